@@ -19,6 +19,7 @@
 #include <libcgroup/log.h>
 #include <libcgroup/tools.h>
 #include <libcgroup/systemd.h>
+#include <libcgroup/monitor.h>
 
 #undef _LIBCGROUP_H_INSIDE
 
@@ -38,6 +39,9 @@
  * -# @ref group_tasks "Manipulation with tasks"
  * -# @ref group_config "Configuration"
  * -# @ref group_errors "Error Handling"
+ *
+ * C++ programs can use the header-only interface of libcgroup.hpp, which
+ * wraps the groups and the iterators into RAII types and ranges.
  */
 
 #endif /* _LIBCGROUP_H  */
@@ -0,0 +1,681 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * C++17 interface of libcgroup
+ *
+ * A header-only layer over the C API: the groups, the pid lists and the
+ * iterators are move-only types which release their resources when they go
+ * out of scope, the iterators are ranges usable in a range-based for loop,
+ * and the names and values are returned as std::string_view pointing into
+ * the buffers of the library, so that reading them copies nothing.
+ *
+ * Errors are thrown as libcgroup::Error, holding the libcgroup error number.
+ * The end of an iterator (#ECGEOF) is not an error.
+ *
+ * @code
+ * libcgroup::Cgroup cg("mygroup");
+ *
+ * cg.add_controller(libcgroup::controllers::cpu).set("cpu.weight", "200");
+ * cg.modify();
+ *
+ * for (const auto &stat : libcgroup::Stats("cpu", "mygroup"))
+ *	std::cout << stat.name << " = " << stat.value << "\n";
+ * @endcode
+ */
+
+#ifndef _LIBCGROUP_HPP
+#define _LIBCGROUP_HPP
+
+#if __cplusplus < 201703L
+#error "<libcgroup.hpp> requires C++17 or later."
+#endif
+
+#include <libcgroup.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string_view>
+#include <utility>
+
+#if __cplusplus >= 202002L
+#include <span>
+#endif
+
+namespace libcgroup {
+
+/**
+ * Error returned by a function of libcgroup.
+ */
+class Error : public std::runtime_error {
+public:
+	explicit Error(int code) : std::runtime_error(cgroup_strerror(code)), code_(code) { }
+
+	/** The libcgroup error number, e.g. #ECGROUPNOTEXIST. */
+	int code() const noexcept { return code_; }
+
+private:
+	int code_;
+};
+
+/**
+ * Name of a controller, usable as a compile-time constant.
+ */
+class ControllerId {
+public:
+	constexpr explicit ControllerId(const char *name) noexcept : name_(name) { }
+
+	constexpr std::string_view name() const noexcept { return name_; }
+	constexpr operator const char *() const noexcept { return name_; }
+
+private:
+	const char *name_;
+};
+
+/**
+ * The controllers known to the kernel.
+ */
+namespace controllers {
+inline constexpr ControllerId blkio{"blkio"};
+inline constexpr ControllerId cpu{"cpu"};
+inline constexpr ControllerId cpuacct{"cpuacct"};
+inline constexpr ControllerId cpuset{"cpuset"};
+inline constexpr ControllerId devices{"devices"};
+inline constexpr ControllerId freezer{"freezer"};
+inline constexpr ControllerId hugetlb{"hugetlb"};
+inline constexpr ControllerId io{"io"};
+inline constexpr ControllerId memory{"memory"};
+inline constexpr ControllerId misc{"misc"};
+inline constexpr ControllerId net_cls{"net_cls"};
+inline constexpr ControllerId net_prio{"net_prio"};
+inline constexpr ControllerId perf_event{"perf_event"};
+inline constexpr ControllerId pids{"pids"};
+inline constexpr ControllerId rdma{"rdma"};
+} /* namespace controllers */
+
+/**
+ * A name and its value, e.g. a parameter of a controller or a line of a
+ * stats file.  The views point into the buffers of the library, see the
+ * range they come from for how long they are valid.
+ */
+struct Value {
+	std::string_view name;
+	std::string_view value;
+};
+
+/**
+ * A group or a file found by a Walk, see #cgroup_file_info.
+ */
+struct FileInfo {
+	enum cgroup_file_type type;
+	std::string_view path;
+	std::string_view parent;
+	std::string_view full_path;
+	int depth;
+};
+
+namespace detail {
+
+inline void check(int ret)
+{
+	if (ret)
+		throw Error(ret);
+}
+
+inline std::string_view view(const char *str) noexcept
+{
+	return str ? std::string_view(str) : std::string_view();
+}
+
+/* The values read from the files keep their newline */
+inline std::string_view chomp(const char *str) noexcept
+{
+	std::string_view sv(str);
+
+	if (!sv.empty() && sv.back() == '\n')
+		sv.remove_suffix(1);
+
+	return sv;
+}
+
+/*
+ * Input iterator over a range reading its elements one at a time: the range
+ * holds the current element, returned by current(), and advance() reads the
+ * next one and returns false at the end.
+ */
+template <typename Range>
+class ReadIterator {
+public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type = typename Range::value_type;
+	using difference_type = std::ptrdiff_t;
+	using pointer = void;
+	using reference = value_type;
+
+	ReadIterator() noexcept = default;
+	explicit ReadIterator(Range *range) noexcept : range_(range) { }
+
+	value_type operator*() const { return range_->current(); }
+
+	ReadIterator &operator++()
+	{
+		if (!range_->advance())
+			range_ = nullptr;
+
+		return *this;
+	}
+
+	void operator++(int) { ++*this; }
+
+	bool operator==(const ReadIterator &other) const noexcept
+	{
+		return range_ == other.range_;
+	}
+
+	bool operator!=(const ReadIterator &other) const noexcept { return !(*this == other); }
+
+private:
+	Range *range_ = nullptr;
+};
+
+/* Iterator over a range whose elements are read by index with at() */
+template <typename Range>
+class IndexIterator {
+public:
+	using iterator_category = std::input_iterator_tag;
+	using value_type = typename Range::value_type;
+	using difference_type = std::ptrdiff_t;
+	using pointer = void;
+	using reference = value_type;
+
+	IndexIterator() noexcept = default;
+	IndexIterator(const Range *range, int index) noexcept : range_(range), index_(index) { }
+
+	value_type operator*() const { return range_->at(index_); }
+
+	IndexIterator &operator++() noexcept
+	{
+		index_++;
+		return *this;
+	}
+
+	void operator++(int) noexcept { index_++; }
+
+	bool operator==(const IndexIterator &other) const noexcept
+	{
+		return index_ == other.index_;
+	}
+
+	bool operator!=(const IndexIterator &other) const noexcept { return !(*this == other); }
+
+private:
+	const Range *range_ = nullptr;
+	int index_ = 0;
+};
+
+/* Ends a tree walk, for the handle owned by a Walk */
+struct WalkEnd {
+	void operator()(void *handle) const noexcept { cgroup_walk_tree_end(&handle); }
+};
+
+} /* namespace detail */
+
+/**
+ * The parameters of a controller, as name and value pairs.  The views are
+ * valid until the parameter is set again or the group is freed.
+ */
+class Values {
+public:
+	using value_type = Value;
+	using iterator = detail::IndexIterator<Values>;
+
+	explicit Values(struct cgroup_controller *cgc) noexcept : cgc_(cgc) { }
+
+	int size() const noexcept
+	{
+		int count = cgroup_get_value_name_count(cgc_);
+
+		return count > 0 ? count : 0;
+	}
+
+	Value at(int index) const
+	{
+		const char *name, *value;
+
+		detail::check(cgroup_peek_value(cgc_, index, &name, &value));
+
+		return Value{name, value};
+	}
+
+	iterator begin() const noexcept { return iterator(this, 0); }
+	iterator end() const noexcept { return iterator(this, size()); }
+
+private:
+	struct cgroup_controller *cgc_;
+};
+
+/**
+ * A controller of a Cgroup, owned by the group.
+ */
+class Controller {
+public:
+	Controller() noexcept = default;
+	explicit Controller(struct cgroup_controller *cgc) noexcept : cgc_(cgc) { }
+
+	/** False for a controller which was not found. */
+	explicit operator bool() const noexcept { return cgc_ != nullptr; }
+
+	struct cgroup_controller *get() const noexcept { return cgc_; }
+
+	std::string_view name() const { return detail::view(cgroup_get_controller_name(cgc_)); }
+
+	/**
+	 * The value of a parameter, valid until the parameter is set again or
+	 * the group is freed.
+	 */
+	std::string_view value(const char *name) const
+	{
+		const char *value;
+
+		detail::check(cgroup_peek_value_string(cgc_, name, &value));
+
+		return value;
+	}
+
+	/** Set a parameter, it is added if the controller does not have it. */
+	Controller &set(const char *name, const char *value)
+	{
+		int ret;
+
+		ret = cgroup_set_value_string(cgc_, name, value);
+		if (ret == ECGROUPVALUENOTEXIST)
+			ret = cgroup_add_value_string(cgc_, name, value);
+		detail::check(ret);
+
+		return *this;
+	}
+
+	Values values() const noexcept { return Values(cgc_); }
+
+private:
+	struct cgroup_controller *cgc_ = nullptr;
+};
+
+/**
+ * The controllers of a Cgroup.
+ */
+class Controllers {
+public:
+	using value_type = Controller;
+	using iterator = detail::IndexIterator<Controllers>;
+
+	explicit Controllers(struct cgroup *cg) noexcept : cg_(cg) { }
+
+	int size() const noexcept
+	{
+		int count = cgroup_get_controller_count(cg_);
+
+		return count > 0 ? count : 0;
+	}
+
+	Controller at(int index) const noexcept
+	{
+		return Controller(cgroup_get_controller_by_index(cg_, index));
+	}
+
+	iterator begin() const noexcept { return iterator(this, 0); }
+	iterator end() const noexcept { return iterator(this, size()); }
+
+private:
+	struct cgroup *cg_;
+};
+
+/**
+ * A control group, freed with cgroup_free() when it goes out of scope.
+ */
+class Cgroup {
+public:
+	explicit Cgroup(const char *name) : cg_(cgroup_new_cgroup(name))
+	{
+		if (!cg_)
+			throw std::bad_alloc();
+	}
+
+	/** Take the ownership of a group allocated by the C API. */
+	explicit Cgroup(struct cgroup *cg) noexcept : cg_(cg) { }
+
+	Cgroup(const Cgroup &) = delete;
+	Cgroup &operator=(const Cgroup &) = delete;
+
+	Cgroup(Cgroup &&other) noexcept : cg_(std::exchange(other.cg_, nullptr)) { }
+
+	Cgroup &operator=(Cgroup &&other) noexcept
+	{
+		if (this != &other) {
+			cgroup_free(&cg_);
+			cg_ = std::exchange(other.cg_, nullptr);
+		}
+
+		return *this;
+	}
+
+	~Cgroup() { cgroup_free(&cg_); }
+
+	struct cgroup *get() const noexcept { return cg_; }
+
+	/** Give the group back to the caller, who frees it with cgroup_free(). */
+	struct cgroup *release() noexcept { return std::exchange(cg_, nullptr); }
+
+	std::string_view name() const { return detail::view(cgroup_get_cgroup_name(cg_)); }
+
+	Controller add_controller(const char *name)
+	{
+		struct cgroup_controller *cgc = cgroup_add_controller(cg_, name);
+
+		if (!cgc)
+			throw Error(ECGINVAL);
+
+		return Controller(cgc);
+	}
+
+	/** The controller of that name, an empty Controller if not found. */
+	Controller controller(const char *name) const noexcept
+	{
+		return Controller(cgroup_get_controller(cg_, name));
+	}
+
+	Controllers controllers() const noexcept { return Controllers(cg_); }
+
+	/** Read the group from the kernel, see cgroup_get_cgroup(). */
+	void read() { detail::check(cgroup_get_cgroup(cg_)); }
+
+	void create(bool ignore_ownership = false)
+	{
+		detail::check(cgroup_create_cgroup(cg_, ignore_ownership));
+	}
+
+	void modify() { detail::check(cgroup_modify_cgroup(cg_)); }
+
+	/** Remove the group, flags are #cgroup_delete_flag flags. */
+	void remove(int flags = 0) { detail::check(cgroup_delete_cgroup_ext(cg_, flags)); }
+
+private:
+	struct cgroup *cg_;
+};
+
+/**
+ * Walk through the groups below a group, see cgroup_walk_tree_begin().
+ * The walk is a single pass range, its views are valid until the next
+ * element is read.
+ *
+ * @code
+ * for (const auto &info : libcgroup::Walk("cpu", "/", 0, CGROUP_WALK_TYPE_DIRS_ONLY))
+ *	std::cout << info.full_path << "\n";
+ * @endcode
+ */
+class Walk {
+public:
+	using value_type = FileInfo;
+	using iterator = detail::ReadIterator<Walk>;
+
+	/**
+	 * @param flags #cgroup_walk_type flags, 0 for the default pre-order
+	 *	walk.
+	 */
+	Walk(const char *controller, const char *base_path, int depth = 0, int flags = 0)
+		: depth_(depth)
+	{
+		void *handle = nullptr;
+		int ret;
+
+		ret = cgroup_walk_tree_begin(controller, base_path, depth, &handle, &info_,
+					     &base_level_);
+		/* Owned by handle_ before anything throws, the destructor would not run */
+		handle_.reset(handle);
+		if (ret == ECGEOF)
+			return;
+		detail::check(ret);
+
+		if (flags)
+			detail::check(cgroup_walk_tree_set_flags(&handle, flags));
+
+		/* In post-order the root is returned again at the end */
+		valid_ = !(flags & CGROUP_WALK_TYPE_POST_DIR) || advance();
+	}
+
+	Walk(const Walk &) = delete;
+	Walk &operator=(const Walk &) = delete;
+
+	Walk(Walk &&other) noexcept
+		: handle_(std::move(other.handle_)), info_(other.info_),
+		  base_level_(other.base_level_), depth_(other.depth_),
+		  valid_(std::exchange(other.valid_, false)) { }
+
+	Walk &operator=(Walk &&other) noexcept
+	{
+		if (this != &other) {
+			handle_ = std::move(other.handle_);
+			info_ = other.info_;
+			base_level_ = other.base_level_;
+			depth_ = other.depth_;
+			valid_ = std::exchange(other.valid_, false);
+		}
+
+		return *this;
+	}
+
+	iterator begin() noexcept { return iterator(valid_ ? this : nullptr); }
+	iterator end() noexcept { return iterator(); }
+
+	FileInfo current() const noexcept
+	{
+		return FileInfo{info_.type, detail::view(info_.path), detail::view(info_.parent),
+				detail::view(info_.full_path), info_.depth};
+	}
+
+	bool advance()
+	{
+		void *handle = handle_.get();
+		int ret;
+
+		ret = cgroup_walk_tree_next(depth_, &handle, &info_, base_level_);
+		valid_ = ret == 0;
+		if (ret != ECGEOF)
+			detail::check(ret);
+
+		return valid_;
+	}
+
+	/**
+	 * Descriptor of the directory last returned by a walk with
+	 * #CGROUP_WALK_TYPE_DIRS_ONLY, see cgroup_walk_tree_get_dirfd().
+	 */
+	int dirfd()
+	{
+		void *handle = handle_.get();
+		int fd;
+
+		detail::check(cgroup_walk_tree_get_dirfd(&handle, &fd));
+
+		return fd;
+	}
+
+private:
+	std::unique_ptr<void, detail::WalkEnd> handle_;
+	struct cgroup_file_info info_ = { };
+	int base_level_ = 0;
+	int depth_;
+	bool valid_ = false;
+};
+
+/**
+ * The lines of the stats file of a controller, see
+ * cgroup_read_stats_begin().  The file is kept open, rewind() reads it
+ * again, e.g. to poll it.  The views are valid until the next line is
+ * read, the values have no newline.
+ *
+ * @code
+ * libcgroup::Stats stats("cpu", "mygroup");
+ *
+ * for (;;) {
+ *	for (const auto &stat : stats)
+ *		std::cout << stat.name << " = " << stat.value << "\n";
+ *	sleep(1);
+ *	stats.rewind();
+ * }
+ * @endcode
+ */
+class Stats {
+public:
+	using value_type = Value;
+	using iterator = detail::ReadIterator<Stats>;
+
+	Stats(const char *controller, const char *path)
+	{
+		int ret;
+
+		ret = cgroup_read_stats_begin(controller, path, &handle_, &stat_);
+		if (ret && ret != ECGEOF) {
+			close();
+			throw Error(ret);
+		}
+		valid_ = ret == 0;
+	}
+
+	Stats(const Stats &) = delete;
+	Stats &operator=(const Stats &) = delete;
+
+	Stats(Stats &&other) noexcept
+		: handle_(std::exchange(other.handle_, nullptr)), stat_(other.stat_),
+		  valid_(std::exchange(other.valid_, false)) { }
+
+	Stats &operator=(Stats &&other) noexcept
+	{
+		if (this != &other) {
+			close();
+			handle_ = std::exchange(other.handle_, nullptr);
+			stat_ = other.stat_;
+			valid_ = std::exchange(other.valid_, false);
+		}
+
+		return *this;
+	}
+
+	~Stats() { close(); }
+
+	iterator begin() noexcept { return iterator(valid_ ? this : nullptr); }
+	iterator end() noexcept { return iterator(); }
+
+	Value current() const noexcept
+	{
+		return Value{stat_.name, detail::chomp(stat_.value)};
+	}
+
+	bool advance()
+	{
+		int ret;
+
+		ret = cgroup_read_stats_next(&handle_, &stat_);
+		valid_ = ret == 0;
+		if (ret != ECGEOF)
+			detail::check(ret);
+
+		return valid_;
+	}
+
+	/** Read the file again from its start, see cgroup_read_stats_rewind(). */
+	void rewind()
+	{
+		int ret;
+
+		ret = cgroup_read_stats_rewind(&handle_, &stat_);
+		valid_ = ret == 0;
+		if (ret != ECGEOF)
+			detail::check(ret);
+	}
+
+private:
+	void close() noexcept
+	{
+		if (handle_)
+			cgroup_read_stats_end(&handle_);
+	}
+
+	void *handle_ = nullptr;
+	struct cgroup_stat stat_ = { };
+	bool valid_ = false;
+};
+
+/**
+ * The processes or threads of a group, see cgroup_get_pids().  The buffer is
+ * kept from one read() to the next, reading the groups one after the other
+ * only allocates when a group has more pids than the ones before.
+ */
+class Pids {
+public:
+	using value_type = pid_t;
+	using iterator = const pid_t *;
+
+	Pids() noexcept = default;
+
+	Pids(const Pids &) = delete;
+	Pids &operator=(const Pids &) = delete;
+
+	Pids(Pids &&other) noexcept
+		: pids_(std::exchange(other.pids_, nullptr)), alloc_(std::exchange(other.alloc_, 0)),
+		  size_(std::exchange(other.size_, 0)) { }
+
+	Pids &operator=(Pids &&other) noexcept
+	{
+		if (this != &other) {
+			free(pids_);
+			pids_ = std::exchange(other.pids_, nullptr);
+			alloc_ = std::exchange(other.alloc_, 0);
+			size_ = std::exchange(other.size_, 0);
+		}
+
+		return *this;
+	}
+
+	~Pids() { free(pids_); }
+
+	/**
+	 * @param controller The name of the controller, NULL for cgroup v2.
+	 * @param flags #cgroup_get_pids_flag flags.
+	 */
+	Pids &read(const char *name, const char *controller = nullptr, int flags = 0)
+	{
+		int ret;
+
+		ret = cgroup_get_pids(name, controller, flags, &pids_, &alloc_, &size_);
+		if (ret) {
+			size_ = 0;
+			throw Error(ret);
+		}
+
+		return *this;
+	}
+
+	const pid_t *data() const noexcept { return pids_; }
+	std::size_t size() const noexcept { return size_; }
+	bool empty() const noexcept { return size_ == 0; }
+	pid_t operator[](std::size_t index) const noexcept { return pids_[index]; }
+
+	iterator begin() const noexcept { return pids_; }
+	iterator end() const noexcept { return pids_ + size_; }
+
+#if __cplusplus >= 202002L
+	std::span<const pid_t> span() const noexcept { return {pids_, size()}; }
+#endif
+
+private:
+	pid_t *pids_ = nullptr;
+	int alloc_ = 0;
+	int size_ = 0;
+};
+
+} /* namespace libcgroup */
+
+#endif /* _LIBCGROUP_HPP */
@@ -36,6 +36,19 @@ extern "C" {
  */
 int cgroup_config_load_config(const char *pathname);
 
+/**
+ * Apply a configuration file to the control groups that already exist,
+ * without tearing them down.  The hierarchies that are not mounted yet are
+ * mounted, the missing groups are created, and only the settings, owners and
+ * permissions that differ from the live groups are written, so the tasks of
+ * the groups are not disturbed.  The groups that are not in the file are left
+ * as they are.  Unlike cgroup_config_load_config(), nothing is undone if a
+ * group cannot be updated: the other groups are still reloaded and the first
+ * error is returned.
+ * @param pathname Name of the configuration file to load.
+ */
+int cgroup_config_reload_config(const char *pathname);
+
 /**
  * Delete all control groups and unmount all hierarchies.
  */
@@ -76,6 +89,31 @@ int cgroup_config_unload_config(const char *pathname, int flags);
  */
 int cgroup_config_set_default(struct cgroup *new_default);
 
+/**
+ * Sets the number of threads creating the groups in subsequent
+ * cgroup_config_load_config() calls.  A group is created only once its
+ * parent group from the configuration is, the other groups are created
+ * concurrently.  The default is 1, the groups are then created one by one in
+ * the order of the configuration.
+ *
+ * @param jobs Number of threads, at least 1.
+ * @return 0 on success, #ECGINVAL if jobs is less than 1.
+ */
+int cgroup_config_set_jobs(int jobs);
+
+/**
+ * Sets whether subsequent cgroup_config_load_config() calls write the values
+ * of the groups with io_uring.  The values of a group are then written in a
+ * few batches of requests instead of a few system calls each, in the same
+ * order.  When the kernel does not allow io_uring, the values are silently
+ * written the usual way.
+ *
+ * @param enable Whether to use io_uring.
+ * @return 0 on success, #ECGROUPUNSUPP if libcgroup was built without
+ *	io_uring support and enable is set.
+ */
+int cgroup_config_set_io_uring(int enable);
+
 /**
  * Initializes the templates cache and load it from file pathname.
  */
@@ -30,6 +30,23 @@ enum cg_setup_mode_t {
 	CGROUP_MODE_UNIFIED,
 };
 
+/**
+ * Flags for cgroup_get_pids().
+ */
+enum cgroup_get_pids_flag {
+	/**
+	 * Return the pids in the order the kernel lists them, without sorting
+	 * them.
+	 */
+	CGFLAG_PIDS_UNSORTED = 1,
+
+	/**
+	 * List the threads of the group (cgroup.threads on cgroup v2, tasks on
+	 * cgroup v1) instead of its processes.
+	 */
+	CGFLAG_PIDS_THREADS = 2,
+};
+
 /**
  * Flags for cgroup_delete_cgroup_ext().
  */
@@ -50,6 +67,27 @@ enum cgroup_delete_flag {
 	 * CGFLAG_DELETE_RECURSIVE.
 	 */
 	CGFLAG_DELETE_EMPTY_ONLY = 4,
+
+	/**
+	 * Kill the processes of the group and of its subgroups through
+	 * cgroup.kill instead of moving them to the parent group.  It is only
+	 * available on cgroup v2, with a kernel providing cgroup.kill,
+	 * elsewhere the processes are moved as without this flag.  The root
+	 * group is never killed.  As cgroup.kill also kills the processes of
+	 * the subgroups, this flag requires CGFLAG_DELETE_RECURSIVE.
+	 */
+	CGFLAG_DELETE_KILL = 8,
+};
+
+/**
+ * Flags for cgroup_txn_commit().
+ */
+enum cgroup_txn_flag {
+	/**
+	 * Stop at the first failed operation and undo the operations done
+	 * before it, as far as possible.
+	 */
+	CGFLAG_TXN_ROLLBACK = 1,
 };
 
 /**
@@ -155,6 +193,44 @@ struct cgroup_controller;
  */
 struct cgroup *cgroup_new_cgroup(const char *name);
 
+/**
+ * Arena the cgroups created by cgroup_new_cgroup_arena() take their memory
+ * from.  The structure is opaque to applications.
+ */
+struct cgroup_arena;
+
+/**
+ * Allocate a new, empty arena.  An arena may be used by one thread at a time.
+ * @returns The arena or NULL on error.
+ */
+struct cgroup_arena *cgroup_arena_new(void);
+
+/**
+ * Allocate new cgroup structure in an arena.  The group, its controllers and
+ * their values are all allocated from @c arena, there is no need to free
+ * them one by one: cgroup_free() only forgets the group, the memory is
+ * released by cgroup_arena_reset().
+ *
+ * @param name Path to the group, see cgroup_new_cgroup().
+ * @param arena The arena.
+ * @returns Created group or NULL on error.
+ */
+struct cgroup *cgroup_new_cgroup_arena(const char *name, struct cgroup_arena *arena);
+
+/**
+ * Release at once all the cgroups allocated from an arena.  The arena keeps
+ * part of its memory to serve the next groups without new allocations.  The
+ * groups of the arena must not be used anymore.
+ * @param arena The arena.
+ */
+void cgroup_arena_reset(struct cgroup_arena *arena);
+
+/**
+ * Free an arena and all the cgroups allocated from it.
+ * @param arena The arena, set to NULL.
+ */
+void cgroup_arena_free(struct cgroup_arena **arena);
+
 /**
  * Attach new controller to cgroup. This function just modifies internal
  * libcgroup structure, not the kernel control group.
@@ -251,7 +327,10 @@ int cgroup_create_cgroup_from_parent(struct cgroup *cgroup,
 
 /**
  * Physically modify a control group in kernel. All parameters added by
- * cgroup_add_value_ or cgroup_set_value_ are written.
+ * cgroup_add_value_ or cgroup_set_value_ are written.  A parameter set by
+ * cgroup_set_value_ to the value last read by cgroup_get_cgroup() or
+ * written by this function is not written again.  The settings that depend
+ * on others, like cpuset.cpus.partition on cpuset.cpus, are written last.
  * Currently it's not possible to change and owner of a group.
  *
  * @param cgroup
@@ -282,6 +361,7 @@ int cgroup_delete_cgroup(struct cgroup *cgroup, int ignore_migration);
  * #CGFLAG_DELETE_RECURSIVE flag specifies that all subgroups should be removed
  * too. If root group is being removed with this flag specified, all subgroups
  * are removed but the root group itself is left undeleted.
+ * #CGFLAG_DELETE_KILL flag kills the processes instead of moving them.
  * @see cgroup_delete_flag.
  *
  * @param cgroup
@@ -319,6 +399,61 @@ int cgroup_delete_cgroup_ext(struct cgroup *cgroup, int flags);
  */
 int cgroup_get_cgroup(struct cgroup *cgroup);
 
+/**
+ * Read from kernel only the settings already present in the group.  Unlike
+ * cgroup_get_cgroup(), the controller directories are not listed: only the
+ * values added to the controllers of @c cgroup, e.g. by
+ * cgroup_add_value_string() with an empty value, are read and replaced.  The
+ * cost thus scales with the number of requested settings, and large files
+ * like memory.stat are not read unless they are asked for.
+ * @code
+ * struct cgroup *cg = cgroup_new_cgroup("foo");
+ * struct cgroup_controller *mem = cgroup_add_controller(cg, "memory");
+ * cgroup_add_value_string(mem, "memory.max", NULL);
+ * cgroup_get_cgroup_selective(cg);
+ * @endcode
+ *
+ * @param cgroup The cgroup to load, with the settings to read.  Controllers
+ *	without settings are left empty.
+ * @retval #ECGROUPVALUENOTEXIST if a setting does not exist.  The settings
+ *	before it are already read.
+ */
+int cgroup_get_cgroup_selective(struct cgroup *cgroup);
+
+/**
+ * One control file to be read by cgroup_read_values_batch().
+ */
+struct cgroup_batch_value {
+	/** Name of the group. */
+	const char *cgroup;
+	/** Name of the controller, NULL for the cgroup v2 core files. */
+	const char *controller;
+	/** Name of the control file, e.g. "memory.current". */
+	const char *file;
+	/** Buffer for the value, provided by the caller. */
+	char *buf;
+	/** Size of @c buf. */
+	size_t buf_len;
+	/** Filled with the length of the value, without the trailing newline. */
+	size_t len;
+	/** Filled with 0 on success, or with the error code of this file. */
+	int err;
+};
+
+/**
+ * Read many control files, possibly of many groups, in one call. Unlike
+ * cgroup_get_cgroup(), only the listed files are read. The values are
+ * stored null terminated into the buffers of the entries, truncated if
+ * they do not fit. List the files of one group next to each other, the
+ * path of a group is then built only once.
+ *
+ * @param values The files to read.
+ * @param count Number of entries of @c values.
+ * @return 0 if all the files were read, otherwise the error code of the
+ *	first file that failed. The error of each file is in its @c err.
+ */
+int cgroup_read_values_batch(struct cgroup_batch_value *values, int count);
+
 /**
  * Copy all controllers, their parameters and values. Group name, permissions
  * and ownerships are not copied. All existing controllers
@@ -552,6 +687,124 @@ int cgroup_set_value_uint64(struct cgroup_controller *controller,
 int cgroup_set_value_bool(struct cgroup_controller *controller,
 			  const char *name, bool value);
 
+/**
+ * Set of CPUs or memory nodes, as found in cpuset.cpus and cpuset.mems.
+ * The set is a bitmap that grows with the highest member.
+ */
+struct cgroup_cpuset;
+
+/**
+ * Allocate an empty set.
+ * @return The set, NULL if the allocation failed.
+ */
+struct cgroup_cpuset *cgroup_cpuset_new(void);
+
+/**
+ * Release a set allocated by cgroup_cpuset_new(), and set it to NULL.
+ * @param set The set
+ */
+void cgroup_cpuset_free(struct cgroup_cpuset **set);
+
+/**
+ * Replace the members of a set with a list of ranges like "0-63,128-191".
+ * An empty list, or a list ended by a newline, is accepted.
+ * @param set The set
+ * @param list The list of ranges
+ * @return 0 on success, ECGINVAL if the list is malformed, ECGOTHER if an
+ * allocation failed.
+ */
+int cgroup_cpuset_parse(struct cgroup_cpuset *set, const char *list);
+
+/**
+ * Write the members of a set as a list of ranges, the way the kernel does.
+ * @param set The set
+ * @param buf The buffer to write the list to
+ * @param size The size of buf
+ * @return 0 on success, ECGINVAL if buf is too small.
+ */
+int cgroup_cpuset_format(const struct cgroup_cpuset *set, char *buf, size_t size);
+
+/**
+ * Remove all the members of a set.
+ * @param set The set
+ */
+void cgroup_cpuset_zero(struct cgroup_cpuset *set);
+
+/**
+ * Add a CPU or memory node to a set.
+ * @param set The set
+ * @param cpu The CPU or node
+ * @return 0 on success, ECGOTHER if an allocation failed.
+ */
+int cgroup_cpuset_set(struct cgroup_cpuset *set, unsigned int cpu);
+
+/**
+ * Tell whether a CPU or memory node is a member of a set.
+ * @param set The set
+ * @param cpu The CPU or node
+ */
+bool cgroup_cpuset_isset(const struct cgroup_cpuset *set, unsigned int cpu);
+
+/**
+ * Return the number of members of a set.
+ * @param set The set
+ */
+unsigned int cgroup_cpuset_count(const struct cgroup_cpuset *set);
+
+/**
+ * Store the intersection of two sets.  dst may be a or b.
+ * @param dst The set receiving the intersection
+ * @param a, b The sets
+ * @return 0 on success, ECGOTHER if an allocation failed.
+ */
+int cgroup_cpuset_and(struct cgroup_cpuset *dst, const struct cgroup_cpuset *a,
+		      const struct cgroup_cpuset *b);
+
+/**
+ * Store the union of two sets.  dst may be a or b.
+ * @param dst The set receiving the union
+ * @param a, b The sets
+ * @return 0 on success, ECGOTHER if an allocation failed.
+ */
+int cgroup_cpuset_or(struct cgroup_cpuset *dst, const struct cgroup_cpuset *a,
+		     const struct cgroup_cpuset *b);
+
+/**
+ * Tell whether two sets have a member in common, e.g. whether two cpuset
+ * partitions overlap.
+ * @param a, b The sets
+ */
+bool cgroup_cpuset_intersects(const struct cgroup_cpuset *a, const struct cgroup_cpuset *b);
+
+/**
+ * Tell whether two sets have the same members.
+ * @param a, b The sets
+ */
+bool cgroup_cpuset_equal(const struct cgroup_cpuset *a, const struct cgroup_cpuset *b);
+
+/**
+ * Read a list of CPUs or memory nodes, like cpuset.cpus.effective, from
+ * @c libcgroup internal structures.
+ * Use @c cgroup_get_cgroup() to fill these structures with data from kernel.
+ *
+ * @param controller
+ * @param name The name of the parameter.
+ * @param set The set receiving the members of the list.
+ */
+int cgroup_get_value_cpuset(struct cgroup_controller *controller,
+			    const char *name, struct cgroup_cpuset *set);
+
+/**
+ * Set a list of CPUs or memory nodes in @c libcgroup internal structures.
+ * Use cgroup_modify_cgroup() or cgroup_create_cgroup() to write it to kernel.
+ *
+ * @param controller
+ * @param name The name of the parameter.
+ * @param set The members of the list.
+ */
+int cgroup_set_value_cpuset(struct cgroup_controller *controller,
+			    const char *name, const struct cgroup_cpuset *set);
+
 /**
  * Return the number of variables for the specified controller in @c libcgroup
  * internal structures. Use cgroup_get_cgroup() to fill these structures with
@@ -577,6 +830,41 @@ int cgroup_get_value_name_count(struct cgroup_controller *controller);
  */
 char *cgroup_get_value_name(struct cgroup_controller *controller, int index);
 
+/**
+ * Return the name and the value of the parameter of controller at given
+ * index, without copying them.
+ *
+ * @note The returned strings point to internal @c libcgroup structures, do
+ * not free them.  They are valid until the value is set again or the group
+ * is freed.
+ *
+ * @param controller
+ * @param index The index of the parameter, from 0 to
+ *	cgroup_get_value_name_count()-1.
+ * @param name The name of the parameter, may be NULL.
+ * @param value The value of the parameter, may be NULL.
+ * @return 0 on success, #ECGINVAL if the index is out of range.
+ */
+int cgroup_peek_value(struct cgroup_controller *controller, int index, const char **name,
+		      const char **value);
+
+/**
+ * Read a parameter value from @c libcgroup internal structures without
+ * copying it, unlike cgroup_get_value_string().
+ *
+ * @note The returned value points to internal @c libcgroup structures, do
+ * not free it.  It is valid until the value is set again or the group is
+ * freed.
+ *
+ * @param controller
+ * @param name The name of the parameter.
+ * @param value The value of the parameter.
+ * @return 0 on success, #ECGROUPVALUENOTEXIST if the controller has no such
+ *	parameter.
+ */
+int cgroup_peek_value_string(struct cgroup_controller *controller, const char *name,
+			     const char **value);
+
 /**
  * Get the list of process in a cgroup. This list is guaranteed to
  * be sorted. It is not necessary that it is unique.
@@ -588,6 +876,35 @@ char *cgroup_get_value_name(struct cgroup_controller *controller, int index);
  */
 int cgroup_get_procs(char *name, char *controller, pid_t **pids, int *size);
 
+/**
+ * Get the list of threads in a cgroup, from cgroup.threads on cgroup v2 and
+ * from tasks on cgroup v1.  This list is guaranteed to be sorted.
+ * @param name The name of the cgroup
+ * @param controller The name of the controller, NULL for cgroup v2
+ * @param pids The list of thread ids, to be freed by the caller using free.
+ * @param size The size of the pids array returned by the API.
+ */
+int cgroup_get_threads(const char *name, const char *controller, pid_t **pids, int *size);
+
+/**
+ * Get the list of processes or threads in a cgroup into a buffer which can
+ * be reused from one call to the next, e.g. by a monitor listing many
+ * groups.  It is not necessary that the list is unique.
+ * @param name The name of the cgroup
+ * @param controller The name of the controller, NULL for cgroup v2
+ * @param flags Combination of #cgroup_get_pids_flag flags.
+ * @param pids The buffer of pids, NULL to allocate a new one.  It grows with
+ *	realloc() as needed, and must be freed by the caller using free, even
+ *	when an error is returned.
+ * @param alloc The number of pids the buffer can hold, 0 for a new buffer.
+ *	Updated when the buffer grows.
+ * @param size Set to the number of pids read.
+ * @return 0 on success, #ECGROUPUNSUPP if the file does not exist, or an
+ *	error number.
+ */
+int cgroup_get_pids(const char *name, const char *controller, int flags, pid_t **pids,
+		    int *alloc, int *size);
+
 /**
  * Change permission of files and directories of given group
  * @param cgroup The cgroup which permissions should be changed
@@ -622,6 +939,26 @@ int cgroup_convert_cgroup(struct cgroup * const out_cgroup,
 			  const struct cgroup * const in_cgroup,
 			  enum cg_version_t in_version);
 
+/**
+ * Convert a cgroup from one cgroup version to another version in place.
+ * The settings which only change their name between the versions, e.g.
+ * cpuset.effective_cpus and cpuset.cpus.effective, are renamed without
+ * allocating a second cgroup.  If some setting must be computed, e.g.
+ * cpu.max from cpu.cfs_quota_us and cpu.cfs_period_us, the cgroup is
+ * converted as by cgroup_convert_cgroup() and its controllers are replaced.
+ *
+ * @param cgroup The cgroup to convert
+ * @param out_version Destination cgroup version
+ * @param in_version Source cgroup version, only used if set to v1 or v2
+ *
+ * @return 0 on success
+ *         ECGNOVERSIONCONVERT some settings cannot be converted, the others were
+ *         ECGFAIL conversion failed, the cgroup is unchanged
+ */
+int cgroup_convert_cgroup_inplace(struct cgroup * const cgroup,
+				  enum cg_version_t out_version,
+				  enum cg_version_t in_version);
+
 /**
  * List the mount paths, that matches the specified version
  *
@@ -693,6 +1030,83 @@ bool is_cgroup_mode_hybrid(void);
  */
 bool is_cgroup_mode_unified(void);
 
+/**
+ * Set of operations on many groups, planned and run together by
+ * cgroup_txn_commit().
+ */
+struct cgroup_txn;
+
+/**
+ * Start an empty transaction.
+ * @return The transaction, NULL if the allocation failed.
+ */
+struct cgroup_txn *cgroup_txn_begin(void);
+
+/**
+ * Add the creation of a group to a transaction, see cgroup_create_cgroup().
+ * The group is only used by cgroup_txn_commit(), it must not be freed or
+ * changed before.
+ * @param txn The transaction
+ * @param cgroup The group to create
+ * @param ignore_ownership Like for cgroup_create_cgroup()
+ * @return 0 on success, ECGINVAL or ECGOTHER on error.  The operations
+ *	are numbered from 0 in the order they are added, whatever their kind.
+ */
+int cgroup_txn_add_create(struct cgroup_txn *txn, struct cgroup *cgroup, int ignore_ownership);
+
+/**
+ * Add the modification of a group to a transaction, see
+ * cgroup_modify_cgroup().  The group must not be freed or changed before
+ * cgroup_txn_commit().
+ * @param txn The transaction
+ * @param cgroup The group holding the values to write
+ * @return 0 on success, ECGINVAL or ECGOTHER on error.
+ */
+int cgroup_txn_add_modify(struct cgroup_txn *txn, struct cgroup *cgroup);
+
+/**
+ * Add the move of a task to a group to a transaction, see
+ * cgroup_attach_task_pid().  The group must not be freed or changed before
+ * cgroup_txn_commit().
+ * @param txn The transaction
+ * @param cgroup The destination group, NULL for the root groups
+ * @param tid The task
+ * @return 0 on success, ECGINVAL or ECGOTHER on error.
+ */
+int cgroup_txn_add_attach(struct cgroup_txn *txn, struct cgroup *cgroup, pid_t tid);
+
+/**
+ * Run the operations of a transaction.  The groups are created parents
+ * first, so that each ancestor and each cgroup v2 subtree_control file is
+ * handled once, then the groups are modified, then the tasks are moved with
+ * one cgroup_attach_tasks() per group.  Without #CGFLAG_TXN_ROLLBACK, every
+ * operation is tried.  With it, the commit stops at the first failure,
+ * restores the values modified before, and removes the groups it created,
+ * which moves the tasks attached to them to their parent.  A transaction
+ * can only be committed once.
+ * @param txn The transaction
+ * @param flags Combination of #cgroup_txn_flag flags
+ * @return 0 on success, else the error of the first failed operation.
+ */
+int cgroup_txn_commit(struct cgroup_txn *txn, int flags);
+
+/**
+ * Get the result of an operation of a committed transaction.
+ * @param txn The transaction
+ * @param op The number of the operation, from 0 in the order of addition
+ * @return 0 if the operation succeeded, its error if it failed, ECGFAIL if
+ *	it was not run, ECGINVAL if op is out of range.  An operation undone
+ *	by the rollback keeps its result.
+ */
+int cgroup_txn_result(const struct cgroup_txn *txn, int op);
+
+/**
+ * Release a transaction and set it to NULL.  The groups it was given are
+ * not freed.
+ * @param txn The transaction
+ */
+void cgroup_txn_free(struct cgroup_txn **txn);
+
 /**
  * @}
  * @}
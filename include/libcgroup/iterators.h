@@ -98,6 +98,15 @@ enum cgroup_walk_type {
 	 * @endcode
 	 */
 	CGROUP_WALK_TYPE_POST_DIR = 0x2,
+	/**
+	 * Return only the directories, in pre-order unless
+	 * #CGROUP_WALK_TYPE_POST_DIR is set too.  The directories are read
+	 * with getdents64() and the control files are skipped by their type,
+	 * nothing is stat'ed.  cgroup_walk_tree_get_dirfd() gives a file
+	 * descriptor of the directory returned.  This flag must be set before
+	 * the first cgroup_walk_tree_next().
+	 */
+	CGROUP_WALK_TYPE_DIRS_ONLY = 0x4,
 };
 
 /**
@@ -179,6 +188,76 @@ int cgroup_walk_tree_end(void **handle);
  */
 int cgroup_walk_tree_set_flags(void **handle, int flags);
 
+/**
+ * Get a file descriptor of the directory last returned by a walk with
+ * #CGROUP_WALK_TYPE_DIRS_ONLY, e.g. to open its control files with openat().
+ * It is closed by the walk, once the walk leaves the directory.
+ * @param handle The handle of the iterator.
+ * @param dirfd The file descriptor.
+ * @return 0 on success, #ECGINVAL if the walk has no such descriptor.
+ */
+int cgroup_walk_tree_get_dirfd(void **handle, int *dirfd);
+
+/**
+ * Flags of cgroup_walk_tree_parallel().
+ */
+enum cgroup_walk_parallel_flags {
+	/**
+	 * Emit the subgroups of each group sorted by name.  By default they
+	 * are emitted in the order they were read from their directory.
+	 */
+	CGROUP_WALK_PARALLEL_SORTED = 0x1,
+};
+
+/**
+ * Callback called by cgroup_walk_tree_parallel() for each group of the tree.
+ * It is called concurrently by the threads of the walk, in no particular
+ * order.
+ * @param info The group, only valid during the call.
+ * @param userdata The userdata passed to cgroup_walk_tree_parallel().
+ * @param result Set it to a malloc()ed result, to be passed to the emit
+ *	callback.
+ * @return 0 to continue the walk, any other value stops it.
+ */
+typedef int (*cgroup_walk_visit_callback)(const struct cgroup_file_info *info, void *userdata,
+					  void **result);
+
+/**
+ * Callback called by cgroup_walk_tree_parallel() for each group of the tree
+ * once all of them have been visited.  It is called by the thread that
+ * started the walk, in pre-order: a group comes before its subgroups.
+ * @param info The group, only valid during the call.
+ * @param result The result set by the visit callback, owned by the callback.
+ * @param userdata The userdata passed to cgroup_walk_tree_parallel().
+ * @return 0 to continue the walk, any other value stops it.
+ */
+typedef int (*cgroup_walk_emit_callback)(const struct cgroup_file_info *info, void *result,
+					 void *userdata);
+
+/**
+ * Walk through the directory tree of the specified controller with a pool
+ * of threads.  The groups are spread over the threads, an idle thread steals
+ * the pending groups of the others.  It is thus much faster than
+ * cgroup_walk_tree_begin() on large trees, and when the visit of a group is
+ * expensive, e.g. to read all its settings.
+ * @param controller Name of the controller, for which we want to walk
+ *	the directory tree.
+ * @param base_path Begin walking from this path, it is the first group.
+ * @param depth The maximum depth to which the function should walk, 0
+ *	implies all the way down.
+ * @param threads Number of threads, including the calling one.
+ * @param flags Flags from #cgroup_walk_parallel_flags.
+ * @param visit Callback called concurrently for each group, may be NULL.
+ * @param emit Callback called in order for each group, may be NULL.
+ * @param userdata Passed to the callbacks.
+ * @return 0 on success, the return value of a callback that stopped the
+ *	walk, or an error number.  When the walk stops, the results that are
+ *	not emitted are freed with free().
+ */
+int cgroup_walk_tree_parallel(const char *controller, const char *base_path, int depth,
+			      int threads, int flags, cgroup_walk_visit_callback visit,
+			      cgroup_walk_emit_callback emit, void *userdata);
+
 /**
  * Read the value of the given variable for the specified
  * controller and control group.
@@ -191,7 +270,8 @@ int cgroup_walk_tree_set_flags(void **handle, int flags);
  * @param buffer The buffer to read the value into.
  * The buffer is always zero-terminated.
  * @param max Maximal length of the buffer
- * @return #ECGEOF when the stats file is empty.
+ * @return #ECGEOF when the stats file is empty or cannot be read, the handle
+ *	is NULL in the latter case and on the other errors.
  */
 
 int cgroup_read_value_begin(const char * const controller, const char *path,
@@ -213,6 +293,19 @@ int cgroup_read_value_begin(const char * const controller, const char *path,
  */
 int cgroup_read_value_next(void **handle, char *buffer, int max);
 
+/**
+ * Read the variable again from its start, e.g. to poll it.  The file opened
+ * by cgroup_read_value_begin() is kept, it is read again into the buffer of
+ * the handle with pread().
+ * @param handle The handle returned by cgroup_read_value_begin().
+ * @param buffer The buffer to read the first value into.
+ * The buffer is always zero-terminated.
+ * @param max Maximal length of the buffer
+ * @return #ECGEOF when the file is empty, #ECGROUPNOTEXIST when the group was
+ *	removed since the handle was created.
+ */
+int cgroup_read_value_rewind(void **handle, char *buffer, int max);
+
 /**
  * Release the iterator.
  */
@@ -247,7 +340,8 @@ struct cgroup_stat {
  * @param path The path to control group, relative to hierarchy root.
  * @param handle The handle to be used during iteration.
  * @param stat Returned first item in the stats file.
- * @return #ECGEOF when the stats file is empty.
+ * @return #ECGEOF when the stats file is empty or cannot be read, the handle
+ *	is NULL in the latter case and on the other errors.
  */
 int cgroup_read_stats_begin(const char *controller, const char *path, void **handle,
 			    struct cgroup_stat *stat);
@@ -260,11 +354,245 @@ int cgroup_read_stats_begin(const char *controller, const char *path, void **han
  */
 int cgroup_read_stats_next(void **handle, struct cgroup_stat *stat);
 
+/**
+ * Read the statistics again from their start, e.g. to poll them.  The file
+ * opened by cgroup_read_stats_begin() is kept, it is read again into the
+ * buffer of the handle.
+ * @param handle The handle returned by cgroup_read_stats_begin().
+ * @param stat Returned first item in the stats file.
+ * @return #ECGEOF when the stats file is empty, #ECGROUPNOTEXIST when the
+ *	group was removed since the handle was created.
+ */
+int cgroup_read_stats_rewind(void **handle, struct cgroup_stat *stat);
+
 /**
  * Release the iterator.
  */
 int cgroup_read_stats_end(void **handle);
 
+/**
+ * Callback called by cgroup_read_stats_foreach() for each value of a stats
+ * file.  The strings point into the read buffer and are only valid during
+ * the call.
+ * @param key The first word of the line, e.g. "anon" in memory.stat or
+ *	"8:0" in io.stat.
+ * @param subkey For nested keyed lines ("8:0 rbytes=1 wbytes=2"), the name
+ *	of the value, e.g. "rbytes".  NULL for flat keyed lines ("anon 1").
+ * @param value The value.  An empty string for lines with a single word,
+ *	like in cgroup.procs.
+ * @param userdata The userdata passed to cgroup_read_stats_foreach().
+ * @return 0 to continue, any other value stops the reading.
+ */
+typedef int (*cgroup_stat_callback)(const char *key, const char *subkey, const char *value,
+				    void *userdata);
+
+/**
+ * Read a flat keyed or nested keyed file of the specified controller and
+ * control group, and pass each value to a callback.  Unlike
+ * cgroup_read_stats_begin() and cgroup_get_value_string(), the values are
+ * neither copied nor truncated, and the length of the file is not limited.
+ * @param controller Name of the controller for which stats are requested.
+ * @param path The path to control group, relative to hierarchy root.
+ * @param name Name of the file, e.g. "io.stat".  If NULL, the @c stats
+ *	file of the controller is read, like cgroup_read_stats_begin().
+ * @param callback Called for each value of the file.
+ * @param userdata Passed to the callback.
+ * @return 0 on success, the return value of the callback if it stopped the
+ *	reading, or an error number.
+ */
+int cgroup_read_stats_foreach(const char *controller, const char *path, const char *name,
+			      cgroup_stat_callback callback, void *userdata);
+
+/**
+ * Opaque set of the keys of a stats file to be read as integers, see
+ * cgroup_read_stats_map().
+ */
+struct cgroup_stat_map;
+
+/**
+ * Build the map of the keys to read with cgroup_read_stats_map().  It is
+ * built once and then used for any number of reads.
+ * @param keys The keys, e.g. "usage_usec".  The values of nested keyed
+ *	lines are named by the key and the subkey separated by a space, e.g.
+ *	"8:0 rbytes".
+ * @param count Number of keys, the value of keys[i] is stored in slot i.
+ * @return The map, NULL if a key is duplicated or the allocation failed.
+ */
+struct cgroup_stat_map *cgroup_stat_map_new(const char * const *keys, int count);
+
+/**
+ * Release a map built by cgroup_stat_map_new().
+ */
+void cgroup_stat_map_free(struct cgroup_stat_map **map);
+
+/**
+ * Read the integer values of the keys of a map from a stats file, in one
+ * pass and without copying any string.
+ * @param controller Name of the controller for which stats are requested.
+ * @param path The path to control group, relative to hierarchy root.
+ * @param name Name of the file, e.g. "cpu.stat".  If NULL, the @c stats
+ *	file of the controller is read.
+ * @param map The keys to read.
+ * @param values Array with one slot per key of the map.  "max" is stored
+ *	as UINT64_MAX, the keys which are not found are set to 0.
+ * @return 0 on success, #ECGINVAL if the value of a key of the map is not
+ *	an unsigned integer, or another error number.
+ */
+int cgroup_read_stats_map(const char *controller, const char *path, const char *name,
+			  const struct cgroup_stat_map *map, u_int64_t *values);
+
+/**
+ * Read the file of a handle again from its start, and store the integer
+ * values of the keys of a map like cgroup_read_stats_map().  The handle is
+ * at the end of the file afterwards.
+ * @param handle The handle returned by cgroup_read_stats_begin() or
+ *	cgroup_read_value_begin(), e.g. for "cpu.stat".
+ * @param map The keys to read.
+ * @param values Array with one slot per key of the map.
+ * @return 0 on success, #ECGROUPNOTEXIST when the group was removed since the
+ *	handle was created, #ECGINVAL if the value of a key of the map is not an
+ *	unsigned integer, or another error number.
+ */
+int cgroup_read_stats_map_rewind(void **handle, const struct cgroup_stat_map *map,
+				 u_int64_t *values);
+
+/**
+ * Opaque sampler of the counters of a stats file over many groups, see
+ * cgroup_sampler_read().  A sampler is not thread-safe.
+ */
+struct cgroup_sampler;
+
+/**
+ * Create a sampler of the counters of a stats file.
+ * @param controller Name of the controller.
+ * @param name Name of the file, e.g. "cpu.stat".  If NULL, the @c stats
+ *	file of the controller is read.
+ * @param keys The counters, named like for cgroup_stat_map_new().
+ * @param count Number of keys.
+ * @return The sampler, NULL if the keys are invalid or the allocation
+ *	failed.
+ */
+struct cgroup_sampler *cgroup_sampler_new(const char *controller, const char *name,
+					  const char * const *keys, int count);
+
+/**
+ * Release a sampler created by cgroup_sampler_new().
+ */
+void cgroup_sampler_free(struct cgroup_sampler **sampler);
+
+/**
+ * Sample the counters of a group, and compute how much they changed since
+ * the previous sample of the same group.  The sampler keeps the previous
+ * sample of each group it has read.  A group which cannot be read any more
+ * is forgotten, and a group which was removed and created again starts
+ * over.
+ * @param sampler The sampler.
+ * @param path The path to control group, relative to hierarchy root.
+ * @param deltas If not NULL, array with one slot per key, set to the
+ *	increase of each counter.  A counter which went down is assumed to
+ *	have been reset, its delta is its new value.
+ * @param rates If not NULL, array with one slot per key, set to the
+ *	increase of each counter per second.
+ * @param interval If not NULL, set to the seconds elapsed since the
+ *	previous sample, measured on CLOCK_MONOTONIC.  0 if there is none, the
+ *	deltas and rates are then 0.
+ * @return 0 on success, or an error number.
+ */
+int cgroup_sampler_read(struct cgroup_sampler *sampler, const char *path, u_int64_t *deltas,
+			double *rates, double *interval);
+
+/**
+ * Reductions of a value over the subtree of each group, see
+ * cgroup_rollup_read().
+ */
+enum cgroup_rollup_op {
+	/**
+	 * Total of the values of the groups of the subtree.  The counters the
+	 * kernel already totals over the subtree, like memory.current,
+	 * pids.current, memory.stat, io.stat and usage_usec, user_usec and
+	 * system_usec of cpu.stat on cgroup v2, or memory.usage_in_bytes,
+	 * pids.current, cpuacct.usage and cpuacct.stat on cgroup v1, are
+	 * taken from the group itself.  The children are only summed when the
+	 * group has no such file, e.g. the root group of cgroup v2.
+	 */
+	CGROUP_ROLLUP_SUM,
+	/** Highest value of the leaf groups of the subtree. */
+	CGROUP_ROLLUP_MAX,
+	/** Number of groups of the subtree whose file could be read. */
+	CGROUP_ROLLUP_COUNT,
+};
+
+/**
+ * A value to reduce over the subtrees.
+ */
+struct cgroup_rollup_key {
+	/** Name of the file, e.g. "memory.current" or "cpu.stat". */
+	const char *name;
+	/**
+	 * Key of the value in a stats file, named like for
+	 * cgroup_stat_map_new(), e.g. "usage_usec".  NULL for a file holding
+	 * a single value.
+	 */
+	const char *key;
+	/** The reduction. */
+	enum cgroup_rollup_op op;
+};
+
+/**
+ * A group of the result of cgroup_rollup_read().
+ */
+struct cgroup_rollup_node {
+	/** Path of the group, relative to the root of the hierarchy. */
+	const char *path;
+	/** Index of the parent group, -1 for the base group. */
+	int parent;
+	/** Depth of the group, below the base group. */
+	short depth;
+	/** The reduced values of the subtree, one per key. */
+	const u_int64_t *values;
+};
+
+/**
+ * Opaque result of cgroup_rollup_read().
+ */
+struct cgroup_rollup;
+
+/**
+ * Walk a tree once with cgroup_walk_tree_parallel(), read the values of the
+ * keys in each group with the parser of cgroup_read_stats_map(), and reduce
+ * them bottom-up over the subtree of each group.  A file which cannot be read
+ * counts as 0.
+ * @param controller Name of the controller.
+ * @param base_path Begin walking from this path, it is the first group.
+ * @param depth The maximum depth to which the function should walk, 0
+ *	implies all the way down.  The values below are not read.
+ * @param threads Number of threads of the walk, including the calling one.
+ * @param keys The values to reduce.
+ * @param count Number of keys.
+ * @param rollup Set to the result, to be released with cgroup_rollup_free().
+ * @return 0 on success, #ECGINVAL if a value is not an unsigned integer, or
+ *	another error number.
+ */
+int cgroup_rollup_read(const char *controller, const char *base_path, int depth, int threads,
+		       const struct cgroup_rollup_key *keys, int count,
+		       struct cgroup_rollup **rollup);
+
+/**
+ * Get the groups of a result, in the pre-order of the walk: a group comes
+ * before its subgroups, which are sorted by name, and the base group is the
+ * first one.
+ * @param rollup The result of cgroup_rollup_read().
+ * @param count Set to the number of groups.
+ * @return The groups, valid until the result is released.
+ */
+const struct cgroup_rollup_node *cgroup_rollup_nodes(const struct cgroup_rollup *rollup,
+						     int *count);
+
+/**
+ * Release a result of cgroup_rollup_read().
+ */
+void cgroup_rollup_free(struct cgroup_rollup **rollup);
+
 /**
  * @}
  *
@@ -350,7 +678,12 @@ int cgroup_get_controller_end(void **handle);
  * @name List all controllers
  * Use following functions to list all controllers, including those which are
  * not mounted. The controllers are returned in the same order as in
- * /proc/cgroups file, i.e. mostly random.
+ * /proc/cgroups file, i.e. mostly random, followed by the controllers of the
+ * cgroup v2 hierarchy missing there.
+ *
+ * Both the lists of mounted controllers and of all controllers are read once
+ * and kept until the mounts change or cgroup_init() is called again; an
+ * iteration walks the lists it started with.
  */
 
 /**
@@ -365,7 +698,7 @@ struct controller_data {
 	 * ID 0 are not currently mounted anywhere.
 	 */
 	int hierarchy;
-	/** Number of groups. */
+	/** Number of groups, when the list of controllers was read. */
 	int num_cgroups;
 	/** Enabled flag. */
 	int enabled;
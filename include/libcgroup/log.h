@@ -99,6 +99,35 @@ enum cgroup_log_level {
 typedef void (*cgroup_logger_callback)(void *userdata, int level,
 				       const char *fmt, va_list ap);
 
+/**
+ * A log message split in fields, given to a #cgroup_log_record_callback.
+ */
+struct cgroup_log_record {
+	/** Level of the message, as in enum #cgroup_log_level. */
+	int level;
+	/**
+	 * Source file, line and function logging the message, NULL and 0 for
+	 * the messages logged with cgroup_log().
+	 */
+	const char *file;
+	unsigned int line;
+	const char *function;
+	/**
+	 * printf format of the message, without the "Error: " like prefix of
+	 * its level.  It lives as long as the library, so it identifies the
+	 * message without formatting it.
+	 */
+	const char *format;
+};
+
+/**
+ * Callback receiving the log messages split in fields, the message is only
+ * formatted if the callback formats it from @c record->format and @p ap.
+ */
+typedef void (*cgroup_log_record_callback)(void *userdata,
+					   const struct cgroup_log_record *record,
+					   va_list ap);
+
 /**
  * Set libcgroup logging callback. All log messages with equal or lower log
  * level will be sent to the application's callback. There can be only
@@ -115,6 +144,19 @@ typedef void (*cgroup_logger_callback)(void *userdata, int level,
 extern void cgroup_set_logger(cgroup_logger_callback logger, int loglevel,
 			      void *userdata);
 
+/**
+ * Set a libcgroup logging callback receiving the log messages split in
+ * fields.  It replaces the callback set by cgroup_set_logger(), and
+ * cgroup_set_logger() replaces it.
+ * @param callback The callback, NULL to disable libcgroup logging.
+ * @param loglevel The log level. Use value -1 to automatically discover the
+ * level from CGROUP_LOGLEVEL environment variable.
+ * @param userdata Application's data which will be provided back to the
+ * callback.
+ */
+extern void cgroup_set_log_record_callback(cgroup_log_record_callback callback, int loglevel,
+					   void *userdata);
+
 /**
  * Set libcgroup logging to stdout. All messages with the given loglevel
  * or below will be sent to standard output. Previous logger set by
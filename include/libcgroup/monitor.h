@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+#ifndef _LIBCGROUP_MONITOR_H
+#define _LIBCGROUP_MONITOR_H
+
+#ifndef _LIBCGROUP_H_INSIDE
+#error "Only <libcgroup.h> should be included directly."
+#endif
+
+#ifndef SWIG
+#include <features.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @defgroup group_monitor 8. Monitoring
+ * @{
+ *
+ * @name Monitoring of groups
+ * @{
+ * A monitor watches groups without polling them.  The changes of files like
+ * cgroup.events or memory.events are watched with inotify, and the pressure
+ * files (cpu.pressure, memory.pressure, io.pressure) with PSI triggers.  All
+ * the watches of a monitor are multiplexed on one file descriptor, which the
+ * application adds to its own event loop.  When it becomes readable, the
+ * application calls cgroup_monitor_dispatch(), which calls the callbacks of
+ * the watches that fired.
+ *
+ * @par
+ * A monitor is not thread-safe, each thread must use its own.
+ */
+
+/**
+ * Opaque monitor, see cgroup_monitor_new().
+ */
+struct cgroup_monitor;
+
+/**
+ * Event passed to a #cgroup_monitor_callback.
+ */
+enum cgroup_monitor_event {
+	/** The watched file was modified, e.g. cgroup.events. */
+	CGROUP_MONITOR_MODIFIED,
+	/** The PSI trigger of the watched pressure file fired. */
+	CGROUP_MONITOR_PRESSURE,
+	/**
+	 * The group was removed, the watch does not fire any more but must
+	 * still be removed with cgroup_monitor_remove().
+	 */
+	CGROUP_MONITOR_REMOVED,
+};
+
+/**
+ * Callback called by cgroup_monitor_dispatch() when a watch fires.  It may
+ * add and remove watches, including its own.
+ * @param monitor The monitor.
+ * @param watch The watch, as returned by cgroup_monitor_add_events() or
+ *	cgroup_monitor_add_pressure().
+ * @param event What happened.
+ * @param userdata The userdata passed when adding the watch.
+ */
+typedef void (*cgroup_monitor_callback)(struct cgroup_monitor *monitor, int watch,
+					enum cgroup_monitor_event event, void *userdata);
+
+/**
+ * Create a monitor.
+ * @return The monitor, NULL on error.
+ */
+struct cgroup_monitor *cgroup_monitor_new(void);
+
+/**
+ * Release a monitor and all its watches.
+ */
+void cgroup_monitor_free(struct cgroup_monitor **monitor);
+
+/**
+ * Get the file descriptor of a monitor, readable when any of its watches
+ * fired.  It is owned by the monitor.
+ * @return The file descriptor, -1 if monitor is NULL.
+ */
+int cgroup_monitor_get_fd(const struct cgroup_monitor *monitor);
+
+/**
+ * Watch the changes of a file of a group, e.g. cgroup.events to know when
+ * the group becomes empty, or memory.events to know when it hits
+ * memory.high.
+ * @param monitor The monitor.
+ * @param controller Name of the controller the file belongs to.
+ * @param path The path to control group, relative to hierarchy root.
+ * @param file Name of the file, e.g. "cgroup.events".
+ * @param callback Called with #CGROUP_MONITOR_MODIFIED when the file changes.
+ * @param userdata Passed to the callback.
+ * @param watch Set to the identifier of the watch.
+ * @return 0 on success, or an error number.
+ */
+int cgroup_monitor_add_events(struct cgroup_monitor *monitor, const char *controller,
+			      const char *path, const char *file, cgroup_monitor_callback callback,
+			      void *userdata, int *watch);
+
+/**
+ * Register a PSI trigger on a pressure file of a group.
+ * @param monitor The monitor.
+ * @param controller Name of the controller the file belongs to.
+ * @param path The path to control group, relative to hierarchy root.
+ * @param file Name of the file, e.g. "memory.pressure".
+ * @param trigger The trigger, e.g. "some 150000 1000000" for a stall of 150
+ *	ms within 1 s, see the PSI documentation of the kernel.
+ * @param callback Called with #CGROUP_MONITOR_PRESSURE when the trigger
+ *	fires.
+ * @param userdata Passed to the callback.
+ * @param watch Set to the identifier of the watch.
+ * @return 0 on success, or an error number.
+ */
+int cgroup_monitor_add_pressure(struct cgroup_monitor *monitor, const char *controller,
+				const char *path, const char *file, const char *trigger,
+				cgroup_monitor_callback callback, void *userdata, int *watch);
+
+/**
+ * Remove a watch of a monitor.
+ * @param monitor The monitor.
+ * @param watch The identifier of the watch, it may be reused by the next
+ *	watch added.
+ * @return 0 on success, #ECGINVAL if there is no such watch.
+ */
+int cgroup_monitor_remove(struct cgroup_monitor *monitor, int watch);
+
+/**
+ * Wait for the watches of a monitor to fire, and call their callbacks.
+ * @param monitor The monitor.
+ * @param timeout Maximum time to wait in milliseconds, 0 to return at once
+ *	and -1 to wait forever, like epoll_wait().
+ * @return 0 on success, including when no watch fired, or an error number.
+ */
+int cgroup_monitor_dispatch(struct cgroup_monitor *monitor, int timeout);
+
+/**
+ * @}
+ * @}
+ */
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _LIBCGROUP_MONITOR_H */
@@ -33,6 +33,19 @@ struct cgroup_systemd_scope_opts {
 	pid_t pid;
 };
 
+/**
+ * Flags for cgroup_create_scope_async().
+ */
+enum cgroup_scope_flag {
+	/**
+	 * Keep the scope alive with a reference of the connection to systemd
+	 * (AddRef) instead of an idle process, when opts gives no pid.  The
+	 * scope lives until it has no process left and the connection is
+	 * closed.
+	 */
+	CGROUP_SCOPE_ADD_REF = 1,
+};
+
 /*
  * cgroup systemd settings
  */
@@ -65,6 +78,99 @@ int cgroup_set_default_scope_opts(struct cgroup_systemd_scope_opts * const opts)
 int cgroup_create_scope(const char * const scope_name, const char * const slice_name,
 			const struct cgroup_systemd_scope_opts * const opts);
 
+/**
+ * Connection to systemd on which many scopes can be created at once, see
+ * cgroup_systemd_bus_open().
+ */
+struct cgroup_systemd_bus;
+
+/**
+ * Callback called by cgroup_systemd_bus_dispatch() when the creation of a
+ * scope queued by cgroup_create_scope_async() completed.  It may queue more
+ * scopes.
+ *
+ * @param bus The connection the scope was queued on
+ * @param scope_name Name of the scope
+ * @param result 0 if the scope was created, > 0 on error
+ * @param userdata The userdata passed to cgroup_create_scope_async()
+ */
+typedef void (*cgroup_scope_callback)(struct cgroup_systemd_bus *bus, const char *scope_name,
+				      int result, void *userdata);
+
+/**
+ * Open a connection to systemd, to create scopes asynchronously.  Unlike
+ * cgroup_create_scope(), which waits for each scope in turn, the calls to
+ * systemd of all the scopes queued on the connection are sent at once, and
+ * their completions are reported as they come.
+ *
+ * @return The connection, NULL on error
+ *
+ * @note A connection is not thread-safe, each thread must use its own.
+ */
+struct cgroup_systemd_bus *cgroup_systemd_bus_open(void);
+
+/**
+ * Close a connection to systemd.  The callbacks of the scopes still pending
+ * are not called.
+ *
+ * @param bus The connection, set to NULL
+ */
+void cgroup_systemd_bus_close(struct cgroup_systemd_bus **bus);
+
+/**
+ * Get the file descriptor of a connection to systemd, to be added to the
+ * event loop of the application.  When it becomes readable, the application
+ * calls cgroup_systemd_bus_dispatch().  It is owned by the connection.
+ *
+ * @param bus The connection
+ *
+ * @return The file descriptor, -1 on error
+ */
+int cgroup_systemd_bus_get_fd(const struct cgroup_systemd_bus *bus);
+
+/**
+ * Get the number of scopes queued on a connection whose creation has not
+ * yet been reported.
+ *
+ * @param bus The connection
+ *
+ * @return The number of scopes, -1 if bus is NULL
+ */
+int cgroup_systemd_bus_pending(const struct cgroup_systemd_bus *bus);
+
+/**
+ * Queue the creation of a systemd scope under the specified slice.  The call
+ * to systemd is sent by the next cgroup_systemd_bus_dispatch().
+ *
+ * @param bus The connection
+ * @param scope_name Name of the scope, must end in .scope
+ * @param slice_name Name of the slice, must end in .slice
+ * @param opts Scope creation options structure instance
+ * @param flags Combination of CGROUP_SCOPE_* flags
+ * @param callback Called when the scope was created or failed, may be NULL
+ * @param userdata Passed to the callback
+ *
+ * @return 0 if the scope was queued and > 0 on error
+ */
+int cgroup_create_scope_async(struct cgroup_systemd_bus *bus, const char *scope_name,
+			      const char *slice_name,
+			      const struct cgroup_systemd_scope_opts *opts, int flags,
+			      cgroup_scope_callback callback, void *userdata);
+
+/**
+ * Send the queued calls to systemd, process its replies and call the
+ * callbacks of the scopes that completed.  A scope whose job did not
+ * complete within 10 seconds fails.
+ *
+ * @param bus The connection
+ * @param timeout Maximum time to wait for a message in milliseconds, 0 to
+ *	return at once and -1 to wait until the next message or the timeout of
+ *	a scope
+ *
+ * @return 0 on success, including when no scope completed, and > 0 on error
+ */
+int cgroup_systemd_bus_dispatch(struct cgroup_systemd_bus *bus, int timeout);
+
 /**
  * Create a systemd scope
  *
@@ -80,6 +186,19 @@ int cgroup_create_scope(const char * const scope_name, const char * const slice_
 int cgroup_create_scope2(struct cgroup *cgroup, int ignore_ownership,
 			 const struct cgroup_systemd_scope_opts * const opts);
 
+/**
+ * Get the idle process libcgroup placed in a scope when it created it.  The
+ * pid is recorded when the scope is created, so that it does not need to be
+ * searched among the processes of the scope.
+ *
+ * @param scope_name Name of the scope, e.g. database.scope
+ * @param pid Set to the pid of the idle process
+ *
+ * @return 0 on success, ECGROUPNOTEXIST if no idle process is recorded for
+ *	the scope or it exited
+ */
+int cgroup_get_scope_idle_pid(const char *scope_name, pid_t *pid);
+
 /**
  * Parse the systemd default cgroup's relative path from
  * /var/run/libcgroup/systemd and set it as default delegation cgroup
@@ -25,6 +25,15 @@ enum cgflags {
 	CGFLAG_USE_TEMPLATE_CACHE = 0x02,
 };
 
+/** Flags for cgroup_change_all_cgroups_ext(). */
+enum cgroup_change_all_flag {
+	/**
+	 * Only move the processes whose matching rule changed since the
+	 * previous load of the cached rules.
+	 */
+	CGFLAG_CHANGE_ALL_CHANGED_RULES = 0x01,
+};
+
 /** Flags for cgroup_register_unchanged_process(). */
 enum cgroup_daemon_type {
 	/**
@@ -35,6 +44,34 @@ enum cgroup_daemon_type {
 	CGROUP_DAEMON_CANCEL_UNCHANGE_PROCESS = 0x2,
 };
 
+/** Flags for cgroup_attach_tasks(). */
+enum cgroup_attach_flag {
+	/**
+	 * A process which exited before it could be moved is not an error.
+	 */
+	CGFLAG_ATTACH_IGNORE_EXITED = 0x01,
+};
+
+/** Flags for cgroup_get_current_controller_paths(). */
+enum cgroup_pid_paths_flag {
+	/**
+	 * Read the cgroup.procs files of the hierarchies rather than the
+	 * /proc/<pid>/cgroup file of each task.  It is cheaper when the tasks
+	 * are most of the tasks of the system.  The tasks must then be
+	 * processes, and the paths are relative to the mount points of the
+	 * hierarchies rather than to the cgroup namespace of the tasks.
+	 */
+	CGFLAG_PID_PATHS_FROM_PROCS = 0x01,
+};
+
+/** Path id of a task which is in none of the groups of a hierarchy. */
+#define CGROUP_PATH_ID_NONE	((unsigned int)-1)
+
+/**
+ * Current groups of many tasks, see cgroup_get_current_controller_paths().
+ */
+struct cgroup_pid_paths;
+
 /**
  * @defgroup group_tasks 4. Manipulation with tasks
  * @{
@@ -58,6 +95,36 @@ int cgroup_attach_task(struct cgroup *cgroup);
  */
 int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid);
 
+/**
+ * Move given process to given control group. Unlike
+ * cgroup_attach_task_pid(), the process is referred to by a pidfd, and is
+ * checked to be alive right before its PID is written.  If it exits in
+ * between, its PID may have been reused and another process moved: this is
+ * only detected after the move, and the function then fails with
+ * ECGROUPNOTEXIST rather than reporting success.
+ * @param cgroup Destination control group.
+ * @param pidfd The pidfd of the process to move, see pidfd_open(2).
+ */
+int cgroup_attach_task_pidfd(struct cgroup *cgroup, int pidfd);
+
+/**
+ * Move given tasks (=threads) to given control group.  Each tasks or
+ * cgroup.procs file of the group is opened once and the tasks are written
+ * to it one after the other, the files shared by several controllers are
+ * written once.  A task which cannot be moved does not stop the others.
+ * @param cgroup Destination control group, NULL for the root groups.
+ * @param pids The tasks to move.
+ * @param n The number of tasks.
+ * @param flags Combination of #cgroup_attach_flag flags.
+ * @param errors Optional array of n errors, set to the first error of each
+ *	task or 0 if it was moved to all the controllers.  An error which
+ *	prevents moving any task is set for all of them.
+ * @return 0 on success, else the first error.  ECGROUPNOTEXIST means a task
+ *	exited, see cgroup_attach_task_pid() for the other errors.
+ */
+int cgroup_attach_tasks(struct cgroup *cgroup, const pid_t *pids, size_t n, int flags,
+			int *errors);
+
 /**
  * Changes the cgroup of a task based on the path provided.  In this case,
  * the user must already know into which cgroup the task should be placed and
@@ -72,6 +139,26 @@ int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid);
 int cgroup_change_cgroup_path(const char *path, pid_t pid,
 			      const char * const controllers[]);
 
+/**
+ * Changes the cgroup of a task like cgroup_change_cgroup_path(), without
+ * the need of cgroup_init().  Only the destination group is looked up, so
+ * the function is meant for launchers which start many short tasks.  It
+ * only handles a cgroup v2 system, with the unified hierarchy mounted on
+ * /sys/fs/cgroup and no default systemd cgroup set; otherwise the caller
+ * should initialize the library and call cgroup_change_cgroup_path().
+ *
+ * @param path Name of the destination group, relative to the root of the
+ *	unified hierarchy.
+ * @param pid The process to move, with all its threads.
+ * @param controllers List of controllers which must be available in the
+ *	hierarchy, or NULL.
+ * @return 0 on success, #ECGROUPUNSUPP if the system is not handled,
+ *	#ECGROUPSUBSYSNOTMOUNTED if a controller is not available in the
+ *	hierarchy, or another error number.
+ */
+int cgroup_change_cgroup_path_fast(const char *path, pid_t pid,
+				   const char * const controllers[]);
+
 /**
  * Get the current control group path where the given task is.
  * @param pid The task to find.
@@ -83,6 +170,58 @@ int cgroup_change_cgroup_path(const char *path, pid_t pid,
 int cgroup_get_current_controller_path(pid_t pid, const char *controller,
 				       char **current_path);
 
+/**
+ * Get the current control group paths of many tasks at once.  The
+ * /proc/<pid>/cgroup file of each task is read once for all the
+ * controllers.  The paths are interned: the tasks in the same group get the
+ * same path id, so that they can be grouped without comparing the paths.
+ * @param pids The tasks to find.
+ * @param n The number of tasks.
+ * @param controllers NULL terminated list of the controllers (hierarchies)
+ *	where to find the tasks, NULL for the unified hierarchy only.
+ * @param flags Combination of #cgroup_pid_paths_flag flags.
+ * @param paths Set to the paths, to be freed with cgroup_pid_paths_free().
+ * @return 0 on success, even if some of the tasks exited: their path id is
+ *	then #CGROUP_PATH_ID_NONE.  ECGROUPSUBSYSNOTMOUNTED if a controller is
+ *	not mounted, or another error number.
+ */
+int cgroup_get_current_controller_paths(const pid_t *pids, size_t n,
+					const char * const controllers[], int flags,
+					struct cgroup_pid_paths **paths);
+
+/**
+ * Get the path id of a task.
+ * @param pid_index The index of the task in the pids of
+ *	cgroup_get_current_controller_paths().
+ * @param controller_index The index of the controller in its controllers, 0
+ *	for the unified hierarchy.
+ * @return The path id, #CGROUP_PATH_ID_NONE if the task is in no group of
+ *	the hierarchy, e.g. it exited, or the controller is not enabled in its
+ *	group.
+ */
+unsigned int cgroup_pid_paths_id(const struct cgroup_pid_paths *paths, size_t pid_index,
+				 int controller_index);
+
+/**
+ * Get the path of a path id, relative to the root of the hierarchy like
+ * the paths of cgroup_get_current_controller_path().
+ * @return The path, valid until cgroup_pid_paths_free(), NULL if the id is
+ *	out of range.
+ */
+const char *cgroup_pid_paths_name(const struct cgroup_pid_paths *paths, unsigned int id);
+
+/**
+ * Get the number of distinct paths, the path ids range from 0 to this
+ * number minus one.
+ */
+unsigned int cgroup_pid_paths_count(const struct cgroup_pid_paths *paths);
+
+/**
+ * Free the paths returned by cgroup_get_current_controller_paths().
+ * @param paths Set to NULL.
+ */
+void cgroup_pid_paths_free(struct cgroup_pid_paths **paths);
+
 /**
  * @}
  *
@@ -105,6 +244,16 @@ int cgroup_init_rules_cache(void);
  */
 int cgroup_reload_cached_rules(void);
 
+/**
+ * Set the lifetime of the cached members of the groups used by "@group"
+ * rules. The members are resolved when the rules are cached and again when
+ * the cache is older than @c ttl seconds or the rules are reloaded. Until
+ * then, changes of the group membership are not noticed.
+ * @param ttl Lifetime of the cache in seconds, 0 (default) disables the
+ *	cache and the group database is queried for every rule check.
+ */
+int cgroup_set_group_cache_ttl(unsigned int ttl);
+
 /**
  * Print the cached rules table.  This function should be called only after
  * first calling cgroup_parse_config(), but it will work with an empty rule
@@ -134,6 +283,42 @@ void cgroup_print_rules_config(FILE *fp);
  */
 int cgroup_change_all_cgroups(void);
 
+/**
+ * Changes the cgroup of all running PIDs based on the cached rules, like
+ * cgroup_change_all_cgroups(), with several threads.
+ *
+ * With #CGFLAG_CHANGE_ALL_CHANGED_RULES, e.g. after
+ * cgroup_reload_cached_rules(), a PID is moved only if its matching rule is
+ * not one of the leading rules which are the same as in the previous cached
+ * rules.  The processes are assumed to be where the previous rules put
+ * them, and the users and groups the rules refer to to be unchanged.
+ *	@param jobs Number of threads classifying the PIDs, at least 1
+ *	@param flags Combination of #cgroup_change_all_flag flags
+ *	@return 0 on success, > 0 on error
+ */
+int cgroup_change_all_cgroups_ext(int jobs, int flags);
+
+/**
+ * Callback of cgroup_change_all_cgroups_skip(), called from the classifying
+ * threads.
+ * @param pid The PID about to be classified.
+ * @param userdata The userdata given to cgroup_change_all_cgroups_skip().
+ * @return true to leave the PID where it is.
+ */
+typedef bool (*cgroup_change_all_skip_callback)(pid_t pid, void *userdata);
+
+/**
+ * Like cgroup_change_all_cgroups_ext(), but the PIDs for which skip returns
+ * true are not moved, e.g. those a daemon must leave alone.
+ *	@param jobs Number of threads classifying the PIDs, at least 1
+ *	@param flags Combination of #cgroup_change_all_flag flags
+ *	@param skip The callback, NULL to classify all the PIDs
+ *	@param userdata Passed to skip
+ *	@return 0 on success, > 0 on error
+ */
+int cgroup_change_all_cgroups_skip(int jobs, int flags, cgroup_change_all_skip_callback skip,
+				   void *userdata);
+
 /**
  * Changes the cgroup of a program based on the rules in the config file.
  * If a rule exists for the given UID, GID or PROCESS NAME, then the given
@@ -156,6 +341,15 @@ int cgroup_change_all_cgroups(void);
 int cgroup_change_cgroup_flags(uid_t uid, gid_t gid,
 			       const char *procname, pid_t pid, int flags);
 
+/**
+ * Get the time spent by the last cgroup_change_cgroup_flags() call of the
+ * calling thread, to let the callers like cgrulesengd monitor it.
+ * @param match_ns Set to the time spent finding the matching rule, in ns.
+ * @param attach_ns Set to the time spent creating the groups from templates
+ *	and moving the process, in ns, 0 if no rule matched.
+ */
+void cgroup_get_last_change_times(u_int64_t *match_ns, u_int64_t *attach_ns);
+
 /**
  * Changes the cgroup of a program based on the rules in the config file.  If a
  * rule exists for the given UID or GID, then the given PID is placed into the
@@ -203,6 +397,34 @@ int cgroup_change_cgroup_uid_gid(uid_t uid, gid_t gid, pid_t pid);
  */
 int cgroup_register_unchanged_process(pid_t pid, int flags);
 
+/**
+ * Register several unchanged processes to a cgrulesengd daemon, in one
+ * exchange on a connection kept open for the next calls.  An older daemon,
+ * which takes one process per connection, is sent the tasks one by one.
+ * If the daemon does not work, this function returns 0 as success.
+ * @param pids The task ids.
+ * @param count Number of task ids.
+ * @param flags Bit flags to change the behavior, as defined in
+ *	#cgroup_daemon_type, for all the tasks
+ * @return 0 on success, 1 if any of the tasks could not be registered
+ */
+int cgroup_register_unchanged_processes(const pid_t *pids, int count, int flags);
+
+/**
+ * Ask a cgrulesengd daemon to move a task to the groups of its rules, like
+ * cgroup_change_cgroup_uid_gid_flags() with #CGFLAG_USECACHE would, using the
+ * rules and mount table the daemon has already loaded.  The call needs
+ * neither cgroup_init() nor the rules, only the daemon socket, and only
+ * root may use it.
+ * @param uid The UID to match.
+ * @param gid The GID to match.
+ * @param pid The PID of the process to move.
+ * @return 0 on success, #ECGOTHER if the daemon could not be reached, was
+ *	too busy to accept the connection or did not answer in time, else the
+ *	error of the daemon.
+ */
+int cgroup_change_cgroup_uid_gid_daemon(uid_t uid, gid_t gid, pid_t pid);
+
 /**
  * @}
  * @}
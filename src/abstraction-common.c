@@ -17,7 +17,21 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <pthread.h>
 
+/*
+ * Index of a conversion table, the pointers to its entries sorted by
+ * in_setting.  The entries of the same in_setting keep the order of the table,
+ * which is the order they are applied in.
+ */
+struct cg_convert_index {
+	const struct cgroup_abstraction_map **entries;
+	int count;
+};
+
+static struct cg_convert_index cg_v1_to_v2_index;
+static struct cg_convert_index cg_v2_to_v1_index;
+static pthread_once_t cg_convert_index_once = PTHREAD_ONCE_INIT;
 
 int cgroup_strtol(const char * const in_str, int base, long * const out_value)
 {
@@ -36,7 +50,7 @@ int cgroup_strtol(const char * const in_str, int base, long * const out_value)
 	/* taken directly from strtol's man page */
 	if ((errno == ERANGE && (*out_value == LONG_MAX || *out_value == LONG_MIN)) ||
 	    (errno != 0 && *out_value == 0)) {
-		cgroup_err("Failed to convert %s from strtol: %s\n", in_str);
+		cgroup_err("Failed to convert %s from strtol: %s\n", in_str, strerror(errno));
 		ret = ECGFAIL;
 		goto out;
 	}
@@ -82,7 +96,7 @@ int cgroup_convert_int(struct cgroup_controller * const dst_cgc, const char * co
 		ret = snprintf(out_value_str, OUT_VALUE_STR_LEN, "%ld", out_value);
 		if (ret == OUT_VALUE_STR_LEN) {
 			/* we ran out of room in the string. throw an error */
-			cgroup_err("output value too large for string: %d\n", out_value);
+			cgroup_err("output value too large for string: %ld\n", out_value);
 			ret = ECGFAIL;
 			goto out;
 		}
@@ -117,12 +131,114 @@ int cgroup_convert_unmappable(struct cgroup_controller * const dst_cgc,
 	return ECGNOVERSIONCONVERT;
 }
 
+static int cg_convert_index_cmp(const void *p1, const void *p2)
+{
+	const struct cgroup_abstraction_map * const *e1 = p1;
+	const struct cgroup_abstraction_map * const *e2 = p2;
+	int ret;
+
+	ret = strcmp((*e1)->in_setting, (*e2)->in_setting);
+	if (ret)
+		return ret;
+
+	/* qsort() is not stable, the entries of a setting stay in table order */
+	return (*e1 > *e2) - (*e1 < *e2);
+}
+
+static void cg_convert_index_build(struct cg_convert_index * const index,
+				   const struct cgroup_abstraction_map * const tbl, int tbl_sz)
+{
+	int i;
+
+	index->entries = malloc(tbl_sz * sizeof(*index->entries));
+	if (!index->entries) {
+		/* convert_setting() falls back on scanning the table */
+		cgroup_warn("cannot allocate the index of the conversion table\n");
+		return;
+	}
+
+	for (i = 0; i < tbl_sz; i++)
+		index->entries[i] = &tbl[i];
+
+	qsort(index->entries, tbl_sz, sizeof(*index->entries), cg_convert_index_cmp);
+	index->count = tbl_sz;
+}
+
+static void cg_convert_index_init(void)
+{
+	cg_convert_index_build(&cg_v1_to_v2_index, cgroup_v1_to_v2_map, cgroup_v1_to_v2_map_sz);
+	cg_convert_index_build(&cg_v2_to_v1_index, cgroup_v2_to_v1_map, cgroup_v2_to_v1_map_sz);
+}
+
+/**
+ * Check if an entry of a conversion table applies to a setting.
+ *
+ * For a few settings, e.g. cpu.max <-> cpu.cfs_quota_us/cpu.cfs_period_us,
+ * the conversion from the N->1 field (cpu.max) back to one of the other
+ * settings cannot be done without prior knowledge of our desired setting
+ * (quota or period in this example).  If prev_name is set, it can guide us
+ * back to the correct mapping.
+ */
+static bool cg_convert_entry_match(const struct cgroup_abstraction_map * const entry,
+				   const struct control_value * const in_ctrl_val)
+{
+	if (in_ctrl_val->prev_name == NULL)
+		return true;
+
+	return entry->out_setting && strcmp(in_ctrl_val->prev_name, entry->out_setting) == 0;
+}
+
+STATIC int cg_convert_lookup(enum cg_version_t out_version, const char * const in_setting,
+			     const struct cgroup_abstraction_map ***entries)
+{
+	const struct cg_convert_index *index;
+	int low, high, mid, count;
+
+	pthread_once(&cg_convert_index_once, cg_convert_index_init);
+
+	switch (out_version) {
+	case CGROUP_V1:
+		index = &cg_v2_to_v1_index;
+		break;
+	case CGROUP_V2:
+		index = &cg_v1_to_v2_index;
+		break;
+	default:
+		return -1;
+	}
+
+	if (!index->entries)
+		return -1;
+
+	/* Find the first entry of the setting */
+	low = 0;
+	high = index->count;
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (strcmp(index->entries[mid]->in_setting, in_setting) < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	for (count = 0; low + count < index->count; count++) {
+		if (strcmp(index->entries[low + count]->in_setting, in_setting) != 0)
+			break;
+	}
+
+	*entries = &index->entries[low];
+
+	return count;
+}
+
 static int convert_setting(struct cgroup_controller * const out_cgc,
 			   const struct control_value * const in_ctrl_val)
 {
+	const struct cgroup_abstraction_map **entries = NULL;
 	const struct cgroup_abstraction_map *convert_tbl;
 	int ret = ECGINVAL;
 	int tbl_sz = 0;
+	int count;
 	int i;
 
 	switch (out_cgc->version) {
@@ -139,19 +255,25 @@ static int convert_setting(struct cgroup_controller * const out_cgc,
 		goto out;
 	}
 
+	count = cg_convert_lookup(out_cgc->version, in_ctrl_val->name, &entries);
+	if (count >= 0) {
+		for (i = 0; i < count; i++) {
+			if (!cg_convert_entry_match(entries[i], in_ctrl_val))
+				continue;
+
+			ret = entries[i]->cgroup_convert(out_cgc, in_ctrl_val->value,
+							 entries[i]->out_setting,
+							 entries[i]->in_dflt, entries[i]->out_dflt);
+			if (ret)
+				goto out;
+		}
+		goto out;
+	}
+
+	/* The index could not be allocated */
 	for (i = 0; i < tbl_sz; i++) {
-		/*
-		 * For a few settings, e.g.
-		 * cpu.max <-> cpu.cfs_quota_us/cpu.cfs_period_us, the
-		 * conversion from the N->1 field (cpu.max) back to one of the
-		 * other settings cannot be done without prior knowledge of our
-		 * desired setting (quota or period in this example).
-		 * If prev_name is set, it can guide us back to the correct
-		 * mapping.
-		 */
 		if (strcmp(convert_tbl[i].in_setting, in_ctrl_val->name) == 0 &&
-		    (in_ctrl_val->prev_name == NULL ||
-		     strcmp(in_ctrl_val->prev_name, convert_tbl[i].out_setting) == 0)) {
+		    cg_convert_entry_match(&convert_tbl[i], in_ctrl_val)) {
 
 			ret = convert_tbl[i].cgroup_convert(out_cgc, in_ctrl_val->value,
 							    convert_tbl[i].out_setting,
@@ -219,6 +341,24 @@ out:
 	return ret;
 }
 
+static int cg_convert_target_version(const char * const name, enum cg_version_t out_version,
+				     enum cg_version_t * const version)
+{
+	if (strcmp(CGROUP_FILE_PREFIX, name) == 0)
+		/*
+		 * libcgroup only supports accessing cgroup.* files
+		 * on cgroup v2 filesystems.
+		 */
+		*version = CGROUP_V2;
+	else
+		*version = out_version;
+
+	if (*version == CGROUP_UNK || *version == CGROUP_DISK)
+		return cgroup_get_controller_version(name, version);
+
+	return 0;
+}
+
 int cgroup_convert_cgroup(struct cgroup * const out_cgroup, enum cg_version_t out_version,
 			  const struct cgroup * const in_cgroup, enum cg_version_t in_version)
 {
@@ -238,20 +378,9 @@ int cgroup_convert_cgroup(struct cgroup * const out_cgroup, enum cg_version_t ou
 		if (in_version == CGROUP_V1 || in_version == CGROUP_V2)
 			in_cgroup->controller[i]->version = in_version;
 
-		if (strcmp(CGROUP_FILE_PREFIX, cgc->name) == 0)
-			/*
-			 * libcgroup only supports accessing cgroup.* files
-			 * on cgroup v2 filesystems.
-			 */
-			cgc->version = CGROUP_V2;
-		else
-			cgc->version = out_version;
-
-		if (cgc->version == CGROUP_UNK || cgc->version == CGROUP_DISK) {
-			ret = cgroup_get_controller_version(cgc->name, &cgc->version);
-			if (ret)
-				goto out;
-		}
+		ret = cg_convert_target_version(cgc->name, out_version, &cgc->version);
+		if (ret)
+			goto out;
 
 		ret = convert_controller(&cgc, in_cgroup->controller[i]);
 		if (ret == ECGNOVERSIONCONVERT) {
@@ -284,3 +413,160 @@ out:
 
 	return ret;
 }
+
+/**
+ * Check if the values of a controller can be converted by renaming them, i.e.
+ * each of them has exactly one conversion, which keeps its contents.
+ */
+static bool cg_convert_renames_only(const struct cgroup_controller * const cgc,
+				    enum cg_version_t out_version,
+				    const struct cgroup_abstraction_map **renames)
+{
+	const struct cgroup_abstraction_map **entries;
+	const struct cgroup_abstraction_map *found;
+	int count, i, j;
+
+	/* cpu.max is built from several v1 settings */
+	if (strcmp(cgc->name, "cpu") == 0)
+		return false;
+
+	for (i = 0; i < cgc->index; i++) {
+		count = cg_convert_lookup(out_version, cgc->values[i]->name, &entries);
+		if (count < 0)
+			return false;
+
+		found = NULL;
+		for (j = 0; j < count; j++) {
+			if (!cg_convert_entry_match(entries[j], cgc->values[i]))
+				continue;
+			if (found)
+				return false;
+			found = entries[j];
+		}
+
+		if (!found || !found->out_setting ||
+		    (found->cgroup_convert != cgroup_convert_passthrough &&
+		     found->cgroup_convert != cgroup_convert_name_only))
+			return false;
+
+		/* cgroup_add_value_string() would refuse the second one */
+		for (j = 0; j < i; j++) {
+			if (strcmp(renames[j]->out_setting, found->out_setting) == 0)
+				return false;
+		}
+
+		renames[i] = found;
+	}
+
+	return true;
+}
+
+int cgroup_convert_cgroup_inplace(struct cgroup * const cgroup, enum cg_version_t out_version,
+				  enum cg_version_t in_version)
+{
+	const struct cgroup_abstraction_map **renames = NULL;
+	struct cgroup_controller *cgc;
+	enum cg_version_t *versions;
+	struct cgroup *converted;
+	const char **names = NULL;
+	int ret = 0, total = 0;
+	int i, j, n;
+
+	if (!cgroup || cgroup->index < 0)
+		return ECGINVAL;
+
+	if (cgroup->index == 0)
+		return 0;
+
+	for (i = 0; i < cgroup->index; i++) {
+		if (cgroup->controller[i]->index < 0)
+			return ECGINVAL;
+		total += cgroup->controller[i]->index;
+	}
+
+	versions = calloc(cgroup->index, sizeof(*versions));
+	renames = calloc(total + 1, sizeof(*renames));
+	names = calloc(total + 1, sizeof(*names));
+	if (!versions || !renames || !names) {
+		last_errno = errno;
+		ret = ECGOTHER;
+		goto out;
+	}
+
+	for (i = 0, n = 0; i < cgroup->index; i++) {
+		cgc = cgroup->controller[i];
+
+		/* the user has overridden the version */
+		if (in_version == CGROUP_V1 || in_version == CGROUP_V2)
+			cgc->version = in_version;
+
+		ret = cg_convert_target_version(cgc->name, out_version, &versions[i]);
+		if (ret)
+			goto out;
+
+		if (cgc->version == versions[i]) {
+			n += cgc->index;
+			continue;
+		}
+
+		if (!cg_convert_renames_only(cgc, versions[i], &renames[n]))
+			goto convert;
+
+		/* The values are renamed below, where nothing can fail */
+		ret = cg_own_values(cgc);
+		if (ret)
+			goto out;
+
+		for (j = 0; j < cgc->index; j++, n++) {
+			names[n] = cg_intern_name(renames[n]->out_setting);
+			if (!names[n]) {
+				ret = ECGOTHER;
+				goto out;
+			}
+		}
+	}
+
+	/* Nothing can fail from here, the cgroup is renamed in place */
+	for (i = 0, n = 0; i < cgroup->index; i++) {
+		cgc = cgroup->controller[i];
+
+		for (j = 0; j < cgc->index; j++, n++) {
+			if (!names[n])
+				continue;
+			cgc->values[j]->name = names[n];
+			cgc->values[j]->prev_name = NULL;
+			cgc->values[j]->dirty = true;
+		}
+		cgc->version = versions[i];
+	}
+
+	goto out;
+
+convert:
+	/* Some values must be computed, convert into a second cgroup */
+	converted = cgroup_new_cgroup(cgroup->name);
+	if (!converted) {
+		ret = ECGCONTROLLERCREATEFAILED;
+		goto out;
+	}
+
+	ret = cgroup_convert_cgroup(converted, out_version, cgroup, in_version);
+	if (ret == 0 || ret == ECGNOVERSIONCONVERT) {
+		n = cgroup_copy_cgroup(cgroup, converted);
+		if (n)
+			ret = n;
+
+		/* cgroup_copy_cgroup() leaves the versions of the controllers unset */
+		for (i = 0; i < cgroup->index; i++)
+			cgroup->controller[i]->version = converted->controller[i]->version;
+	}
+
+	cgroup_free(&converted);
+
+out:
+	free(versions);
+	free(renames);
+	free(names);
+
+	return ret;
+}
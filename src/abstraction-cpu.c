@@ -29,7 +29,7 @@ static int read_setting(const char * const cgroup_name, const char * const contr
 			const char * const setting_name, char ** const value)
 {
 	char tmp_line[LL_MAX];
-	void *handle;
+	void *handle = NULL;
 	int ret;
 
 	ret = cgroup_read_value_begin(controller_name, cgroup_name, setting_name, &handle,
@@ -44,10 +44,12 @@ static int read_setting(const char * const cgroup_name, const char * const contr
 		ret = ECGOTHER;
 
 read_end:
-	cgroup_read_value_end(&handle);
 	if (ret == ECGEOF)
 		ret = 0;
 end:
+	if (handle)
+		cgroup_read_value_end(&handle);
+
 	return ret;
 }
 
@@ -129,7 +131,7 @@ int cgroup_convert_cpu_quota_to_max(struct cgroup_controller * const dst_cgc,
 			goto out;
 	}
 
-	dst_cgc->values[dst_cgc->index - 1]->prev_name = strdup(CFS_QUOTA_US);
+	dst_cgc->values[dst_cgc->index - 1]->prev_name = CFS_QUOTA_US;
 
 out:
 	if (period)
@@ -165,7 +167,7 @@ int cgroup_convert_cpu_period_to_max(struct cgroup_controller * const dst_cgc,
 			goto out;
 	}
 
-	dst_cgc->values[dst_cgc->index - 1]->prev_name = strdup(CFS_PERIOD_US);
+	dst_cgc->values[dst_cgc->index - 1]->prev_name = CFS_PERIOD_US;
 
 out:
 	if (quota)
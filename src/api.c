@@ -31,12 +31,14 @@
 #include <string.h>
 #include <libgen.h>
 #include <assert.h>
+#include <fnmatch.h>
 #include <errno.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <ctype.h>
 #include <fts.h>
 #include <pwd.h>
+#include <poll.h>
 #include <grp.h>
 
 #include <sys/syscall.h>
@@ -66,34 +68,123 @@ static __thread char errtext[MAXLEN];
 /* Task command name length */
 #define TASK_COMM_LEN 16
 
-/* Check if cgroup_init has been called or not. */
-static int cgroup_initialized;
+#define CGROUP2_SUPER_MAGIC	0x63677270
+#define CGROUP_SUPER_MAGIC	0x27E0EB
 
-/* List of configuration rules */
+/* List of configuration rules being parsed, published to rules once done */
 static struct cgroup_rule_list rl;
 
 /* Temporary list of configuration rules (for non-cache apps) */
 static struct cgroup_rule_list trl;
 
-/* Lock for the list of rules (rl) */
-static pthread_rwlock_t rl_lock = PTHREAD_RWLOCK_INITIALIZER;
+/* Serializes the writers of rl, trl and rules */
+static pthread_mutex_t rl_lock = PTHREAD_MUTEX_INITIALIZER;
 
-/* Cgroup v2 mount path.  Null if v2 isn't mounted */
-char cg_cgroup_v2_mount_path[FILENAME_MAX];
+static void cgroup_release_rule_list(void *data);
 
-/* Namespace */
-__thread char *cg_namespace_table[CG_CONTROLLER_MAX];
+/* The cached rules, a struct cgroup_rule_list, read without taking a lock */
+static struct cg_snapshot rules = CG_SNAPSHOT_INITIALIZER(cgroup_release_rule_list);
+
+/* The rules parsed from one file, reused as long as the file does not change */
+struct cg_rules_segment {
+	char *path;
+	struct stat st;
+	/* Copies of the rules of the file */
+	struct cgroup_rule_list rules;
+	struct cg_rules_segment *next;
+};
+
+/*
+ * The segments of the last parse of the cached rules, in the order of the
+ * files, and the status of the user and group databases their names were
+ * resolved with.  A reload only parses the files which changed.  Protected
+ * by rl_lock.
+ */
+static struct cg_rules_segment *rules_segments;
+static struct stat *rules_segments_deps;
+static int rules_segments_deps_cnt;
+
+/*
+ * Set by the parse of the cached rules when a name is not resolved from
+ * /etc/passwd or /etc/group.  The rules then depend on other services,
+ * their files are not kept as segments and they are not compiled.
+ * Protected by rl_lock.
+ */
+static bool rules_nss_names;
 
-pthread_rwlock_t cg_mount_table_lock = PTHREAD_RWLOCK_INITIALIZER;
-struct cg_mount_table_s cg_mount_table[CG_CONTROLLER_MAX];
+/* Lifetime of the cached group members of the rules, 0 disables the cache */
+static unsigned int group_cache_ttl;
 
-/* Cgroup v2 mount paths, with empty controllers */
-struct cg_mount_point *cg_cgroup_v2_empty_mount_paths;
+/* Serializes the creation of groups from templates (the parser is global) */
+static pthread_mutex_t template_lock = PTHREAD_MUTEX_INITIALIZER;
 
-#ifdef WITH_SYSTEMD
-/* Default systemd path name. Length: <name>.slice/<name>.scope */
-char systemd_default_cgroup[FILENAME_MAX * 2 + 1];
-#endif
+/* A group created from a template, with the controllers of its rule */
+struct cg_template_entry {
+	char *key;
+	unsigned int hash;
+	struct cg_template_entry *next;
+};
+
+/*
+ * Groups created from templates, protected by template_lock.  They belong to
+ * template_cache_gen, and are dropped once template_gen moves on.
+ */
+static struct cg_template_entry *template_cache[CG_TEMPLATE_CACHE_SIZE];
+static int template_cache_cnt;
+static unsigned long template_cache_gen;
+static unsigned long template_gen;
+
+/* A cgroup v2 directory, with the controllers enabled in its cgroup.subtree_control */
+struct cg_subtree_entry {
+	char *path;
+	unsigned int hash;
+	/* Bits of the names of subtree_ctrl_names */
+	u_int64_t enabled;
+	struct cg_subtree_entry *next;
+};
+
+/*
+ * Controllers known to be enabled below the directories, protected by
+ * subtree_lock.  Only what was read or written by this process is known, the
+ * entries belong to subtree_cache_gen and are dropped once subtree_gen moves
+ * on.  The controllers are named by their bit, the names are kept across the
+ * invalidations, the mount table may be changed without cgroup_init().
+ */
+static pthread_mutex_t subtree_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cg_subtree_entry *subtree_cache[CG_SUBTREE_CACHE_SIZE];
+static char *subtree_ctrl_names[64];
+static int subtree_cache_cnt;
+static unsigned long subtree_cache_gen;
+static unsigned long subtree_gen;
+
+/*
+ * The tables of the default context, exported as cg_mount_table and
+ * cg_mount_table_lock since CGROUP_2.0.  The names are macros for the tables
+ * of the context of the thread.
+ */
+struct cg_mount_table_s cg_default_mount_table[CG_CONTROLLER_MAX] __asm__("cg_mount_table");
+pthread_rwlock_t cg_default_mount_table_lock __asm__("cg_mount_table_lock") =
+	PTHREAD_RWLOCK_INITIALIZER;
+
+/* The context of the threads which did not choose one */
+struct cgroup_ctx cg_default_ctx = {
+	.mount_table = &cg_default_mount_table,
+	.mount_table_lock = &cg_default_mount_table_lock,
+	.mount_index_v2 = -1,
+	.controllers_lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+__thread struct cgroup_ctx *cg_thread_ctx;
+
+/* A context created by cgroup_ctx_new(), with its own tables */
+struct cg_ctx_alloc {
+	struct cgroup_ctx ctx;
+	struct cg_mount_table_s mount_table[CG_CONTROLLER_MAX];
+	pthread_rwlock_t mount_table_lock;
+};
+
+/* Namespace */
+__thread char *cg_thread_namespace_table[CG_CONTROLLER_MAX];
 
 const char * const cgroup_strerror_codes[] = {
 	"Cgroup is not compiled in",
@@ -149,67 +240,217 @@ static int cg_chown(const char *filename, uid_t owner, gid_t group)
 
 	return chown(filename, owner, group);
 }
-static int cg_chown_file(FTS *fts, FTSENT *ent, uid_t owner, gid_t group)
+
+/**
+ * Get the mode cg_chmod_path() gives to a file.
+ *	@param st The status of the file
+ *	@param owner_is_umask Whether the owner permissions mask the group and
+ *	others ones
+ */
+static mode_t cg_chmod_mode(const struct stat * const st, mode_t mode, int owner_is_umask)
 {
-	const char *filename = fts->fts_path;
-	int ret = 0;
+	mode_t umask, gmask, omask;
 
-	cgroup_dbg("chown: seeing file %s\n", filename);
-	switch (ent->fts_info) {
-	case FTS_ERR:
-		errno = ent->fts_errno;
-		break;
-	case FTS_D:
-	case FTS_DC:
-	case FTS_NSOK:
-	case FTS_NS:
-	case FTS_DNR:
-	case FTS_DP:
-	case FTS_F:
-	case FTS_DEFAULT:
-		ret = cg_chown(filename, owner, group);
-		break;
+	if (!owner_is_umask)
+		return mode;
+
+	/*
+	 * Use owner permissions as an umask for group and others
+	 * permissions because we trust kernel to initialize owner
+	 * permissions to something useful.  Keep SUID and SGID bits.
+	 */
+	/* 0700 == S_IRWXU */
+	umask = 0700 & st->st_mode;
+	gmask = umask >> 3;
+	omask = gmask >> 3;
+
+	return mode & (umask|gmask|omask|S_ISUID|S_ISGID|S_ISVTX);
+}
+
+/* Ownership and permissions applied to a directory tree */
+struct cg_perm_walk {
+	bool chown;
+	uid_t owner;
+	gid_t group;
+	mode_t dir_mode;
+	int dirm_change;
+	mode_t file_mode;
+	int filem_change;
+	int owner_is_umask;
+	/* Files whose mode is not changed, terminated with NULL */
+	const char * const *ignore_list;
+	int ret;
+};
+
+static bool cg_perm_walk_ignored(const struct cg_perm_walk * const walk, const char *path)
+{
+	const char *name;
+	int i;
+
+	if (!walk->ignore_list)
+		return false;
+
+	name = strrchr(path, '/');
+	name = name ? name + 1 : path;
+
+	for (i = 0; walk->ignore_list[i]; i++)
+		if (!strcmp(walk->ignore_list[i], name))
+			return true;
+
+	return false;
+}
+
+/**
+ * Apply the ownership and permissions of a walk to an entry of a directory,
+ * skipping the changes the entry already has.
+ *	@param dirfd The directory of the entry, or the entry itself if name is
+ *	empty
+ *	@param path The path of the entry, for the messages and the ignore list
+ */
+static void cg_perm_walk_apply(struct cg_perm_walk * const walk, int dirfd, const char *name,
+			       const char *path, const struct stat * const st)
+{
+	int flags = *name ? AT_SYMLINK_NOFOLLOW : AT_EMPTY_PATH;
+	bool is_dir = S_ISDIR(st->st_mode);
+	mode_t mode;
+
+	cgroup_dbg("chown/chmod: seeing file %s\n", path);
+
+	if (walk->chown && (st->st_uid != walk->owner || st->st_gid != walk->group) &&
+	    fchownat(dirfd, name, walk->owner, walk->group, flags)) {
+		cgroup_warn("cannot change owner of file %s: %s\n", path, strerror(errno));
+		last_errno = errno;
+		walk->ret = ECGOTHER;
+		return;
 	}
-	if (ret < 0) {
-		cgroup_warn("cannot change owner of file %s: %s\n", filename, strerror(errno));
+
+	if (S_ISLNK(st->st_mode) || cg_perm_walk_ignored(walk, path))
+		return;
+	if (is_dir ? !walk->dirm_change : !walk->filem_change)
+		return;
+
+	mode = cg_chmod_mode(st, is_dir ? walk->dir_mode : walk->file_mode, walk->owner_is_umask);
+	if ((st->st_mode & 07777) == mode)
+		return;
+
+	/* fchmodat() cannot change the directory itself, but fchmod() can */
+	if (*name ? fchmodat(dirfd, name, mode, 0) : fchmod(dirfd, mode)) {
+		cgroup_warn("cannot change permissions of file %s: %s\n", path, strerror(errno));
 		last_errno = errno;
-		ret = ECGOTHER;
+		walk->ret = ECGOTHER;
 	}
-	return ret;
 }
 
-/* TODO: Need to decide a better place to put this function. */
-static int cg_chown_recursive(char **path, uid_t owner, gid_t group)
+/**
+ * Walk a directory applying the ownership and permissions to its entries.
+ * The entries are opened relative to their directory, the path is only
+ * extended for the messages.
+ *	@param dirfd The directory, closed on return
+ *	@param path The path of the directory, of FILENAME_MAX characters
+ */
+static void cg_perm_walk_dir(struct cg_perm_walk * const walk, int dirfd, char *path)
 {
-	int ret = 0;
-	FTS *fts;
+	size_t len = strlen(path);
+	struct cg_dirent64 *ent;
+	char buf[8192];
+	struct stat st;
+	long nread, i;
+	int fd;
+
+	while ((nread = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0) {
+		for (i = 0; i < nread; i += ent->d_reclen) {
+			ent = (struct cg_dirent64 *)(buf + i);
+
+			if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+				continue;
+
+			if (snprintf(path + len, FILENAME_MAX - len, "/%s", ent->d_name) >=
+			    FILENAME_MAX - len) {
+				cgroup_warn("path too long: %s/%s\n", path, ent->d_name);
+				walk->ret = ECGOTHER;
+				continue;
+			}
+
+			if (ent->d_type != DT_DIR) {
+				if (fstatat(dirfd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW)) {
+					cgroup_warn("cannot stat file %s: %s\n", path, strerror(errno));
+					last_errno = errno;
+					walk->ret = ECGOTHER;
+					continue;
+				}
+
+				/* The type is unknown when the file system does not report it */
+				if (!S_ISDIR(st.st_mode)) {
+					cg_perm_walk_apply(walk, dirfd, ent->d_name, path, &st);
+					continue;
+				}
+			}
+
+			fd = openat(dirfd, ent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+			if (fd < 0 || fstat(fd, &st)) {
+				cgroup_warn("cannot open directory %s: %s\n", path, strerror(errno));
+				last_errno = errno;
+				walk->ret = ECGOTHER;
+				if (fd >= 0)
+					close(fd);
+				continue;
+			}
+
+			cg_perm_walk_apply(walk, fd, "", path, &st);
+			cg_perm_walk_dir(walk, fd, path);
+		}
+	}
+
+	if (nread < 0) {
+		path[len] = '\0';
+		cgroup_warn("cannot read directory %s: %s\n", path, strerror(errno));
+		last_errno = errno;
+		walk->ret = ECGOTHER;
+	}
 
-	cgroup_dbg("chown: path is %s\n", *path);
-	fts = fts_open(path, FTS_PHYSICAL | FTS_NOCHDIR | FTS_NOSTAT, NULL);
-	if (fts == NULL) {
+	path[len] = '\0';
+	close(dirfd);
+}
+
+/**
+ * Apply the ownership and permissions of a walk to a directory tree.
+ *	@param path The root of the tree
+ */
+static int cg_perm_walk(struct cg_perm_walk * const walk, const char * const path)
+{
+	struct stat st;
+	char *buf;
+	int fd;
+
+	cgroup_dbg("chown/chmod: path is %s\n", path);
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st)) {
 		cgroup_warn("cannot open directory %s: %s\n", path, strerror(errno));
 		last_errno = errno;
+		if (fd >= 0)
+			close(fd);
 		return ECGOTHER;
 	}
 
-	while (1) {
-		FTSENT *ent;
-
-		ent = fts_read(fts);
-		if (!ent) {
-			cgroup_warn("fts_read failed\n");
-			break;
-		}
-		ret = cg_chown_file(fts, ent, owner, group);
+	buf = malloc(FILENAME_MAX);
+	if (!buf) {
+		last_errno = errno;
+		close(fd);
+		return ECGOTHER;
 	}
-	fts_close(fts);
+	snprintf(buf, FILENAME_MAX, "%s", path);
 
-	return ret;
+	walk->ret = 0;
+	cg_perm_walk_apply(walk, fd, "", buf, &st);
+	cg_perm_walk_dir(walk, fd, buf);
+	free(buf);
+
+	return walk->ret;
 }
 
 int cg_chmod_path(const char *path, mode_t mode, int owner_is_umask)
 {
-	mode_t mask = -1U;
 	struct stat buf;
 	int fd;
 
@@ -217,25 +458,11 @@ int cg_chmod_path(const char *path, mode_t mode, int owner_is_umask)
 	if (fd == -1)
 		goto fail;
 
-	if (owner_is_umask) {
-		mode_t umask, gmask, omask;
-		/*
-		 * Use owner permissions as an umask for group and others
-		 * permissions because we trust kernel to initialize owner
-		 * permissions to something useful.  Keep SUID and SGID bits.
-		 */
-		if (fstat(fd, &buf) == -1)
-			goto fail;
-
-		/* 0700 == S_IRWXU */
-		umask = 0700 & buf.st_mode;
-		gmask = umask >> 3;
-		omask = gmask >> 3;
-
-		mask = umask|gmask|omask|S_ISUID|S_ISGID|S_ISVTX;
-	}
+	if (fstat(fd, &buf) == -1)
+		goto fail;
 
-	if (fchmod(fd, mode & mask))
+	mode = cg_chmod_mode(&buf, mode, owner_is_umask);
+	if ((buf.st_mode & 07777) != mode && fchmod(fd, mode))
 		goto fail;
 
 	close(fd);
@@ -252,37 +479,6 @@ fail:
 	return ECGOTHER;
 }
 
-int cg_chmod_file(FTS *fts, FTSENT *ent, mode_t dir_mode, int dirm_change, mode_t file_mode,
-		  int filem_change, int owner_is_umask)
-{
-	const char *filename = fts->fts_path;
-	int ret = 0;
-
-	cgroup_dbg("chmod: seeing file %s\n", filename);
-
-	switch (ent->fts_info) {
-	case FTS_ERR:
-		errno = ent->fts_errno;
-		break;
-	case FTS_D:
-	case FTS_DC:
-	case FTS_DNR:
-	case FTS_DP:
-		if (dirm_change)
-			ret = cg_chmod_path(filename, dir_mode, owner_is_umask);
-		break;
-	case FTS_F:
-	case FTS_NSOK:
-	case FTS_NS:
-	case FTS_DEFAULT:
-		if (filem_change)
-			ret = cg_chmod_path(filename, file_mode, owner_is_umask);
-		break;
-	}
-
-	return ret;
-}
-
 /**
  * Changes permissions of all directories and control files (i.e. all files
  * except files named in ignore_list. The list must be terminated with NULL.
@@ -291,57 +487,70 @@ static int cg_chmod_recursive_controller(char *path, mode_t dir_mode, int dirm_c
 					 mode_t file_mode, int filem_change, int owner_is_umask,
 					 const char * const *ignore_list)
 {
-	int final_ret = 0;
-	char *fts_path[2];
-	int i, ignored;
-	int ret = 0;
-	FTS *fts;
+	struct cg_perm_walk walk = {
+		.dir_mode = dir_mode,
+		.dirm_change = dirm_change,
+		.file_mode = file_mode,
+		.filem_change = filem_change,
+		.owner_is_umask = owner_is_umask,
+		.ignore_list = ignore_list,
+	};
 
-	fts_path[0] = path;
-	fts_path[1] = NULL;
-	cgroup_dbg("chmod: path is %s\n", path);
+	return cg_perm_walk(&walk, path);
+}
 
-	fts = fts_open(fts_path, FTS_PHYSICAL | FTS_NOCHDIR | FTS_NOSTAT, NULL);
-	if (fts == NULL) {
-		cgroup_warn("cannot open directory %s: %s\n", fts_path, strerror(errno));
-		last_errno = errno;
-		return ECGOTHER;
-	}
+/**
+ * Change the ownership, then the permissions, of a new cgroup directory and
+ * of the files the kernel created in it, in a single walk.
+ */
+static int cg_chown_chmod_recursive(const struct cgroup * const cgroup, const char * const path)
+{
+	struct cg_perm_walk walk = {
+		.chown = true,
+		.owner = cgroup->control_uid,
+		.group = cgroup->control_gid,
+		.dir_mode = cgroup->control_dperm,
+		.dirm_change = cgroup->control_dperm != NO_PERMS,
+		.file_mode = cgroup->control_fperm,
+		.filem_change = cgroup->control_fperm != NO_PERMS,
+		.owner_is_umask = 1,
+		.ignore_list = cgroup_ignored_tasks_files,
+	};
 
-	while (1) {
-		FTSENT *ent;
+	if (walk.owner == NO_UID_GID)
+		walk.owner = getuid();
+	if (walk.group == NO_UID_GID)
+		walk.group = getgid();
 
-		ent = fts_read(fts);
-		if (!ent) {
-			if (errno != 0) {
-				cgroup_dbg("fts_read failed\n");
-				last_errno = errno;
-				final_ret = ECGOTHER;
-			}
-			break;
-		}
+	return cg_perm_walk(&walk, path);
+}
 
-		ignored = 0;
-		if (ignore_list != NULL)
-			for (i = 0; ignore_list[i] != NULL; i++)
-				if (!strcmp(ignore_list[i], ent->fts_name)) {
-					ignored = 1;
-					break;
-				}
-		if (ignored)
-			continue;
+/**
+ * Check whether a controller of a cgroup shares its directory with one of the
+ * previous controllers, as the cgroup v2 and the co-mounted v1 controllers do.
+ */
+static bool cg_controller_dir_seen(const struct cgroup * const cgroup, int idx)
+{
+	bool seen = false;
+	char *path, *prev;
+	int i;
 
-		ret = cg_chmod_file(fts, ent, dir_mode, dirm_change, file_mode, filem_change,
-				    owner_is_umask);
-		if (ret) {
-			cgroup_warn("cannot change file mode %s: %s\n", fts_path, strerror(errno));
-			last_errno = errno;
-			final_ret = ECGOTHER;
-		}
-	}
-	fts_close(fts);
+	path = malloc(FILENAME_MAX * 2);
+	if (!path)
+		return false;
+	prev = path + FILENAME_MAX;
 
-	return final_ret;
+	if (!cg_build_path(cgroup->name, path, cgroup->controller[idx]->name))
+		goto out;
+
+	for (i = 0; i < idx && !seen; i++)
+		seen = cg_build_path(cgroup->name, prev, cgroup->controller[i]->name) &&
+		       !strcmp(path, prev);
+
+out:
+	free(path);
+
+	return seen;
 }
 
 int cg_chmod_recursive(struct cgroup *cgroup, mode_t dir_mode, int dirm_change, mode_t file_mode,
@@ -362,6 +571,9 @@ int cg_chmod_recursive(struct cgroup *cgroup, mode_t dir_mode, int dirm_change,
 			break;
 		}
 
+		if (cg_controller_dir_seen(cgroup, i))
+			continue;
+
 		ret = cg_chmod_recursive_controller(path, dir_mode, dirm_change, file_mode,
 						    filem_change, 0, NULL);
 		if (ret)
@@ -405,38 +617,30 @@ static char *cgroup_basename(const char *path)
 
 int cgroup_test_subsys_mounted(const char *name)
 {
-	int i;
+	int ret;
 
 	pthread_rwlock_rdlock(&cg_mount_table_lock);
 
-	for (i = 0; cg_mount_table[i].name[0] != '\0'; i++) {
-		if (strncmp(cg_mount_table[i].name, name, sizeof(cg_mount_table[i].name)) == 0) {
-			pthread_rwlock_unlock(&cg_mount_table_lock);
-			return 1;
-		}
+	ret = cg_mount_table_find(name) >= 0;
 
-		/*
-		 * The user has likely requested a file like cgroup.type or
-		 * cgroup.procs. Allow this request as long as there's a
-		 * cgroup v2 controller mounted.
-		 */
-		if (strncmp(name, CGROUP_FILE_PREFIX, strlen(CGROUP_FILE_PREFIX)) == 0 &&
-		    cg_mount_table[i].version == CGROUP_V2) {
-			pthread_rwlock_unlock(&cg_mount_table_lock);
-			return 1;
-		}
-	}
+	/*
+	 * The user has likely requested a file like cgroup.type or
+	 * cgroup.procs. Allow this request as long as there's a
+	 * cgroup v2 controller mounted.
+	 */
+	if (!ret && strncmp(name, CGROUP_FILE_PREFIX, strlen(CGROUP_FILE_PREFIX)) == 0)
+		ret = cg_mount_table_find_v2() >= 0;
 
 	pthread_rwlock_unlock(&cg_mount_table_lock);
 
-	return 0;
+	return ret;
 }
 
 /**
  * Free a single cgroup_rule struct.
  *	@param r The rule to free from memory
  */
-static void cgroup_free_rule(struct cgroup_rule *r)
+void cgroup_free_rule(struct cgroup_rule *r)
 {
 	/* Loop variable */
 	int i = 0;
@@ -450,6 +654,7 @@ static void cgroup_free_rule(struct cgroup_rule *r)
 		free(r->procname);
 		r->procname = NULL;
 	}
+	cg_procname_free(&r->pattern);
 	/* We must free any used controller strings, too. */
 	for (i = 0; i < MAX_MNT_ELEMENTS; i++) {
 		if (r->controllers[i])
@@ -460,15 +665,25 @@ static void cgroup_free_rule(struct cgroup_rule *r)
 }
 
 /**
- * Free a list of cgroup_rule structs.  If rl is the main list of rules, the
- * lock must be taken for writing before calling this function!
+ * Free a list of cgroup_rule structs.  If rl is the list being parsed, the
+ * lock must be taken before calling this function!
  *	@param rl Pointer to the list of rules to free from memory
  */
-static void cgroup_free_rule_list(struct cgroup_rule_list *cg_rl)
+void cgroup_free_rule_list(struct cgroup_rule_list *cg_rl)
 {
 	/* Temporary pointer */
 	struct cgroup_rule *tmp = NULL;
 
+	/* The index points into the list, it must go first */
+	cgroup_rule_index_free(&cg_rl->index);
+
+	if (cg_rl->replaced) {
+		if (cg_rl->replaced->head)
+			cgroup_free_rule_list(cg_rl->replaced);
+		free(cg_rl->replaced);
+		cg_rl->replaced = NULL;
+	}
+
 	/* Make sure we're not freeing NULL memory! */
 	if (!(cg_rl->head)) {
 		cgroup_warn("attempted to free NULL list\n");
@@ -486,45 +701,279 @@ static void cgroup_free_rule_list(struct cgroup_rule_list *cg_rl)
 	cg_rl->tail = NULL;
 }
 
-static char *cg_skip_unused_charactors_in_rule(char *rule)
+/**
+ * Free a published list of rules, once no reader can see it.
+ *	@param data The struct cgroup_rule_list to free
+ */
+static void cgroup_release_rule_list(void *data)
 {
-	char *itr;
+	struct cgroup_rule_list *lst = data;
 
-	/* We ignore anything after a # sign as comments. */
-	itr = strchr(rule, '#');
-	if (itr)
-		*itr = '\0';
+	cgroup_free_rule_list(lst);
+	free(lst);
+}
 
-	/* We also need to remove the newline character. */
-	itr = strchr(rule, '\n');
-	if (itr)
-		*itr = '\0';
+static bool cgroup_rule_equal(const struct cgroup_rule * const a,
+			      const struct cgroup_rule * const b)
+{
+	int i;
 
-	/* Now, skip any leading tabs and spaces. */
-	itr = rule;
-	while (itr && isblank(*itr))
-		itr++;
+	if (a->uid != b->uid || a->gid != b->gid || a->is_ignore != b->is_ignore)
+		return false;
 
-	/* If there's nothing left, we can ignore this line. */
-	if (!strlen(itr))
-		return NULL;
+	if ((a->procname || b->procname) &&
+	    (!a->procname || !b->procname || strcmp(a->procname, b->procname)))
+		return false;
 
-	return itr;
+	if (strcmp(a->username, b->username) || strcmp(a->destination, b->destination))
+		return false;
+
+	for (i = 0; i < MAX_MNT_ELEMENTS; i++) {
+		if (!a->controllers[i] || !b->controllers[i])
+			return a->controllers[i] == b->controllers[i];
+		if (strcmp(a->controllers[i], b->controllers[i]))
+			return false;
+	}
+
+	return true;
 }
 
 /**
- * Parse the options field in the rule from the cgrules configuration file
- *
- *	@param options Comma-separated string of options
- *	@param rule The rule that will contain the parsed options
- *	@return 0 on success, -EINVAL if the options are invalid
- * TODO: Make this function thread safe!
+ * Append a rule to a list.
+ *	@param lst The list
+ *	@param rule The rule, which the list takes
  */
-STATIC int cgroup_parse_rules_options(char *options, struct cgroup_rule * const rule)
+static void cgroup_rule_list_append(struct cgroup_rule_list * const lst,
+				    struct cgroup_rule * const rule)
 {
-	char *stok_buff = NULL;
-	size_t cmp_len;
-	int ret = 0;
+	rule->next = NULL;
+	if (lst->tail)
+		lst->tail->next = rule;
+	else
+		lst->head = rule;
+	lst->tail = rule;
+}
+
+/**
+ * Copy a rule, without the rules following it.
+ *	@param rule The rule to copy
+ *	@return The copy, to be freed with cgroup_free_rule(), NULL on error
+ */
+static struct cgroup_rule *cgroup_dup_rule(const struct cgroup_rule * const rule)
+{
+	struct cgroup_rule *dup;
+	int i;
+
+	dup = calloc(1, sizeof(struct cgroup_rule));
+	if (!dup)
+		goto err;
+
+	dup->uid = rule->uid;
+	dup->gid = rule->gid;
+	dup->is_ignore = rule->is_ignore;
+	memcpy(dup->username, rule->username, sizeof(dup->username));
+	memcpy(dup->destination, rule->destination, sizeof(dup->destination));
+
+	if (rule->procname) {
+		dup->procname = strdup(rule->procname);
+		if (!dup->procname)
+			goto err;
+
+		/* The name was compiled once already, only an allocation can fail */
+		if (cg_procname_compile(&dup->pattern, dup->procname))
+			goto err;
+	}
+
+	for (i = 0; i < MAX_MNT_ELEMENTS && rule->controllers[i]; i++) {
+		dup->controllers[i] = strdup(rule->controllers[i]);
+		if (!dup->controllers[i])
+			goto err;
+	}
+
+	return dup;
+
+err:
+	last_errno = errno;
+	if (dup)
+		cgroup_free_rule(dup);
+
+	return NULL;
+}
+
+/**
+ * Mark the leading and the trailing rules of lst which are the same as in
+ * the previous list, and keep copies of the previous rules found between
+ * them in lst->replaced.  A pid whose first matching rule is one of the
+ * unchanged rules is classified the same way by both lists, unless it also
+ * matches one of the replaced rules, which came before the trailing rules.
+ * A multi-line rule is unchanged only if all its lines are.
+ *	@param old The previously published rules, may be NULL
+ *	@param lst The new rules
+ */
+STATIC void cgroup_mark_unchanged_rules(const struct cgroup_rule_list * const old,
+					struct cgroup_rule_list * const lst)
+{
+	struct cgroup_rule *o_group = NULL, *n_group = NULL, *o_tail = NULL, *n_tail = NULL;
+	struct cgroup_rule *o, *n, *r, *o_start, *dup;
+	int old_len = 0, new_len = 0;
+
+	for (n = lst->head; n; n = n->next)
+		n->unchanged = false;
+
+	if (!old)
+		return;
+
+	for (o = old->head, n = lst->head; o && n; o = o->next, n = n->next) {
+		if (!cgroup_rule_equal(o, n))
+			break;
+		if (n->username[0] != '%') {
+			o_group = o;
+			n_group = n;
+		}
+		n->unchanged = true;
+	}
+
+	/* The walk stopped within a multi-line rule, which changed */
+	if (n_group && ((o && o->username[0] == '%') || (n && n->username[0] == '%'))) {
+		for (r = n_group; r != n; r = r->next)
+			r->unchanged = false;
+		o = o_group;
+		n = n_group;
+	}
+
+	/* The trailing rules are compared at the same distance from the end */
+	o_start = o;
+	for (r = o; r; r = r->next)
+		old_len++;
+	for (r = n; r; r = r->next)
+		new_len++;
+	for (; old_len > new_len; old_len--)
+		o = o->next;
+	for (; new_len > old_len; new_len--)
+		n = n->next;
+
+	for (; o && n; o = o->next, n = n->next) {
+		if (!cgroup_rule_equal(o, n)) {
+			o_tail = NULL;
+			n_tail = NULL;
+		} else if (!n_tail && n->username[0] != '%') {
+			o_tail = o;
+			n_tail = n;
+		}
+	}
+
+	for (n = n_tail; n; n = n->next)
+		n->unchanged = true;
+
+	/* Rules were only added */
+	if (o_start == o_tail)
+		return;
+
+	lst->replaced = calloc(1, sizeof(struct cgroup_rule_list));
+	if (!lst->replaced)
+		goto err;
+
+	for (o = o_start; o != o_tail; o = o->next) {
+		dup = cgroup_dup_rule(o);
+		if (!dup)
+			goto err;
+		cgroup_rule_list_append(lst->replaced, dup);
+	}
+
+	return;
+
+err:
+	/* Without the replaced rules, the trailing rules may have been shadowed */
+	cgroup_warn("cannot copy the replaced rules\n");
+	for (n = n_tail; n; n = n->next)
+		n->unchanged = false;
+	if (lst->replaced) {
+		if (lst->replaced->head)
+			cgroup_free_rule_list(lst->replaced);
+		free(lst->replaced);
+		lst->replaced = NULL;
+	}
+}
+
+/**
+ * Publish rl as the cached rules, and leave it empty for the next parse.
+ * The previous rules are freed once their readers are done.  An empty list
+ * is published as NULL.  rl_lock must be held.
+ *	@return 0 on success, ECGOTHER if the list could not be allocated
+ */
+static int cgroup_publish_rules(void)
+{
+	struct cgroup_rule_list *lst = NULL, *old;
+	int ret = 0;
+	int slot;
+
+	if (rl.head) {
+		lst = malloc(sizeof(struct cgroup_rule_list));
+		if (!lst) {
+			last_errno = errno;
+			cgroup_free_rule_list(&rl);
+			ret = ECGOTHER;
+		} else {
+			*lst = rl;
+
+			/* rl_lock is held, the previous rules cannot go away */
+			old = cg_snapshot_get(&rules, &slot);
+			cgroup_mark_unchanged_rules(old, lst);
+			cg_snapshot_put(&rules, slot);
+		}
+	}
+	memset(&rl, 0, sizeof(rl));
+
+	cg_snapshot_publish(&rules, lst);
+
+	return ret;
+}
+
+static char *cg_skip_unused_charactors_in_rule(char *rule)
+{
+	char *itr;
+
+	/* We ignore anything after a # sign as comments. */
+	itr = strchr(rule, '#');
+	if (itr)
+		*itr = '\0';
+
+	/* We also need to remove the newline character. */
+	itr = strchr(rule, '\n');
+	if (itr)
+		*itr = '\0';
+
+	/* Now, skip any leading tabs and spaces. */
+	itr = rule;
+	while (itr && isblank(*itr))
+		itr++;
+
+	/* If there's nothing left, we can ignore this line. */
+	if (!strlen(itr))
+		return NULL;
+
+	return itr;
+}
+
+/**
+ * Parse the options field in the rule from the cgrules configuration file
+ *
+ *	@param options Comma-separated string of options
+ *	@param rule The rule that will contain the parsed options
+ *	@return 0 on success, -EINVAL if the options are invalid
+ * TODO: Make this function thread safe!
+ */
+STATIC int cgroup_parse_rules_options(char *options, struct cgroup_rule * const rule)
+{
+	char *stok_buff = NULL;
+	size_t cmp_len;
+	int ret = 0;
+
+	/* strtok() would go on with the string of its previous call */
+	if (!options) {
+		cgroup_err("failed to parse options: (null)\n");
+		return -EINVAL;
+	}
 
 	stok_buff = strtok(options, ",");
 	if (!stok_buff) {
@@ -588,6 +1037,7 @@ static int cgroup_parse_rules_file(char *filename, bool cache, uid_t muid, gid_t
 
 	/* Pointer to process name in a line of the configuration file */
 	char *procname = NULL;
+	struct cg_procname_pattern pattern;
 
 	/* Pointer to the list that we're using */
 	struct cgroup_rule_list *lst = NULL;
@@ -724,6 +1174,8 @@ static int cgroup_parse_rules_file(char *filename, bool cache, uid_t muid, gid_t
 			/* New GID rule. */
 			itr = &(user[1]);
 			grp = getgrnam(itr);
+			if (cache && !(grp && cg_rules_name_in_files(itr, true)))
+				rules_nss_names = true;
 			if (grp) {
 				uid = CGRULE_INVALID;
 				gid = grp->gr_gid;
@@ -740,6 +1192,8 @@ static int cgroup_parse_rules_file(char *filename, bool cache, uid_t muid, gid_t
 		} else if (*itr != '%') {
 			/* New UID rule. */
 			pwd = getpwnam(user);
+			if (cache && !(pwd && cg_rules_name_in_files(user, false)))
+				rules_nss_names = true;
 			if (pwd) {
 				uid = pwd->pw_uid;
 				gid = CGRULE_INVALID;
@@ -775,32 +1229,50 @@ static int cgroup_parse_rules_file(char *filename, bool cache, uid_t muid, gid_t
 		if (uid == muid || gid == mgid || uid == CGRULE_WILD)
 			matched = true;
 
-		if (!cache) {
-			if (!matched)
+		if (!cache && !matched)
+			continue;
+
+		memset(&pattern, 0, sizeof(pattern));
+		if (len_procname) {
+			ret = cg_procname_compile(&pattern, procname);
+			if (ret == ECGINVAL) {
+				cgroup_warn("invalid process name %s. Skipping rule on line %d.\n",
+					    procname, linenum);
+				uid = CGRULE_INVALID;
+				gid = CGRULE_INVALID;
+				matched = false;
+				skipped = true;
+				ret = 0;
 				continue;
-			if (len_procname) {
-				char *mproc_base;
-				/*
-				 * If there is a rule based on process name,
-				 * it should be matched with mprocname.
-				 */
-				if (!mprocname) {
-					uid = CGRULE_INVALID;
-					gid = CGRULE_INVALID;
-					matched = false;
-					continue;
-				}
+			} else if (ret) {
+				goto close;
+			}
+		}
 
-				mproc_base = cgroup_basename(mprocname);
-				if (strcmp(mprocname, procname) && strcmp(mproc_base, procname)) {
-					uid = CGRULE_INVALID;
-					gid = CGRULE_INVALID;
-					matched = false;
-					free(mproc_base);
-					continue;
-				}
+		if (!cache && len_procname) {
+			char *mproc_base;
+			/*
+			 * If there is a rule based on process name,
+			 * it should be matched with mprocname.
+			 */
+			if (!mprocname) {
+				uid = CGRULE_INVALID;
+				gid = CGRULE_INVALID;
+				matched = false;
+				cg_procname_free(&pattern);
+				continue;
+			}
+
+			mproc_base = cgroup_basename(mprocname);
+			if (!cg_procname_match(&pattern, procname, mprocname, mproc_base)) {
+				uid = CGRULE_INVALID;
+				gid = CGRULE_INVALID;
+				matched = false;
 				free(mproc_base);
+				cg_procname_free(&pattern);
+				continue;
 			}
+			free(mproc_base);
 		}
 
 		/*
@@ -812,6 +1284,7 @@ static int cgroup_parse_rules_file(char *filename, bool cache, uid_t muid, gid_t
 		if (!newrule) {
 			cgroup_err("out of memory? Error was: %s\n", strerror(errno));
 			last_errno = errno;
+			cg_procname_free(&pattern);
 			ret = ECGOTHER;
 			goto close;
 		}
@@ -831,9 +1304,11 @@ static int cgroup_parse_rules_file(char *filename, bool cache, uid_t muid, gid_t
 					   strerror(errno));
 				free(newrule);
 				last_errno = errno;
+				cg_procname_free(&pattern);
 				ret = ECGOTHER;
 				goto close;
 			}
+			newrule->pattern = pattern;
 		} else {
 			newrule->procname = NULL;
 		}
@@ -907,142 +1382,512 @@ finish:
 }
 
 /**
- * Parse CGRULES_CONF_FILE and all files in CGRULES_CONF_FILE_DIR.
- * If CGRULES_CONF_FILE_DIR does not exists or can not be read, parse only
- * CGRULES_CONF_FILE. This way we keep the back compatibility.
- *
- * Original description of this function moved to cgroup_parse_rules_file.
- * Also cloned and all occurrences of file changed to files.
- *
- * Parse the configuration files that maps UID/GIDs to cgroups. If ever the
- * configuration files are modified, applications should call this function to
- * load the new configuration rules. The function caller is responsible for
- * calling free() on each rule in the list.
- *
- * The cache parameter alters the behavior of this function.  If true, this
- * function will read the entire content of all configuration files and store
- * the results in rl (global rules list). If false, this function will only
- * parse until it finds a file and a rule matching the given UID or GID.
- * The remaining files are skipped. It will store this rule in trl, as well as
- * any children rules (rules that begin with a %) that it has.
- *
- * Files can be read in an random order so the first match must not be
- * dependent on it. Thus construct the rules the way not to break this
- * assumption.
- *
- * This function is NOT thread safe!
- *	@param cache True to cache rules, else false
- *	@param muid If cache is false, the UID to match against
- *	@param mgid If cache is false, the GID to match against
- *	@return 0 on success, -1 if no cache and match found, > 0 on error.
- * TODO: Make this function thread safe!
+ * Reentrant getgrnam(), the buffer grows until the group entry fits.
+ *	@param name Name of the group
+ *	@param grp Storage of the group entry
+ *	@param buffer Storage of the group strings, to be freed by the caller
+ *	@return grp on success, NULL if the group was not found or on error
  */
-static int cgroup_parse_rules(bool cache, uid_t muid, gid_t mgid, const char *mprocname)
+struct group *cg_getgrnam(const char *name, struct group *grp, char **buffer)
 {
-	/* Pointer to the list that we're using */
-	struct cgroup_rule_list *lst = NULL;
-
-	/* Directory variables */
-	const char *dirname = CGRULES_CONF_DIR;
-	struct dirent *item;
+	struct group *result = NULL;
+	size_t len = CGROUP_BUFFER_LEN;
 	char *tmp;
-	int sret;
-	DIR *d;
-
 	int ret;
 
-	/* Determine which list we're using. */
-	if (cache)
-		lst = &rl;
-	else
-		lst = &trl;
+	*buffer = NULL;
+	do {
+		tmp = realloc(*buffer, len);
+		if (!tmp) {
+			last_errno = errno;
+			return NULL;
+		}
 
-	/* If our list already exists, clean it. */
-	if (lst->head)
-		cgroup_free_rule_list(lst);
+		*buffer = tmp;
+		ret = getgrnam_r(name, grp, *buffer, len, &result);
+		len *= 2;
+	} while (ret == ERANGE);
 
-	pthread_rwlock_wrlock(&rl_lock);
+	return result;
+}
 
-	/* Parse CGRULES_CONF_FILE configuration file (back compatibility). */
-	ret = cgroup_parse_rules_file(CGRULES_CONF_FILE, cache, muid, mgid, mprocname);
+/**
+ * Compile the cached rules list into an index used by
+ * cgroup_find_matching_rule().  If the index cannot be built, the rules are
+ * still usable, the lookup simply falls back to scanning the list.
+ * rl_lock must be taken before calling this function.
+ *	@param lst The list of rules to index
+ */
+static void cgroup_build_rules_index(struct cgroup_rule_list *lst)
+{
+	int ret;
 
-	/*
-	 * if match (ret = -1), stop parsing other files,
-	 * just return or ret > 0 => error
-	 */
-	if (ret != 0) {
-		pthread_rwlock_unlock(&rl_lock);
-		return ret;
+	cgroup_rule_index_free(&lst->index);
+	if (!lst->head)
+		return;
+
+	ret = cgroup_rule_index_build(lst->head, &lst->index);
+	if (ret) {
+		cgroup_warn("failed to build the rules index: %s\n", cgroup_strerror(ret));
+		return;
 	}
 
-	/* Continue parsing */
-	d = opendir(dirname);
-	if (!d) {
-		cgroup_warn("Failed to open directory %s: %s\n", dirname, strerror(errno));
+	/* Resolve the group members now rather than on the first event */
+	if (group_cache_ttl)
+		cgroup_rule_index_resolve_groups(lst->index);
+}
 
-		/*
-		 * Cannot read directory. However, CGRULES_CONF_FILE is
-		 * successfully parsed. Thus return as a success for back
-		 * compatibility.
-		 */
-		pthread_rwlock_unlock(&rl_lock);
+/**
+ * Check whether the user of a non-cache lookup is a member of the group of a
+ * rule, like cgroup_parse_rules_file() does with the group entry.
+ *	@param gid The group of the rule
+ *	@param muid The UID to match against
+ *	@return true if muid is listed as a member of gid
+ */
+static bool cgroup_rule_group_has_user(gid_t gid, uid_t muid)
+{
+	struct passwd *pwd;
+	struct group *grp;
+	int i;
 
-		return 0;
+	grp = getgrgid(gid);
+	if (!grp)
+		return false;
+
+	pwd = getpwuid(muid);
+	if (!pwd)
+		return false;
+
+	for (i = 0; grp->gr_mem[i]; i++) {
+		if (!strcmp(pwd->pw_name, grp->gr_mem[i]))
+			return true;
 	}
 
-	/* Read all files from CGRULES_CONF_FILE_DIR */
-	do {
-		item = readdir(d);
-		if (item && (item->d_type == DT_REG || item->d_type == DT_LNK)) {
+	return false;
+}
 
-			sret = asprintf(&tmp, "%s/%s", dirname, item->d_name);
-			if (sret < 0) {
-				cgroup_err("Out of memory\n");
+/**
+ * Move the first rule of all matching muid, mgid and mprocname, with its
+ * children rules, to trl, as the non-cache cgroup_parse_rules_file() would
+ * find it.  The other rules are freed.  rl_lock must be held.
+ *	@param all The rules of all the configuration files
+ *	@param muid The UID to match against
+ *	@param mgid The GID to match against
+ *	@param mprocname The process name to match against
+ *	@return -1 if a rule matched, 0 otherwise.
+ */
+static int cgroup_select_rules(struct cgroup_rule_list *all, uid_t muid, gid_t mgid,
+			       const char *mprocname)
+{
+	struct cgroup_rule *rule, *last;
+	bool matched = false;
+	char *mproc_base;
 
-				/*
-				 * Cannot read directory.
-				 * However, CGRULES_CONF_FILE is successfully
-				 * parsed. Thus return as a success for back
-				 * compatibility.
-				 */
-				ret = 0;
-				goto unlock_list;
+	for (rule = all->head; rule; rule = rule->next) {
+		if (rule->username[0] == '%')
+			continue;
+
+		if (rule->uid == muid || rule->gid == mgid || rule->uid == CGRULE_WILD)
+			matched = true;
+		else if (rule->gid != CGRULE_INVALID && rule->gid != CGRULE_WILD &&
+			 muid != CGRULE_INVALID)
+			matched = cgroup_rule_group_has_user(rule->gid, muid);
+
+		if (matched && rule->procname) {
+			if (!mprocname) {
+				matched = false;
+			} else {
+				mproc_base = cgroup_basename(mprocname);
+				if (!cg_procname_match(&rule->pattern, rule->procname, mprocname,
+						       mproc_base))
+					matched = false;
+				free(mproc_base);
 			}
+		}
 
-			cgroup_dbg("Parsing cgrules file: %s\n", tmp);
-			ret = cgroup_parse_rules_file(tmp, cache, muid, mgid, mprocname);
+		if (matched)
+			break;
+	}
 
-			free(tmp);
+	if (!matched) {
+		if (all->head)
+			cgroup_free_rule_list(all);
+		return 0;
+	}
 
-			/* Match with cache disabled? */
-			if (ret != 0)
-				goto unlock_list;
-		}
-		if (!item && errno) {
-			cgroup_warn("cannot read %s: %s\n", dirname, strerror(errno));
-			/*
-			 * Cannot read an item.
-			 * But continue for back compatibility as a success.
-			 */
-			ret = 0;
-			goto unlock_list;
-		}
-	} while (item != NULL);
+	/* The matched rule and its children, the rules beginning with % */
+	for (last = rule; last->next && last->next->username[0] == '%'; last = last->next)
+		;
 
-unlock_list:
-	closedir(d);
-	pthread_rwlock_unlock(&rl_lock);
+	trl.head = rule;
+	trl.tail = last;
 
-	return ret;
+	/* Free the rules before and after them */
+	for (rule = all->head; rule != trl.head; rule = all->head) {
+		all->head = rule->next;
+		cgroup_free_rule(rule);
+	}
+	all->head = last->next;
+	last->next = NULL;
+	if (all->head)
+		cgroup_free_rule_list(all);
+
+	return -1;
 }
 
-int cg_add_duplicate_mount(struct cg_mount_table_s *item, const char *path)
+static bool cg_rules_stat_equal(const struct stat * const a, const struct stat * const b)
 {
-	struct cg_mount_point *mount, *it;
+	return a->st_dev == b->st_dev && a->st_ino == b->st_ino && a->st_size == b->st_size &&
+	       a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+	       a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+	       a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+	       a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
 
-	mount = malloc(sizeof(struct cg_mount_point));
-	if (!mount) {
-		last_errno = errno;
+static void cg_rules_segments_free(struct cg_rules_segment *seg)
+{
+	struct cg_rules_segment *next;
+
+	for (; seg; seg = next) {
+		next = seg->next;
+		if (seg->rules.head)
+			cgroup_free_rule_list(&seg->rules);
+		free(seg->path);
+		free(seg);
+	}
+}
+
+/**
+ * Drop the segments if the user and group databases changed since they
+ * were parsed, the names of their rules may not resolve the same way.
+ * rl_lock must be held.
+ *	@param sources The files the rules are parsed from, NULL if unknown
+ */
+static void cg_rules_segments_check_deps(const struct cg_rules_sources * const sources)
+{
+	struct stat *deps = NULL;
+	bool same = false;
+	int i, cnt = 0;
+
+	if (sources) {
+		cnt = sources->count - sources->deps;
+		deps = malloc(cnt * sizeof(struct stat));
+		if (deps)
+			memcpy(deps, &sources->st[sources->deps], cnt * sizeof(struct stat));
+	}
+
+	if (deps && rules_segments_deps && cnt == rules_segments_deps_cnt) {
+		same = true;
+		for (i = 0; i < cnt; i++) {
+			if (!cg_rules_stat_equal(&deps[i], &rules_segments_deps[i]))
+				same = false;
+		}
+	}
+
+	if (!same) {
+		cg_rules_segments_free(rules_segments);
+		rules_segments = NULL;
+	}
+
+	free(rules_segments_deps);
+	rules_segments_deps = deps;
+	rules_segments_deps_cnt = deps ? cnt : 0;
+}
+
+/**
+ * Parse a rules file into rl, or copy its rules from its segment if the
+ * file did not change since it was parsed.  rl_lock must be held.
+ *	@param filename The file to parse
+ *	@param old The segments of the previous parse, the one of the file is
+ *	taken out of them
+ *	@param tail Where the segment of the file is linked, moved past it
+ *	@return 0 on success, > 0 on error
+ */
+static int cgroup_parse_rules_segment(char *filename, struct cg_rules_segment **old,
+				      struct cg_rules_segment ***tail)
+{
+	struct cg_rules_segment *seg = NULL, **prev;
+	struct cgroup_rule *last, *rule, *dup;
+	bool nss_names;
+	struct stat st;
+	int ret;
+
+	/* The files are read in the same order, it is usually the first one */
+	for (prev = old; *prev; prev = &(*prev)->next) {
+		if (!strcmp((*prev)->path, filename)) {
+			seg = *prev;
+			*prev = seg->next;
+			seg->next = NULL;
+			break;
+		}
+	}
+
+	/* A change while the file is parsed is noticed by the next reload */
+	if (stat(filename, &st)) {
+		cg_rules_segments_free(seg);
+		return cgroup_parse_rules_file(filename, true, CGRULE_INVALID, CGRULE_INVALID,
+					       NULL);
+	}
+
+	if (seg && cg_rules_stat_equal(&seg->st, &st)) {
+		cgroup_dbg("Reusing the rules of %s\n", filename);
+		for (rule = seg->rules.head; rule; rule = rule->next) {
+			dup = cgroup_dup_rule(rule);
+			if (!dup) {
+				cg_rules_segments_free(seg);
+				return ECGOTHER;
+			}
+			cgroup_rule_list_append(&rl, dup);
+		}
+		goto link;
+	}
+
+	cg_rules_segments_free(seg);
+
+	last = rl.tail;
+	nss_names = rules_nss_names;
+	rules_nss_names = false;
+	ret = cgroup_parse_rules_file(filename, true, CGRULE_INVALID, CGRULE_INVALID, NULL);
+	if (ret)
+		return ret;
+
+	/* Its names are resolved again by the next reload */
+	if (rules_nss_names)
+		return 0;
+	rules_nss_names = nss_names;
+
+	/* Without its segment, the file is parsed again by the next reload */
+	seg = calloc(1, sizeof(struct cg_rules_segment));
+	if (!seg)
+		return 0;
+
+	seg->path = strdup(filename);
+	if (!seg->path)
+		goto drop;
+	seg->st = st;
+
+	for (rule = last ? last->next : rl.head; rule; rule = rule->next) {
+		dup = cgroup_dup_rule(rule);
+		if (!dup)
+			goto drop;
+		cgroup_rule_list_append(&seg->rules, dup);
+	}
+
+link:
+	**tail = seg;
+	*tail = &seg->next;
+
+	return 0;
+
+drop:
+	cg_rules_segments_free(seg);
+
+	return 0;
+}
+
+static int cg_rules_file_filter(const struct dirent *item)
+{
+	return item->d_type == DT_REG || item->d_type == DT_LNK;
+}
+
+/* By name, whatever the locale */
+static int cg_rules_file_compare(const struct dirent **a, const struct dirent **b)
+{
+	return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/**
+ * Read the rules from the compiled cache rather than parsing them, as
+ * cgroup_parse_rules() would read them.  rl_lock must be held.
+ *	@param cache True to cache rules, else false
+ *	@param muid If cache is false, the UID to match against
+ *	@param mgid If cache is false, the GID to match against
+ *	@param ret Set to the return code of cgroup_parse_rules()
+ *	@return true if the rules were read from the cache
+ */
+static bool cgroup_load_compiled_rules(bool cache, uid_t muid, gid_t mgid, const char *mprocname,
+				       int *ret)
+{
+	struct cgroup_rule_list all;
+
+	if (cg_rules_cache_load(CGRULES_CACHE_FILE, cache ? &rl : &all))
+		return false;
+
+	*ret = cache ? 0 : cgroup_select_rules(&all, muid, mgid, mprocname);
+
+	return true;
+}
+
+/**
+ * Parse CGRULES_CONF_FILE and all files in CGRULES_CONF_FILE_DIR.
+ * If CGRULES_CONF_FILE_DIR does not exists or can not be read, parse only
+ * CGRULES_CONF_FILE. This way we keep the back compatibility.
+ *
+ * Original description of this function moved to cgroup_parse_rules_file.
+ * Also cloned and all occurrences of file changed to files.
+ *
+ * Parse the configuration files that maps UID/GIDs to cgroups. If ever the
+ * configuration files are modified, applications should call this function to
+ * load the new configuration rules. The function caller is responsible for
+ * calling free() on each rule in the list.
+ *
+ * The cache parameter alters the behavior of this function.  If true, this
+ * function will read the entire content of all configuration files and store
+ * the results in rl (global rules list). If false, this function will only
+ * parse until it finds a file and a rule matching the given UID or GID.
+ * The remaining files are skipped. It will store this rule in trl, as well as
+ * any children rules (rules that begin with a %) that it has.
+ *
+ * The files of CGRULES_CONF_FILE_DIR are read in the order of their names.
+ * When caching, the rules of each file are kept as its segment, and a file
+ * which did not change since the previous parse is not parsed again.
+ *
+ * This function is NOT thread safe!
+ *	@param cache True to cache rules, else false
+ *	@param muid If cache is false, the UID to match against
+ *	@param mgid If cache is false, the GID to match against
+ *	@return 0 on success, -1 if no cache and match found, > 0 on error.
+ * TODO: Make this function thread safe!
+ */
+static int cgroup_parse_rules(bool cache, uid_t muid, gid_t mgid, const char *mprocname)
+{
+	/* Pointer to the list that we're using */
+	struct cgroup_rule_list *lst = NULL;
+
+	/* Files the rules are parsed from, to compile the cache */
+	struct cg_rules_sources sources;
+	bool compile = false;
+
+	/* Segments of the files, when caching */
+	struct cg_rules_segment *old_segments = NULL, **segments_tail = &rules_segments;
+
+	/* Directory variables */
+	const char *dirname = CGRULES_CONF_DIR;
+	struct dirent **items = NULL;
+	int items_cnt, i;
+	char *tmp;
+	int sret;
+
+	int ret;
+
+	/* Determine which list we're using. */
+	if (cache)
+		lst = &rl;
+	else
+		lst = &trl;
+
+	pthread_mutex_lock(&rl_lock);
+
+	/* If our list already exists, clean it. */
+	if (lst->head)
+		cgroup_free_rule_list(lst);
+
+	if (cgroup_load_compiled_rules(cache, muid, mgid, mprocname, &ret))
+		goto build_index;
+
+	/* The files are recorded first, a change during the parse is noticed */
+	if (cache) {
+		rules_nss_names = false;
+		compile = !cg_rules_sources_collect(CGRULES_CONF_FILE, dirname, &sources);
+
+		cg_rules_segments_check_deps(compile ? &sources : NULL);
+		old_segments = rules_segments;
+		rules_segments = NULL;
+	}
+
+	/* Parse CGRULES_CONF_FILE configuration file (back compatibility). */
+	if (cache)
+		ret = cgroup_parse_rules_segment(CGRULES_CONF_FILE, &old_segments,
+						 &segments_tail);
+	else
+		ret = cgroup_parse_rules_file(CGRULES_CONF_FILE, cache, muid, mgid, mprocname);
+
+	/*
+	 * if match (ret = -1), stop parsing other files,
+	 * just return or ret > 0 => error
+	 */
+	if (ret != 0)
+		goto build_index;
+
+	/* Continue parsing, in the order of the names */
+	items_cnt = scandir(dirname, &items, cg_rules_file_filter, cg_rules_file_compare);
+	if (items_cnt < 0) {
+		cgroup_warn("Failed to open directory %s: %s\n", dirname, strerror(errno));
+
+		/*
+		 * Cannot read directory. However, CGRULES_CONF_FILE is
+		 * successfully parsed. Thus return as a success for back
+		 * compatibility.
+		 */
+		ret = 0;
+		goto build_index;
+	}
+
+	/* Read all files from CGRULES_CONF_FILE_DIR */
+	for (i = 0; i < items_cnt; i++) {
+		sret = asprintf(&tmp, "%s/%s", dirname, items[i]->d_name);
+		if (sret < 0) {
+			cgroup_err("Out of memory\n");
+
+			/*
+			 * Cannot read directory.
+			 * However, CGRULES_CONF_FILE is successfully
+			 * parsed. Thus return as a success for back
+			 * compatibility.
+			 */
+			ret = 0;
+			break;
+		}
+
+		cgroup_dbg("Parsing cgrules file: %s\n", tmp);
+		if (cache)
+			ret = cgroup_parse_rules_segment(tmp, &old_segments, &segments_tail);
+		else
+			ret = cgroup_parse_rules_file(tmp, cache, muid, mgid, mprocname);
+
+		free(tmp);
+
+		/* Match with cache disabled? */
+		if (ret != 0)
+			break;
+	}
+
+	for (i = 0; i < items_cnt; i++)
+		free(items[i]);
+	free(items);
+
+build_index:
+	/* The segments of the files which went away */
+	cg_rules_segments_free(old_segments);
+
+	if (compile) {
+		/* A failure leaves the next processes parsing the rules */
+		if (ret == 0 && !rules_nss_names)
+			cg_rules_cache_store(CGRULES_CACHE_FILE, lst, &sources);
+		else if (ret == 0)
+			unlink(CGRULES_CACHE_FILE);
+		cg_rules_sources_free(&sources);
+	}
+
+	if (cache && ret == 0)
+		cgroup_build_rules_index(lst);
+
+	/* Readers switch to the new rules, the old ones go once they are done */
+	if (cache && cgroup_publish_rules() && ret == 0)
+		ret = ECGOTHER;
+
+	pthread_mutex_unlock(&rl_lock);
+
+	return ret;
+}
+
+int cg_add_duplicate_mount(struct cg_mount_table_s *item, const char *path)
+{
+	struct cg_mount_point *mount, *it;
+
+	mount = malloc(sizeof(struct cg_mount_point));
+	if (!mount) {
+		last_errno = errno;
 		return ECGOTHER;
 	}
 	mount->next = NULL;
@@ -1328,6 +2173,61 @@ out:
 	return ret;
 }
 
+static unsigned int cg_mount_index_hash(const char * const name)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, name) & (CG_MOUNT_INDEX_SIZE - 1);
+}
+
+void cg_mount_index_build(void)
+{
+	struct cgroup_ctx *ctx = cg_ctx();
+	unsigned int slot;
+	int i;
+
+	memset(ctx->mount_index, 0, sizeof(ctx->mount_index));
+	ctx->mount_index_v2 = -1;
+
+	/* The hierarchies may have changed with the table */
+	cg_subtree_cache_invalidate();
+	__atomic_add_fetch(&ctx->mount_table_gen, 1, __ATOMIC_RELAXED);
+
+	for (i = 0; i < CG_CONTROLLER_MAX && (*ctx->mount_table)[i].name[0] != '\0'; i++) {
+		if (ctx->mount_index_v2 < 0 && (*ctx->mount_table)[i].version == CGROUP_V2)
+			ctx->mount_index_v2 = i;
+
+		/* The table has no duplicates, keep the first one anyway */
+		if (cg_mount_table_find((*ctx->mount_table)[i].name) >= 0)
+			continue;
+
+		slot = cg_mount_index_hash((*ctx->mount_table)[i].name);
+		while (ctx->mount_index[slot])
+			slot = (slot + 1) & (CG_MOUNT_INDEX_SIZE - 1);
+
+		ctx->mount_index[slot] = i + 1;
+	}
+}
+
+int cg_mount_table_find(const char * const name)
+{
+	struct cgroup_ctx *ctx = cg_ctx();
+	unsigned int slot;
+	int i;
+
+	for (slot = cg_mount_index_hash(name); ctx->mount_index[slot];
+	     slot = (slot + 1) & (CG_MOUNT_INDEX_SIZE - 1)) {
+		i = ctx->mount_index[slot] - 1;
+		if (strncmp((*ctx->mount_table)[i].name, name, CONTROL_NAMELEN_MAX) == 0)
+			return i;
+	}
+
+	return -1;
+}
+
+int cg_mount_table_find_v2(void)
+{
+	return cg_ctx()->mount_index_v2;
+}
+
 /*
  * Free global variables filled by previous cgroup_init(). This function
  * should be called with cg_mount_table_lock taken.
@@ -1348,6 +2248,7 @@ static void cgroup_free_cg_mount_table(void)
 	}
 
 	memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+	cg_mount_index_build();
 	memset(&cg_cgroup_v2_mount_path, 0, sizeof(cg_cgroup_v2_mount_path));
 	memset(&cg_cgroup_v2_empty_mount_paths, 0, sizeof(cg_cgroup_v2_empty_mount_paths));
 }
@@ -1593,48 +2494,55 @@ err:
 	return ret;
 }
 
-/**
- * cgroup_init(), initializes the MOUNT_POINT.
- *
- * This code is theoretically thread safe now. Its not really tested so it can
- * blow up. If does for you, please let us know with your test case and we can
- * really make it thread safe.
+/*
+ * Cache of the open tasks and cgroup.procs files, so that attaching a task
+ * to a cgroup is a single write(). The kernel serializes the migrations
+ * anyway, one lock for the whole cache is enough.
  */
-int cgroup_init(void)
-{
-	static char *controllers[CG_CONTROLLER_MAX];
-	int ret = 0;
-	int i;
-
-	cgroup_set_default_logger(-1);
+struct cg_attach_fd {
+	char *path;
+	int fd;
+};
 
-	pthread_rwlock_wrlock(&cg_mount_table_lock);
+static struct cg_attach_fd attach_fd_cache[CG_ATTACH_FD_CACHE_SIZE];
+static pthread_mutex_t attach_fd_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	/* Free global variables filled by previous cgroup_init() */
-	cgroup_free_cg_mount_table();
+static struct cg_attach_fd *cg_attach_fd_slot(const char * const path)
+{
+	unsigned int hash = 0;
+	const char *c;
 
-	ret = cgroup_populate_controllers(controllers);
-	if (ret)
-		goto unlock_exit;
+	for (c = path; *c; c++)
+		hash = hash * 31 + (unsigned char)*c;
 
-	ret = cgroup_populate_mount_points(controllers);
-	if (ret)
-		goto unlock_exit;
+	return &attach_fd_cache[hash % CG_ATTACH_FD_CACHE_SIZE];
+}
 
-	cgroup_initialized = 1;
+static void cg_attach_fd_close(struct cg_attach_fd * const slot)
+{
+	if (!slot->path)
+		return;
 
-unlock_exit:
-	for (i = 0; controllers[i]; i++) {
-		free(controllers[i]);
-		controllers[i] = NULL;
-	}
+	close(slot->fd);
+	free(slot->path);
+	slot->path = NULL;
+}
 
-	pthread_rwlock_unlock(&cg_mount_table_lock);
+/**
+ * Close all the cached tasks and cgroup.procs files, e.g. when the mount
+ * points are re-read.
+ */
+static void cg_attach_fd_flush(void)
+{
+	int i;
 
-	return ret;
+	pthread_mutex_lock(&attach_fd_lock);
+	for (i = 0; i < CG_ATTACH_FD_CACHE_SIZE; i++)
+		cg_attach_fd_close(&attach_fd_cache[i]);
+	pthread_mutex_unlock(&attach_fd_lock);
 }
 
-static int cg_test_mounted_fs(void)
+static int cg_scan_mounted_fs(void)
 {
 	char mntent_buff[4 * FILENAME_MAX];
 	struct mntent *temp_ent = NULL;
@@ -1674,147 +2582,334 @@ done:
 	return ret;
 }
 
-static inline pid_t cg_gettid(void)
-{
-	return syscall(__NR_gettid);
-}
+/*
+ * Generation of the mounts of the system. The kernel raises POLLPRI on
+ * /proc/self/mountinfo when the mount table changes, the caches derived
+ * from the mounts are valid as long as the generation does not change.
+ */
+static unsigned long mounts_gen = 1;
+static int mounted_fs_fd = -1;
+static pthread_mutex_t mounted_fs_lock = PTHREAD_MUTEX_INITIALIZER;
 
-static char *cg_concat_path(const char *pref, const char *suf, char *path)
+/* Cached result of cg_scan_mounted_fs(), -1 if not known */
+static int mounted_fs_cache = -1;
+static unsigned long mounted_fs_gen;
+
+/**
+ * Drop the caches derived from the mounts, e.g. when the mount points are
+ * re-read.
+ */
+static void cg_invalidate_mounted_fs(void)
 {
-	if ((suf[strlen(suf)-1] == '/') || ((strlen(suf) == 0) && (pref[strlen(pref)-1] == '/')))
-		snprintf(path, FILENAME_MAX, "%s%s", pref, suf+((suf[0] == '/') ? 1 : 0));
-	else
-		snprintf(path, FILENAME_MAX, "%s%s/", pref, suf+((suf[0] == '/') ? 1 : 0));
+	pthread_mutex_lock(&mounted_fs_lock);
+	mounts_gen++;
+	pthread_mutex_unlock(&mounted_fs_lock);
+}
+
+/**
+ * Get the generation of the mounts, called with mounted_fs_lock held.
+ * There is a single poll() for all the caches, it consumes the event.
+ */
+static unsigned long cg_mounts_gen_locked(void)
+{
+	struct pollfd pfd;
 
-	path[FILENAME_MAX-1] = '\0';
+	if (mounted_fs_fd < 0)
+		mounted_fs_fd = open("/proc/self/mountinfo", O_RDONLY | O_CLOEXEC);
 
-	return path;
+	/* Without the mountinfo file, nothing tells when to scan again */
+	if (mounted_fs_fd < 0)
+		return ++mounts_gen;
+
+	pfd.fd = mounted_fs_fd;
+	pfd.events = POLLPRI;
+	pfd.revents = 0;
+
+	if (poll(&pfd, 1, 0) != 0)
+		mounts_gen++;
+
+	return mounts_gen;
 }
 
-/* Call with cg_mount_table_lock taken */
-/* path value have to have size at least FILENAME_MAX */
-char *cg_build_path_locked(const char *name, char *path, const char *type)
+static unsigned long cg_mounts_gen(void)
 {
-	/*
-	 * len is the allocation size for path, that stores:
-	 * cg_mount_table[i].mount.path + '/' + cg_namespace_table[i] + '/'
-	 */
-	int i, ret, len = (FILENAME_MAX * 2) + 2;
-	char *tmp_systemd_default_cgroup, *_path = NULL;
+	unsigned long gen;
 
-	/*
-	 * systemd_default_cgroup can't be clobbered.   The user may pass
-	 * multiple cgroups, hence use temporary variable for manipulations
-	 * for example:
-	 * cgget -g cpu:/ -g cpu:cgrp1 -g cpu:/cgrp2
-	 */
-	tmp_systemd_default_cgroup = calloc(1, (sizeof(char) * len));
-	if (!tmp_systemd_default_cgroup) {
-		cgroup_err("Failed to allocate memory for tmp_systemd_default_cgroup\n");
-		goto out;
-	}
+	pthread_mutex_lock(&mounted_fs_lock);
+	gen = cg_mounts_gen_locked();
+	pthread_mutex_unlock(&mounted_fs_lock);
 
-#ifdef WITH_SYSTEMD
-	/*
-	 * If the user specifies the name as /<cgroup-name>, they are
-	 * effectively overriding the systemd_default_cgroup but if the name
-	 * is "/", the cgroup root path is systemd_default_cgroup
-	 */
-	if (strlen(systemd_default_cgroup) && name && name[0] == '/' && name[1] != '\0')
-		tmp_systemd_default_cgroup[0] = '\0';
-	else
-		snprintf(tmp_systemd_default_cgroup, len, "%s/", systemd_default_cgroup);
+	return gen;
+}
 
-	/* allocate more space for systemd_default_cgroup + '/' */
-	len += (FILENAME_MAX + 1);
-#endif
-	/*
-	 * Recent gcc are unhappy when sizeof(dest) <= sizeof(src) with
-	 * snprintf()'s.  Alternative is to use multiple strncpy()/strcat(),
-	 * work around it by allocating large temporary buffer _path and
-	 * copying the constructed _path into path.
-	 */
-	_path = malloc(len);
-	if (!_path) {
-		cgroup_err("Failed to allocate memory for _path\n");
-		goto out;
+/**
+ * Test whether a cgroup file system is mounted. The mount table is only
+ * scanned again after it has changed.
+ * @return 1 if a cgroup or cgroup2 file system is mounted, 0 otherwise.
+ */
+static int cg_test_mounted_fs(void)
+{
+	unsigned long gen;
+	int ret;
+
+	pthread_mutex_lock(&mounted_fs_lock);
+
+	gen = cg_mounts_gen_locked();
+	if (mounted_fs_cache < 0 || mounted_fs_gen != gen) {
+		mounted_fs_cache = cg_scan_mounted_fs();
+		mounted_fs_gen = gen;
 	}
+	ret = mounted_fs_cache;
 
-	/*
-	 * If no type is specified, and there's a valid cgroup v2 mount, then
-	 * build up a path to this mount (and cgroup name if supplied).
-	 * This can be used to create a cgroup v2 cgroup that's not attached to
-	 * any controller.
-	 */
-	if (!type && strlen(cg_cgroup_v2_mount_path) > 0) {
-		ret = snprintf(_path, len, "%s/%s", cg_cgroup_v2_mount_path,
-			       tmp_systemd_default_cgroup);
-		if (ret >= FILENAME_MAX)
-			cgroup_dbg("filename too long: %s", _path);
+	pthread_mutex_unlock(&mounted_fs_lock);
+
+	return ret;
+}
+
+/**
+ * Read the mount table, from the file published by cgrulesengd if there is
+ * a usable one.
+ * @param publish True to always parse the mounts, and publish them
+ */
+static int cg_init(bool publish)
+{
+	static char *controllers[CG_CONTROLLER_MAX];
+	int ret = 0;
+	int i;
 
-		strncpy(path, _path, FILENAME_MAX - 1);
-		path[FILENAME_MAX - 1] = '\0';
+	cgroup_set_default_logger(-1);
 
-		if (name) {
-			char *tmp;
+	/* The mount points can change, drop the cached tasks files */
+	cg_attach_fd_flush();
+	cg_invalidate_mounted_fs();
+	cg_dirfd_flush();
 
-			tmp = strdup(path);
-			if (tmp == NULL) {
-				path = NULL;
-				goto out;
-			}
+	pthread_rwlock_wrlock(&cg_mount_table_lock);
 
-			cg_concat_path(tmp, name, path);
-			free(tmp);
+	/* Free global variables filled by previous cgroup_init() */
+	cgroup_free_cg_mount_table();
+
+	if (!publish) {
+		if (cg_mount_cache_load(CGMOUNTS_CACHE_FILE) == 0) {
+			cg_mount_index_build();
+			cgroup_initialized = 1;
+			goto unlock_exit;
 		}
-		goto out;
+		cgroup_free_cg_mount_table();
 	}
 
-	for (i = 0; cg_mount_table[i].name[0] != '\0'; i++) {
+	ret = cgroup_populate_controllers(controllers);
+	if (ret)
+		goto unlock_exit;
+
+	ret = cgroup_populate_mount_points(controllers);
+	cg_mount_index_build();
+	if (ret)
+		goto unlock_exit;
+
+	cgroup_initialized = 1;
+
+unlock_exit:
+	for (i = 0; controllers[i]; i++) {
+		free(controllers[i]);
+		controllers[i] = NULL;
+	}
+
+	/* A table that failed to be read is withdrawn */
+	if (publish) {
+		i = cg_mount_cache_publish(CGMOUNTS_CACHE_FILE, ret == 0);
+		if (!ret)
+			ret = i;
+	}
+
+	pthread_rwlock_unlock(&cg_mount_table_lock);
+
+	return ret;
+}
+
+/**
+ * cgroup_init(), initializes the MOUNT_POINT.
+ *
+ * This code is theoretically thread safe now. Its not really tested so it can
+ * blow up. If does for you, please let us know with your test case and we can
+ * really make it thread safe.
+ */
+int cgroup_init(void)
+{
+	return cg_init(false);
+}
+
+int cgroup_publish_mount_table(void)
+{
+	return cg_init(true);
+}
+
+static void cg_controllers_put(struct cg_controllers *ctrls);
+
+struct cgroup_ctx *cgroup_ctx_new(void)
+{
+	struct cg_ctx_alloc *alloc;
+
+	alloc = calloc(1, sizeof(struct cg_ctx_alloc));
+	if (!alloc) {
+		last_errno = errno;
+		return NULL;
+	}
+
+	pthread_rwlock_init(&alloc->mount_table_lock, NULL);
+	pthread_mutex_init(&alloc->ctx.controllers_lock, NULL);
+	alloc->ctx.mount_table = &alloc->mount_table;
+	alloc->ctx.mount_table_lock = &alloc->mount_table_lock;
+	alloc->ctx.mount_index_v2 = -1;
+
+	return &alloc->ctx;
+}
+
+struct cgroup_ctx *cg_ctx_get(void)
+{
+	return cg_ctx();
+}
+
+struct cgroup_ctx *cgroup_ctx_use(struct cgroup_ctx *ctx)
+{
+	struct cgroup_ctx *prev = cg_thread_ctx;
+
+	cg_thread_ctx = ctx;
+
+	return prev;
+}
+
+void cgroup_ctx_free(struct cgroup_ctx **ctx)
+{
+	struct cgroup_ctx *prev;
+	int i;
+
+	if (!ctx || !*ctx)
+		return;
+
+	/* The tables of the context are freed as those of the thread */
+	prev = cgroup_ctx_use(*ctx);
+
+	pthread_rwlock_wrlock(&cg_mount_table_lock);
+	cgroup_free_cg_mount_table();
+	pthread_rwlock_unlock(&cg_mount_table_lock);
+
+	for (i = 0; i < CG_CONTROLLER_MAX; i++)
+		free(cg_namespace_table[i]);
+
+	cg_controllers_put((*ctx)->controllers);
+
+	cgroup_ctx_use(prev == *ctx ? NULL : prev);
+
+	pthread_rwlock_destroy((*ctx)->mount_table_lock);
+	pthread_mutex_destroy(&(*ctx)->controllers_lock);
+	free(*ctx);
+	*ctx = NULL;
+}
+
+static inline pid_t cg_gettid(void)
+{
+	return syscall(__NR_gettid);
+}
+
+/**
+ * Append a string to a path being built, truncating the path to
+ * FILENAME_MAX - 1 characters like snprintf() would.
+ * @return The new length of the path
+ */
+static inline size_t cg_path_append(char * const path, size_t len, const char * const str,
+				    size_t str_len)
+{
+	if (str_len > FILENAME_MAX - 1 - len)
+		str_len = FILENAME_MAX - 1 - len;
+
+	memcpy(path + len, str, str_len);
+
+	return len + str_len;
+}
+
+/* Call with cg_mount_table_lock taken */
+/* path value have to have size at least FILENAME_MAX */
+char *cg_build_path_locked(const char *name, char *path, const char *type)
+{
+	const char *mount_path, *ns = NULL;
+	size_t len, name_len;
+	bool dir;
+	int i;
+
+	/*
+	 * If no type is specified, and there's a valid cgroup v2 mount, then
+	 * build up a path to this mount (and cgroup name if supplied).
+	 * This can be used to create a cgroup v2 cgroup that's not attached to
+	 * any controller.
+	 */
+	if (!type && cg_cgroup_v2_mount_path[0] != '\0') {
+		mount_path = cg_cgroup_v2_mount_path;
+	} else {
 		/* Two ways to successfully move forward here:
 		 * 1. The "type" controller matches the name of a mounted
 		 *    controller
 		 * 2. The "type" controller requested is "cgroup" and there's
 		 *    a "real" controller mounted as cgroup v2
 		 */
-		if ((type && strcmp(cg_mount_table[i].name, type) == 0) ||
-		    (type && strcmp(type, CGROUP_FILE_PREFIX) == 0 &&
-		     cg_mount_table[i].version == CGROUP_V2)) {
+		if (!type)
+			i = -1;
+		else if (strcmp(type, CGROUP_FILE_PREFIX) == 0)
+			i = cg_mount_table_find_v2();
+		else
+			i = cg_mount_table_find(type);
 
-			if (cg_namespace_table[i])
-				ret = snprintf(_path, len, "%s/%s%s/", cg_mount_table[i].mount.path,
-					       tmp_systemd_default_cgroup, cg_namespace_table[i]);
-			else
-				ret = snprintf(_path, len, "%s/%s", cg_mount_table[i].mount.path,
-					       tmp_systemd_default_cgroup);
+		if (i < 0)
+			return NULL;
+
+		mount_path = cg_mount_table[i].mount.path;
+		ns = cg_namespace_table[i];
+	}
 
-			if (ret >= FILENAME_MAX)
-				cgroup_dbg("filename too long: %s", _path);
+	/*
+	 * The path is written straight into the caller's buffer, as
+	 * <mount>/<systemd default cgroup>/<namespace>/<name>/
+	 */
+	len = cg_path_append(path, 0, mount_path, strlen(mount_path));
+	len = cg_path_append(path, len, "/", 1);
 
-			strncpy(path, _path, FILENAME_MAX - 1);
-			path[FILENAME_MAX - 1] = '\0';
+#ifdef WITH_SYSTEMD
+	/*
+	 * If the user specifies the name as /<cgroup-name>, they are
+	 * effectively overriding the systemd_default_cgroup but if the name
+	 * is "/", the cgroup root path is systemd_default_cgroup
+	 */
+	if (systemd_default_cgroup[0] == '\0' || !name || name[0] != '/' || name[1] == '\0') {
+		len = cg_path_append(path, len, systemd_default_cgroup,
+				     strlen(systemd_default_cgroup));
+		len = cg_path_append(path, len, "/", 1);
+	}
+#endif
 
-			if (name) {
-				char *tmp;
+	if (ns) {
+		len = cg_path_append(path, len, ns, strlen(ns));
+		len = cg_path_append(path, len, "/", 1);
+	}
 
-				tmp = strdup(path);
-				if (tmp == NULL)
-					break;
+	if (name) {
+		/* The path of a group always ends with a '/' */
+		name_len = strlen(name);
+		if (name_len)
+			dir = name[name_len - 1] == '/';
+		else
+			dir = path[len - 1] == '/';
 
-				cg_concat_path(tmp, name, path);
-				free(tmp);
-			}
-			goto out;
+		if (name[0] == '/') {
+			name++;
+			name_len--;
 		}
-	}
-	path = NULL;
 
-out:
-	if (_path)
-		free(_path);
+		len = cg_path_append(path, len, name, name_len);
+		if (!dir)
+			len = cg_path_append(path, len, "/", 1);
+	}
 
-	if (tmp_systemd_default_cgroup)
-		free(tmp_systemd_default_cgroup);
+	path[len] = '\0';
 
 	return path;
 }
@@ -1922,6 +3017,161 @@ error:
 	return err;
 }
 
+void cg_subtree_cache_invalidate(void)
+{
+	__atomic_add_fetch(&subtree_gen, 1, __ATOMIC_RELAXED);
+}
+
+static void cg_subtree_cache_flush(void)
+{
+	struct cg_subtree_entry *entry;
+	int i;
+
+	for (i = 0; i < CG_SUBTREE_CACHE_SIZE; i++) {
+		while (subtree_cache[i]) {
+			entry = subtree_cache[i];
+			subtree_cache[i] = entry->next;
+			free(entry->path);
+			free(entry);
+		}
+	}
+	subtree_cache_cnt = 0;
+}
+
+/**
+ * Get the bit of a controller in the masks of the subtree cache.
+ * subtree_lock must be held.
+ *	@param add Give a bit to a controller that has none yet
+ *	@return The bit, -1 if the controller has none
+ */
+static int cg_subtree_cache_bit(const char * const ctrl_name, bool add)
+{
+	int i;
+
+	for (i = 0; i < (int)ARRAY_SIZE(subtree_ctrl_names) && subtree_ctrl_names[i]; i++)
+		if (!strcmp(subtree_ctrl_names[i], ctrl_name))
+			return i;
+
+	if (!add || i == ARRAY_SIZE(subtree_ctrl_names))
+		return -1;
+
+	subtree_ctrl_names[i] = strdup(ctrl_name);
+
+	return subtree_ctrl_names[i] ? i : -1;
+}
+
+/**
+ * Look for a directory in the subtree cache.  subtree_lock must be held.
+ *	@param path The directory, trailing slashes are ignored
+ *	@param add Add the directory if it is not cached, with no controller
+ *	@return The entry, NULL if the directory is not cached
+ */
+static struct cg_subtree_entry *cg_subtree_cache_find(const char * const path, bool add)
+{
+	struct cg_subtree_entry *entry;
+	unsigned long gen;
+	unsigned int hash;
+	size_t len;
+
+	gen = __atomic_load_n(&subtree_gen, __ATOMIC_RELAXED);
+	if (gen != subtree_cache_gen) {
+		cg_subtree_cache_flush();
+		subtree_cache_gen = gen;
+	}
+
+	len = strlen(path);
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+
+	hash = cg_fnv1a(CG_FNV1A_INIT, path, len);
+
+	for (entry = subtree_cache[hash & (CG_SUBTREE_CACHE_SIZE - 1)]; entry;
+	     entry = entry->next) {
+		if (entry->hash == hash && !strncmp(entry->path, path, len) &&
+		    entry->path[len] == '\0')
+			return entry;
+	}
+
+	if (!add)
+		return NULL;
+
+	/* Groups spread over the whole hierarchy, start over rather than grow */
+	if (subtree_cache_cnt >= 4 * CG_SUBTREE_CACHE_SIZE)
+		cg_subtree_cache_flush();
+
+	entry = calloc(1, sizeof(struct cg_subtree_entry));
+	if (!entry)
+		return NULL;
+
+	entry->path = strndup(path, len);
+	if (!entry->path) {
+		free(entry);
+		return NULL;
+	}
+
+	entry->hash = hash;
+	entry->next = subtree_cache[hash & (CG_SUBTREE_CACHE_SIZE - 1)];
+	subtree_cache[hash & (CG_SUBTREE_CACHE_SIZE - 1)] = entry;
+	subtree_cache_cnt++;
+
+	return entry;
+}
+
+/**
+ * Check whether a controller is known to be enabled in the
+ * cgroup.subtree_control file of a directory.
+ */
+static bool cg_subtree_cache_enabled(const char * const path, const char * const ctrl_name)
+{
+	struct cg_subtree_entry *entry;
+	bool enabled = false;
+	int bit;
+
+	pthread_mutex_lock(&subtree_lock);
+	bit = cg_subtree_cache_bit(ctrl_name, false);
+	if (bit >= 0) {
+		entry = cg_subtree_cache_find(path, false);
+		enabled = entry && (entry->enabled & (1ULL << bit));
+	}
+	pthread_mutex_unlock(&subtree_lock);
+
+	return enabled;
+}
+
+/**
+ * Remember the state of a controller in the cgroup.subtree_control file of
+ * a directory, read from it or written to it.
+ */
+static void cg_subtree_cache_set(const char * const path, const char * const ctrl_name,
+				 bool enabled)
+{
+	struct cg_subtree_entry *entry;
+	int bit;
+
+	pthread_mutex_lock(&subtree_lock);
+	bit = cg_subtree_cache_bit(ctrl_name, enabled);
+	entry = bit >= 0 ? cg_subtree_cache_find(path, enabled) : NULL;
+	if (entry && enabled)
+		entry->enabled |= 1ULL << bit;
+	else if (entry)
+		entry->enabled &= ~(1ULL << bit);
+	pthread_mutex_unlock(&subtree_lock);
+}
+
+/**
+ * Forget a directory of the subtree cache, e.g. its group was removed.
+ */
+static void cg_subtree_cache_forget(const char * const path)
+{
+	struct cg_subtree_entry *entry;
+
+	pthread_mutex_lock(&subtree_lock);
+	entry = cg_subtree_cache_find(path, false);
+	if (entry)
+		entry->enabled = 0;
+	pthread_mutex_unlock(&subtree_lock);
+}
+
 STATIC int cgroupv2_controller_enabled(const char * const cg_name, const char * const ctrl_name)
 {
 	char path[FILENAME_MAX] = {0};
@@ -1959,12 +3209,17 @@ STATIC int cgroupv2_controller_enabled(const char * const cg_name, const char *
 
 	dname = dirname(parent);
 
+	if (cg_subtree_cache_enabled(dname, ctrl_name))
+		goto err;
+
 	error = cgroupv2_get_subtree_control(dname, ctrl_name, &enabled);
 	if (error)
 		goto err;
 
-	if (enabled)
+	if (enabled) {
+		cg_subtree_cache_set(dname, ctrl_name, true);
 		error = 0;
+	}
 err:
 	if (parent)
 		free(parent);
@@ -1972,56 +3227,120 @@ err:
 	return error;
 }
 
-static int __cgroup_attach_task_pid(char *path, pid_t tid)
+/**
+ * Get the error of a tasks or cgroup.procs file that cannot be opened.
+ */
+static int cg_attach_open_error(int err)
 {
-	FILE *tasks = NULL;
+	switch (err) {
+	case EPERM:
+	case EACCES:
+		return ECGROUPNOTOWNER;
+	case ENOENT:
+		return ECGROUPNOTEXIST;
+	default:
+		return ECGROUPNOTALLOWED;
+	}
+}
+
+/**
+ * Check that the process of a pidfd has not exited.
+ * @param pidfd The pidfd
+ * @return 0 if the process is alive, ECGROUPNOTEXIST if it has exited.
+ */
+static int cg_pidfd_check_alive(int pidfd)
+{
+#ifdef SYS_pidfd_send_signal
+	if (syscall(SYS_pidfd_send_signal, pidfd, 0, NULL, 0) < 0) {
+		last_errno = errno;
+		return errno == ESRCH ? ECGROUPNOTEXIST : ECGOTHER;
+	}
+#else
+	struct pollfd pfd = { .fd = pidfd, .events = POLLIN };
+
+	/* A pidfd becomes readable when its process exits */
+	if (poll(&pfd, 1, 0) < 0) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+	if (pfd.revents & (POLLIN | POLLHUP))
+		return ECGROUPNOTEXIST;
+#endif
+
+	return 0;
+}
+
+/*
+ * Write tid to a tasks or cgroup.procs file.  With a pidfd, its process is
+ * checked to be alive right before the write: tid is still its PID then.
+ */
+static int __cgroup_attach_task_pid(char *path, pid_t tid, int pidfd)
+{
+	struct cg_attach_fd *slot;
+	char buf[16];
+	bool cached;
 	int ret = 0;
+	int len, fd;
 
-	tasks = fopen(path, "we");
-	if (!tasks) {
-		switch (errno) {
-		case EPERM:
-			ret = ECGROUPNOTOWNER;
-			break;
-		case ENOENT:
-			ret = ECGROUPNOTEXIST;
-			break;
-		default:
-			ret = ECGROUPNOTALLOWED;
+	len = snprintf(buf, sizeof(buf), "%d", tid);
+
+	pthread_mutex_lock(&attach_fd_lock);
+	slot = cg_attach_fd_slot(path);
+
+retry:
+	cached = slot->path && !strcmp(slot->path, path);
+	if (!cached) {
+		cg_attach_fd_close(slot);
+
+		fd = open(path, O_WRONLY | O_CLOEXEC);
+		if (fd < 0) {
+			ret = cg_attach_open_error(errno);
+			goto err;
 		}
-		goto err;
+
+		slot->path = strdup(path);
+		if (!slot->path) {
+			last_errno = errno;
+			close(fd);
+			ret = ECGOTHER;
+			goto err;
+		}
+		slot->fd = fd;
 	}
-	ret = fprintf(tasks, "%d", tid);
-	if (ret < 0) {
-		last_errno = errno;
-		ret = ECGOTHER;
-		goto err;
+
+	if (pidfd >= 0) {
+		ret = cg_pidfd_check_alive(pidfd);
+		if (ret) {
+			pthread_mutex_unlock(&attach_fd_lock);
+			return ret;
+		}
 	}
-	ret = fflush(tasks);
-	if (ret) {
+
+	if (write(slot->fd, buf, len) != len) {
+		/*
+		 * A cached file outlives the removal of its cgroup, the
+		 * cgroup may have been re-created since then.
+		 */
+		if (cached && (errno == ENODEV || errno == ENOENT)) {
+			cg_attach_fd_close(slot);
+			goto retry;
+		}
+
 		last_errno = errno;
 		ret = ECGOTHER;
 		goto err;
 	}
-	fclose(tasks);
+	pthread_mutex_unlock(&attach_fd_lock);
+
 	return 0;
 err:
 	cgroup_warn("cannot write tid %d to %s:%s\n", tid, path, strerror(errno));
-	if (tasks)
-		fclose(tasks);
+	pthread_mutex_unlock(&attach_fd_lock);
+
 	return ret;
 }
 
-/**
- *  cgroup_attach_task_pid is used to assign tasks to a cgroup.
- *  struct cgroup *cgroup: The cgroup to assign the thread to.
- *  pid_t tid: The thread to be assigned to the cgroup.
- *
- *  returns 0 on success.
- *  returns ECGROUPNOTOWNER if the caller does not have access to the cgroup.
- *  returns ECGROUPNOTALLOWED for other causes of failure.
- */
-int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid)
+static int cg_attach_task_pid(struct cgroup *cgroup, pid_t tid, int pidfd)
 {
 	char path[FILENAME_MAX] = {0};
 	char *controller_name;
@@ -2039,10 +3358,12 @@ int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid)
 		for (i = 0; i < CG_CONTROLLER_MAX && cg_mount_table[i].name[0] != '\0'; i++) {
 			ret = cgroup_build_tasks_procs_path(path, sizeof(path), NULL,
 							    cg_mount_table[i].name);
-			if (ret)
+			if (ret) {
+				pthread_rwlock_unlock(&cg_mount_table_lock);
 				return ret;
+			}
 
-			ret = __cgroup_attach_task_pid(path, tid);
+			ret = __cgroup_attach_task_pid(path, tid, pidfd);
 			if (ret) {
 				pthread_rwlock_unlock(&cg_mount_table_lock);
 				return ret;
@@ -2066,7 +3387,7 @@ int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid)
 		     empty_cgroup > 0 || i < cgroup->index;
 		     i++, empty_cgroup--) {
 
-			if (cgroup->controller[i])
+			if (i < cgroup->index)
 				controller_name = cgroup->controller[i]->name;
 
 			ret = cgroupv2_controller_enabled(cgroup->name, controller_name);
@@ -2078,7 +3399,7 @@ int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid)
 			if (ret)
 				return ret;
 
-			ret = __cgroup_attach_task_pid(path, tid);
+			ret = __cgroup_attach_task_pid(path, tid, pidfd);
 			if (ret)
 				return ret;
 		}
@@ -2086,6 +3407,288 @@ int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid)
 	return 0;
 }
 
+/**
+ *  cgroup_attach_task_pid is used to assign tasks to a cgroup.
+ *  struct cgroup *cgroup: The cgroup to assign the thread to.
+ *  pid_t tid: The thread to be assigned to the cgroup.
+ *
+ *  returns 0 on success.
+ *  returns ECGROUPNOTOWNER if the caller does not have access to the cgroup.
+ *  returns ECGROUPNOTALLOWED for other causes of failure.
+ */
+int cgroup_attach_task_pid(struct cgroup *cgroup, pid_t tid)
+{
+	int ret;
+
+	cg_probe(libcgroup, attach_entry, cgroup ? cgroup->name : NULL, tid);
+	ret = cg_attach_task_pid(cgroup, tid, -1);
+	cg_probe(libcgroup, attach_return, cgroup ? cgroup->name : NULL, tid, ret);
+
+	return ret;
+}
+
+/**
+ * Get the PID of the process a pidfd refers to, from /proc/self/fdinfo.
+ * @param pidfd The pidfd
+ * @param pid The PID, -1 if the process has exited
+ * @return 0 on success, ECGOTHER if pidfd is not a pidfd.
+ */
+static int cg_get_pidfd_pid(int pidfd, pid_t *pid)
+{
+	char path[FILENAME_MAX];
+	char buf[FILENAME_MAX];
+	int ret = ECGOTHER;
+	FILE *f;
+
+	snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", pidfd);
+	f = fopen(path, "re");
+	if (!f) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	while (fgets(buf, sizeof(buf), f)) {
+		if (strncmp(buf, "Pid:", 4))
+			continue;
+
+		if (sscanf(buf + strlen("Pid:"), "%d", pid) == 1)
+			ret = 0;
+		break;
+	}
+	fclose(f);
+
+	if (ret)
+		last_errno = EINVAL;
+
+	return ret;
+}
+
+/**
+ *  cgroup_attach_task_pidfd is used to assign a process to a cgroup.
+ *  struct cgroup *cgroup: The cgroup to assign the process to.
+ *  int pidfd: The pidfd of the process to be assigned to the cgroup.
+ *
+ *  Unlike cgroup_attach_task_pid(), the process is checked to be alive right
+ *  before each write of its PID, and once it is attached.  If it exits
+ *  between a check and the write, its PID may already belong to another
+ *  process which is moved instead: this is only noticed after the move, and
+ *  reported as ECGROUPNOTEXIST, never as a success.
+ *
+ *  returns 0 on success.
+ *  returns ECGROUPNOTEXIST if the process has exited.
+ *  See cgroup_attach_task_pid for the other return values.
+ */
+int cgroup_attach_task_pidfd(struct cgroup *cgroup, int pidfd)
+{
+	pid_t pid;
+	int ret;
+
+	ret = cg_get_pidfd_pid(pidfd, &pid);
+	if (ret)
+		return ret;
+
+	if (pid <= 0)
+		return ECGROUPNOTEXIST;
+
+	/*
+	 * While the process is alive its PID cannot be recycled: each write
+	 * is preceded by a check of the pidfd.
+	 */
+	cg_probe(libcgroup, attach_entry, cgroup ? cgroup->name : NULL, pid);
+	ret = cg_attach_task_pid(cgroup, pid, pidfd);
+	cg_probe(libcgroup, attach_return, cgroup ? cgroup->name : NULL, pid, ret);
+	if (ret)
+		return ret;
+
+	/* The process was alive throughout the writes: the PID was its own */
+	return cg_pidfd_check_alive(pidfd);
+}
+
+/**
+ * Set the error of the tasks which did not fail yet, none of them could be
+ * moved.
+ */
+static void cg_attach_tasks_fail(int * const errors, size_t n, int err)
+{
+	size_t i;
+
+	for (i = 0; errors && i < n; i++) {
+		if (!errors[i])
+			errors[i] = err;
+	}
+}
+
+/**
+ * Write pids to a tasks or cgroup.procs file through a single open file.
+ *	@param errors The error of each pid, the first one is kept
+ *	@return 0 on success, else the error of the file or of the first pid
+ *		which failed
+ */
+static int cg_attach_tasks_path(const char * const path, const pid_t * const pids, size_t n,
+				int flags, int * const errors)
+{
+	char buf[16];
+	int ret = 0;
+	int len, fd;
+	size_t i;
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		ret = cg_attach_open_error(errno);
+		cgroup_warn("cannot open %s: %s\n", path, strerror(errno));
+		cg_attach_tasks_fail(errors, n, ret);
+
+		return ret;
+	}
+
+	for (i = 0; i < n; i++) {
+		/* The kernel reads one pid per write() */
+		len = snprintf(buf, sizeof(buf), "%d", pids[i]);
+		if (write(fd, buf, len) == len)
+			continue;
+
+		if (errno == ESRCH && (flags & CGFLAG_ATTACH_IGNORE_EXITED))
+			continue;
+
+		cgroup_warn("cannot write tid %d to %s:%s\n", pids[i], path, strerror(errno));
+		last_errno = errno;
+
+		if (errors && !errors[i])
+			errors[i] = errno == ESRCH ? ECGROUPNOTEXIST : ECGOTHER;
+		if (!ret)
+			ret = errno == ESRCH ? ECGROUPNOTEXIST : ECGOTHER;
+	}
+
+	close(fd);
+
+	return ret;
+}
+
+/**
+ * Attach pids to the group of one controller, unless the tasks or
+ * cgroup.procs file was already written, e.g. on a shared mount point or
+ * for another cgroup v2 controller.
+ *	@param done The files already written
+ *	@param done_cnt The number of files in done
+ *	@return 0 on success, ECGOTHER if done cannot be extended, else the
+ *		first error of cg_attach_tasks_path()
+ */
+static int cg_attach_tasks_controller(const char * const cg_name, const char * const ctrl_name,
+				      const pid_t * const pids, size_t n, int flags,
+				      int * const errors, char ** const done, int * const done_cnt)
+{
+	char path[FILENAME_MAX] = {0};
+	int ret, i;
+
+	ret = cgroup_build_tasks_procs_path(path, sizeof(path), cg_name, ctrl_name);
+	if (ret)
+		goto err;
+
+	for (i = 0; i < *done_cnt; i++) {
+		if (!strcmp(done[i], path))
+			return 0;
+	}
+
+	ret = ECGOTHER;
+	if (*done_cnt >= CG_CONTROLLER_MAX)
+		goto err;
+
+	done[*done_cnt] = strdup(path);
+	if (!done[*done_cnt]) {
+		last_errno = errno;
+		goto err;
+	}
+	(*done_cnt)++;
+
+	return cg_attach_tasks_path(path, pids, n, flags, errors);
+
+err:
+	cg_attach_tasks_fail(errors, n, ret);
+
+	return ret;
+}
+
+int cgroup_attach_tasks(struct cgroup *cgroup, const pid_t *pids, size_t n, int flags,
+			int *errors)
+{
+	char *done[CG_CONTROLLER_MAX] = { NULL };
+	const char *controller_name;
+	int empty_cgroup = 0;
+	int done_cnt = 0;
+	int ret = 0, err;
+	size_t j;
+	int i;
+
+	/* Every task gets its error, even when none is attempted */
+	for (j = 0; errors && j < n; j++)
+		errors[j] = 0;
+
+	if (!cgroup_initialized) {
+		cgroup_warn("libcgroup is not initialized\n");
+		cg_attach_tasks_fail(errors, n, ECGROUPNOTINITIALIZED);
+		return ECGROUPNOTINITIALIZED;
+	}
+
+	if (n && !pids) {
+		cg_attach_tasks_fail(errors, n, ECGINVAL);
+		return ECGINVAL;
+	}
+
+	if (!n)
+		return 0;
+
+	cg_probe(libcgroup, attach_tasks_entry, cgroup ? cgroup->name : NULL, n);
+
+	/* if the cgroup is NULL, attach the tasks to the root cgroup. */
+	if (!cgroup) {
+		pthread_rwlock_rdlock(&cg_mount_table_lock);
+		for (i = 0; i < CG_CONTROLLER_MAX && cg_mount_table[i].name[0] != '\0'; i++) {
+			err = cg_attach_tasks_controller(NULL, cg_mount_table[i].name, pids, n,
+							 flags, errors, done, &done_cnt);
+			if (err && !ret)
+				ret = err;
+		}
+		pthread_rwlock_unlock(&cg_mount_table_lock);
+		goto out;
+	}
+
+	for (i = 0; i < cgroup->index; i++) {
+		if (!cgroup_test_subsys_mounted(cgroup->controller[i]->name)) {
+			cgroup_warn("subsystem %s is not mounted\n", cgroup->controller[i]->name);
+			ret = ECGROUPSUBSYSNOTMOUNTED;
+			cg_attach_tasks_fail(errors, n, ret);
+			goto out;
+		}
+	}
+
+	if (cgroup->index == 0)
+		/* Valid empty cgroup v2 with no controllers added. */
+		empty_cgroup = 1;
+
+	for (i = 0, controller_name = NULL; empty_cgroup > 0 || i < cgroup->index;
+	     i++, empty_cgroup--) {
+		if (i < cgroup->index)
+			controller_name = cgroup->controller[i]->name;
+
+		err = cgroupv2_controller_enabled(cgroup->name, controller_name);
+		if (err)
+			cg_attach_tasks_fail(errors, n, err);
+		else
+			err = cg_attach_tasks_controller(cgroup->name, controller_name, pids, n,
+							 flags, errors, done, &done_cnt);
+		if (err && !ret)
+			ret = err;
+	}
+
+out:
+	for (i = 0; i < done_cnt; i++)
+		free(done[i]);
+
+	cg_probe(libcgroup, attach_tasks_return, cgroup ? cgroup->name : NULL, n, ret);
+
+	return ret;
+}
+
 /**
  * cgroup_attach_task is used to attach the current thread to a cgroup.
  * struct cgroup *cgroup: The cgroup to assign the current thread to.
@@ -2102,6 +3705,16 @@ int cgroup_attach_task(struct cgroup *cgroup)
 	return error;
 }
 
+/**
+ * Get the error code of a failed mkdir.
+ */
+static int cg_mkdir_error(int err)
+{
+	last_errno = err;
+
+	return err == EPERM ? ECGROUPNOTOWNER : ECGROUPNOTALLOWED;
+}
+
 /**
  * cg_mkdir_p, emulate the mkdir -p command (recursively creating paths)
  * @path: path to create
@@ -2141,9 +3754,6 @@ int cg_mkdir_p(const char *path)
 			case EEXIST:
 				ret = 0;	/* Not fatal really */
 				break;
-			case EPERM:
-				ret = ECGROUPNOTOWNER;
-				goto done;
 			case EROFS:
 				/*
 				 * Check if path exists, use tmp_path to
@@ -2154,7 +3764,7 @@ int cg_mkdir_p(const char *path)
 				if (ret == 0)
 					break;	/* Path exists */
 			default: /* fallthrough */
-				ret = ECGROUPNOTALLOWED;
+				ret = cg_mkdir_error(errno);
 				goto done;
 			}
 		}
@@ -2175,13 +3785,18 @@ done:
  */
 static int cg_create_control_group(const char *path)
 {
-	int error;
-
 	if (!cg_test_mounted_fs())
 		return ECGROUPNOTMOUNTED;
 
-	error = cg_mkdir_p(path);
-	return error;
+	/*
+	 * The parent of a new group usually exists, and its directory is
+	 * cached: a single mkdirat() creates the group.
+	 * 0775 == S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH
+	 */
+	if (cg_dirfd_mkdir(path, 0775))
+		return cg_mkdir_error(errno);
+
+	return 0;
 }
 
 /*
@@ -2189,19 +3804,73 @@ static int cg_create_control_group(const char *path)
  * This is the low level function for putting in a value in a control file.
  * This function takes in the complete path and sets the value in val in that file.
  */
-static int cg_set_control_value(char *path, const char *val)
+/**
+ * Write a value to an open control file, and close it.
+ *	@param ctl_file The control file, opened for writing
+ *	@param path Path of the control file, for the messages
+ *	@param val The value, each of its lines is written separately
+ */
+static int cg_write_control_value(int ctl_file, const char * const path, const char *val)
 {
 	char *str_val_start;
 	char *str_val;
-	int ctl_file;
 	size_t len;
 	char *pos;
 
-	if (!cg_test_mounted_fs())
-		return ECGROUPNOTMOUNTED;
-
-	ctl_file = open(path, O_RDWR | O_CLOEXEC);
-
+	/*
+	 * Split the multiline value into lines.  One line is a special
+	 * case of multiline value.
+	 */
+	str_val = strdup(val);
+	if (str_val == NULL) {
+		last_errno = errno;
+		close(ctl_file);
+		return ECGOTHER;
+	}
+
+	str_val_start = str_val;
+	pos = str_val;
+
+	do {
+		str_val = pos;
+		pos = strchr(str_val, '\n');
+
+		if (pos) {
+			*pos = '\0';
+			++pos;
+		}
+
+		len = strlen(str_val);
+		if (len > 0) {
+			if (write(ctl_file, str_val, len) == -1) {
+				last_errno = errno;
+				free(str_val_start);
+				close(ctl_file);
+				return ECGOTHER;
+			}
+		} else
+			cgroup_warn("skipping empty line for %s\n", path);
+	} while (pos);
+
+	if (close(ctl_file)) {
+		last_errno = errno;
+		free(str_val_start);
+		return ECGOTHER;
+	}
+
+	free(str_val_start);
+	return 0;
+}
+
+static int cg_set_control_value(char *path, const char *val)
+{
+	int ctl_file;
+
+	if (!cg_test_mounted_fs())
+		return ECGROUPNOTMOUNTED;
+
+	ctl_file = cg_dirfd_open(path, O_RDWR);
+
 	if (ctl_file == -1) {
 		if (errno == EPERM) {
 			/*
@@ -2246,66 +3915,64 @@ static int cg_set_control_value(char *path, const char *val)
 		return ECGROUPVALUENOTEXIST;
 	}
 
-	/*
-	 * Split the multiline value into lines.  One line is a special
-	 * case of multiline value.
-	 */
-	str_val = strdup(val);
-	if (str_val == NULL) {
-		last_errno = errno;
-		close(ctl_file);
-		return ECGOTHER;
-	}
-
-	str_val_start = str_val;
-	pos = str_val;
-
-	do {
-		str_val = pos;
-		pos = strchr(str_val, '\n');
+	return cg_write_control_value(ctl_file, path, val);
+}
 
-		if (pos) {
-			*pos = '\0';
-			++pos;
-		}
+/*
+ * Settings that the kernel validates against other settings of the group,
+ * e.g. a cpuset partition against cpuset.cpus.  They are written after the
+ * settings they depend on, the other settings keep their order.
+ */
+static const struct {
+	const char *name;
+	int order;
+} cg_value_orders[] = {
+	{ "cpuset.cpus.exclusive",	1 },
+	{ "cpuset.cpus.partition",	2 },
+};
 
-		len = strlen(str_val);
-		if (len > 0) {
-			if (write(ctl_file, str_val, len) == -1) {
-				last_errno = errno;
-				free(str_val_start);
-				close(ctl_file);
-				return ECGOTHER;
-			}
-		} else
-			cgroup_warn("skipping empty line for %s\n", path);
-	} while (pos);
+static int cg_value_order(const char * const name)
+{
+	int i;
 
-	if (close(ctl_file)) {
-		last_errno = errno;
-		free(str_val_start);
-		return ECGOTHER;
+	for (i = 0; i < ARRAY_SIZE(cg_value_orders); i++) {
+		if (!strcmp(cg_value_orders[i].name, name))
+			return cg_value_orders[i].order;
 	}
 
-	free(str_val_start);
 	return 0;
 }
 
 /**
- * Walk the settings in controller and write their values to disk
+ * Walk the settings in controller and write their values to disk.  The
+ * files are opened relative to one fd of the directory of the group.
  *
  * @param base The full path to the base of this cgroup
  * @param controller The controller whose values are being updated
  * @param ignore_non_dirty_values If set skips writing non-dirty controller settings
  */
 STATIC int cgroup_set_values_recursive(const char * const base,
-				       const struct cgroup_controller * const controller,
+				       struct cgroup_controller * const controller,
 				       bool ignore_non_dirty_values)
 {
 	struct control_value *cv;
 	struct stat path_stat;
-	int ret, j, error = 0;
+	int count = 0, error = 0;
+	int *order = NULL;
 	char *path = NULL;
+	bool retried = false;
+	int dirfd = -1;
+	int ret, i, j;
+	int ctl_file;
+
+	if (!controller->index)
+		return 0;
+
+	order = malloc(controller->index * sizeof(int));
+	if (!order) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
 
 	for (j = 0; j < controller->index; j++) {
 		cv = controller->values[j];
@@ -2323,22 +3990,57 @@ STATIC int cgroup_set_values_recursive(const char * const base,
 		 * it writing only the controller settings that has it
 		 * dirty value set.
 		 */
-		if (ignore_non_dirty_values && cv->dirty == false)
+		if (ignore_non_dirty_values && !cg_cv_is_dirty(controller, j))
 			continue;
 
 		/* We don't support, writing multiline settings */
 		if (strcspn(cv->value, "\n")  < (strlen(cv->value) - 1))
 			continue;
 
-		ret = asprintf(&path, "%s%s", base, cv->name);
-		if (ret < 0) {
-			last_errno = errno;
-			error = ECGOTHER;
-			goto err;
-		}
+		/* Insert after the settings of the same or a lower order */
+		for (i = count; i > 0 && cg_value_order(controller->values[order[i - 1]]->name) >
+				       cg_value_order(cv->name); i--)
+			order[i] = order[i - 1];
+		order[i] = j;
+		count++;
+	}
+
+	if (!count)
+		goto err;
+
+	if (!cg_test_mounted_fs()) {
+		error = ECGROUPNOTMOUNTED;
+		goto err;
+	}
+
+	dirfd = cg_dirfd_dup(base);
+	if (dirfd < 0) {
+		last_errno = errno;
+		error = ECGROUPVALUENOTEXIST;
+		goto err;
+	}
+
+	i = 0;
+#ifdef WITH_IO_URING
+	if (cg_uring_enabled)
+		i = cg_uring_write_values(base, dirfd, controller, order, count);
+#endif
+
+	for (; i < count; i++) {
+		cv = controller->values[order[i]];
 
 		/* skip read-only settings */
-		ret = (stat(path, &path_stat));
+		ret = fstatat(dirfd, cv->name, &path_stat, 0);
+		if (ret < 0 && errno == ENOENT && !retried) {
+			/* The cgroup may have been removed and created again */
+			retried = true;
+			close(dirfd);
+			cg_dirfd_forget(base);
+
+			dirfd = cg_dirfd_dup(base);
+			if (dirfd >= 0)
+				ret = fstatat(dirfd, cv->name, &path_stat, 0);
+		}
 		if (ret < 0) {
 			last_errno = errno;
 			error = ECGROUPVALUENOTEXIST;
@@ -2349,9 +4051,21 @@ STATIC int cgroup_set_values_recursive(const char * const base,
 		if (!(path_stat.st_mode & 0200))
 			continue;
 
+		ret = asprintf(&path, "%s%s", base, cv->name);
+		if (ret < 0) {
+			last_errno = errno;
+			error = ECGOTHER;
+			goto err;
+		}
+
 		cgroup_dbg("setting %s to \"%s\", pathlen %d\n", path, cv->value, ret);
 
-		error = cg_set_control_value(path, cv->value);
+		ctl_file = openat(dirfd, cv->name, O_RDWR | O_CLOEXEC);
+		if (ctl_file >= 0)
+			error = cg_write_control_value(ctl_file, path, cv->value);
+		else
+			/* Let cg_set_control_value() tell why the file cannot be opened */
+			error = cg_set_control_value(path, cv->value);
 		free(path);
 		path = NULL;
 
@@ -2363,7 +4077,7 @@ STATIC int cgroup_set_values_recursive(const char * const base,
 			}
 			goto err;
 		}
-		cv->dirty = false;
+		cg_cv_set_dirty(controller, order[i], false);
 	}
 
 err:
@@ -2374,6 +4088,9 @@ err:
 	 */
 	if (path)
 		free(path);
+	if (dirfd >= 0)
+		close(dirfd);
+	free(order);
 
 	return error;
 }
@@ -2526,6 +4243,8 @@ STATIC int cgroupv2_subtree_control(const char *path, const char *ctrl_name, boo
 	if (error)
 		goto out;
 
+	cg_subtree_cache_set(path, ctrl_name, enable);
+
 out:
 	if (value)
 		free(value);
@@ -2544,19 +4263,11 @@ out:
 STATIC int cgroupv2_subtree_control_recursive(char *path, const char *ctrl_name, bool enable)
 {
 	char *path_copy, *tmp_path, *stok_buff = NULL;
-	bool found_mount = false;
 	size_t mount_len;
 	int i, error = 0;
 
-	for (i = 0; cg_mount_table[i].name[0] != '\0'; i++) {
-		if (strncmp(cg_mount_table[i].name, ctrl_name,
-			    sizeof(cg_mount_table[i].name)) == 0) {
-			found_mount = true;
-			break;
-		}
-	}
-
-	if (!found_mount)
+	i = cg_mount_table_find(ctrl_name);
+	if (i < 0)
 		return ECGROUPSUBSYSNOTMOUNTED;
 
 	path_copy = strdup(path);
@@ -2578,6 +4289,10 @@ STATIC int cgroupv2_subtree_control_recursive(char *path, const char *ctrl_name,
 			strcat(path_copy, tmp_path);
 		}
 
+		/* The ancestors of the previous groups are already enabled */
+		if (enable && cg_subtree_cache_enabled(path_copy, ctrl_name))
+			continue;
+
 		error = cg_create_control_group(path_copy);
 		if (error)
 			goto out;
@@ -2592,18 +4307,7 @@ out:
 	return error;
 }
 
-/**
- * cgroup_modify_cgroup modifies the cgroup control files.
- * struct cgroup *cgroup: The name will be the cgroup to be modified.
- * The values will be the values to be modified, those not mentioned in the
- * structure will not be modified.
- *
- * The uids cannot be modified yet.
- *
- * returns 0 on success.
- */
-
-int cgroup_modify_cgroup(struct cgroup *cgroup)
+static int cg_modify_cgroup(struct cgroup *cgroup)
 {
 	char base[FILENAME_MAX];
 	int error = 0;
@@ -2634,6 +4338,27 @@ err:
 	return error;
 }
 
+/**
+ * cgroup_modify_cgroup modifies the cgroup control files.
+ * struct cgroup *cgroup: The name will be the cgroup to be modified.
+ * The values will be the values to be modified, those not mentioned in the
+ * structure will not be modified.
+ *
+ * The uids cannot be modified yet.
+ *
+ * returns 0 on success.
+ */
+int cgroup_modify_cgroup(struct cgroup *cgroup)
+{
+	int ret;
+
+	cg_probe(libcgroup, modify_entry, cgroup ? cgroup->name : NULL);
+	ret = cg_modify_cgroup(cgroup);
+	cg_probe(libcgroup, modify_return, cgroup ? cgroup->name : NULL, ret);
+
+	return ret;
+}
+
 int cgroup_copy_controller_values(struct cgroup_controller * const dst,
 				  const struct cgroup_controller * const src)
 {
@@ -2643,23 +4368,43 @@ int cgroup_copy_controller_values(struct cgroup_controller * const dst,
 		return ECGFAIL;
 
 	strncpy(dst->name, src->name, CONTROL_NAMELEN_MAX);
-	for (i = 0; i < src->index; i++, dst->index++) {
+
+	/*
+	 * The values of the heap are shared until either controller changes
+	 * them, src itself is only marked as sharing them
+	 */
+	if (dst->index == 0 && src->index > 0 && !(dst->cgroup && dst->cgroup->arena) &&
+	    !(src->cgroup && src->cgroup->arena))
+		return cg_share_values(dst, (struct cgroup_controller *)src);
+
+	for (i = 0; i < src->index; i++) {
 		struct control_value *src_val = src->values[i];
 		struct control_value *dst_val;
 
-		dst->values[i] = calloc(1, sizeof(struct control_value));
-		if (!dst->values[i]) {
-			last_errno = errno;
+		ret = cg_reserve_value(dst);
+		if (ret)
+			goto err;
+
+		dst_val = cg_cgroup_calloc(dst->cgroup, sizeof(struct control_value));
+		if (!dst_val) {
 			ret = ECGOTHER;
 			goto err;
 		}
+		dst->values[dst->index++] = dst_val;
 
-		dst_val = dst->values[i];
-		strncpy(dst_val->value, src_val->value, CG_CONTROL_VALUE_MAX);
-		strncpy(dst_val->name, src_val->name, FILENAME_MAX);
+		/* The names are interned, they can be shared */
+		dst_val->name = src_val->name;
+		dst_val->prev_name = src_val->prev_name;
+		ret = cg_set_cv_value(dst, dst_val, src_val->value);
+		if (ret)
+			goto err;
 
 		if (src_val->multiline_value) {
-			dst_val->multiline_value = strdup(src_val->multiline_value);
+			if (dst->cgroup && dst->cgroup->arena)
+				dst_val->multiline_value = cg_arena_strndup(dst->cgroup->arena,
+					src_val->multiline_value, strlen(src_val->multiline_value));
+			else
+				dst_val->multiline_value = strdup(src_val->multiline_value);
 			if (!dst_val->multiline_value) {
 				last_errno = errno;
 				ret = ECGOTHER;
@@ -2668,17 +4413,6 @@ int cgroup_copy_controller_values(struct cgroup_controller * const dst,
 		} else {
 			dst_val->multiline_value = NULL;
 		}
-
-		if (src_val->prev_name) {
-			dst_val->prev_name = strdup(src_val->prev_name);
-			if (!dst_val->prev_name) {
-				last_errno = errno;
-				ret = ECGOTHER;
-				goto err;
-			}
-		} else {
-			dst_val->prev_name = NULL;
-		}
 		/*
 		 * set dirty flag unconditionally, as we overwrite
 		 * destination controller values.
@@ -2689,18 +4423,7 @@ int cgroup_copy_controller_values(struct cgroup_controller * const dst,
 	return ret;
 
 err:
-	dst->index = 0;
-	for (i = 0; i < src->index; i++) {
-		if (dst->values[i]) {
-			if (dst->values[i]->multiline_value)
-				free(dst->values[i]->multiline_value);
-
-			if (dst->values[i]->prev_name)
-				free(dst->values[i]->prev_name);
-
-			free(dst->values[i]);
-		}
-	}
+	cg_free_values(dst);
 
 	return ret;
 }
@@ -2729,14 +4452,18 @@ int cgroup_copy_cgroup(struct cgroup *dst, struct cgroup *src)
 		struct cgroup_controller *src_ctlr = src->controller[i];
 		struct cgroup_controller *dst_ctlr;
 
-		dst->controller[i] = calloc(1, sizeof(struct cgroup_controller));
+		ret = cg_reserve_controller(dst);
+		if (ret)
+			goto err;
+
+		dst->controller[i] = cg_cgroup_calloc(dst, sizeof(struct cgroup_controller));
 		if (!dst->controller[i]) {
-			last_errno = errno;
 			ret = ECGOTHER;
 			goto err;
 		}
 
 		dst_ctlr = dst->controller[i];
+		dst_ctlr->cgroup = dst;
 		ret = cgroup_copy_controller_values(dst_ctlr, src_ctlr);
 		if (ret)
 			goto err;
@@ -2785,22 +4512,19 @@ err:
 }
 
 static int _cgroup_create_cgroup(const struct cgroup * const cgroup,
-				 const struct cgroup_controller * const controller,
+				 struct cgroup_controller * const controller,
 				 int ignore_ownership)
 {
 	enum cg_version_t version = CGROUP_UNK;
-	char *fts_path[2];
 	char *base = NULL;
 	char *path = NULL;
 	int error;
 
-	fts_path[0] = (char *)malloc(FILENAME_MAX);
-	if (!fts_path[0]) {
+	path = (char *)malloc(FILENAME_MAX);
+	if (!path) {
 		last_errno = errno;
 		return ECGOTHER;
 	}
-	fts_path[1] = NULL;
-	path = fts_path[0];
 
 	if (controller) {
 		if (!cg_build_path(cgroup->name, path, controller->name)) {
@@ -2848,15 +4572,8 @@ static int _cgroup_create_cgroup(const struct cgroup * const cgroup,
 	}
 
 	if (!ignore_ownership) {
-		cgroup_dbg("Changing ownership of %s\n", fts_path[0]);
-		error = cg_chown_recursive(fts_path, cgroup->control_uid, cgroup->control_gid);
-		if (!error)
-			error = cg_chmod_recursive_controller(fts_path[0],
-							      cgroup->control_dperm,
-							      cgroup->control_dperm != NO_PERMS,
-							      cgroup->control_fperm,
-							      cgroup->control_fperm != NO_PERMS,
-							      1, cgroup_ignored_tasks_files);
+		cgroup_dbg("Changing ownership of %s\n", path);
+		error = cg_chown_chmod_recursive(cgroup, path);
 	}
 
 	if (error)
@@ -2883,16 +4600,7 @@ err:
 	return error;
 }
 
-/**
- * cgroup_create_cgroup creates a new control group.
- * struct cgroup *cgroup: The control group to be created
- *
- * returns 0 on success. We recommend calling cg_delete_cgroup if this
- * routine fails. That should do the cleanup operation. If ECGCANTSETVALUE
- * is returned, the group was created successfully but not all controller
- * parameters were successfully set.
- */
-int cgroup_create_cgroup(struct cgroup *cgroup, int ignore_ownership)
+static int cg_create_cgroup(struct cgroup *cgroup, int ignore_ownership)
 {
 	int error = 0;
 	int i;
@@ -2926,7 +4634,9 @@ int cgroup_create_cgroup(struct cgroup *cgroup, int ignore_ownership)
 	 * on the cgroup data structure. If not, we fail.
 	 */
 	for (i = 0; i < cgroup->index; i++) {
-		error = _cgroup_create_cgroup(cgroup, cgroup->controller[i], ignore_ownership);
+		/* The ownership of a shared directory is only changed once */
+		error = _cgroup_create_cgroup(cgroup, cgroup->controller[i],
+					      ignore_ownership || cg_controller_dir_seen(cgroup, i));
 		if (error) {
 			int del_error;
 
@@ -2947,6 +4657,26 @@ int cgroup_create_cgroup(struct cgroup *cgroup, int ignore_ownership)
 	return 0;
 }
 
+/**
+ * cgroup_create_cgroup creates a new control group.
+ * struct cgroup *cgroup: The control group to be created
+ *
+ * returns 0 on success. We recommend calling cg_delete_cgroup if this
+ * routine fails. That should do the cleanup operation. If ECGCANTSETVALUE
+ * is returned, the group was created successfully but not all controller
+ * parameters were successfully set.
+ */
+int cgroup_create_cgroup(struct cgroup *cgroup, int ignore_ownership)
+{
+	int ret;
+
+	cg_probe(libcgroup, create_entry, cgroup ? cgroup->name : NULL);
+	ret = cg_create_cgroup(cgroup, ignore_ownership);
+	cg_probe(libcgroup, create_return, cgroup ? cgroup->name : NULL, ret);
+
+	return ret;
+}
+
 /**
  * Obtain the calculated parent name of specified cgroup; no validation of
  * the existence of the child or parent group is performed.
@@ -3008,14 +4738,9 @@ static int is_cgrp_ctrl_shared_mnt(char *controller)
 
 	pthread_rwlock_rdlock(&cg_mount_table_lock);
 
-	for (i = 0; cg_mount_table[i].name[0] != '\0'; i++) {
-
-		if (strncmp(cg_mount_table[i].name, controller, CONTROL_NAMELEN_MAX) == 0 &&
-		    cg_mount_table[i].shared_mnt) {
-			ret = 1;
-			break;
-		}
-	}
+	i = cg_mount_table_find(controller);
+	if (i >= 0 && cg_mount_table[i].shared_mnt)
+		ret = 1;
 
 	pthread_rwlock_unlock(&cg_mount_table_lock);
 
@@ -3149,44 +4874,141 @@ err_nomem:
 }
 
 /**
- * Move all processes from one task file to another.
+ * Move all processes from one task file to another.  The kernel takes a
+ * single pid per write(), the pids are thus written directly rather than
+ * through stdio, and read in large chunks.
  * @param input_tasks Pre-opened file to read tasks from.
  * @param output_tasks Pre-opened file to write tasks to.
  * @return 0 on success, >0 on error.
  */
-static int cg_move_task_files(FILE *input_tasks, FILE *output_tasks)
+STATIC int cg_move_task_files(FILE *input_tasks, FILE *output_tasks)
 {
-	int ret = 0;
-	int tids;
+	int in = fileno(input_tasks), out = fileno(output_tasks);
+	char buf[CG_MOVE_TASKS_BUF_SIZE + 1];
+	char *pos, *eol;
+	size_t len = 0;
+	ssize_t ret;
 
-	while (!feof(input_tasks)) {
-		ret = fscanf(input_tasks, "%d", &tids);
-		if (ret == EOF || ret == 0) {
-			ret = 0;
-			break;
-		}
+	for (;;) {
+		ret = read(in, buf + len, CG_MOVE_TASKS_BUF_SIZE - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
 		if (ret < 0)
-			break;
+			goto err;
+		len += ret;
 
-		ret = fprintf(output_tasks, "%d", tids);
-		if (ret < 0 && errno != ESRCH)
+		for (pos = buf; pos < buf + len; pos = eol + 1) {
+			eol = memchr(pos, '\n', buf + len - pos);
+			if (!eol) {
+				/* The rest of the line comes with the next read */
+				if (ret)
+					break;
+				eol = buf + len;
+			}
+			*eol = '\0';
+
+			/* A task which exited in the meantime is not an error */
+			if (eol > pos && write(out, pos, eol - pos) < 0 && errno != ESRCH)
+				goto err;
+		}
+
+		if (!ret)
 			break;
 
-		/* Flush the file, we need only one process per write() call. */
-		ret = fflush(output_tasks);
-		if (ret < 0) {
-			if (errno == ESRCH)
-				ret = 0;
-			else
-				break;
+		len = pos < buf + len ? buf + len - pos : 0;
+		if (len == CG_MOVE_TASKS_BUF_SIZE) {
+			errno = EINVAL;
+			goto err;
 		}
+		memmove(buf, pos, len);
 	}
 
-	if (ret < 0) {
-		last_errno = errno;
-		return ECGOTHER;
-	}
 	return 0;
+
+err:
+	last_errno = errno;
+	return ECGOTHER;
+}
+
+/**
+ * Kill all the processes of a group and of its subgroups with cgroup.kill,
+ * and wait for them to be gone.
+ * @param cgroup_name Name of the group.
+ * @param controller Name of the controller, NULL for cgroup v2.
+ * @return 0 on success, ECGROUPVALUENOTEXIST if the kernel has no
+ *	cgroup.kill, ECGNONEMPTY if the group is still populated after
+ *	CG_DELETE_KILL_TIMEOUT ms, >0 on other errors.
+ */
+static int cg_kill_cgroup(const char * const cgroup_name, const char * const controller)
+{
+	char path[FILENAME_MAX], buf[CG_CONTROL_VALUE_MAX];
+	int timeout = CG_DELETE_KILL_TIMEOUT;
+	struct pollfd pfd;
+	int fd = -1, ret;
+	char *populated;
+	ssize_t len;
+
+	if (!cg_build_path(cgroup_name, path, controller))
+		return ECGROUPSUBSYSNOTMOUNTED;
+
+	strncat(path, "cgroup.kill", sizeof(path) - strlen(path) - 1);
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		last_errno = errno;
+		return errno == ENOENT ? ECGROUPVALUENOTEXIST : ECGOTHER;
+	}
+
+	ret = write(fd, "1", 1) == 1 ? 0 : ECGOTHER;
+	if (ret)
+		last_errno = errno;
+	close(fd);
+	if (ret)
+		return ret;
+
+	/* The killed processes exit asynchronously, cgroup.events tells when */
+	path[strlen(path) - strlen("kill")] = '\0';
+	strncat(path, "events", sizeof(path) - strlen(path) - 1);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	for (;;) {
+		len = pread(fd, buf, sizeof(buf) - 1, 0);
+		if (len < 0) {
+			last_errno = errno;
+			ret = ECGOTHER;
+			break;
+		}
+		buf[len] = '\0';
+
+		populated = strstr(buf, "populated ");
+		if (!populated || populated[strlen("populated ")] == '0')
+			break;
+
+		/* cgroup.events is modified when the group becomes empty */
+		pfd.fd = fd;
+		pfd.events = POLLPRI;
+		ret = poll(&pfd, 1, timeout > 100 ? 100 : timeout);
+		if (ret < 0 && errno != EINTR) {
+			last_errno = errno;
+			ret = ECGOTHER;
+			break;
+		}
+		ret = 0;
+
+		timeout -= 100;
+		if (timeout <= 0) {
+			cgroup_warn("%s is still populated after killing its processes\n",
+				    cgroup_name);
+			ret = ECGNONEMPTY;
+			break;
+		}
+	}
+	close(fd);
+
+	return ret;
 }
 
 /**
@@ -3249,9 +5071,14 @@ static int cg_delete_cgroup_controller(char *cgroup_name, char *controller, FILE
 	if (!cg_build_path(cgroup_name, path, controller))
 		return ECGROUPSUBSYSNOTMOUNTED;
 
+	cg_dirfd_forget(path);
+	cg_subtree_cache_forget(path);
 	ret = rmdir(path);
-	if (ret == 0 || errno == ENOENT)
+	if (ret == 0 || errno == ENOENT) {
+		/* It may have been created from a template */
+		cg_template_cache_invalidate();
 		return 0;
+	}
 
 	if ((flags & CGFLAG_DELETE_EMPTY_ONLY) && (errno == EBUSY))
 		return ECGNONEMPTY;
@@ -3287,7 +5114,8 @@ static int cg_delete_cgroup_controller_recursive(char *cgroup_name, char *contro
 	ret = cgroup_walk_tree_begin(controller, cgroup_name, 0, &handle, &info, &level);
 
 	if (ret == 0)
-		ret = cgroup_walk_tree_set_flags(&handle, CGROUP_WALK_TYPE_POST_DIR);
+		ret = cgroup_walk_tree_set_flags(&handle, CGROUP_WALK_TYPE_POST_DIR |
+						 CGROUP_WALK_TYPE_DIRS_ONLY);
 
 	if (ret != 0) {
 		cgroup_walk_tree_end(&handle);
@@ -3346,8 +5174,10 @@ int cgroup_delete_cgroup_ext(struct cgroup *cgroup, int flags)
 	char *controller_name = NULL;
 	FILE *parent_tasks = NULL;
 	char *parent_name = NULL;
+	enum cg_version_t version;
 	int delete_group = 1;
 	int empty_cgroup = 0;
+	int del_flags;
 	int i, ret;
 
 	if (!cgroup_initialized)
@@ -3360,6 +5190,10 @@ int cgroup_delete_cgroup_ext(struct cgroup *cgroup, int flags)
 	    && (flags & CGFLAG_DELETE_EMPTY_ONLY))
 		return ECGINVAL;
 
+	/* cgroup.kill kills the processes of the subgroups too */
+	if ((flags & CGFLAG_DELETE_KILL) && !(flags & CGFLAG_DELETE_RECURSIVE))
+		return ECGINVAL;
+
 	if (cgroup->index == 0)
 		/* Valid empty cgroup v2 with not controllers added. */
 		empty_cgroup = 1;
@@ -3378,8 +5212,9 @@ int cgroup_delete_cgroup_ext(struct cgroup *cgroup, int flags)
 
 		ret = 0;
 		controller_name = NULL;
+		del_flags = flags;
 
-		if (cgroup->controller[i])
+		if (i < cgroup->index)
 			controller_name = cgroup->controller[i]->name;
 
 		/* Find parent, it can be different for each controller */
@@ -3430,6 +5265,28 @@ int cgroup_delete_cgroup_ext(struct cgroup *cgroup, int flags)
 			}
 		}
 
+		/* The processes of the group are killed rather than moved */
+		if (parent_name && delete_group && (flags & CGFLAG_DELETE_KILL) &&
+		    !cgroup_get_controller_version(controller_name, &version) &&
+		    version == CGROUP_V2) {
+			ret = cg_kill_cgroup(cgroup->name, controller_name);
+			if (ret == 0) {
+				free(parent_name);
+				parent_name = NULL;
+				del_flags |= CGFLAG_DELETE_EMPTY_ONLY;
+			} else if (ret != ECGROUPVALUENOTEXIST) {
+				if (first_error == 0) {
+					first_errno = last_errno;
+					first_error = ret;
+				}
+				free(parent_name);
+				parent_name = NULL;
+				continue;
+			}
+			/* Without cgroup.kill, the processes are moved */
+			ret = 0;
+		}
+
 		if (parent_name) {
 			/* Tasks need to be moved, pre-open target tasks file */
 			ret = cgroup_build_tasks_procs_path(parent_path, sizeof(parent_path),
@@ -3455,11 +5312,11 @@ int cgroup_delete_cgroup_ext(struct cgroup *cgroup, int flags)
 		}
 		if (flags & CGFLAG_DELETE_RECURSIVE) {
 			ret = cg_delete_cgroup_controller_recursive(cgroup->name, controller_name,
-								    parent_tasks, flags,
+								    parent_tasks, del_flags,
 								    delete_group);
 		} else {
 			ret = cg_delete_cgroup_controller(cgroup->name, controller_name,
-							  parent_tasks, flags);
+							  parent_tasks, del_flags);
 		}
 
 		if (parent_tasks) {
@@ -3504,40 +5361,151 @@ int cgroup_delete_cgroup_ext(struct cgroup *cgroup, int flags)
 static int cg_rd_ctrl_file(const char *subsys, const char *cgroup, const char *file, char **value)
 {
 	char path[FILENAME_MAX];
-	FILE *ctrl_file = NULL;
-	int ret;
+	ssize_t len = 0;
+	int ctrl_file;
+	ssize_t ret;
+	char c;
 
 	if (!cg_build_path_locked(cgroup, path, subsys))
 		return ECGFAIL;
 
 	strncat(path, file, sizeof(path) - strlen(path));
-	ctrl_file = fopen(path, "re");
-	if (!ctrl_file)
+	ctrl_file = cg_dirfd_open(path, O_RDONLY);
+	if (ctrl_file < 0)
 		return ECGROUPVALUENOTEXIST;
 
 	*value = calloc(CG_CONTROL_VALUE_MAX, 1);
 	if (!*value) {
-		fclose(ctrl_file);
+		close(ctrl_file);
 		last_errno = errno;
 		return ECGOTHER;
 	}
 
-	/* Using %as crashes when we try to read from files like memory.stat */
-	ret = fread(*value, 1, CG_CONTROL_VALUE_MAX-1, ctrl_file);
-	if (ret < 0) {
-		free(*value);
-		*value = NULL;
-	} else {
-		/* Remove trailing \n */
-		if (ret > 0 && (*value)[ret-1] == '\n')
-			(*value)[ret-1] = '\0';
+	/* Files like memory.stat need more than one read() */
+	while (len < CG_CONTROL_VALUE_MAX - 1) {
+		ret = read(ctrl_file, *value + len, CG_CONTROL_VALUE_MAX - 1 - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			break;
+		len += ret;
+	}
+
+	/* Such files are read in full by cgroup_read_stats_foreach() */
+	if (len == CG_CONTROL_VALUE_MAX - 1 && read(ctrl_file, &c, 1) > 0)
+		cgroup_warn("%s is longer than %d bytes, its value is truncated\n", path,
+			    CG_CONTROL_VALUE_MAX - 1);
+
+	/* Remove trailing \n */
+	if (len > 0 && (*value)[len - 1] == '\n')
+		(*value)[len - 1] = '\0';
+
+	close(ctrl_file);
+
+	return 0;
+}
+
+/**
+ * Read one control file into the buffer of a batch entry.
+ * @param path Full path of the control file
+ * @param value The batch entry
+ * @return 0 on success, > 0 on error.
+ */
+static int cg_read_batch_value(const char * const path, struct cgroup_batch_value * const value)
+{
+	size_t len = 0;
+	ssize_t ret;
+	int fd;
+
+	fd = cg_dirfd_open(path, O_RDONLY);
+	if (fd < 0) {
+		last_errno = errno;
+		return ECGROUPVALUENOTEXIST;
+	}
+
+	while (len < value->buf_len - 1) {
+		ret = read(fd, value->buf + len, value->buf_len - 1 - len);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret < 0) {
+			last_errno = errno;
+			close(fd);
+			return ECGOTHER;
+		}
+		if (ret == 0)
+			break;
+		len += ret;
 	}
+	close(fd);
 
-	fclose(ctrl_file);
+	/* Remove trailing \n */
+	if (len > 0 && value->buf[len - 1] == '\n')
+		len--;
+	value->buf[len] = '\0';
+	value->len = len;
 
 	return 0;
 }
 
+int cgroup_read_values_batch(struct cgroup_batch_value *values, int count)
+{
+	const char *last_cgroup = NULL, *last_controller = NULL;
+	char path[FILENAME_MAX];
+	bool have_dir = false;
+	size_t dir_len = 0;
+	int first_error = 0;
+	int i;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!values || count < 0)
+		return ECGINVAL;
+
+	pthread_rwlock_rdlock(&cg_mount_table_lock);
+	for (i = 0; i < count; i++) {
+		struct cgroup_batch_value *value = &values[i];
+
+		value->len = 0;
+		if (!value->cgroup || !value->file || !value->buf || value->buf_len == 0) {
+			value->err = ECGINVAL;
+			goto next;
+		}
+		value->buf[0] = '\0';
+
+		/*
+		 * The callers usually list all the files of one cgroup next to
+		 * each other, build the path of the cgroup only once for them.
+		 */
+		if (!have_dir || strcmp(value->cgroup, last_cgroup) ||
+		    (value->controller != last_controller &&
+		     (!value->controller || !last_controller ||
+		      strcmp(value->controller, last_controller)))) {
+			have_dir = cg_build_path_locked(value->cgroup, path, value->controller) != NULL;
+			last_cgroup = value->cgroup;
+			last_controller = value->controller;
+			if (have_dir)
+				dir_len = strlen(path);
+		}
+
+		if (!have_dir) {
+			value->err = ECGROUPSUBSYSNOTMOUNTED;
+			goto next;
+		}
+
+		path[dir_len] = '\0';
+		strncat(path, value->file, sizeof(path) - dir_len - 1);
+		value->err = cg_read_batch_value(path, value);
+
+next:
+		if (value->err && !first_error)
+			first_error = value->err;
+	}
+	pthread_rwlock_unlock(&cg_mount_table_lock);
+
+	return first_error;
+}
+
 /*
  * Call this function with required locks taken.
  */
@@ -3634,13 +5602,7 @@ fill_error:
 	return error;
 }
 
-/*
- * cgroup_get_cgroup reads the cgroup data from the filesystem.
- * struct cgroup has the name of the group to be populated
- *
- * return 0 on success.
- */
-int cgroup_get_cgroup(struct cgroup *cgroup)
+static int cg_get_cgroup(struct cgroup *cgroup)
 {
 	char cgrp_ctrl_path[FILENAME_MAX];
 	struct dirent *ctrl_dir = NULL;
@@ -3772,7 +5734,7 @@ int cgroup_get_cgroup(struct cgroup *cgroup)
 
 			error = cgroup_fill_cgc(ctrl_dir, cgroup, cgc, i);
 			for (j = 0; j < cgc->index; j++)
-				cgc->values[j]->dirty = false;
+				cg_cv_set_dirty(cgc, j, false);
 
 			if (error == ECGFAIL) {
 				closedir(dir);
@@ -3797,7 +5759,13 @@ int cgroup_get_cgroup(struct cgroup *cgroup)
 			}
 
 			if (memsw_limit >= 0 && memsw_limit < mem_limit) {
-				struct control_value *val = cgc->values[memsw_limit];
+				struct control_value *val;
+
+				error = cg_own_values(cgc);
+				if (error)
+					goto unlock_error;
+
+				val = cgc->values[memsw_limit];
 
 				cgc->values[memsw_limit] = cgc->values[mem_limit];
 				cgc->values[mem_limit] = val;
@@ -3833,6 +5801,76 @@ unlock_error:
 	return error;
 }
 
+/*
+ * cgroup_get_cgroup reads the cgroup data from the filesystem.
+ * struct cgroup has the name of the group to be populated
+ *
+ * return 0 on success.
+ */
+int cgroup_get_cgroup(struct cgroup *cgroup)
+{
+	int ret;
+
+	cg_probe(libcgroup, get_entry, cgroup ? cgroup->name : NULL);
+	ret = cg_get_cgroup(cgroup);
+	cg_probe(libcgroup, get_return, cgroup ? cgroup->name : NULL, ret);
+
+	return ret;
+}
+
+/*
+ * cgroup_get_cgroup_selective reads from the filesystem only the settings
+ * already present in the controllers of the cgroup.
+ *
+ * return 0 on success.
+ */
+int cgroup_get_cgroup_selective(struct cgroup *cgroup)
+{
+	struct cgroup_controller *cgc;
+	struct control_value *cv;
+	char *ctrl_value = NULL;
+	int error = 0;
+	int i, j;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!cgroup)
+		return ECGROUPNOTALLOWED;
+
+	pthread_rwlock_rdlock(&cg_mount_table_lock);
+	for (i = 0; i < cgroup->index; i++) {
+		cgc = cgroup->controller[i];
+
+		error = cg_own_values(cgc);
+		if (error)
+			goto unlock;
+
+		for (j = 0; j < cgc->index; j++) {
+			cv = cgc->values[j];
+
+			error = cg_rd_ctrl_file(cgc->name, cgroup->name, cv->name, &ctrl_value);
+			if (error == ECGFAIL)
+				error = ECGROUPSUBSYSNOTMOUNTED;
+			if (error)
+				goto unlock;
+
+			error = cg_set_cv_value(cgc, cv, ctrl_value);
+			free(ctrl_value);
+			ctrl_value = NULL;
+			if (error)
+				goto unlock;
+
+			cv->dirty = false;
+		}
+	}
+
+unlock:
+	pthread_rwlock_unlock(&cg_mount_table_lock);
+
+	return error;
+}
+
 /**
  * cg_prepare_cgroup Process the selected rule. Prepare the cgroup structure
  * which can be used to add the task to destination cgroup.
@@ -3920,273 +5958,480 @@ STATIC bool cgroup_compare_wildcard_procname(const char * const rule_procname,
 	return true;
 }
 
-static int cgroup_find_matching_destination(char *cgroup_list[], const char * const rule_dest,
-					    int *matching_index)
+/**
+ * Get the literal prefix of an anchored extended regular expression, the
+ * characters every matching name starts with.
+ *	@param re The regular expression
+ *	@return The length of the prefix, after the '^'
+ */
+static unsigned int cg_procname_regex_prefix(const char * const re)
 {
-	size_t rule_strlen = strlen(rule_dest);
-	int ret = -ENODATA;
-	int i;
-
-	for (i = 0; i < MAX_MNT_ELEMENTS; i++) {
-		if (cgroup_list[i] == NULL)
-			break;
+	unsigned int len = 0;
 
-		if (rule_dest[rule_strlen - 1] == '/') {
-			/*
-			 * Avoid a weird corner case where given a rule dest
-			 * like 'folder/', we _don't_ want to match 'folder1'
-			 */
-			if (strlen(cgroup_list[i]) >= rule_strlen &&
-			    cgroup_list[i][rule_strlen - 1] != '/')
-				continue;
+	/* Any branch of an alternation can match */
+	if (re[0] != '^' || strchr(re, '|'))
+		return 0;
 
-			/*
-			 * Strip off the '/' at the end of the rule, as
-			 * the destination from the cgroup_list will not
-			 * have a trailing '/'
-			 */
-			rule_strlen--;
-		}
+	while (re[len + 1] && !strchr(".[]()*+?{}\\^$", re[len + 1]))
+		len++;
 
-		if (strncmp(rule_dest, cgroup_list[i],
-			    rule_strlen) == 0) {
-			*matching_index = i;
-			ret = 0;
-			break;
-		}
-	}
+	/* The last character may be absent when it is quantified */
+	if (len && re[len + 1] && strchr("*?{", re[len + 1]))
+		len--;
 
-	return ret;
+	return len;
 }
 
-static int cgroup_find_matching_controller(char * const *rule_controllers,
-					   const char * const pid_controller, int *matching_index)
+int cg_procname_compile(struct cg_procname_pattern * const pattern, const char * const procname)
 {
-	int ret = -ENODATA;
-	int i;
+	size_t len = strlen(procname);
+	const char *star;
+	char err[128];
+	int ret;
 
-	for (i = 0; i < MAX_MNT_ELEMENTS; i++) {
-		if (rule_controllers[i] == NULL)
-			break;
+	memset(pattern, 0, sizeof(*pattern));
 
-		if (strlen(rule_controllers[i]) != strlen(pid_controller))
-			continue;
+	if (procname[0] == CG_PROCNAME_REGEX_MARK) {
+		pattern->regex = malloc(sizeof(regex_t));
+		if (!pattern->regex) {
+			last_errno = errno;
+			return ECGOTHER;
+		}
 
-		if (strncmp(pid_controller, rule_controllers[i], strlen(pid_controller)) == 0) {
-			*matching_index = i;
-			ret = 0;
-			break;
+		ret = regcomp(pattern->regex, procname + 1, REG_EXTENDED | REG_NOSUB);
+		if (ret) {
+			regerror(ret, pattern->regex, err, sizeof(err));
+			cgroup_warn("invalid regular expression %s: %s\n", procname + 1, err);
+			free(pattern->regex);
+			pattern->regex = NULL;
+			return ret == REG_ESPACE ? ECGOTHER : ECGINVAL;
 		}
-	}
 
-	return ret;
-}
+		pattern->type = CG_PROCNAME_REGEX;
+		pattern->prefix_start = 2;
+		pattern->prefix_len = cg_procname_regex_prefix(procname + 1);
 
-/**
- * Evaluates if rule is an ignore rule and the pid/procname match this rule.
- * If rule is an ignore rule and the pid/procname match this rule, then this
- * function returns true.  Otherwise it returns false.
- *
- *	@param rule The rule being evaluated
- *	@param pid PID of the process being compared
- *	@param procname Process name of the process being compared
- *	@return True if the rule is an ignore rule and this pid/procname
- *		match the rule.  False otherwise
- */
-STATIC bool cgroup_compare_ignore_rule(const struct cgroup_rule * const rule, pid_t pid,
-				       const char * const procname)
-{
-	char *controller_list[MAX_MNT_ELEMENTS] = { '\0' };
-	char *cgroup_list[MAX_MNT_ELEMENTS] = { '\0' };
-	int rule_matching_controller_idx;
-	int cgroup_list_matching_idx;
-	bool found_match = false;
-	char *token, *saveptr;
-	int ret, i;
+		return 0;
+	}
 
-	if (!rule->is_ignore)
-		/* Immediately return if the 'ignore' option is not set */
-		return false;
+	/*
+	 * A single trailing asterisk is a prefix, as it always was.  A name
+	 * with a backslash is a glob, the backslash quoting the next character
+	 * as fnmatch() does.
+	 */
+	star = strchr(procname, '*');
+	if (!strpbrk(procname, "?[\\") && (!star || star == &procname[len - 1]))
+		return 0;
 
-	ret = cg_get_cgroups_from_proc_cgroups(pid, cgroup_list, controller_list,
-					       MAX_MNT_ELEMENTS);
-	if (ret < 0)
-		goto out;
+	/* The prefix is indexed as written, it ends before the first escape */
+	pattern->type = CG_PROCNAME_GLOB;
+	pattern->prefix_len = strcspn(procname, "*?[\\");
 
-	ret = cgroup_find_matching_destination(cgroup_list, rule->destination,
-					       &cgroup_list_matching_idx);
-	if (ret < 0)
-		/* No cgroups matched */
-		goto out;
+	return 0;
+}
 
-	token = strtok_r(controller_list[cgroup_list_matching_idx], ",", &saveptr);
-	while (token != NULL) {
+void cg_procname_free(struct cg_procname_pattern * const pattern)
+{
+	if (pattern->regex) {
+		regfree(pattern->regex);
+		free(pattern->regex);
+	}
 
-		ret = cgroup_find_matching_controller(rule->controllers, token,
-						      &rule_matching_controller_idx);
-		if (ret == 0)
-			/* We found a matching controller */
-			break;
+	memset(pattern, 0, sizeof(*pattern));
+}
 
-		token = strtok_r(NULL, ",", &saveptr);
-	}
+bool cg_procname_match(const struct cg_procname_pattern * const pattern,
+		       const char * const rule_procname, const char * const procname,
+		       const char * const base)
+{
+	switch (pattern->type) {
+	case CG_PROCNAME_GLOB:
+		if (!fnmatch(rule_procname, procname, FNM_PATHNAME))
+			return true;
 
-	if (!rule->procname) {
-		/*
-		 * The rule procname is empty, thus it's a wildcard and
-		 * all processes match.
-		 */
-		found_match = true;
-		goto out;
+		return base && !fnmatch(rule_procname, base, FNM_PATHNAME);
+	case CG_PROCNAME_REGEX:
+		return !regexec(pattern->regex, procname, 0, NULL, 0);
+	default:
+		break;
 	}
 
-	if (!strcmp(rule->procname, procname)) {
-		found_match = true;
-		goto out;
-	}
+	if (!strcmp(rule_procname, procname))
+		return true;
 
-	if (cgroup_compare_wildcard_procname(rule->procname, procname))
-		found_match = true;
+	if (base && !strcmp(rule_procname, base))
+		/* Check a rule of basename. */
+		return true;
 
-out:
-	for (i = 0; i < MAX_MNT_ELEMENTS; i++) {
-		if (controller_list[i])
-			free(controller_list[i]);
-		if (cgroup_list[i])
-			free(cgroup_list[i]);
-	}
+	return cgroup_compare_wildcard_procname(rule_procname, procname);
+}
 
-	return found_match;
+STATIC void cg_proc_cgroups_init(struct cg_proc_cgroups * const pc, pid_t pid)
+{
+	memset(pc, 0, sizeof(*pc));
+	pc->pid = pid;
 }
 
-static struct cgroup_rule *cgroup_find_matching_rule_uid_gid(uid_t uid, gid_t gid,
-							     struct cgroup_rule *rule)
+STATIC void cg_proc_cgroups_free(struct cg_proc_cgroups * const pc)
+{
+	int i;
+
+	for (i = 0; i < MAX_MNT_ELEMENTS; i++) {
+		free(pc->controllers[i]);
+		free(pc->cgroups[i]);
+	}
+
+	cg_proc_cgroups_init(pc, pc->pid);
+}
+
+/**
+ * Read the cgroups of the process, unless they were read already.
+ *	@return 0 on success, -1 if /proc/PID/cgroup cannot be read
+ */
+static int cg_proc_cgroups_read(struct cg_proc_cgroups * const pc)
+{
+	int i;
+
+	if (pc->state)
+		return pc->state > 0 ? 0 : -1;
+
+	if (cg_get_cgroups_from_proc_cgroups(pc->pid, pc->cgroups, pc->controllers,
+					     MAX_MNT_ELEMENTS) < 0) {
+		pc->state = -1;
+		return -1;
+	}
+
+	for (i = 0; i < MAX_MNT_ELEMENTS && pc->cgroups[i]; i++)
+		pc->cgroups_len[i] = strlen(pc->cgroups[i]);
+
+	pc->state = 1;
+
+	return 0;
+}
+
+static int cgroup_find_matching_destination(const struct cg_proc_cgroups * const pc,
+					    const char * const rule_dest, int *matching_index)
+{
+	size_t rule_strlen = strlen(rule_dest);
+	size_t cmp_len = rule_strlen;
+	bool folder = false;
+	int i;
+
+	if (rule_strlen && rule_dest[rule_strlen - 1] == '/') {
+		/*
+		 * Strip off the '/' at the end of the rule, as the
+		 * destination from the cgroup list will not have a
+		 * trailing '/'
+		 */
+		folder = true;
+		cmp_len--;
+	}
+
+	for (i = 0; i < MAX_MNT_ELEMENTS && pc->cgroups[i]; i++) {
+		/*
+		 * Avoid a weird corner case where given a rule dest like
+		 * 'folder/', we _don't_ want to match 'folder1'
+		 */
+		if (folder && pc->cgroups_len[i] >= rule_strlen &&
+		    pc->cgroups[i][rule_strlen - 1] != '/')
+			continue;
+
+		if (strncmp(rule_dest, pc->cgroups[i], cmp_len) == 0) {
+			*matching_index = i;
+			return 0;
+		}
+	}
+
+	return -ENODATA;
+}
+
+/**
+ * Find a controller of a rule in a list of controllers, separated by
+ * commas as in /proc/PID/cgroup.
+ */
+static int cgroup_find_matching_controller(char * const *rule_controllers,
+					   const char * const pid_controllers, int *matching_index)
+{
+	const char *token = pid_controllers;
+	size_t token_len;
+	int i;
+
+	while (*token) {
+		token_len = strcspn(token, ",");
+
+		for (i = 0; i < MAX_MNT_ELEMENTS && rule_controllers[i]; i++) {
+			if (strlen(rule_controllers[i]) == token_len &&
+			    strncmp(token, rule_controllers[i], token_len) == 0) {
+				*matching_index = i;
+				return 0;
+			}
+		}
+
+		token += token_len;
+		if (*token == ',')
+			token++;
+	}
+
+	return -ENODATA;
+}
+
+/**
+ * Evaluates if rule is an ignore rule and the process matches it, with the
+ * cgroups of the process read at most once for all the rules.
+ *	@param rule The rule being evaluated
+ *	@param pc The cgroups of the process being compared
+ *	@param procname Process name of the process being compared
+ *	@return True if the rule is an ignore rule and the process matches it
+ */
+STATIC bool cg_compare_ignore_rule(const struct cgroup_rule * const rule,
+				   struct cg_proc_cgroups * const pc, const char * const procname)
+{
+	int rule_matching_controller_idx;
+	int cgroup_list_matching_idx;
+
+	if (!rule->is_ignore)
+		/* Immediately return if the 'ignore' option is not set */
+		return false;
+
+	if (cg_proc_cgroups_read(pc))
+		return false;
+
+	if (cgroup_find_matching_destination(pc, rule->destination, &cgroup_list_matching_idx))
+		/* No cgroups matched */
+		return false;
+
+	cgroup_find_matching_controller(rule->controllers,
+					pc->controllers[cgroup_list_matching_idx],
+					&rule_matching_controller_idx);
+
+	if (!rule->procname)
+		/*
+		 * The rule procname is empty, thus it's a wildcard and
+		 * all processes match.
+		 */
+		return true;
+
+	return cg_procname_match(&rule->pattern, rule->procname, procname, NULL);
+}
+
+/* What a match depends on, besides the UID, the GID and the process name */
+#define CG_MATCH_DEP_PID	0x1	/* the current cgroups of the process */
+#define CG_MATCH_DEP_GROUPS	0x2	/* the members of a group */
+
+/**
+ * Checks whether the user part of the rule matches the given UID and GID.
+ *	@param uid The UID to match
+ *	@param gid The GID to match
+ *	@param rule The rule to check
+ *	@param index The index of the list of the rule, NULL if not built
+ *	@param deps CG_MATCH_DEP_GROUPS is added if the group members were used
+ *	@return True if the rule applies to the UID or GID
+ */
+static bool cgroup_match_rule_uid_gid(uid_t uid, gid_t gid, const struct cgroup_rule * const rule,
+				      struct cgroup_rule_index * const index,
+				      unsigned int * const deps)
 {
 	/* Temporary user data */
-	struct passwd *usr = NULL;
+	char pw_buffer[CGROUP_BUFFER_LEN];
+	struct passwd pw, *usr = NULL;
 
 	/* Temporary group data */
-	struct group *grp = NULL;
+	struct group gr, *grp = NULL;
+	char *gr_buffer = NULL;
 
 	/* Temporary string pointer */
-	char *sp = NULL;
+	const char *sp = NULL;
+
+	/* Cached group membership */
+	int member;
+
+	bool found = false;
 
 	/* Loop variable */
 	int i = 0;
 
-	while (rule) {
-		/* Skip "%" which indicates continuation of previous rule. */
-		if (rule->username[0] == '%') {
-			rule = rule->next;
-			continue;
-		}
-		/* The wildcard rule always matches. */
-		if ((rule->uid == CGRULE_WILD) && (rule->gid == CGRULE_WILD))
-			return rule;
-
-		/* This is the simple case of the UID matching. */
-		if (rule->uid == uid)
-			return rule;
-
-		/* This is the simple case of the GID matching. */
-		if (rule->gid == gid)
-			return rule;
-
-		/* If this is a group rule, the UID might be a member. */
-		if (rule->username[0] == '@') {
-			/* Get the group data. */
-			sp = &(rule->username[1]);
-			grp = getgrnam(sp);
-			if (!grp) {
-				rule = rule->next;
-				continue;
-			}
+	/* Skip "%" which indicates continuation of previous rule. */
+	if (rule->username[0] == '%')
+		return false;
 
-			/* Get the data for UID. */
-			usr = getpwuid(uid);
-			if (!usr) {
-				rule = rule->next;
-				continue;
-			}
+	/* The wildcard rule always matches. */
+	if ((rule->uid == CGRULE_WILD) && (rule->gid == CGRULE_WILD))
+		return true;
 
-			/* If UID is a member of group, we matched. */
-			for (i = 0; grp->gr_mem[i]; i++) {
-				if (!(strcmp(usr->pw_name, grp->gr_mem[i])))
-					return rule;
-			}
-		}
+	/* This is the simple case of the UID matching. */
+	if (rule->uid == uid)
+		return true;
+
+	/* This is the simple case of the GID matching. */
+	if (rule->gid == gid)
+		return true;
+
+	/* If this is a group rule, the UID might be a member. */
+	if (rule->username[0] != '@')
+		return false;
+
+	*deps |= CG_MATCH_DEP_GROUPS;
+
+	member = cgroup_rule_index_group_member(index, rule, uid,
+						__atomic_load_n(&group_cache_ttl, __ATOMIC_RELAXED));
+	if (member >= 0)
+		return member;
+
+	/* Get the group data. */
+	sp = &(rule->username[1]);
+	grp = cg_getgrnam(sp, &gr, &gr_buffer);
+	if (!grp)
+		goto out;
 
-		/* If we haven't matched, try the next rule. */
-		rule = rule->next;
+	/* Get the data for UID. */
+	if (getpwuid_r(uid, &pw, pw_buffer, sizeof(pw_buffer), &usr) != 0 || !usr)
+		goto out;
+
+	/* If UID is a member of group, we matched. */
+	for (i = 0; grp->gr_mem[i]; i++) {
+		if (!(strcmp(usr->pw_name, grp->gr_mem[i]))) {
+			found = true;
+			break;
+		}
 	}
 
-	/* If we get here, no rules matched. */
-	return NULL;
+out:
+	free(gr_buffer);
+
+	return found;
+}
+
+/**
+ * Checks whether the rule is the one to apply to the given process.  An
+ * ignore rule is returned as matching if it applies to the process.
+ *	@param rule The rule to check
+ *	@param uid The UID to match
+ *	@param gid The GID to match
+ *	@param pc The cgroups of the process, read by the first ignore rule
+ *	@param procname The PROCESS NAME to match
+ *	@param base The basename of procname
+ *	@param index The index of the list of the rule, NULL if not built
+ *	@param deps Flags CG_MATCH_DEP_* added for what the result depends on
+ *	@return True if the rule matches
+ */
+static bool cgroup_match_rule(const struct cgroup_rule * const rule, uid_t uid, gid_t gid,
+			      struct cg_proc_cgroups * const pc, const char * const procname,
+			      const char * const base, struct cgroup_rule_index * const index,
+			      unsigned int * const deps)
+{
+	if (!cgroup_match_rule_uid_gid(uid, gid, rule, index, deps))
+		return false;
+
+	if (rule->is_ignore)
+		*deps |= CG_MATCH_DEP_PID;
+
+	if (cg_compare_ignore_rule(rule, pc, procname))
+		/*
+		 * This pid matched a rule that instructs the
+		 * cgrules daemon to ignore this process.
+		 */
+		return true;
+
+	if (rule->is_ignore)
+		/*
+		 * The rule currently being examined is an ignore
+		 * rule, but it didn't match this pid. Move on to
+		 * the next rule
+		 */
+		return false;
+
+	if (!procname)
+		/* If procname is NULL, return a rule matching UID or GID. */
+		return true;
+
+	if (!rule->procname)
+		/* If no process name in a rule, that means wildcard */
+		return true;
+
+	return cg_procname_match(&rule->pattern, rule->procname, procname, base);
 }
 
 /**
  * Finds the first rule in the cached list that matches the given UID, GID
- * or PROCESS NAME, and returns a pointer to that rule.
- * This function uses rl_lock.
+ * or PROCESS NAME, and returns a pointer to that rule.  If the rules index
+ * is available, only the candidate rules it returns are checked, and the
+ * result is kept in the cache of the index unless it depends on the pid.
+ * The index is rebuilt when the rules are reloaded, which flushes the cache.
+ * The caller must hold a snapshot of the rules for as long as it uses the
+ * returned rule.
  *
- * This function may NOT be thread safe.
+ *	@param lst The cached rules, from cg_snapshot_get()
  *	@param uid The UID to match
  *	@param gid The GID to match
  *	@param procname The PROCESS NAME to match
  *	@return Pointer to the first matching rule, or NULL if no match
- * TODO: Determine thread-safeness and fix if not safe.
  */
-static struct cgroup_rule *cgroup_find_matching_rule(uid_t uid, gid_t gid, pid_t pid,
+STATIC struct cgroup_rule *cgroup_find_matching_rule(const struct cgroup_rule_list * const lst,
+						     uid_t uid, gid_t gid, pid_t pid,
 						     const char *procname)
 {
-	/* Return value */
-	struct cgroup_rule *ret = rl.head;
+	struct cgroup_rule_iter iter;
+	unsigned long groups_gen = 0;
+	struct cg_proc_cgroups pc;
+	struct cgroup_rule *ret;
+	bool use_index, indexed = false;
+	unsigned int deps = 0;
+	unsigned int ttl;
 	char *base = NULL;
 
-	pthread_rwlock_wrlock(&rl_lock);
-	while (ret) {
-		ret = cgroup_find_matching_rule_uid_gid(uid, gid, ret);
-		if (!ret)
-			break;
-		if (cgroup_compare_ignore_rule(ret, pid, procname))
-			/*
-			 * This pid matched a rule that instructs the
-			 * cgrules daemon to ignore this process.
-			 */
-			break;
-		if (ret->is_ignore) {
-			/*
-			 * The rule currently being examined is an ignore
-			 * rule, but it didn't match this pid. Move on to
-			 * the next rule
-			 */
-			ret = ret->next;
-			continue;
-		}
-		if (!procname)
-			/* If procname is NULL, return a rule matching UID or GID. */
-			break;
-		if (!ret->procname)
-			/* If no process name in a rule, that means wildcard */
-			break;
-		if (!strcmp(ret->procname, procname))
-			break;
+	cg_probe(libcgroup, rule_match_entry, uid, gid, pid, procname);
+
+	/*
+	 * The index has no notion of CGRULE_INVALID, fall back to the list
+	 * scan if a caller passes it.
+	 */
+	use_index = lst->index && uid != CGRULE_INVALID && gid != CGRULE_INVALID;
+	ttl = __atomic_load_n(&group_cache_ttl, __ATOMIC_RELAXED);
+
+	if (use_index && cgroup_rule_index_match_get(lst->index, uid, gid, procname, ttl, &ret,
+						     &groups_gen)) {
+		cg_probe(libcgroup, rule_match_cached, pid, ret ? ret->destination : NULL);
+		goto out;
+	}
 
+	if (procname)
 		base = cgroup_basename(procname);
-		if (!strcmp(ret->procname, base))
-			/* Check a rule of basename. */
-			break;
-		if (cgroup_compare_wildcard_procname(ret->procname, procname))
-			break;
-		ret = ret->next;
-		free(base);
-		base = NULL;
+
+	cg_proc_cgroups_init(&pc, pid);
+
+	if (use_index)
+		indexed = cgroup_rule_index_lookup(lst->index, uid, procname, base, &iter) == 0;
+
+	if (indexed) {
+		while ((ret = cgroup_rule_iter_next(&iter))) {
+			if (cgroup_match_rule(ret, uid, gid, &pc, procname, base, lst->index,
+					      &deps))
+				break;
+		}
+	} else {
+		for (ret = lst->head; ret; ret = ret->next) {
+			if (cgroup_match_rule(ret, uid, gid, &pc, procname, base, lst->index,
+					      &deps))
+				break;
+		}
 	}
-	pthread_rwlock_unlock(&rl_lock);
+
+	cg_proc_cgroups_free(&pc);
 
 	if (base)
 		free(base);
 
+	/*
+	 * An ignore rule matches according to the cgroups the process is in,
+	 * and the group members are only trusted as long as the group cache.
+	 */
+	if (use_index && !(deps & CG_MATCH_DEP_PID) && (!(deps & CG_MATCH_DEP_GROUPS) || ttl))
+		cgroup_rule_index_match_put(lst->index, uid, gid, procname, ret,
+					    deps & CG_MATCH_DEP_GROUPS, groups_gen);
+
+out:
+	cg_probe(libcgroup, rule_match_return, pid, ret ? ret->destination : NULL, indexed);
+
 	return ret;
 }
 
@@ -4273,6 +6518,134 @@ end:
 	return ret;
 }
 
+void cg_template_cache_invalidate(void)
+{
+	__atomic_add_fetch(&template_gen, 1, __ATOMIC_RELAXED);
+}
+
+static unsigned int cg_template_cache_hash(const char * const key)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, key);
+}
+
+static void cg_template_cache_flush(void)
+{
+	struct cg_template_entry *entry;
+	int i;
+
+	for (i = 0; i < CG_TEMPLATE_CACHE_SIZE; i++) {
+		while (template_cache[i]) {
+			entry = template_cache[i];
+			template_cache[i] = entry->next;
+			free(entry->key);
+			free(entry);
+		}
+	}
+	template_cache_cnt = 0;
+}
+
+/**
+ * Build the key of a group created from a template: its expanded name and
+ * the controllers of the rule, the same name may be used by another rule
+ * with other controllers.
+ *	@return The key to be freed by the caller, NULL on error
+ */
+STATIC char *cg_template_cache_key(const char * const group_name,
+				   const struct cgroup_rule * const rule)
+{
+	size_t len;
+	char *key;
+	int i;
+
+	len = strlen(group_name) + 1;
+	for (i = 0; i < MAX_MNT_ELEMENTS && rule->controllers[i]; i++)
+		len += strlen(rule->controllers[i]) + 1;
+
+	key = malloc(len);
+	if (!key) {
+		last_errno = errno;
+		return NULL;
+	}
+
+	strcpy(key, group_name);
+	for (i = 0; i < MAX_MNT_ELEMENTS && rule->controllers[i]; i++) {
+		strcat(key, i ? "," : ":");
+		strcat(key, rule->controllers[i]);
+	}
+
+	return key;
+}
+
+/**
+ * Look for a group already created from a template.  template_lock must be
+ * held.
+ *	@param key The key of the group
+ *	@param remove Forget the group, e.g. it could not be used
+ *	@return true if the group was created since the last invalidation
+ */
+STATIC bool cg_template_cache_find(const char * const key, bool remove)
+{
+	struct cg_template_entry **entry, *tmp;
+	unsigned long gen;
+	unsigned int hash;
+
+	gen = __atomic_load_n(&template_gen, __ATOMIC_RELAXED);
+	if (gen != template_cache_gen) {
+		cg_template_cache_flush();
+		template_cache_gen = gen;
+		return false;
+	}
+
+	hash = cg_template_cache_hash(key);
+	for (entry = &template_cache[hash & (CG_TEMPLATE_CACHE_SIZE - 1)]; *entry;
+	     entry = &(*entry)->next) {
+		if ((*entry)->hash != hash || strcmp((*entry)->key, key))
+			continue;
+
+		if (remove) {
+			tmp = *entry;
+			*entry = tmp->next;
+			free(tmp->key);
+			free(tmp);
+			template_cache_cnt--;
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+/**
+ * Remember a group created from a template.  template_lock must be held.
+ *	@param key The key of the group, owned by the cache on success
+ *	@return 0 on success, ECGOTHER if the allocation failed
+ */
+STATIC int cg_template_cache_add(char * const key)
+{
+	struct cg_template_entry *entry;
+	unsigned int bucket;
+
+	/* Logins of many different users, start over rather than grow */
+	if (template_cache_cnt >= 4 * CG_TEMPLATE_CACHE_SIZE)
+		cg_template_cache_flush();
+
+	entry = malloc(sizeof(struct cg_template_entry));
+	if (!entry) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	entry->key = key;
+	entry->hash = cg_template_cache_hash(key);
+	bucket = entry->hash & (CG_TEMPLATE_CACHE_SIZE - 1);
+	entry->next = template_cache[bucket];
+	template_cache[bucket] = entry;
+	template_cache_cnt++;
+
+	return 0;
+}
+
 /*
  * Create control group based given template if the group already don't exist
  * dest is template name with substitute variables tmp is used cgrules rule.
@@ -4379,15 +6752,86 @@ end:
 	return ret;
 }
 
+/**
+ * Create a group from a template, unless it was already created since the
+ * templates were last reloaded or a group was removed.
+ *	@param group_name The expanded destination of the rule
+ *	@param rule The rule
+ *	@param flags Flags of cgroup_change_cgroup_flags()
+ *	@param forget Check and create the group even if it was already created
+ *	@param created Set to true if the group was checked or created now
+ *	@return 0 on success, > 0 on error
+ */
+static int cg_create_template_group_cached(char *group_name, struct cgroup_rule *rule, int flags,
+					   bool forget, bool *created)
+{
+	char *key;
+	int ret = 0;
+
+	*created = false;
+
+	/* Without a key the group is simply created every time */
+	key = cg_template_cache_key(group_name, rule);
+
+	pthread_mutex_lock(&template_lock);
+
+	if (key && cg_template_cache_find(key, forget) && !forget) {
+		cgroup_dbg("Group %s was already created from its template\n", group_name);
+		goto unlock;
+	}
+
+	ret = cgroup_create_template_group(group_name, rule, flags);
+	*created = true;
+	if (ret == 0 && key && cg_template_cache_add(key) == 0)
+		key = NULL;
+
+unlock:
+	pthread_mutex_unlock(&template_lock);
+	free(key);
+
+	return ret;
+}
+
+/* Time spent by the last cgroup_change_cgroup_flags() of the thread, in ns */
+static __thread u_int64_t change_match_ns;
+static __thread u_int64_t change_attach_ns;
+
+static u_int64_t cg_monotonic_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void cgroup_get_last_change_times(u_int64_t *match_ns, u_int64_t *attach_ns)
+{
+	if (match_ns)
+		*match_ns = change_match_ns;
+	if (attach_ns)
+		*attach_ns = change_attach_ns;
+}
+
 int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t pid, int flags)
 {
+	/* Start of the call and end of the rule matching */
+	u_int64_t start, matched = 0, now;
+
 	/* Temporary pointer to a rule */
 	struct cgroup_rule *tmp = NULL;
 
+	/* The cached rules, held until tmp is no longer used */
+	struct cgroup_rule_list *lst = NULL;
+	int slot = -1;
+
 	/* Temporary variables for destination substitution */
+	char nss_buffer[CGROUP_BUFFER_LEN];
 	char newdest[FILENAME_MAX];
-	struct passwd *user_info;
-	struct group *group_info;
+	struct passwd *user_info, user_buf;
+	struct group *group_info, group_buf;
+	bool template, created;
 	int available;
 	int written;
 	int i, j;
@@ -4395,6 +6839,9 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 	/* Return codes */
 	int ret = 0;
 
+	start = cg_monotonic_ns();
+	cg_probe(libcgroup, change_entry, uid, gid, procname, pid, flags);
+
 	/* We need to check this before doing anything else! */
 	if (!cgroup_initialized) {
 		cgroup_warn("libcgroup is not initialized\n");
@@ -4408,13 +6855,21 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 	 * cgrulesengd. Lets emulate its behaviour of caching the rules by
 	 * reloading the rules from the configuration file.
 	 */
-	if ((flags & CGFLAG_USECACHE) && (rl.head == NULL)) {
-		cgroup_warn("no cached rules found, trying to reload from %s.\n",
-			    CGRULES_CONF_FILE);
-
-		ret = cgroup_reload_cached_rules();
-		if (ret != 0)
-			goto finished;
+	if (flags & CGFLAG_USECACHE) {
+		lst = cg_snapshot_get(&rules, &slot);
+		if (!lst) {
+			cg_snapshot_put(&rules, slot);
+			cgroup_warn("no cached rules found, trying to reload from %s.\n",
+				    CGRULES_CONF_FILE);
+
+			ret = cgroup_reload_cached_rules();
+			if (ret != 0) {
+				slot = -1;
+				goto finished;
+			}
+
+			lst = cg_snapshot_get(&rules, &slot);
+		}
 	}
 
 	/*
@@ -4443,7 +6898,7 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 		tmp = trl.head;
 	} else {
 		/* Find the first matching rule in the cached list. */
-		tmp = cgroup_find_matching_rule(uid, gid, pid, procname);
+		tmp = lst ? cgroup_find_matching_rule(lst, uid, gid, pid, procname) : NULL;
 		if (!tmp) {
 			cgroup_dbg("No rule found to match PID: %d, UID: %d, GID: %d\n",
 				   pid, uid, gid);
@@ -4465,6 +6920,7 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 	}
 
 	/* If we are here, then we found a matching rule, so execute it. */
+	matched = cg_monotonic_ns();
 	do {
 		cgroup_dbg("Executing rule %s for PID %d... ", tmp->username, pid);
 
@@ -4482,7 +6938,9 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 					written = snprintf(newdest+j, available, "%d", uid);
 					break;
 				case 'u':
-					user_info = getpwuid(uid);
+					if (getpwuid_r(uid, &user_buf, nss_buffer, sizeof(nss_buffer),
+						       &user_info) != 0)
+						user_info = NULL;
 					if (user_info) {
 						written = snprintf(newdest + j, available, "%s",
 								   user_info->pw_name);
@@ -4495,7 +6953,9 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 					written = snprintf(newdest + j,	available, "%d", gid);
 					break;
 				case 'g':
-					group_info = getgrgid(gid);
+					if (getgrgid_r(gid, &group_buf, nss_buffer, sizeof(nss_buffer),
+						       &group_info) != 0)
+						group_info = NULL;
 					if (group_info) {
 						written = snprintf(newdest + j,	available, "%s",
 								   group_info->gr_name);
@@ -4544,11 +7004,14 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 		}
 
 		newdest[j] = 0;
-		if (strcmp(newdest, tmp->destination) != 0) {
+		template = strcmp(newdest, tmp->destination) != 0;
+		created = false;
+		if (template) {
 			/* Destination tag contains templates */
 
 			cgroup_dbg("control group %s is template\n", newdest);
-			ret = cgroup_create_template_group(newdest, tmp, flags);
+			ret = cg_create_template_group_cached(newdest, tmp, flags, false,
+							      &created);
 			if (ret) {
 				cgroup_warn("failed to create cgroup based on template %s\n",
 					    newdest);
@@ -4559,6 +7022,15 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 		/* Apply the rule */
 		ret = cgroup_change_cgroup_path(newdest, pid,
 						(const char * const *)tmp->controllers);
+		if (ret && template && !created) {
+			/* The group may have been removed behind our back */
+			cgroup_dbg("retrying with a new group %s\n", newdest);
+			ret = cg_create_template_group_cached(newdest, tmp, flags, true,
+							      &created);
+			if (!ret)
+				ret = cgroup_change_cgroup_path(newdest, pid,
+								(const char * const *)tmp->controllers);
+		}
 		if (ret) {
 			cgroup_warn("failed to apply the rule. Error was: %d\n", ret);
 			goto finished;
@@ -4574,6 +7046,14 @@ int cgroup_change_cgroup_flags(uid_t uid, gid_t gid, const char *procname, pid_t
 	} while (tmp && (tmp->username[0] == '%'));
 
 finished:
+	if (slot >= 0)
+		cg_snapshot_put(&rules, slot);
+
+	now = cg_monotonic_ns();
+	change_match_ns = (matched ? matched : now) - start;
+	change_attach_ns = matched ? now - matched : 0;
+	cg_probe(libcgroup, change_return, pid, ret, change_match_ns, change_attach_ns);
+
 	return ret;
 }
 
@@ -4677,52 +7157,277 @@ finished:
 }
 
 /**
- * Changes the cgroup of all running PIDs based on the rules in the config file.
- * If a rules exists for a PID, then the PID is placed in the correct group.
- *
- * This function may be called after creating new control groups to move
- * running PIDs into the newly created control groups.
- *	@return 0 on success, < 0 on error
+ * Check that the controllers are available in the unified hierarchy, by
+ * reading the cgroup.controllers file of its root.
  */
-int cgroup_change_all_cgroups(void)
+static int cg_unified_controllers_available(const char * const controllers[])
+{
+	char buf[CG_CONTROL_VALUE_MAX];
+	const char *start;
+	size_t len;
+	ssize_t n;
+	int fd, i;
+
+	fd = open(CG_UNIFIED_MOUNT_PATH "/cgroup.controllers", O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n < 0) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+	buf[n] = '\0';
+
+	for (i = 0; controllers[i]; i++) {
+		if (strcmp(controllers[i], "*") == 0)
+			continue;
+
+		len = strlen(controllers[i]);
+		for (start = buf; (start = strstr(start, controllers[i])); start += len) {
+			if ((start == buf || start[-1] == ' ') &&
+			    (start[len] == ' ' || start[len] == '\n' || start[len] == '\0'))
+				break;
+		}
+		if (!start)
+			return ECGROUPSUBSYSNOTMOUNTED;
+	}
+
+	return 0;
+}
+
+int cgroup_change_cgroup_path_fast(const char *dest, pid_t pid, const char * const controllers[])
+{
+	char path[FILENAME_MAX];
+	struct statfs fs;
+	char buf[16];
+	int len, fd;
+	int ret;
+
+	if (!dest)
+		return ECGINVAL;
+
+	if (statfs(CG_UNIFIED_MOUNT_PATH, &fs) || fs.f_type != CGROUP2_SUPER_MAGIC)
+		return ECGROUPUNSUPP;
+
+#ifdef WITH_SYSTEMD
+	/* The paths are relative to the default systemd cgroup, which needs cgroup_init() */
+	if (access(CG_SYSTEMD_DEFAULT_CGROUP_FILE, F_OK) == 0)
+		return ECGROUPUNSUPP;
+#endif
+
+	if (controllers) {
+		ret = cg_unified_controllers_available(controllers);
+		if (ret)
+			return ret;
+	}
+
+	ret = snprintf(path, sizeof(path), "%s/%s/cgroup.procs", CG_UNIFIED_MOUNT_PATH, dest);
+	if (ret >= (int)sizeof(path))
+		return ECGINVAL;
+
+	fd = open(path, O_WRONLY | O_CLOEXEC);
+	if (fd < 0) {
+		switch (errno) {
+		case EPERM:
+		case EACCES:
+			return ECGROUPNOTOWNER;
+		case ENOENT:
+			return ECGROUPNOTEXIST;
+		default:
+			last_errno = errno;
+			return ECGROUPNOTALLOWED;
+		}
+	}
+
+	/* The kernel moves all the threads of the process written to cgroup.procs */
+	ret = 0;
+	len = snprintf(buf, sizeof(buf), "%d", pid);
+	if (write(fd, buf, len) != len) {
+		last_errno = errno;
+		ret = errno == ESRCH ? ECGROUPNOTEXIST : ECGOTHER;
+	}
+	close(fd);
+
+	return ret;
+}
+
+/* Pids of /proc shared by the threads of cgroup_change_all_cgroups_ext() */
+struct cg_change_all {
+	pid_t *pids;
+	int count;
+	/* Next pid to be taken by a thread */
+	int next;
+	int flags;
+	cgroup_change_all_skip_callback skip;
+	void *userdata;
+};
+
+static void cg_change_all_pid(pid_t pid, const struct cg_change_all * const change)
+{
+	int flags = change->flags;
+	struct cgroup_rule_list *lst;
+	struct cgroup_rule *rule;
+	char *procname = NULL;
+	bool skip;
+	uid_t euid;
+	gid_t egid;
+	int slot;
+	int err;
+
+	if (change->skip && change->skip(pid, change->userdata))
+		return;
+
+	err = cgroup_get_proc_info_from_procfs(pid, &euid, &egid, &procname);
+	if (err)
+		return;
+
+	if (flags & CGFLAG_CHANGE_ALL_CHANGED_RULES) {
+		/*
+		 * A pid matching no rule is not moved anyway, and one matching
+		 * an unchanged rule is already where the rule puts it.
+		 */
+		lst = cg_snapshot_get(&rules, &slot);
+		rule = lst ? cgroup_find_matching_rule(lst, euid, egid, pid, procname) : NULL;
+		skip = !rule || rule->unchanged;
+
+		/* The rule may have been shadowed by a rule the reload replaced */
+		if (skip && rule && lst->replaced)
+			skip = !cgroup_find_matching_rule(lst->replaced, euid, egid, pid,
+							  procname);
+		cg_snapshot_put(&rules, slot);
+
+		if (skip)
+			goto out;
+	}
+
+	err = cgroup_change_cgroup_flags(euid, egid, procname, pid, CGFLAG_USECACHE);
+	if (err)
+		cgroup_dbg("cgroup change pid %i failed\n", pid);
+
+out:
+	free(procname);
+}
+
+static void *cg_change_all_worker(void *arg)
+{
+	struct cg_change_all *change = arg;
+	int i, end;
+
+	for (;;) {
+		i = __atomic_fetch_add(&change->next, CG_CHANGE_ALL_CHUNK, __ATOMIC_RELAXED);
+		if (i >= change->count)
+			break;
+
+		end = min(i + CG_CHANGE_ALL_CHUNK, change->count);
+		for (; i < end; i++)
+			cg_change_all_pid(change->pids[i], change);
+	}
+
+	return NULL;
+}
+
+int cgroup_change_all_cgroups_ext(int jobs, int flags)
 {
+	return cgroup_change_all_cgroups_skip(jobs, flags, NULL, NULL);
+}
+
+int cgroup_change_all_cgroups_skip(int jobs, int flags, cgroup_change_all_skip_callback skip,
+				   void *userdata)
+{
+	struct cg_change_all change;
 	struct dirent *pid_dir = NULL;
-	char *path = "/proc/";
+	pthread_t *threads = NULL;
+	int started = 0;
+	int alloc = 0;
+	pid_t *tmp;
+	int i, pid;
 	DIR *dir;
 
-	dir = opendir(path);
-	if (!dir)
-		return -ECGOTHER;
+	if (jobs < 1)
+		return ECGINVAL;
 
-	while ((pid_dir = readdir(dir)) != NULL) {
-		int err, pid;
-		uid_t euid;
-		gid_t egid;
-		char *procname = NULL;
+	memset(&change, 0, sizeof(change));
+	change.flags = flags;
+	change.skip = skip;
+	change.userdata = userdata;
 
-		err = sscanf(pid_dir->d_name, "%i", &pid);
-		if (err < 1)
-			continue;
+	/* List the pids first, the threads then share them */
+	dir = opendir("/proc/");
+	if (!dir) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
 
-		err = cgroup_get_uid_gid_from_procfs(pid, &euid, &egid);
-		if (err)
+	while ((pid_dir = readdir(dir)) != NULL) {
+		if (sscanf(pid_dir->d_name, "%i", &pid) < 1)
 			continue;
 
-		err = cgroup_get_procname_from_procfs(pid, &procname);
-		if (err)
-			continue;
+		if (change.count == alloc) {
+			alloc = alloc ? alloc * 2 : 1024;
+			tmp = realloc(change.pids, alloc * sizeof(pid_t));
+			if (!tmp) {
+				last_errno = errno;
+				closedir(dir);
+				free(change.pids);
+				return ECGOTHER;
+			}
+			change.pids = tmp;
+		}
+		change.pids[change.count++] = pid;
+	}
+	closedir(dir);
 
-		err = cgroup_change_cgroup_flags(euid, egid, procname, pid, CGFLAG_USECACHE);
-		if (err)
-			cgroup_dbg("cgroup change pid %i failed\n", pid);
+	if (jobs > change.count / CG_CHANGE_ALL_CHUNK)
+		jobs = max(change.count / CG_CHANGE_ALL_CHUNK, 1);
 
-		free(procname);
+	if (jobs > 1) {
+		threads = malloc((jobs - 1) * sizeof(pthread_t));
+		if (!threads)
+			jobs = 1;
 	}
 
-	closedir(dir);
+	/* The calling thread is one of the workers */
+	for (i = 0; i < jobs - 1; i++) {
+		if (pthread_create(&threads[i], NULL, cg_change_all_worker, &change)) {
+			cgroup_warn("cannot start a thread, using %d\n", i + 1);
+			break;
+		}
+		started++;
+	}
+
+	cg_change_all_worker(&change);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	free(threads);
+	free(change.pids);
+
 	return 0;
 }
 
+/**
+ * Changes the cgroup of all running PIDs based on the rules in the config file.
+ * If a rules exists for a PID, then the PID is placed in the correct group.
+ *
+ * This function may be called after creating new control groups to move
+ * running PIDs into the newly created control groups.
+ *	@return 0 on success, < 0 on error
+ */
+int cgroup_change_all_cgroups(void)
+{
+	int ret;
+
+	ret = cgroup_change_all_cgroups_ext(1, 0);
+
+	/* Historically, the error is negative */
+	return ret ? -ret : 0;
+}
+
 /**
  * Print the cached rules table.  This function should be called only after
  * first calling cgroup_parse_config(), but it will work with an empty rule
@@ -4734,18 +7439,22 @@ void cgroup_print_rules_config(FILE *fp)
 	/* Iterator */
 	struct cgroup_rule *itr = NULL;
 
+	/* The cached rules */
+	struct cgroup_rule_list *lst;
+	int slot;
+
 	/* Loop variable */
 	int i = 0;
 
-	pthread_rwlock_rdlock(&rl_lock);
+	lst = cg_snapshot_get(&rules, &slot);
 
-	if (!(rl.head)) {
+	if (!lst) {
 		fprintf(fp, "The rules table is empty.\n\n");
-		pthread_rwlock_unlock(&rl_lock);
+		cg_snapshot_put(&rules, slot);
 		return;
 	}
 
-	itr = rl.head;
+	itr = lst->head;
 	while (itr) {
 		fprintf(fp, "Rule: %s", itr->username);
 		if (itr->procname)
@@ -4781,7 +7490,7 @@ void cgroup_print_rules_config(FILE *fp)
 		fprintf(fp, "\n");
 		itr = itr->next;
 	}
-	pthread_rwlock_unlock(&rl_lock);
+	cg_snapshot_put(&rules, slot);
 }
 
 /**
@@ -4809,6 +7518,24 @@ finished:
 	return ret;
 }
 
+int cgroup_set_group_cache_ttl(unsigned int ttl)
+{
+	struct cgroup_rule_list *lst;
+	int slot;
+
+	pthread_mutex_lock(&rl_lock);
+	__atomic_store_n(&group_cache_ttl, ttl, __ATOMIC_RELAXED);
+
+	lst = cg_snapshot_get(&rules, &slot);
+	if (lst)
+		cgroup_rule_index_invalidate_groups(lst->index);
+	cg_snapshot_put(&rules, slot);
+
+	pthread_mutex_unlock(&rl_lock);
+
+	return 0;
+}
+
 /**
  * Initializes the rules cache.
  *	@return 0 on success, > 0 on error
@@ -4982,386 +7709,1374 @@ cleanup_path:
 	return ret;
 }
 
-const char *cgroup_strerror(int code)
-{
-	int idx = code % ECGROUPNOTCOMPILED;
+/* Current groups of many tasks */
+struct cgroup_pid_paths {
+	size_t pids;
+	int columns;
+	/* Path id of each task in each hierarchy, pids * columns */
+	unsigned int *ids;
+	/* Interned paths, indexed by their id */
+	char **names;
+	unsigned int names_cnt;
+	unsigned int names_size;
+	/* Open addressing table of the path ids + 1, 0 for a free slot */
+	unsigned int *slots;
+	unsigned int slots_size;
+	struct cgroup_arena *arena;
+};
 
-	if (code == ECGOTHER) {
-#ifdef STRERROR_R_CHAR_P
-		return strerror_r(cgroup_get_last_errno(), errtext, MAXLEN);
-#else
-		return strerror_r(cgroup_get_last_errno(), errtext, sizeof(errtext)) ?
-			"unknown error" : errtext;
-#endif
-	}
-	if (idx >= ARRAY_SIZE(cgroup_strerror_codes))
-		return "Invalid error code";
+/* A hierarchy the tasks are looked up in */
+struct cg_pid_paths_column {
+	/* NULL for the unified hierarchy */
+	const char *controller;
+	size_t len;
+	bool v2;
+	char *mount;
+	/* The first column of the same hierarchy */
+	int first;
+};
 
-	return cgroup_strerror_codes[idx];
-}
+/* A task to look up in the cgroup.procs files */
+struct cg_pid_paths_task {
+	pid_t pid;
+	size_t index;
+};
 
-/**
- * Return last errno, which caused ECGOTHER error.
- */
-int cgroup_get_last_errno(void)
+static unsigned int cg_pid_paths_hash(const char * const path, size_t len)
 {
-	return last_errno;
+	return cg_fnv1a(CG_FNV1A_INIT, path, len);
 }
 
-static int cg_walk_node(FTS *fts, FTSENT *ent, const int depth, struct cgroup_file_info *info,
-			int dir)
+/**
+ * Get the id of a path, give it a new one if it has none yet.
+ *	@return 0 on success, ECGOTHER if the allocation failed
+ */
+static int cg_pid_paths_intern(struct cgroup_pid_paths * const paths, const char * const path,
+			       size_t len, unsigned int * const id)
 {
-	int ret = 0;
+	unsigned int *slots, size, slot, i;
+	char **names;
 
-	if (!cgroup_initialized)
-		return ECGROUPNOTINITIALIZED;
-
-	cgroup_dbg("seeing file %s\n", ent->fts_path);
+	if ((paths->names_cnt + 1) * 2 > paths->slots_size) {
+		size = paths->slots_size ? paths->slots_size * 2 : 256;
+		slots = calloc(size, sizeof(unsigned int));
+		if (!slots)
+			goto err;
 
-	info->path = ent->fts_name;
-	info->parent = ent->fts_parent->fts_name;
-	info->full_path = ent->fts_path;
-	info->depth = ent->fts_level;
-	info->type = CGROUP_FILE_TYPE_OTHER;
+		for (i = 0; i < paths->names_cnt; i++) {
+			slot = cg_pid_paths_hash(paths->names[i], strlen(paths->names[i]));
+			while (slots[slot & (size - 1)])
+				slot++;
+			slots[slot & (size - 1)] = i + 1;
+		}
 
-	if (depth && (info->depth > depth))
-		return 0;
+		free(paths->slots);
+		paths->slots = slots;
+		paths->slots_size = size;
+	}
 
-	switch (ent->fts_info) {
-	case FTS_DNR:
-	case FTS_ERR:
-		errno = ent->fts_errno;
-		break;
-	case FTS_D:
-		if (dir & CGROUP_WALK_TYPE_PRE_DIR)
-			info->type = CGROUP_FILE_TYPE_DIR;
-		break;
-	case FTS_DC:
-	case FTS_NSOK:
-	case FTS_NS:
-	case FTS_DP:
-		if (dir & CGROUP_WALK_TYPE_POST_DIR)
-			info->type = CGROUP_FILE_TYPE_DIR;
-		break;
-	case FTS_F:
-		info->type = CGROUP_FILE_TYPE_FILE;
-		break;
-	case FTS_DEFAULT:
-		break;
+	slot = cg_pid_paths_hash(path, len) & (paths->slots_size - 1);
+	while (paths->slots[slot]) {
+		i = paths->slots[slot] - 1;
+		if (!strncmp(paths->names[i], path, len) && paths->names[i][len] == '\0') {
+			*id = i;
+			return 0;
+		}
+		slot = (slot + 1) & (paths->slots_size - 1);
 	}
-	return ret;
-}
 
-int cgroup_walk_tree_next(int depth, void **handle, struct cgroup_file_info *info, int base_level)
-{
-	struct cgroup_tree_handle *entry;
-	FTSENT *ent;
-	int ret = 0;
+	if (paths->names_cnt == paths->names_size) {
+		size = paths->names_size ? paths->names_size * 2 : 64;
+		names = realloc(paths->names, size * sizeof(char *));
+		if (!names)
+			goto err;
 
-	if (!cgroup_initialized)
-		return ECGROUPNOTINITIALIZED;
+		paths->names = names;
+		paths->names_size = size;
+	}
 
-	if (!handle)
-		return ECGINVAL;
+	paths->names[paths->names_cnt] = cg_arena_strndup(paths->arena, path, len);
+	if (!paths->names[paths->names_cnt])
+		goto err;
 
-	entry = (struct cgroup_tree_handle *) *handle;
+	paths->slots[slot] = paths->names_cnt + 1;
+	*id = paths->names_cnt++;
 
-	ent = fts_read(entry->fts);
-	if (!ent)
-		return ECGEOF;
-	if (!base_level && depth)
-		base_level = ent->fts_level + depth;
+	return 0;
 
-	ret = cg_walk_node(entry->fts, ent, base_level, info, entry->flags);
+err:
+	last_errno = errno;
 
-	*handle = entry;
-	return ret;
+	return ECGOTHER;
 }
 
-int cgroup_walk_tree_end(void **handle)
+/**
+ * Read a whole file of procfs or cgroupfs into a buffer grown as needed.
+ *	@param dirfd The directory of the file, or AT_FDCWD
+ *	@return The length read, -1 with errno set on error
+ */
+static ssize_t cg_pid_paths_read(int dirfd, const char * const file, char **buf,
+				 size_t * const size)
 {
-	struct cgroup_tree_handle *entry;
+	ssize_t len = 0, ret;
+	char *tmp;
+	int fd;
+
+	fd = openat(dirfd, file, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return -1;
+
+	for (;;) {
+		if ((size_t)len + 1 >= *size) {
+			tmp = realloc(*buf, *size * 2);
+			if (!tmp) {
+				len = -1;
+				break;
+			}
+			*buf = tmp;
+			*size *= 2;
+		}
+
+		ret = read(fd, *buf + len, *size - len - 1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0) {
+			if (ret < 0)
+				len = -1;
+			break;
+		}
+		len += ret;
+	}
+	close(fd);
+
+	if (len >= 0)
+		(*buf)[len] = '\0';
+
+	return len;
+}
+
+/**
+ * Check whether a comma separated list of controllers has a controller.
+ */
+static bool cg_pid_paths_has_controller(const char *list, const char * const end,
+					const struct cg_pid_paths_column * const column)
+{
+	const char *comma;
+
+	while (list < end) {
+		comma = memchr(list, ',', end - list);
+		if (!comma)
+			comma = end;
+
+		if ((size_t)(comma - list) == column->len &&
+		    !memcmp(list, column->controller, column->len))
+			return true;
+
+		list = comma + 1;
+	}
+
+	return false;
+}
+
+/**
+ * Fill the path ids of a task from its /proc/<pid>/cgroup file, each line
+ * being hierarchy-ID:controller-list:cgroup-path.
+ */
+static int cg_pid_paths_parse(struct cgroup_pid_paths * const paths,
+			      const struct cg_pid_paths_column * const columns, size_t index,
+			      const char *line, const char * const end)
+{
+	const char *eol, *ctrls, *path;
+	unsigned int *ids;
+	bool unified;
+	int j, ret;
+
+	ids = &paths->ids[index * paths->columns];
+
+	for (; line < end; line = eol + 1) {
+		eol = memchr(line, '\n', end - line);
+		if (!eol)
+			eol = end;
+
+		ctrls = memchr(line, ':', eol - line);
+		if (!ctrls)
+			continue;
+		ctrls++;
+
+		path = memchr(ctrls, ':', eol - ctrls);
+		if (!path)
+			continue;
+
+		/* The unified hierarchy is 0::<path> */
+		unified = ctrls - line == 2 && line[0] == '0' && path == ctrls;
+
+		for (j = 0; j < paths->columns; j++) {
+			if (ids[j] != CGROUP_PATH_ID_NONE)
+				continue;
+
+			if (columns[j].v2 ? !unified :
+			    unified || !cg_pid_paths_has_controller(ctrls, path, &columns[j]))
+				continue;
+
+			ret = cg_pid_paths_intern(paths, path + 1, eol - path - 1, &ids[j]);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int cg_pid_paths_task_cmp(const void *a, const void *b)
+{
+	const struct cg_pid_paths_task *ta = a, *tb = b;
+
+	return ta->pid < tb->pid ? -1 : ta->pid > tb->pid;
+}
+
+/**
+ * Walk a hierarchy, filling the path ids of the tasks found in the
+ * cgroup.procs file of each group.
+ *	@param first The first column of the hierarchy
+ *	@param dirfd The directory of the group, closed on return
+ *	@param path The path of the group relative to the mount point, of
+ *	FILENAME_MAX characters
+ */
+static int cg_pid_paths_walk(struct cgroup_pid_paths * const paths,
+			     const struct cg_pid_paths_column * const columns, int first,
+			     const struct cg_pid_paths_task * const tasks, int dirfd, char *path,
+			     char **buf, size_t * const size)
+{
+	struct cg_pid_paths_task key, *task;
+	unsigned int id = CGROUP_PATH_ID_NONE;
+	size_t len = strlen(path);
+	struct dirent *dent;
+	char *pos, *next;
+	ssize_t cnt;
+	int ret = 0;
+	DIR *dir;
+	int fd, j;
+
+	cnt = cg_pid_paths_read(dirfd, "cgroup.procs", buf, size);
+	for (pos = *buf; cnt > 0 && *pos; pos = next) {
+		key.pid = strtol(pos, &next, 10);
+		if (next == pos)
+			break;
+
+		task = bsearch(&key, tasks, paths->pids, sizeof(*tasks), cg_pid_paths_task_cmp);
+		if (!task)
+			continue;
+
+		if (id == CGROUP_PATH_ID_NONE) {
+			ret = cg_pid_paths_intern(paths, path, len, &id);
+			if (ret)
+				goto out;
+		}
+
+		/* The same task may have been asked for more than once */
+		while (task > tasks && task[-1].pid == key.pid)
+			task--;
+		for (; task < tasks + paths->pids && task->pid == key.pid; task++)
+			for (j = first; j < paths->columns; j++)
+				if (columns[j].first == first)
+					paths->ids[task->index * paths->columns + j] = id;
+	}
+
+	fd = fcntl(dirfd, F_DUPFD_CLOEXEC, 0);
+	dir = fd >= 0 ? fdopendir(fd) : NULL;
+	if (!dir) {
+		if (fd >= 0)
+			close(fd);
+		goto out;
+	}
+
+	while (!ret && (dent = readdir(dir))) {
+		if (dent->d_type != DT_DIR || !strcmp(dent->d_name, ".") ||
+		    !strcmp(dent->d_name, ".."))
+			continue;
+
+		if (snprintf(path + len, FILENAME_MAX - len, "%s%s", len > 1 ? "/" : "",
+			     dent->d_name) >= FILENAME_MAX - (int)len)
+			continue;
+
+		fd = openat(dirfd, dent->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd >= 0)
+			ret = cg_pid_paths_walk(paths, columns, first, tasks, fd, path, buf, size);
+	}
+	path[len] = '\0';
+	closedir(dir);
+
+out:
+	close(dirfd);
+
+	return ret;
+}
+
+/**
+ * Fill the path ids of the tasks from the cgroup.procs files of the
+ * hierarchies.
+ */
+static int cg_pid_paths_from_procs(struct cgroup_pid_paths * const paths,
+				   const pid_t * const pids,
+				   const struct cg_pid_paths_column * const columns,
+				   char **buf, size_t * const size)
+{
+	struct cg_pid_paths_task *tasks;
+	char *path = NULL;
+	int ret = 0;
+	size_t i;
+	int j, fd;
+
+	tasks = malloc(paths->pids * sizeof(*tasks));
+	path = malloc(FILENAME_MAX);
+	if (!tasks || !path) {
+		last_errno = errno;
+		ret = ECGOTHER;
+		goto out;
+	}
+
+	for (i = 0; i < paths->pids; i++) {
+		tasks[i].pid = pids[i];
+		tasks[i].index = i;
+	}
+	qsort(tasks, paths->pids, sizeof(*tasks), cg_pid_paths_task_cmp);
+
+	for (j = 0; j < paths->columns && !ret; j++) {
+		if (columns[j].first != j)
+			continue;
+
+		fd = open(columns[j].mount, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0) {
+			last_errno = errno;
+			ret = ECGOTHER;
+			break;
+		}
+
+		strcpy(path, "/");
+		ret = cg_pid_paths_walk(paths, columns, j, tasks, fd, path, buf, size);
+	}
+
+out:
+	free(tasks);
+	free(path);
+
+	return ret;
+}
+
+/**
+ * Drop the path ids of the cgroup v2 groups where the controller of a
+ * column is not enabled, each group is checked once.
+ */
+static int cg_pid_paths_check_v2(struct cgroup_pid_paths * const paths,
+				 const struct cg_pid_paths_column * const column, int j)
+{
+	unsigned int *ids, id;
+	signed char *enabled;
+	size_t i;
+
+	enabled = calloc(paths->names_cnt, 1);
+	if (!enabled) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	for (i = 0; i < paths->pids; i++) {
+		ids = &paths->ids[i * paths->columns];
+		id = ids[j];
+		if (id == CGROUP_PATH_ID_NONE)
+			continue;
+
+		if (!enabled[id])
+			enabled[id] = cgroupv2_controller_enabled(paths->names[id],
+								  column->controller) ? -1 : 1;
+		if (enabled[id] < 0)
+			ids[j] = CGROUP_PATH_ID_NONE;
+	}
+	free(enabled);
+
+	return 0;
+}
+
+int cgroup_get_current_controller_paths(const pid_t *pids, size_t n,
+					const char * const controllers[], int flags,
+					struct cgroup_pid_paths **paths)
+{
+	struct cg_pid_paths_column *columns = NULL;
+	struct cgroup_pid_paths *result = NULL;
+	size_t size = 4096, i;
+	int cnt = 1, j, k;
+	char *buf = NULL;
+	char file[64];
+	ssize_t len;
+	int ret = 0;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!paths || (!pids && n))
+		return ECGINVAL;
+
+	if (controllers)
+		for (cnt = 0; controllers[cnt]; cnt++)
+			;
+
+	result = calloc(1, sizeof(struct cgroup_pid_paths));
+	columns = calloc(cnt ? cnt : 1, sizeof(struct cg_pid_paths_column));
+	buf = malloc(size);
+	if (!result || !columns || !buf)
+		goto oom;
+
+	result->pids = n;
+	result->columns = cnt;
+	result->arena = cgroup_arena_new();
+	result->ids = malloc((n * cnt + 1) * sizeof(unsigned int));
+	if (!result->arena || !result->ids)
+		goto oom;
+	memset(result->ids, 0xff, n * cnt * sizeof(unsigned int));
+
+	pthread_rwlock_rdlock(&cg_mount_table_lock);
+	for (j = 0; j < cnt; j++) {
+		if (controllers) {
+			k = cg_mount_table_find(controllers[j]);
+			if (k < 0) {
+				ret = ECGROUPSUBSYSNOTMOUNTED;
+				break;
+			}
+
+			columns[j].controller = controllers[j];
+			columns[j].len = strlen(controllers[j]);
+			columns[j].v2 = cg_mount_table[k].version == CGROUP_V2;
+			columns[j].mount = strdup(cg_mount_table[k].mount.path);
+		} else if (cg_cgroup_v2_mount_path[0] != '\0') {
+			columns[j].v2 = true;
+			columns[j].mount = strdup(cg_cgroup_v2_mount_path);
+		} else {
+			ret = ECGROUPSUBSYSNOTMOUNTED;
+			break;
+		}
+
+		if (!columns[j].mount) {
+			last_errno = errno;
+			ret = ECGOTHER;
+			break;
+		}
+
+		for (k = 0; k < j && strcmp(columns[k].mount, columns[j].mount); k++)
+			;
+		columns[j].first = k;
+	}
+	pthread_rwlock_unlock(&cg_mount_table_lock);
+	if (ret)
+		goto err;
+
+	if (flags & CGFLAG_PID_PATHS_FROM_PROCS) {
+		ret = cg_pid_paths_from_procs(result, pids, columns, &buf, &size);
+		if (ret)
+			goto err;
+	} else {
+		for (i = 0; i < n; i++) {
+			snprintf(file, sizeof(file), "/proc/%d/cgroup", pids[i]);
+
+			/* A task which exited is in no group */
+			len = cg_pid_paths_read(AT_FDCWD, file, &buf, &size);
+			if (len < 0)
+				continue;
+
+			ret = cg_pid_paths_parse(result, columns, i, buf, buf + len);
+			if (ret)
+				goto err;
+		}
+	}
+
+	for (j = 0; j < cnt; j++) {
+		if (!columns[j].v2 || !columns[j].controller)
+			continue;
+
+		ret = cg_pid_paths_check_v2(result, &columns[j], j);
+		if (ret)
+			goto err;
+	}
+
+	goto out;
+
+oom:
+	last_errno = errno;
+	ret = ECGOTHER;
+err:
+	cgroup_pid_paths_free(&result);
+out:
+	for (j = 0; columns && j < cnt; j++)
+		free(columns[j].mount);
+	free(columns);
+	free(buf);
+
+	*paths = result;
+
+	return ret;
+}
+
+unsigned int cgroup_pid_paths_id(const struct cgroup_pid_paths *paths, size_t pid_index,
+				 int controller_index)
+{
+	if (!paths || pid_index >= paths->pids || controller_index < 0 ||
+	    controller_index >= paths->columns)
+		return CGROUP_PATH_ID_NONE;
+
+	return paths->ids[pid_index * paths->columns + controller_index];
+}
+
+const char *cgroup_pid_paths_name(const struct cgroup_pid_paths *paths, unsigned int id)
+{
+	if (!paths || id >= paths->names_cnt)
+		return NULL;
+
+	return paths->names[id];
+}
+
+unsigned int cgroup_pid_paths_count(const struct cgroup_pid_paths *paths)
+{
+	return paths ? paths->names_cnt : 0;
+}
+
+void cgroup_pid_paths_free(struct cgroup_pid_paths **paths)
+{
+	if (!paths || !*paths)
+		return;
+
+	cgroup_arena_free(&(*paths)->arena);
+	free((*paths)->ids);
+	free((*paths)->names);
+	free((*paths)->slots);
+	free(*paths);
+	*paths = NULL;
+}
+
+const char *cgroup_strerror(int code)
+{
+	int idx = code % ECGROUPNOTCOMPILED;
+
+	if (code == ECGOTHER) {
+#ifdef STRERROR_R_CHAR_P
+		return strerror_r(cgroup_get_last_errno(), errtext, MAXLEN);
+#else
+		return strerror_r(cgroup_get_last_errno(), errtext, sizeof(errtext)) ?
+			"unknown error" : errtext;
+#endif
+	}
+	if (idx >= ARRAY_SIZE(cgroup_strerror_codes))
+		return "Invalid error code";
+
+	return cgroup_strerror_codes[idx];
+}
+
+/**
+ * Return last errno, which caused ECGOTHER error.
+ */
+int cgroup_get_last_errno(void)
+{
+	return last_errno;
+}
+
+static int cg_walk_node(FTS *fts, FTSENT *ent, const int depth, struct cgroup_file_info *info,
+			int dir)
+{
+	int ret = 0;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	cgroup_dbg("seeing file %s\n", ent->fts_path);
+
+	info->path = ent->fts_name;
+	info->parent = ent->fts_parent->fts_name;
+	info->full_path = ent->fts_path;
+	info->depth = ent->fts_level;
+	info->type = CGROUP_FILE_TYPE_OTHER;
+
+	if (depth && (info->depth > depth))
+		return 0;
+
+	switch (ent->fts_info) {
+	case FTS_DNR:
+	case FTS_ERR:
+		errno = ent->fts_errno;
+		break;
+	case FTS_D:
+		if (dir & CGROUP_WALK_TYPE_PRE_DIR)
+			info->type = CGROUP_FILE_TYPE_DIR;
+		break;
+	case FTS_DC:
+	case FTS_NSOK:
+	case FTS_NS:
+	case FTS_DP:
+		if (dir & CGROUP_WALK_TYPE_POST_DIR)
+			info->type = CGROUP_FILE_TYPE_DIR;
+		break;
+	case FTS_F:
+		info->type = CGROUP_FILE_TYPE_FILE;
+		break;
+	case FTS_DEFAULT:
+		break;
+	}
+	return ret;
+}
+
+int cgroup_walk_tree_next(int depth, void **handle, struct cgroup_file_info *info, int base_level)
+{
+	struct cgroup_tree_handle *entry;
+	FTSENT *ent;
+	int ret = 0;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle)
+		return ECGINVAL;
+
+	entry = (struct cgroup_tree_handle *) *handle;
+	entry->started = true;
+
+	if (entry->flags & CGROUP_WALK_TYPE_DIRS_ONLY) {
+		/* The info of cgroup_walk_tree_begin() pointed into the fts walk */
+		if (entry->fts) {
+			fts_close(entry->fts);
+			entry->fts = NULL;
+		}
+		return cg_walk_dirs_next(entry, base_level ? base_level : depth, info);
+	}
+
+	ent = fts_read(entry->fts);
+	if (!ent)
+		return ECGEOF;
+	if (!base_level && depth)
+		base_level = ent->fts_level + depth;
+
+	ret = cg_walk_node(entry->fts, ent, base_level, info, entry->flags);
+
+	*handle = entry;
+	return ret;
+}
+
+int cgroup_walk_tree_end(void **handle)
+{
+	struct cgroup_tree_handle *entry;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle)
+		return ECGINVAL;
+
+	entry = (struct cgroup_tree_handle *) *handle;
+
+	if (entry->fts)
+		fts_close(entry->fts);
+	cg_walk_dirs_end(entry);
+	free(entry);
+	*handle = NULL;
+
+	return 0;
+}
+
+/* TODO: Need to decide a better place to put this function. */
+int cgroup_walk_tree_begin(const char *controller, const char *base_path, int depth, void **handle,
+			   struct cgroup_file_info *info, int *base_level)
+{
+	struct cgroup_tree_handle *entry;
+	char full_path[FILENAME_MAX];
+	char *cg_path[2];
+	FTSENT *ent;
+	int ret = 0;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle)
+		return ECGINVAL;
+
+	cgroup_dbg("path is %s\n", base_path);
+
+	if (!cg_build_path(base_path, full_path, controller))
+		return ECGOTHER;
+
+	entry = calloc(1, sizeof(struct cgroup_tree_handle));
+
+	if (!entry) {
+		last_errno = errno;
+		*handle = NULL;
+		return ECGOTHER;
+	}
+
+	entry->flags |= CGROUP_WALK_TYPE_PRE_DIR;
+
+	*base_level = 0;
+	cg_path[0] = full_path;
+	cg_path[1] = NULL;
+
+	entry->fts = fts_open(cg_path, FTS_LOGICAL | FTS_NOCHDIR | FTS_NOSTAT, NULL);
+	if (entry->fts == NULL) {
+		free(entry);
+		last_errno = errno;
+		*handle = NULL;
+		return ECGOTHER;
+	}
+	ent = fts_read(entry->fts);
+	if (!ent) {
+		cgroup_warn("fts_read failed\n");
+		fts_close(entry->fts);
+		free(entry);
+		*handle = NULL;
+		return ECGINVAL;
+	}
+	if (!*base_level && depth)
+		*base_level = ent->fts_level + depth;
+
+	ret = cg_walk_node(entry->fts, ent, *base_level, info, entry->flags);
+	if (ret != 0) {
+		fts_close(entry->fts);
+		free(entry);
+		*handle = NULL;
+	} else {
+		*handle = entry;
+	}
+	return ret;
+}
+
+int cgroup_walk_tree_set_flags(void **handle, int flags)
+{
+	struct cgroup_tree_handle *entry;
+	int ret;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle)
+		return ECGINVAL;
+
+	if ((flags & CGROUP_WALK_TYPE_PRE_DIR) &&
+	    (flags & CGROUP_WALK_TYPE_POST_DIR))
+		return ECGINVAL;
+
+	entry = (struct cgroup_tree_handle *) *handle;
+
+	if ((flags ^ entry->flags) & CGROUP_WALK_TYPE_DIRS_ONLY) {
+		/* The fts walk is closed by the first step, it cannot be restored */
+		if (entry->started || !(flags & CGROUP_WALK_TYPE_DIRS_ONLY))
+			return ECGINVAL;
+
+		ret = cg_walk_dirs_start(entry, entry->fts->fts_cur->fts_path);
+		if (ret)
+			return ret;
+	}
+
+	entry->flags = flags;
+
+	*handle = entry;
+	return 0;
+}
+
+int cgroup_walk_tree_get_dirfd(void **handle, int *dirfd)
+{
+	struct cgroup_tree_handle *entry;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle || !*handle || !dirfd)
+		return ECGINVAL;
+
+	entry = (struct cgroup_tree_handle *) *handle;
+	if (!(entry->flags & CGROUP_WALK_TYPE_DIRS_ONLY))
+		return ECGINVAL;
+
+	*dirfd = cg_walk_dirs_fd(entry);
+	if (*dirfd < 0)
+		return ECGINVAL;
+
+	return 0;
+}
+
+int cgroup_walk_tree_parallel(const char *controller, const char *base_path, int depth,
+			      int threads, int flags, cgroup_walk_visit_callback visit,
+			      cgroup_walk_emit_callback emit, void *userdata)
+{
+	char full_path[FILENAME_MAX];
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!base_path || threads < 1 || depth < 0)
+		return ECGINVAL;
+
+	if (!cg_build_path(base_path, full_path, controller))
+		return ECGOTHER;
+
+	return cg_walk_tree_parallel(full_path, depth, threads, flags, visit, emit, userdata);
+}
+
+/*
+ * Handle of cgroup_read_value_*() and cgroup_read_stats_*().  The file stays
+ * open, it is read from offset 0 into the buffer of the handle by the begin
+ * and rewind functions, and the lines are then taken from the buffer.
+ */
+struct cg_read_handle {
+	int fd;
+	char *buf;
+	size_t size;
+	size_t len;
+	/* Start of the next line in buf */
+	size_t pos;
+};
+
+/**
+ * Read the whole file of a handle again, with pread() so that the offset of
+ * the file does not matter.
+ * @return 0 on success, ECGROUPNOTEXIST if the group was removed
+ */
+static int cg_read_handle_fill(struct cg_read_handle * const rh)
+{
+	size_t size;
+	ssize_t rd;
+	char *buf;
+
+	rh->len = 0;
+	rh->pos = 0;
+
+	for (;;) {
+		if (rh->len == rh->size) {
+			size = rh->size ? rh->size * 2 : CG_KEYED_BUF_SIZE;
+			buf = realloc(rh->buf, size);
+			if (!buf) {
+				last_errno = errno;
+				return ECGOTHER;
+			}
+			rh->buf = buf;
+			rh->size = size;
+		}
+
+		rd = pread(rh->fd, rh->buf + rh->len, rh->size - rh->len, rh->len);
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd < 0) {
+			last_errno = errno;
+			/* The files of a removed group stay open but fail */
+			return errno == ENODEV ? ECGROUPNOTEXIST : ECGOTHER;
+		}
+		/* The buffer was grown before the last read, a \0 fits after len */
+		if (rd == 0)
+			return 0;
+
+		rh->len += rd;
+	}
+}
+
+static int cg_read_handle_open(const char * const path, struct cg_read_handle ** const rh)
+{
+	*rh = calloc(1, sizeof(struct cg_read_handle));
+	if (!*rh) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	(*rh)->fd = cg_dirfd_open(path, O_RDONLY);
+	if ((*rh)->fd < 0) {
+		last_errno = errno;
+		free(*rh);
+		*rh = NULL;
+		return ECGOTHER;
+	}
+
+	return 0;
+}
+
+static int cg_read_handle_close(void **handle)
+{
+	struct cg_read_handle *rh;
+
+	if (!handle || !*handle)
+		return ECGINVAL;
+
+	rh = *handle;
+	close(rh->fd);
+	free(rh->buf);
+	free(rh);
+	*handle = NULL;
+
+	return 0;
+}
+
+/* Like fgets(), from the buffer of the handle */
+static int cg_read_handle_line(struct cg_read_handle * const rh, char *buffer, int max)
+{
+	char *newline;
+	size_t len;
+
+	if (rh->pos == rh->len || max < 1)
+		return ECGEOF;
 
+	len = rh->len - rh->pos;
+	newline = memchr(rh->buf + rh->pos, '\n', len);
+	if (newline)
+		len = newline - (rh->buf + rh->pos) + 1;
+	if (len > (size_t)max - 1)
+		len = max - 1;
+
+	memcpy(buffer, rh->buf + rh->pos, len);
+	buffer[len] = '\0';
+	rh->pos += len;
+
+	return 0;
+}
+
+/* The next word of the line between *pos and end, separated by spaces */
+static size_t cg_read_handle_word(const char ** const pos, const char * const end,
+				  const char ** const word)
+{
+	const char *c = *pos;
+
+	while (c < end && *c == ' ')
+		c++;
+	*word = c;
+
+	while (c < end && *c != ' ')
+		c++;
+	*pos = c;
+
+	return c - *word;
+}
+
+/*
+ * This parses a stat line which is in the form of (name value) pair
+ * separated by a space.  The value keeps the newline of the line.
+ */
+static int cg_read_stat(struct cg_read_handle * const rh, struct cgroup_stat *cgroup_stat)
+{
+	const char *pos, *end, *word;
+	char *newline;
+	size_t len;
+
+	if (rh->pos == rh->len)
+		return ECGEOF;
+
+	pos = rh->buf + rh->pos;
+	newline = memchr(pos, '\n', rh->len - rh->pos);
+	end = newline ? newline + 1 : rh->buf + rh->len;
+	rh->pos = end - rh->buf;
+
+	len = cg_read_handle_word(&pos, end, &word);
+	if (!len)
+		return ECGINVAL;
+	if (len > FILENAME_MAX - 1)
+		len = FILENAME_MAX - 1;
+	memcpy(cgroup_stat->name, word, len);
+	cgroup_stat->name[len] = '\0';
+
+	len = cg_read_handle_word(&pos, end, &word);
+	if (!len)
+		return ECGINVAL;
+	if (len > CG_VALUE_MAX - 1)
+		len = CG_VALUE_MAX - 1;
+	memcpy(cgroup_stat->value, word, len);
+	cgroup_stat->value[len] = '\0';
+
+	return 0;
+}
+
+int cgroup_read_value_end(void **handle)
+{
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
 
-	if (!handle)
+	return cg_read_handle_close(handle);
+}
+
+int cgroup_read_value_next(void **handle, char *buffer, int max)
+{
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!buffer || !handle || !*handle)
 		return ECGINVAL;
 
-	entry = (struct cgroup_tree_handle *) *handle;
+	return cg_read_handle_line(*handle, buffer, max);
+}
 
-	fts_close(entry->fts);
-	free(entry);
-	*handle = NULL;
+int cgroup_read_value_rewind(void **handle, char *buffer, int max)
+{
+	int ret;
 
-	return 0;
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!buffer || !handle || !*handle)
+		return ECGINVAL;
+
+	ret = cg_read_handle_fill(*handle);
+	if (ret)
+		return ret;
+
+	return cg_read_handle_line(*handle, buffer, max);
 }
 
-/* TODO: Need to decide a better place to put this function. */
-int cgroup_walk_tree_begin(const char *controller, const char *base_path, int depth, void **handle,
-			   struct cgroup_file_info *info, int *base_level)
+int cgroup_read_value_begin(const char * const controller, const char *path,
+			    const char * const name, void **handle, char *buffer, int max)
 {
-	struct cgroup_tree_handle *entry;
-	char full_path[FILENAME_MAX];
-	char *cg_path[2];
-	FTSENT *ent;
+	char stat_file[FILENAME_MAX + sizeof(name)];
+	char stat_path[FILENAME_MAX];
+	struct cg_read_handle *rh;
 	int ret = 0;
 
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
 
-	if (!handle)
+	if (!buffer || !handle)
 		return ECGINVAL;
 
-	cgroup_dbg("path is %s\n", base_path);
-
-	if (!cg_build_path(base_path, full_path, controller))
+	if (!cg_build_path(path, stat_path, controller))
 		return ECGOTHER;
 
-	entry = calloc(1, sizeof(struct cgroup_tree_handle));
+	snprintf(stat_file, sizeof(stat_file), "%s/%s", stat_path,
+		 name);
+	*handle = NULL;
 
-	if (!entry) {
-		last_errno = errno;
-		*handle = NULL;
-		return ECGOTHER;
+	ret = cg_read_handle_open(stat_file, &rh);
+	if (ret) {
+		cgroup_warn("open failed\n");
+		return ret;
 	}
 
-	entry->flags |= CGROUP_WALK_TYPE_PRE_DIR;
+	/* As fgets() did, a failed read is the end of the file */
+	if (cg_read_handle_fill(rh)) {
+		cg_read_handle_close((void **)&rh);
+		return ECGEOF;
+	}
 
-	*base_level = 0;
-	cg_path[0] = full_path;
-	cg_path[1] = NULL;
+	*handle = rh;
 
-	entry->fts = fts_open(cg_path, FTS_LOGICAL | FTS_NOCHDIR | FTS_NOSTAT, NULL);
-	if (entry->fts == NULL) {
-		free(entry);
-		last_errno = errno;
-		*handle = NULL;
-		return ECGOTHER;
-	}
-	ent = fts_read(entry->fts);
-	if (!ent) {
-		cgroup_warn("fts_read failed\n");
-		fts_close(entry->fts);
-		free(entry);
-		*handle = NULL;
+	return cg_read_handle_line(rh, buffer, max);
+}
+
+int cgroup_read_stats_end(void **handle)
+{
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	return cg_read_handle_close(handle);
+}
+
+int cgroup_read_stats_next(void **handle, struct cgroup_stat *cgroup_stat)
+{
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle || !*handle || !cgroup_stat)
 		return ECGINVAL;
-	}
-	if (!*base_level && depth)
-		*base_level = ent->fts_level + depth;
 
-	ret = cg_walk_node(entry->fts, ent, *base_level, info, entry->flags);
-	if (ret != 0) {
-		fts_close(entry->fts);
-		free(entry);
-		*handle = NULL;
-	} else {
-		*handle = entry;
-	}
+	return cg_read_stat(*handle, cgroup_stat);
+}
+
+int cgroup_read_stats_rewind(void **handle, struct cgroup_stat *cgroup_stat)
+{
+	int ret;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle || !*handle || !cgroup_stat)
+		return ECGINVAL;
+
+	ret = cg_read_handle_fill(*handle);
+	if (ret)
+		return ret;
+
+	return cg_read_stat(*handle, cgroup_stat);
+}
+
+int cgroup_read_stats_map_rewind(void **handle, const struct cgroup_stat_map *map,
+				 u_int64_t *values)
+{
+	struct cg_read_handle *rh;
+	int ret;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!handle || !*handle || !map || !values)
+		return ECGINVAL;
+
+	rh = *handle;
+	ret = cg_read_handle_fill(rh);
+	if (ret)
+		return ret;
+
+	/* The lines are split in place, nothing is left for the next call */
+	ret = cg_stat_map_parse(rh->buf, rh->len, map, values);
+	rh->pos = rh->len;
+
 	return ret;
 }
 
-int cgroup_walk_tree_set_flags(void **handle, int flags)
+/* TODO: Need to decide a better place to put this function. */
+int cgroup_read_stats_begin(const char *controller, const char *path, void **handle,
+			    struct cgroup_stat *cgroup_stat)
 {
-	struct cgroup_tree_handle *entry;
+	char stat_file[FILENAME_MAX + sizeof(".stat")];
+	char stat_path[FILENAME_MAX];
+	struct cg_read_handle *rh;
 
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
 
-	if (!handle)
+	if (!cgroup_stat || !handle)
 		return ECGINVAL;
 
-	if ((flags & CGROUP_WALK_TYPE_PRE_DIR) &&
-	    (flags & CGROUP_WALK_TYPE_POST_DIR))
+	if (!cg_build_path(path, stat_path, controller))
+		return ECGOTHER;
+
+	snprintf(stat_file, sizeof(stat_file), "%s/%s.stat", stat_path, controller);
+
+	*handle = NULL;
+
+	if (cg_read_handle_open(stat_file, &rh)) {
+		cgroup_warn("open failed\n");
 		return ECGINVAL;
+	}
 
-	entry = (struct cgroup_tree_handle *) *handle;
-	entry->flags = flags;
+	/* As getline() did, a failed read is the end of the file */
+	if (cg_read_handle_fill(rh)) {
+		cg_read_handle_close((void **)&rh);
+		return ECGEOF;
+	}
 
-	*handle = entry;
-	return 0;
+	*handle = rh;
+
+	return cg_read_stat(rh, cgroup_stat);
 }
 
-/*
- * This parses a stat line which is in the form of (name value) pair
- * separated by a space.
+/**
+ * Split a line of a flat keyed or nested keyed file, and pass its values to
+ * the callback.
  */
-static int cg_read_stat(FILE *fp, struct cgroup_stat *cgroup_stat)
+static int cg_parse_keyed_line(char *line, cgroup_stat_callback callback, void *userdata)
 {
 	char *saveptr = NULL;
-	ssize_t read_bytes;
-	char *line = NULL;
-	size_t len = 0;
-	char *token;
-	int ret = 0;
+	char *key, *token;
+	char *equal;
+	int ret;
 
-	read_bytes = getline(&line, &len, fp);
-	if (read_bytes == -1) {
-		ret = ECGEOF;
-		goto out_free;
-	}
+	key = strtok_r(line, " \t", &saveptr);
+	if (!key)
+		return 0;
 
-	token = strtok_r(line, " ", &saveptr);
-	if (!token) {
-		ret = ECGINVAL;
-		goto out_free;
-	}
-	strncpy(cgroup_stat->name, token, FILENAME_MAX - 1);
+	token = strtok_r(NULL, " \t", &saveptr);
+	if (!token)
+		return callback(key, NULL, "", userdata);
 
-	token = strtok_r(NULL, " ", &saveptr);
-	if (!token) {
-		ret = ECGINVAL;
-		goto out_free;
-	}
-	strncpy(cgroup_stat->value, token, CG_VALUE_MAX - 1);
+	do {
+		equal = strchr(token, '=');
+		if (equal) {
+			*equal = '\0';
+			ret = callback(key, token, equal + 1, userdata);
+		} else {
+			ret = callback(key, NULL, token, userdata);
+		}
+		if (ret)
+			return ret;
+	} while ((token = strtok_r(NULL, " \t", &saveptr)) != NULL);
 
-out_free:
-	free(line);
+	return 0;
+}
+
+int cg_parse_keyed_buf(char *buf, size_t len, cgroup_stat_callback callback, void *userdata)
+{
+	char *line = buf, *end = buf + len;
+	char *newline;
+	int ret = 0;
+
+	while (!ret && line < end) {
+		/* The last line may have no \n, there is room for the \0 */
+		newline = memchr(line, '\n', end - line);
+		if (!newline)
+			newline = end;
+
+		*newline = '\0';
+		ret = cg_parse_keyed_line(line, callback, userdata);
+		line = newline + 1;
+	}
 
 	return ret;
 }
 
-int cgroup_read_value_end(void **handle)
+int cg_read_keyed_file(const char * const path, cgroup_stat_callback callback, void *userdata)
 {
-	FILE *fp;
+	char stack_buf[CG_KEYED_BUF_SIZE];
+	size_t size = sizeof(stack_buf);
+	char *buf = stack_buf;
+	char *line, *newline;
+	size_t len = 0;
+	char *new_buf;
+	ssize_t rd;
+	int ret = 0;
+	int fd;
+
+	fd = cg_dirfd_open(path, O_RDONLY);
+	if (fd < 0) {
+		last_errno = errno;
+		return ECGROUPVALUENOTEXIST;
+	}
+
+	while (!ret) {
+		/* The pending line fills the buffer, only then the heap is used */
+		if (len == size - 1) {
+			if (buf == stack_buf) {
+				new_buf = malloc(size * 2);
+				if (new_buf)
+					memcpy(new_buf, buf, len);
+			} else {
+				new_buf = realloc(buf, size * 2);
+			}
+			if (!new_buf) {
+				last_errno = errno;
+				ret = ECGOTHER;
+				break;
+			}
+			buf = new_buf;
+			size *= 2;
+		}
+
+		rd = read(fd, buf + len, size - 1 - len);
+		if (rd < 0 && errno == EINTR)
+			continue;
+		if (rd < 0) {
+			last_errno = errno;
+			ret = ECGOTHER;
+			break;
+		}
+		if (rd == 0) {
+			/* The last line has no \n */
+			if (len > 0) {
+				buf[len] = '\0';
+				ret = cg_parse_keyed_line(buf, callback, userdata);
+			}
+			break;
+		}
+		len += rd;
 
-	if (!cgroup_initialized)
-		return ECGROUPNOTINITIALIZED;
+		line = buf;
+		while (!ret && (newline = memchr(line, '\n', buf + len - line)) != NULL) {
+			*newline = '\0';
+			ret = cg_parse_keyed_line(line, callback, userdata);
+			line = newline + 1;
+		}
 
-	if (!handle)
-		return ECGINVAL;
+		len -= line - buf;
+		memmove(buf, line, len);
+	}
 
-	fp = (FILE *)*handle;
-	fclose(fp);
-	*handle = NULL;
+	if (buf != stack_buf)
+		free(buf);
+	close(fd);
 
-	return 0;
+	return ret;
 }
 
-int cgroup_read_value_next(void **handle, char *buffer, int max)
+/**
+ * Build the path of a stats file, name defaults to the stats file of the
+ * controller.
+ * @param stat_file Buffer of CG_STAT_PATH_MAX characters
+ */
+static int cg_build_stat_path(const char * const controller, const char * const path,
+			      const char * const name, char * const stat_file)
 {
-	char *ret_c;
-	int ret = 0;
-	FILE *fp;
-
-	if (!cgroup_initialized)
-		return ECGROUPNOTINITIALIZED;
+	char stat_path[FILENAME_MAX];
 
-	if (!buffer || !handle)
-		return ECGINVAL;
+	if (!cg_build_path(path, stat_path, controller))
+		return ECGOTHER;
 
-	fp = (FILE *)*handle;
-	ret_c = fgets(buffer, max, fp);
-	if (ret_c == NULL)
-		ret = ECGEOF;
+	if (name)
+		snprintf(stat_file, CG_STAT_PATH_MAX, "%s/%s", stat_path, name);
+	else
+		snprintf(stat_file, CG_STAT_PATH_MAX, "%s/%s.stat", stat_path, controller);
 
-	return ret;
+	return 0;
 }
 
-int cgroup_read_value_begin(const char * const controller, const char *path,
-			    const char * const name, void **handle, char *buffer, int max)
+int cgroup_read_stats_foreach(const char *controller, const char *path, const char *name,
+			      cgroup_stat_callback callback, void *userdata)
 {
-	char stat_file[FILENAME_MAX + sizeof(name)];
-	char stat_path[FILENAME_MAX];
-	char *ret_c = NULL;
-	int ret = 0;
-	FILE *fp;
+	char stat_file[CG_STAT_PATH_MAX];
+	int ret;
 
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
 
-	if (!buffer || !handle)
+	if (!controller || !path || !callback)
 		return ECGINVAL;
 
-	if (!cg_build_path(path, stat_path, controller))
-		return ECGOTHER;
-
-	snprintf(stat_file, sizeof(stat_file), "%s/%s", stat_path,
-		 name);
-	fp = fopen(stat_file, "re");
-	if (!fp) {
-		cgroup_warn("fopen failed\n");
-		last_errno = errno;
-		*handle = NULL;
-		return ECGOTHER;
-	}
-
-	ret_c = fgets(buffer, max, fp);
-	if (ret_c == NULL)
-		ret = ECGEOF;
-
-	*handle = fp;
+	ret = cg_build_stat_path(controller, path, name, stat_file);
+	if (ret)
+		return ret;
 
-	return ret;
+	return cg_read_keyed_file(stat_file, callback, userdata);
 }
 
-int cgroup_read_stats_end(void **handle)
+int cgroup_read_stats_map(const char *controller, const char *path, const char *name,
+			  const struct cgroup_stat_map *map, u_int64_t *values)
 {
-	FILE *fp;
+	char stat_file[CG_STAT_PATH_MAX];
+	int ret;
 
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
 
-	if (!handle)
-		return ECGINVAL;
-
-	fp = (FILE *)*handle;
-	if (fp == NULL)
+	if (!controller || !path || !map || !values)
 		return ECGINVAL;
 
-	fclose(fp);
+	ret = cg_build_stat_path(controller, path, name, stat_file);
+	if (ret)
+		return ret;
 
-	return 0;
+	return cg_stat_map_read(stat_file, map, values);
 }
 
-int cgroup_read_stats_next(void **handle, struct cgroup_stat *cgroup_stat)
+int cgroup_monitor_add_events(struct cgroup_monitor *monitor, const char *controller,
+			      const char *path, const char *file, cgroup_monitor_callback callback,
+			      void *userdata, int *watch)
 {
-	FILE *fp;
-	int ret = 0;
+	char file_path[CG_STAT_PATH_MAX];
+	int ret;
 
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
 
-	if (!handle || !cgroup_stat)
+	if (!monitor || !controller || !path || !file || !callback || !watch)
 		return ECGINVAL;
 
-	fp = (FILE *)*handle;
-	ret = cg_read_stat(fp, cgroup_stat);
-	*handle = fp;
+	ret = cg_build_stat_path(controller, path, file, file_path);
+	if (ret)
+		return ret;
 
-	return ret;
+	return cg_monitor_add(monitor, file_path, NULL, callback, userdata, watch);
 }
 
-/* TODO: Need to decide a better place to put this function. */
-int cgroup_read_stats_begin(const char *controller, const char *path, void **handle,
-			    struct cgroup_stat *cgroup_stat)
+int cgroup_monitor_add_pressure(struct cgroup_monitor *monitor, const char *controller,
+				const char *path, const char *file, const char *trigger,
+				cgroup_monitor_callback callback, void *userdata, int *watch)
 {
-	char stat_file[FILENAME_MAX + sizeof(".stat")];
-	char stat_path[FILENAME_MAX];
-	int ret = 0;
-	FILE *fp;
+	char file_path[CG_STAT_PATH_MAX];
+	int ret;
 
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
 
-	if (!cgroup_stat || !handle)
-		return ECGINVAL;
-
-	if (!cg_build_path(path, stat_path, controller))
-		return ECGOTHER;
-
-	snprintf(stat_file, sizeof(stat_file), "%s/%s.stat", stat_path, controller);
-
-	fp = fopen(stat_file, "re");
-	if (!fp) {
-		cgroup_warn("fopen failed\n");
+	if (!monitor || !controller || !path || !file || !trigger || !callback || !watch)
 		return ECGINVAL;
-	}
 
-	ret = cg_read_stat(fp, cgroup_stat);
-	*handle = fp;
+	ret = cg_build_stat_path(controller, path, file, file_path);
+	if (ret)
+		return ret;
 
-	return ret;
+	return cg_monitor_add(monitor, file_path, trigger, callback, userdata, watch);
 }
 
 int cgroup_get_task_end(void **handle)
@@ -5431,73 +9146,308 @@ int cgroup_get_task_begin(const char *cgroup, const char *controller, void **han
 	return ret;
 }
 
-int cgroup_get_controller_end(void **handle)
+/*
+ * Immutable snapshot of the controllers, shared by the iterators. It is
+ * built again when the mounts change or cgroup_init() reads them again, the
+ * iterators keep walking the snapshot they started with.
+ */
+struct cg_controllers {
+	unsigned long mounts_gen;
+	unsigned long table_gen;
+	int refs;
+	/* Mounted controllers, without the "cgroup" pseudo-controller */
+	struct cgroup_mount_point *mounts;
+	int mounts_cnt;
+	/* All the controllers, /proc/cgroups then the cgroup v2 ones missing there */
+	struct controller_data *all;
+	int all_cnt;
+	/* Why there is no controller in all */
+	int all_err;
+};
+
+struct cg_controllers_iter {
+	struct cg_controllers *ctrls;
+	int pos;
+};
+
+static void cg_controllers_put(struct cg_controllers *ctrls)
 {
-	int *pos = (int *) *handle;
+	if (!ctrls || __atomic_sub_fetch(&ctrls->refs, 1, __ATOMIC_ACQ_REL))
+		return;
 
-	if (!cgroup_initialized)
-		return ECGROUPNOTINITIALIZED;
+	free(ctrls->mounts);
+	free(ctrls->all);
+	free(ctrls);
+}
 
-	if (!pos)
-		return ECGINVAL;
+static int cg_controllers_add(struct cg_controllers * const ctrls, int * const alloc,
+			      const char * const name, int hierarchy, int num_cgroups, int enabled)
+{
+	struct controller_data *all, *info;
 
-	free(pos);
-	*handle = NULL;
+	if (ctrls->all_cnt == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 16;
+		all = realloc(ctrls->all, *alloc * sizeof(struct controller_data));
+		if (!all) {
+			last_errno = errno;
+			return ECGOTHER;
+		}
+		ctrls->all = all;
+	}
+
+	info = &ctrls->all[ctrls->all_cnt++];
+	snprintf(info->name, sizeof(info->name), "%s", name);
+	info->hierarchy = hierarchy;
+	info->num_cgroups = num_cgroups;
+	info->enabled = enabled;
 
 	return 0;
 }
 
-int cgroup_get_controller_next(void **handle, struct cgroup_mount_point *info)
+/* Read /proc/cgroups into ctrls->all */
+static int cg_controllers_read_proc(struct cg_controllers * const ctrls, int * const alloc)
 {
-	int *pos = (int *) *handle;
+	int hierarchy, num_cgroups, enabled;
+	char subsys_name[FILENAME_MAX];
+	char buf[FILENAME_MAX];
+	FILE *proc_cgroup;
 	int ret = 0;
 
-	if (!cgroup_initialized)
-		return ECGROUPNOTINITIALIZED;
+	proc_cgroup = fopen("/proc/cgroups", "re");
+	if (!proc_cgroup) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
 
-	if (!pos)
-		return ECGINVAL;
+	if (!fgets(buf, FILENAME_MAX, proc_cgroup)) {
+		last_errno = errno;
+		fclose(proc_cgroup);
+		return ECGOTHER;
+	}
 
-	if (!info)
-		return ECGINVAL;
+	/*
+	 * check Linux Kernel sources/kernel/cgroup/cgroup.c cgroup_init_early(),
+	 * MAX_CGROUP_TYPE_NAMELEN check for details on why 32 is used.
+	 */
+	while (!ret && fscanf(proc_cgroup, "%32s %d %d %d\n", subsys_name, &hierarchy,
+			      &num_cgroups, &enabled) == 4)
+		ret = cg_controllers_add(ctrls, alloc, subsys_name, hierarchy, num_cgroups,
+					 enabled);
+
+	fclose(proc_cgroup);
+
+	return ret;
+}
+
+/*
+ * Add the controllers of the cgroup v2 root missing in /proc/cgroups, called
+ * with cg_mount_table_lock held.
+ */
+static int cg_controllers_read_v2(struct cg_controllers * const ctrls, int * const alloc)
+{
+	char path[FILENAME_MAX], name[CONTROL_NAMELEN_MAX];
+	int ret = 0, cnt, i;
+	FILE *fp;
+
+	if (cg_cgroup_v2_mount_path[0] == '\0')
+		return 0;
+
+	if (snprintf(path, sizeof(path), "%s/%s", cg_cgroup_v2_mount_path,
+		     CGV2_CONTROLLERS_FILE) >= (int)sizeof(path))
+		return 0;
+
+	fp = fopen(path, "re");
+	if (!fp)
+		return 0;
+
+	cnt = ctrls->all_cnt;
+	while (!ret && fscanf(fp, "%31s", name) == 1) {
+		for (i = 0; i < cnt; i++) {
+			if (strcmp(ctrls->all[i].name, name) == 0)
+				break;
+		}
+
+		if (i == cnt)
+			ret = cg_controllers_add(ctrls, alloc, name, 0, 0, 1);
+	}
+
+	fclose(fp);
+
+	return ret;
+}
+
+static struct cg_controllers *cg_controllers_build(void)
+{
+	struct cgroup_mount_point *info;
+	struct cg_controllers *ctrls;
+	int alloc = 0, i, ret;
+
+	ctrls = calloc(1, sizeof(struct cg_controllers));
+	if (!ctrls) {
+		last_errno = errno;
+		return NULL;
+	}
+	ctrls->refs = 1;
+
+	ctrls->all_err = cg_controllers_read_proc(ctrls, &alloc);
+	if (ctrls->all_err && ctrls->all_cnt)
+		goto err;
 
 	pthread_rwlock_rdlock(&cg_mount_table_lock);
 
-	if (cg_mount_table[*pos].name[0] == '\0') {
-		ret = ECGEOF;
-		goto out_unlock;
+	ret = cg_controllers_read_v2(ctrls, &alloc);
+	if (ret)
+		goto err_unlock;
+	if (ctrls->all_cnt)
+		ctrls->all_err = 0;
+
+	for (i = 0; i < CG_CONTROLLER_MAX && cg_mount_table[i].name[0] != '\0'; i++)
+		;
+
+	if (i) {
+		ctrls->mounts = malloc(i * sizeof(struct cgroup_mount_point));
+		if (!ctrls->mounts) {
+			last_errno = errno;
+			goto err_unlock;
+		}
 	}
 
-	if (strncmp(cg_mount_table[*pos].name, CGROUP_FILE_PREFIX, CONTROL_NAMELEN_MAX) == 0)
+	for (i = 0; i < CG_CONTROLLER_MAX && cg_mount_table[i].name[0] != '\0'; i++) {
 		/*
 		 * For now, hide the "cgroup" pseudo-controller from the user.  This may be
 		 * worth revisiting in the future.
 		 */
-		(*pos)++;
+		if (strncmp(cg_mount_table[i].name, CGROUP_FILE_PREFIX, CONTROL_NAMELEN_MAX) == 0)
+			continue;
 
-	if (cg_mount_table[*pos].name[0] == '\0') {
-		ret = ECGEOF;
-		goto out_unlock;
-	}
+		info = &ctrls->mounts[ctrls->mounts_cnt++];
+
+		strncpy(info->name, cg_mount_table[i].name, FILENAME_MAX - 1);
+		info->name[FILENAME_MAX - 1] = '\0';
 
-	strncpy(info->name, cg_mount_table[*pos].name, FILENAME_MAX - 1);
-	info->name[FILENAME_MAX - 1] = '\0';
+		strncpy(info->path, cg_mount_table[i].mount.path, FILENAME_MAX - 1);
+		info->path[FILENAME_MAX - 1] = '\0';
+	}
 
-	strncpy(info->path, cg_mount_table[*pos].mount.path, FILENAME_MAX - 1);
-	info->path[FILENAME_MAX - 1] = '\0';
+	pthread_rwlock_unlock(&cg_mount_table_lock);
 
-	(*pos)++;
-	*handle = pos;
+	return ctrls;
 
-out_unlock:
+err_unlock:
 	pthread_rwlock_unlock(&cg_mount_table_lock);
+err:
+	cg_controllers_put(ctrls);
 
-	return ret;
+	return NULL;
+}
+
+/**
+ * Get a reference to the snapshot of the controllers, built again if the
+ * mounts changed since.
+ * @return The snapshot, to be released with cg_controllers_put(), NULL on error
+ */
+static struct cg_controllers *cg_controllers_get(void)
+{
+	struct cgroup_ctx *ctx = cg_ctx();
+	unsigned long mounts_gen, table_gen;
+	struct cg_controllers *ctrls;
+
+	/* Read before the snapshot, a change while it is built is seen next time */
+	mounts_gen = cg_mounts_gen();
+	table_gen = __atomic_load_n(&ctx->mount_table_gen, __ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&ctx->controllers_lock);
+
+	if (!ctx->controllers || ctx->controllers->mounts_gen != mounts_gen ||
+	    ctx->controllers->table_gen != table_gen) {
+		ctrls = cg_controllers_build();
+		if (!ctrls) {
+			pthread_mutex_unlock(&ctx->controllers_lock);
+			return NULL;
+		}
+
+		ctrls->mounts_gen = mounts_gen;
+		ctrls->table_gen = table_gen;
+		cg_controllers_put(ctx->controllers);
+		ctx->controllers = ctrls;
+	}
+
+	ctrls = ctx->controllers;
+	__atomic_add_fetch(&ctrls->refs, 1, __ATOMIC_RELAXED);
+
+	pthread_mutex_unlock(&ctx->controllers_lock);
+
+	return ctrls;
+}
+
+static int cg_controllers_iter_begin(void **handle)
+{
+	struct cg_controllers_iter *iter;
+
+	iter = calloc(1, sizeof(struct cg_controllers_iter));
+	if (!iter) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	iter->ctrls = cg_controllers_get();
+	if (!iter->ctrls) {
+		free(iter);
+		return ECGOTHER;
+	}
+
+	*handle = iter;
+
+	return 0;
+}
+
+static int cg_controllers_iter_end(void **handle)
+{
+	struct cg_controllers_iter *iter = *handle;
+
+	if (!iter)
+		return ECGINVAL;
+
+	cg_controllers_put(iter->ctrls);
+	free(iter);
+	*handle = NULL;
+
+	return 0;
+}
+
+int cgroup_get_controller_end(void **handle)
+{
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	return cg_controllers_iter_end(handle);
+}
+
+int cgroup_get_controller_next(void **handle, struct cgroup_mount_point *info)
+{
+	struct cg_controllers_iter *iter = *handle;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!iter)
+		return ECGINVAL;
+
+	if (!info)
+		return ECGINVAL;
+
+	if (iter->pos >= iter->ctrls->mounts_cnt)
+		return ECGEOF;
+
+	memcpy(info, &iter->ctrls->mounts[iter->pos], sizeof(struct cgroup_mount_point));
+	iter->pos++;
+
+	return 0;
 }
 
 int cgroup_get_controller_begin(void **handle, struct cgroup_mount_point *info)
 {
-	int *pos;
+	int ret;
 
 	if (!cgroup_initialized)
 		return ECGROUPNOTINITIALIZED;
@@ -5505,63 +9455,112 @@ int cgroup_get_controller_begin(void **handle, struct cgroup_mount_point *info)
 	if (!info)
 		return ECGINVAL;
 
-	pos = malloc(sizeof(int));
+	ret = cg_controllers_iter_begin(handle);
+	if (ret)
+		return ret;
 
-	if (!pos) {
-		last_errno = errno;
-		return ECGOTHER;
-	}
+	return cgroup_get_controller_next(handle, info);
+}
 
-	*pos = 0;
+/*
+ * Per-thread buffer for /proc/<pid>/status. The Name, Uid and Gid lines
+ * are within the first few hundred bytes, one read() gets all of them.
+ */
+static __thread char proc_status_buf[CG_PROC_STATUS_LEN];
 
-	*handle = pos;
+/**
+ * Parse the effective id, the second of the four ids of an Uid: or Gid:
+ * line of /proc/<pid>/status.
+ * @param line: The line, past the "Uid:" or "Gid:" tag
+ * @param id: The effective id
+ * @return 0 on success, ECGFAIL if the line is malformed.
+ */
+static int cg_parse_proc_status_ids(const char *line, unsigned long *id)
+{
+	unsigned long ids[4];
+	char *end;
+	int i;
 
-	return cgroup_get_controller_next(handle, info);
+	for (i = 0; i < 4; i++) {
+		ids[i] = strtoul(line, &end, 10);
+		if (end == line)
+			return ECGFAIL;
+		line = end;
+	}
+
+	cgroup_dbg("Scanned proc values are %lu %lu %lu %lu\n", ids[0], ids[1], ids[2], ids[3]);
+	*id = ids[1];
+
+	return 0;
 }
 
 /**
- * Get process data (euid and egid) from /proc/<pid>/status file.
+ * Read /proc/<pid>/status with a single open() and read() and parse the
+ * fields the caller asked for. The parsing stops as soon as they are found.
  * @param pid: The process id
- * @param euid: The uid of param pid
- * @param egid: The gid of param pid
+ * @param euid: The uid of param pid, NULL if not needed
+ * @param egid: The gid of param pid, NULL if not needed
+ * @param procname_status: The process name, allocated, NULL if not needed
  * @return 0 on success, > 0 on error.
  */
-int cgroup_get_uid_gid_from_procfs(pid_t pid, uid_t *euid, gid_t *egid)
+STATIC int cg_read_proc_status(pid_t pid, uid_t *euid, gid_t *egid, char **procname_status)
 {
+	bool need_euid = euid != NULL;
+	bool need_egid = egid != NULL;
+	bool need_name = procname_status != NULL;
 	char path[FILENAME_MAX];
-	uid_t ruid, suid, fsuid;
-	gid_t rgid, sgid, fsgid;
-	bool found_euid = false;
-	bool found_egid = false;
-	char buf[4092];
-	FILE *f;
+	char *line, *eol;
+	unsigned long id;
+	ssize_t len;
+	int fd;
 
-	sprintf(path, "/proc/%d/status", pid);
-	f = fopen(path, "re");
-	if (!f)
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
 		return ECGROUPNOTEXIST;
 
-	while (fgets(buf, sizeof(buf), f)) {
-		if (!strncmp(buf, "Uid:", 4)) {
-			if (sscanf((buf + strlen("Uid:") + 1), "%d%d%d%d",
-				    &ruid, euid, &suid, &fsuid) != 4)
+	do {
+		len = read(fd, proc_status_buf, sizeof(proc_status_buf) - 1);
+	} while (len < 0 && errno == EINTR);
+	close(fd);
+
+	/* The process exited between open() and read() */
+	if (len < 0)
+		return ECGROUPNOTEXIST;
+	proc_status_buf[len] = '\0';
+
+	for (line = proc_status_buf; *line && (need_euid || need_egid || need_name);
+	     line = eol + 1) {
+		eol = strchr(line, '\n');
+		if (!eol)
+			break;
+		*eol = '\0';
+
+		if (need_name && !strncmp(line, "Name:", 5)) {
+			*procname_status = strdup(line + strlen("Name:") + 1);
+			if (*procname_status == NULL) {
+				last_errno = errno;
+				return ECGOTHER;
+			}
+			need_name = false;
+		} else if (need_euid && !strncmp(line, "Uid:", 4)) {
+			if (cg_parse_proc_status_ids(line + strlen("Uid:"), &id))
 				break;
-			cgroup_dbg("Scanned proc values are %d %d %d %d\n",
-				   ruid, *euid, suid, fsuid);
-			found_euid = true;
-		} else if (!strncmp(buf, "Gid:", 4)) {
-			if (sscanf((buf + strlen("Gid:") + 1), "%d%d%d%d",
-				   &rgid, egid, &sgid, &fsgid) != 4)
+			*euid = id;
+			need_euid = false;
+		} else if (need_egid && !strncmp(line, "Gid:", 4)) {
+			if (cg_parse_proc_status_ids(line + strlen("Gid:"), &id))
 				break;
-			cgroup_dbg("Scanned proc values are %d %d %d %d\n",
-				   rgid, *egid, sgid, fsgid);
-			found_egid = true;
+			*egid = id;
+			need_egid = false;
 		}
-		if (found_euid && found_egid)
-			break;
 	}
-	fclose(f);
-	if (!found_euid || !found_egid) {
+
+	if (need_euid || need_egid || need_name) {
+		if (procname_status && !need_name) {
+			free(*procname_status);
+			*procname_status = NULL;
+		}
 		/*
 		 * This method doesn't match the file format of
 		 * /proc/<pid>/status. The format has been changed and we
@@ -5570,9 +9569,22 @@ int cgroup_get_uid_gid_from_procfs(pid_t pid, uid_t *euid, gid_t *egid)
 		cgroup_warn("invalid file format of /proc/%d/status\n", pid);
 		return ECGFAIL;
 	}
+
 	return 0;
 }
 
+/**
+ * Get process data (euid and egid) from /proc/<pid>/status file.
+ * @param pid: The process id
+ * @param euid: The uid of param pid
+ * @param egid: The gid of param pid
+ * @return 0 on success, > 0 on error.
+ */
+int cgroup_get_uid_gid_from_procfs(pid_t pid, uid_t *euid, gid_t *egid)
+{
+	return cg_read_proc_status(pid, euid, egid, NULL);
+}
+
 /**
  * Given a pid, this function will return the controllers and cgroups that
  * the pid is a member of. The caller is expected to allocate the
@@ -5670,44 +9682,6 @@ STATIC int cg_get_cgroups_from_proc_cgroups(pid_t pid, char *cgroup_list[],
 	return ret;
 }
 
-/**
- * Get process name from /proc/<pid>/status file.
- * @param pid: The process id
- * @param pname_status : The process name
- * @return 0 on success, > 0 on error.
- */
-static int cg_get_procname_from_proc_status(pid_t pid, char **procname_status)
-{
-	char path[FILENAME_MAX];
-	int ret = ECGFAIL;
-	char buf[4092];
-	FILE *f;
-	int len;
-
-	sprintf(path, "/proc/%d/status", pid);
-	f = fopen(path, "re");
-	if (!f)
-		return ECGROUPNOTEXIST;
-
-	while (fgets(buf, sizeof(buf), f)) {
-		if (!strncmp(buf, "Name:", 5)) {
-			len = strlen(buf);
-			if (buf[len - 1] == '\n')
-				buf[len - 1] = '\0';
-			*procname_status = strdup(buf + strlen("Name:") + 1);
-			if (*procname_status == NULL) {
-				last_errno = errno;
-				ret = ECGOTHER;
-				break;
-			}
-			ret = 0;
-			break;
-		}
-	}
-	fclose(f);
-	return ret;
-}
-
 /**
  * Get process name from /proc/<pid>/cmdline file.
  * This function is mainly for getting a script name (shell, perl, etc).
@@ -5801,25 +9775,21 @@ static int cg_get_procname_from_proc_cmdline(pid_t pid, const char *pname_status
 }
 
 /**
- * Get a process name from /proc file system.
- * This function allocates memory for a process name, writes a process
- * name onto it. So a caller should free the memory when unusing it.
+ * Resolve the full process name from the name in /proc/<pid>/status,
+ * the /proc/<pid>/exe link and, for scripts, /proc/<pid>/cmdline.
  * @param pid: The process id
+ * @param pname_status: The process name taken from /proc/<pid>/status,
+ *	it is consumed by this function
  * @param procname: The process name
  * @return 0 on success, > 0 on error.
  */
-int cgroup_get_procname_from_procfs(pid_t pid, char **procname)
+static int cg_resolve_procname(pid_t pid, char *pname_status, char **procname)
 {
 	char path[FILENAME_MAX];
 	char buf[FILENAME_MAX];
 	char *pname_cmdline;
-	char *pname_status;
 	int ret;
 
-	ret = cg_get_procname_from_proc_status(pid, &pname_status);
-	if (ret)
-		return ret;
-
 	/* Get the full patch of process name from /proc/<pid>/exe. */
 	memset(buf, '\0', sizeof(buf));
 	snprintf(path, FILENAME_MAX, "/proc/%d/exe", pid);
@@ -5862,61 +9832,452 @@ int cgroup_get_procname_from_procfs(pid_t pid, char **procname)
 		return 0;
 	}
 
-	/*
-	 * The above strncmp() is not 0 also if executing a symbolic link,
-	 * /proc/pid/exe points to real executable name then. Return it as
-	 * the last resort.
-	 */
-	free(pname_status);
-	*procname = strdup(buf);
-	if (*procname == NULL) {
-		last_errno = errno;
-		return ECGOTHER;
+	/*
+	 * The above strncmp() is not 0 also if executing a symbolic link,
+	 * /proc/pid/exe points to real executable name then. Return it as
+	 * the last resort.
+	 */
+	free(pname_status);
+	*procname = strdup(buf);
+	if (*procname == NULL) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	return 0;
+}
+
+/**
+ * Get a process name from /proc file system.
+ * This function allocates memory for a process name, writes a process
+ * name onto it. So a caller should free the memory when unusing it.
+ * @param pid: The process id
+ * @param procname: The process name
+ * @return 0 on success, > 0 on error.
+ */
+int cgroup_get_procname_from_procfs(pid_t pid, char **procname)
+{
+	char *pname_status;
+	int ret;
+
+	ret = cg_read_proc_status(pid, NULL, NULL, &pname_status);
+	if (ret)
+		return ret;
+
+	return cg_resolve_procname(pid, pname_status, procname);
+}
+
+/**
+ * Get the euid, the egid and the process name of a process, reading
+ * /proc/<pid>/status only once.
+ * The caller should free the process name when unusing it.
+ * @param pid: The process id
+ * @param euid: The uid of param pid
+ * @param egid: The gid of param pid
+ * @param procname: The process name
+ * @return 0 on success, > 0 on error.
+ */
+int cgroup_get_proc_info_from_procfs(pid_t pid, uid_t *euid, gid_t *egid, char **procname)
+{
+	char *pname_status;
+	int ret;
+
+	ret = cg_read_proc_status(pid, euid, egid, &pname_status);
+	if (ret)
+		return ret;
+
+	return cg_resolve_procname(pid, pname_status, procname);
+}
+
+/* Number of requests sent to cgrulesengd before reading their replies */
+#define CGRULE_REQUEST_CHUNK	256
+
+/*
+ * Connection to cgrulesengd, kept open by the process cgred_owner.  The
+ * device and inode of the socket tell whether the descriptor is still ours,
+ * the application may have closed it and opened another file under its number.
+ */
+static int cgred_sk = -1;
+static pid_t cgred_owner;
+static dev_t cgred_dev;
+static ino_t cgred_ino;
+static pthread_mutex_t cgred_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * Open a connection to cgrulesengd.
+ * @return The socket, -1 if the daemon does not run
+ */
+static int cg_cgred_open(void)
+{
+	struct sockaddr_un addr;
+	int sk;
+
+	sk = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sk < 0)
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, CGRULE_CGRED_SOCKET_PATH);
+
+	if (connect(sk, (struct sockaddr *)&addr,
+	    sizeof(addr.sun_family) + strlen(CGRULE_CGRED_SOCKET_PATH)) < 0) {
+		close(sk);
+		return -1;
+	}
+
+	return sk;
+}
+
+/**
+ * Connect to cgrulesengd, and check that it takes batches.
+ * @return 0 on success, -1 if the daemon does not run, 1 on error, 2 if the
+ * daemon only takes one request per connection
+ */
+static int cg_cgred_connect(void)
+{
+	struct cgrule_request hello = {
+		.pid = 0,
+		.flags = CGRULE_REQUEST_HELLO,
+	};
+	struct stat st;
+	char version;
+	ssize_t len;
+	int sk;
+
+	sk = cg_cgred_open();
+	if (sk < 0)
+		return -1;
+
+	if (send(sk, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello))
+		goto err;
+
+	do {
+		len = recv(sk, &version, sizeof(version), 0);
+	} while (len < 0 && errno == EINTR);
+
+	/* An older daemon drops the connection */
+	if (len == 0 || (len == 1 && version < CGRULE_PROTOCOL_VERSION)) {
+		close(sk);
+		return 2;
+	}
+	if (len != 1 || fstat(sk, &st) < 0)
+		goto err;
+
+	cgred_sk = sk;
+	cgred_owner = getpid();
+	cgred_dev = st.st_dev;
+	cgred_ino = st.st_ino;
+
+	return 0;
+
+err:
+	close(sk);
+
+	return 1;
+}
+
+/**
+ * Check that the cached connection to cgrulesengd is still ours.  A
+ * descriptor which is not is forgotten, not closed, it belongs to the
+ * application now.
+ */
+static void cg_cgred_validate(void)
+{
+	struct stat st;
+
+	if (cgred_sk < 0)
+		return;
+
+	/* A child must not talk on the connection of its parent */
+	if (cgred_owner != getpid()) {
+		close(cgred_sk);
+		cgred_sk = -1;
+		return;
+	}
+
+	if (fstat(cgred_sk, &st) < 0 || !S_ISSOCK(st.st_mode) || st.st_dev != cgred_dev ||
+	    st.st_ino != cgred_ino)
+		cgred_sk = -1;
+}
+
+/**
+ * Register a process to a daemon which takes one request per connection,
+ * answered by CGRULE_SUCCESS_STORE_PID on success only.
+ * @return 0 on success, 1 on error
+ */
+static int cg_cgred_register_single(pid_t pid, int flags)
+{
+	char buff[sizeof(CGRULE_SUCCESS_STORE_PID)];
+	struct cgrule_request req = {
+		.pid = pid,
+		.flags = flags,
+	};
+	int ret = 1;
+	int sk;
+
+	sk = cg_cgred_open();
+	if (sk < 0) {
+		/* If the daemon does not work, this function returns 0 as success. */
+		return 0;
+	}
+
+	if (send(sk, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+		goto close;
+
+	if (recv(sk, buff, sizeof(buff), MSG_WAITALL) != sizeof(buff))
+		goto close;
+
+	if (strncmp(buff, CGRULE_SUCCESS_STORE_PID, sizeof(buff)))
+		goto close;
+
+	ret = 0;
+close:
+	close(sk);
+
+	return ret;
+}
+
+/**
+ * Send a batch of requests to cgrulesengd and read their status.  The
+ * requests are written while the replies are read, so neither side blocks
+ * on a full socket.
+ * @param pids The processes
+ * @param count Number of processes
+ * @param flags The flags of the requests
+ * @param failed Incremented for each request the daemon failed
+ * @return 0 on success, 1 if the connection failed
+ */
+static int cg_cgred_exchange(const pid_t *pids, int count, int flags, int *failed)
+{
+	struct cgrule_request reqs[CGRULE_REQUEST_CHUNK];
+	char status[CGRULE_REQUEST_CHUNK];
+	size_t chunk_off = 0, chunk_len = 0;
+	struct pollfd pfd;
+	int next = 0, replied = 0;
+	ssize_t len;
+	int i, n;
+
+	pfd.fd = cgred_sk;
+
+	while (replied < count) {
+		if (chunk_off == chunk_len && next < count) {
+			n = min(count - next, CGRULE_REQUEST_CHUNK);
+			for (i = 0; i < n; i++) {
+				reqs[i].pid = pids[next + i];
+				reqs[i].flags = flags | CGRULE_REQUEST_BATCH;
+			}
+			next += n;
+			chunk_off = 0;
+			chunk_len = n * sizeof(struct cgrule_request);
+		}
+
+		pfd.events = POLLIN;
+		if (chunk_off < chunk_len)
+			pfd.events |= POLLOUT;
+
+		if (poll(&pfd, 1, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			return 1;
+		}
+
+		if (pfd.revents & POLLOUT) {
+			len = send(cgred_sk, (char *)reqs + chunk_off, chunk_len - chunk_off,
+				   MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (len < 0 && errno != EAGAIN && errno != EINTR)
+				return 1;
+			if (len > 0)
+				chunk_off += len;
+		}
+
+		if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+			len = recv(cgred_sk, status, sizeof(status), MSG_DONTWAIT);
+			if (len == 0)
+				return 1;
+			if (len < 0) {
+				if (errno != EAGAIN && errno != EINTR)
+					return 1;
+				continue;
+			}
+
+			for (i = 0; i < len; i++)
+				*failed += status[i] != 0;
+			replied += len;
+		}
+	}
+
+	return 0;
+}
+
+int cgroup_register_unchanged_processes(const pid_t *pids, int count, int flags)
+{
+	int retried = 0;
+	int failed = 0;
+	int ret = 0;
+	int i;
+
+	if (!pids || count < 0)
+		return 1;
+
+	if (!count)
+		return 0;
+
+	pthread_mutex_lock(&cgred_lock);
+
+	cg_cgred_validate();
+
+retry:
+	if (cgred_sk < 0) {
+		ret = cg_cgred_connect();
+		if (ret == 2) {
+			for (i = 0; i < count; i++)
+				failed += cg_cgred_register_single(pids[i], flags);
+			goto done;
+		}
+		if (ret) {
+			/* If the daemon does not work, this function returns 0 as success. */
+			if (ret < 0)
+				ret = 0;
+			goto unlock;
+		}
+	}
+
+	if (cg_cgred_exchange(pids, count, flags, &failed)) {
+		close(cgred_sk);
+		cgred_sk = -1;
+
+		/* The daemon may have been restarted since the connection was opened */
+		if (!retried) {
+			retried = 1;
+			failed = 0;
+			goto retry;
+		}
+		ret = 1;
+		goto unlock;
 	}
 
-	return 0;
+done:
+	ret = failed ? 1 : 0;
+unlock:
+	pthread_mutex_unlock(&cgred_lock);
+
+	return ret;
 }
 
 int cgroup_register_unchanged_process(pid_t pid, int flags)
 {
-	char buff[sizeof(CGRULE_SUCCESS_STORE_PID)];
+	return cgroup_register_unchanged_processes(&pid, 1, flags);
+}
+
+/**
+ * Wait for a socket to be ready, at most until the deadline of a request.
+ * @return 0 once ready, 1 on error or timeout
+ */
+static int cg_cgred_wait(int sk, short events, const struct timespec * const deadline)
+{
+	struct pollfd pfd = { .fd = sk, .events = events };
+	struct timespec now;
+	int timeout, ret;
+
+	do {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		timeout = (deadline->tv_sec - now.tv_sec) * 1000 +
+			  (deadline->tv_nsec - now.tv_nsec) / 1000000;
+		if (timeout <= 0) {
+			errno = ETIMEDOUT;
+			return 1;
+		}
+
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret == 0)
+		errno = ETIMEDOUT;
+
+	return ret <= 0;
+}
+
+int cgroup_change_cgroup_uid_gid_daemon(uid_t uid, gid_t gid, pid_t pid)
+{
+	struct {
+		struct cgrule_request req;
+		struct cgrule_classify classify;
+	} msg;
 	struct sockaddr_un addr;
-	size_t ret_len;
-	int ret = 1;
+	struct timespec deadline;
+	size_t off = 0;
+	int32_t reply;
+	ssize_t len;
 	int sk;
 
-	sk = socket(PF_UNIX, SOCK_STREAM, 0);
+	memset(&msg, 0, sizeof(msg));
+	msg.req.flags = CGRULE_REQUEST_CLASSIFY;
+	msg.classify.pid = pid;
+	msg.classify.uid = uid;
+	msg.classify.gid = gid;
+
+	sk = socket(PF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
 	if (sk < 0)
-		return 1;
+		goto err;
 
 	memset(&addr, 0, sizeof(addr));
 	addr.sun_family = AF_UNIX;
 	strcpy(addr.sun_path, CGRULE_CGRED_SOCKET_PATH);
 
-	if (connect(sk, (struct sockaddr *)&addr,
-	    sizeof(addr.sun_family) + strlen(CGRULE_CGRED_SOCKET_PATH)) < 0) {
-		/* If the daemon does not work, this function returns 0 as success. */
-		ret = 0;
-		goto close;
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += CGRULE_CLASSIFY_TIMEOUT / 1000;
+	deadline.tv_nsec += (CGRULE_CLASSIFY_TIMEOUT % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
 	}
-	if (write(sk, &pid, sizeof(pid)) < 0)
-		goto close;
 
-	if (write(sk, &flags, sizeof(flags)) < 0)
-		goto close;
+	/*
+	 * A UNIX socket connects at once, EAGAIN means the backlog of the
+	 * daemon is full: the caller classifies the process itself rather than
+	 * waiting for a busy daemon.
+	 */
+	if (connect(sk, (struct sockaddr *)&addr,
+	    sizeof(addr.sun_family) + strlen(CGRULE_CGRED_SOCKET_PATH)) < 0)
+		goto err;
 
-	ret_len = read(sk, buff, sizeof(buff));
-	if (ret_len != sizeof(buff))
-		goto close;
+	while (off < sizeof(msg)) {
+		len = send(sk, (char *)&msg + off, sizeof(msg) - off, MSG_NOSIGNAL);
+		if (len < 0 && errno != EAGAIN && errno != EINTR)
+			goto err;
+		if (len < 0 && errno == EAGAIN && cg_cgred_wait(sk, POLLOUT, &deadline))
+			goto err;
+		if (len > 0)
+			off += len;
+	}
 
-	if (strncmp(buff, CGRULE_SUCCESS_STORE_PID, sizeof(buff)))
-		goto close;
+	/* A daemon without the request closes the connection */
+	for (off = 0; off < sizeof(reply); off += len) {
+		if (cg_cgred_wait(sk, POLLIN, &deadline))
+			goto err;
+
+		len = recv(sk, (char *)&reply + off, sizeof(reply) - off, 0);
+		if (len < 0 && (errno == EAGAIN || errno == EINTR)) {
+			len = 0;
+			continue;
+		}
+		if (len == 0)
+			errno = ECONNRESET;
+		if (len <= 0)
+			goto err;
+	}
 
-	ret = 0;
-close:
 	close(sk);
 
-	return ret;
+	return reply;
+
+err:
+	last_errno = errno;
+	if (sk >= 0)
+		close(sk);
+
+	return ECGOTHER;
 }
 
 int cgroup_get_subsys_mount_point(const char *controller, char **mount_point)
@@ -5931,10 +10292,8 @@ int cgroup_get_subsys_mount_point(const char *controller, char **mount_point)
 		return ECGINVAL;
 
 	pthread_rwlock_rdlock(&cg_mount_table_lock);
-	for (i = 0; cg_mount_table[i].name[0] != '\0'; i++) {
-		if (strncmp(cg_mount_table[i].name, controller, FILENAME_MAX))
-			continue;
-
+	i = cg_mount_table_find(controller);
+	if (i >= 0) {
 		*mount_point = strdup(cg_mount_table[i].mount.path);
 
 		if (!*mount_point) {
@@ -5944,7 +10303,6 @@ int cgroup_get_subsys_mount_point(const char *controller, char **mount_point)
 		}
 
 		ret = 0;
-		break;
 	}
 out_exit:
 	pthread_rwlock_unlock(&cg_mount_table_lock);
@@ -5954,77 +10312,44 @@ out_exit:
 
 int cgroup_get_all_controller_end(void **handle)
 {
-	FILE *proc_cgroup = (FILE *) *handle;
-
-	if (!proc_cgroup)
-		return ECGINVAL;
-
-	fclose(proc_cgroup);
-	*handle = NULL;
-
-	return 0;
+	return cg_controllers_iter_end(handle);
 }
 
 int cgroup_get_all_controller_next(void **handle, struct controller_data *info)
 {
-	FILE *proc_cgroup = (FILE *) *handle;
-	int hierarchy, num_cgroups, enabled;
-	char subsys_name[FILENAME_MAX];
-	int err = 0;
+	struct cg_controllers_iter *iter = *handle;
 
-	if (!proc_cgroup)
+	if (!iter)
 		return ECGINVAL;
 
 	if (!info)
 		return ECGINVAL;
 
-	/*
-	 * check Linux Kernel sources/kernel/cgroup/cgroup.c cgroup_init_early(),
-	 * MAX_CGROUP_TYPE_NAMELEN check for details on why 32 is used.
-	 */
-	err = fscanf(proc_cgroup, "%32s %d %d %d\n", subsys_name, &hierarchy, &num_cgroups,
-		     &enabled);
-
-	if (err != 4)
+	if (iter->pos >= iter->ctrls->all_cnt)
 		return ECGEOF;
 
-	strncpy(info->name, subsys_name, FILENAME_MAX);
-	info->name[FILENAME_MAX-1] = '\0';
-	info->hierarchy = hierarchy;
-	info->num_cgroups = num_cgroups;
-	info->enabled = enabled;
+	memcpy(info, &iter->ctrls->all[iter->pos], sizeof(struct controller_data));
+	iter->pos++;
 
 	return 0;
 }
 
 int cgroup_get_all_controller_begin(void **handle, struct controller_data *info)
 {
-	FILE *proc_cgroup = NULL;
-	char buf[FILENAME_MAX];
 	int ret;
 
 	if (!info)
 		return ECGINVAL;
 
-	proc_cgroup = fopen("/proc/cgroups", "re");
-	if (!proc_cgroup) {
-		last_errno = errno;
-		return ECGOTHER;
-	}
-
-	if (!fgets(buf, FILENAME_MAX, proc_cgroup)) {
-		last_errno = errno;
-		fclose(proc_cgroup);
-		*handle = NULL;
-		return ECGOTHER;
-	}
-	*handle = proc_cgroup;
+	ret = cg_controllers_iter_begin(handle);
+	if (ret)
+		return ret;
 
-	ret = cgroup_get_all_controller_next(handle, info);
-	if (ret != 0) {
-		fclose(proc_cgroup);
-		*handle = NULL;
-	}
+	ret = ((struct cg_controllers_iter *)*handle)->ctrls->all_err;
+	if (!ret)
+		ret = cgroup_get_all_controller_next(handle, info);
+	if (ret != 0)
+		cg_controllers_iter_end(handle);
 
 	return ret;
 }
@@ -6045,67 +10370,141 @@ static int pid_compare(const void *a, const void *b)
  */
 int cgroup_get_procs(char *name, char *controller, pid_t **pids, int *size)
 {
-	char cgroup_path[FILENAME_MAX];
-	int tot_procs = 16;
-	pid_t *tmp_list;
-	FILE *procs;
-	int n = 0;
-	int err;
+	int alloc = 0;
+	int ret;
+
+	*pids = NULL;
+	ret = cgroup_get_pids(name, controller, 0, pids, &alloc, size);
+	if (ret) {
+		free(*pids);
+		*pids = NULL;
+		*size = 0;
+	}
 
-	cg_build_path(name, cgroup_path, controller);
-	strncat(cgroup_path, "/cgroup.procs", FILENAME_MAX-strlen(cgroup_path));
+	return ret;
+}
 
-	procs = fopen(cgroup_path, "r");
-	if (!procs) {
-		last_errno = errno;
+int cgroup_get_threads(const char *name, const char *controller, pid_t **pids, int *size)
+{
+	int alloc = 0;
+	int ret;
+
+	if (!pids || !size)
+		return ECGINVAL;
+
+	*pids = NULL;
+	ret = cgroup_get_pids(name, controller, CGFLAG_PIDS_THREADS, pids, &alloc, size);
+	if (ret) {
+		free(*pids);
 		*pids = NULL;
 		*size = 0;
-		if (errno == ENOENT)
-			return ECGROUPUNSUPP;
-		else
+	}
+
+	return ret;
+}
+
+/**
+ * Append a pid to the buffer of cgroup_get_pids(), it grows if needed.
+ * @return 0 on success, ECGOTHER if the allocation failed
+ */
+static int cg_pids_append(pid_t pid, pid_t ** const pids, int * const alloc, int * const size)
+{
+	pid_t *tmp;
+	int len;
+
+	if (*size == *alloc) {
+		len = *alloc ? *alloc * 2 : 64;
+		tmp = realloc(*pids, len * sizeof(pid_t));
+		if (!tmp) {
+			last_errno = errno;
 			return ECGOTHER;
+		}
+		*pids = tmp;
+		*alloc = len;
 	}
 
-	/* Keep doubling the memory allocated if needed */
-	tmp_list = malloc(sizeof(pid_t) * tot_procs);
-	if (!tmp_list) {
-		last_errno = errno;
-		fclose(procs);
-		return ECGOTHER;
+	(*pids)[(*size)++] = pid;
+
+	return 0;
+}
+
+int cgroup_get_pids(const char *name, const char *controller, int flags, pid_t **pids,
+		    int *alloc, int *size)
+{
+	char path[FILENAME_MAX], buf[CG_PIDS_BUF_SIZE];
+	enum cg_version_t version;
+	const char *file = "cgroup.procs";
+	bool in_pid = false;
+	pid_t pid = 0;
+	ssize_t len, i;
+	int fd, ret = 0;
+
+	if (!name || !pids || !alloc || !size || *alloc < 0 || (*alloc && !*pids))
+		return ECGINVAL;
+
+	*size = 0;
+
+	if (flags & CGFLAG_PIDS_THREADS) {
+		ret = cgroup_get_controller_version(controller, &version);
+		if (ret)
+			return ret;
+
+		/* cgroup v1 lists the threads in tasks */
+		file = version == CGROUP_V1 ? "tasks" : "cgroup.threads";
 	}
 
-	while (!feof(procs)) {
-		while (!feof(procs) && n < tot_procs) {
-			pid_t pid;
+	if (!cg_build_path(name, path, controller))
+		return ECGROUPSUBSYSNOTMOUNTED;
+	strncat(path, file, sizeof(path) - strlen(path) - 1);
 
-			err = fscanf(procs, "%u", &pid);
-			if (err == EOF)
-				break;
-			tmp_list[n] = pid;
-			n++;
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		last_errno = errno;
+		return errno == ENOENT ? ECGROUPUNSUPP : ECGOTHER;
+	}
+
+	/* The file is read in large chunks, a pid can span two of them */
+	for (;;) {
+		len = read(fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0) {
+			last_errno = errno;
+			ret = ECGOTHER;
+			break;
 		}
-		if (!feof(procs)) {
-			pid_t *orig_list = tmp_list;
 
-			tot_procs *= 2;
-			tmp_list = realloc(tmp_list, sizeof(pid_t) * tot_procs);
-			if (!tmp_list) {
-				last_errno = errno;
-				fclose(procs);
-				free(orig_list);
-				*pids = NULL;
-				*size = 0;
-				return ECGOTHER;
+		for (i = 0; i < len; i++) {
+			if (buf[i] >= '0' && buf[i] <= '9') {
+				pid = pid * 10 + (buf[i] - '0');
+				in_pid = true;
+				continue;
 			}
+
+			if (!in_pid)
+				continue;
+
+			ret = cg_pids_append(pid, pids, alloc, size);
+			if (ret)
+				goto out;
+			in_pid = false;
+			pid = 0;
+		}
+
+		if (len == 0) {
+			if (in_pid)
+				ret = cg_pids_append(pid, pids, alloc, size);
+			break;
 		}
 	}
-	fclose(procs);
 
-	*size = n;
-	qsort(tmp_list, n, sizeof(pid_t), &pid_compare);
-	*pids = tmp_list;
+out:
+	close(fd);
 
-	return 0;
+	if (ret == 0 && !(flags & CGFLAG_PIDS_UNSORTED))
+		qsort(*pids, *size, sizeof(pid_t), &pid_compare);
+
+	return ret;
 }
 
 int cgroup_dictionary_create(struct cgroup_dictionary **dict,
@@ -6124,53 +10523,140 @@ int cgroup_dictionary_create(struct cgroup_dictionary **dict,
 	return 0;
 }
 
+static unsigned int cg_dictionary_hash(const char * const name)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, name);
+}
+
+/**
+ * Find the slot of the index of a dictionary holding the first item of a
+ * name, or the free slot where it would go.
+ */
+static unsigned int cg_dictionary_slot(const struct cgroup_dictionary * const dict,
+				       const char * const name, unsigned int hash)
+{
+	const struct cgroup_dictionary_item *it;
+	unsigned int mask = dict->index_size - 1;
+	unsigned int slot;
+
+	for (slot = hash & mask; dict->index[slot]; slot = (slot + 1) & mask) {
+		it = &dict->items[dict->index[slot] - 1];
+		if (it->hash == hash && !strcmp(it->name, name))
+			break;
+	}
+
+	return slot;
+}
+
+/**
+ * Rebuild the index of a dictionary with twice the slots.
+ * @return 0 on success, ECGOTHER if the allocation failed
+ */
+static int cg_dictionary_grow_index(struct cgroup_dictionary * const dict)
+{
+	unsigned int size, slot;
+	int *index;
+	int i;
+
+	size = dict->index_size ? dict->index_size * 2 : 16;
+	index = calloc(size, sizeof(int));
+	if (!index) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	free(dict->index);
+	dict->index = index;
+	dict->index_size = size;
+
+	/* Inserted in order, a name keeps its first item */
+	for (i = 0; i < dict->count; i++) {
+		if (!dict->items[i].name)
+			continue;
+
+		slot = cg_dictionary_slot(dict, dict->items[i].name, dict->items[i].hash);
+		if (!dict->index[slot])
+			dict->index[slot] = i + 1;
+	}
+
+	return 0;
+}
+
 int cgroup_dictionary_add(struct cgroup_dictionary *dict, const char *name, const char *value)
 {
 	struct cgroup_dictionary_item *it;
+	unsigned int slot;
+	int alloc;
 
 	if (!dict)
 		return ECGINVAL;
 
-	it = (struct cgroup_dictionary_item *) malloc(sizeof(struct cgroup_dictionary_item));
-	if (!it) {
-		last_errno = errno;
-		return ECGOTHER;
+	if (dict->count == dict->alloc) {
+		alloc = dict->alloc ? dict->alloc * 2 : 8;
+		it = realloc(dict->items, alloc * sizeof(struct cgroup_dictionary_item));
+		if (!it) {
+			last_errno = errno;
+			return ECGOTHER;
+		}
+		dict->items = it;
+		dict->alloc = alloc;
 	}
 
-	it->next = NULL;
+	/* Keep the index at most half full */
+	if (2 * (unsigned int)(dict->count + 1) > dict->index_size &&
+	    cg_dictionary_grow_index(dict))
+		return ECGOTHER;
+
+	it = &dict->items[dict->count];
 	it->name = name;
 	it->value = value;
+	it->hash = name ? cg_dictionary_hash(name) : 0;
 
-	if (dict->tail) {
-		dict->tail->next = it;
-		dict->tail = it;
-	} else {
-		/* It is the first item */
-		dict->tail = it;
-		dict->head = it;
+	/* An item without name is kept for the iterator, it cannot be found */
+	if (name) {
+		slot = cg_dictionary_slot(dict, name, it->hash);
+		if (!dict->index[slot])
+			dict->index[slot] = dict->count + 1;
 	}
+	dict->count++;
+
+	return 0;
+}
+
+int cgroup_dictionary_get(struct cgroup_dictionary *dict, const char *name, const char **value)
+{
+	unsigned int slot;
+
+	if (!dict || !name || !value)
+		return ECGINVAL;
+
+	if (!dict->count)
+		return ECGROUPVALUENOTEXIST;
+
+	slot = cg_dictionary_slot(dict, name, cg_dictionary_hash(name));
+	if (!dict->index[slot])
+		return ECGROUPVALUENOTEXIST;
+
+	*value = dict->items[dict->index[slot] - 1].value;
 
 	return 0;
 }
 
 int cgroup_dictionary_free(struct cgroup_dictionary *dict)
 {
-	struct cgroup_dictionary_item *it;
+	int i;
 
 	if (!dict)
 		return ECGINVAL;
 
-	it = dict->head;
-	while (it) {
-		struct cgroup_dictionary_item *del = it;
-
-		it = it->next;
-		if (!(dict->flags & CG_DICT_DONT_FREE_ITEMS)) {
-			free((void *)del->value);
-			free((void *)del->name);
+	if (!(dict->flags & CG_DICT_DONT_FREE_ITEMS)) {
+		for (i = 0; i < dict->count; i++) {
+			free((void *)dict->items[i].value);
+			free((void *)dict->items[i].name);
 		}
-		free(del);
 	}
+	free(dict->items);
+	free(dict->index);
 	free(dict);
 
 	return 0;
@@ -6193,7 +10679,8 @@ int cgroup_dictionary_iterator_begin(struct cgroup_dictionary *dict, void **hand
 		return ECGOTHER;
 	}
 
-	iter->item = dict->head;
+	iter->dict = dict;
+	iter->pos = 0;
 	*handle = iter;
 
 	return cgroup_dictionary_iterator_next(handle, name, value);
@@ -6211,12 +10698,12 @@ int cgroup_dictionary_iterator_next(void **handle, const char **name, const char
 	if (!iter)
 		return ECGINVAL;
 
-	if (!iter->item)
+	if (iter->pos >= iter->dict->count)
 		return ECGEOF;
 
-	*name = iter->item->name;
-	*value = iter->item->value;
-	iter->item = iter->item->next;
+	*name = iter->dict->items[iter->pos].name;
+	*value = iter->dict->items[iter->pos].value;
+	iter->pos++;
 
 	return 0;
 }
@@ -6239,11 +10726,8 @@ int cgroup_get_subsys_mount_point_begin(const char *controller, void **handle, c
 	if (!handle || !path || !controller)
 		return ECGINVAL;
 
-	for (i = 0; cg_mount_table[i].name[0] != '\0'; i++)
-		if (strcmp(controller, cg_mount_table[i].name) == 0)
-			break;
-
-	if (cg_mount_table[i].name[0] == '\0') {
+	i = cg_mount_table_find(controller);
+	if (i < 0) {
 		/* The controller is not mounted at all */
 		*handle = NULL;
 		*path = '\0';
@@ -6312,12 +10796,10 @@ int cgroup_get_controller_version(const char * const controller, enum cg_version
 
 	*version = CGROUP_UNK;
 
-	for (i = 0; cg_mount_table[i].name[0] != '\0'; i++) {
-		if (strncmp(cg_mount_table[i].name, controller,
-			    sizeof(cg_mount_table[i].name)) == 0) {
-			*version = cg_mount_table[i].version;
-			return 0;
-		}
+	i = cg_mount_table_find(controller);
+	if (i >= 0) {
+		*version = cg_mount_table[i].version;
+		return 0;
 	}
 
 	return ECGROUPNOTEXIST;
@@ -6466,9 +10948,6 @@ const struct cgroup_library_version *cgroup_version(void)
  */
 enum cg_setup_mode_t cgroup_setup_mode(void)
 {
-#define CGROUP2_SUPER_MAGIC	0x63677270
-#define CGROUP_SUPER_MAGIC	0x27E0EB
-
 	unsigned int cg_setup_mode_bitmask = 0U;
 	enum cg_setup_mode_t setup_mode;
 	struct statfs cgrp_buf;
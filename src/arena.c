@@ -0,0 +1,130 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Arena allocator for cgroup object graphs
+ *
+ * The tools build many short lived cgroups just to print them.  Each
+ * cgroup, controller and value used to be a separate allocation, freed
+ * again one by one.  A cgroup created by cgroup_new_cgroup_arena() takes
+ * all its memory from a bump-pointer arena instead, and the whole arena is
+ * released at once by cgroup_arena_reset().
+ *
+ * An arena is not thread-safe, each thread must use its own.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Size of the first chunk, the next ones double up to CG_ARENA_CHUNK_MAX */
+#define CG_ARENA_CHUNK_SIZE	(16 * 1024)
+#define CG_ARENA_CHUNK_MAX	(1024 * 1024)
+
+/* All the allocations are aligned for any of the structures */
+#define CG_ARENA_ALIGN		16
+
+struct cg_arena_chunk {
+	struct cg_arena_chunk *next;
+	size_t size;
+	size_t used;
+	char data[] __attribute__((aligned(CG_ARENA_ALIGN)));
+};
+
+struct cgroup_arena {
+	/* The allocations are served from the first chunk, the newest one */
+	struct cg_arena_chunk *chunks;
+};
+
+struct cgroup_arena *cgroup_arena_new(void)
+{
+	struct cgroup_arena *arena;
+
+	arena = calloc(1, sizeof(struct cgroup_arena));
+	if (!arena)
+		last_errno = errno;
+
+	return arena;
+}
+
+void *cg_arena_alloc(struct cgroup_arena * const arena, size_t size)
+{
+	struct cg_arena_chunk *chunk = arena->chunks;
+	size_t chunk_size;
+	void *ptr;
+
+	size = (size + CG_ARENA_ALIGN - 1) & ~((size_t)CG_ARENA_ALIGN - 1);
+
+	if (!chunk || chunk->size - chunk->used < size) {
+		chunk_size = chunk ? chunk->size * 2 : CG_ARENA_CHUNK_SIZE;
+		if (chunk_size > CG_ARENA_CHUNK_MAX)
+			chunk_size = CG_ARENA_CHUNK_MAX;
+		if (chunk_size < size)
+			chunk_size = size;
+
+		chunk = malloc(sizeof(struct cg_arena_chunk) + chunk_size);
+		if (!chunk) {
+			last_errno = errno;
+			return NULL;
+		}
+
+		chunk->size = chunk_size;
+		chunk->used = 0;
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	memset(ptr, 0, size);
+
+	return ptr;
+}
+
+char *cg_arena_strndup(struct cgroup_arena * const arena, const char * const str, size_t max)
+{
+	size_t len = strnlen(str, max);
+	char *copy;
+
+	copy = cg_arena_alloc(arena, len + 1);
+	if (!copy)
+		return NULL;
+
+	memcpy(copy, str, len);
+
+	return copy;
+}
+
+void cgroup_arena_reset(struct cgroup_arena *arena)
+{
+	struct cg_arena_chunk *chunk, *next;
+
+	if (!arena || !arena->chunks)
+		return;
+
+	/* Keep the newest, usually the largest, chunk for the next graphs */
+	for (chunk = arena->chunks->next; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	arena->chunks->next = NULL;
+	arena->chunks->used = 0;
+}
+
+void cgroup_arena_free(struct cgroup_arena **arena)
+{
+	struct cg_arena_chunk *chunk, *next;
+
+	if (!arena || !*arena)
+		return;
+
+	for (chunk = (*arena)->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		free(chunk);
+	}
+
+	free(*arena);
+	*arena = NULL;
+}
@@ -47,12 +47,30 @@ enum tc_switch_t {
 	TEMPLATE,
 };
 
-extern FILE *yyin;
 extern int yyparse(void);
 
 static struct cgroup default_group;
 static int default_group_set;
 
+/* Number of threads creating the groups, see cgroup_config_set_jobs() */
+static int config_jobs = 1;
+
+#ifdef WITH_IO_URING
+/* Whether the values are written with io_uring, see cgroup_config_set_io_uring() */
+static bool config_io_uring;
+#endif
+
+/*
+ * The groups parsed from the configuration are allocated by slabs that never
+ * move, and the tables hold pointers to them.  Growing a table for a huge
+ * file copies pointers instead of groups, the groups being filled by the
+ * parser keep their address, and the tables are sorted by moving pointers.
+ */
+struct config_slab {
+	struct config_slab *next;
+	struct cgroup groups[];
+};
+
 /*
  * The basic global data structures.
  *
@@ -68,7 +86,8 @@ static int config_table_index;
 static int namespace_table_index;
 static pthread_rwlock_t config_table_lock = PTHREAD_RWLOCK_INITIALIZER;
 static pthread_rwlock_t namespace_table_lock = PTHREAD_RWLOCK_INITIALIZER;
-static struct cgroup *config_cgroup_table;
+static struct cgroup **config_cgroup_table;
+static struct config_slab *config_cgroup_slabs;
 static int cgroup_table_index;
 
 /*
@@ -76,7 +95,8 @@ static int cgroup_table_index;
  * file is parsing (analogous to config_cgroup_table and cgroup_table_index
  * for cgroups)
  */
-static struct cgroup *config_template_table;
+static struct cgroup **config_template_table;
+static struct config_slab *config_template_slabs;
 static int config_template_table_index;
 
 /*
@@ -88,6 +108,18 @@ static struct cgroup *template_table;
 static int template_table_index;
 static struct cgroup_string_list *template_files;
 
+/*
+ * Hash index of template_table by name, built on the first lookup after the
+ * table changed.  The templates of a bucket are chained through
+ * template_next in the order of the table.
+ */
+static int *template_buckets;
+static int *template_next;
+static unsigned int template_bucket_cnt;
+
+/* Set while cgroup_config_create_template_group() loads the templates itself */
+static bool template_implicit_load;
+
 
 /* Needed for the type while mounting cgroupfs. */
 #define CGROUP_FILESYSTEM "cgroup"
@@ -97,7 +129,7 @@ static struct cgroup_string_list *template_files;
 static const char * const systemd_def_cgrp_file_dir = "/var/run/libcgroup/";
 
 /* File that stores the relative delegated systemd cgroup path */
-static const char * const systemd_default_cgroup_file = "/var/run/libcgroup/systemd";
+static const char * const systemd_default_cgroup_file = CG_SYSTEMD_DEFAULT_CGROUP_FILE;
 
 /* Lock that protects systemd_default_cgroup_file */
 static pthread_rwlock_t systemd_default_cgroup_lock = PTHREAD_RWLOCK_INITIALIZER;
@@ -112,6 +144,71 @@ static struct cgroup_systemd_opts *cgroup_systemd_opts_tail;
 static int config_create_slice_scope(char * const tmp_systemd_default_cgroup);
 #endif
 
+/**
+ * Grow a table of groups to max entries, the new groups are allocated in a
+ * single slab.
+ * @param table The table
+ * @param slabs The slabs of the table
+ * @param len Current number of entries, set to max on success
+ * @param max New number of entries
+ * @return 0 on success, ECGOTHER with last_errno set on failure
+ */
+static int config_table_grow(struct cgroup ***table, struct config_slab **slabs,
+			     unsigned int * const len, unsigned int max)
+{
+	struct config_slab *slab;
+	struct cgroup **newtbl;
+	unsigned int i;
+
+	slab = calloc(1, sizeof(struct config_slab) + (max - *len) * sizeof(struct cgroup));
+	if (!slab) {
+		last_errno = ENOMEM;
+		return ECGOTHER;
+	}
+
+	newtbl = realloc(*table, max * sizeof(struct cgroup *));
+	if (!newtbl) {
+		free(slab);
+		last_errno = ENOMEM;
+		return ECGOTHER;
+	}
+
+	init_cgroup_table(slab->groups, max - *len);
+	for (i = *len; i < max; i++)
+		newtbl[i] = &slab->groups[i - *len];
+
+	slab->next = *slabs;
+	*slabs = slab;
+	*table = newtbl;
+	*len = max;
+
+	return 0;
+}
+
+/**
+ * Free a table of groups and its slabs, the controllers of the first count
+ * groups are freed too.
+ */
+static void config_table_free(struct cgroup ***table, struct config_slab **slabs, int count)
+{
+	struct config_slab *slab;
+	int i;
+
+	if (*table) {
+		for (i = 0; i < count; i++)
+			cgroup_free_controllers((*table)[i]);
+	}
+
+	while (*slabs) {
+		slab = *slabs;
+		*slabs = slab->next;
+		free(slab);
+	}
+
+	free(*table);
+	*table = NULL;
+}
+
 /*
  * NOTE: All these functions return 1 on success and not 0 as is the
  * library convention
@@ -126,61 +223,42 @@ static int config_create_slice_scope(char * const tmp_systemd_default_cgroup);
 int config_insert_cgroup(char *cg_name, int flag)
 {
 
+	struct config_slab **slabs;
+	struct cgroup ***table;
 	struct cgroup *config_cgroup;
-	struct cgroup *config_table;
 	unsigned int *max;
 	int *table_index;
 
 	switch (flag) {
 	case CGROUP:
 		table_index = &cgroup_table_index;
-		config_table = config_cgroup_table;
+		table = &config_cgroup_table;
+		slabs = &config_cgroup_slabs;
 		max = &MAX_CGROUPS;
 		break;
 	case TEMPLATE:
 		table_index = &config_template_table_index;
-		config_table = config_template_table;
+		table = &config_template_table;
+		slabs = &config_template_slabs;
 		max = &MAX_TEMPLATES;
 		break;
 	default:
 		return 0;
 	}
 
+	/* The parser fills the next group before it names it */
 	if (*table_index >= *max - 1) {
-		struct cgroup *newblk;
-		unsigned int oldlen;
-
-		if (*max >= INT_MAX) {
-			last_errno = ENOMEM;
-			return 0;
-		}
-		oldlen = *max;
-		*max *= 2;
-
-		newblk = realloc(config_table, (*max * sizeof(struct cgroup)));
-		if (!newblk) {
+		if (*max >= INT_MAX / 2) {
 			last_errno = ENOMEM;
 			return 0;
 		}
 
-		memset(newblk + oldlen, 0, (*max - oldlen) * sizeof(struct cgroup));
-		init_cgroup_table(newblk + oldlen, *max - oldlen);
-		config_table = newblk;
-		switch (flag) {
-		case CGROUP:
-			config_cgroup_table = config_table;
-			break;
-		case TEMPLATE:
-			config_template_table = config_table;
-			break;
-		default:
+		if (config_table_grow(table, slabs, max, *max * 2))
 			return 0;
-		}
 		cgroup_dbg("maximum %d\n", *max);
-		cgroup_dbg("reallocated config_table to %p\n", config_table);
 	}
 
-	config_cgroup = &config_table[*table_index];
+	config_cgroup = (*table)[*table_index];
 	strncpy(config_cgroup->name, cg_name, FILENAME_MAX - 1);
 
 	/* Since this will be the last part to be parsed. */
@@ -228,6 +306,7 @@ int config_parse_controller_options(char *controller, struct cgroup_dictionary *
 	struct cgroup_controller *cgc;
 	struct cgroup *config_cgroup;
 	const char *name, *value;
+	const char *first;
 	void *iter = NULL;
 	int *table_index;
 	int error;
@@ -235,11 +314,11 @@ int config_parse_controller_options(char *controller, struct cgroup_dictionary *
 	switch (flag) {
 	case CGROUP:
 		table_index = &cgroup_table_index;
-		config_cgroup =	&config_cgroup_table[*table_index];
+		config_cgroup =	config_cgroup_table[*table_index];
 		break;
 	case TEMPLATE:
 		table_index = &config_template_table_index;
-		config_cgroup =	&config_template_table[*table_index];
+		config_cgroup =	config_template_table[*table_index];
 		break;
 	default:
 		return 0;
@@ -262,6 +341,12 @@ int config_parse_controller_options(char *controller, struct cgroup_dictionary *
 		cgroup_dbg("[1] name value pair being processed is %s=%s\n", name, value);
 		if (!name)
 			goto parse_error;
+		/* The lookup finds the first item of a name given twice */
+		if (!cgroup_dictionary_get(values, name, &first) && first != value) {
+			cgroup_err("%s is set more than once for controller %s\n", name,
+				   controller);
+			goto parse_error;
+		}
 		error = cgroup_add_value_string(cgc, name, value);
 		if (error)
 			goto parse_error;
@@ -334,11 +419,11 @@ int config_group_task_perm(char *perm_type, char *value, int flag)
 	switch (flag) {
 	case CGROUP:
 		table_index = cgroup_table_index;
-		config_cgroup = &config_cgroup_table[table_index];
+		config_cgroup = config_cgroup_table[table_index];
 		break;
 	case TEMPLATE:
 		table_index = config_template_table_index;
-		config_cgroup = &config_template_table[table_index];
+		config_cgroup = config_template_table[table_index];
 		break;
 	default:
 		return 0;
@@ -444,11 +529,11 @@ int config_group_admin_perm(char *perm_type, char *value, int flag)
 	switch (flag) {
 	case CGROUP:
 		table_index = cgroup_table_index;
-		config_cgroup = &config_cgroup_table[table_index];
+		config_cgroup = config_cgroup_table[table_index];
 		break;
 	case TEMPLATE:
 		table_index = config_template_table_index;
-		config_cgroup = &config_template_table[table_index];
+		config_cgroup = config_template_table[table_index];
 		break;
 	default:
 		return 0;
@@ -692,9 +777,10 @@ static int cgroup_config_ajdust_mount_options(struct cg_mount_table_s *mount, un
 }
 
 /*
- * Start mounting the mount table
+ * Start mounting the mount table.  If skip_mounted is set, the controllers
+ * that are already mounted are left as they are.
  */
-static int cgroup_config_mount_fs(void)
+static int cgroup_config_mount_fs(bool skip_mounted)
 {
 	unsigned long flags;
 	struct stat buff;
@@ -705,6 +791,9 @@ static int cgroup_config_mount_fs(void)
 	for (i = 0; i < config_table_index; i++) {
 		struct cg_mount_table_s *curr =	&(config_mount_table[i]);
 
+		if (skip_mounted && cgroup_test_subsys_mounted(curr->name))
+			continue;
+
 		ret = stat(curr->mount.path, &buff);
 		if (ret < 0 && errno != ENOENT) {
 			cgroup_err("cannot access %s: %s\n", curr->mount.path, strerror(errno));
@@ -860,6 +949,269 @@ err:
 	cgroup_free(&cgrp_cpy);
 	return ret;
 }
+static int cg_config_create_group(struct cgroup * const cgroup)
+{
+	int error;
+
+	error = cgroup_create_cgroup(cgroup, 0);
+	cgroup_dbg("creating group %s, error %d\n", cgroup->name, error);
+	if (error) {
+		/*
+		 * Attempt to convert the controller version
+		 * and retry.
+		 */
+		error = convert_controller_versions(cgroup);
+	}
+
+	return error;
+}
+
+/* Name of a group of the table, sorted to find the parents of the groups */
+struct cg_config_name {
+	const char *name;
+	int index;
+};
+
+static int cg_config_compare_names(const void *p1, const void *p2)
+{
+	const struct cg_config_name *n1 = p1;
+	const struct cg_config_name *n2 = p2;
+	int ret;
+
+	ret = strcmp(n1->name, n2->name);
+	if (ret)
+		return ret;
+
+	return n1->index - n2->index;
+}
+
+static int cg_config_compare_name(const void *p1, const void *p2)
+{
+	const struct cg_config_name *n1 = p1;
+	const struct cg_config_name *n2 = p2;
+
+	return strcmp(n1->name, n2->name);
+}
+
+/**
+ * Find the parent of each group of a table: the nearest of its ancestors
+ * that is defined in the table, or else the root group if the table has
+ * one.  A group defined twice has its previous definition as parent.
+ * @param cgroups The groups
+ * @param count Number of groups
+ * @param parents Set to the index of the parent of each group, -1 if none
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+STATIC int cg_config_parent_groups(struct cgroup * const * const cgroups, int count,
+				   int * const parents)
+{
+	struct cg_config_name *names, *found, key;
+	char path[FILENAME_MAX];
+	int root = -1;
+	char *slash;
+	int i, j;
+
+	names = malloc(count * sizeof(struct cg_config_name));
+	if (!names) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	for (i = 0; i < count; i++) {
+		names[i].name = cgroups[i]->name;
+		names[i].index = i;
+
+		if (root < 0 && (!strcmp(cgroups[i]->name, ".") || !strcmp(cgroups[i]->name, "/")))
+			root = i;
+	}
+	qsort(names, count, sizeof(struct cg_config_name), cg_config_compare_names);
+
+	for (i = 0; i < count; i++) {
+		j = names[i].index;
+		parents[j] = -1;
+
+		if (i > 0 && !strcmp(names[i - 1].name, names[i].name)) {
+			parents[j] = names[i - 1].index;
+			continue;
+		}
+
+		if (j == root || !strcmp(names[i].name, ".") || !strcmp(names[i].name, "/"))
+			continue;
+
+		snprintf(path, sizeof(path), "%s", names[i].name);
+		while (parents[j] < 0 && (slash = strrchr(path, '/'))) {
+			*slash = '\0';
+
+			key.name = path;
+			found = bsearch(&key, names, count, sizeof(struct cg_config_name),
+					cg_config_compare_name);
+			if (found)
+				parents[j] = found->index;
+		}
+
+		if (parents[j] < 0)
+			parents[j] = root;
+	}
+
+	free(names);
+
+	return 0;
+}
+
+/* State shared by the threads of cgroup_config_create_groups_parallel() */
+struct cg_config_creation {
+	struct cgroup **cgroups;
+	/* First child and next sibling of each group, -1 at the end */
+	int *child;
+	int *sibling;
+	/* The groups whose parent is created, each group is queued once */
+	int *ready;
+	int ready_head;
+	int ready_tail;
+	/* Number of groups being created */
+	int running;
+	/* First error, and the last_errno of the thread that hit it */
+	int error;
+	int error_errno;
+	/* Whether the values are written with io_uring, as by the loading thread */
+	bool uring;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static void *cg_config_create_worker(void *arg)
+{
+	struct cg_config_creation *creation = arg;
+	int error, i, child;
+
+#ifdef WITH_IO_URING
+	cg_uring_enabled = creation->uring;
+#endif
+	pthread_mutex_lock(&creation->lock);
+	for (;;) {
+		while (creation->ready_head == creation->ready_tail && creation->running &&
+		       !creation->error)
+			pthread_cond_wait(&creation->cond, &creation->lock);
+
+		/* Stop on the first error, or once all the groups are created */
+		if (creation->error || creation->ready_head == creation->ready_tail)
+			break;
+
+		i = creation->ready[creation->ready_head++];
+		creation->running++;
+		pthread_mutex_unlock(&creation->lock);
+
+		error = cg_config_create_group(creation->cgroups[i]);
+
+		pthread_mutex_lock(&creation->lock);
+		creation->running--;
+		if (error) {
+			if (!creation->error) {
+				creation->error = error;
+				creation->error_errno = last_errno;
+			}
+		} else {
+			/* The children can be created now that their parent is set up */
+			for (child = creation->child[i]; child >= 0;
+			     child = creation->sibling[child])
+				creation->ready[creation->ready_tail++] = child;
+		}
+		pthread_cond_broadcast(&creation->cond);
+	}
+	pthread_mutex_unlock(&creation->lock);
+
+	return NULL;
+}
+
+/*
+ * Create the groups with several threads.  A group is created once its
+ * parent is, so that the parent's cgroup.subtree_control and settings are
+ * in place, and independent subtrees are created concurrently.
+ */
+static int cgroup_config_create_groups_parallel(int jobs)
+{
+	struct cg_config_creation creation;
+	int count = cgroup_table_index;
+	pthread_t *threads = NULL;
+	int *parents = NULL;
+	int started = 0;
+	int error, i;
+
+	memset(&creation, 0, sizeof(creation));
+	creation.cgroups = config_cgroup_table;
+#ifdef WITH_IO_URING
+	creation.uring = cg_uring_enabled;
+#endif
+
+	if (jobs > count)
+		jobs = count;
+
+	parents = malloc(count * sizeof(int));
+	creation.child = malloc(count * sizeof(int));
+	creation.sibling = malloc(count * sizeof(int));
+	creation.ready = malloc(count * sizeof(int));
+	threads = malloc((jobs - 1) * sizeof(pthread_t));
+	if (!parents || !creation.child || !creation.sibling || !creation.ready || !threads) {
+		last_errno = errno;
+		error = ECGOTHER;
+		goto out;
+	}
+
+	error = cg_config_parent_groups(config_cgroup_table, count, parents);
+	if (error)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		creation.child[i] = -1;
+		creation.sibling[i] = -1;
+	}
+
+	/* Link the children backwards, so they are queued in the table order */
+	for (i = count - 1; i >= 0; i--) {
+		if (parents[i] < 0)
+			continue;
+		creation.sibling[i] = creation.child[parents[i]];
+		creation.child[parents[i]] = i;
+	}
+	for (i = 0; i < count; i++) {
+		if (parents[i] < 0)
+			creation.ready[creation.ready_tail++] = i;
+	}
+
+	pthread_mutex_init(&creation.lock, NULL);
+	pthread_cond_init(&creation.cond, NULL);
+
+	/* The calling thread is one of the workers */
+	for (i = 0; i < jobs - 1; i++) {
+		if (pthread_create(&threads[i], NULL, cg_config_create_worker, &creation)) {
+			cgroup_warn("cannot start a thread, using %d\n", i + 1);
+			break;
+		}
+		started++;
+	}
+
+	cg_config_create_worker(&creation);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&creation.cond);
+	pthread_mutex_destroy(&creation.lock);
+
+	error = creation.error;
+	if (error)
+		last_errno = creation.error_errno;
+
+out:
+	free(threads);
+	free(creation.ready);
+	free(creation.sibling);
+	free(creation.child);
+	free(parents);
+
+	return error;
+}
+
 /*
  * Actually create the groups once the parsing has been finished
  */
@@ -867,23 +1219,27 @@ static int cgroup_config_create_groups(void)
 {
 	int error = 0;
 	int i;
+#ifdef WITH_IO_URING
+	/* Only this load and its workers, not the other threads, use io_uring */
+	bool uring = cg_uring_enabled;
 
-	for (i = 0; i < cgroup_table_index; i++) {
-		struct cgroup *cgroup = &config_cgroup_table[i];
+	cg_uring_enabled = config_io_uring;
+#endif
 
-		error = cgroup_create_cgroup(cgroup, 0);
-		cgroup_dbg("creating group %s, error %d\n", cgroup->name, error);
-		if (error) {
-			/*
-			 * Attempt to convert the controller version
-			 * and retry.
-			 */
-			error = convert_controller_versions(cgroup);
+	if (config_jobs > 1 && cgroup_table_index > 1) {
+		error = cgroup_config_create_groups_parallel(config_jobs);
+	} else {
+		for (i = 0; i < cgroup_table_index; i++) {
+			error = cg_config_create_group(config_cgroup_table[i]);
 			if (error)
-				return error;
+				break;
 		}
 	}
 
+#ifdef WITH_IO_URING
+	cg_uring_enabled = uring;
+#endif
+
 	return error;
 }
 
@@ -896,7 +1252,7 @@ static int cgroup_config_destroy_groups(void)
 	int i;
 
 	for (i = 0; i < cgroup_table_index; i++) {
-		struct cgroup *cgroup = &config_cgroup_table[i];
+		struct cgroup *cgroup = config_cgroup_table[i];
 
 		error = cgroup_delete_cgroup_ext(cgroup, CGFLAG_DELETE_RECURSIVE |
 							 CGFLAG_DELETE_IGNORE_MIGRATION);
@@ -1087,23 +1443,11 @@ error_out:
  */
 static void cgroup_free_config(void)
 {
-	int i;
-
-	if (config_cgroup_table) {
-		for (i = 0; i < cgroup_table_index; i++)
-			cgroup_free_controllers(&config_cgroup_table[i]);
-		free(config_cgroup_table);
-		config_cgroup_table = NULL;
-	}
+	config_table_free(&config_cgroup_table, &config_cgroup_slabs, cgroup_table_index);
 
 	config_table_index = 0;
-	if (config_template_table) {
-		for (i = 0; i < config_template_table_index; i++)
-			cgroup_free_controllers(&config_template_table[i]);
-
-		free(config_template_table);
-		config_template_table = NULL;
-	}
+	config_table_free(&config_template_table, &config_template_slabs,
+			  config_template_table_index);
 	config_template_table_index = 0;
 
 	cgroup_cleanup_systemd_opts();
@@ -1118,7 +1462,7 @@ static void cgroup_config_apply_default(void)
 
 	if (config_cgroup_table) {
 		for (i = 0; i < cgroup_table_index; i++) {
-			struct cgroup *c = &config_cgroup_table[i];
+			struct cgroup *c = config_cgroup_table[i];
 
 			if (c->control_dperm == NO_PERMS)
 				c->control_dperm = default_group.control_dperm;
@@ -1140,31 +1484,30 @@ static void cgroup_config_apply_default(void)
 
 static int cgroup_parse_config(const char *pathname)
 {
+	unsigned int len = 0;
 	int ret;
 
-	yyin = fopen(pathname, "re");
-
-	if (!yyin) {
+	if (cg_config_lex_open(pathname)) {
 		cgroup_err("failed to open file %s\n", pathname);
-		last_errno = errno;
 		return ECGOTHER;
 	}
 
-	config_cgroup_table = calloc(MAX_CGROUPS, sizeof(struct cgroup));
-	if (!config_cgroup_table) {
+	/* Clear all internal variables so this function can be called twice. */
+	cgroup_table_index = 0;
+	config_template_table_index = 0;
+
+	if (config_table_grow(&config_cgroup_table, &config_cgroup_slabs, &len, MAX_CGROUPS)) {
 		ret = ECGFAIL;
 		goto err;
 	}
 
-	config_template_table = calloc(MAX_TEMPLATES, sizeof(struct cgroup));
-	if (!config_template_table) {
+	len = 0;
+	if (config_table_grow(&config_template_table, &config_template_slabs, &len,
+			      MAX_TEMPLATES)) {
 		ret = ECGFAIL;
 		goto err;
 	}
 
-	/* Clear all internal variables so this function can be called twice. */
-	init_cgroup_table(config_cgroup_table, MAX_CGROUPS);
-	init_cgroup_table(config_template_table, MAX_TEMPLATES);
 	memset(config_namespace_table, 0, sizeof(config_namespace_table));
 	memset(config_mount_table, 0, sizeof(config_mount_table));
 	config_table_index = 0;
@@ -1189,8 +1532,7 @@ static int cgroup_parse_config(const char *pathname)
 	}
 
 err:
-	if (yyin)
-		fclose(yyin);
+	cg_config_lex_close();
 	if (ret)
 		cgroup_free_config();
 
@@ -1199,15 +1541,15 @@ err:
 
 int _cgroup_config_compare_groups(const void *p1, const void *p2)
 {
-	const struct cgroup *g1 = p1;
-	const struct cgroup *g2 = p2;
+	const struct cgroup * const *g1 = p1;
+	const struct cgroup * const *g2 = p2;
 
-	return strcmp(g1->name, g2->name);
+	return strcmp((*g1)->name, (*g2)->name);
 }
 
 static void cgroup_config_sort_groups(void)
 {
-	qsort(config_cgroup_table, cgroup_table_index, sizeof(struct cgroup),
+	qsort(config_cgroup_table, cgroup_table_index, sizeof(struct cgroup *),
 	      _cgroup_config_compare_groups);
 }
 
@@ -1236,11 +1578,11 @@ int cgroup_config_load_config(const char *pathname)
 
 	/* The configuration should have namespace or mount, not both. */
 	if (namespace_enabled && mount_enabled) {
-		free(config_cgroup_table);
+		cgroup_free_config();
 		return ECGMOUNTNAMESPACE;
 	}
 
-	error = cgroup_config_mount_fs();
+	error = cgroup_config_mount_fs(false);
 	if (error)
 		goto err_mnt;
 
@@ -1315,6 +1657,268 @@ err_mnt:
 	return error;
 }
 
+/*
+ * Owner a group is given by cgroup_create_cgroup(), NO_UID_GID stands for
+ * the current user or group.
+ */
+static bool cg_config_owner_differs(const struct stat * const st, uid_t uid, gid_t gid)
+{
+	if (uid == NO_UID_GID)
+		uid = getuid();
+	if (gid == NO_UID_GID)
+		gid = getgid();
+
+	return st->st_uid != uid || st->st_gid != gid;
+}
+
+/*
+ * Mode a file is given by cg_chmod_path(), the owner permissions being used
+ * as an umask for the group and others.
+ */
+static bool cg_config_mode_differs(const struct stat * const st, mode_t mode)
+{
+	mode_t mask;
+
+	if (mode == NO_PERMS)
+		return false;
+
+	mask = 0700 & st->st_mode;
+	mask |= mask >> 3 | mask >> 6 | S_ISUID | S_ISGID | S_ISVTX;
+
+	return (st->st_mode & 07777) != (mode & mask);
+}
+
+/**
+ * Check that the directories of a configured group exist, and whether their
+ * owners and permissions match the configuration.
+ * @param cgroup The configured group
+ * @param changed Set if the owners or permissions differ
+ * @return 0 on success, ECGROUPNOTEXIST if a directory is missing
+ */
+STATIC int cg_config_stat_group(const struct cgroup * const cgroup, bool * const changed)
+{
+	char path[FILENAME_MAX + sizeof("/tasks")];
+	enum cg_version_t version;
+	const char *controller;
+	struct stat st;
+	int count, i;
+
+	*changed = false;
+
+	/* A group without controllers is a cgroup v2 group */
+	count = cgroup->index ? cgroup->index : 1;
+	for (i = 0; i < count; i++) {
+		controller = cgroup->index ? cgroup->controller[i]->name : NULL;
+
+		if (!cg_build_path(cgroup->name, path, controller))
+			return ECGOTHER;
+
+		if (stat(path, &st)) {
+			if (errno == ENOENT)
+				return ECGROUPNOTEXIST;
+			last_errno = errno;
+			return ECGOTHER;
+		}
+
+		if (cg_config_owner_differs(&st, cgroup->control_uid, cgroup->control_gid) ||
+		    cg_config_mode_differs(&st, cgroup->control_dperm))
+			*changed = true;
+
+		if (!controller || cgroup_get_controller_version(controller, &version) ||
+		    version != CGROUP_V1)
+			continue;
+
+		/* The tasks file of cgroup v1 has its own owner */
+		strcat(path, "/tasks");
+		if (stat(path, &st)) {
+			last_errno = errno;
+			return ECGOTHER;
+		}
+
+		if (cg_config_owner_differs(&st, cgroup->tasks_uid, cgroup->tasks_gid) ||
+		    cg_config_mode_differs(&st, cgroup->task_fperm))
+			*changed = true;
+	}
+
+	return 0;
+}
+
+/**
+ * Find the settings of a configured group that differ from the live group.
+ * @param cgroup The configured group
+ * @param diff Filled with the controllers and values to write
+ * @return 0 on success, ECGROUPVALUENOTEXIST if a setting does not exist
+ */
+STATIC int cg_config_diff_group(const struct cgroup * const cgroup, struct cgroup * const diff)
+{
+	struct cgroup_controller *cgc, *live_cgc, *diff_cgc;
+	struct control_value *cv, *live_cv;
+	struct cgroup *live;
+	int error = 0;
+	int i, j;
+
+	live = cgroup_new_cgroup(cgroup->name);
+	if (!live)
+		return ECGROUPNOTCREATED;
+
+	/* Read only the settings of the configuration */
+	for (i = 0; i < cgroup->index; i++) {
+		cgc = cgroup->controller[i];
+
+		live_cgc = cgroup_add_controller(live, cgc->name);
+		if (!live_cgc) {
+			error = ECGINVAL;
+			goto out;
+		}
+
+		for (j = 0; j < cgc->index; j++) {
+			error = cgroup_add_value_string(live_cgc, cgc->values[j]->name, NULL);
+			if (error)
+				goto out;
+		}
+	}
+
+	error = cgroup_get_cgroup_selective(live);
+	if (error)
+		goto out;
+
+	for (i = 0; i < cgroup->index; i++) {
+		cgc = cgroup->controller[i];
+		live_cgc = live->controller[i];
+		diff_cgc = NULL;
+
+		for (j = 0; j < cgc->index; j++) {
+			cv = cgc->values[j];
+			live_cv = live_cgc->values[j];
+
+			/* A multiline value cannot be compared with what is read */
+			if (!cv->multiline_value && !strcmp(cv->value, live_cv->value))
+				continue;
+
+			cgroup_dbg("%s: %s changed from %s to %s\n", cgroup->name, cv->name,
+				   live_cv->value, cv->value);
+
+			if (!diff_cgc) {
+				diff_cgc = cgroup_add_controller(diff, cgc->name);
+				if (!diff_cgc) {
+					error = ECGINVAL;
+					goto out;
+				}
+			}
+
+			error = cgroup_add_value_string(diff_cgc, cv->name, cv->multiline_value ?
+							cv->multiline_value : cv->value);
+			if (error)
+				goto out;
+		}
+	}
+
+out:
+	cgroup_free(&live);
+
+	return error;
+}
+
+/**
+ * Bring a live group in line with its configuration.  A missing group is
+ * created, and only the settings that differ are written to an existing one.
+ * If its owners or permissions changed, the group is set up again like by
+ * cgroup_config_load_config().
+ */
+static int cg_config_reload_group(struct cgroup * const cgroup)
+{
+	struct cgroup *diff;
+	bool changed;
+	int error;
+
+	error = cg_config_stat_group(cgroup, &changed);
+	if (error == ECGROUPNOTEXIST || (!error && changed)) {
+		cgroup_dbg("%s %s\n", error ? "creating" : "setting up", cgroup->name);
+		return cg_config_create_group(cgroup);
+	}
+	if (error)
+		return error;
+
+	diff = cgroup_new_cgroup(cgroup->name);
+	if (!diff)
+		return ECGROUPNOTCREATED;
+
+	error = cg_config_diff_group(cgroup, diff);
+	if (error == ECGROUPVALUENOTEXIST) {
+		/* The settings may be for the other cgroup version, convert them */
+		error = cg_config_create_group(cgroup);
+	} else if (!error && diff->index) {
+		error = cgroup_modify_cgroup(diff);
+	}
+
+	cgroup_free(&diff);
+
+	return error;
+}
+
+int cgroup_config_reload_config(const char *pathname)
+{
+	int namespace_enabled = 0;
+	int mount_enabled = 0;
+	int error = 0;
+	int ret, i;
+
+	ret = cgroup_parse_config(pathname);
+	if (ret != 0)
+		return ret;
+
+	namespace_enabled = (config_namespace_table[0].name[0] != '\0');
+	mount_enabled = (config_mount_table[0].name[0] != '\0');
+
+	/* The configuration should have namespace or mount, not both. */
+	if (namespace_enabled && mount_enabled) {
+		error = ECGMOUNTNAMESPACE;
+		goto out;
+	}
+
+	/* Only the hierarchies that are not mounted yet are mounted */
+	cgroup_init();
+	error = cgroup_config_mount_fs(true);
+	if (error)
+		goto out;
+
+	error = cgroup_init();
+	if (error == ECGROUPNOTMOUNTED && cgroup_table_index == 0) {
+		/* The config file seems to be empty. */
+		error = 0;
+		goto out;
+	}
+	if (error)
+		goto out;
+
+	error = config_order_namespace_table();
+	if (error)
+		goto out;
+
+	error = config_validate_namespaces();
+	if (error)
+		goto out;
+
+	cgroup_config_apply_default();
+
+	/* The parents come first, and every group is tried */
+	cgroup_config_sort_groups();
+	for (i = 0; i < cgroup_table_index; i++) {
+		ret = cg_config_reload_group(config_cgroup_table[i]);
+		if (ret) {
+			cgroup_warn("cannot reload group %s: %s\n", config_cgroup_table[i]->name,
+				    cgroup_strerror(ret));
+			if (!error)
+				error = ret;
+		}
+	}
+
+out:
+	cgroup_free_config();
+
+	return error;
+}
+
 /* unmounts given mount, but only if it is empty */
 static int cgroup_config_try_unmount(struct cg_mount_table_s *mount_info)
 {
@@ -1345,6 +1949,12 @@ static int cgroup_config_try_unmount(struct cg_mount_table_s *mount_info)
 	if (ret)
 		return ret;
 
+	ret = cgroup_walk_tree_set_flags(&handle, CGROUP_WALK_TYPE_DIRS_ONLY);
+	if (ret) {
+		cgroup_walk_tree_end(&handle);
+		return ret;
+	}
+
 	/* skip the first found directory, it's '/' */
 	ret = cgroup_walk_tree_next(0, &handle, &info, lvl);
 	/* find any other subdirectory */
@@ -1395,7 +2005,7 @@ int cgroup_config_unload_config(const char *pathname, int flags)
 	mount_enabled = (config_mount_table[0].name[0] != '\0');
 	/* The configuration should have namespace or mount, not both. */
 	if (namespace_enabled && mount_enabled) {
-		free(config_cgroup_table);
+		cgroup_free_config();
 		return ECGMOUNTNAMESPACE;
 	}
 
@@ -1410,7 +2020,7 @@ int cgroup_config_unload_config(const char *pathname, int flags)
 	/* Delete the groups in reverse order, i.e. subgroups first, then parents. */
 	cgroup_config_sort_groups();
 	for (i = cgroup_table_index-1; i >= 0; i--) {
-		struct cgroup *cgroup = &config_cgroup_table[i];
+		struct cgroup *cgroup = config_cgroup_table[i];
 
 		cgroup_dbg("removing %s\n", pathname);
 		error = cgroup_delete_cgroup_ext(cgroup, flags);
@@ -1421,7 +2031,7 @@ int cgroup_config_unload_config(const char *pathname, int flags)
 
 	/* Delete templates */
 	for (i = 0; i < config_template_table_index; i++) {
-		struct cgroup *cgroup = &config_template_table[i];
+		struct cgroup *cgroup = config_template_table[i];
 
 		cgroup_dbg("removing %s\n", pathname);
 		error = cgroup_delete_cgroup_ext(cgroup, flags);
@@ -1561,7 +2171,7 @@ out_errno:
  */
 int cgroup_config_define_default(void)
 {
-	struct cgroup *config_cgroup = &config_cgroup_table[cgroup_table_index];
+	struct cgroup *config_cgroup = config_cgroup_table[cgroup_table_index];
 
 	init_cgroup_table(&default_group, 1);
 	if (config_cgroup->control_dperm != NO_PERMS)
@@ -1607,6 +2217,117 @@ int cgroup_config_set_default(struct cgroup *new_default)
 	return 0;
 }
 
+int cgroup_config_set_jobs(int jobs)
+{
+	if (jobs < 1)
+		return ECGINVAL;
+
+	config_jobs = jobs;
+
+	return 0;
+}
+
+int cgroup_config_set_io_uring(int enable)
+{
+#ifdef WITH_IO_URING
+	config_io_uring = enable;
+
+	return 0;
+#else
+	return enable ? ECGROUPUNSUPP : 0;
+#endif
+}
+
+/**
+ * Drop the name index of template_table, and the groups already created from
+ * the previous templates unless they are reloaded for a group being created.
+ */
+static void cg_template_table_changed(void)
+{
+	free(template_buckets);
+	free(template_next);
+	template_buckets = NULL;
+	template_next = NULL;
+	template_bucket_cnt = 0;
+
+	if (!template_implicit_load)
+		cg_template_cache_invalidate();
+}
+
+static unsigned int cg_template_hash(const char * const name)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, name);
+}
+
+/**
+ * Build the name index of template_table.
+ * @return 0 on success, ECGOTHER if the allocation failed
+ */
+static int cg_template_index_build(void)
+{
+	unsigned int cnt = 16, bucket;
+	int i;
+
+	while (cnt < 2 * (unsigned int)template_table_index)
+		cnt *= 2;
+
+	template_buckets = malloc(cnt * sizeof(int));
+	template_next = malloc(template_table_index * sizeof(int));
+	if (!template_buckets || !template_next) {
+		last_errno = errno;
+		free(template_buckets);
+		free(template_next);
+		template_buckets = NULL;
+		template_next = NULL;
+		return ECGOTHER;
+	}
+
+	memset(template_buckets, -1, cnt * sizeof(int));
+	template_bucket_cnt = cnt;
+
+	/* Inserted backwards, each chain is in the order of the table */
+	for (i = template_table_index - 1; i >= 0; i--) {
+		bucket = cg_template_hash(template_table[i].name) & (cnt - 1);
+		template_next[i] = template_buckets[bucket];
+		template_buckets[bucket] = i;
+	}
+
+	return 0;
+}
+
+/**
+ * Find the next template of a name in template_table.  Without the index,
+ * e.g. when it could not be allocated, the table is scanned.
+ * @param name Name of the template
+ * @param prev The previous template found, -1 to find the first one
+ * @return The index of the template, -1 if there is no more
+ */
+static int cg_template_lookup(const char * const name, int prev)
+{
+	int i;
+
+	if (!template_table_index)
+		return -1;
+
+	if (prev < 0 && !template_buckets)
+		cg_template_index_build();
+
+	if (prev >= 0)
+		i = template_buckets ? template_next[prev] : prev + 1;
+	else if (template_buckets)
+		i = template_buckets[cg_template_hash(name) & (template_bucket_cnt - 1)];
+	else
+		i = 0;
+
+	while (i >= 0 && i < template_table_index) {
+		if (!strcmp(template_table[i].name, name))
+			return i;
+		i = template_buckets ? template_next[i] : i + 1;
+	}
+
+	return -1;
+}
+
 /**
  * Reloads the templates list, using the given configuration file.
  *	@return 0 on success, > 0 on failure
@@ -1625,6 +2346,7 @@ int cgroup_reload_cached_templates(char *pathname)
 		template_table = NULL;
 	}
 	template_table_index = 0;
+	cg_template_table_changed();
 
 	if ((config_template_table_index != 0) || (config_table_index != 0)) {
 		/* config template structures have to be free as well*/
@@ -1648,15 +2370,15 @@ int cgroup_reload_cached_templates(char *pathname)
 	}
 
 	for (i = 0; i < template_table_index; i++) {
-		cgroup_copy_cgroup(&template_table[i], &config_template_table[i]);
-		strcpy((template_table[i]).name, (config_template_table[i]).name);
-		template_table[i].tasks_uid = config_template_table[i].tasks_uid;
-		template_table[i].tasks_gid = config_template_table[i].tasks_gid;
-		template_table[i].task_fperm = config_template_table[i].task_fperm;
-		template_table[i].control_uid =	config_template_table[i].control_uid;
-		template_table[i].control_gid =	config_template_table[i].control_gid;
-		template_table[i].control_fperm = config_template_table[i].control_fperm;
-		template_table[i].control_dperm = config_template_table[i].control_dperm;
+		cgroup_copy_cgroup(&template_table[i], config_template_table[i]);
+		strcpy((template_table[i]).name, config_template_table[i]->name);
+		template_table[i].tasks_uid = config_template_table[i]->tasks_uid;
+		template_table[i].tasks_gid = config_template_table[i]->tasks_gid;
+		template_table[i].task_fperm = config_template_table[i]->task_fperm;
+		template_table[i].control_uid =	config_template_table[i]->control_uid;
+		template_table[i].control_gid =	config_template_table[i]->control_gid;
+		template_table[i].control_fperm = config_template_table[i]->control_fperm;
+		template_table[i].control_dperm = config_template_table[i]->control_dperm;
 	}
 
 	return ret;
@@ -1680,6 +2402,7 @@ int cgroup_init_templates_cache(char *pathname)
 		template_table = NULL;
 	}
 	template_table_index = 0;
+	cg_template_table_changed();
 
 	if ((config_template_table_index != 0) || (config_table_index != 0)) {
 		/* config structures have to be clean */
@@ -1703,15 +2426,15 @@ int cgroup_init_templates_cache(char *pathname)
 	}
 
 	for (i = 0; i < template_table_index; i++) {
-		cgroup_copy_cgroup(&template_table[i], &config_template_table[i]);
-		strcpy((template_table[i]).name, (config_template_table[i]).name);
-		template_table[i].tasks_uid = config_template_table[i].tasks_uid;
-		template_table[i].tasks_gid = config_template_table[i].tasks_gid;
-		template_table[i].task_fperm = config_template_table[i].task_fperm;
-		template_table[i].control_uid =	config_template_table[i].control_uid;
-		template_table[i].control_gid =	config_template_table[i].control_gid;
-		template_table[i].control_fperm = config_template_table[i].control_fperm;
-		template_table[i].control_dperm = config_template_table[i].control_dperm;
+		cgroup_copy_cgroup(&template_table[i], config_template_table[i]);
+		strcpy((template_table[i]).name, config_template_table[i]->name);
+		template_table[i].tasks_uid = config_template_table[i]->tasks_uid;
+		template_table[i].tasks_gid = config_template_table[i]->tasks_gid;
+		template_table[i].task_fperm = config_template_table[i]->task_fperm;
+		template_table[i].control_uid =	config_template_table[i]->control_uid;
+		template_table[i].control_gid =	config_template_table[i]->control_gid;
+		template_table[i].control_fperm = config_template_table[i]->control_fperm;
+		template_table[i].control_dperm = config_template_table[i]->control_dperm;
 	}
 
 	return ret;
@@ -1737,18 +2460,18 @@ int cgroup_add_cgroup_templates(int offset)
 
 	for (i = 0; i < config_template_table_index; i++) {
 		ti = i + offset;
-		ret = cgroup_copy_cgroup(&template_table[ti], &config_template_table[i]);
+		ret = cgroup_copy_cgroup(&template_table[ti], config_template_table[i]);
 		if (ret)
 			return ret;
 
-		strcpy((template_table[ti]).name, (config_template_table[i]).name);
-		template_table[ti].tasks_uid = config_template_table[i].tasks_uid;
-		template_table[ti].tasks_gid = config_template_table[i].tasks_gid;
-		template_table[ti].task_fperm =	config_template_table[i].task_fperm;
-		template_table[ti].control_uid = config_template_table[i].control_uid;
-		template_table[ti].control_gid = config_template_table[i].control_gid;
-		template_table[ti].control_fperm = config_template_table[i].control_fperm;
-		template_table[ti].control_dperm = config_template_table[i].control_dperm;
+		strcpy((template_table[ti]).name, config_template_table[i]->name);
+		template_table[ti].tasks_uid = config_template_table[i]->tasks_uid;
+		template_table[ti].tasks_gid = config_template_table[i]->tasks_gid;
+		template_table[ti].task_fperm =	config_template_table[i]->task_fperm;
+		template_table[ti].control_uid = config_template_table[i]->control_uid;
+		template_table[ti].control_gid = config_template_table[i]->control_gid;
+		template_table[ti].control_fperm = config_template_table[i]->control_fperm;
+		template_table[ti].control_dperm = config_template_table[i]->control_dperm;
 	}
 
 	return 0;
@@ -1770,10 +2493,15 @@ int cgroup_expand_template_table(void)
 	if (template_table == NULL)
 		return -ECGOTHER;
 
-	for (i = 0; i < config_template_table_index; i++)
+	for (i = 0; i < config_template_table_index; i++) {
 		template_table[i + template_table_index].index = 0;
+		template_table[i + template_table_index].controller = NULL;
+		template_table[i + template_table_index].controller_alloc = 0;
+		template_table[i + template_table_index].arena = NULL;
+	}
 
 	template_table_index += config_template_table_index;
+	cg_template_table_changed();
 
 	return 0;
 }
@@ -1813,6 +2541,7 @@ int cgroup_load_templates_cache_from_files(int *file_index)
 		template_table = NULL;
 	}
 	template_table_index = 0;
+	cg_template_table_changed();
 
 	if ((config_template_table_index != 0) || (config_table_index != 0)) {
 		/* config structures have to be clean before parsing */
@@ -1879,8 +2608,10 @@ int cgroup_config_create_template_group(struct cgroup *cgroup, char *template_na
 		int fileindex;
 
 		/* the rules cache is empty */
+		template_implicit_load = true;
 		ret = cgroup_load_templates_cache_from_files(
 			&fileindex);
+		template_implicit_load = false;
 		if (ret != 0) {
 			if (fileindex < 0) {
 				cgroup_dbg("Template source files have not been set\n");
@@ -1904,13 +2635,10 @@ int cgroup_config_create_template_group(struct cgroup *cgroup, char *template_na
 
 		found = 0;
 		/* look for relevant template - test name x controller pair */
-		for (j = 0; j < template_table_index; j++) {
+		for (j = cg_template_lookup(template_name, -1); j >= 0 && !found;
+		     j = cg_template_lookup(template_name, j)) {
 
 			t_cgroup = &template_table[j];
-			if (strcmp(t_cgroup->name, template_name) != 0) {
-				/* template name does not match skip template */
-				continue;
-			}
 
 			/* template name match */
 			for (k = 0; t_cgroup->controller[k] != NULL; k++) {
@@ -1937,13 +2665,11 @@ int cgroup_config_create_template_group(struct cgroup *cgroup, char *template_na
 					cgroup_dbg("creating group %s, error %d\n", cgroup->name,
 						   ret);
 					goto end;
-				} else {
-					/* go to new controller */
-					j = template_table_index;
-					found = 1;
-					continue;
 				}
 
+				/* go to new controller */
+				found = 1;
+				break;
 			}
 		}
 
@@ -2130,10 +2856,23 @@ out:
 	return ret;
 }
 
+static void config_scope_created(struct cgroup_systemd_bus *bus, const char *scope_name,
+				 int result, void *userdata)
+{
+	int *failed = userdata;
+
+	if (result) {
+		cgroup_err("Failed to create systemd scope %s: %s\n", scope_name,
+			   cgroup_strerror(result));
+		(*failed)++;
+	}
+}
+
 /**
  * Create the systemd slice and scope. The slice/scope are parsed and available in
  * the cgroup_systemd_opts_head list. This function skips the slice and scope creation
- * if previously created.
+ * if previously created.  The scopes are all queued on one connection to systemd and
+ * created concurrently.
  *
  * Returns 1 on success and 0 on failure.
  */
@@ -2141,6 +2880,8 @@ static int config_create_slice_scope(char * const tmp_systemd_default_cgroup)
 {
 	struct cgroup_systemd_opts *curr, *def = NULL;
 	struct cgroup_systemd_scope_opts scope_opts;
+	struct cgroup_systemd_bus *bus = NULL;
+	int failed = 0;
 	int ret = 0;
 
 	if (!tmp_systemd_default_cgroup)
@@ -2155,6 +2896,12 @@ static int config_create_slice_scope(char * const tmp_systemd_default_cgroup)
 	if (!ret)
 		return 0;
 
+	if (cgroup_systemd_opts_head) {
+		bus = cgroup_systemd_bus_open();
+		if (!bus)
+			return 0;
+	}
+
 	for (curr = cgroup_systemd_opts_head; curr; curr = curr->next) {
 
 		if (!strlen(curr->slice_name)) {
@@ -2174,14 +2921,24 @@ static int config_create_slice_scope(char * const tmp_systemd_default_cgroup)
 		if (curr->pid)
 			scope_opts.pid = curr->pid;
 
-		ret = cgroup_create_scope(curr->scope_name, curr->slice_name, &scope_opts);
+		ret = cgroup_create_scope_async(bus, curr->scope_name, curr->slice_name,
+						&scope_opts, 0, config_scope_created, &failed);
 		if (ret)
 			goto err;
 
-		cgroup_dbg("Created systemd slice %s scope %s default %d pid %d\n",
+		cgroup_dbg("Creating systemd slice %s scope %s default %d pid %d\n",
 			   curr->slice_name, curr->scope_name, curr->setdefault, curr->pid);
 	}
 
+	while (cgroup_systemd_bus_pending(bus) > 0) {
+		if (cgroup_systemd_bus_dispatch(bus, -1))
+			goto err;
+	}
+	cgroup_systemd_bus_close(&bus);
+
+	if (failed)
+		return 0;
+
 	if (def) {
 		if (!cgroup_write_systemd_default_cgroup(def->slice_name, def->scope_name))
 			goto err;
@@ -2196,6 +2953,7 @@ static int config_create_slice_scope(char * const tmp_systemd_default_cgroup)
 
 	return 1;
 err:
+	cgroup_systemd_bus_close(&bus);
 	return 0;
 }
 
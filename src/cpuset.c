@@ -0,0 +1,385 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * CPU and memory node sets
+ *
+ * cpuset.cpus, cpuset.mems and their effective variants are lists of ranges
+ * like "0-63,128-191".  A cgroup_cpuset holds such a list as a bitmap, so
+ * that sets read from many groups are compared a word at a time instead of
+ * by parsing the strings over and over.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <errno.h>
+#include <ctype.h>
+
+#define CG_CPUSET_WORD_BITS	(sizeof(unsigned long) * CHAR_BIT)
+
+/* Higher than any NR_CPUS or MAX_NUMNODES, it bounds the size of a set */
+#define CG_CPUSET_MAX_BITS	(1U << 20)
+
+struct cgroup_cpuset {
+	/* The bits past words * CG_CPUSET_WORD_BITS are all clear */
+	unsigned long *bits;
+	unsigned int words;
+};
+
+struct cgroup_cpuset *cgroup_cpuset_new(void)
+{
+	return calloc(1, sizeof(struct cgroup_cpuset));
+}
+
+void cgroup_cpuset_free(struct cgroup_cpuset **set)
+{
+	if (!set || !*set)
+		return;
+
+	free((*set)->bits);
+	free(*set);
+	*set = NULL;
+}
+
+/* Make room for words words in set, the new words are cleared */
+static int cg_cpuset_grow(struct cgroup_cpuset * const set, unsigned int words)
+{
+	unsigned long *bits;
+
+	if (words <= set->words)
+		return 0;
+
+	bits = realloc(set->bits, words * sizeof(unsigned long));
+	if (!bits) {
+		last_errno = ENOMEM;
+		return ECGOTHER;
+	}
+
+	memset(bits + set->words, 0, (words - set->words) * sizeof(unsigned long));
+	set->bits = bits;
+	set->words = words;
+
+	return 0;
+}
+
+/* Set the bits first to last, the set must be large enough */
+static void cg_cpuset_set_range(struct cgroup_cpuset * const set, unsigned int first,
+				unsigned int last)
+{
+	unsigned int first_word = first / CG_CPUSET_WORD_BITS;
+	unsigned int last_word = last / CG_CPUSET_WORD_BITS;
+	unsigned long first_mask = ~0UL << (first % CG_CPUSET_WORD_BITS);
+	unsigned long last_mask = ~0UL >> (CG_CPUSET_WORD_BITS - 1 - last % CG_CPUSET_WORD_BITS);
+	unsigned int i;
+
+	if (first_word == last_word) {
+		set->bits[first_word] |= first_mask & last_mask;
+		return;
+	}
+
+	set->bits[first_word] |= first_mask;
+	for (i = first_word + 1; i < last_word; i++)
+		set->bits[i] = ~0UL;
+	set->bits[last_word] |= last_mask;
+}
+
+/*
+ * Index of the first bit from from on that is set, or clear if value is
+ * false.  Past the last word every bit is clear.
+ */
+static unsigned int cg_cpuset_next(const struct cgroup_cpuset * const set, unsigned int from,
+				   bool value)
+{
+	unsigned int i = from / CG_CPUSET_WORD_BITS;
+	unsigned long word;
+
+	if (i >= set->words)
+		return value ? UINT_MAX : from;
+
+	word = value ? set->bits[i] : ~set->bits[i];
+	word &= ~0UL << (from % CG_CPUSET_WORD_BITS);
+
+	while (!word) {
+		if (++i >= set->words)
+			return value ? UINT_MAX : i * CG_CPUSET_WORD_BITS;
+		word = value ? set->bits[i] : ~set->bits[i];
+	}
+
+	return i * CG_CPUSET_WORD_BITS + __builtin_ctzl(word);
+}
+
+static int cg_cpuset_parse_number(const char **str, unsigned int * const value)
+{
+	unsigned long n = 0;
+	const char *c = *str;
+
+	if (!isdigit((unsigned char)*c))
+		return ECGINVAL;
+
+	for (; isdigit((unsigned char)*c); c++) {
+		n = n * 10 + (*c - '0');
+		if (n >= CG_CPUSET_MAX_BITS)
+			return ECGINVAL;
+	}
+
+	*value = n;
+	*str = c;
+
+	return 0;
+}
+
+int cgroup_cpuset_parse(struct cgroup_cpuset *set, const char *list)
+{
+	unsigned int first, last;
+	const char *c;
+	int ret;
+
+	if (!set || !list)
+		return ECGINVAL;
+
+	cgroup_cpuset_zero(set);
+
+	/* The files end with a newline, an empty set is an empty line */
+	for (c = list; *c && *c != '\n'; ) {
+		ret = cg_cpuset_parse_number(&c, &first);
+		if (ret)
+			return ret;
+
+		last = first;
+		if (*c == '-') {
+			c++;
+			ret = cg_cpuset_parse_number(&c, &last);
+			if (ret)
+				return ret;
+			if (last < first)
+				return ECGINVAL;
+		}
+
+		ret = cg_cpuset_grow(set, last / CG_CPUSET_WORD_BITS + 1);
+		if (ret)
+			return ret;
+		cg_cpuset_set_range(set, first, last);
+
+		if (*c == ',')
+			c++;
+		else if (*c && *c != '\n')
+			return ECGINVAL;
+	}
+
+	return 0;
+}
+
+/* Like snprintf(), returns the length of the whole list */
+static size_t cg_cpuset_format(const struct cgroup_cpuset * const set, char * const buf,
+			       size_t size)
+{
+	unsigned int first, last;
+	size_t len = 0;
+	int ret;
+
+	if (size)
+		buf[0] = '\0';
+
+	for (first = cg_cpuset_next(set, 0, true); first != UINT_MAX;
+	     first = cg_cpuset_next(set, last + 1, true)) {
+		last = cg_cpuset_next(set, first, false) - 1;
+
+		if (first == last)
+			ret = snprintf(buf + len, len < size ? size - len : 0, "%s%u",
+				       len ? "," : "", first);
+		else
+			ret = snprintf(buf + len, len < size ? size - len : 0, "%s%u-%u",
+				       len ? "," : "", first, last);
+		len += ret;
+	}
+
+	return len;
+}
+
+int cgroup_cpuset_format(const struct cgroup_cpuset *set, char *buf, size_t size)
+{
+	if (!set || !buf || !size)
+		return ECGINVAL;
+
+	if (cg_cpuset_format(set, buf, size) >= size)
+		return ECGINVAL;
+
+	return 0;
+}
+
+void cgroup_cpuset_zero(struct cgroup_cpuset *set)
+{
+	if (set && set->words)
+		memset(set->bits, 0, set->words * sizeof(unsigned long));
+}
+
+int cgroup_cpuset_set(struct cgroup_cpuset *set, unsigned int cpu)
+{
+	int ret;
+
+	if (!set || cpu >= CG_CPUSET_MAX_BITS)
+		return ECGINVAL;
+
+	ret = cg_cpuset_grow(set, cpu / CG_CPUSET_WORD_BITS + 1);
+	if (ret)
+		return ret;
+
+	set->bits[cpu / CG_CPUSET_WORD_BITS] |= 1UL << (cpu % CG_CPUSET_WORD_BITS);
+
+	return 0;
+}
+
+bool cgroup_cpuset_isset(const struct cgroup_cpuset *set, unsigned int cpu)
+{
+	if (!set || cpu / CG_CPUSET_WORD_BITS >= set->words)
+		return false;
+
+	return set->bits[cpu / CG_CPUSET_WORD_BITS] & (1UL << (cpu % CG_CPUSET_WORD_BITS));
+}
+
+unsigned int cgroup_cpuset_count(const struct cgroup_cpuset *set)
+{
+	unsigned int count = 0;
+	unsigned int i;
+
+	if (!set)
+		return 0;
+
+	for (i = 0; i < set->words; i++)
+		count += __builtin_popcountl(set->bits[i]);
+
+	return count;
+}
+
+int cgroup_cpuset_and(struct cgroup_cpuset *dst, const struct cgroup_cpuset *a,
+		      const struct cgroup_cpuset *b)
+{
+	unsigned int words, i;
+	int ret;
+
+	if (!dst || !a || !b)
+		return ECGINVAL;
+
+	words = a->words < b->words ? a->words : b->words;
+	ret = cg_cpuset_grow(dst, words);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < words; i++)
+		dst->bits[i] = a->bits[i] & b->bits[i];
+	for (; i < dst->words; i++)
+		dst->bits[i] = 0;
+
+	return 0;
+}
+
+int cgroup_cpuset_or(struct cgroup_cpuset *dst, const struct cgroup_cpuset *a,
+		     const struct cgroup_cpuset *b)
+{
+	const struct cgroup_cpuset *longer;
+	unsigned int words, i;
+	int ret;
+
+	if (!dst || !a || !b)
+		return ECGINVAL;
+
+	if (a->words < b->words) {
+		words = a->words;
+		longer = b;
+	} else {
+		words = b->words;
+		longer = a;
+	}
+
+	/* dst may be a or b, grow it before reading them */
+	ret = cg_cpuset_grow(dst, longer->words);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < words; i++)
+		dst->bits[i] = a->bits[i] | b->bits[i];
+	for (; i < longer->words; i++)
+		dst->bits[i] = longer->bits[i];
+	for (; i < dst->words; i++)
+		dst->bits[i] = 0;
+
+	return 0;
+}
+
+bool cgroup_cpuset_intersects(const struct cgroup_cpuset *a, const struct cgroup_cpuset *b)
+{
+	unsigned int words, i;
+
+	if (!a || !b)
+		return false;
+
+	words = a->words < b->words ? a->words : b->words;
+	for (i = 0; i < words; i++) {
+		if (a->bits[i] & b->bits[i])
+			return true;
+	}
+
+	return false;
+}
+
+bool cgroup_cpuset_equal(const struct cgroup_cpuset *a, const struct cgroup_cpuset *b)
+{
+	const struct cgroup_cpuset *longer;
+	unsigned int words, i;
+
+	if (!a || !b)
+		return a == b;
+
+	if (a->words < b->words) {
+		words = a->words;
+		longer = b;
+	} else {
+		words = b->words;
+		longer = a;
+	}
+
+	if (words && memcmp(a->bits, b->bits, words * sizeof(unsigned long)))
+		return false;
+
+	for (i = words; i < longer->words; i++) {
+		if (longer->bits[i])
+			return false;
+	}
+
+	return true;
+}
+
+int cgroup_get_value_cpuset(struct cgroup_controller *controller, const char *name,
+			    struct cgroup_cpuset *set)
+{
+	int i;
+
+	if (!controller || !name || !set)
+		return ECGINVAL;
+
+	for (i = 0; i < controller->index; i++) {
+		struct control_value *val = controller->values[i];
+
+		if (!strcmp(val->name, name))
+			return cgroup_cpuset_parse(set, val->value);
+	}
+
+	return ECGROUPVALUENOTEXIST;
+}
+
+int cgroup_set_value_cpuset(struct cgroup_controller *controller, const char *name,
+			    const struct cgroup_cpuset *set)
+{
+	char buf[CG_CONTROL_VALUE_MAX];
+
+	if (!controller || !name || !set)
+		return ECGINVAL;
+
+	if (cg_cpuset_format(set, buf, sizeof(buf)) >= sizeof(buf))
+		return ECGINVAL;
+
+	return cgroup_set_value_string(controller, name, buf);
+}
@@ -29,6 +29,7 @@
 #include "cgrulesengd.h"
 #include "libcgroup.h"
 
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
@@ -36,15 +37,22 @@
 #include <syslog.h>
 #include <getopt.h>
 #include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <time.h>
 
 #include <pwd.h>
 #include <grp.h>
 
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
 #include <sys/socket.h>
 #include <sys/syslog.h>
+#include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -53,7 +61,29 @@
 #include <linux/netlink.h>
 #include <linux/un.h>
 
-#define NUM_PER_REALLOCATIOM	(100)
+/* Initial number of entries of the PID tables and the parent ring */
+#define CGRE_PID_TABLE_SIZE	(256)
+#define CGRE_PARENT_RING_SIZE	(256)
+
+/* Events returned by one epoll_wait() of the main loop */
+#define CGRE_EPOLL_EVENTS	(8)
+
+/* The signals handled by the main loop, blocked and read from a signalfd */
+static sigset_t cgre_signals;
+
+/* Changes of the rules files watched by inotify */
+#define CGRE_RULES_EVENTS	(IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | \
+				 IN_CREATE)
+
+/* Reload the rules when their files change, see cgre_watch_rules() */
+static int watch_rules;
+
+/* Watches of the directory of CGRULES_CONF_FILE and of CGRULES_CONF_DIR, or -1 */
+static int rules_parent_wd = -1;
+static int rules_dir_wd = -1;
+
+/* CGRULES_CONF_DIR is in the directory of CGRULES_CONF_FILE */
+static int rules_dir_in_parent;
 
 /* list of config files from CGCONFIG_CONF_FILE and CGCONFIG_CONF_DIR */
 static struct cgroup_string_list template_files;
@@ -73,6 +103,48 @@ uid_t socket_user = -1;
 /* Owner of the socket, -1 means no change */
 gid_t socket_group = -1;
 
+/* Size of the netlink socket receive buffer, 0 keeps the system default */
+static int netlink_rcvbuf = CGRE_NETLINK_RCVBUF;
+
+/*
+ * Events received from the netlink socket, waiting to be classified.
+ * The socket is drained into the ring first, so that the kernel does not
+ * drop messages while the daemon is busy reading /proc and writing cgroups.
+ */
+struct cgre_event_ring {
+	struct proc_event events[CGRE_EVENT_RING_SIZE];
+	unsigned int head;
+	unsigned int count;
+};
+
+static struct cgre_event_ring event_ring;
+
+/*
+ * Classification thread. The main thread dispatches the events of a PID
+ * always to the same worker, so the events of one process are handled in
+ * the order they were received.
+ */
+struct cgre_worker {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	/* Signalled when an event is queued */
+	pthread_cond_t more;
+	/* Signalled when an event is taken off the queue or it got idle */
+	pthread_cond_t space;
+	struct proc_event events[CGRE_WORKER_QUEUE_SIZE];
+	unsigned int head;
+	unsigned int count;
+	int busy;
+};
+
+/* Number of classification threads, 1 classifies in the main thread */
+static unsigned int worker_cnt = 1;
+
+static struct cgre_worker *workers;
+
+/* Recording fed to the classification by --replay, NULL otherwise */
+STATIC struct cgre_trace *replay_trace;
+
 /**
  * Prints the usage information for this program and, optionally, an error
  * message.  This function uses vfprintf.
@@ -105,6 +177,28 @@ static void usage(FILE *fd, const char *msg, ...)
 	fprintf(fd, " " CGRULE_CGRED_SOCKET_PATH " socket user\n");
 	fprintf(fd, "    -g <group>   | --socket-group=<group> set");
 	fprintf(fd, " "	CGRULE_CGRED_SOCKET_PATH " socket group\n");
+	fprintf(fd, "    -t <sec>     | --group-cache-ttl=<sec> cache group");
+	fprintf(fd, " members for <sec> seconds, 0 disables the cache\n");
+	fprintf(fd, "    -b <bytes>   | --rcvbuf=<bytes>	  set the netlink");
+	fprintf(fd, " socket receive buffer size\n");
+	fprintf(fd, "    -T <n>       | --threads=<n>\t  classify the");
+	fprintf(fd, " events in <n> threads\n");
+	fprintf(fd, "    -a           | --async-log\t\t  write the log");
+	fprintf(fd, " from a separate thread\n");
+	fprintf(fd, "    -F           | --no-event-filter\t  receive all the");
+	fprintf(fd, " events of the kernel\n");
+	fprintf(fd, "    -c <ms>      | --coalesce=<ms>\t  merge the events");
+	fprintf(fd, " of a process for <ms> milliseconds\n");
+	fprintf(fd, "    -w           | --watch-rules\t  reload the rules");
+	fprintf(fd, " when their files change\n");
+	fprintf(fd, "    -r <path>    | --record=<path>\t  record the events");
+	fprintf(fd, " to <path>\n");
+	fprintf(fd, "    -R <path>    | --replay=<path>\t  classify the");
+	fprintf(fd, " events recorded to <path> and exit\n");
+	fprintf(fd, "    --replay-speed=original|max\t  replay at the");
+	fprintf(fd, " pace of the recording or as fast as possible\n");
+	fprintf(fd, "    -S           | --stats\t\t  print the statistics");
+	fprintf(fd, " of the running daemon\n");
 	fprintf(fd, "    -h           | --help\t\t  show this help\n\n");
 	va_end(ap);
 }
@@ -126,6 +220,9 @@ void flog_write(int level, const char *format,  va_list ap)
 	if (level > loglevel)
 		return;
 
+	if (cgre_log_async_queue(level, format, ap) == 0)
+		return;
+
 	/* copy the argument list if needed - it can be processed only once */
 	if (logfile && logfacility) {
 		copy = 1;
@@ -195,186 +292,488 @@ void flog_cgroup(void *userdata, int cgroup_level, const char *format, va_list a
 	flog_write(level, format, ap);
 }
 
-struct parent_info {
-	__u64 timestamp;
+/*
+ * Open addressing hash table of PIDs. The entries live in the table
+ * itself, one allocation per table instead of one per PID, and the
+ * removed entries are left as tombstones until the next rehash.
+ */
+#define CGRE_PID_EMPTY		(0)
+#define CGRE_PID_DELETED	(-1)
+
+struct cgre_pid_entry {
 	pid_t pid;
+	int value;
 };
 
-struct array_parent_info {
-	int index;
-	int num_allocation;
-	struct parent_info **parent_info;
+struct cgre_pid_table {
+	struct cgre_pid_entry *entries;
+	/* Always a power of two */
+	unsigned int size;
+	/* Live entries and tombstones */
+	unsigned int used;
+	unsigned int live;
 };
 
-struct array_parent_info array_pi;
+static unsigned int cgre_pid_hash(const struct cgre_pid_table * const table, pid_t pid)
+{
+	return ((unsigned int)pid * 2654435761U) & (table->size - 1);
+}
 
-static int cgre_store_parent_info(pid_t pid)
+static struct cgre_pid_entry *cgre_pid_table_find(const struct cgre_pid_table * const table,
+						  pid_t pid)
 {
-	struct parent_info *info;
-	struct timespec tp;
-	__u64 uptime_ns;
+	struct cgre_pid_entry *entry;
+	unsigned int i;
+
+	if (!table->live)
+		return NULL;
+
+	for (i = cgre_pid_hash(table, pid);; i = (i + 1) & (table->size - 1)) {
+		entry = &table->entries[i];
+		if (entry->pid == pid)
+			return entry;
+		if (entry->pid == CGRE_PID_EMPTY)
+			return NULL;
+	}
+}
 
-	if (clock_gettime(CLOCK_MONOTONIC, &tp) < 0) {
-		flog(LOG_WARNING, "Failed to get time\n");
+static int cgre_pid_table_rehash(struct cgre_pid_table * const table, unsigned int size)
+{
+	struct cgre_pid_entry *old = table->entries;
+	unsigned int old_size = table->size;
+	struct cgre_pid_entry *entry;
+	unsigned int i, j;
+
+	table->entries = calloc(size, sizeof(struct cgre_pid_entry));
+	if (!table->entries) {
+		table->entries = old;
+		flog(LOG_WARNING, "Failed to allocate memory\n");
 		return 1;
 	}
-	uptime_ns = ((__u64)tp.tv_sec * 1000 * 1000 * 1000) + tp.tv_nsec;
+	table->size = size;
+	table->used = table->live;
 
-	if (array_pi.index >= array_pi.num_allocation) {
-		int alloc = array_pi.num_allocation + NUM_PER_REALLOCATIOM;
-		void *new_array = realloc(array_pi.parent_info, sizeof(info) * alloc);
+	for (i = 0; i < old_size; i++) {
+		if (old[i].pid == CGRE_PID_EMPTY || old[i].pid == CGRE_PID_DELETED)
+			continue;
 
-		if (!new_array) {
-			flog(LOG_WARNING, "Failed to allocate memory\n");
-			return 1;
+		for (j = cgre_pid_hash(table, old[i].pid);; j = (j + 1) & (size - 1)) {
+			entry = &table->entries[j];
+			if (entry->pid == CGRE_PID_EMPTY)
+				break;
+		}
+		*entry = old[i];
+	}
+	free(old);
+
+	return 0;
+}
+
+/**
+ * Find the entry of a PID, add it with value 0 if it is not in the table.
+ *	@param table The table
+ *	@param pid The PID
+ *	@return The entry, NULL on allocation failure
+ */
+static struct cgre_pid_entry *cgre_pid_table_insert(struct cgre_pid_table * const table,
+						    pid_t pid)
+{
+	struct cgre_pid_entry *entry, *tombstone = NULL;
+	unsigned int i, size;
+
+	entry = cgre_pid_table_find(table, pid);
+	if (entry)
+		return entry;
+
+	/* Keep the load, tombstones included, under 3/4 */
+	if ((table->used + 1) * 4 > table->size * 3) {
+		size = table->size ? table->size : CGRE_PID_TABLE_SIZE;
+		if ((table->live + 1) * 2 > size)
+			size *= 2;
+		if (cgre_pid_table_rehash(table, size))
+			return NULL;
+	}
+
+	for (i = cgre_pid_hash(table, pid);; i = (i + 1) & (table->size - 1)) {
+		entry = &table->entries[i];
+		if (entry->pid == CGRE_PID_DELETED) {
+			if (!tombstone)
+				tombstone = entry;
+			continue;
 		}
-		array_pi.parent_info = new_array;
-		array_pi.num_allocation = alloc;
+		if (entry->pid == CGRE_PID_EMPTY)
+			break;
 	}
 
-	info = calloc(1, sizeof(struct parent_info));
+	if (tombstone)
+		entry = tombstone;
+	else
+		table->used++;
+	table->live++;
+
+	entry->pid = pid;
+	entry->value = 0;
+
+	return entry;
+}
+
+static void cgre_pid_table_remove(struct cgre_pid_table * const table,
+				  struct cgre_pid_entry * const entry)
+{
+	entry->pid = CGRE_PID_DELETED;
+	table->live--;
+}
+
+struct parent_info {
+	__u64 timestamp;
+	pid_t pid;
+};
+
+/*
+ * The parents whose cgroup was changed, ordered by the time of the change,
+ * so the expired entries are always at the head of the ring. parent_pids
+ * counts the entries of each PID in the ring.
+ */
+struct parent_info_ring {
+	struct parent_info *info;
+	/* Always a power of two */
+	unsigned int size;
+	unsigned int head;
+	unsigned int count;
+	struct cgre_pid_table parent_pids;
+};
+
+static struct parent_info_ring parent_ring;
+
+/* Protects parent_ring against the classification threads */
+static pthread_mutex_t parent_ring_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int cgre_grow_parent_ring(void)
+{
+	unsigned int size = parent_ring.size ? parent_ring.size * 2 : CGRE_PARENT_RING_SIZE;
+	struct parent_info *info;
+	unsigned int i;
+
+	info = malloc(sizeof(struct parent_info) * size);
 	if (!info) {
 		flog(LOG_WARNING, "Failed to allocate memory\n");
 		return 1;
 	}
-	info->timestamp = uptime_ns;
-	info->pid = pid;
 
-	array_pi.parent_info[array_pi.index] = info;
-	array_pi.index++;
+	for (i = 0; i < parent_ring.count; i++)
+		info[i] = parent_ring.info[(parent_ring.head + i) & (parent_ring.size - 1)];
+
+	free(parent_ring.info);
+	parent_ring.info = info;
+	parent_ring.size = size;
+	parent_ring.head = 0;
 
 	return 0;
 }
 
+STATIC int cgre_store_parent_info(pid_t pid)
+{
+	struct cgre_pid_entry *entry;
+	struct parent_info *info;
+	struct timespec tp;
+	int ret = 1;
+
+	pthread_mutex_lock(&parent_ring_lock);
+
+	/* Read the clock under the lock, the ring stays ordered */
+	if (clock_gettime(CLOCK_MONOTONIC, &tp) < 0) {
+		flog(LOG_WARNING, "Failed to get time\n");
+		goto out;
+	}
+
+	if (parent_ring.count == parent_ring.size && cgre_grow_parent_ring())
+		goto out;
+
+	entry = cgre_pid_table_insert(&parent_ring.parent_pids, pid);
+	if (!entry)
+		goto out;
+	entry->value++;
+
+	info = &parent_ring.info[(parent_ring.head + parent_ring.count) & (parent_ring.size - 1)];
+	info->timestamp = ((__u64)tp.tv_sec * 1000 * 1000 * 1000) + tp.tv_nsec;
+	info->pid = pid;
+	parent_ring.count++;
+	ret = 0;
+
+out:
+	pthread_mutex_unlock(&parent_ring_lock);
+
+	return ret;
+}
+
 static void cgre_remove_old_parent_info(__u64 key_timestamp)
 {
-	int i, j;
+	struct cgre_pid_entry *entry;
+	struct parent_info *info;
 
-	for (i = 0; i < array_pi.index; i++) {
-		if (key_timestamp < array_pi.parent_info[i]->timestamp)
-			continue;
+	while (parent_ring.count) {
+		info = &parent_ring.info[parent_ring.head];
+		if (key_timestamp < info->timestamp)
+			break;
 
-		free(array_pi.parent_info[i]);
-		for (j = i; j < array_pi.index - 1; j++)
-			array_pi.parent_info[j] = array_pi.parent_info[j + 1];
-		array_pi.index--;
-		i--;
+		entry = cgre_pid_table_find(&parent_ring.parent_pids, info->pid);
+		if (entry && --entry->value == 0)
+			cgre_pid_table_remove(&parent_ring.parent_pids, entry);
+
+		parent_ring.head = (parent_ring.head + 1) & (parent_ring.size - 1);
+		parent_ring.count--;
 	}
 }
 
-static int cgre_was_parent_changed_when_forking(const struct proc_event *ev)
+/**
+ * Forget the parents changed more than CGRE_PARENT_INFO_TTL seconds ago, no
+ * fork event still queued can be older than them.  Without this, the ring
+ * would only be cleaned by the fork events.
+ */
+static void cgre_expire_parent_info(void)
 {
-	__u64 timestamp_parent;
-	__u64 timestamp_child;
-	pid_t parent_pid;
-	int i;
+	u_int64_t now = cgre_now_ns();
+	u_int64_t ttl = (u_int64_t)CGRE_PARENT_INFO_TTL * 1000 * 1000 * 1000;
 
-	parent_pid = ev->event_data.fork.parent_pid;
-	timestamp_child = ev->timestamp_ns;
+	if (now < ttl)
+		return;
 
-	cgre_remove_old_parent_info(timestamp_child);
+	pthread_mutex_lock(&parent_ring_lock);
+	cgre_remove_old_parent_info(now - ttl);
+	pthread_mutex_unlock(&parent_ring_lock);
+}
 
-	for (i = 0; i < array_pi.index; i++) {
-		if (parent_pid != array_pi.parent_info[i]->pid)
-			continue;
+STATIC int cgre_was_parent_changed_when_forking(const struct proc_event *ev)
+{
+	int ret;
 
-		timestamp_parent = array_pi.parent_info[i]->timestamp;
-		if (timestamp_child > timestamp_parent)
-			continue;
+	pthread_mutex_lock(&parent_ring_lock);
 
-		return 1;
-	}
+	/*
+	 * Once the entries older than the fork are expired, any entry left
+	 * for the parent means its cgroup was changed while forking.
+	 */
+	cgre_remove_old_parent_info(ev->timestamp_ns);
+	ret = cgre_pid_table_find(&parent_ring.parent_pids,
+				  ev->event_data.fork.parent_pid) != NULL;
 
-	return 0;
+	pthread_mutex_unlock(&parent_ring_lock);
+
+	return ret;
 }
 
-struct unchanged_pid {
-	pid_t pid;
-	int flags;
-} unchanged_pid_t;
+/* The processes the daemon must not move, the value are their flags */
+static struct cgre_pid_table unchanged_pids;
 
-struct array_unchanged {
-	int index;
-	int num_allocation;
-	struct unchanged_pid *proc;
-};
+/* Protects unchanged_pids against the classification threads */
+static pthread_rwlock_t unchanged_pids_lock = PTHREAD_RWLOCK_INITIALIZER;
 
-struct array_unchanged array_unch;
+/* unchanged_pids changed since the state was written, under unchanged_pids_lock */
+static int state_dirty;
 
-static int cgre_store_unchanged_process(pid_t pid, int flags)
+/* When the state was written, see cgre_save_state() */
+static u_int64_t state_saved_ns;
+
+/* Fingerprint of the loaded rules, written with the state */
+static u_int64_t rules_fingerprint;
+
+/* Filter the events in the kernel, see filter.c */
+static int event_filter = 1;
+
+/* The netlink socket while its filter is attached, -1 otherwise */
+STATIC int event_filter_sk = -1;
+
+/*
+ * The exit events are only needed to forget the unchanged processes, the
+ * filter passes them while there is any.  Called with unchanged_pids_lock
+ * held for writing when the table becomes empty or not.
+ */
+static void cgre_filter_update(bool exits)
 {
-	int i;
+	if (event_filter_sk >= 0)
+		cgre_filter_attach(event_filter_sk, exits);
+}
 
-	for (i = 0; i < array_unch.index; i++) {
-		if (array_unch.proc[i].pid != pid)
-			continue;
+STATIC int cgre_store_unchanged_process(pid_t pid, int flags)
+{
+	struct cgre_pid_entry *entry;
+	char path[FILENAME_MAX];
+	struct stat buff_stat;
+	bool exits = false;
+	int ret = 1;
+
+	pthread_rwlock_wrlock(&unchanged_pids_lock);
+	if (cgre_pid_table_find(&unchanged_pids, pid)) {
 		/* pid is stored already. */
-		return 0;
+		ret = 0;
+		goto out;
 	}
 
-	if (array_unch.index >= array_unch.num_allocation) {
-		int alloc = array_unch.num_allocation + NUM_PER_REALLOCATIOM;
-		void *new_array = realloc(array_unch.proc, sizeof(unchanged_pid_t) * alloc);
+	/*
+	 * The exits pass the filter before the first process is stored, and
+	 * the process is checked again once they do: one which exited
+	 * meanwhile would stay in the table forever.
+	 */
+	if (!unchanged_pids.live && event_filter_sk >= 0) {
+		cgre_filter_update(true);
+		exits = true;
 
-		if (!new_array) {
-			flog(LOG_WARNING, "Failed to allocate memory\n");
-			return 1;
-		}
-		array_unch.proc = new_array;
-		array_unch.num_allocation = alloc;
+		snprintf(path, sizeof(path), "/proc/%d", pid);
+		if (stat(path, &buff_stat))
+			goto out;
 	}
-	array_unch.proc[array_unch.index].pid = pid;
-	array_unch.proc[array_unch.index].flags = flags;
-	array_unch.index++;
+
+	entry = cgre_pid_table_insert(&unchanged_pids, pid);
+	if (!entry)
+		goto out;
+	entry->value = flags;
+	state_dirty = 1;
+	ret = 0;
 
 	flog(LOG_DEBUG, "Store the unchanged process (PID: %d, FLAGS: %d)\n", pid, flags);
 
-	return 0;
+out:
+	if (exits && !unchanged_pids.live)
+		cgre_filter_update(false);
+	pthread_rwlock_unlock(&unchanged_pids_lock);
+
+	return ret;
 }
 
-static void cgre_remove_unchanged_process(pid_t pid)
+STATIC void cgre_remove_unchanged_process(pid_t pid)
 {
-	int i, j;
-
-	for (i = 0; i < array_unch.index; i++) {
-		if (array_unch.proc[i].pid != pid)
-			continue;
+	struct cgre_pid_entry *entry;
+
+	pthread_rwlock_wrlock(&unchanged_pids_lock);
+	entry = cgre_pid_table_find(&unchanged_pids, pid);
+	if (entry) {
+		cgre_pid_table_remove(&unchanged_pids, entry);
+		state_dirty = 1;
+		if (!unchanged_pids.live)
+			cgre_filter_update(false);
+	}
+	pthread_rwlock_unlock(&unchanged_pids_lock);
 
-		for (j = i; j < array_unch.index - 1; j++)
-			memcpy(&array_unch.proc[j], &array_unch.proc[j + 1],
-			       sizeof(struct unchanged_pid));
-		array_unch.index--;
+	if (entry)
 		flog(LOG_DEBUG, "Remove the unchanged process (PID: %d)\n", pid);
-		return;
-	}
 }
 
-static int cgre_is_unchanged_process(pid_t pid)
+STATIC int cgre_is_unchanged_process(pid_t pid)
 {
-	int i;
+	int ret;
+
+	pthread_rwlock_rdlock(&unchanged_pids_lock);
+	ret = cgre_pid_table_find(&unchanged_pids, pid) != NULL;
+	pthread_rwlock_unlock(&unchanged_pids_lock);
+
+	return ret;
+}
 
-	for (i = 0; i < array_unch.index; i++) {
-		if (array_unch.proc[i].pid != pid)
+STATIC int cgre_is_unchanged_child(pid_t pid)
+{
+	struct cgre_pid_entry *entry;
+	int ret = 0;
+
+	pthread_rwlock_rdlock(&unchanged_pids_lock);
+	entry = cgre_pid_table_find(&unchanged_pids, pid);
+	if (entry && (entry->value & CGROUP_DAEMON_UNCHANGE_CHILDREN))
+		ret = 1;
+	pthread_rwlock_unlock(&unchanged_pids_lock);
+
+	return ret;
+}
+
+/**
+ * Write the unchanged processes and the fingerprint of the rules to the
+ * state file, so that a restarted daemon keeps them.
+ */
+static void cgre_save_state(void)
+{
+	struct cgre_state state = { };
+	struct cgre_pid_entry *entry;
+	u_int64_t slack;
+	unsigned int i;
+
+	state.rules = rules_fingerprint;
+
+	/* The events in flight are those of processes started a bit earlier */
+	state.time = cgre_state_now();
+	slack = (u_int64_t)CGRE_STATE_SLACK * sysconf(_SC_CLK_TCK);
+	state.time = state.time > slack ? state.time - slack : 0;
+
+	pthread_rwlock_wrlock(&unchanged_pids_lock);
+	if (unchanged_pids.live) {
+		state.pids = calloc(unchanged_pids.live, sizeof(struct cgre_state_pid));
+		if (!state.pids) {
+			pthread_rwlock_unlock(&unchanged_pids_lock);
+			flog(LOG_WARNING, "Failed to allocate memory\n");
+			return;
+		}
+	}
+
+	for (i = 0; i < unchanged_pids.size; i++) {
+		entry = &unchanged_pids.entries[i];
+		if (entry->pid == CGRE_PID_EMPTY || entry->pid == CGRE_PID_DELETED)
 			continue;
-		return 1;
+
+		state.pids[state.count].pid = entry->pid;
+		state.pids[state.count].flags = entry->value;
+		state.count++;
+	}
+	state_dirty = 0;
+	pthread_rwlock_unlock(&unchanged_pids_lock);
+
+	/* Read outside of the lock, a process which exited is left out */
+	for (i = 0; i < (unsigned int)state.count; i++) {
+		if (cgre_proc_start_time(state.pids[i].pid, &state.pids[i].start)) {
+			state.pids[i] = state.pids[state.count - 1];
+			state.count--;
+			i--;
+		}
 	}
 
-	return 0;
+	cgre_state_save(CGRE_STATE_FILE, &state);
+	cgre_state_free(&state);
+	state_saved_ns = cgre_now_ns();
 }
 
-static int cgre_is_unchanged_child(pid_t pid)
+/**
+ * Write the state if the unchanged processes changed, or once in a while
+ * so that a daemon killed without notice loses little.
+ */
+static void cgre_update_state(void)
 {
-	int i;
+	int dirty;
+
+	pthread_rwlock_rdlock(&unchanged_pids_lock);
+	dirty = state_dirty;
+	pthread_rwlock_unlock(&unchanged_pids_lock);
 
-	for (i = 0; i < array_unch.index; i++) {
-		if (array_unch.proc[i].pid != pid)
+	if (dirty || cgre_now_ns() - state_saved_ns >= CGRE_STATE_PERIOD * 1000000000ULL)
+		cgre_save_state();
+}
+
+/**
+ * Register again the unchanged processes of the state which still run,
+ * those whose start time differs reuse the pid of an exited one.
+ *	@param state The state of the previous daemon
+ *	@return The number of processes registered
+ */
+static int cgre_restore_state(const struct cgre_state * const state)
+{
+	int restored = 0, i;
+	u_int64_t start;
+
+	for (i = 0; i < state->count; i++) {
+		if (cgre_proc_start_time(state->pids[i].pid, &start) ||
+		    start != state->pids[i].start)
 			continue;
-		if (array_unch.proc[i].flags & CGROUP_DAEMON_UNCHANGE_CHILDREN)
-			return 1;
-		break;
+
+		if (!cgre_store_unchanged_process(state->pids[i].pid, state->pids[i].flags))
+			restored++;
 	}
 
-	return 0;
+	return restored;
 }
 
 /**
@@ -390,6 +789,7 @@ int cgre_process_event(const struct proc_event *ev, const int type)
 	pid_t pid = 0, log_pid = 0;
 	uid_t euid, log_uid = 0;
 	gid_t egid, log_gid = 0;
+	u_int64_t start, match_ns, attach_ns;
 	pid_t ppid, cpid;
 	char *procname;
 
@@ -438,22 +838,24 @@ int cgre_process_event(const struct proc_event *ev, const int type)
 		break;
 	}
 
-	ret = cgroup_get_uid_gid_from_procfs(pid, &euid, &egid);
+	start = cgre_now_ns();
+	if (replay_trace) {
+		ret = cgre_trace_proc_info(replay_trace, pid, &euid, &egid, &procname);
+	} else {
+		ret = cgroup_get_proc_info_from_procfs(pid, &euid, &egid, &procname);
+		cgre_trace_record_proc(pid, ret, euid, egid, procname);
+	}
+	cgre_hist_record(&cgre_stats.proc_read, cgre_now_ns() - start);
+	cg_probe(cgrulesengd, proc_read, pid, ret);
 	if (ret == ECGROUPNOTEXIST)
 		/*
-		 * cgroup_get_uid_gid_from_procfs() returns ECGROUPNOTEXIST
+		 * cgroup_get_proc_info_from_procfs() returns ECGROUPNOTEXIST
 		 * if a process finished and that is not a problem.
 		 */
 		return 0;
 	else if (ret)
 		return ret;
 
-	ret = cgroup_get_procname_from_procfs(pid, &procname);
-	if (ret == ECGROUPNOTEXIST)
-		return 0;
-	else if (ret)
-		return ret;
-
 	/*
 	 * Now that we have the UID, the GID, and the PID, we can make a
 	 * call to libcgroup to change the cgroup for this PID.
@@ -483,6 +885,14 @@ int cgre_process_event(const struct proc_event *ev, const int type)
 	}
 
 	ret = cgroup_change_cgroup_flags(euid, egid, procname, pid, CGFLAG_USECACHE);
+	cgroup_get_last_change_times(&match_ns, &attach_ns);
+	cgre_hist_record(&cgre_stats.rule_match, match_ns);
+	if (attach_ns)
+		cgre_hist_record(&cgre_stats.attach, attach_ns);
+	__atomic_add_fetch(ret ? &cgre_stats.failed : &cgre_stats.classified, 1,
+			   __ATOMIC_RELAXED);
+	cg_probe(cgrulesengd, classify, pid, euid, egid, procname, ret);
+
 	if (ret == ECGOTHER) {
 		/*
 		 * A process finished already but we may have missed
@@ -506,23 +916,55 @@ int cgre_process_event(const struct proc_event *ev, const int type)
 	return ret;
 }
 
+/**
+ * Get the PID the event is about; it selects the classification thread.
+ *	@param ev The event
+ *	@return The PID, 0 for the events the daemon ignores
+ */
+static pid_t cgre_event_pid(const struct proc_event *ev)
+{
+	switch (ev->what) {
+	case PROC_EVENT_FORK:
+		return ev->event_data.fork.child_pid;
+	case PROC_EVENT_EXEC:
+		return ev->event_data.exec.process_pid;
+	case PROC_EVENT_UID:
+	case PROC_EVENT_GID:
+		return ev->event_data.id.process_pid;
+	case PROC_EVENT_EXIT:
+		return ev->event_data.exit.process_pid;
+	default:
+		return 0;
+	}
+}
+
 /**
  * Handle a netlink message.
  * In the event of PROC_EVENT_UID or PROC_EVENT_GID, we pass the event along
  * to cgre_process_event for further processing.  All other events are ignored.
- *	@param cn_hdr The netlink message
+ *	@param ev The event carried by the netlink message
  *	@return 0 on success, > 0 on error
  */
-static int cgre_handle_msg(struct cn_msg *cn_hdr)
+static int cgre_handle_msg(const struct proc_event *ev)
 {
-	/* The event to consider */
-	struct proc_event *ev;
+	u_int64_t now;
 
 	/* Return codes */
 	int ret = 0;
 
-	/* Get the event data.  We only care about two event types. */
-	ev = (struct proc_event *)cn_hdr->data;
+	/*
+	 * The kernel stamps the events with CLOCK_MONOTONIC, a time
+	 * namespace of the daemon may shift its clock.
+	 */
+	now = cgre_now_ns();
+	if (ev->timestamp_ns > now)
+		now = 0;
+	if (now)
+		cgre_hist_record(&cgre_stats.queue, now - ev->timestamp_ns);
+
+	cg_probe(cgrulesengd, event_entry, ev->what, cgre_event_pid(ev), ev->timestamp_ns);
+
+	/* We only care about some of the event types. */
 	switch (ev->what) {
 	case PROC_EVENT_UID:
 		flog(LOG_DEBUG, "UID Event: PID = %d, tGID = %d, rUID = %d, eUID = %d\n",
@@ -548,135 +990,1217 @@ static int cgre_handle_msg(struct cn_msg *cn_hdr)
 		ret = cgre_process_event(ev, PROC_EVENT_EXEC);
 		break;
 	default:
-		break;
+		cg_probe(cgrulesengd, event_return, ev->what, 0);
+		return 0;
+	}
+
+	cg_probe(cgrulesengd, event_return, ev->what, ret);
+
+	if (now)
+		cgre_hist_record(&cgre_stats.latency, cgre_now_ns() - ev->timestamp_ns);
+
+	return ret;
+}
+
+/**
+ * Classification thread, handles the events queued by cgre_dispatch_event().
+ *	@param arg The worker
+ */
+static void *cgre_worker_thread(void *arg)
+{
+	struct cgre_worker *worker = arg;
+	struct proc_event ev;
+
+	pthread_mutex_lock(&worker->lock);
+	for (;;) {
+		while (!worker->count)
+			pthread_cond_wait(&worker->more, &worker->lock);
+
+		ev = worker->events[worker->head];
+		worker->head = (worker->head + 1) % CGRE_WORKER_QUEUE_SIZE;
+		worker->count--;
+		worker->busy = 1;
+		pthread_cond_signal(&worker->space);
+		pthread_mutex_unlock(&worker->lock);
+
+		cgre_handle_msg(&ev);
+
+		pthread_mutex_lock(&worker->lock);
+		worker->busy = 0;
+		if (!worker->count)
+			pthread_cond_broadcast(&worker->space);
+	}
+
+	return NULL;
+}
+
+/**
+ * Start the classification threads. The threads block all the signals,
+ * so that SIGUSR1, SIGUSR2 and SIGTERM are always handled by the main
+ * thread.
+ *	@return 0 on success, 1 on error
+ */
+static int cgre_start_workers(void)
+{
+	sigset_t sigset, oldset;
+	unsigned int i;
+	int ret;
+
+	if (worker_cnt < 2)
+		return 0;
+
+	workers = calloc(worker_cnt, sizeof(struct cgre_worker));
+	if (!workers) {
+		flog(LOG_ERR, "Failed to allocate memory\n");
+		return 1;
+	}
+
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+
+	for (i = 0; i < worker_cnt; i++) {
+		pthread_mutex_init(&workers[i].lock, NULL);
+		pthread_cond_init(&workers[i].more, NULL);
+		pthread_cond_init(&workers[i].space, NULL);
+
+		ret = pthread_create(&workers[i].thread, NULL, cgre_worker_thread, &workers[i]);
+		if (ret) {
+			flog(LOG_ERR, "Failed to create classification thread: %s\n",
+			     strerror(ret));
+			pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+			return 1;
+		}
+	}
+
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	flog(LOG_INFO, "Started %u classification threads\n", worker_cnt);
+
+	return 0;
+}
+
+/**
+ * Wait until all the classification threads are idle, so that the rules
+ * and templates can be reloaded.
+ */
+static void cgre_wait_workers(void)
+{
+	unsigned int i;
+
+	if (!workers)
+		return;
+
+	for (i = 0; i < worker_cnt; i++) {
+		pthread_mutex_lock(&workers[i].lock);
+		while (workers[i].count || workers[i].busy)
+			pthread_cond_wait(&workers[i].space, &workers[i].lock);
+		pthread_mutex_unlock(&workers[i].lock);
 	}
+}
+
+/**
+ * Queue an event to the classification thread of its PID. Blocks while
+ * the queue of the thread is full.
+ *	@param ev The event
+ */
+static void cgre_dispatch_event(const struct proc_event *ev)
+{
+	struct cgre_worker *worker;
+	pid_t pid;
+
+	pid = cgre_event_pid(ev);
+	if (!pid)
+		return;
+
+	worker = &workers[(unsigned int)pid % worker_cnt];
+
+	pthread_mutex_lock(&worker->lock);
+	while (worker->count == CGRE_WORKER_QUEUE_SIZE)
+		pthread_cond_wait(&worker->space, &worker->lock);
+
+	worker->events[(worker->head + worker->count) % CGRE_WORKER_QUEUE_SIZE] = *ev;
+	worker->count++;
+	pthread_cond_signal(&worker->more);
+	pthread_mutex_unlock(&worker->lock);
+}
+
+/**
+ * Classify an event, or hand it over to the classification threads.
+ *	@param ev The event
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+static int cgre_deliver_event(const struct proc_event *ev)
+{
+	if (workers) {
+		cgre_dispatch_event(ev);
+		return 0;
+	}
+
+	return cgre_handle_msg(ev) < 0;
+}
+
+/**
+ * Classify the running processes as if they just called exec(), so that
+ * the unchanged processes are left alone.
+ *	@param since Only the processes started since, in clock ticks since
+ *		     boot, 0 for all of them
+ *	@return 0 on success, 1 on error
+ */
+static int cgre_sweep_processes(u_int64_t since)
+{
+	struct proc_event ev = { };
+	unsigned int count = 0;
+	struct dirent *dent;
+	u_int64_t start;
+	int ret = 0;
+	char *end;
+	pid_t pid;
+	DIR *dir;
+
+	dir = opendir("/proc");
+	if (!dir) {
+		flog(LOG_WARNING, "Warning: cannot open /proc: %s\n", strerror(errno));
+		return 1;
+	}
+
+	ev.what = PROC_EVENT_EXEC;
+	while ((dent = readdir(dir)) != NULL) {
+		pid = strtol(dent->d_name, &end, 10);
+		if (*end || pid <= 0)
+			continue;
+
+		if (since && (cgre_proc_start_time(pid, &start) || start < since))
+			continue;
+
+		ev.event_data.exec.process_pid = pid;
+		ev.event_data.exec.process_tgid = pid;
+		ev.timestamp_ns = cgre_now_ns();
+		ret = cgre_deliver_event(&ev);
+		if (ret)
+			break;
+		count++;
+	}
+	closedir(dir);
+
+	cgre_wait_workers();
+	flog(LOG_INFO, "Classified %u running processes\n", count);
+
+	return ret;
+}
+
+/**
+ * Classify the running processes on startup.  With the state of a previous
+ * daemon of this boot, its unchanged processes are kept, and if the rules
+ * did not change, only the processes started after the state was written
+ * are classified.
+ *	@return 0 on success, 1 on error
+ */
+static int cgre_classify_running_tasks(void)
+{
+	struct cgre_state state;
+	u_int64_t since = 0;
+	int restored = 0;
+
+	if (!cgre_state_load(CGRE_STATE_FILE, &state)) {
+		restored = cgre_restore_state(&state);
+		if (rules_fingerprint && state.rules == rules_fingerprint)
+			since = state.time;
+		flog(LOG_INFO, "Restored %d unchanged processes, the rules %s\n", restored,
+		     since ? "did not change" : "changed");
+		cgre_state_free(&state);
+	}
+
+	/* The library does not know the unchanged processes */
+	if (restored || since)
+		return cgre_sweep_processes(since);
+
+	/* As many threads as workers */
+	return cgroup_change_all_cgroups_ext(worker_cnt, 0) != 0;
+}
+
+/* Window during which the events of a process are merged, 0 disables it */
+STATIC unsigned int coalesce_ms = CGRE_COALESCE_MS;
+
+/*
+ * A sudo or a service start sends the fork, uid, gid and exec events of a
+ * process within microseconds, each of them reads /proc and classifies it.
+ * The exec, uid and gid events wait instead until the end of the window
+ * opened by the first of them, a later event replacing the pending one, so
+ * that only the final state of the process is classified.  The exit of the
+ * process cancels its pending event.  The fork events are not delayed, they
+ * make the child of a sticky process sticky before its parent may exit.
+ *
+ * The socket filter drops the exit events while there is no sticky process,
+ * so the start time of the process is kept with its event and checked
+ * again on delivery: a process which exited meanwhile is not classified,
+ * nor another one reusing its pid.
+ */
+struct cgre_pending_event {
+	u_int64_t deadline;
+	struct proc_event ev;
+	/* Start time of the process of the last event, 0 if not checked */
+	u_int64_t start;
+	/* 0 once the event was delivered or cancelled */
+	pid_t pid;
+};
+
+/* The pending events, in the order their window opened */
+struct cgre_pending_ring {
+	struct cgre_pending_event events[CGRE_PENDING_SIZE];
+	unsigned int head;
+	unsigned int count;
+	/* The slot of the pending event of each PID */
+	struct cgre_pid_table slots;
+};
+
+static struct cgre_pending_ring pending;
+
+/**
+ * Deliver the pending event of a slot now.
+ *	@param slot The slot of the event in the ring
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+static int cgre_pending_deliver(unsigned int slot)
+{
+	struct cgre_pending_event *pe = &pending.events[slot];
+	struct cgre_pid_entry *entry;
+	u_int64_t start;
+	pid_t pid;
+
+	pid = pe->pid;
+	if (!pid)
+		return 0;
+
+	entry = cgre_pid_table_find(&pending.slots, pid);
+	if (entry)
+		cgre_pid_table_remove(&pending.slots, entry);
+	pe->pid = 0;
+
+	if (pe->start && (cgre_proc_start_time(pid, &start) || start != pe->start)) {
+		flog(LOG_DEBUG, "PID %d exited before its pending event\n", pid);
+		cgre_stats.coalesced++;
+		return 0;
+	}
+
+	return cgre_deliver_event(&pe->ev);
+}
+
+/**
+ * Get the start time of the process of a pending event, when its exit may
+ * not be received.
+ *	@param pid The process
+ *	@param start Its start time, 0 if the exit events are received
+ *	@return 0 on success, 1 if the process exited already
+ */
+static int cgre_pending_start_time(pid_t pid, u_int64_t * const start)
+{
+	*start = 0;
+	if (event_filter_sk < 0)
+		return 0;
+
+	return cgre_proc_start_time(pid, start) != 0;
+}
+
+/**
+ * Deliver the pending events whose window is over, or all of them.
+ *	@param all Deliver all the events
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+STATIC int cgre_flush_pending(int all)
+{
+	u_int64_t now = cgre_now_ns();
+	unsigned int slot;
+
+	while (pending.count) {
+		slot = pending.head;
+		if (!all && pending.events[slot].pid && pending.events[slot].deadline > now)
+			break;
+
+		pending.head = (pending.head + 1) % CGRE_PENDING_SIZE;
+		pending.count--;
+		if (cgre_pending_deliver(slot))
+			return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Milliseconds until the window of the oldest pending event is over.
+ *	@return The timeout of epoll_wait(), -1 if no event is pending
+ */
+static int cgre_pending_timeout(void)
+{
+	u_int64_t now, deadline;
+
+	if (!pending.count)
+		return -1;
+
+	now = cgre_now_ns();
+	deadline = pending.events[pending.head].deadline;
+	if (deadline <= now)
+		return 0;
+
+	return (deadline - now + 999999) / 1000000;
+}
+
+/**
+ * Deliver an event, or keep it pending until the end of the coalescing
+ * window of its process.
+ *	@param ev The event
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+STATIC int cgre_coalesce_event(const struct proc_event *ev)
+{
+	struct cgre_pending_event *pe;
+	struct cgre_pid_entry *entry;
+	unsigned int slot;
+	u_int64_t start;
+	pid_t pid;
+
+	pid = cgre_event_pid(ev);
+	if (!coalesce_ms || !pid)
+		return cgre_deliver_event(ev);
+
+	switch (ev->what) {
+	case PROC_EVENT_FORK:
+		/* The parent is classified first, as its child may have to follow it */
+		entry = cgre_pid_table_find(&pending.slots, ev->event_data.fork.parent_pid);
+		if (entry && cgre_pending_deliver(entry->value))
+			return 1;
+		return cgre_deliver_event(ev);
+	case PROC_EVENT_EXIT:
+		entry = cgre_pid_table_find(&pending.slots, pid);
+		if (entry) {
+			pending.events[entry->value].pid = 0;
+			cgre_pid_table_remove(&pending.slots, entry);
+			cgre_stats.coalesced++;
+		}
+		return cgre_deliver_event(ev);
+	case PROC_EVENT_EXEC:
+	case PROC_EVENT_UID:
+	case PROC_EVENT_GID:
+		break;
+	default:
+		return cgre_deliver_event(ev);
+	}
+
+	/* The process of the last event is the one to classify */
+	if (cgre_pending_start_time(pid, &start))
+		return cgre_deliver_event(ev);
+
+	entry = cgre_pid_table_find(&pending.slots, pid);
+	if (entry) {
+		pending.events[entry->value].ev = *ev;
+		pending.events[entry->value].start = start;
+		cgre_stats.coalesced++;
+		return 0;
+	}
+
+	/* The oldest event goes before its window is over */
+	if (pending.count == CGRE_PENDING_SIZE) {
+		slot = pending.head;
+		pending.head = (pending.head + 1) % CGRE_PENDING_SIZE;
+		pending.count--;
+		if (cgre_pending_deliver(slot))
+			return 1;
+	}
+
+	entry = cgre_pid_table_insert(&pending.slots, pid);
+	if (!entry)
+		return cgre_deliver_event(ev);
+
+	entry->value = (pending.head + pending.count) % CGRE_PENDING_SIZE;
+	pending.count++;
+
+	pe = &pending.events[entry->value];
+	pe->deadline = cgre_now_ns() + (u_int64_t)coalesce_ms * 1000 * 1000;
+	pe->ev = *ev;
+	pe->start = start;
+	pe->pid = pid;
+
+	return 0;
+}
+
+/**
+ * Classify all the events waiting in the ring, oldest first, or hand them
+ * over to the classification threads, once their coalescing window is over.
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+static int cgre_process_event_ring(void)
+{
+	struct proc_event *ev;
+
+	while (event_ring.count) {
+		ev = &event_ring.events[event_ring.head];
+		event_ring.head = (event_ring.head + 1) % CGRE_EVENT_RING_SIZE;
+		event_ring.count--;
+
+		if (cgre_coalesce_event(ev))
+			return 1;
+	}
+
+	return cgre_flush_pending(0);
+}
+
+/**
+ * Copy an event into the ring.  If the ring is full, the events already
+ * queued are classified first.
+ *	@param data The event
+ *	@param len Length of the event, the kernel may send a shorter one
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+static int cgre_queue_event(const void *data, size_t len)
+{
+	struct proc_event *ev;
+
+	if (event_ring.count == CGRE_EVENT_RING_SIZE) {
+		if (cgre_process_event_ring())
+			return 1;
+	}
+
+	ev = &event_ring.events[(event_ring.head + event_ring.count) % CGRE_EVENT_RING_SIZE];
+	memset(ev, 0, sizeof(struct proc_event));
+	memcpy(ev, data, min(len, sizeof(struct proc_event)));
+	event_ring.count++;
+	cgre_trace_record_event(ev);
+	cgre_stats_count_event(ev->what);
+	cg_probe(cgrulesengd, event_queued, ev->what, cgre_event_pid(ev));
+
+	return 0;
+}
+
+/**
+ * Queue all the events carried by one netlink datagram.
+ *	@param buff The datagram
+ *	@param recv_len Length of the datagram
+ *	@param from_nla Sender of the datagram
+ *	@param from_nla_len Length of the sender address
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+static int cgre_queue_netlink_msg(char *buff, int recv_len, const struct sockaddr_nl *from_nla,
+				  socklen_t from_nla_len)
+{
+	struct cn_msg *cn_hdr;
+	struct nlmsghdr *nlh;
+
+	if (recv_len < 1)
+		return 0;
+
+	if (from_nla_len != sizeof(*from_nla)) {
+		flog(LOG_ERR, "Bad address size reading netlink socket\n");
+		return 0;
+	}
+
+	if (from_nla->nl_groups != CN_IDX_PROC || from_nla->nl_pid != 0)
+		return 0;
+
+	nlh = (struct nlmsghdr *)buff;
+	while (NLMSG_OK(nlh, recv_len)) {
+		cn_hdr = NLMSG_DATA(nlh);
+
+		if (nlh->nlmsg_type == NLMSG_NOOP) {
+			nlh = NLMSG_NEXT(nlh, recv_len);
+			continue;
+		}
+		if ((nlh->nlmsg_type == NLMSG_ERROR) || (nlh->nlmsg_type == NLMSG_OVERRUN))
+			break;
+		if (cgre_queue_event(cn_hdr->data, cn_hdr->len))
+			return 1;
+		if (nlh->nlmsg_type == NLMSG_DONE)
+			break;
+		nlh = NLMSG_NEXT(nlh, recv_len);
+	}
+
+	return 0;
+}
+
+/**
+ * Drain the non-blocking netlink socket into the event ring, in batches of
+ * up to CGRE_NETLINK_BATCH datagrams, and classify the received events
+ * once the socket is empty or the ring is full.
+ *	@param sk_nl The netlink socket
+ *	@return 0 on success, 1 if the daemon should stop
+ */
+static int cgre_receive_netlink_msg(int sk_nl)
+{
+	static char buffs[CGRE_NETLINK_BATCH][BUFF_SIZE];
+	struct sockaddr_nl from_nla[CGRE_NETLINK_BATCH];
+	struct mmsghdr msgs[CGRE_NETLINK_BATCH];
+	struct iovec iovs[CGRE_NETLINK_BATCH];
+	int cnt, i;
+
+	while (event_ring.count + CGRE_NETLINK_BATCH <= CGRE_EVENT_RING_SIZE) {
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < CGRE_NETLINK_BATCH; i++) {
+			iovs[i].iov_base = buffs[i];
+			iovs[i].iov_len = BUFF_SIZE;
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+			msgs[i].msg_hdr.msg_name = &from_nla[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(from_nla[i]);
+		}
+
+		cnt = recvmmsg(sk_nl, msgs, CGRE_NETLINK_BATCH, MSG_DONTWAIT, NULL);
+		if (cnt < 0) {
+			if (errno == EINTR)
+				continue;
+
+			if (errno == ENOBUFS) {
+				cgre_stats.netlink_drops++;
+				flog(LOG_ERR, "ERROR: NETLINK BUFFER FULL, MESSAGE DROPPED! (%llu)\n",
+				     (unsigned long long)cgre_stats.netlink_drops);
+				continue;
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				flog(LOG_ERR, "Error receiving netlink message: %s\n",
+				     strerror(errno));
+			break;
+		}
+
+		cgre_stats.datagrams += cnt;
+		for (i = 0; i < cnt; i++) {
+			if (cgre_queue_netlink_msg(buffs[i], msgs[i].msg_len, &from_nla[i],
+						   msgs[i].msg_hdr.msg_namelen))
+				return 1;
+		}
+
+		if (cnt < CGRE_NETLINK_BATCH)
+			break;
+	}
+
+	return cgre_process_event_ring();
+}
+
+static int cgre_epoll_add(int epoll_fd, int fd)
+{
+	struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+
+	if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+		flog(LOG_ERR, "Error adding a descriptor to epoll: %s\n", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * A connection of the UNIX socket.  The requests are read and the replies
+ * written without blocking, a slow client never stalls the main loop.
+ */
+struct cgre_client {
+	int fd;
+	/* Events watched by epoll */
+	unsigned int events;
+	/* Close the connection once the replies are written */
+	bool closing;
+	/* Owner of the client process, only root may classify a process */
+	uid_t uid;
+	/* Bytes read of the requests not handled yet */
+	char in[CGRE_CLIENT_IN_SIZE];
+	size_t in_len;
+	/* Replies not written yet */
+	char *out;
+	size_t out_off;
+	size_t out_len;
+	size_t out_size;
+};
+
+static struct cgre_client clients[CGRE_MAX_CLIENTS];
+
+static struct cgre_client *cgre_client_find(int fd)
+{
+	int i;
+
+	for (i = 0; i < CGRE_MAX_CLIENTS; i++) {
+		if (clients[i].fd == fd)
+			return &clients[i];
+	}
+
+	return NULL;
+}
+
+static void cgre_client_close(int epoll_fd, struct cgre_client * const client)
+{
+	epoll_ctl(epoll_fd, EPOLL_CTL_DEL, client->fd, NULL);
+	close(client->fd);
+	free(client->out);
+	memset(client, 0, sizeof(*client));
+	client->fd = -1;
+}
+
+static int cgre_client_reply(struct cgre_client * const client, const void *buf, size_t len)
+{
+	size_t size;
+	char *out;
+
+	if (client->out_len + len > client->out_size) {
+		size = max(client->out_size * 2, client->out_len + len);
+		out = realloc(client->out, size);
+		if (!out) {
+			flog(LOG_WARNING, "Failed to allocate memory\n");
+			return 1;
+		}
+		client->out = out;
+		client->out_size = size;
+	}
+
+	memcpy(client->out + client->out_len, buf, len);
+	client->out_len += len;
+
+	return 0;
+}
+
+/**
+ * Check for a CGRULE_REQUEST_CLASSIFY request, followed by the process.
+ */
+static bool cgre_is_classify(const struct cgrule_request * const req)
+{
+	return req->pid == 0 && req->flags == CGRULE_REQUEST_CLASSIFY;
+}
+
+/**
+ * Classify a process on the request of a client, PAM sessions ask for it
+ * instead of loading the rules themselves.  The change is made right away
+ * by the main loop, the client waits for it.
+ *	@param client The client
+ *	@param classify The process and its credentials
+ *	@return 0 on success, else the error of the classification
+ */
+static int32_t cgre_classify(const struct cgre_client * const client,
+			     const struct cgrule_classify * const classify)
+{
+	int ret;
+
+	if (client->uid != 0) {
+		flog(LOG_WARNING, "Warning: classification of PID %d refused, UID %d is not root\n",
+		     classify->pid, (int) client->uid);
+		return ECGROUPNOTALLOWED;
+	}
+
+	ret = cgroup_change_cgroup_uid_gid_flags(classify->uid, classify->gid, classify->pid,
+						 CGFLAG_USECACHE);
+	__atomic_add_fetch(ret ? &cgre_stats.failed : &cgre_stats.classified, 1,
+			   __ATOMIC_RELAXED);
+	if (ret) {
+		flog(LOG_WARNING, "Cgroup change for PID: %d, UID: %d, GID: %d requested FAILED! ",
+		     classify->pid, classify->uid, classify->gid);
+		flog(LOG_WARNING, "(Error Code: %d)\n", ret);
+
+		/* The errno of ECGOTHER stays in the daemon */
+		return ret == ECGOTHER ? ECGFAIL : ret;
+	}
+
+	flog(LOG_INFO, "Cgroup change for PID: %d, UID: %d, GID: %d requested OK\n",
+	     classify->pid, classify->uid, classify->gid);
+
+	/* The children forked meanwhile follow their parent */
+	cgre_store_parent_info(classify->pid);
+
+	return 0;
+}
+
+/**
+ * Handle a request of a client.
+ *	@param client The client
+ *	@param req The request
+ *	@return 0 to read the next request, 1 to close the connection once the
+ *	replies are written
+ */
+static int cgre_client_request(struct cgre_client * const client,
+			       const struct cgrule_request * const req, const char * const payload)
+{
+	int flags = req->flags & ~CGRULE_REQUEST_BATCH;
+	struct cgrule_classify classify;
+	char path[FILENAME_MAX];
+	struct stat buff_stat;
+	int32_t reply;
+	char status = 1;
+	char *text;
+
+	if (cgre_is_classify(req)) {
+		memcpy(&classify, payload, sizeof(classify));
+		reply = cgre_classify(client, &classify);
+		cgre_client_reply(client, &reply, sizeof(reply));
+
+		/* A session asks for a single process */
+		return 1;
+	}
+
+	if (req->pid == 0 && req->flags == CGRULE_REQUEST_HELLO) {
+		status = CGRULE_PROTOCOL_VERSION;
+
+		/* The batches of the client follow */
+		return cgre_client_reply(client, &status, sizeof(status));
+	}
+
+	if (req->flags == CGRULE_REQUEST_STATS) {
+		text = cgre_stats_dump();
+		if (!text) {
+			flog(LOG_WARNING, "Warning: cannot format the statistics\n");
+			return 1;
+		}
+		cgre_client_reply(client, text, strlen(text));
+		free(text);
+
+		/* The client reads the statistics until the connection is closed */
+		return 1;
+	}
+
+	snprintf(path, sizeof(path), "/proc/%d", req->pid);
+	if (stat(path, &buff_stat)) {
+		flog(LOG_WARNING, "Warning: there is no such process (PID: %d)\n", req->pid);
+		goto reply;
+	}
+
+	if (flags == CGROUP_DAEMON_CANCEL_UNCHANGE_PROCESS)
+		cgre_remove_unchanged_process(req->pid);
+	else if (cgre_store_unchanged_process(req->pid, flags))
+		goto reply;
+	status = 0;
+
+reply:
+	if (req->flags & CGRULE_REQUEST_BATCH)
+		return cgre_client_reply(client, &status, sizeof(status));
+
+	/* A single request is only answered on success */
+	if (status)
+		return 1;
+
+	return cgre_client_reply(client, CGRULE_SUCCESS_STORE_PID,
+				 sizeof(CGRULE_SUCCESS_STORE_PID));
+}
+
+/**
+ * Write the pending replies of a client, as much as the socket takes.
+ *	@return 0 on success, 1 if the connection failed
+ */
+static int cgre_client_flush(struct cgre_client * const client)
+{
+	ssize_t len;
+
+	while (client->out_off < client->out_len) {
+		len = send(client->fd, client->out + client->out_off,
+			   client->out_len - client->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			flog(LOG_WARNING, "Warning: cannot write to daemon socket: %s\n",
+			     strerror(errno));
+			return 1;
+		}
+		client->out_off += len;
+	}
+
+	client->out_off = 0;
+	client->out_len = 0;
+
+	return 0;
+}
+
+/**
+ * Read the requests of a client, and answer them.  The client is served at
+ * most CGRE_CLIENT_READS reads per wakeup, and not read while too many
+ * replies are pending, the requests wait in its socket meanwhile.
+ *	@param epoll_fd The epoll descriptor of the main loop
+ *	@param client The client
+ */
+static void cgre_receive_client_msg(int epoll_fd, struct cgre_client * const client)
+{
+	struct cgrule_request req;
+	struct epoll_event ev;
+	unsigned int events;
+	size_t off, size;
+	ssize_t len;
+	int reads;
+
+	for (reads = 0; reads < CGRE_CLIENT_READS && !client->closing &&
+	     client->out_len - client->out_off < CGRE_CLIENT_OUT_MAX; reads++) {
+		len = recv(client->fd, client->in + client->in_len,
+			   sizeof(client->in) - client->in_len, MSG_DONTWAIT);
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			break;
+		if (len <= 0) {
+			/* The client closed the connection */
+			if (len < 0)
+				flog(LOG_WARNING, "Warning: error reading daemon socket: %s\n",
+				     strerror(errno));
+			goto close;
+		}
+		client->in_len += len;
+
+		for (off = 0; !client->closing && client->in_len - off >= sizeof(req);
+		     off += size) {
+			memcpy(&req, client->in + off, sizeof(req));
+			size = sizeof(req);
+			if (cgre_is_classify(&req))
+				size += sizeof(struct cgrule_classify);
+			if (client->in_len - off < size)
+				break;
+
+			if (cgre_client_request(client, &req, client->in + off + sizeof(req)))
+				client->closing = true;
+		}
+		memmove(client->in, client->in + off, client->in_len - off);
+		client->in_len -= off;
+	}
+
+	if (cgre_client_flush(client))
+		goto close;
+
+	if (client->closing && !client->out_len)
+		goto close;
+
+	events = 0;
+	if (!client->closing && client->out_len - client->out_off < CGRE_CLIENT_OUT_MAX)
+		events |= EPOLLIN;
+	if (client->out_len)
+		events |= EPOLLOUT;
+
+	if (events != client->events) {
+		ev.events = events;
+		ev.data.fd = client->fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_MOD, client->fd, &ev) < 0) {
+			flog(LOG_WARNING, "Warning: cannot watch a client of the socket: %s\n",
+			     strerror(errno));
+			goto close;
+		}
+		client->events = events;
+	}
+
+	return;
+
+close:
+	cgre_client_close(epoll_fd, client);
+}
+
+/**
+ * Accept all the clients waiting on the non-blocking UNIX socket.
+ *	@param epoll_fd The epoll descriptor of the main loop
+ *	@param sk_unix The listening socket
+ */
+static void cgre_receive_unix_domain_msg(int epoll_fd, int sk_unix)
+{
+	struct cgre_client *client;
+	struct ucred cred;
+	socklen_t len;
+	int fd_client;
+
+	for (;;) {
+		fd_client = accept4(sk_unix, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd_client < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				flog(LOG_WARNING, "Warning: 'accept' command error: %s\n",
+				     strerror(errno));
+			return;
+		}
+
+		client = cgre_client_find(-1);
+		if (!client) {
+			flog(LOG_WARNING, "Warning: too many clients of the daemon socket\n");
+			close(fd_client);
+			continue;
+		}
+
+		if (cgre_epoll_add(epoll_fd, fd_client)) {
+			close(fd_client);
+			continue;
+		}
+
+		/* Without credentials the client is not trusted */
+		len = sizeof(cred);
+		if (getsockopt(fd_client, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0)
+			cred.uid = (uid_t) -1;
+
+		client->fd = fd_client;
+		client->events = EPOLLIN;
+		client->uid = cred.uid;
+
+		/* The request is usually there already */
+		cgre_receive_client_msg(epoll_fd, client);
+	}
+}
+
+/**
+ * Handle the signals queued on the signalfd.  The reloads run here, in the
+ * main loop, while no event is being classified by the main thread.
+ *	@param sig_fd The signalfd
+ */
+static void cgre_receive_signals(int sig_fd)
+{
+	struct signalfd_siginfo info;
+	ssize_t len;
+
+	for (;;) {
+		len = read(sig_fd, &info, sizeof(info));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len != sizeof(info)) {
+			if (len < 0 && errno != EAGAIN)
+				flog(LOG_ERR, "Error reading the signals: %s\n", strerror(errno));
+			return;
+		}
+
+		switch (info.ssi_signo) {
+		case SIGHUP:
+		case SIGUSR2:
+			cgre_flash_rules(info.ssi_signo);
+			break;
+		case SIGUSR1:
+			cgre_flash_templates(info.ssi_signo);
+			break;
+		case SIGINT:
+		case SIGTERM:
+			cgre_catch_term(info.ssi_signo);
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * Handle the expirations of the timer of the parent info.
+ *	@param timer_fd The timerfd
+ */
+static void cgre_receive_timer(int timer_fd)
+{
+	u_int64_t expirations;
+
+	if (read(timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+		return;
+
+	cgre_expire_parent_info();
+	cgre_update_state();
+}
+
+/**
+ * Publish the mount table of the daemon, the other processes then copy it in
+ * cgroup_init() instead of examining the mounts.
+ */
+static void cgre_publish_mounts(void)
+{
+	int ret;
+
+	ret = cgroup_publish_mount_table();
+	if (ret)
+		flog(LOG_WARNING, "Warning: cannot publish the mount table: %s\n",
+		     cgroup_strerror(ret));
+}
+
+/* The name of path, after its last slash */
+static const char *cgre_basename(const char * const path)
+{
+	const char *slash = strrchr(path, '/');
+
+	return slash ? slash + 1 : path;
+}
 
-	return ret;
+/**
+ * Watch CGRULES_CONF_DIR, which may not exist.
+ *	@param inotify_fd The inotify descriptor
+ */
+static void cgre_watch_rules_dir(int inotify_fd)
+{
+	rules_dir_wd = inotify_add_watch(inotify_fd, CGRULES_CONF_DIR,
+					 CGRE_RULES_EVENTS | IN_ONLYDIR);
+	if (rules_dir_wd < 0 && errno != ENOENT)
+		flog(LOG_WARNING, "Warning: cannot watch %s: %s\n", CGRULES_CONF_DIR,
+		     strerror(errno));
 }
 
-static int cgre_receive_netlink_msg(int sk_nl)
+/**
+ * Watch the rules files.  CGRULES_CONF_FILE is replaced by most editors, the
+ * directory holding it is watched for its name.  CGRULES_CONF_DIR is watched
+ * as a whole, and through its parent if it is created later.
+ *	@return The inotify descriptor, -1 on error
+ */
+static int cgre_watch_rules(void)
 {
-	struct sockaddr_nl from_nla;
-	socklen_t from_nla_len;
-	struct cn_msg *cn_hdr;
-	struct nlmsghdr *nlh;
-	char buff[BUFF_SIZE];
-	size_t recv_len;
+	char parent[FILENAME_MAX];
+	int inotify_fd;
 
-	memset(buff, 0, sizeof(buff));
-	from_nla_len = sizeof(from_nla);
-	recv_len = recvfrom(sk_nl, buff, sizeof(buff), 0, (struct sockaddr *)&from_nla,
-			    &from_nla_len);
-	if (recv_len == ENOBUFS) {
-		flog(LOG_ERR, "ERROR: NETLINK BUFFER FULL, MESSAGE DROPPED!\n");
-		return 0;
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		flog(LOG_ERR, "Error creating the inotify descriptor: %s\n", strerror(errno));
+		return -1;
 	}
 
-	if (recv_len < 1)
-		return 0;
+	snprintf(parent, sizeof(parent), "%.*s",
+		 (int)(cgre_basename(CGRULES_CONF_FILE) - CGRULES_CONF_FILE), CGRULES_CONF_FILE);
+	rules_parent_wd = inotify_add_watch(inotify_fd, parent, CGRE_RULES_EVENTS | IN_ONLYDIR);
+	if (rules_parent_wd < 0) {
+		flog(LOG_ERR, "Error watching %s: %s\n", parent, strerror(errno));
+		close(inotify_fd);
+		return -1;
+	}
 
-	if (from_nla_len != sizeof(from_nla)) {
-		flog(LOG_ERR, "Bad address size reading netlink socket\n");
-		return 0;
+	rules_dir_in_parent = !strncmp(CGRULES_CONF_DIR, parent, strlen(parent)) &&
+			      !strchr(CGRULES_CONF_DIR + strlen(parent), '/');
+	cgre_watch_rules_dir(inotify_fd);
+
+	flog(LOG_INFO, "Watching the changes of %s and %s\n", CGRULES_CONF_FILE,
+	     CGRULES_CONF_DIR);
+
+	return inotify_fd;
+}
+
+/**
+ * Whether an inotify event is about the rules files.
+ *	@param inotify_fd The inotify descriptor
+ *	@param ev The event
+ */
+static int cgre_rules_event(int inotify_fd, const struct inotify_event * const ev)
+{
+	/* Some events were lost */
+	if (ev->mask & IN_Q_OVERFLOW)
+		return 1;
+
+	if (ev->wd == rules_dir_wd) {
+		/* The directory was removed */
+		if (ev->mask & IN_IGNORED)
+			rules_dir_wd = -1;
+		return 1;
 	}
 
-	if (from_nla.nl_groups != CN_IDX_PROC || from_nla.nl_pid != 0)
+	if (ev->wd != rules_parent_wd || !ev->len)
 		return 0;
 
-	nlh = (struct nlmsghdr *)buff;
-	while (NLMSG_OK(nlh, recv_len)) {
-		cn_hdr = NLMSG_DATA(nlh);
+	if (!strcmp(ev->name, cgre_basename(CGRULES_CONF_FILE)))
+		return 1;
 
-		if (nlh->nlmsg_type == NLMSG_NOOP) {
-			nlh = NLMSG_NEXT(nlh, recv_len);
-			continue;
-		}
-		if ((nlh->nlmsg_type == NLMSG_ERROR) || (nlh->nlmsg_type == NLMSG_OVERRUN))
-			break;
-		if (cgre_handle_msg(cn_hdr) < 0)
-			return 1;
-		if (nlh->nlmsg_type == NLMSG_DONE)
-			break;
-		nlh = NLMSG_NEXT(nlh, recv_len);
+	if (rules_dir_in_parent && !strcmp(ev->name, cgre_basename(CGRULES_CONF_DIR))) {
+		if (rules_dir_wd < 0 && (ev->mask & (IN_CREATE | IN_MOVED_TO)))
+			cgre_watch_rules_dir(inotify_fd);
+		return 1;
 	}
 
 	return 0;
 }
 
-static void cgre_receive_unix_domain_msg(int sk_unix)
+/**
+ * The unchanged processes keep their groups across the reloads.
+ */
+static bool cgre_skip_unchanged_process(pid_t pid, void *userdata)
 {
-	struct sockaddr_un caddr;
-	char path[FILENAME_MAX];
-	struct stat buff_stat;
-	socklen_t caddr_len;
-	size_t ret_len;
-	int fd_client;
-	int flags;
-	pid_t pid;
+	return cgre_is_unchanged_process(pid);
+}
+
+/**
+ * Reload the rules after a change of their files.  Only the changed files
+ * are parsed again, and only the processes whose rule may have changed are
+ * classified again.
+ */
+static void cgre_reload_changed_rules(void)
+{
+	int ret;
+
+	flog(LOG_INFO, "The rules files changed, reloading the rules\n");
+
+	cgre_wait_workers();
 
-	caddr_len = sizeof(caddr);
-	fd_client = accept(sk_unix, (struct sockaddr *)&caddr, &caddr_len);
-	if (fd_client < 0) {
-		flog(LOG_WARNING, "Warning: 'accept' command error: %s\n", strerror(errno));
+	ret = cgroup_reload_cached_rules();
+	if (ret) {
+		flog(LOG_WARNING, "Warning: cannot reload the rules: %s\n", cgroup_strerror(ret));
 		return;
 	}
+	rules_fingerprint = cgre_state_fingerprint();
 
-	ret_len = read(fd_client, &pid, sizeof(pid));
-	if (ret_len != sizeof(pid)) {
-		flog(LOG_WARNING, "Warning: 'read' command error: %s\n", strerror(errno));
-		goto close;
+	if (logfile && loglevel >= LOG_INFO) {
+		cgroup_print_rules_config(logfile);
+		fprintf(logfile, "\n");
 	}
 
-	sprintf(path, "/proc/%d", pid);
-	if (stat(path, &buff_stat)) {
-		flog(LOG_WARNING, "Warning: there is no such process (PID: %d)\n", pid);
-		goto close;
-	}
+	ret = cgroup_change_all_cgroups_skip(worker_cnt, CGFLAG_CHANGE_ALL_CHANGED_RULES,
+					     cgre_skip_unchanged_process, NULL);
+	if (ret)
+		flog(LOG_WARNING, "Failed to classify the running tasks again.\n");
+}
 
-	ret_len = read(fd_client, &flags, sizeof(flags));
-	if (ret_len != sizeof(flags)) {
-		flog(LOG_WARNING, "Warning: error reading daemon socket: %s\n", strerror(errno));
-		goto close;
-	}
+/**
+ * Handle the events of the watched rules files.  The events queued together
+ * cause a single reload.
+ *	@param inotify_fd The inotify descriptor
+ */
+static void cgre_receive_inotify(int inotify_fd)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	int changed = 0;
+	ssize_t len;
+	char *ptr;
 
-	if (flags == CGROUP_DAEMON_CANCEL_UNCHANGE_PROCESS)
-		cgre_remove_unchanged_process(pid);
-	else if (cgre_store_unchanged_process(pid, flags))
-		goto close;
+	for (;;) {
+		len = read(inotify_fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len <= 0) {
+			if (len < 0 && errno != EAGAIN)
+				flog(LOG_ERR, "Error reading the inotify events: %s\n",
+				     strerror(errno));
+			break;
+		}
 
-	if (write(fd_client, CGRULE_SUCCESS_STORE_PID, sizeof(CGRULE_SUCCESS_STORE_PID)) < 0) {
-		flog(LOG_WARNING, "Warning: cannot write to daemon socket: %s\n", strerror(errno));
-		goto close;
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + ev->len) {
+			ev = (const struct inotify_event *)ptr;
+			if (cgre_rules_event(inotify_fd, ev))
+				changed = 1;
+		}
 	}
 
-close:
-	close(fd_client);
+	if (changed)
+		cgre_reload_changed_rules();
 }
 
 static int cgre_create_netlink_socket_process_msg(void)
 {
-	int sk_nl = 0, sk_unix = 0, sk_max;
+	int sig_fd = -1, timer_fd = -1, epoll_fd = -1, mounts_fd = -1, inotify_fd = -1;
+	struct epoll_event mounts_ev = { .events = EPOLLPRI };
+	struct epoll_event events[CGRE_EPOLL_EVENTS];
+	int sk_nl = 0, sk_unix = 0;
 	enum proc_cn_mcast_op *mcop_msg;
+	struct cgre_proc_input *input;
+	struct itimerspec expiry = { };
 	struct sockaddr_nl my_nla;
 	struct sockaddr_un saddr;
 	struct nlmsghdr *nl_hdr;
 	struct cn_msg *cn_hdr;
 	char buff[BUFF_SIZE];
-	fd_set fds, readfds;
-	sigset_t sigset;
+	struct cgre_client *client;
 	int rc = -1;
+	int cnt, i;
 
 	/*
 	 * Create an endpoint for communication. Use the kernel user interface
 	 * device (PF_NETLINK) which is a datagram oriented service (SOCK_DGRAM).
 	 * The protocol used is the connector protocol (NETLINK_CONNECTOR)
 	 */
-	sk_nl = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_CONNECTOR);
+	sk_nl = socket(PF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK, NETLINK_CONNECTOR);
 	if (sk_nl == -1) {
 		flog(LOG_ERR, "Error: error opening netlink socket: %s\n", strerror(errno));
 		return rc;
 	}
 
+	/*
+	 * Bursts of fork/exec events overflow the default receive buffer,
+	 * try to force a bigger one (we are root) and fall back to the
+	 * limit allowed by net.core.rmem_max.
+	 */
+	if (netlink_rcvbuf > 0) {
+		if (setsockopt(sk_nl, SOL_SOCKET, SO_RCVBUFFORCE, &netlink_rcvbuf,
+			       sizeof(netlink_rcvbuf)) < 0 &&
+		    setsockopt(sk_nl, SOL_SOCKET, SO_RCVBUF, &netlink_rcvbuf,
+			       sizeof(netlink_rcvbuf)) < 0)
+			flog(LOG_WARNING, "Warning: cannot set netlink receive buffer to %d: %s\n",
+			     netlink_rcvbuf, strerror(errno));
+	}
+
 	my_nla.nl_family = AF_NETLINK;
 	my_nla.nl_groups = CN_IDX_PROC;
 	my_nla.nl_pid = getpid();
@@ -687,15 +2211,31 @@ static int cgre_create_netlink_socket_process_msg(void)
 		goto close_and_exit;
 	}
 
+	/* The filter is attached before the first event can be queued */
+	if (event_filter) {
+		pthread_rwlock_wrlock(&unchanged_pids_lock);
+		if (!cgre_filter_attach(sk_nl, unchanged_pids.live > 0))
+			event_filter_sk = sk_nl;
+		pthread_rwlock_unlock(&unchanged_pids_lock);
+	}
+
 	nl_hdr = (struct nlmsghdr *)buff;
 	cn_hdr = (struct cn_msg *)NLMSG_DATA(nl_hdr);
 	mcop_msg = (enum proc_cn_mcast_op *)&cn_hdr->data[0];
 	flog(LOG_DEBUG, "Sending proc connector: PROC_CN_MCAST_LISTEN...\n");
 	memset(buff, 0, sizeof(buff));
 	*mcop_msg = PROC_CN_MCAST_LISTEN;
+	cn_hdr->len = sizeof(enum proc_cn_mcast_op);
+
+	/* Ask the kernel to only send the events the daemon handles */
+	if (event_filter && cgre_filter_kernel_supported()) {
+		input = (struct cgre_proc_input *)&cn_hdr->data[0];
+		input->event_type = CGRE_FILTER_EVENTS;
+		cn_hdr->len = sizeof(struct cgre_proc_input);
+	}
 
 	/* fill the netlink header */
-	nl_hdr->nlmsg_len = SEND_MESSAGE_LEN;
+	nl_hdr->nlmsg_len = NLMSG_LENGTH(sizeof(struct cn_msg) + cn_hdr->len);
 	nl_hdr->nlmsg_type = NLMSG_DONE;
 	nl_hdr->nlmsg_flags = 0;
 	nl_hdr->nlmsg_seq = 0;
@@ -706,7 +2246,6 @@ static int cgre_create_netlink_socket_process_msg(void)
 	cn_hdr->id.val = CN_VAL_PROC;
 	cn_hdr->seq = 0;
 	cn_hdr->ack = 0;
-	cn_hdr->len = sizeof(enum proc_cn_mcast_op);
 	flog(LOG_DEBUG, "Sending netlink message len=%d, cn_msg len=%d\n", nl_hdr->nlmsg_len,
 	     (int) sizeof(struct cn_msg));
 
@@ -718,7 +2257,7 @@ static int cgre_create_netlink_socket_process_msg(void)
 	flog(LOG_DEBUG, "Message sent\n");
 
 	/* Setup Unix domain socket. */
-	sk_unix = socket(PF_UNIX, SOCK_STREAM, 0);
+	sk_unix = socket(PF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
 	if (sk_unix < 0) {
 		flog(LOG_ERR, "Error creating UNIX socket: %s\n", strerror(errno));
 		goto close_and_exit;
@@ -736,7 +2275,7 @@ static int cgre_create_netlink_socket_process_msg(void)
 		goto close_and_exit;
 	}
 
-	if (listen(sk_unix, 1) < 0) {
+	if (listen(sk_unix, SOMAXCONN) < 0) {
 		flog(LOG_ERR, "Error listening on UNIX socket %s: %s\n", CGRULE_CGRED_SOCKET_PATH,
 		     strerror(errno));
 		goto close_and_exit;
@@ -758,40 +2297,113 @@ static int cgre_create_netlink_socket_process_msg(void)
 		goto close_and_exit;
 	}
 
-	FD_ZERO(&readfds);
-	FD_SET(sk_nl, &readfds);
-	FD_SET(sk_unix, &readfds);
-	if (sk_nl < sk_unix)
-		sk_max = sk_unix;
-	else
-		sk_max = sk_nl;
+	for (i = 0; i < CGRE_MAX_CLIENTS; i++)
+		clients[i].fd = -1;
 
-	sigemptyset(&sigset);
-	sigaddset(&sigset, SIGUSR2);
-	for (;;) {
-		/*
-		 * For avoiding the deadlock and "Interrupted system call"
-		 * error, restrict the effective range of SIGUSR2 signal.
-		 */
-		sigprocmask(SIG_UNBLOCK, &sigset, NULL);
-		sigprocmask(SIG_BLOCK, &sigset, NULL);
+	/* The signals were blocked by cgre_block_signals() */
+	sig_fd = signalfd(-1, &cgre_signals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (sig_fd < 0) {
+		flog(LOG_ERR, "Error creating the signalfd: %s\n", strerror(errno));
+		goto close_and_exit;
+	}
 
-		memcpy(&fds, &readfds, sizeof(fd_set));
-		if (select(sk_max + 1, &fds, NULL, NULL, NULL) < 0) {
-			flog(LOG_ERR, "Selecting error: %s\n", strerror(errno));
+	timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (timer_fd < 0) {
+		flog(LOG_ERR, "Error creating the timerfd: %s\n", strerror(errno));
+		goto close_and_exit;
+	}
+
+	expiry.it_value.tv_sec = CGRE_PARENT_INFO_TTL;
+	expiry.it_interval.tv_sec = CGRE_PARENT_INFO_TTL;
+	if (timerfd_settime(timer_fd, 0, &expiry, NULL) < 0) {
+		flog(LOG_ERR, "Error arming the timerfd: %s\n", strerror(errno));
+		goto close_and_exit;
+	}
+
+	epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		flog(LOG_ERR, "Error creating the epoll descriptor: %s\n", strerror(errno));
+		goto close_and_exit;
+	}
+
+	if (cgre_epoll_add(epoll_fd, sk_nl) || cgre_epoll_add(epoll_fd, sk_unix) ||
+	    cgre_epoll_add(epoll_fd, sig_fd) || cgre_epoll_add(epoll_fd, timer_fd))
+		goto close_and_exit;
+
+	/*
+	 * The table is published by the forked daemon, which holds its lock.
+	 * A change of the mounts is reported as a priority event.
+	 */
+	mounts_fd = open("/proc/self/mounts", O_RDONLY | O_CLOEXEC);
+	if (mounts_fd < 0) {
+		flog(LOG_WARNING, "Warning: cannot open /proc/self/mounts: %s\n", strerror(errno));
+	} else {
+		mounts_ev.data.fd = mounts_fd;
+		if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, mounts_fd, &mounts_ev) < 0) {
+			flog(LOG_ERR, "Error adding a descriptor to epoll: %s\n", strerror(errno));
 			goto close_and_exit;
 		}
+		cgre_publish_mounts();
+	}
 
-		if (FD_ISSET(sk_nl, &fds)) {
-			if (cgre_receive_netlink_msg(sk_nl))
-				break;
+	if (watch_rules) {
+		inotify_fd = cgre_watch_rules();
+		if (inotify_fd < 0 || cgre_epoll_add(epoll_fd, inotify_fd))
+			goto close_and_exit;
+	}
+
+	for (;;) {
+		/* Wake up at the end of the window of the oldest pending event */
+		cnt = epoll_wait(epoll_fd, events, CGRE_EPOLL_EVENTS, cgre_pending_timeout());
+		if (cnt < 0) {
+			if (errno == EINTR)
+				continue;
+			flog(LOG_ERR, "Error waiting for events: %s\n", strerror(errno));
+			goto close_and_exit;
 		}
 
-		if (FD_ISSET(sk_unix, &fds))
-			cgre_receive_unix_domain_msg(sk_unix);
+		if (cgre_flush_pending(0))
+			goto close_and_exit;
+
+		for (i = 0; i < cnt; i++) {
+			if (events[i].data.fd == sk_nl) {
+				if (cgre_receive_netlink_msg(sk_nl))
+					goto close_and_exit;
+			} else if (events[i].data.fd == sk_unix) {
+				cgre_receive_unix_domain_msg(epoll_fd, sk_unix);
+			} else if (events[i].data.fd == sig_fd) {
+				cgre_receive_signals(sig_fd);
+			} else if (events[i].data.fd == timer_fd) {
+				cgre_receive_timer(timer_fd);
+			} else if (events[i].data.fd == mounts_fd) {
+				flog(LOG_INFO, "The mounts changed, publishing them again\n");
+				cgre_publish_mounts();
+			} else if (events[i].data.fd == inotify_fd) {
+				cgre_receive_inotify(inotify_fd);
+			} else {
+				client = cgre_client_find(events[i].data.fd);
+				if (client)
+					cgre_receive_client_msg(epoll_fd, client);
+			}
+		}
 	}
 
 close_and_exit:
+	event_filter_sk = -1;
+	for (i = 0; i < CGRE_MAX_CLIENTS; i++) {
+		if (clients[i].fd >= 0)
+			cgre_client_close(epoll_fd, &clients[i]);
+	}
+	if (epoll_fd >= 0)
+		close(epoll_fd);
+	if (mounts_fd >= 0)
+		close(mounts_fd);
+	if (inotify_fd >= 0)
+		close(inotify_fd);
+	if (timer_fd >= 0)
+		close(timer_fd);
+	if (sig_fd >= 0)
+		close(sig_fd);
 	if (sk_nl >= 0)
 		close(sk_nl);
 	if (sk_unix >= 0)
@@ -931,9 +2543,9 @@ int cgre_start_daemon(const char *logp, const int logf, const unsigned char daem
 }
 
 /**
- * Catch the SIGUSR2 signal and reload the rules configuration.
+ * Handle the SIGUSR2 and SIGHUP signals and reload the rules configuration.
  * This function makes use of the logfile and flog() to print the new rules.
- *	@param signum The signal that we caught (always SIGUSR2)
+ *	@param signum The signal that we received (SIGUSR2, SIGHUP)
  */
 void cgre_flash_rules(int signum)
 {
@@ -945,8 +2557,11 @@ void cgre_flash_rules(int signum)
 	flog(LOG_INFO, "Reloading rules configuration\n");
 	flog(LOG_DEBUG, "Current time: %s\n", ctime(&tm));
 
+	cgre_wait_workers();
+
 	/* Ask libcgroup to reload the rules table. */
 	cgroup_reload_cached_rules();
+	rules_fingerprint = cgre_state_fingerprint();
 
 	/* Print the results of the new table to our log file. */
 	if (logfile && loglevel >= LOG_INFO) {
@@ -959,9 +2574,27 @@ void cgre_flash_rules(int signum)
 }
 
 /**
- * Catch the SIGUSR1 signal and reload the rules configuration.
- * This function makes use of the logfile and flog() to print the new rules.
- *	@param signum The signal that we caught (always SIGUSR1)
+ * Write the statistics to the log, one line per counter.
+ */
+static void cgre_log_stats(void)
+{
+	char *text, *line, *saveptr;
+
+	text = cgre_stats_dump();
+	if (!text)
+		return;
+
+	flog(LOG_INFO, "Statistics:\n");
+	for (line = strtok_r(text, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr))
+		flog(LOG_INFO, "  %s\n", line);
+
+	free(text);
+}
+
+/**
+ * Handle the SIGUSR1 signal, reload the templates configuration and log the
+ * statistics of the daemon.
+ *	@param signum The signal that we received (always SIGUSR1)
  */
 void cgre_flash_templates(int signum)
 {
@@ -970,25 +2603,41 @@ void cgre_flash_templates(int signum)
 
 	int fileindex;
 
+	cgre_log_stats();
+
 	flog(LOG_INFO, "Reloading templates configuration.\n");
 	flog(LOG_DEBUG, "Current time: %s\n", ctime(&tm));
 
+	cgre_wait_workers();
+
 	/* Ask libcgroup to reload the templates table. */
 	cgroup_load_templates_cache_from_files(&fileindex);
 }
 
 /**
- * Catch the SIGTERM and SIGINT signals so that we can exit gracefully.
+ * Handle the SIGTERM and SIGINT signals so that we can exit gracefully.
  * Before exiting, this function makes use of the logfile and flog().
- *	@param signum The signal that we caught (SIGTERM, SIGINT)
+ *	@param signum The signal that we received (SIGTERM, SIGINT)
  */
 void cgre_catch_term(int signum)
 {
 	/* Current time */
 	time_t tm = time(0);
 
+	if (cgre_stats.netlink_drops)
+		flog(LOG_INFO, "Netlink receive buffer overran %llu times\n",
+		     (unsigned long long)cgre_stats.netlink_drops);
+
+	/* A restarted daemon keeps the unchanged processes */
+	cgre_save_state();
+
+	cgre_trace_record_stop();
+
 	flog(LOG_INFO, "Stopped CGroup Rules Engine Daemon at %s\n", ctime(&tm));
 
+	/* Write the queued messages before closing the log */
+	cgre_log_async_stop();
+
 	/* Close the log file, if we opened one */
 	if (logfile && logfile != stdout)
 		fclose(logfile);
@@ -1000,6 +2649,146 @@ void cgre_catch_term(int signum)
 	exit(EXIT_SUCCESS);
 }
 
+/**
+ * Block the signals handled by the main loop, it reads them from a signalfd.
+ * The threads started afterwards inherit the mask.
+ *	@return 0 on success, 1 on error
+ */
+static int cgre_block_signals(void)
+{
+	sigemptyset(&cgre_signals);
+	sigaddset(&cgre_signals, SIGHUP);
+	sigaddset(&cgre_signals, SIGUSR1);
+	sigaddset(&cgre_signals, SIGUSR2);
+	sigaddset(&cgre_signals, SIGINT);
+	sigaddset(&cgre_signals, SIGTERM);
+
+	if (sigprocmask(SIG_BLOCK, &cgre_signals, NULL) < 0) {
+		flog(LOG_ERR, "Failed to block the signals: %s\n", strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+/**
+ * Ask the running daemon for its statistics and print them.
+ *	@return 0 on success, 1 on error
+ */
+static int cgre_print_stats(void)
+{
+	int flags = CGRULE_REQUEST_STATS;
+	struct sockaddr_un addr;
+	pid_t pid = getpid();
+	char buf[4096];
+	int ret = 1;
+	ssize_t len;
+	int sk;
+
+	sk = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (sk < 0) {
+		fprintf(stderr, "Error creating UNIX socket: %s\n", strerror(errno));
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, CGRULE_CGRED_SOCKET_PATH);
+
+	if (connect(sk, (struct sockaddr *)&addr,
+		    sizeof(addr.sun_family) + strlen(CGRULE_CGRED_SOCKET_PATH)) < 0) {
+		fprintf(stderr, "Cannot connect to %s, is cgrulesengd running? %s\n",
+			CGRULE_CGRED_SOCKET_PATH, strerror(errno));
+		goto close;
+	}
+
+	if (write(sk, &pid, sizeof(pid)) != sizeof(pid) ||
+	    write(sk, &flags, sizeof(flags)) != sizeof(flags)) {
+		fprintf(stderr, "Error writing to %s: %s\n", CGRULE_CGRED_SOCKET_PATH,
+			strerror(errno));
+		goto close;
+	}
+
+	/* The daemon closes the connection after the last counter */
+	while ((len = read(sk, buf, sizeof(buf))) != 0) {
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0) {
+			fprintf(stderr, "Error reading %s: %s\n", CGRULE_CGRED_SOCKET_PATH,
+				strerror(errno));
+			goto close;
+		}
+		fwrite(buf, 1, len, stdout);
+	}
+
+	ret = 0;
+close:
+	close(sk);
+
+	return ret;
+}
+
+/**
+ * Feed the events of a recording to the classification, in place of the
+ * netlink socket, and print the throughput and the statistics.
+ *	@param max_speed Replay as fast as possible, otherwise at the pace
+ *		of the recording
+ *	@return 0 on success, 1 on error
+ */
+static int cgre_replay(int max_speed)
+{
+	u_int64_t start, first, due, elapsed;
+	struct proc_event ev;
+	struct timespec ts;
+	char *stats;
+	size_t i;
+
+	start = cgre_now_ns();
+	first = replay_trace->event_cnt ? replay_trace->events[0].timestamp_ns : 0;
+
+	for (i = 0; i < replay_trace->event_cnt; i++) {
+		ev = replay_trace->events[i];
+
+		if (max_speed) {
+			ev.timestamp_ns = cgre_now_ns();
+		} else {
+			/* The timestamps of the CPUs may be slightly out of order */
+			due = start + (ev.timestamp_ns > first ? ev.timestamp_ns - first : 0);
+			if (due > cgre_now_ns()) {
+				/* The queued events go before the wait */
+				if (cgre_process_event_ring())
+					return 1;
+				ts.tv_sec = due / 1000000000;
+				ts.tv_nsec = due % 1000000000;
+				while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+					;
+			}
+			ev.timestamp_ns = due;
+		}
+
+		if (cgre_queue_event(&ev, sizeof(ev)))
+			return 1;
+	}
+
+	if (cgre_process_event_ring() || cgre_flush_pending(1))
+		return 1;
+	cgre_wait_workers();
+
+	elapsed = cgre_now_ns() - start;
+	printf("events %zu\n", replay_trace->event_cnt);
+	printf("elapsed_ns %llu\n", (unsigned long long)elapsed);
+	printf("events_per_sec %llu\n", elapsed ?
+	       (unsigned long long)(replay_trace->event_cnt * 1000000000.0 / elapsed) : 0ULL);
+
+	stats = cgre_stats_dump();
+	if (stats) {
+		fputs(stats, stdout);
+		free(stats);
+	}
+
+	return 0;
+}
+
 /**
  * Parse the syslog facility as received on command line.
  *	@param arg Command line argument with the syslog facility
@@ -1037,6 +2826,12 @@ static int cgre_parse_syslog_facility(const char *arg)
 	}
 }
 
+#ifdef UNIT_TEST
+/* The unit tests have a main() of their own */
+#define main cgre_main
+int cgre_main(int argc, char *argv[]);
+#endif
+
 int main(int argc, char *argv[])
 {
 	/* Patch to the log file */
@@ -1049,19 +2844,37 @@ int main(int argc, char *argv[])
 	int verbosity = 1;
 
 	/* For catching signals */
-	struct sigaction sa;
 
 	/* Should we daemonize? */
 	unsigned char daemon = 1;
 
+	/* Only print the statistics of the running daemon */
+	int print_stats = 0;
+
+	/* Write the log from a separate thread */
+	int async_log = 0;
+
+	/* Recording of the events, written or replayed */
+	const char *record_path = NULL;
+	const char *replay_path = NULL;
+	int replay_max_speed = 0;
+	struct cgre_trace trace = { };
+
 	/* Return codes */
 	int ret = 0;
 
 	struct passwd *pw;
 	struct group *gr;
 
+	/* Lifetime of the cached group members */
+	long group_cache_ttl = CGRE_GROUP_CACHE_TTL;
+	long rcvbuf;
+	long threads;
+	long coalesce;
+	char *endptr;
+
 	/* Command line arguments */
-	const char *short_options = "hvqf:s::ndQu:g:";
+	const char *short_options = "hvqf:s::ndQu:g:t:b:T:SaFwc:r:R:";
 	struct option long_options[] = {
 		{"help",	       no_argument, NULL, 'h'},
 		{"verbose",	       no_argument, NULL, 'v'},
@@ -1073,6 +2886,17 @@ int main(int argc, char *argv[])
 		{"nolog",	       no_argument, NULL, 'Q'},
 		{"socket-user",  required_argument, NULL, 'u'},
 		{"socket-group", required_argument, NULL, 'g'},
+		{"group-cache-ttl", required_argument, NULL, 't'},
+		{"rcvbuf",	 required_argument, NULL, 'b'},
+		{"threads",	 required_argument, NULL, 'T'},
+		{"stats",	       no_argument, NULL, 'S'},
+		{"async-log",	       no_argument, NULL, 'a'},
+		{"no-event-filter",    no_argument, NULL, 'F'},
+		{"watch-rules",	       no_argument, NULL, 'w'},
+		{"coalesce",	 required_argument, NULL, 'c'},
+		{"record",	 required_argument, NULL, 'r'},
+		{"replay",	 required_argument, NULL, 'R'},
+		{"replay-speed", required_argument, NULL, 'P'},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -1172,6 +2996,77 @@ int main(int argc, char *argv[])
 			flog(LOG_DEBUG, "Using socket group %s id %d\n", optarg,
 			     (int)socket_group);
 			break;
+		case 't': /* --group-cache-ttl */
+			errno = 0;
+			group_cache_ttl = strtol(optarg, &endptr, 10);
+			if (errno || *endptr != '\0' || endptr == optarg || group_cache_ttl < 0) {
+				usage(stderr, "Invalid group cache TTL %s", optarg);
+				ret = 2;
+				goto finished;
+			}
+			break;
+		case 'b': /* --rcvbuf */
+			errno = 0;
+			rcvbuf = strtol(optarg, &endptr, 10);
+			if (errno || *endptr != '\0' || endptr == optarg || rcvbuf < 0 ||
+			    rcvbuf > INT_MAX) {
+				usage(stderr, "Invalid receive buffer size %s", optarg);
+				ret = 2;
+				goto finished;
+			}
+			netlink_rcvbuf = rcvbuf;
+			break;
+		case 'T': /* --threads */
+			errno = 0;
+			threads = strtol(optarg, &endptr, 10);
+			if (errno || *endptr != '\0' || endptr == optarg || threads < 1 ||
+			    threads > CGRE_MAX_THREADS) {
+				usage(stderr, "Invalid number of threads %s", optarg);
+				ret = 2;
+				goto finished;
+			}
+			worker_cnt = threads;
+			break;
+		case 'S': /* --stats */
+			print_stats = 1;
+			break;
+		case 'a': /* --async-log */
+			async_log = 1;
+			break;
+		case 'F': /* --no-event-filter */
+			event_filter = 0;
+			break;
+		case 'w': /* --watch-rules */
+			watch_rules = 1;
+			break;
+		case 'c': /* --coalesce */
+			errno = 0;
+			coalesce = strtol(optarg, &endptr, 10);
+			if (errno || *endptr != '\0' || endptr == optarg || coalesce < 0 ||
+			    coalesce > CGRE_COALESCE_MAX_MS) {
+				usage(stderr, "Invalid coalescing window %s", optarg);
+				ret = 2;
+				goto finished;
+			}
+			coalesce_ms = coalesce;
+			break;
+		case 'r': /* --record */
+			record_path = optarg;
+			break;
+		case 'R': /* --replay */
+			replay_path = optarg;
+			break;
+		case 'P': /* --replay-speed */
+			if (!strcmp(optarg, "max")) {
+				replay_max_speed = 1;
+			} else if (!strcmp(optarg, "original")) {
+				replay_max_speed = 0;
+			} else {
+				usage(stderr, "Invalid replay speed %s", optarg);
+				ret = 2;
+				goto finished;
+			}
+			break;
 		default:
 			usage(stderr, "");
 			ret = 2;
@@ -1179,6 +3074,26 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (print_stats) {
+		ret = cgre_print_stats();
+		goto finished;
+	}
+
+	if (record_path && replay_path) {
+		usage(stderr, "Cannot record and replay at once");
+		ret = 2;
+		goto finished;
+	}
+
+	/* The replay prints its results, it does not become a daemon */
+	if (replay_path) {
+		ret = cgre_trace_load(replay_path, &trace);
+		if (ret)
+			goto finished;
+		replay_trace = &trace;
+		daemon = 0;
+	}
+
 	/* Initialize libcgroup. */
 	ret = cgroup_init();
 	if (ret != 0) {
@@ -1187,6 +3102,23 @@ int main(int argc, char *argv[])
 		goto finished;
 	}
 
+	/* The groups are listed before the fork of the daemon, with the errors on stderr */
+	if (record_path) {
+		ret = cgre_trace_record_start(record_path);
+		if (ret)
+			goto finished;
+	}
+
+	/* The processes are moved into the groups of the recording, not the real ones */
+	if (replay_trace) {
+		ret = cgre_trace_stub_cgroupfs(replay_trace);
+		if (ret)
+			goto finished;
+	}
+
+	/* The group cache TTL applies when the rules cache is built. */
+	cgroup_set_group_cache_ttl(group_cache_ttl);
+
 	/* Ask libcgroup to load the configuration rules. */
 	ret = cgroup_string_list_init(&template_files, CGCONFIG_CONF_FILES_LIST_MINIMUM_SIZE);
 	if (ret) {
@@ -1229,50 +3161,44 @@ int main(int argc, char *argv[])
 		goto finished;
 	}
 
-	/*
-	 * Set up the signal handler to reload the cached rules upon
-	 * reception of a SIGUSR2 signal.
-	 */
-	memset(&sa, 0, sizeof(sa));
-	sa.sa_handler = &cgre_flash_rules;
-	sigemptyset(&sa.sa_mask);
-	ret = sigaction(SIGUSR2, &sa, NULL);
-	if (ret) {
-		flog(LOG_ERR, "Failed to set up signal handler for SIGUSR2. Error: %s\n",
-		     strerror(errno));
-		goto finished;
-	}
-
-	/*
-	 * Set up the signal handler to reload templates cache upon
-	 * reception of a SIGUSR1 signal.
-	 */
-	sa.sa_handler = &cgre_flash_templates;
-	ret = sigaction(SIGUSR1, &sa, NULL);
-	if (ret) {
-		flog(LOG_ERR, "Failed to set up signal handler for SIGUSR1. Error: %s\n",
-		     strerror(errno));
-		goto finished;
+	/* The logging thread is started after the fork of the daemon. */
+	if (async_log) {
+		ret = cgre_log_async_start();
+		if (ret)
+			goto finished;
 	}
 
 	/*
-	 * Set up the signal handler to catch SIGINT and SIGTERM so that
-	 * we can exit gracefully
+	 * The reload and termination signals are handled by the main loop,
+	 * they wait there until the initial scan is done.  The replay has no
+	 * main loop, the signals keep their default action.
 	 */
-	sa.sa_handler = &cgre_catch_term;
-	ret = sigaction(SIGINT, &sa, NULL);
-	ret |= sigaction(SIGTERM, &sa, NULL);
-	if (ret) {
-		flog(LOG_ERR, "Failed to set up the signal handler. Error: %s\n", strerror(errno));
-		goto finished;
+	if (!replay_trace) {
+		ret = cgre_block_signals();
+		if (ret)
+			goto finished;
 	}
 
 	/* Print the configuration to the log file, or stdout. */
 	if (logfile && loglevel >= LOG_INFO)
 		cgroup_print_rules_config(logfile);
 
+	/* The threads are started after the fork of the daemon. */
+	ret = cgre_start_workers();
+	if (ret)
+		goto finished;
+
+	if (replay_trace) {
+		ret = cgre_replay(replay_max_speed);
+		goto finished;
+	}
+
+	if (record_path)
+		flog(LOG_INFO, "Recording the events to %s\n", record_path);
+
 	/* Scan for running applications with rules */
-	ret = cgroup_change_all_cgroups();
+	rules_fingerprint = cgre_state_fingerprint();
+	ret = cgre_classify_running_tasks();
 	if (ret)
 		flog(LOG_WARNING, "Failed to initialize running tasks.\n");
 
@@ -1283,6 +3209,9 @@ int main(int argc, char *argv[])
 
 finished:
 	cgroup_string_list_free(&template_files);
+	cgre_trace_record_stop();
+	cgre_trace_free(&trace);
+	cgre_log_async_stop();
 
 finished_without_temp_files:
 	if (logfile && logfile != stdout)
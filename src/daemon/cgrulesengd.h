@@ -17,6 +17,9 @@ extern "C" {
 #include "config.h"
 #include "libcgroup.h"
 
+#include <stdarg.h>
+#include <stdio.h>
+
 #include <linux/connector.h>
 #include <linux/cn_proc.h>
 
@@ -41,6 +44,136 @@ extern "C" {
 #define PROC_CN_MCAST_LISTEN (1)
 #define PROC_CN_MCAST_IGNORE (2)
 
+/* Default lifetime of the cached group members, in seconds */
+#define CGRE_GROUP_CACHE_TTL	60
+
+/* Maximum number of netlink datagrams received by one recvmmsg() call */
+#define CGRE_NETLINK_BATCH	64
+
+/* Number of received events waiting for the classification */
+#define CGRE_EVENT_RING_SIZE	4096
+
+/* Default size of the netlink socket receive buffer, in bytes */
+#define CGRE_NETLINK_RCVBUF	(4 * 1024 * 1024)
+
+/* Seconds a changed parent is remembered for its fork events, and period of the expiry */
+#define CGRE_PARENT_INFO_TTL	10
+
+/* Number of events waiting in the queue of one classification thread */
+#define CGRE_WORKER_QUEUE_SIZE	1024
+
+/* Default window during which the events of a process are merged, in milliseconds */
+#define CGRE_COALESCE_MS	5
+
+/* Longest coalescing window accepted, in milliseconds */
+#define CGRE_COALESCE_MAX_MS	1000
+
+/* Number of processes whose events wait for the end of the coalescing window */
+#define CGRE_PENDING_SIZE	1024
+
+/* Classification state kept across the restarts of the daemon, see state.c */
+#define CGRE_STATE_FILE		"/run/cgred.state"
+
+/* Seconds between two writes of the state, unless the sticky processes change */
+#define CGRE_STATE_PERIOD	60
+
+/* Seconds before the write of the state its time is set to, for the events in flight */
+#define CGRE_STATE_SLACK	2
+
+/* Clients connected at once to the daemon socket */
+#define CGRE_MAX_CLIENTS	128
+
+/* Bytes of requests read at once from a client of the socket */
+#define CGRE_CLIENT_IN_SIZE	4096
+
+/* Reads from one client in a wakeup of the main loop */
+#define CGRE_CLIENT_READS	16
+
+/* Bytes of replies pending before a client of the socket is not read anymore */
+#define CGRE_CLIENT_OUT_MAX	(64 * 1024)
+
+/* Maximum number of classification threads */
+#define CGRE_MAX_THREADS	1024
+
+/* Number of messages waiting in the ring of the asynchronous logging */
+#define CGRE_LOG_RING_SIZE	1024
+
+/* Maximum length of a message of the asynchronous logging */
+#define CGRE_LOG_LINE_MAX	512
+
+/* Sub-buckets of each power of two of a histogram, as a number of bits */
+#define CGRE_HIST_SUB_BITS	3
+#define CGRE_HIST_SUB		(1 << CGRE_HIST_SUB_BITS)
+#define CGRE_HIST_BUCKETS	((64 - CGRE_HIST_SUB_BITS + 1) * CGRE_HIST_SUB)
+
+/* Histogram of durations, in nanoseconds */
+struct cgre_histogram {
+	u_int64_t buckets[CGRE_HIST_BUCKETS];
+	u_int64_t count;
+	u_int64_t sum;
+	u_int64_t max;
+};
+
+enum cgre_stats_event {
+	CGRE_STATS_EVENT_FORK,
+	CGRE_STATS_EVENT_EXEC,
+	CGRE_STATS_EVENT_UID,
+	CGRE_STATS_EVENT_GID,
+	CGRE_STATS_EVENT_EXIT,
+	CGRE_STATS_EVENT_OTHER,
+	CGRE_STATS_EVENTS,
+};
+
+struct cgre_stats {
+	/* Events received, per type */
+	u_int64_t events[CGRE_STATS_EVENTS];
+	u_int64_t datagrams;
+	/* Number of times the kernel dropped netlink messages */
+	u_int64_t netlink_drops;
+	/* Classifications that moved the process or matched no rule */
+	u_int64_t classified;
+	u_int64_t failed;
+	/* Events merged with a later event of their process, or cancelled by its exit */
+	u_int64_t coalesced;
+
+	/* From the kernel event to the end of its classification */
+	struct cgre_histogram latency;
+	/* From the kernel event to the start of its classification */
+	struct cgre_histogram queue;
+	struct cgre_histogram proc_read;
+	struct cgre_histogram rule_match;
+	/* Creation of the groups from templates and move of the process */
+	struct cgre_histogram attach;
+};
+
+extern struct cgre_stats cgre_stats;
+
+/**
+ * Get the time of CLOCK_MONOTONIC, the clock of the timestamps of the
+ * kernel events.
+ *	@return The time in nanoseconds, 0 on error
+ */
+u_int64_t cgre_now_ns(void);
+
+/**
+ * Count a received event.  Must be called by the main thread only.
+ *	@param what The type of the event, PROC_EVENT_*
+ */
+void cgre_stats_count_event(unsigned int what);
+
+/**
+ * Record a duration in a histogram.  Safe to call from any thread.
+ *	@param hist The histogram
+ *	@param value The duration, in nanoseconds
+ */
+void cgre_hist_record(struct cgre_histogram * const hist, u_int64_t value);
+
+/**
+ * Format the statistics as "name value" lines.
+ *	@return The text, to be freed by the caller, NULL on error
+ */
+char *cgre_stats_dump(void);
+
 /**
  * Prints the usage information for this program and, optionally,
  * an error message. This function uses vfprintf.
@@ -60,6 +193,221 @@ void cgre_usage(FILE *fd, const char *msg, ...);
  */
 void flog(int level, const char *msg, ...);
 
+/* Log file, NULL if logging to file is disabled */
+extern FILE *logfile;
+
+/* Log facility, 0 if logging to syslog is disabled */
+extern int logfacility;
+
+/**
+ * Start the thread writing the log messages, flog() then queues the
+ * messages instead of writing them.
+ *	@return 0 on success, 1 on error
+ */
+int cgre_log_async_start(void);
+
+/**
+ * Write the queued log messages and stop the logging thread.
+ */
+void cgre_log_async_stop(void);
+
+/**
+ * Queue a log message for the logging thread.
+ *	@param level The log level (LOG_EMERG ... LOG_DEBUG)
+ *	@param format The format for the message (vprintf style)
+ *	@param ap Any args to format (vprintf style)
+ *	@return 0 if the message was queued or dropped, -1 if the asynchronous
+ *	logging is not running
+ */
+int cgre_log_async_queue(int level, const char *format, va_list ap);
+
+/**
+ * Get the number of log messages dropped because the ring was full.
+ */
+u_int64_t cgre_log_async_drops(void);
+
+/* A process registered as sticky, its cgroup is not changed by the daemon */
+struct cgre_state_pid {
+	pid_t pid;
+	/* Start time, in clock ticks since boot, tells a reused pid apart */
+	u_int64_t start;
+	/* CGROUP_DAEMON_UNCHANGE_* */
+	int flags;
+};
+
+/* The classification state of the daemon */
+struct cgre_state {
+	/* Fingerprint of the rules, see cgre_state_fingerprint() */
+	u_int64_t rules;
+	/* The processes started before are classified, in clock ticks since boot */
+	u_int64_t time;
+	struct cgre_state_pid *pids;
+	int count;
+};
+
+/**
+ * Get the time since boot, in the clock ticks of the start times of the
+ * processes.
+ *	@return The time, 0 on error
+ */
+u_int64_t cgre_state_now(void);
+
+/**
+ * Get the start time of a process.
+ *	@param pid The process
+ *	@param start Set to the start time, in clock ticks since boot
+ *	@return 0 on success, 1 if the process does not exist
+ */
+int cgre_proc_start_time(pid_t pid, u_int64_t * const start);
+
+/**
+ * Compute the fingerprint of the loaded rules.
+ *	@return The fingerprint, 0 on error
+ */
+u_int64_t cgre_state_fingerprint(void);
+
+/**
+ * Write the state, it replaces the previous one at once.
+ *	@param path The state file
+ *	@param state The state
+ *	@return 0 on success, 1 on error
+ */
+int cgre_state_save(const char * const path, const struct cgre_state * const state);
+
+/**
+ * Read the state written during the current boot.
+ *	@param path The state file
+ *	@param state Filled with the state, to be freed with cgre_state_free()
+ *	@return 0 on success, 1 if there is no valid state of this boot
+ */
+int cgre_state_load(const char * const path, struct cgre_state * const state);
+
+/**
+ * Free the processes of a state.
+ *	@param state The state
+ */
+void cgre_state_free(struct cgre_state * const state);
+
+/* The events the daemon handles */
+#define CGRE_FILTER_EVENTS	(PROC_EVENT_FORK | PROC_EVENT_EXEC | PROC_EVENT_UID | \
+				 PROC_EVENT_GID | PROC_EVENT_EXIT)
+
+/* Listen request of the proc connector with the mask of the events, Linux 6.6 */
+struct cgre_proc_input {
+	__u32 mcast_op;
+	__u32 event_type;
+};
+
+/**
+ * Attach the filter of the events to the netlink socket, it replaces the
+ * filter attached before.
+ *	@param sk_nl The netlink socket
+ *	@param exits True to pass the exit events
+ *	@return 0 on success, 1 on error
+ */
+int cgre_filter_attach(int sk_nl, bool exits);
+
+/**
+ * Check whether the kernel filters the events by the mask of the listen
+ * request, struct cgre_proc_input.
+ */
+bool cgre_filter_kernel_supported(void);
+
+/* A process read from /proc during the recording, see trace.c */
+struct cgre_trace_proc {
+	pid_t pid;
+	/* Order of the read in the recording */
+	size_t seq;
+	/* Error of cgroup_get_proc_info_from_procfs() */
+	int ret;
+	uid_t euid;
+	gid_t egid;
+	char *procname;
+	/* Taken by the replay */
+	bool used;
+};
+
+/* A recording of the events, loaded for the replay */
+struct cgre_trace {
+	struct proc_event *events;
+	size_t event_cnt;
+	/* Sorted by pid, then in the order they were read */
+	struct cgre_trace_proc *procs;
+	size_t proc_cnt;
+	/* The directories of the hierarchies, parents first */
+	char **groups;
+	size_t group_cnt;
+};
+
+/**
+ * Start recording the events, with the groups of the mounted hierarchies.
+ *	@param path The recording, replaced
+ *	@return 0 on success, 1 on error
+ */
+int cgre_trace_record_start(const char * const path);
+
+/**
+ * Write the rest of the recording and stop recording.
+ */
+void cgre_trace_record_stop(void);
+
+/**
+ * Record a received event, if the daemon records.  Must be called by the
+ * main thread only.
+ *	@param ev The event
+ */
+void cgre_trace_record_event(const struct proc_event * const ev);
+
+/**
+ * Record the details of a process read from /proc, if the daemon records.
+ * Safe to call from any thread.
+ *	@param pid The process
+ *	@param ret The error of cgroup_get_proc_info_from_procfs()
+ *	@param euid The effective user of the process
+ *	@param egid The effective group of the process
+ *	@param procname The name of the program of the process
+ */
+void cgre_trace_record_proc(pid_t pid, int ret, uid_t euid, gid_t egid,
+			    const char * const procname);
+
+/**
+ * Load a recording.
+ *	@param path The recording
+ *	@param trace Filled with the recording, to be freed with cgre_trace_free()
+ *	@return 0 on success, 1 on error
+ */
+int cgre_trace_load(const char * const path, struct cgre_trace * const trace);
+
+/**
+ * Free a recording.
+ *	@param trace The recording
+ */
+void cgre_trace_free(struct cgre_trace * const trace);
+
+/**
+ * Get the details of a process from a recording, in place of /proc.  The
+ * reads of a process take its records in turn.
+ *	@param trace The recording
+ *	@param pid The process
+ *	@param euid Filled with the effective user of the process
+ *	@param egid Filled with the effective group of the process
+ *	@param procname Filled with the name of the program, to be freed
+ *	@return 0 on success, ECGROUPNOTEXIST if the process was not recorded,
+ *		the recorded error if it was gone
+ */
+int cgre_trace_proc_info(struct cgre_trace * const trace, pid_t pid, uid_t *euid, gid_t *egid,
+			 char **procname);
+
+/**
+ * Cover the mounted hierarchies with a tmpfs holding the recorded groups,
+ * in a mount namespace of the daemon.  A group is only created beneath the
+ * tmpfs of its hierarchy, the other groups are skipped.  Must be called
+ * before the classification threads start.
+ *	@param trace The recording
+ *	@return 0 on success, 1 on error
+ */
+int cgre_trace_stub_cgroupfs(const struct cgre_trace * const trace);
+
 /**
  * Process an event from the kernel, and determine the correct UID/GID/PID
  * to pass to libcgroup. Then, libcgroup will decide the cgroup to move
@@ -95,26 +443,54 @@ int cgre_start_daemon(const char *logp, const int logf, const unsigned char daem
 		      const int logv);
 
 /**
- * Catch the SIGUSR2 signal and reload the rules configuration.
+ * Handle the SIGUSR2 and SIGHUP signals and reload the rules configuration.
  * This function makes use of the logfile and flog() to print the new rules.
- *	@param signum The signal that we caught (always SIGUSR2)
+ *	@param signum The signal that we received (SIGUSR2, SIGHUP)
  */
 void cgre_flash_rules(int signum);
 
 /**
- * Catch the SIGUSR1 signal and reload the rules configuration.
- * This function makes use of the logfile and flog() to print the new rules.
- *	@param signum The signal that we caught (always SIGUSR1)
+ * Handle the SIGUSR1 signal, reload the templates configuration and log the
+ * statistics of the daemon.
+ *	@param signum The signal that we received (always SIGUSR1)
  */
 void cgre_flash_templates(int signum);
 
 /**
- * Catch the SIGTERM and SIGINT signal so that we can exit gracefully.
+ * Handle the SIGTERM and SIGINT signals so that we can exit gracefully.
  * Before exiting, this function makes use of the logfile and flog().
- *	@param signum The signal that we caught (SIGTERM, SIGINT)
+ *	@param signum The signal that we received (SIGTERM, SIGINT)
  */
 void cgre_catch_term(int signum);
 
+/*
+ * Functions that are defined as STATIC can be placed within the UNIT_TEST
+ * ifdef.  This will allow them to be included in the unit tests while
+ * remaining static in the daemon.
+ */
+#ifdef UNIT_TEST
+
+int cgre_store_parent_info(pid_t pid);
+int cgre_was_parent_changed_when_forking(const struct proc_event *ev);
+
+int cgre_store_unchanged_process(pid_t pid, int flags);
+void cgre_remove_unchanged_process(pid_t pid);
+int cgre_is_unchanged_process(pid_t pid);
+int cgre_is_unchanged_child(pid_t pid);
+
+extern struct cgre_trace *replay_trace;
+extern int event_filter_sk;
+extern unsigned int coalesce_ms;
+
+int cgre_coalesce_event(const struct proc_event *ev);
+int cgre_flush_pending(int all);
+
+int cgre_trace_stub_add_root(const char * const path);
+void cgre_trace_stub_free_roots(void);
+int cgre_trace_stub_group(const char * const group);
+
+#endif /* UNIT_TEST */
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
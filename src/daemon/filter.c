@@ -0,0 +1,83 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Kernel-side filtering of the proc connector events of the cgroup rules
+ * engine daemon
+ *
+ * The daemon classifies the processes on their fork, exec, uid and gid
+ * events, and only needs the exit events to forget the processes it must
+ * not move.  A classic BPF filter on the netlink socket drops the other
+ * events before they wake the daemon up, and the exit events while no such
+ * process is registered.  The fork events cannot be filtered by pid: a fork
+ * matters when its parent is moved after it, the event is emitted before
+ * the daemon knows it.
+ *
+ * Since Linux 6.6 the listen request of the proc connector also carries the
+ * mask of the events, so the kernel does not even allocate them.
+ */
+
+#include "../libcgroup-internal.h"
+#include "cgrulesengd.h"
+
+#include <sys/utsname.h>
+#include <sys/socket.h>
+
+#include <arpa/inet.h>
+
+#include <linux/connector.h>
+#include <linux/cn_proc.h>
+#include <linux/netlink.h>
+#include <linux/filter.h>
+
+#include <stddef.h>
+#include <string.h>
+#include <syslog.h>
+#include <errno.h>
+#include <stdio.h>
+
+/* Offset of the type of the event in a datagram of the proc connector */
+#define CGRE_EVENT_WHAT_OFFSET	\
+	(NLMSG_LENGTH(0) + sizeof(struct cn_msg) + offsetof(struct proc_event, what))
+
+int cgre_filter_attach(int sk_nl, bool exits)
+{
+	struct sock_filter code[] = {
+		/* The event type, in host order, read as big endian */
+		BPF_STMT(BPF_LD | BPF_W | BPF_ABS, CGRE_EVENT_WHAT_OFFSET),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(PROC_EVENT_FORK), 5, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(PROC_EVENT_EXEC), 4, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(PROC_EVENT_UID), 3, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(PROC_EVENT_GID), 2, 0),
+		BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, htonl(PROC_EVENT_EXIT), exits ? 1 : 0, 0),
+		/* Drop */
+		BPF_STMT(BPF_RET | BPF_K, 0),
+		/* Accept the whole datagram */
+		BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+	};
+	struct sock_fprog prog = {
+		.len = ARRAY_SIZE(code),
+		.filter = code,
+	};
+
+	if (setsockopt(sk_nl, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+		flog(LOG_WARNING, "Warning: cannot filter the netlink events: %s\n",
+		     strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+bool cgre_filter_kernel_supported(void)
+{
+	unsigned int major, minor;
+	struct utsname uts;
+
+	/*
+	 * An older kernel ignores a listen request carrying the event mask,
+	 * the daemon would then receive no event at all.
+	 */
+	if (uname(&uts) || sscanf(uts.release, "%u.%u", &major, &minor) != 2)
+		return false;
+
+	return major > 6 || (major == 6 && minor >= 6);
+}
@@ -0,0 +1,213 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Asynchronous logging of the cgroup rules engine daemon
+ *
+ * The messages are formatted by the threads calling flog() into a bounded
+ * ring, the lock-free queue of Dmitry Vyukov: each slot carries a sequence
+ * number telling whether it is free for the producer of a given position or
+ * ready for the writer.  The writer thread takes the messages in order, writes
+ * them to the log file without flushing each line, then flushes once the
+ * ring is empty.  A message is dropped, and counted, when the ring is full.
+ */
+
+#include "../libcgroup-internal.h"
+#include "cgrulesengd.h"
+
+#include <semaphore.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <string.h>
+#include <syslog.h>
+#include <stdio.h>
+
+struct cgre_log_entry {
+	unsigned long seq;
+	int level;
+	char msg[CGRE_LOG_LINE_MAX];
+};
+
+static struct cgre_log_entry log_ring[CGRE_LOG_RING_SIZE];
+
+/* Next position to fill, shared by the producers */
+static unsigned long log_tail;
+
+/* Next position to write, owned by the writer thread */
+static unsigned long log_head;
+
+/* Posted for each queued message, and to stop the writer */
+static sem_t log_sem;
+
+static pthread_t log_thread;
+static int log_running;
+static int log_stop;
+
+/* Number of producers between their check of log_running and their message */
+static unsigned int log_producers;
+
+/* Number of messages dropped before the writer got to them */
+static u_int64_t log_drops;
+static u_int64_t log_drops_reported;
+
+int cgre_log_async_queue(int level, const char *format, va_list ap)
+{
+	struct cgre_log_entry *entry;
+	unsigned long pos, seq;
+
+	/* Pairs with cgre_log_async_stop(), which clears log_running first */
+	__atomic_add_fetch(&log_producers, 1, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&log_running, __ATOMIC_SEQ_CST)) {
+		__atomic_sub_fetch(&log_producers, 1, __ATOMIC_RELEASE);
+		return -1;
+	}
+
+	pos = __atomic_load_n(&log_tail, __ATOMIC_RELAXED);
+	for (;;) {
+		entry = &log_ring[pos % CGRE_LOG_RING_SIZE];
+		seq = __atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE);
+
+		if (seq == pos) {
+			if (__atomic_compare_exchange_n(&log_tail, &pos, pos + 1, true,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if ((long)(seq - pos) < 0) {
+			/* The writer did not free the slot yet, the ring is full */
+			__atomic_add_fetch(&log_drops, 1, __ATOMIC_RELAXED);
+			__atomic_sub_fetch(&log_producers, 1, __ATOMIC_RELEASE);
+			return 0;
+		} else {
+			pos = __atomic_load_n(&log_tail, __ATOMIC_RELAXED);
+		}
+	}
+
+	entry->level = level;
+	vsnprintf(entry->msg, sizeof(entry->msg), format, ap);
+	__atomic_store_n(&entry->seq, pos + 1, __ATOMIC_RELEASE);
+	__atomic_sub_fetch(&log_producers, 1, __ATOMIC_RELEASE);
+
+	sem_post(&log_sem);
+
+	return 0;
+}
+
+u_int64_t cgre_log_async_drops(void)
+{
+	return __atomic_load_n(&log_drops, __ATOMIC_RELAXED);
+}
+
+static void cgre_log_write_entry(int level, const char * const msg)
+{
+	if (logfile)
+		fputs(msg, logfile);
+
+	if (logfacility)
+		syslog(LOG_MAKEPRI(logfacility, level), "%s", msg);
+}
+
+/**
+ * Write all the messages ready in the ring.
+ *	@return The number of messages written
+ */
+static unsigned int cgre_log_drain(void)
+{
+	struct cgre_log_entry *entry;
+	unsigned int cnt = 0;
+	char msg[64];
+	u_int64_t drops;
+
+	for (;;) {
+		entry = &log_ring[log_head % CGRE_LOG_RING_SIZE];
+		if (__atomic_load_n(&entry->seq, __ATOMIC_ACQUIRE) != log_head + 1)
+			break;
+
+		cgre_log_write_entry(entry->level, entry->msg);
+		__atomic_store_n(&entry->seq, log_head + CGRE_LOG_RING_SIZE, __ATOMIC_RELEASE);
+		log_head++;
+		cnt++;
+	}
+
+	drops = cgre_log_async_drops();
+	if (drops != log_drops_reported) {
+		snprintf(msg, sizeof(msg), "Log ring full, %llu messages dropped\n",
+			 (unsigned long long)(drops - log_drops_reported));
+		cgre_log_write_entry(LOG_WARNING, msg);
+		log_drops_reported = drops;
+	}
+
+	if (cnt && logfile)
+		fflush(logfile);
+
+	return cnt;
+}
+
+static void *cgre_log_thread(void *arg)
+{
+	for (;;) {
+		while (sem_wait(&log_sem) && errno == EINTR)
+			;
+
+		cgre_log_drain();
+
+		if (__atomic_load_n(&log_stop, __ATOMIC_ACQUIRE))
+			break;
+	}
+
+	/*
+	 * log_running is cleared: once the producers which saw it set are
+	 * done, every slot taken is filled and no more are taken.
+	 */
+	while (__atomic_load_n(&log_producers, __ATOMIC_SEQ_CST))
+		sched_yield();
+	cgre_log_drain();
+
+	return NULL;
+}
+
+int cgre_log_async_start(void)
+{
+	sigset_t sigset, oldset;
+	unsigned long i;
+	int ret;
+
+	for (i = 0; i < CGRE_LOG_RING_SIZE; i++)
+		log_ring[i].seq = i;
+	log_head = 0;
+	log_tail = 0;
+	log_stop = 0;
+
+	if (sem_init(&log_sem, 0, 0)) {
+		flog(LOG_ERR, "Failed to initialize the log semaphore: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* The signals are handled by the main thread */
+	sigfillset(&sigset);
+	pthread_sigmask(SIG_BLOCK, &sigset, &oldset);
+	ret = pthread_create(&log_thread, NULL, cgre_log_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+	if (ret) {
+		flog(LOG_ERR, "Failed to create the logging thread: %s\n", strerror(ret));
+		sem_destroy(&log_sem);
+		return 1;
+	}
+
+	__atomic_store_n(&log_running, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void cgre_log_async_stop(void)
+{
+	if (!__atomic_load_n(&log_running, __ATOMIC_ACQUIRE))
+		return;
+
+	/* The messages logged from now on are written synchronously */
+	__atomic_store_n(&log_running, 0, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&log_stop, 1, __ATOMIC_RELEASE);
+	sem_post(&log_sem);
+
+	/* The semaphore is not destroyed, a late producer may still post it */
+	pthread_join(log_thread, NULL);
+}
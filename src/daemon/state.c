@@ -0,0 +1,233 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Classification state of the cgroup rules engine daemon, kept across its
+ * restarts
+ *
+ * On startup the daemon classified every process of the system, and the
+ * processes registered as sticky by cgexec and cgclassify were forgotten.
+ * The state file records these processes, a fingerprint of the rules and
+ * the time it was written.  When the daemon starts again within the same
+ * boot, it keeps the sticky processes which still run, and if the rules
+ * did not change, it only classifies the processes started after that
+ * time.
+ *
+ * The state is a text file:
+ *	cgrulesengd-state <version>
+ *	boot <boot id>
+ *	rules <fingerprint>
+ *	time <clock ticks since boot>
+ *	<pid> <start time in clock ticks since boot> <flags>
+ *	...
+ */
+
+#include "../libcgroup-internal.h"
+#include "cgrulesengd.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#define CGRE_STATE_MAGIC	"cgrulesengd-state"
+/* Bumped whenever the content of the file changes */
+#define CGRE_STATE_VERSION	1
+
+#define CGRE_BOOT_ID_FILE	"/proc/sys/kernel/random/boot_id"
+#define CGRE_BOOT_ID_LEN	36
+
+static int cgre_read_boot_id(char boot_id[CGRE_BOOT_ID_LEN + 1])
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(CGRE_BOOT_ID_FILE, "re");
+	if (!f)
+		return 1;
+
+	ret = fscanf(f, "%36s", boot_id) != 1;
+	fclose(f);
+
+	return ret;
+}
+
+u_int64_t cgre_state_now(void)
+{
+	struct timespec ts;
+	long hz;
+
+	hz = sysconf(_SC_CLK_TCK);
+	if (hz <= 0 || clock_gettime(CLOCK_BOOTTIME, &ts))
+		return 0;
+
+	return (u_int64_t)ts.tv_sec * hz + (u_int64_t)ts.tv_nsec * hz / 1000000000;
+}
+
+int cgre_proc_start_time(pid_t pid, u_int64_t * const start)
+{
+	char path[FILENAME_MAX], buf[1024];
+	unsigned long long value;
+	char *field;
+	size_t len;
+	FILE *f;
+	int i;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	f = fopen(path, "re");
+	if (!f)
+		return 1;
+
+	len = fread(buf, 1, sizeof(buf) - 1, f);
+	fclose(f);
+	buf[len] = '\0';
+
+	/* The name of the process may hold spaces and parentheses */
+	field = strrchr(buf, ')');
+	if (!field)
+		return 1;
+
+	/* The start time is the 22nd field, the 20th after the name */
+	for (i = 0; i < 20; i++) {
+		field = strchr(field + 1, ' ');
+		if (!field)
+			return 1;
+	}
+
+	if (sscanf(field, "%llu", &value) != 1)
+		return 1;
+
+	*start = value;
+
+	return 0;
+}
+
+u_int64_t cgre_state_fingerprint(void)
+{
+	u_int64_t hash;
+	size_t len;
+	char *buf;
+	FILE *f;
+
+	f = open_memstream(&buf, &len);
+	if (!f)
+		return 0;
+
+	cgroup_print_rules_config(f);
+	if (fclose(f))
+		return 0;
+
+	/* The length widens the hash of the internal tables */
+	hash = (u_int64_t)len << 32 | cg_fnv1a(CG_FNV1A_INIT, buf, len);
+	free(buf);
+
+	return hash;
+}
+
+int cgre_state_save(const char * const path, const struct cgre_state * const state)
+{
+	char boot_id[CGRE_BOOT_ID_LEN + 1];
+	char tmp[FILENAME_MAX];
+	int ret, i;
+	FILE *f;
+
+	if (cgre_read_boot_id(boot_id))
+		return 1;
+
+	/* The file is replaced at once, a crash leaves the previous state */
+	if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+		return 1;
+
+	f = fopen(tmp, "we");
+	if (!f) {
+		flog(LOG_WARNING, "Warning: cannot write %s: %s\n", tmp, strerror(errno));
+		return 1;
+	}
+
+	fprintf(f, "%s %d\n", CGRE_STATE_MAGIC, CGRE_STATE_VERSION);
+	fprintf(f, "boot %s\n", boot_id);
+	fprintf(f, "rules %llx\n", (unsigned long long)state->rules);
+	fprintf(f, "time %llu\n", (unsigned long long)state->time);
+	for (i = 0; i < state->count; i++)
+		fprintf(f, "%d %llu %d\n", state->pids[i].pid,
+			(unsigned long long)state->pids[i].start, state->pids[i].flags);
+
+	ret = ferror(f);
+	if (fclose(f))
+		ret = 1;
+
+	if (ret || rename(tmp, path)) {
+		flog(LOG_WARNING, "Warning: cannot write %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+		return 1;
+	}
+
+	return 0;
+}
+
+int cgre_state_load(const char * const path, struct cgre_state * const state)
+{
+	char boot_id[CGRE_BOOT_ID_LEN + 1], saved_id[CGRE_BOOT_ID_LEN + 1];
+	unsigned long long rules, time, start;
+	struct cgre_state_pid *pids;
+	int version, flags, alloc = 0;
+	pid_t pid;
+	FILE *f;
+
+	memset(state, 0, sizeof(struct cgre_state));
+
+	if (cgre_read_boot_id(boot_id))
+		return 1;
+
+	f = fopen(path, "re");
+	if (!f)
+		return 1;
+
+	if (fscanf(f, CGRE_STATE_MAGIC " %d boot %36s rules %llx time %llu", &version,
+		   saved_id, &rules, &time) != 4 ||
+	    version != CGRE_STATE_VERSION) {
+		flog(LOG_WARNING, "Warning: ignoring the invalid state %s\n", path);
+		goto err;
+	}
+
+	/* The pids and times of another boot mean nothing */
+	if (strcmp(boot_id, saved_id))
+		goto err;
+
+	state->rules = rules;
+	state->time = time;
+
+	while (fscanf(f, "%d %llu %d", &pid, &start, &flags) == 3) {
+		if (state->count == alloc) {
+			alloc = alloc ? alloc * 2 : 64;
+			pids = realloc(state->pids, alloc * sizeof(struct cgre_state_pid));
+			if (!pids) {
+				flog(LOG_WARNING, "Failed to allocate memory\n");
+				goto err;
+			}
+			state->pids = pids;
+		}
+
+		state->pids[state->count].pid = pid;
+		state->pids[state->count].start = start;
+		state->pids[state->count].flags = flags;
+		state->count++;
+	}
+
+	fclose(f);
+
+	return 0;
+
+err:
+	fclose(f);
+	cgre_state_free(state);
+
+	return 1;
+}
+
+void cgre_state_free(struct cgre_state * const state)
+{
+	free(state->pids);
+	memset(state, 0, sizeof(struct cgre_state));
+}
@@ -0,0 +1,201 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Latency and throughput counters of the cgroup rules engine daemon
+ *
+ * The durations are recorded in log-linear histograms, in the way of
+ * HdrHistogram: each power of two of nanoseconds is split into
+ * CGRE_HIST_SUB buckets, so a percentile is reported within 1/8 of its
+ * value.  The classification threads update the histograms concurrently
+ * with relaxed atomics; the main thread reads them when the statistics are
+ * requested on the socket or by SIGUSR1.
+ */
+
+#include "../libcgroup-internal.h"
+#include "cgrulesengd.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <linux/cn_proc.h>
+
+struct cgre_stats cgre_stats;
+
+static const char * const cgre_event_names[CGRE_STATS_EVENTS] = {
+	[CGRE_STATS_EVENT_FORK] = "fork",
+	[CGRE_STATS_EVENT_EXEC] = "exec",
+	[CGRE_STATS_EVENT_UID] = "uid",
+	[CGRE_STATS_EVENT_GID] = "gid",
+	[CGRE_STATS_EVENT_EXIT] = "exit",
+	[CGRE_STATS_EVENT_OTHER] = "other",
+};
+
+u_int64_t cgre_now_ns(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return (u_int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void cgre_stats_count_event(unsigned int what)
+{
+	enum cgre_stats_event type;
+
+	switch (what) {
+	case PROC_EVENT_FORK:
+		type = CGRE_STATS_EVENT_FORK;
+		break;
+	case PROC_EVENT_EXEC:
+		type = CGRE_STATS_EVENT_EXEC;
+		break;
+	case PROC_EVENT_UID:
+		type = CGRE_STATS_EVENT_UID;
+		break;
+	case PROC_EVENT_GID:
+		type = CGRE_STATS_EVENT_GID;
+		break;
+	case PROC_EVENT_EXIT:
+		type = CGRE_STATS_EVENT_EXIT;
+		break;
+	default:
+		type = CGRE_STATS_EVENT_OTHER;
+		break;
+	}
+
+	/* Only the main thread receives the events */
+	cgre_stats.events[type]++;
+}
+
+static unsigned int cgre_hist_index(u_int64_t value)
+{
+	unsigned int msb;
+
+	if (value < CGRE_HIST_SUB)
+		return value;
+
+	msb = 63 - __builtin_clzll(value);
+
+	return (msb - CGRE_HIST_SUB_BITS + 1) * CGRE_HIST_SUB +
+		((value >> (msb - CGRE_HIST_SUB_BITS)) & (CGRE_HIST_SUB - 1));
+}
+
+/**
+ * Get the highest value recorded in a bucket.
+ */
+static u_int64_t cgre_hist_value(unsigned int index)
+{
+	unsigned int shift;
+
+	if (index < CGRE_HIST_SUB)
+		return index;
+
+	shift = index / CGRE_HIST_SUB - 1;
+
+	return (((u_int64_t)(CGRE_HIST_SUB + index % CGRE_HIST_SUB) + 1) << shift) - 1;
+}
+
+void cgre_hist_record(struct cgre_histogram * const hist, u_int64_t value)
+{
+	u_int64_t max;
+
+	__atomic_add_fetch(&hist->buckets[cgre_hist_index(value)], 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&hist->sum, value, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+	while (value > max && !__atomic_compare_exchange_n(&hist->max, &max, value, true,
+							   __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/**
+ * Get a percentile of a histogram.
+ *	@param permille The percentile, in thousandths
+ */
+static u_int64_t cgre_hist_percentile(const struct cgre_histogram * const hist,
+				      u_int64_t count, u_int64_t max, unsigned int permille)
+{
+	u_int64_t target, seen = 0;
+	unsigned int i;
+
+	/* The rank of the percentile, rounded up */
+	target = (count * permille + 999) / 1000;
+	if (!target)
+		return 0;
+
+	for (i = 0; i < CGRE_HIST_BUCKETS; i++) {
+		seen += __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+		if (seen >= target)
+			return min(cgre_hist_value(i), max);
+	}
+
+	return max;
+}
+
+static void cgre_hist_print(FILE * const f, const char * const name,
+			    const struct cgre_histogram * const hist)
+{
+	u_int64_t count, sum, max;
+
+	count = __atomic_load_n(&hist->count, __ATOMIC_RELAXED);
+	sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+	fprintf(f, "%s_count %llu\n", name, (unsigned long long)count);
+	fprintf(f, "%s_mean_ns %llu\n", name, (unsigned long long)(count ? sum / count : 0));
+	fprintf(f, "%s_p50_ns %llu\n", name,
+		(unsigned long long)cgre_hist_percentile(hist, count, max, 500));
+	fprintf(f, "%s_p90_ns %llu\n", name,
+		(unsigned long long)cgre_hist_percentile(hist, count, max, 900));
+	fprintf(f, "%s_p99_ns %llu\n", name,
+		(unsigned long long)cgre_hist_percentile(hist, count, max, 990));
+	fprintf(f, "%s_p999_ns %llu\n", name,
+		(unsigned long long)cgre_hist_percentile(hist, count, max, 999));
+	fprintf(f, "%s_max_ns %llu\n", name, (unsigned long long)max);
+}
+
+char *cgre_stats_dump(void)
+{
+	u_int64_t received = 0;
+	char *buf = NULL;
+	size_t len;
+	FILE *f;
+	int i;
+
+	f = open_memstream(&buf, &len);
+	if (!f)
+		return NULL;
+
+	for (i = 0; i < CGRE_STATS_EVENTS; i++)
+		received += cgre_stats.events[i];
+
+	fprintf(f, "events_received %llu\n", (unsigned long long)received);
+	for (i = 0; i < CGRE_STATS_EVENTS; i++)
+		fprintf(f, "events_%s %llu\n", cgre_event_names[i],
+			(unsigned long long)cgre_stats.events[i]);
+	fprintf(f, "netlink_datagrams %llu\n", (unsigned long long)cgre_stats.datagrams);
+	fprintf(f, "netlink_drops %llu\n", (unsigned long long)cgre_stats.netlink_drops);
+	fprintf(f, "classified %llu\n",
+		(unsigned long long)__atomic_load_n(&cgre_stats.classified, __ATOMIC_RELAXED));
+	fprintf(f, "classify_failed %llu\n",
+		(unsigned long long)__atomic_load_n(&cgre_stats.failed, __ATOMIC_RELAXED));
+	fprintf(f, "coalesced %llu\n", (unsigned long long)cgre_stats.coalesced);
+	fprintf(f, "log_drops %llu\n", (unsigned long long)cgre_log_async_drops());
+
+	cgre_hist_print(f, "latency", &cgre_stats.latency);
+	cgre_hist_print(f, "queue", &cgre_stats.queue);
+	cgre_hist_print(f, "proc_read", &cgre_stats.proc_read);
+	cgre_hist_print(f, "rule_match", &cgre_stats.rule_match);
+	cgre_hist_print(f, "attach", &cgre_stats.attach);
+
+	if (fclose(f)) {
+		free(buf);
+		return NULL;
+	}
+
+	return buf;
+}
@@ -0,0 +1,587 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Recording and replay of the process events of the cgroup rules engine
+ * daemon
+ *
+ * With --record the daemon writes every event it receives, and the details
+ * of the processes it reads from /proc to classify them, to a recording.
+ * With --replay another daemon feeds a recording to the classification, in
+ * place of the netlink socket: the details of the processes come from the
+ * recording instead of /proc, and the events of a fork storm captured in
+ * production can be classified again and again in a lab, at their original
+ * pace or as fast as possible.
+ *
+ * The recording also lists the directories of the mounted hierarchies when
+ * it started.  The replay runs in a mount namespace of its own, where a tmpfs
+ * covers each hierarchy and holds these directories, with empty
+ * cgroup.procs and tasks files: the processes are "moved" into these files,
+ * and no real process is ever moved.
+ *
+ * A recording is binary, in the byte order of the recording machine:
+ *	struct cgre_trace_header
+ *	struct cgre_trace_record, followed by len bytes, ...
+ * A CGRE_TRACE_EVENT record holds a struct proc_event, with the timestamp
+ * set by the kernel.  A CGRE_TRACE_PROC record holds a struct
+ * cgre_trace_proc_data followed by the name of the program, unless the
+ * process was gone.  A CGRE_TRACE_GROUP record holds the path of a
+ * directory.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "../libcgroup-internal.h"
+#include "cgrulesengd.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <ftw.h>
+
+#include <sys/syscall.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+
+#include <linux/openat2.h>
+
+#define CGRE_TRACE_MAGIC	"cgretrc"
+/* Bumped whenever the content of the file changes */
+#define CGRE_TRACE_VERSION	1
+
+/* Buffer of the recording, the records are written by the whole buffer */
+#define CGRE_TRACE_BUFFER	(1024 * 1024)
+
+enum cgre_trace_type {
+	CGRE_TRACE_EVENT = 'E',
+	CGRE_TRACE_PROC = 'P',
+	CGRE_TRACE_GROUP = 'G',
+};
+
+struct cgre_trace_header {
+	char magic[8];
+	__u32 version;
+	/* sizeof(struct proc_event) of the recording daemon */
+	__u32 event_size;
+};
+
+struct cgre_trace_record {
+	__u8 type;
+	__u8 pad;
+	/* Length of the data following the record */
+	__u16 len;
+	/* The process of a CGRE_TRACE_PROC record */
+	__s32 pid;
+};
+
+struct cgre_trace_proc_data {
+	/* Error of cgroup_get_proc_info_from_procfs() */
+	__s32 ret;
+	__u32 euid;
+	__u32 egid;
+};
+
+/* Recording of --record, NULL if the daemon does not record */
+static FILE *trace_file;
+
+/* The records of the classification threads are written whole */
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void cgre_trace_write(enum cgre_trace_type type, pid_t pid, const void * const data,
+			     size_t len, const void * const data2, size_t len2)
+{
+	struct cgre_trace_record record = { };
+
+	if (len + len2 > UINT16_MAX)
+		len2 = UINT16_MAX - len;
+
+	record.type = type;
+	record.len = len + len2;
+	record.pid = pid;
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file) {
+		fwrite(&record, sizeof(record), 1, trace_file);
+		fwrite(data, len, 1, trace_file);
+		if (len2)
+			fwrite(data2, len2, 1, trace_file);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+static int cgre_trace_group_walk(const char *path, const struct stat *sb, int type,
+				 struct FTW *ftw)
+{
+	if (type == FTW_D)
+		cgre_trace_write(CGRE_TRACE_GROUP, 0, path, strlen(path), NULL, 0);
+
+	return 0;
+}
+
+/*
+ * Call a function with the mount point of each hierarchy, once.
+ *	@return 0 on success, 1 on error
+ */
+static int cgre_trace_for_each_mount(int (*func)(const char * const path))
+{
+	struct cgroup_mount_point info;
+	char **paths = NULL, **tmp;
+	void *handle = NULL;
+	int cnt = 0, ret, i;
+
+	ret = cgroup_get_controller_begin(&handle, &info);
+	while (ret == 0) {
+		for (i = 0; i < cnt && strcmp(paths[i], info.path); i++)
+			;
+		if (i == cnt) {
+			tmp = realloc(paths, (cnt + 1) * sizeof(char *));
+			if (!tmp)
+				break;
+			paths = tmp;
+			paths[cnt] = strdup(info.path);
+			if (!paths[cnt])
+				break;
+			cnt++;
+
+			if (func(info.path))
+				break;
+		}
+		ret = cgroup_get_controller_next(&handle, &info);
+	}
+	cgroup_get_controller_end(&handle);
+
+	for (i = 0; i < cnt; i++)
+		free(paths[i]);
+	free(paths);
+
+	return ret != ECGEOF;
+}
+
+static int cgre_trace_record_mount(const char * const path)
+{
+	if (nftw(path, cgre_trace_group_walk, 16, FTW_PHYS | FTW_MOUNT)) {
+		fprintf(stderr, "Warning: cannot record the groups of %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	return 0;
+}
+
+int cgre_trace_record_start(const char * const path)
+{
+	struct cgre_trace_header header = { .magic = CGRE_TRACE_MAGIC };
+	FILE *f;
+
+	f = fopen(path, "we");
+	if (!f) {
+		fprintf(stderr, "Error: cannot create the recording %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+	setvbuf(f, NULL, _IOFBF, CGRE_TRACE_BUFFER);
+
+	header.version = CGRE_TRACE_VERSION;
+	header.event_size = sizeof(struct proc_event);
+	fwrite(&header, sizeof(header), 1, f);
+
+	trace_file = f;
+
+	/* The groups the events will be replayed into */
+	cgre_trace_for_each_mount(cgre_trace_record_mount);
+
+	/* Nothing is left in the buffer for the fork of the daemon */
+	fflush(f);
+
+	return 0;
+}
+
+void cgre_trace_record_stop(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file) {
+		if (fclose(trace_file))
+			flog(LOG_WARNING, "Warning: cannot write the recording: %s\n",
+			     strerror(errno));
+		trace_file = NULL;
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+void cgre_trace_record_event(const struct proc_event * const ev)
+{
+	if (trace_file)
+		cgre_trace_write(CGRE_TRACE_EVENT, 0, ev, sizeof(*ev), NULL, 0);
+}
+
+void cgre_trace_record_proc(pid_t pid, int ret, uid_t euid, gid_t egid,
+			    const char * const procname)
+{
+	struct cgre_trace_proc_data data = { .ret = ret };
+
+	if (!trace_file)
+		return;
+
+	if (!ret) {
+		data.euid = euid;
+		data.egid = egid;
+	}
+	cgre_trace_write(CGRE_TRACE_PROC, pid, &data, sizeof(data), procname,
+			 !ret && procname ? strlen(procname) : 0);
+}
+
+/* Sort the processes by pid, in the order they were read */
+static int cgre_trace_proc_cmp(const void *a, const void *b)
+{
+	const struct cgre_trace_proc *pa = a, *pb = b;
+
+	if (pa->pid != pb->pid)
+		return pa->pid < pb->pid ? -1 : 1;
+
+	return pa->seq < pb->seq ? -1 : pa->seq > pb->seq;
+}
+
+static void *cgre_trace_grow(void *array, size_t *alloc, size_t cnt, size_t size)
+{
+	void *tmp;
+
+	if (cnt < *alloc)
+		return array;
+
+	tmp = realloc(array, (*alloc ? *alloc * 2 : 1024) * size);
+	if (tmp)
+		*alloc = *alloc ? *alloc * 2 : 1024;
+
+	return tmp;
+}
+
+int cgre_trace_load(const char * const path, struct cgre_trace * const trace)
+{
+	size_t events_alloc = 0, procs_alloc = 0, groups_alloc = 0;
+	struct cgre_trace_header header;
+	struct cgre_trace_proc_data data;
+	struct cgre_trace_record record;
+	struct cgre_trace_proc *proc;
+	char buf[UINT16_MAX + 1];
+	void *tmp;
+	FILE *f;
+
+	memset(trace, 0, sizeof(struct cgre_trace));
+
+	f = fopen(path, "re");
+	if (!f) {
+		fprintf(stderr, "Error: cannot open the recording %s: %s\n", path,
+			strerror(errno));
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    memcmp(header.magic, CGRE_TRACE_MAGIC, sizeof(header.magic)) ||
+	    header.version != CGRE_TRACE_VERSION ||
+	    header.event_size != sizeof(struct proc_event)) {
+		fprintf(stderr, "Error: %s is not a recording of this daemon\n", path);
+		goto err;
+	}
+
+	while (fread(&record, sizeof(record), 1, f) == 1) {
+		if (fread(buf, 1, record.len, f) != record.len)
+			break;
+		buf[record.len] = '\0';
+
+		switch (record.type) {
+		case CGRE_TRACE_EVENT:
+			if (record.len != sizeof(struct proc_event))
+				break;
+			tmp = cgre_trace_grow(trace->events, &events_alloc, trace->event_cnt,
+					      sizeof(struct proc_event));
+			if (!tmp)
+				goto nomem;
+			trace->events = tmp;
+			memcpy(&trace->events[trace->event_cnt++], buf, record.len);
+			break;
+		case CGRE_TRACE_PROC:
+			if (record.len < sizeof(data))
+				break;
+			tmp = cgre_trace_grow(trace->procs, &procs_alloc, trace->proc_cnt,
+					      sizeof(struct cgre_trace_proc));
+			if (!tmp)
+				goto nomem;
+			trace->procs = tmp;
+
+			memcpy(&data, buf, sizeof(data));
+			proc = &trace->procs[trace->proc_cnt];
+			memset(proc, 0, sizeof(*proc));
+			proc->pid = record.pid;
+			proc->seq = trace->proc_cnt;
+			proc->ret = data.ret;
+			proc->euid = data.euid;
+			proc->egid = data.egid;
+			if (!data.ret) {
+				proc->procname = strdup(buf + sizeof(data));
+				if (!proc->procname)
+					goto nomem;
+			}
+			trace->proc_cnt++;
+			break;
+		case CGRE_TRACE_GROUP:
+			tmp = cgre_trace_grow(trace->groups, &groups_alloc, trace->group_cnt,
+					      sizeof(char *));
+			if (!tmp)
+				goto nomem;
+			trace->groups = tmp;
+			trace->groups[trace->group_cnt] = strdup(buf);
+			if (!trace->groups[trace->group_cnt])
+				goto nomem;
+			trace->group_cnt++;
+			break;
+		default:
+			break;
+		}
+	}
+	fclose(f);
+
+	qsort(trace->procs, trace->proc_cnt, sizeof(struct cgre_trace_proc),
+	      cgre_trace_proc_cmp);
+
+	return 0;
+
+nomem:
+	fprintf(stderr, "Error: cannot load the recording %s: %s\n", path, strerror(ENOMEM));
+err:
+	fclose(f);
+	cgre_trace_free(trace);
+
+	return 1;
+}
+
+void cgre_trace_free(struct cgre_trace * const trace)
+{
+	size_t i;
+
+	for (i = 0; i < trace->proc_cnt; i++)
+		free(trace->procs[i].procname);
+	for (i = 0; i < trace->group_cnt; i++)
+		free(trace->groups[i]);
+	free(trace->events);
+	free(trace->procs);
+	free(trace->groups);
+	memset(trace, 0, sizeof(struct cgre_trace));
+}
+
+int cgre_trace_proc_info(struct cgre_trace * const trace, pid_t pid, uid_t *euid, gid_t *egid,
+			 char **procname)
+{
+	struct cgre_trace_proc *proc;
+	size_t lo = 0, hi = trace->proc_cnt, mid;
+
+	/* The first record of the process */
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (trace->procs[mid].pid < pid)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == trace->proc_cnt || trace->procs[lo].pid != pid)
+		return ECGROUPNOTEXIST;
+
+	/*
+	 * The records of a process are taken in the order they were read, the
+	 * last one stays.  The events of a process are all classified by the
+	 * same thread, nothing else touches its records.
+	 */
+	while (lo + 1 < trace->proc_cnt && trace->procs[lo].used && trace->procs[lo + 1].pid == pid)
+		lo++;
+	proc = &trace->procs[lo];
+	proc->used = true;
+
+	if (proc->ret)
+		return proc->ret;
+
+	*procname = strdup(proc->procname);
+	if (!*procname)
+		return ECGOTHER;
+	*euid = proc->euid;
+	*egid = proc->egid;
+
+	return 0;
+}
+
+/* The tmpfs mounted on each hierarchy by the replay */
+static struct cgre_trace_stub_root {
+	char *path;
+	int fd;
+} *stub_roots;
+static int stub_root_cnt;
+
+/* Take the tmpfs mounted on path as the root of the groups of a hierarchy */
+STATIC int cgre_trace_stub_add_root(const char * const path)
+{
+	struct cgre_trace_stub_root *tmp;
+
+	tmp = realloc(stub_roots, (stub_root_cnt + 1) * sizeof(*stub_roots));
+	if (!tmp)
+		return 1;
+	stub_roots = tmp;
+
+	stub_roots[stub_root_cnt].fd = open(path, O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (stub_roots[stub_root_cnt].fd < 0) {
+		fprintf(stderr, "Error: cannot open %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+	stub_roots[stub_root_cnt].path = strdup(path);
+	if (!stub_roots[stub_root_cnt].path) {
+		close(stub_roots[stub_root_cnt].fd);
+		return 1;
+	}
+	stub_root_cnt++;
+
+	return 0;
+}
+
+STATIC void cgre_trace_stub_free_roots(void)
+{
+	while (stub_root_cnt > 0) {
+		stub_root_cnt--;
+		close(stub_roots[stub_root_cnt].fd);
+		free(stub_roots[stub_root_cnt].path);
+	}
+	free(stub_roots);
+	stub_roots = NULL;
+}
+
+static int cgre_trace_stub_mount(const char * const path)
+{
+	if (mount("cgre-replay", path, "tmpfs", 0, "mode=755")) {
+		fprintf(stderr, "Error: cannot mount a tmpfs on %s: %s\n", path, strerror(errno));
+		return 1;
+	}
+
+	return cgre_trace_stub_add_root(path);
+}
+
+/* Resolve path beneath dirfd, without following a symbolic link or a mount */
+static int cgre_trace_openat_beneath(int dirfd, const char * const path, int flags, mode_t mode)
+{
+	struct open_how how = {
+		.flags = flags | O_CLOEXEC,
+		.mode = mode,
+		.resolve = RESOLVE_BENEATH | RESOLVE_NO_SYMLINKS | RESOLVE_NO_XDEV,
+	};
+
+	return syscall(SYS_openat2, dirfd, path, &how, sizeof(how));
+}
+
+/*
+ * The paths of the recording are not trusted: a group is only created
+ * beneath the tmpfs covering its hierarchy, relative to its root.
+ * Returns -1 if the group is not beneath a hierarchy, 1 on error.
+ */
+STATIC int cgre_trace_stub_group(const char * const group)
+{
+	static const char * const files[] = { "cgroup.procs", "tasks" };
+	const char *rel = NULL, *base;
+	char parent[FILENAME_MAX];
+	int i, pfd, dfd, fd, ret;
+	size_t len, j;
+
+	for (i = 0; i < stub_root_cnt; i++) {
+		len = strlen(stub_roots[i].path);
+		if (!strncmp(group, stub_roots[i].path, len) &&
+		    (group[len] == '/' || group[len] == '\0')) {
+			rel = group + len;
+			break;
+		}
+	}
+	if (!rel)
+		return -1;
+
+	rel += strspn(rel, "/");
+	if (*rel == '\0') {
+		dfd = dup(stub_roots[i].fd);
+	} else {
+		/* The directories are recorded parents first */
+		base = strrchr(rel, '/');
+		if (base) {
+			len = base - rel;
+			if (len >= sizeof(parent))
+				return 1;
+			memcpy(parent, rel, len);
+			parent[len] = '\0';
+			pfd = cgre_trace_openat_beneath(stub_roots[i].fd, parent,
+							O_PATH | O_DIRECTORY, 0);
+			base++;
+		} else {
+			pfd = dup(stub_roots[i].fd);
+			base = rel;
+		}
+		if (pfd < 0)
+			return 1;
+
+		ret = mkdirat(pfd, base, 0755);
+		close(pfd);
+		if (ret && errno != EEXIST)
+			return 1;
+
+		/* Also rejects a ".." or a symbolic link as the last component */
+		dfd = cgre_trace_openat_beneath(stub_roots[i].fd, rel, O_PATH | O_DIRECTORY, 0);
+	}
+	if (dfd < 0)
+		return 1;
+
+	for (j = 0; j < ARRAY_SIZE(files); j++) {
+		fd = cgre_trace_openat_beneath(dfd, files[j], O_WRONLY | O_CREAT, 0644);
+		if (fd >= 0)
+			close(fd);
+	}
+	close(dfd);
+
+	return 0;
+}
+
+int cgre_trace_stub_cgroupfs(const struct cgre_trace * const trace)
+{
+	int ret = 0;
+	size_t i;
+
+	/* The tmpfs mounts are only seen by the replay */
+	if (unshare(CLONE_NEWNS) || mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL)) {
+		fprintf(stderr, "Error: cannot create a mount namespace: %s\n", strerror(errno));
+		return 1;
+	}
+
+	if (cgre_trace_for_each_mount(cgre_trace_stub_mount)) {
+		ret = 1;
+		goto out;
+	}
+
+	for (i = 0; i < trace->group_cnt; i++) {
+		switch (cgre_trace_stub_group(trace->groups[i])) {
+		case 0:
+			break;
+		case -1:
+			fprintf(stderr, "Warning: skipping the group %s, not beneath a hierarchy\n",
+				trace->groups[i]);
+			break;
+		default:
+			if (errno == ENOSYS) {
+				fprintf(stderr, "Error: cannot confine the groups to the hierarchies\n");
+				ret = 1;
+				goto out;
+			}
+			fprintf(stderr, "Warning: cannot create the group %s: %s\n",
+				trace->groups[i], strerror(errno));
+		}
+	}
+
+out:
+	cgre_trace_stub_free_roots();
+
+	return ret;
+}
@@ -0,0 +1,354 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Cache of open cgroup directories
+ *
+ * Reading or writing a control file used to resolve its full path, from
+ * the mount point down to the cgroup, for every single access.  On deep
+ * hierarchies such as machine.slice/.../x.scope that path walk is most of
+ * the cost of the access.  The directories of the recently used cgroups
+ * are kept open instead, and the control files are opened relative to
+ * them with openat().
+ *
+ * The directories are keyed by their path and evicted in LRU order.  A
+ * cached directory can outlive the removal of its cgroup; an ENOENT from a
+ * cached directory thus reopens it once before the error is returned.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+/* Number of the hash buckets, a power of two */
+#define CG_DIRFD_HASH_SIZE	(2 * CG_DIRFD_CACHE_SIZE)
+
+struct cg_dirfd {
+	char *path;
+	int fd;
+	/* Next entry of the same hash bucket */
+	struct cg_dirfd *hnext;
+	/* LRU list, the most recently used entry is first */
+	struct cg_dirfd *prev;
+	struct cg_dirfd *next;
+};
+
+static struct cg_dirfd *dirfd_table[CG_DIRFD_HASH_SIZE];
+static struct cg_dirfd dirfd_lru = { .prev = &dirfd_lru, .next = &dirfd_lru };
+static unsigned int dirfd_count;
+
+/* The directories are looked up and opened by the callers in parallel */
+static pthread_mutex_t dirfd_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int cg_dirfd_hash(const char * const path, size_t len)
+{
+	return cg_fnv1a(CG_FNV1A_INIT, path, len) & (CG_DIRFD_HASH_SIZE - 1);
+}
+
+static void cg_dirfd_lru_unlink(struct cg_dirfd * const entry)
+{
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static void cg_dirfd_lru_push(struct cg_dirfd * const entry)
+{
+	entry->next = dirfd_lru.next;
+	entry->prev = &dirfd_lru;
+	dirfd_lru.next->prev = entry;
+	dirfd_lru.next = entry;
+}
+
+static void cg_dirfd_remove(struct cg_dirfd * const entry)
+{
+	struct cg_dirfd **pp;
+
+	pp = &dirfd_table[cg_dirfd_hash(entry->path, strlen(entry->path))];
+	while (*pp != entry)
+		pp = &(*pp)->hnext;
+	*pp = entry->hnext;
+
+	cg_dirfd_lru_unlink(entry);
+	dirfd_count--;
+
+	close(entry->fd);
+	free(entry->path);
+	free(entry);
+}
+
+/**
+ * Get the open directory of the given path, open it if it is not cached.
+ *	@param dir The path of the directory, not null terminated
+ *	@param len Length of dir
+ *	@param cached Set to true if the directory was found in the cache
+ *	@return The directory fd on success, -1 with errno set on error.
+ *	Call with dirfd_lock taken.
+ */
+static int cg_dirfd_get_locked(const char * const dir, size_t len, bool * const cached)
+{
+	struct cg_dirfd *entry;
+	unsigned int hash;
+	int fd;
+
+	hash = cg_dirfd_hash(dir, len);
+	for (entry = dirfd_table[hash]; entry; entry = entry->hnext) {
+		if (strncmp(entry->path, dir, len) || entry->path[len] != '\0')
+			continue;
+
+		cg_dirfd_lru_unlink(entry);
+		cg_dirfd_lru_push(entry);
+		*cached = true;
+
+		return entry->fd;
+	}
+
+	*cached = false;
+
+	entry = calloc(1, sizeof(struct cg_dirfd));
+	if (!entry)
+		return -1;
+
+	entry->path = strndup(dir, len);
+	if (!entry->path) {
+		free(entry);
+		return -1;
+	}
+
+	fd = open(entry->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		free(entry->path);
+		free(entry);
+		return -1;
+	}
+	entry->fd = fd;
+
+	if (dirfd_count >= CG_DIRFD_CACHE_SIZE)
+		cg_dirfd_remove(dirfd_lru.prev);
+
+	entry->hnext = dirfd_table[hash];
+	dirfd_table[hash] = entry;
+	cg_dirfd_lru_push(entry);
+	dirfd_count++;
+
+	return fd;
+}
+
+/**
+ * Drop the cached directory of the given path.
+ *	Call with dirfd_lock taken.
+ */
+static void cg_dirfd_drop_locked(const char * const dir, size_t len)
+{
+	struct cg_dirfd *entry;
+
+	for (entry = dirfd_table[cg_dirfd_hash(dir, len)]; entry; entry = entry->hnext) {
+		if (strncmp(entry->path, dir, len) || entry->path[len] != '\0')
+			continue;
+
+		cg_dirfd_remove(entry);
+		return;
+	}
+}
+
+/**
+ * Split a path into its directory and its last component.
+ *	@param path The path
+ *	@param len Length of the directory part, "/" is kept for the root
+ *	@return The last component, NULL if path has no directory part
+ */
+static const char *cg_dirfd_split(const char * const path, size_t * const len)
+{
+	const char *file;
+
+	file = strrchr(path, '/');
+	if (!file || file[1] == '\0')
+		return NULL;
+
+	*len = file == path ? 1 : (size_t)(file - path);
+
+	return file + 1;
+}
+
+int cg_dirfd_open(const char * const path, int flags)
+{
+	const char *file;
+	bool cached;
+	size_t len;
+	int dirfd;
+	int fd;
+
+	file = cg_dirfd_split(path, &len);
+	if (!file)
+		return open(path, flags | O_CLOEXEC);
+
+	pthread_mutex_lock(&dirfd_lock);
+	dirfd = cg_dirfd_get_locked(path, len, &cached);
+	if (dirfd < 0) {
+		pthread_mutex_unlock(&dirfd_lock);
+		return -1;
+	}
+
+	fd = openat(dirfd, file, flags | O_CLOEXEC);
+	if (fd < 0 && errno == ENOENT && cached) {
+		/* The cgroup may have been removed and created again */
+		cg_dirfd_drop_locked(path, len);
+
+		dirfd = cg_dirfd_get_locked(path, len, &cached);
+		if (dirfd >= 0)
+			fd = openat(dirfd, file, flags | O_CLOEXEC);
+	}
+	pthread_mutex_unlock(&dirfd_lock);
+
+	return fd;
+}
+
+int cg_dirfd_stat(const char * const path, struct stat * const st)
+{
+	const char *file;
+	bool cached;
+	size_t len;
+	int dirfd;
+	int ret;
+
+	file = cg_dirfd_split(path, &len);
+	if (!file)
+		return stat(path, st);
+
+	pthread_mutex_lock(&dirfd_lock);
+	dirfd = cg_dirfd_get_locked(path, len, &cached);
+	if (dirfd < 0) {
+		pthread_mutex_unlock(&dirfd_lock);
+		return -1;
+	}
+
+	ret = fstatat(dirfd, file, st, 0);
+	if (ret < 0 && errno == ENOENT && cached) {
+		cg_dirfd_drop_locked(path, len);
+
+		dirfd = cg_dirfd_get_locked(path, len, &cached);
+		if (dirfd >= 0)
+			ret = fstatat(dirfd, file, st, 0);
+	}
+	pthread_mutex_unlock(&dirfd_lock);
+
+	return ret;
+}
+
+int cg_dirfd_dup(const char * const dir)
+{
+	size_t len = strlen(dir);
+	bool cached;
+	int fd;
+
+	/* The paths built by cg_build_path() end with a slash */
+	while (len > 1 && dir[len - 1] == '/')
+		len--;
+
+	pthread_mutex_lock(&dirfd_lock);
+	fd = cg_dirfd_get_locked(dir, len, &cached);
+	if (fd >= 0)
+		fd = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+	pthread_mutex_unlock(&dirfd_lock);
+
+	return fd;
+}
+
+/**
+ * Create a directory, and its missing parents, relative to the cached fd of
+ * its parent.  The leaf is tried first, the parents are only created when
+ * it fails with ENOENT.
+ *	@param path The path of the directory, written to while the parents
+ *	are created
+ *	@param len Length of path
+ *	Call with dirfd_lock taken.
+ */
+static int cg_dirfd_mkdir_locked(char * const path, size_t len, mode_t mode)
+{
+	const char *leaf;
+	struct stat st;
+	bool cached;
+	size_t dlen;
+	int dirfd;
+	int ret;
+
+	path[len] = '\0';
+	leaf = cg_dirfd_split(path, &dlen);
+	if (!leaf)
+		return mkdir(path, mode) && errno != EEXIST ? -1 : 0;
+
+	dirfd = cg_dirfd_get_locked(path, dlen, &cached);
+	if (dirfd < 0 && errno == ENOENT) {
+		if (cg_dirfd_mkdir_locked(path, dlen, mode))
+			return -1;
+
+		/* The parent made the path shorter */
+		path[dlen] = '/';
+		path[len] = '\0';
+		dirfd = cg_dirfd_get_locked(path, dlen, &cached);
+	}
+	if (dirfd < 0)
+		return -1;
+
+	ret = mkdirat(dirfd, leaf, mode);
+	if (ret < 0 && errno == ENOENT && cached) {
+		/* The parent may have been removed and created again */
+		cg_dirfd_drop_locked(path, dlen);
+
+		return cg_dirfd_mkdir_locked(path, len, mode);
+	}
+
+	/* A read-only file system fails even if the directory exists */
+	if (ret < 0 && errno == EROFS && !fstatat(dirfd, leaf, &st, 0))
+		return 0;
+
+	return ret < 0 && errno != EEXIST ? -1 : 0;
+}
+
+int cg_dirfd_mkdir(const char * const path, mode_t mode)
+{
+	size_t len = strlen(path);
+	char *buf;
+	int ret;
+
+	/* The paths built by cg_build_path() end with a slash */
+	while (len > 1 && path[len - 1] == '/')
+		len--;
+
+	buf = strndup(path, len);
+	if (!buf)
+		return -1;
+
+	pthread_mutex_lock(&dirfd_lock);
+	ret = cg_dirfd_mkdir_locked(buf, len, mode);
+	pthread_mutex_unlock(&dirfd_lock);
+
+	free(buf);
+
+	return ret;
+}
+
+void cg_dirfd_forget(const char * const dir)
+{
+	size_t len = strlen(dir);
+
+	/* The paths built by cg_build_path() end with a slash */
+	while (len > 1 && dir[len - 1] == '/')
+		len--;
+
+	pthread_mutex_lock(&dirfd_lock);
+	cg_dirfd_drop_locked(dir, len);
+	pthread_mutex_unlock(&dirfd_lock);
+}
+
+void cg_dirfd_flush(void)
+{
+	pthread_mutex_lock(&dirfd_lock);
+	while (dirfd_count)
+		cg_dirfd_remove(dirfd_lru.prev);
+	pthread_mutex_unlock(&dirfd_lock);
+}
@@ -22,11 +22,18 @@ extern "C" {
 #include <limits.h>
 #include <mntent.h>
 #include <setjmp.h>
+#include <string.h>
+#include <regex.h>
 #include <fts.h>
+#include <grp.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#ifdef WITH_USDT
+#include <sys/sdt.h>
+#endif
+
 #define MAX_MNT_ELEMENTS	16	/* Maximum number of mount points/controllers */
 #define MAX_GROUP_ELEMENTS	128	/* Estimated number of groups created */
 
@@ -49,6 +56,50 @@ extern "C" {
 #define CGRULE_WILD	((uid_t) -2)
 
 #define CGRULE_SUCCESS_STORE_PID	"SUCCESS_STORE_PID"
+/*
+ * Flags of a request of the statistics of cgrulesengd on its socket, in
+ * place of the flags of cgroup_register_unchanged_process()
+ */
+#define CGRULE_REQUEST_STATS		0x1000
+/*
+ * Set in the flags of the requests of a batch: each request is answered by
+ * a status byte, 0 on success, and the connection stays open for the next
+ * ones.  The other requests are answered by CGRULE_SUCCESS_STORE_PID.
+ */
+#define CGRULE_REQUEST_BATCH		0x2000
+
+/*
+ * Flags of a request to classify a process with the given credentials, like
+ * cgroup_change_cgroup_uid_gid_flags() would.  Its pid is 0, so that an older
+ * daemon drops the connection, and it is followed by a struct
+ * cgrule_classify.  It is answered by the int32_t return code.
+ */
+#define CGRULE_REQUEST_CLASSIFY		0x4000
+
+/*
+ * Flags of the first request of a client sending batches.  Its pid is 0, so
+ * that an older daemon, which knows no batch, drops the connection and the
+ * client falls back to one connection per process.  It is answered by the
+ * CGRULE_PROTOCOL_VERSION byte.
+ */
+#define CGRULE_REQUEST_HELLO		0x8000
+#define CGRULE_PROTOCOL_VERSION		1
+
+/* Time a client waits for the classification of its process, in ms */
+#define CGRULE_CLASSIFY_TIMEOUT		2000
+
+/* A request on the socket of cgrulesengd */
+struct cgrule_request {
+	pid_t pid;
+	int flags;
+};
+
+/* The process of a CGRULE_REQUEST_CLASSIFY request, and its credentials */
+struct cgrule_classify {
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+};
 #define CGRULE_OPTION_IGNORE		"ignore" /* Definitions for the cgrules options field */
 
 #define CGCONFIG_CONF_FILE		"/etc/cgconfig.conf"
@@ -58,10 +109,56 @@ extern "C" {
 
 #define CGRULES_CONF_FILE		"/etc/cgrules.conf"
 #define CGRULES_CONF_DIR		"/etc/cgrules.d"
+#define CGRULES_CACHE_FILE		"/run/libcgroup/rules.bin"
 #define CGRULES_MAX_FIELDS_PER_LINE	3
 
+/* Mount table published by cgroup_publish_mount_table() */
+#define CGMOUNTS_CACHE_FILE		"/run/libcgroup/mounts.bin"
+
 #define CGROUP_BUFFER_LEN	(5 * FILENAME_MAX)
 
+/* Where the unified hierarchy is mounted on a cgroup v2 system */
+#define CG_UNIFIED_MOUNT_PATH		"/sys/fs/cgroup"
+
+/* File that stores the relative delegated systemd cgroup path */
+#define CG_SYSTEMD_DEFAULT_CGROUP_FILE	"/var/run/libcgroup/systemd"
+
+/* Size of the buffer /proc/<pid>/status is read into */
+#define CG_PROC_STATUS_LEN	4096
+
+/* Number of open tasks and cgroup.procs files kept by the attach functions */
+#define CG_ATTACH_FD_CACHE_SIZE	64
+
+/* Size of the chunks a tasks file is read in when its tasks are moved */
+#define CG_MOVE_TASKS_BUF_SIZE	65536
+
+/* Number of pids a thread of cgroup_change_all_cgroups_ext() takes at once */
+#define CG_CHANGE_ALL_CHUNK	64
+
+/* Size of the chunks cgroup.procs and cgroup.threads are read in */
+#define CG_PIDS_BUF_SIZE	65536
+
+/* Time given to the processes killed through cgroup.kill to exit, in ms */
+#define CG_DELETE_KILL_TIMEOUT	10000
+
+/* Number of open cgroup directories the control files are opened from */
+#define CG_DIRFD_CACHE_SIZE	128
+
+/* Number of the hash buckets of the groups created from templates, a power of two */
+#define CG_TEMPLATE_CACHE_SIZE	256
+
+/* Number of the hash buckets of the cgroup v2 directories whose subtree_control is known */
+#define CG_SUBTREE_CACHE_SIZE	256
+
+/* Number of slots of the index of cg_mount_table, a power of two above 2 * CG_CONTROLLER_MAX */
+#define CG_MOUNT_INDEX_SIZE	256
+
+/* Initial size of the buffer keyed files are read into, it grows for longer lines */
+#define CG_KEYED_BUF_SIZE	4096
+
+/* Maximum length of the path of a stats file */
+#define CG_STAT_PATH_MAX	(2 * FILENAME_MAX)
+
 /* Maximum length of a key(<user>:<process name>) in the daemon config file */
 #define CGROUP_RULE_MAXKEY	(LOGIN_NAME_MAX + FILENAME_MAX + 1)
 
@@ -77,11 +174,52 @@ extern "C" {
 /* maximum line length when reading the cgroup.controllers file */
 #define CGV2_CONTROLLERS_LL_MAX	100
 
-#define cgroup_err(x...)	cgroup_log(CGROUP_LOG_ERROR, "Error: " x)
-#define cgroup_warn(x...)	cgroup_log(CGROUP_LOG_WARNING, "Warning: " x)
-#define cgroup_info(x...)	cgroup_log(CGROUP_LOG_INFO, "Info: " x)
-#define cgroup_dbg(x...)	cgroup_log(CGROUP_LOG_DEBUG, x)
-#define cgroup_cont(x...)	cgroup_log(CGROUP_LOG_CONT, x)
+#if defined(LIBCG_LIB) || defined(UNIT_TEST)
+/*
+ * Highest level of the messages sent to the logger, -1 without a logger.
+ * The macros check it before evaluating the arguments of a message.
+ */
+extern int cg_log_level;
+
+/*
+ * Log a message of the library.  The prefix of the level is concatenated
+ * to the format, and skipped for the record callbacks.
+ */
+void cg_log_full(int level, size_t prefix_len, const char *file, unsigned int line,
+		 const char *function, const char *fmt, ...)
+	__attribute__((format(printf, 6, 7)));
+
+#define cg_log_enabled(level)	((level) <= __atomic_load_n(&cg_log_level, __ATOMIC_RELAXED))
+#define cg_log_at(level, prefix, x...)							\
+	(cg_log_enabled(level) ?							\
+	 cg_log_full(level, sizeof(prefix) - 1, __FILE__, __LINE__, __func__, prefix x) :	\
+	 (void)0)
+#else
+/* The tools and the daemon link to the shared library, which hides cg_log_level */
+#define cg_log_at(level, prefix, x...)	cgroup_log(level, prefix x)
+#endif
+
+#define cgroup_err(x...)	cg_log_at(CGROUP_LOG_ERROR, "Error: ", x)
+#define cgroup_warn(x...)	cg_log_at(CGROUP_LOG_WARNING, "Warning: ", x)
+#define cgroup_info(x...)	cg_log_at(CGROUP_LOG_INFO, "Info: ", x)
+#ifdef CG_DISABLE_DEBUG_LOG
+/* The arguments are still checked by the compiler, but the call is dropped */
+#define cgroup_dbg(x...)	(0 ? cgroup_log(CGROUP_LOG_DEBUG, x) : (void)0)
+#else
+#define cgroup_dbg(x...)	cg_log_at(CGROUP_LOG_DEBUG, "", x)
+#endif
+#define cgroup_cont(x...)	cg_log_at(CGROUP_LOG_CONT, "", x)
+
+/*
+ * Static probe for SystemTap and bpftrace, e.g. usdt:libcgroup.so:libcgroup:attach_entry.
+ * A probe is a nop until a tracer attaches to it, and without --enable-usdt
+ * its arguments are not even evaluated.
+ */
+#ifdef WITH_USDT
+#define cg_probe(provider, name, ...)	STAP_PROBEV(provider, name, ##__VA_ARGS__)
+#else
+#define cg_probe(provider, name, ...)	do { } while (0)
+#endif
 
 #define CGROUP_DEFAULT_LOGLEVEL CGROUP_LOG_ERROR
 
@@ -90,9 +228,36 @@ extern "C" {
 
 #define ARRAY_SIZE(x)	(sizeof(x) / sizeof((x)[0]))
 
+/* Offset basis of the 32-bit FNV-1a hash, the hash of nothing */
+#define CG_FNV1A_INIT	2166136261U
+
+/*
+ * Continue the FNV-1a hash of the internal hash tables with len bytes.
+ * Start with CG_FNV1A_INIT.
+ */
+static inline unsigned int cg_fnv1a(unsigned int hash, const void * const buf, size_t len)
+{
+	const unsigned char *c = (const unsigned char *)buf;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		hash ^= c[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static inline unsigned int cg_fnv1a_str(unsigned int hash, const char * const str)
+{
+	return cg_fnv1a(hash, str, strlen(str));
+}
+
 struct control_value {
-	char name[FILENAME_MAX];
-	char value[CG_CONTROL_VALUE_MAX];
+	/* Interned by cg_intern_name(), shared by all the values of that name */
+	const char *name;
+	/* Allocated to the length of the value, never NULL */
+	char *value;
 
 	/* cgget uses this field for values that span multiple lines */
 	char *multiline_value;
@@ -100,15 +265,32 @@ struct control_value {
 	/*
 	 * The abstraction layer uses prev_name when there's an
 	 * N->1 or 1->N relationship between cgroup v1 and v2 settings.
+	 * It points to a constant or an interned name and is never freed.
 	 */
-	char *prev_name;
+	const char *prev_name;
 
 	bool dirty;
 };
 
+/*
+ * Values shared by the controllers copied by cgroup_copy_controller_values(),
+ * they all point to the same values array.  The values are only read until
+ * the last reference is dropped, a controller changing them takes its own
+ * copy first, see cg_own_values().
+ */
+struct cg_value_set {
+	int refcount;
+};
+
 struct cgroup_controller {
 	char name[CONTROL_NAMELEN_MAX];
-	struct control_value *values[CG_NV_MAX];
+	/* Grown on demand up to CG_NV_MAX entries */
+	struct control_value **values;
+	int values_alloc;
+	/* Set the values are shared with, NULL if the controller owns them */
+	struct cg_value_set *shared;
+	/* The dirty flags of the shared values, one bit per value */
+	unsigned char shared_dirty[(CG_NV_MAX + 7) / 8];
 	struct cgroup *cgroup;
 	int index;
 	enum cg_version_t version;
@@ -116,8 +298,12 @@ struct cgroup_controller {
 
 struct cgroup {
 	char name[FILENAME_MAX];
-	struct cgroup_controller *controller[CG_CONTROLLER_MAX];
+	/* Grown on demand up to CG_CONTROLLER_MAX entries */
+	struct cgroup_controller **controller;
+	int controller_alloc;
 	int index;
+	/* Arena all the memory of the group comes from, NULL for the heap */
+	struct cgroup_arena *arena;
 	uid_t tasks_uid;
 	gid_t tasks_gid;
 	mode_t task_fperm;
@@ -153,69 +339,188 @@ struct cgroup_rules_data {
 	gid_t gid;
 };
 
+/* Marks a process name of a rule as an extended regular expression */
+#define CG_PROCNAME_REGEX_MARK	'~'
+
+enum cg_procname_type {
+	/* The name or the basename, or a prefix of the name with a trailing '*' */
+	CG_PROCNAME_LEGACY = 0,
+	/* A fnmatch(3) pattern matching the name or the basename */
+	CG_PROCNAME_GLOB,
+	/* An extended regular expression found in the name */
+	CG_PROCNAME_REGEX,
+};
+
+/* Process name of a rule, compiled by cg_procname_compile() */
+struct cg_procname_pattern {
+	enum cg_procname_type type;
+	/* The literal prefix, in the procname, every matching name starts with */
+	unsigned int prefix_start;
+	unsigned int prefix_len;
+	/* Only for CG_PROCNAME_REGEX */
+	regex_t *regex;
+};
+
 /* A rule that maps UID/GID to a cgroup */
 struct cgroup_rule {
 	uid_t uid;
 	gid_t gid;
 	bool is_ignore;
 	char *procname;
+	struct cg_procname_pattern pattern;
 	char username[LOGIN_NAME_MAX];
 	char destination[FILENAME_MAX];
 	char *controllers[MAX_MNT_ELEMENTS];
+	/*
+	 * The rule, and the whole multi-line rule it belongs to, are the same
+	 * as in the previously published list, see cgroup_mark_unchanged_rules()
+	 */
+	bool unchanged;
 	struct cgroup_rule *next;
 };
 
+/*
+ * The cgroups of the process being classified, read from /proc/PID/cgroup
+ * on the first ignore rule and shared by all the rules of the lookup.
+ */
+struct cg_proc_cgroups {
+	pid_t pid;
+	/* 0 until read, 1 once read, -1 if the read failed */
+	int state;
+	char *cgroups[MAX_MNT_ELEMENTS];
+	char *controllers[MAX_MNT_ELEMENTS];
+	size_t cgroups_len[MAX_MNT_ELEMENTS];
+};
+
+struct cgroup_rule_index;
+struct cgroup_rule_bucket;
+
 /* Container for a list of rules */
 struct cgroup_rule_list {
 	struct cgroup_rule *head;
 	struct cgroup_rule *tail;
 	int len;
+	/* Compiled index of the list, NULL if not built */
+	struct cgroup_rule_index *index;
+	/*
+	 * Copies of the rules of the previously published list this one
+	 * replaced, NULL if none, see cgroup_mark_unchanged_rules()
+	 */
+	struct cgroup_rule_list *replaced;
+};
+
+/* Files a list of rules was parsed from, see cg_rules_sources_collect() */
+struct cg_rules_sources {
+	char **paths;
+	/* Zeroed for a file which does not exist */
+	struct stat *st;
+	/* Index of the first user and group database, after the rules files */
+	int deps;
+	int count;
+	int alloc;
+};
+
+/* Maximum number of buckets merged by one rules index lookup */
+#define CG_RULE_ITER_MAX	64
+
+/* Iterator over the candidate rules returned by cgroup_rule_index_lookup() */
+struct cgroup_rule_iter {
+	struct cgroup_rule_bucket *buckets[CG_RULE_ITER_MAX];
+	int next[CG_RULE_ITER_MAX];
+	int count;
+	unsigned int last_pos;
+	bool started;
 };
 
+/*
+ * Read-mostly data published as immutable snapshots.  Readers take no lock:
+ * they count themselves in the slot of the current epoch, and a writer
+ * replacing the data flips the epoch and waits for the readers of the old
+ * slot to leave before releasing the old data.
+ */
+struct cg_snapshot {
+	void *data;
+	/* Called on the replaced data once no reader can see it, may be NULL */
+	void (*release)(void *data);
+	unsigned long epoch;
+	unsigned long readers[2];
+	/* Serializes the writers */
+	pthread_mutex_t lock;
+};
+
+#define CG_SNAPSHOT_INITIALIZER(release) \
+	{ NULL, release, 0, { 0, 0 }, PTHREAD_MUTEX_INITIALIZER }
+
+/* The entries of a directory, as returned by getdents64() */
+struct cg_dirent64 {
+	u_int64_t d_ino;
+	int64_t d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+/* A directory open by a walk with CGROUP_WALK_TYPE_DIRS_ONLY */
+struct cg_walk_dir;
+
 /* The walk_tree handle */
 struct cgroup_tree_handle {
 	FTS *fts;
 	int flags;
+	/* cgroup_walk_tree_next() was called, the backend cannot change */
+	bool started;
+
+	/* Stack of the directories of the getdents64() walk, see walk-dirs.c */
+	struct cg_walk_dir *dirs;
+	int dirs_cnt;
+	int dirs_alloc;
+	/* The directory on the top of the stack was returned post-order */
+	bool pop;
+	/* Full path of the directory on the top of the stack */
+	char path[FILENAME_MAX];
 };
 
 /**
- * Internal item of dictionary. Linked list is sufficient for now - we need
- * only 'add' operation and simple iterator. In future, this might be easily
- * rewritten to dynamic array when random access is needed, just keep in mind
- * that the order is important and the iterator should return the items in
- * the order they were added there.
+ * Internal item of dictionary.  The items are stored in an array in the
+ * order they were added there, the iterator returns them in that order.
  */
 struct cgroup_dictionary_item {
 	const char *name;
 	const char *value;
-	struct cgroup_dictionary_item *next;
+	unsigned int hash;
 };
 
 /* Flags for cgroup_dictionary_create */
 /**
  * All items (i.e. both name and value strings) stored in the dictionary
  * should *NOT* be free()d on cgroup_dictionary_free(), only the  dictionary
- * helper structures (i.e. underlying linked list) should be freed.
+ * helper structures (i.e. underlying array and index) should be freed.
  */
 #define CG_DICT_DONT_FREE_ITEMS	1
 
 /**
  * Dictionary of (name, value) items.
  * The dictionary keeps its order, iterator iterates in the same order as
- * the items were added there. It is *not* hash-style structure, it does
- * not provide random access to its items nor quick search. This structure
- * should be opaque to users of the dictionary, underlying data structure
- * might change anytime and without warnings.
+ * the items were added there.  The items are found by name through an open
+ * addressing hash of their positions, see cgroup_dictionary_get().  This
+ * structure should be opaque to users of the dictionary, underlying data
+ * structure might change anytime and without warnings.
  */
 struct cgroup_dictionary {
-	struct cgroup_dictionary_item *head;
-	struct cgroup_dictionary_item *tail;
+	struct cgroup_dictionary_item *items;
+	int count;
+	int alloc;
+	/* Position of an item plus one per slot, 0 for a free slot */
+	int *index;
+	/* Number of slots of the index, a power of two */
+	unsigned int index_size;
 	int flags;
 };
 
 /** Opaque iterator of an dictionary. */
 struct cgroup_dictionary_iterator {
-	struct cgroup_dictionary_item *item;
+	struct cgroup_dictionary *dict;
+	int pos;
 };
 
 /**
@@ -228,36 +533,146 @@ extern __thread int last_errno;
  */
 extern jmp_buf parser_error_env;
 
+/* Input of the lexer, see lex.l */
+int cg_config_lex_open(const char *pathname);
+void cg_config_lex_close(void);
+
 /* Internal API */
 char *cg_build_path(const char *name, char *path, const char *type);
 int cgroup_get_uid_gid_from_procfs(pid_t pid, uid_t *euid, gid_t *egid);
 int cgroup_get_procname_from_procfs(pid_t pid, char **procname);
+int cgroup_get_proc_info_from_procfs(pid_t pid, uid_t *euid, gid_t *egid, char **procname);
 int cg_mkdir_p(const char *path);
+struct group *cg_getgrnam(const char *name, struct group *grp, char **buffer);
+void cgroup_free_rule(struct cgroup_rule *r);
+void cgroup_free_rule_list(struct cgroup_rule_list *cg_rl);
 struct cgroup *create_cgroup_from_name_value_pairs(const char *name,
 						struct control_value *name_value, int nv_number);
 void init_cgroup_table(struct cgroup *cgroups, size_t count);
 
+struct cg_controllers;
+
 /*
- * Main mounting structures
- *
- * cg_mount_table_lock must be held to access:
- *	cg_mount_table
- *	cg_cgroup_v2_mount_path
+ * The state of the library which depends on the mounts and the settings of
+ * the caller, see cgroup_ctx_new().  The names below refer to the context of
+ * the calling thread, the default context unless the thread uses another.
+ */
+struct cgroup_ctx {
+	/*
+	 * Main mounting structures
+	 *
+	 * mount_table_lock must be held to access:
+	 *	mount_table
+	 *	cgroup_v2_mount_path
+	 *	cgroup_v2_empty_mount_paths
+	 *	mount_index, mount_index_v2
+	 *
+	 * The tables of the default context are the exported cg_mount_table
+	 * and cg_mount_table_lock.
+	 */
+	struct cg_mount_table_s (*mount_table)[CG_CONTROLLER_MAX];
+	char cgroup_v2_mount_path[FILENAME_MAX];
+	/* Cgroup v2 mount paths, with empty controllers */
+	struct cg_mount_point *cgroup_v2_empty_mount_paths;
+	pthread_rwlock_t *mount_table_lock;
+
+	/*
+	 * Open addressing index of the controller names of mount_table.  A
+	 * slot holds the index of the controller plus one, 0 is a free slot.
+	 */
+	short mount_index[CG_MOUNT_INDEX_SIZE];
+	/* Index of the first cgroup v2 controller, -1 if there is none */
+	int mount_index_v2;
+	/* Bumped whenever mount_table is built again */
+	unsigned long mount_table_gen;
+
+	/* Snapshot of the controllers, see cg_controllers_get() */
+	struct cg_controllers *controllers;
+	pthread_mutex_t controllers_lock;
+
+	/* Set by cgroup_init() */
+	int initialized;
+
+	/* Namespaces of the controllers, unused by the default context */
+	char *namespace_table[CG_CONTROLLER_MAX];
+
+	/* Default systemd cgroup, <name>.slice/<name>.scope */
+	char systemd_default_cgroup[FILENAME_MAX * 2 + 1];
+};
+
+extern struct cgroup_ctx cg_default_ctx;
+
+/* The context of the thread, NULL for the default one */
+extern __thread struct cgroup_ctx *cg_thread_ctx;
+
+/* The context of the calling thread, for the programs using the library */
+struct cgroup_ctx *cg_ctx_get(void);
+
+/*
+ * The variables of the contexts are private to the shared library, the
+ * tools linked to it go through cg_ctx_get().
+ */
+#if defined(LIBCG_LIB) || defined(UNIT_TEST)
+static inline struct cgroup_ctx *cg_ctx(void)
+{
+	return cg_thread_ctx ? cg_thread_ctx : &cg_default_ctx;
+}
+#else
+static inline struct cgroup_ctx *cg_ctx(void)
+{
+	return cg_ctx_get();
+}
+#endif
+
+#define cg_mount_table			(*cg_ctx()->mount_table)
+#define cg_cgroup_v2_mount_path		(cg_ctx()->cgroup_v2_mount_path)
+#define cg_cgroup_v2_empty_mount_paths	(cg_ctx()->cgroup_v2_empty_mount_paths)
+#define cg_mount_table_lock		(*cg_ctx()->mount_table_lock)
+
+/*
+ * Build the index of the controller names of cg_mount_table.  It is built
+ * by cgroup_init(), code filling cg_mount_table by itself must call it.
+ * Call with cg_mount_table_lock taken for writing.
+ */
+void cg_mount_index_build(void);
+
+/*
+ * Find a controller in cg_mount_table, the index is the identifier of the
+ * controller until the next cgroup_init().  Call with cg_mount_table_lock
+ * taken.
+ * @return The index of the controller, -1 if it is not mounted
  */
-extern struct cg_mount_table_s cg_mount_table[CG_CONTROLLER_MAX];
-extern char cg_cgroup_v2_mount_path[FILENAME_MAX];
-extern pthread_rwlock_t cg_mount_table_lock;
+int cg_mount_table_find(const char * const name);
+
+/*
+ * Find the first cgroup v2 controller of cg_mount_table.  Call with
+ * cg_mount_table_lock taken.
+ * @return Its index, -1 if no cgroup v2 controller is mounted
+ */
+int cg_mount_table_find_v2(void);
 
 /*
  * config related structures
+ *
+ * The namespaces of the default context are set per thread.
  */
-extern __thread char *cg_namespace_table[CG_CONTROLLER_MAX];
+extern __thread char *cg_thread_namespace_table[CG_CONTROLLER_MAX];
+
+static inline char *(*cg_ctx_namespace_table(void))[CG_CONTROLLER_MAX]
+{
+	return cg_thread_ctx ? &cg_thread_ctx->namespace_table : &cg_thread_namespace_table;
+}
+
+#define cg_namespace_table		(*cg_ctx_namespace_table())
 
 /*
  * Default systemd cgroup used by the cg_build_path_locked() and tools
  * setting the default cgroup path.
  */
-extern char systemd_default_cgroup[FILENAME_MAX * 2 + 1];
+#define systemd_default_cgroup		(cg_ctx()->systemd_default_cgroup)
+
+/* Set by cgroup_init(), tests filling cg_mount_table by themselves may set it */
+#define cgroup_initialized		(cg_ctx()->initialized)
 
 /*
  * config related API
@@ -286,6 +701,18 @@ extern int cgroup_dictionary_create(struct cgroup_dictionary **dict, int flags);
  */
 extern int cgroup_dictionary_add(struct cgroup_dictionary *dict, const char *name,
 				 const char *value);
+
+/**
+ * Find the value of an item of a dictionary.  If the name was added more
+ * than once, the first value added is returned.
+ * @param dict The dictionary
+ * @param name Name of the item
+ * @param value Set to the value of the item
+ * @return 0 on success, ECGROUPVALUENOTEXIST if there is no such item.
+ */
+extern int cgroup_dictionary_get(struct cgroup_dictionary *dict, const char *name,
+				 const char **value);
+
 /**
  * Fully destroy existing dictionary. Depending on flags passed to
  * cgroup_dictionary_create(), names and values might get destroyed too.
@@ -394,6 +821,500 @@ int cgroup_remove_value(struct cgroup_controller * const controller, const char
  */
 void cgroup_free_controller(struct cgroup_controller *ctrl);
 
+/**
+ * Compile the process name of a rule.  A name starting with '~' is an
+ * extended regular expression, a name holding a glob character other than
+ * a single trailing '*' is a glob, anything else keeps the legacy meaning.
+ *
+ * @param pattern The pattern to fill
+ * @param procname The process name of the rule
+ * @return 0 on success, ECGINVAL if the regular expression is invalid and
+ *	ECGOTHER if an allocation failed
+ */
+int cg_procname_compile(struct cg_procname_pattern * const pattern, const char * const procname);
+
+/**
+ * Free the regular expression of a compiled process name.
+ */
+void cg_procname_free(struct cg_procname_pattern * const pattern);
+
+/**
+ * Check whether a process matches the compiled process name of a rule.
+ *
+ * @param pattern The compiled process name
+ * @param rule_procname The process name of the rule
+ * @param procname The name of the process
+ * @param base Basename of procname, NULL to match the whole name only
+ * @return true if the process matches
+ */
+bool cg_procname_match(const struct cg_procname_pattern * const pattern,
+		       const char * const rule_procname, const char * const procname,
+		       const char * const base);
+
+/**
+ * Compile the rules list starting at head into an index.  The index refers
+ * to the rules, it must be freed before the rules are freed.
+ *
+ * @param head First rule of the list
+ * @param index Output variable for the allocated index
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+int cgroup_rule_index_build(struct cgroup_rule * const head, struct cgroup_rule_index **index);
+
+/**
+ * Free the rules index and set the pointer to NULL.
+ */
+void cgroup_rule_index_free(struct cgroup_rule_index **index);
+
+/**
+ * Prepare an iterator over all the rules which can match the given uid and
+ * procname, in the order of the original list.  Group rules are always
+ * returned as the group membership is not part of the index.
+ *
+ * @param index The rules index
+ * @param uid The UID to match
+ * @param procname The process name to match, NULL matches any rule
+ * @param base Basename of procname (optional)
+ * @param iter Iterator to initialize
+ * @return 0 on success, ECGFAIL when the lookup does not fit into the
+ *	iterator and the caller has to scan the list instead
+ */
+int cgroup_rule_index_lookup(const struct cgroup_rule_index * const index, uid_t uid,
+			     const char * const procname, const char * const base,
+			     struct cgroup_rule_iter * const iter);
+
+/**
+ * Return the next candidate rule or NULL when there are no more rules.
+ */
+struct cgroup_rule *cgroup_rule_iter_next(struct cgroup_rule_iter * const iter);
+
+/**
+ * Check whether uid is a member of the group of an "@group" rule using the
+ * group cache of the index.  The cache is refreshed when it is older than
+ * ttl seconds.
+ *
+ * @param index The rules index
+ * @param rule The group rule
+ * @param uid The UID to look up
+ * @param ttl Lifetime of the cache in seconds, 0 disables the cache
+ * @return 1 if uid is a member, 0 if it is not a member and -1 if the cache
+ *	cannot answer and the caller has to ask NSS
+ */
+int cgroup_rule_index_group_member(struct cgroup_rule_index * const index,
+				   const struct cgroup_rule * const rule, uid_t uid,
+				   unsigned int ttl);
+
+/**
+ * Resolve the members of all the groups used by the indexed rules.
+ *
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+int cgroup_rule_index_resolve_groups(struct cgroup_rule_index * const index);
+
+/**
+ * Drop the cached group members, they are resolved again on the next use.
+ */
+void cgroup_rule_index_invalidate_groups(struct cgroup_rule_index * const index);
+
+/**
+ * Look up the cached result of matching the rules of the index.
+ *
+ * @param index The rules index
+ * @param uid The UID of the lookup
+ * @param gid The GID of the lookup
+ * @param procname The process name of the lookup, may be NULL
+ * @param ttl Lifetime of the group cache in seconds, a result depending on
+ *	the group members is never valid when 0
+ * @param rule Output variable for the first matching rule, NULL when it is
+ *	known that no rule matches
+ * @param groups_gen Output variable for the generation of the group cache,
+ *	to pass to cgroup_rule_index_match_put() after a miss
+ * @return true if the result was cached
+ */
+bool cgroup_rule_index_match_get(struct cgroup_rule_index * const index, uid_t uid, gid_t gid,
+				 const char * const procname, unsigned int ttl,
+				 struct cgroup_rule ** const rule, unsigned long * const groups_gen);
+
+/**
+ * Cache the result of matching the rules of the index.  The result must not
+ * depend on anything else than the uid, the gid, the process name and, if
+ * groups is set, the members of the groups.
+ *
+ * @param rule The first matching rule, NULL if no rule matched
+ * @param groups true if the members of a group were looked up
+ * @param groups_gen The generation returned by cgroup_rule_index_match_get()
+ */
+void cgroup_rule_index_match_put(struct cgroup_rule_index * const index, uid_t uid, gid_t gid,
+				 const char * const procname, struct cgroup_rule * const rule,
+				 bool groups, unsigned long groups_gen);
+
+/**
+ * Drop all the cached match results of the index.
+ */
+void cgroup_rule_index_match_flush(struct cgroup_rule_index * const index);
+
+/**
+ * Open a control file relative to the cached fd of its directory.
+ * @param path Full path of the file
+ * @param flags Flags of open(2), O_CLOEXEC is always added
+ * @return A new fd on success, -1 with errno set on error.
+ */
+int cg_dirfd_open(const char * const path, int flags);
+
+/**
+ * stat(2) a control file relative to the cached fd of its directory.
+ * @param path Full path of the file
+ * @param st The file status
+ * @return 0 on success, -1 with errno set on error.
+ */
+int cg_dirfd_stat(const char * const path, struct stat * const st);
+
+/**
+ * Duplicate the cached fd of a directory, to access many of its files
+ * without going through the cache for each of them.
+ * @param dir Path of the directory
+ * @return A new fd on success, to be closed by the caller, -1 with errno set
+ *	on error.
+ */
+int cg_dirfd_dup(const char * const dir);
+
+#ifdef WITH_IO_URING
+/*
+ * Whether cgroup_set_values_recursive() writes the values with io_uring in
+ * the calling thread.  Set by a configuration load for its thread and its
+ * worker threads, while it creates the groups.
+ */
+extern __thread bool cg_uring_enabled;
+
+/**
+ * Write the values of a controller in order through the io_uring of the
+ * calling thread, clearing their dirty flag, up to the first one that needs
+ * the synchronous path.
+ * @param base Path of the group, for the debug messages
+ * @param dirfd Fd of the directory of the group
+ * @param controller The controller whose values are written
+ * @param order Indexes of the values to write, in order
+ * @param count Number of indexes in order
+ * @return The number of values done, written or skipped as read-only.
+ */
+int cg_uring_write_values(const char * const base, int dirfd,
+			  struct cgroup_controller * const controller, const int * const order,
+			  int count);
+#endif
+
+/**
+ * mkdir -p a cgroup directory relative to the cached fd of its parent, or
+ * of its nearest existing ancestor.  The directories opened on the way are
+ * cached for the next groups created below them.
+ * @param path Path of the directory
+ * @param mode Mode of the created directories
+ * @return 0 on success or if the directory exists, -1 with errno set on
+ *	error.
+ */
+int cg_dirfd_mkdir(const char * const path, mode_t mode);
+
+/**
+ * Close the cached fd of a directory that is about to be removed, an open
+ * fd would keep the removed cgroup around in the kernel.
+ * @param dir Path of the directory
+ */
+void cg_dirfd_forget(const char * const dir);
+
+/**
+ * Close all the cached directory fds.
+ */
+void cg_dirfd_flush(void);
+
+/**
+ * Forget the groups already created from templates, they are checked and
+ * created again on their next use.  Called when the templates are reloaded
+ * and when a group is removed.
+ */
+void cg_template_cache_invalidate(void);
+
+/**
+ * Forget the state of the cgroup.subtree_control files read or written by
+ * this process, e.g. another process may have changed them.  Called when
+ * the mount table is built.
+ */
+void cg_subtree_cache_invalidate(void);
+
+/**
+ * Record the status of the files the rules are parsed from, before parsing
+ * them: the configuration file, the configuration directory and its files,
+ * and the user and group databases.
+ * @param conf_file Path of the configuration file
+ * @param conf_dir Path of the configuration directory
+ * @param sources Filled with the files, to be freed with
+ *	cg_rules_sources_free()
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+int cg_rules_sources_collect(const char * const conf_file, const char * const conf_dir,
+			     struct cg_rules_sources * const sources);
+
+/**
+ * Free the files recorded by cg_rules_sources_collect().
+ */
+void cg_rules_sources_free(struct cg_rules_sources * const sources);
+
+/**
+ * Check that a user or group is listed in /etc/passwd or /etc/group.  The
+ * names resolved by the other services of nsswitch.conf, like LDAP, change
+ * without any file changing: the rules naming them are neither compiled
+ * nor kept across reloads, they are resolved again by each parse.
+ * @param name The user or group name
+ * @param group True for a group
+ * @return true if the name is in the file
+ */
+bool cg_rules_name_in_files(const char * const name, bool group);
+
+/**
+ * Write the compiled cache of a list of parsed rules.  The cache is written
+ * to a temporary file renamed over path.
+ * @param path Path of the cache
+ * @param lst The parsed rules
+ * @param sources The files the rules were parsed from
+ * @return 0 on success, ECGOTHER on error
+ */
+int cg_rules_cache_store(const char * const path, const struct cgroup_rule_list * const lst,
+			 const struct cg_rules_sources * const sources);
+
+/**
+ * Read the rules from their compiled cache, if none of the files they were
+ * parsed from changed since.
+ * @param path Path of the cache
+ * @param lst Filled with the rules, without index
+ * @return 0 on success, ECGOTHER if the cache is missing, stale or invalid
+ */
+int cg_rules_cache_load(const char * const path, struct cgroup_rule_list * const lst);
+
+/**
+ * Publish cg_mount_table in the shared file the next cgroup_init() read,
+ * cg_mount_table_lock must be held.  The file is created on the first call
+ * and locked until the process exits.
+ * @param path Path of the file
+ * @param valid False to withdraw the table, the readers parse the mounts
+ * @return 0 on success, ECGMAXVALUESEXCEEDED if the table does not fit in
+ *	the file, ECGOTHER on error
+ */
+int cg_mount_cache_publish(const char * const path, bool valid);
+
+/**
+ * Fill the empty cg_mount_table from the shared file, if its publisher is
+ * alive and of the same mount namespace.  cg_mount_table_lock must be held
+ * for writing.
+ * @param path Path of the file
+ * @return 0 on success, ECGOTHER if the table is missing, unusable or an
+ *	allocation failed
+ */
+int cg_mount_cache_load(const char * const path);
+
+/**
+ * Add a mount point at the end of the mount points of a controller.
+ * @return 0 on success, ECGOTHER if the allocation failed
+ */
+int cg_add_duplicate_mount(struct cg_mount_table_s *item, const char *path);
+
+/**
+ * Get the shared copy of a control file name.  The interned names are never
+ * freed, there is only a few hundred of them.
+ * @param name The name
+ * @return The interned name, NULL if an allocation failed
+ */
+const char *cg_intern_name(const char * const name);
+
+/**
+ * Replace the value of a control value with a copy of value.
+ * @param controller The controller of cv, its cgroup may have an arena
+ * @param cv The control value
+ * @param value The new value
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+int cg_set_cv_value(const struct cgroup_controller * const controller,
+		    struct control_value * const cv, const char * const value);
+
+/**
+ * Share the values of src with dst instead of copying them, the values of dst
+ * are all dirty.  Neither cgroup of the controllers may have an arena.
+ * @param dst The destination controller, it has no value
+ * @param src The source controller
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+int cg_share_values(struct cgroup_controller * const dst, struct cgroup_controller * const src);
+
+/**
+ * Take a private copy of the values of a controller before they are changed.
+ * The pointers to its control values are not valid anymore on success.
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+int cg_own_values(struct cgroup_controller * const controller);
+
+/**
+ * Get the dirty flag of the value at index i of a controller, whether its
+ * values are shared or not.
+ */
+bool cg_cv_is_dirty(const struct cgroup_controller * const controller, int i);
+
+/**
+ * Set the dirty flag of the value at index i of a controller.
+ */
+void cg_cv_set_dirty(struct cgroup_controller * const controller, int i, bool dirty);
+
+/**
+ * Allocate zeroed memory for a part of cgroup, from its arena if it has one.
+ * @param cgroup The cgroup, may be NULL for the heap
+ * @param size Size of the memory
+ * @return The memory, NULL if the allocation failed
+ */
+void *cg_cgroup_calloc(const struct cgroup * const cgroup, size_t size);
+
+/**
+ * Free all the values of a controller.
+ */
+void cg_free_values(struct cgroup_controller * const controller);
+
+/**
+ * Allocate zeroed memory from an arena, it is released by
+ * cgroup_arena_reset().
+ * @return The memory, NULL if the allocation failed
+ */
+void *cg_arena_alloc(struct cgroup_arena * const arena, size_t size);
+
+/**
+ * Copy at most max characters of str into an arena.
+ * @return The copy, NULL if the allocation failed
+ */
+char *cg_arena_strndup(struct cgroup_arena * const arena, const char * const str, size_t max);
+
+/**
+ * Make room for one more controller in cgroup->controller.
+ * @return 0 on success, ECGMAXVALUESEXCEEDED if cgroup already has
+ *	CG_CONTROLLER_MAX controllers, ECGOTHER if an allocation failed
+ */
+int cg_reserve_controller(struct cgroup * const cgroup);
+
+/**
+ * Make room for one more value in controller->values.
+ * @return 0 on success, ECGMAXVALUESEXCEEDED if controller already has
+ *	CG_NV_MAX values, ECGOTHER if an allocation failed
+ */
+int cg_reserve_value(struct cgroup_controller * const controller);
+
+/**
+ * Start the walk of a handle with CGROUP_WALK_TYPE_DIRS_ONLY from the
+ * directory path.  The directory itself was returned already.
+ * @return 0 on success, ECGOTHER if it cannot be opened
+ */
+int cg_walk_dirs_start(struct cgroup_tree_handle * const entry, const char * const path);
+
+/**
+ * Get the next directory of a walk started by cg_walk_dirs_start().
+ * @param depth Directories deeper than depth are skipped, 0 for no limit
+ * @return 0 on success, ECGEOF at the end of the walk, ECGOTHER if a
+ *	directory cannot be read
+ */
+int cg_walk_dirs_next(struct cgroup_tree_handle * const entry, int depth,
+		      struct cgroup_file_info * const info);
+
+/**
+ * Get the file descriptor of the directory last returned by the walk.
+ * @return The descriptor, -1 if the walk did not start
+ */
+int cg_walk_dirs_fd(const struct cgroup_tree_handle * const entry);
+
+/**
+ * Close the directories of the walk.
+ */
+void cg_walk_dirs_end(struct cgroup_tree_handle * const entry);
+
+/**
+ * Walk the tree under path with a pool of threads, see
+ * cgroup_walk_tree_parallel().
+ * @param path Full path of the first group of the walk
+ */
+int cg_walk_tree_parallel(const char * const path, int depth, int threads, int flags,
+			  cgroup_walk_visit_callback visit, cgroup_walk_emit_callback emit,
+			  void *userdata);
+
+/**
+ * Read a flat keyed or nested keyed file, see cgroup_read_stats_foreach().
+ * @param path Full path of the file
+ */
+int cg_read_keyed_file(const char * const path, cgroup_stat_callback callback, void *userdata);
+
+/**
+ * Parse the lines of a flat keyed or nested keyed file read in a buffer, see
+ * cgroup_read_stats_foreach().  The lines are split in place.
+ * @param buf The content of the file, with room for one more byte
+ * @param len Length of the content
+ */
+int cg_parse_keyed_buf(char *buf, size_t len, cgroup_stat_callback callback, void *userdata);
+
+/**
+ * Read the values of the keys of map from a stats file, see
+ * cgroup_read_stats_map().
+ * @param path Full path of the file
+ */
+int cg_stat_map_read(const char * const path, const struct cgroup_stat_map * const map,
+		     u_int64_t * const values);
+
+/**
+ * Parse the values of the keys of map from the content of a stats file, see
+ * cg_parse_keyed_buf().
+ */
+int cg_stat_map_parse(char *buf, size_t len, const struct cgroup_stat_map * const map,
+		      u_int64_t * const values);
+
+/**
+ * Parse a decimal unsigned integer, "max" is UINT64_MAX.
+ * @return 0 on success, ECGINVAL if str is not a valid integer
+ */
+int cg_stat_parse_u64(const char *str, u_int64_t * const value);
+
+/**
+ * Store the sample current of the group path, taken at now, and compute the
+ * deltas, see cgroup_sampler_read().
+ * @param ino Inode of the directory of the group
+ */
+int cg_sampler_update(struct cgroup_sampler * const sampler, const char * const path, ino_t ino,
+		      const u_int64_t * const current, const struct timespec * const now,
+		      u_int64_t * const deltas, double * const rates, double * const interval);
+
+/**
+ * Drop the previous sample of the group path, if any.
+ */
+void cg_sampler_forget(struct cgroup_sampler * const sampler, const char * const path);
+
+/**
+ * Add a watch of the file path to a monitor, see cgroup_monitor_add_events()
+ * and cgroup_monitor_add_pressure().
+ * @param trigger The PSI trigger written to path, NULL to watch the changes
+ *	of path with inotify
+ */
+int cg_monitor_add(struct cgroup_monitor * const monitor, const char * const path,
+		   const char * const trigger, cgroup_monitor_callback callback, void *userdata,
+		   int * const watch);
+
+/**
+ * Start reading a snapshot, this never blocks.  The data stays valid until
+ * cg_snapshot_put() is called with the same slot.  A reader must not publish
+ * to the snapshot it is reading.
+ * @param slot Set to the slot to pass to cg_snapshot_put()
+ * @return The current data, NULL if none was published
+ */
+void *cg_snapshot_get(struct cg_snapshot * const snapshot, int * const slot);
+
+/**
+ * Stop reading a snapshot.
+ */
+void cg_snapshot_put(struct cg_snapshot * const snapshot, int slot);
+
+/**
+ * Replace the data of a snapshot.  This waits for the readers that may see
+ * the old data, and then releases it.
+ */
+void cg_snapshot_publish(struct cg_snapshot * const snapshot, void *data);
+
 /**
  * Functions that are defined as STATIC can be placed within the UNIT_TEST
  * ifdef.  This will allow them to be included in the unit tests while
@@ -404,22 +1325,47 @@ void cgroup_free_controller(struct cgroup_controller *ctrl);
 #define TEST_PROC_PID_CGROUP_FILE "test-procpidcgroup"
 
 int cgroup_parse_rules_options(char *options, struct cgroup_rule * const rule);
+int cg_read_proc_status(pid_t pid, uid_t *euid, gid_t *egid, char **procname_status);
 int cg_get_cgroups_from_proc_cgroups(pid_t pid, char *cgroup_list[], char *controller_list[],
 				     int list_len);
-bool cgroup_compare_ignore_rule(const struct cgroup_rule * const rule, pid_t pid,
-				const char * const procname);
+void cg_proc_cgroups_init(struct cg_proc_cgroups * const pc, pid_t pid);
+void cg_proc_cgroups_free(struct cg_proc_cgroups * const pc);
+bool cg_compare_ignore_rule(const struct cgroup_rule * const rule,
+			    struct cg_proc_cgroups * const pc, const char * const procname);
 bool cgroup_compare_wildcard_procname(const char * const rule_procname,
 				      const char * const procname);
 int cgroup_process_v1_mnt(char *controllers[], struct mntent *ent, int *mnt_tbl_idx);
 int cgroup_process_v2_mnt(struct mntent *ent, int *mnt_tbl_idx);
 int cgroup_set_values_recursive(const char * const base,
-				const struct cgroup_controller * const controller,
+				struct cgroup_controller * const controller,
 				bool ignore_non_dirty_failures);
 int cgroup_chown_chmod_tasks(const char * const cg_path, uid_t uid, gid_t gid, mode_t fperm);
 int cgroupv2_subtree_control(const char *path, const char *ctrl_name, bool enable);
 int cgroupv2_get_subtree_control(const char *path,  const char *ctrl_name, bool * const enabled);
 int cgroupv2_controller_enabled(const char * const cg_name, const char * const ctrl_name);
 
+int cg_config_parent_groups(struct cgroup * const * const cgroups, int count,
+			    int * const parents);
+int cg_config_stat_group(const struct cgroup * const cgroup, bool * const changed);
+int cg_config_diff_group(const struct cgroup * const cgroup, struct cgroup * const diff);
+
+char *cg_template_cache_key(const char * const group_name, const struct cgroup_rule * const rule);
+bool cg_template_cache_find(const char * const key, bool remove);
+int cg_template_cache_add(char * const key);
+
+int cg_move_task_files(FILE *input_tasks, FILE *output_tasks);
+
+void cgroup_mark_unchanged_rules(const struct cgroup_rule_list * const old,
+				 struct cgroup_rule_list * const lst);
+
+struct cgroup_abstraction_map;
+int cg_convert_lookup(enum cg_version_t out_version, const char * const in_setting,
+		      const struct cgroup_abstraction_map ***entries);
+
+struct cgroup_rule *cgroup_find_matching_rule(const struct cgroup_rule_list * const lst,
+					      uid_t uid, gid_t gid, pid_t pid,
+					      const char *procname);
+
 #endif /* UNIT_TEST */
 
 #ifdef __cplusplus
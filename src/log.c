@@ -15,27 +15,64 @@
 #include <stdio.h>
 
 static cgroup_logger_callback cgroup_logger;
+static cgroup_log_record_callback cgroup_record_logger;
 static void *cgroup_logger_userdata;
 static int cgroup_loglevel;
 
+int cg_log_level = -1;
+
 static void cgroup_default_logger(void *userdata, int level, const char *fmt,
 				  va_list ap)
 {
 	vfprintf(stdout, fmt, ap);
 }
 
-void cgroup_log(int level, const char *fmt, ...)
+static void cg_log_update_level(void)
 {
-	va_list ap;
+	int level = -1;
 
-	if (!cgroup_logger)
-		return;
+	if (cgroup_logger || cgroup_record_logger)
+		level = cgroup_loglevel;
+
+	__atomic_store_n(&cg_log_level, level, __ATOMIC_RELAXED);
+}
+
+static void cg_vlog(int level, size_t prefix_len, const char *file, unsigned int line,
+		    const char *function, const char *fmt, va_list ap)
+{
+	struct cgroup_log_record record;
 
 	if (level > cgroup_loglevel)
 		return;
 
+	if (cgroup_record_logger) {
+		record.level = level;
+		record.file = file;
+		record.line = line;
+		record.function = function;
+		record.format = fmt + prefix_len;
+		cgroup_record_logger(cgroup_logger_userdata, &record, ap);
+	} else if (cgroup_logger) {
+		cgroup_logger(cgroup_logger_userdata, level, fmt, ap);
+	}
+}
+
+void cg_log_full(int level, size_t prefix_len, const char *file, unsigned int line,
+		 const char *function, const char *fmt, ...)
+{
+	va_list ap;
+
 	va_start(ap, fmt);
-	cgroup_logger(cgroup_logger_userdata, level, fmt, ap);
+	cg_vlog(level, prefix_len, file, line, function, fmt, ap);
+	va_end(ap);
+}
+
+void cgroup_log(int level, const char *fmt, ...)
+{
+	va_list ap;
+
+	va_start(ap, fmt);
+	cg_vlog(level, 0, NULL, 0, NULL, fmt, ap);
 	va_end(ap);
 }
 
@@ -43,13 +80,23 @@ void cgroup_set_logger(cgroup_logger_callback logger, int loglevel,
 		       void *userdata)
 {
 	cgroup_logger = logger;
+	cgroup_record_logger = NULL;
+	cgroup_logger_userdata = userdata;
 	cgroup_set_loglevel(loglevel);
+}
+
+void cgroup_set_log_record_callback(cgroup_log_record_callback callback, int loglevel,
+				    void *userdata)
+{
+	cgroup_record_logger = callback;
+	cgroup_logger = NULL;
 	cgroup_logger_userdata = userdata;
+	cgroup_set_loglevel(loglevel);
 }
 
 void cgroup_set_default_logger(int level)
 {
-	if (!cgroup_logger)
+	if (!cgroup_logger && !cgroup_record_logger)
 		cgroup_set_logger(cgroup_default_logger, level, NULL);
 }
 
@@ -89,4 +136,6 @@ void cgroup_set_loglevel(int loglevel)
 		else
 			cgroup_loglevel = CGROUP_DEFAULT_LOGLEVEL;
 	}
+
+	cg_log_update_level();
 }
@@ -0,0 +1,328 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Event driven monitoring of groups
+ *
+ * The files like cgroup.events are watched through one inotify instance, and
+ * each PSI trigger is a pressure file opened for writing.  The inotify fd and
+ * the trigger fds are all added to one epoll instance, whose fd is given to
+ * the application.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/inotify.h>
+#include <sys/epoll.h>
+
+/* Initial number of watches of a monitor */
+#define CG_MONITOR_WATCHES	8
+
+/* Number of epoll events read at once */
+#define CG_MONITOR_EVENTS	16
+
+/* epoll data of the inotify fd, the data of a trigger fd is its watch */
+#define CG_MONITOR_INOTIFY	((uint64_t)-1)
+
+struct cg_monitor_watch {
+	cgroup_monitor_callback callback;
+	void *userdata;
+	/* inotify watch descriptor, -1 for a trigger or once it is removed */
+	int wd;
+	/* Pressure file of a trigger, -1 for an inotify watch */
+	int fd;
+	bool used;
+};
+
+struct cgroup_monitor {
+	int epoll_fd;
+	int inotify_fd;
+
+	struct cg_monitor_watch *watches;
+	int watches_alloc;
+};
+
+struct cgroup_monitor *cgroup_monitor_new(void)
+{
+	struct cgroup_monitor *monitor;
+	struct epoll_event event;
+
+	monitor = calloc(1, sizeof(struct cgroup_monitor));
+	if (!monitor) {
+		last_errno = errno;
+		return NULL;
+	}
+
+	monitor->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	monitor->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (monitor->epoll_fd < 0 || monitor->inotify_fd < 0)
+		goto err;
+
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN;
+	event.data.u64 = CG_MONITOR_INOTIFY;
+	if (epoll_ctl(monitor->epoll_fd, EPOLL_CTL_ADD, monitor->inotify_fd, &event))
+		goto err;
+
+	return monitor;
+
+err:
+	last_errno = errno;
+	cgroup_monitor_free(&monitor);
+
+	return NULL;
+}
+
+void cgroup_monitor_free(struct cgroup_monitor **monitor)
+{
+	int i;
+
+	if (!monitor || !*monitor)
+		return;
+
+	for (i = 0; i < (*monitor)->watches_alloc; i++) {
+		if ((*monitor)->watches[i].used && (*monitor)->watches[i].fd >= 0)
+			close((*monitor)->watches[i].fd);
+	}
+	free((*monitor)->watches);
+
+	/* Closing the inotify fd drops all its watches */
+	if ((*monitor)->inotify_fd >= 0)
+		close((*monitor)->inotify_fd);
+	if ((*monitor)->epoll_fd >= 0)
+		close((*monitor)->epoll_fd);
+
+	free(*monitor);
+	*monitor = NULL;
+}
+
+int cgroup_monitor_get_fd(const struct cgroup_monitor *monitor)
+{
+	if (!monitor)
+		return -1;
+
+	return monitor->epoll_fd;
+}
+
+/**
+ * Find a free watch, the array of watches grows if needed.
+ * @return The index of the watch, -1 if the allocation failed
+ */
+static int cg_monitor_new_watch(struct cgroup_monitor * const monitor)
+{
+	struct cg_monitor_watch *watches;
+	int alloc, i;
+
+	for (i = 0; i < monitor->watches_alloc; i++) {
+		if (!monitor->watches[i].used)
+			return i;
+	}
+
+	alloc = monitor->watches_alloc ? monitor->watches_alloc * 2 : CG_MONITOR_WATCHES;
+	watches = realloc(monitor->watches, alloc * sizeof(struct cg_monitor_watch));
+	if (!watches) {
+		last_errno = errno;
+		return -1;
+	}
+
+	memset(&watches[monitor->watches_alloc], 0,
+	       (alloc - monitor->watches_alloc) * sizeof(struct cg_monitor_watch));
+	monitor->watches = watches;
+	monitor->watches_alloc = alloc;
+
+	return i;
+}
+
+int cg_monitor_add(struct cgroup_monitor * const monitor, const char * const path,
+		   const char * const trigger, cgroup_monitor_callback callback, void *userdata,
+		   int * const watch)
+{
+	struct cg_monitor_watch *entry;
+	struct epoll_event event;
+	int index, fd, wd;
+	size_t len;
+
+	index = cg_monitor_new_watch(monitor);
+	if (index < 0)
+		return ECGOTHER;
+
+	wd = -1;
+	fd = -1;
+
+	if (!trigger) {
+		wd = inotify_add_watch(monitor->inotify_fd, path, IN_MODIFY);
+		if (wd < 0)
+			goto err;
+	} else {
+		fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+			goto err;
+
+		/* The kernel expects the trigger with its terminating NUL */
+		len = strlen(trigger) + 1;
+		if (write(fd, trigger, len) != (ssize_t)len)
+			goto err;
+
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLPRI;
+		event.data.u64 = index;
+		if (epoll_ctl(monitor->epoll_fd, EPOLL_CTL_ADD, fd, &event))
+			goto err;
+	}
+
+	entry = &monitor->watches[index];
+	entry->callback = callback;
+	entry->userdata = userdata;
+	entry->wd = wd;
+	entry->fd = fd;
+	entry->used = true;
+
+	*watch = index;
+
+	return 0;
+
+err:
+	last_errno = errno;
+	if (fd >= 0)
+		close(fd);
+
+	cgroup_warn("cannot watch %s: %s\n", path, strerror(last_errno));
+	if (last_errno == ENOENT)
+		return ECGROUPVALUENOTEXIST;
+
+	return ECGOTHER;
+}
+
+int cgroup_monitor_remove(struct cgroup_monitor *monitor, int watch)
+{
+	struct cg_monitor_watch *entry;
+	int i;
+
+	if (!monitor || watch < 0 || watch >= monitor->watches_alloc ||
+	    !monitor->watches[watch].used)
+		return ECGINVAL;
+
+	entry = &monitor->watches[watch];
+	entry->used = false;
+
+	if (entry->fd >= 0) {
+		/* Closing the fd also removes it from the epoll instance */
+		close(entry->fd);
+		return 0;
+	}
+
+	if (entry->wd < 0)
+		return 0;
+
+	/* inotify returns the same wd for the watches of the same file */
+	for (i = 0; i < monitor->watches_alloc; i++) {
+		if (monitor->watches[i].used && monitor->watches[i].wd == entry->wd)
+			return 0;
+	}
+
+	inotify_rm_watch(monitor->inotify_fd, entry->wd);
+
+	return 0;
+}
+
+/**
+ * Call the callbacks of the watches of an inotify watch descriptor.
+ */
+static void cg_monitor_fire_wd(struct cgroup_monitor * const monitor, int wd,
+			       enum cgroup_monitor_event event)
+{
+	struct cg_monitor_watch *entry;
+	int i;
+
+	/* The callbacks may add or remove watches, the array may move */
+	for (i = 0; i < monitor->watches_alloc; i++) {
+		entry = &monitor->watches[i];
+		if (!entry->used || entry->wd != wd)
+			continue;
+
+		/* The kernel dropped the watch, its wd may be reused */
+		if (event == CGROUP_MONITOR_REMOVED)
+			entry->wd = -1;
+
+		entry->callback(monitor, i, event, entry->userdata);
+	}
+}
+
+static int cg_monitor_read_inotify(struct cgroup_monitor * const monitor)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *event;
+	ssize_t len;
+	char *ptr;
+
+	for (;;) {
+		len = read(monitor->inotify_fd, buf, sizeof(buf));
+		if (len < 0 && errno == EINTR)
+			continue;
+		if (len < 0 && errno == EAGAIN)
+			return 0;
+		if (len <= 0) {
+			last_errno = errno;
+			return ECGOTHER;
+		}
+
+		for (ptr = buf; ptr < buf + len; ptr += sizeof(struct inotify_event) + event->len) {
+			event = (const struct inotify_event *)ptr;
+
+			if (event->mask & IN_IGNORED)
+				cg_monitor_fire_wd(monitor, event->wd, CGROUP_MONITOR_REMOVED);
+			else if (event->mask & IN_MODIFY)
+				cg_monitor_fire_wd(monitor, event->wd, CGROUP_MONITOR_MODIFIED);
+		}
+	}
+}
+
+int cgroup_monitor_dispatch(struct cgroup_monitor *monitor, int timeout)
+{
+	struct epoll_event events[CG_MONITOR_EVENTS];
+	struct cg_monitor_watch *entry;
+	int count, i, index;
+	int ret = 0;
+
+	if (!monitor)
+		return ECGINVAL;
+
+	count = epoll_wait(monitor->epoll_fd, events, CG_MONITOR_EVENTS, timeout);
+	if (count < 0) {
+		if (errno == EINTR)
+			return 0;
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (events[i].data.u64 == CG_MONITOR_INOTIFY) {
+			ret = cg_monitor_read_inotify(monitor);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		/* An earlier callback may have removed the watch */
+		index = events[i].data.u64;
+		if (index >= monitor->watches_alloc || !monitor->watches[index].used ||
+		    monitor->watches[index].fd < 0)
+			continue;
+
+		entry = &monitor->watches[index];
+		if (events[i].events & EPOLLERR) {
+			/* The group was removed, stop polling the trigger */
+			epoll_ctl(monitor->epoll_fd, EPOLL_CTL_DEL, entry->fd, NULL);
+			entry->callback(monitor, index, CGROUP_MONITOR_REMOVED, entry->userdata);
+		} else {
+			entry->callback(monitor, index, CGROUP_MONITOR_PRESSURE, entry->userdata);
+		}
+	}
+
+	return ret;
+}
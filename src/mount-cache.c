@@ -0,0 +1,553 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Mount table shared by cgrulesengd
+ *
+ * Every cgroup_init() reads /proc/cgroups, all of /proc/self/mounts and the
+ * cgroup.controllers file of each cgroup v2 mount.  cgrulesengd instead
+ * publishes the table it parsed in a file it keeps mapped, and updates it
+ * whenever the mounts change.  cgroup_init() maps the file and copies the
+ * table, without reading anything else.
+ *
+ * The table is rewritten in place under a sequence counter: it is odd while
+ * the table is written, a reader retries when the counter was odd or moved
+ * during its copy.  The publisher holds a write lock on the file for its
+ * whole life, a table without a live publisher may be stale and is ignored.
+ * It is also ignored by the processes of another mount namespace or root.
+ *
+ * The file is made of a header, the controllers, the offsets of their mount
+ * points and the strings, all in the native byte order.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CG_MOUNT_CACHE_MAGIC	"CGMOUNT"
+/* Bumped whenever the layout of the file changes */
+#define CG_MOUNT_CACHE_VERSION	1
+
+/* Size of the file, the table is rewritten in place */
+#define CG_MOUNT_CACHE_SIZE	(64 * 1024)
+
+/* Attempts to copy a table that is being rewritten */
+#define CG_MOUNT_CACHE_RETRIES	16
+
+/* String offset of a missing cgroup v2 mount */
+#define CG_MOUNT_CACHE_NONE	UINT32_MAX
+
+struct cg_mount_cache_header {
+	char magic[8];
+	uint32_t version;
+	/* Odd while the table is written */
+	uint32_t seq;
+};
+
+/* The table, right after the header */
+struct cg_mount_cache_table {
+	/* The mount namespace and the root the table was read in */
+	uint64_t mnt_ns_dev;
+	uint64_t mnt_ns_ino;
+	uint64_t root_dev;
+	uint64_t root_ino;
+	/* Size of the table, 0 if none is published */
+	uint32_t size;
+	uint32_t entries_cnt;
+	uint32_t paths_cnt;
+	/* The cgroup v2 mounts without controllers, at the end of the paths */
+	uint32_t empty_cnt;
+	uint32_t v2_path;
+	uint32_t strings_len;
+};
+
+struct cg_mount_cache_entry {
+	char name[CONTROL_NAMELEN_MAX];
+	int32_t version;
+	int32_t shared_mnt;
+	int32_t index;
+	/* Index of the first mount point in the paths */
+	uint32_t paths;
+	uint32_t paths_cnt;
+	uint32_t pad;
+};
+
+#define CG_MOUNT_CACHE_TABLE_MAX \
+	(CG_MOUNT_CACHE_SIZE - sizeof(struct cg_mount_cache_header))
+
+/* The file published by this process, protected by cg_mount_table_lock */
+static int cg_mount_cache_fd = -1;
+static struct cg_mount_cache_header *cg_mount_cache_map;
+
+/* Data of a table being serialized, bounded by the size of the file */
+struct cg_mount_cache_buf {
+	char data[CG_MOUNT_CACHE_TABLE_MAX];
+	size_t len;
+};
+
+static int cg_mount_cache_append(struct cg_mount_cache_buf * const buf, const void * const data,
+				 size_t len)
+{
+	size_t off = buf->len;
+
+	if (len > sizeof(buf->data) - buf->len)
+		return -1;
+
+	memcpy(buf->data + buf->len, data, len);
+	buf->len += len;
+
+	return off;
+}
+
+/**
+ * Get the identity of the mount namespace and of the root of this process.
+ * @return 0 on success, -1 if /proc is not mounted
+ */
+static int cg_mount_cache_ids(struct cg_mount_cache_table * const table)
+{
+	struct stat ns, root;
+
+	if (stat("/proc/self/ns/mnt", &ns) || stat("/", &root))
+		return -1;
+
+	table->mnt_ns_dev = ns.st_dev;
+	table->mnt_ns_ino = ns.st_ino;
+	table->root_dev = root.st_dev;
+	table->root_ino = root.st_ino;
+
+	return 0;
+}
+
+/**
+ * Serialize cg_mount_table, its mount points are counted first as the
+ * strings follow them.
+ * @return 0 on success, -1 if the table does not fit in the file
+ */
+static int cg_mount_cache_serialize(struct cg_mount_cache_buf * const buf)
+{
+	struct cg_mount_cache_table table = { 0 };
+	struct cg_mount_cache_entry entry;
+	struct cg_mount_point *mount;
+	uint32_t *paths, path;
+	size_t strings_off, len;
+	int i;
+
+	if (cg_mount_cache_ids(&table))
+		return -1;
+
+	for (i = 0; i < CG_CONTROLLER_MAX && cg_mount_table[i].name[0] != '\0'; i++) {
+		table.entries_cnt++;
+		for (mount = &cg_mount_table[i].mount; mount; mount = mount->next)
+			table.paths_cnt++;
+	}
+	for (mount = cg_cgroup_v2_empty_mount_paths; mount; mount = mount->next)
+		table.empty_cnt++;
+	table.paths_cnt += table.empty_cnt;
+
+	buf->len = sizeof(table);
+	strings_off = buf->len + table.entries_cnt * sizeof(entry) +
+		      table.paths_cnt * sizeof(uint32_t);
+	if (strings_off > sizeof(buf->data))
+		return -1;
+
+	paths = (uint32_t *)(buf->data + buf->len + table.entries_cnt * sizeof(entry));
+	path = 0;
+
+	for (i = 0; i < table.entries_cnt; i++) {
+		memset(&entry, 0, sizeof(entry));
+		memcpy(entry.name, cg_mount_table[i].name, sizeof(entry.name));
+		entry.version = cg_mount_table[i].version;
+		entry.shared_mnt = cg_mount_table[i].shared_mnt;
+		entry.index = cg_mount_table[i].index;
+		entry.paths = path;
+		for (mount = &cg_mount_table[i].mount; mount; mount = mount->next)
+			entry.paths_cnt++;
+		path += entry.paths_cnt;
+
+		cg_mount_cache_append(buf, &entry, sizeof(entry));
+	}
+
+	/* The strings come after the offsets, which are filled in place */
+	buf->len = strings_off;
+	path = 0;
+	for (i = 0; i < table.entries_cnt; i++) {
+		for (mount = &cg_mount_table[i].mount; mount; mount = mount->next) {
+			len = strlen(mount->path) + 1;
+			paths[path] = buf->len - strings_off;
+			if (cg_mount_cache_append(buf, mount->path, len) < 0)
+				return -1;
+			path++;
+		}
+	}
+	for (mount = cg_cgroup_v2_empty_mount_paths; mount; mount = mount->next) {
+		len = strlen(mount->path) + 1;
+		paths[path] = buf->len - strings_off;
+		if (cg_mount_cache_append(buf, mount->path, len) < 0)
+			return -1;
+		path++;
+	}
+
+	table.v2_path = CG_MOUNT_CACHE_NONE;
+	if (cg_cgroup_v2_mount_path[0] != '\0') {
+		table.v2_path = buf->len - strings_off;
+		if (cg_mount_cache_append(buf, cg_cgroup_v2_mount_path,
+					  strlen(cg_cgroup_v2_mount_path) + 1) < 0)
+			return -1;
+	}
+
+	/* An empty table of strings still has its terminated last string */
+	if (buf->len == strings_off && cg_mount_cache_append(buf, "", 1) < 0)
+		return -1;
+
+	table.strings_len = buf->len - strings_off;
+	table.size = buf->len;
+	memcpy(buf->data, &table, sizeof(table));
+
+	return 0;
+}
+
+/**
+ * Create the file of a publisher, and lock it for the life of the process.
+ * @return 0 on success, ECGOTHER on error
+ */
+static int cg_mount_cache_create(const char * const path)
+{
+	struct cg_mount_cache_header header = { 0 };
+	struct flock lock = { 0 };
+	char *tmp_path = NULL, *dir = NULL;
+	void *map = MAP_FAILED;
+	char *slash;
+	int fd = -1;
+
+	dir = strdup(path);
+	if (!dir)
+		goto err;
+
+	slash = strrchr(dir, '/');
+	if (slash && slash != dir) {
+		*slash = '\0';
+		if (mkdir(dir, 0755) && errno != EEXIST)
+			goto err;
+	}
+
+	if (asprintf(&tmp_path, "%s.XXXXXX", path) < 0) {
+		tmp_path = NULL;
+		goto err;
+	}
+
+	/*
+	 * The file of a former publisher is replaced, not reused: its
+	 * readers keep seeing it without a live publisher.
+	 */
+	fd = mkostemp(tmp_path, O_CLOEXEC);
+	if (fd < 0)
+		goto err;
+
+	lock.l_type = F_WRLCK;
+	lock.l_whence = SEEK_SET;
+	if (fchmod(fd, 0644) || ftruncate(fd, CG_MOUNT_CACHE_SIZE) || fcntl(fd, F_SETLK, &lock))
+		goto err;
+
+	map = mmap(NULL, CG_MOUNT_CACHE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+		goto err;
+
+	memcpy(header.magic, CG_MOUNT_CACHE_MAGIC, sizeof(CG_MOUNT_CACHE_MAGIC));
+	header.version = CG_MOUNT_CACHE_VERSION;
+	memcpy(map, &header, sizeof(header));
+
+	if (rename(tmp_path, path))
+		goto err;
+
+	cg_mount_cache_fd = fd;
+	cg_mount_cache_map = map;
+
+	free(tmp_path);
+	free(dir);
+
+	return 0;
+
+err:
+	last_errno = errno;
+	cgroup_dbg("cannot create the mount table cache %s: %s\n", path, strerror(errno));
+	if (map != MAP_FAILED)
+		munmap(map, CG_MOUNT_CACHE_SIZE);
+	if (fd >= 0) {
+		close(fd);
+		unlink(tmp_path);
+	}
+	free(tmp_path);
+	free(dir);
+
+	return ECGOTHER;
+}
+
+int cg_mount_cache_publish(const char * const path, bool valid)
+{
+	struct cg_mount_cache_table *table;
+	struct cg_mount_cache_buf *buf;
+	uint32_t seq;
+	int ret;
+
+	if (!cg_mount_cache_map) {
+		ret = cg_mount_cache_create(path);
+		if (ret)
+			return ret;
+	}
+
+	buf = malloc(sizeof(*buf));
+	if (!buf) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	/* A table that cannot be published leaves the readers parsing the mounts */
+	ret = 0;
+	if (!valid || cg_mount_cache_serialize(buf)) {
+		memset(buf->data, 0, sizeof(struct cg_mount_cache_table));
+		buf->len = sizeof(struct cg_mount_cache_table);
+		ret = valid ? ECGMAXVALUESEXCEEDED : 0;
+	}
+
+	table = (struct cg_mount_cache_table *)(cg_mount_cache_map + 1);
+	seq = cg_mount_cache_map->seq;
+
+	__atomic_store_n(&cg_mount_cache_map->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	memcpy(table, buf->data, buf->len);
+	__atomic_store_n(&cg_mount_cache_map->seq, seq + 2, __ATOMIC_RELEASE);
+
+	free(buf);
+
+	return ret;
+}
+
+/**
+ * Check that a table was published by a live process, in the same mount
+ * namespace and root as this one.
+ * @return true if the table can be used
+ */
+static bool cg_mount_cache_usable(int fd, const struct stat * const st,
+				  const struct cg_mount_cache_table * const table)
+{
+	struct cg_mount_cache_table ids;
+	struct flock lock = { 0 };
+	struct stat own;
+
+	/* The lock of this very process is not reported by F_GETLK */
+	if (cg_mount_cache_fd < 0 || fstat(cg_mount_cache_fd, &own) ||
+	    own.st_dev != st->st_dev || own.st_ino != st->st_ino) {
+		lock.l_type = F_WRLCK;
+		lock.l_whence = SEEK_SET;
+		if (fcntl(fd, F_GETLK, &lock) || lock.l_type == F_UNLCK) {
+			cgroup_dbg("the mount table cache has no publisher\n");
+			return false;
+		}
+	}
+
+	if (cg_mount_cache_ids(&ids))
+		return false;
+
+	if (ids.mnt_ns_dev != table->mnt_ns_dev || ids.mnt_ns_ino != table->mnt_ns_ino ||
+	    ids.root_dev != table->root_dev || ids.root_ino != table->root_ino) {
+		cgroup_dbg("the mount table cache is of another mount namespace\n");
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Check that all the offsets of a table point inside of it.
+ * @return true if the table is well formed
+ */
+static bool cg_mount_cache_valid(const struct cg_mount_cache_table * const table)
+{
+	const struct cg_mount_cache_entry *entries;
+	const uint32_t *paths;
+	const char *strings;
+	uint64_t expected;
+	uint32_t i;
+
+	if (table->size < sizeof(*table) || table->size > CG_MOUNT_CACHE_TABLE_MAX ||
+	    !table->entries_cnt || table->entries_cnt >= CG_CONTROLLER_MAX ||
+	    !table->strings_len)
+		return false;
+
+	expected = sizeof(*table) +
+		   (uint64_t)table->entries_cnt * sizeof(struct cg_mount_cache_entry) +
+		   (uint64_t)table->paths_cnt * sizeof(uint32_t) + table->strings_len;
+	if (expected != table->size || table->empty_cnt > table->paths_cnt)
+		return false;
+
+	entries = (const struct cg_mount_cache_entry *)(table + 1);
+	paths = (const uint32_t *)(entries + table->entries_cnt);
+	strings = (const char *)(paths + table->paths_cnt);
+
+	/* Every string ends before the end of the table */
+	if (strings[table->strings_len - 1] != '\0')
+		return false;
+
+	if (table->v2_path != CG_MOUNT_CACHE_NONE &&
+	    (table->v2_path >= table->strings_len ||
+	     strlen(strings + table->v2_path) >= FILENAME_MAX))
+		return false;
+
+	for (i = 0; i < table->paths_cnt; i++) {
+		if (paths[i] >= table->strings_len || strlen(strings + paths[i]) >= FILENAME_MAX)
+			return false;
+	}
+
+	for (i = 0; i < table->entries_cnt; i++) {
+		if (!entries[i].name[0] || memchr(entries[i].name, '\0',
+						  sizeof(entries[i].name)) == NULL ||
+		    !entries[i].paths_cnt || (uint64_t)entries[i].paths + entries[i].paths_cnt >
+		    table->paths_cnt - table->empty_cnt)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Copy a consistent table out of the mapped file.
+ * @return 0 on success, -1 if none is published or it kept changing
+ */
+static int cg_mount_cache_copy(const struct cg_mount_cache_header * const header,
+			       struct cg_mount_cache_table * const table)
+{
+	const struct cg_mount_cache_table *shared;
+	uint32_t seq, size;
+	int i;
+
+	shared = (const struct cg_mount_cache_table *)(header + 1);
+
+	for (i = 0; i < CG_MOUNT_CACHE_RETRIES; i++) {
+		seq = __atomic_load_n(&header->seq, __ATOMIC_ACQUIRE);
+		if (seq & 1)
+			continue;
+
+		size = shared->size;
+		if (size < sizeof(*table) || size > CG_MOUNT_CACHE_TABLE_MAX)
+			size = sizeof(*table);
+		memcpy(table, shared, size);
+
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&header->seq, __ATOMIC_RELAXED) != seq)
+			continue;
+
+		return table->size ? 0 : -1;
+	}
+
+	cgroup_dbg("the mount table cache kept changing\n");
+	return -1;
+}
+
+/**
+ * Fill cg_mount_table from a copied table.
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+static int cg_mount_cache_fill(const struct cg_mount_cache_table * const table)
+{
+	const struct cg_mount_cache_entry *entries;
+	struct cg_mount_point *mount, **tail;
+	const uint32_t *paths;
+	const char *strings;
+	uint32_t i, j;
+	int ret;
+
+	entries = (const struct cg_mount_cache_entry *)(table + 1);
+	paths = (const uint32_t *)(entries + table->entries_cnt);
+	strings = (const char *)(paths + table->paths_cnt);
+
+	for (i = 0; i < table->entries_cnt; i++) {
+		memcpy(cg_mount_table[i].name, entries[i].name, sizeof(cg_mount_table[i].name));
+		cg_mount_table[i].version = entries[i].version;
+		cg_mount_table[i].shared_mnt = entries[i].shared_mnt;
+		cg_mount_table[i].index = entries[i].index;
+		strcpy(cg_mount_table[i].mount.path, strings + paths[entries[i].paths]);
+		cg_mount_table[i].mount.next = NULL;
+
+		for (j = 1; j < entries[i].paths_cnt; j++) {
+			ret = cg_add_duplicate_mount(&cg_mount_table[i],
+						     strings + paths[entries[i].paths + j]);
+			if (ret)
+				return ret;
+		}
+	}
+
+	if (table->v2_path != CG_MOUNT_CACHE_NONE)
+		strcpy(cg_cgroup_v2_mount_path, strings + table->v2_path);
+
+	tail = &cg_cgroup_v2_empty_mount_paths;
+	for (i = table->paths_cnt - table->empty_cnt; i < table->paths_cnt; i++) {
+		mount = malloc(sizeof(struct cg_mount_point));
+		if (!mount) {
+			last_errno = errno;
+			return ECGOTHER;
+		}
+
+		strcpy(mount->path, strings + paths[i]);
+		mount->next = NULL;
+		*tail = mount;
+		tail = &mount->next;
+	}
+
+	return 0;
+}
+
+int cg_mount_cache_load(const char * const path)
+{
+	struct cg_mount_cache_header *header = MAP_FAILED;
+	struct cg_mount_cache_table *table = NULL;
+	struct stat st;
+	int ret = ECGOTHER;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return ECGOTHER;
+
+	/* Only a file no other user could have written is trusted */
+	if (fstat(fd, &st) || st.st_size != CG_MOUNT_CACHE_SIZE ||
+	    (st.st_uid != 0 && st.st_uid != geteuid()) || (st.st_mode & (S_IWGRP | S_IWOTH)))
+		goto out;
+
+	header = mmap(NULL, CG_MOUNT_CACHE_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (header == MAP_FAILED)
+		goto out;
+
+	if (memcmp(header->magic, CG_MOUNT_CACHE_MAGIC, sizeof(CG_MOUNT_CACHE_MAGIC)) ||
+	    header->version != CG_MOUNT_CACHE_VERSION)
+		goto out;
+
+	table = malloc(CG_MOUNT_CACHE_TABLE_MAX);
+	if (!table)
+		goto out;
+
+	if (cg_mount_cache_copy(header, table) || !cg_mount_cache_valid(table) ||
+	    !cg_mount_cache_usable(fd, &st, table))
+		goto out;
+
+	ret = cg_mount_cache_fill(table);
+
+out:
+	if (header != MAP_FAILED)
+		munmap(header, CG_MOUNT_CACHE_SIZE);
+	free(table);
+	close(fd);
+
+	return ret;
+}
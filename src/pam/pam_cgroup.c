@@ -66,6 +66,7 @@
 
 /* argument parsing */
 #define PAM_DEBUG_ARG       0x0001
+#define PAM_DAEMON_ARG      0x0002
 
 static int _pam_parse(const pam_handle_t *pamh, int argc, const char **argv)
 {
@@ -75,6 +76,8 @@ static int _pam_parse(const pam_handle_t *pamh, int argc, const char **argv)
 	for (ctrl = 0; argc-- > 0; ++argv) {
 		if (!strcmp(*argv, "debug"))
 			ctrl |= PAM_DEBUG_ARG;
+		else if (!strcmp(*argv, "daemon"))
+			ctrl |= PAM_DAEMON_ARG;
 		else
 			pam_syslog(pamh, LOG_ERR, "unknown option: %s", *argv);
 	}
@@ -110,6 +113,35 @@ PAM_EXTERN int pam_sm_open_session(pam_handle_t *pamh, int flags, int argc, cons
 
 	D(("user name is %s", user_name));
 
+	/* Determine the pid of the task */
+	pid = getpid();
+
+	/*
+	 * cgrulesengd has the rules loaded already, the session only waits for
+	 * it to move the task.  The rules are only loaded here when the daemon
+	 * cannot be reached.
+	 */
+	if (ctrl & PAM_DAEMON_ARG) {
+		ret = cgroup_change_cgroup_uid_gid_daemon(pwd->pw_uid, pwd->pw_gid, pid);
+		if (!ret) {
+			if (ctrl & PAM_DEBUG_ARG)
+				pam_syslog(pamh, LOG_DEBUG, "cgrulesengd changed cgroup for process "
+					   "%d with username %s.\n", pid, user_name);
+			return PAM_SUCCESS;
+		}
+
+		if (ret != ECGOTHER) {
+			if (ctrl & PAM_DEBUG_ARG)
+				pam_syslog(pamh, LOG_ERR, "cgrulesengd failed to change cgroup for "
+					   "username %s: %s\n", user_name, cgroup_strerror(ret));
+			return PAM_SESSION_ERR;
+		}
+
+		if (ctrl & PAM_DEBUG_ARG)
+			pam_syslog(pamh, LOG_DEBUG, "cgrulesengd unreachable: %s\n",
+				   cgroup_strerror(ret));
+	}
+
 	/* Initialize libcgroup */
 	ret = cgroup_init();
 	if (ret) {
@@ -120,9 +152,6 @@ PAM_EXTERN int pam_sm_open_session(pam_handle_t *pamh, int flags, int argc, cons
 
 	D(("Initialized libcgroup successfully."));
 
-	/* Determine the pid of the task */
-	pid = getpid();
-
 	/*
 	 * Note: We are using default gid here. Is there a way to
 	 * determine under what egid service will be provided?
@@ -35,6 +35,13 @@ cdef extern from "libcgroup.h":
         unsigned int minor
         unsigned int release
 
+    cdef enum cgroup_get_pids_flag:
+        CGFLAG_PIDS_UNSORTED
+        CGFLAG_PIDS_THREADS
+
+    ctypedef int (*cgroup_stat_callback)(const char *key, const char *subkey, const char *value,
+                                         void *userdata) noexcept nogil
+
 ifdef(`WITH_SYSTEMD',
     # comment to appease m4
     cdef enum cgroup_systemd_mode_t:
@@ -94,7 +101,7 @@ ifdef(`WITH_SYSTEMD',
                             const cgroup_systemd_scope_opts * const opts)
 )
 
-    int cgroup_get_cgroup(cgroup *cg)
+    int cgroup_get_cgroup(cgroup *cg) nogil
 
     int cgroup_delete_cgroup(cgroup *cg, int ignore_migration)
 
@@ -127,6 +134,12 @@ ifdef(`WITH_SYSTEMD',
 
     int cgroup_get_procs(char *name, char *controller, pid_t **pids, int *size)
 
+    int cgroup_get_pids(const char *name, const char *controller, int flags, pid_t **pids,
+                        int *alloc, int *size) nogil
+
+    int cgroup_read_stats_foreach(const char *controller, const char *path, const char *name,
+                                  cgroup_stat_callback callback, void *userdata) nogil
+
     bool is_cgroup_mode_legacy()
 
     bool is_cgroup_mode_hybrid()
@@ -15,8 +15,10 @@ __author__ = 'Tom Hromatka <tom.hromatka@oracle.com>'
 __date__ = "25 October 2021"
 
 from posix.types cimport pid_t, mode_t
-from libc.stdlib cimport malloc, free
-from libc.string cimport strcpy
+from libc.stdlib cimport malloc, realloc, free, strtoull
+from libc.string cimport strcpy, strlen, memcpy
+from cpython.buffer cimport PyBUF_FORMAT, PyBUF_WRITABLE
+from collections.abc import Mapping
 cimport cgroup
 
 CONTROL_NAMELEN_MAX = 32
@@ -63,7 +65,7 @@ class Controller:
     def __init__(self, name):
         self.name = name
         # self.settings maps to
-        # struct control_value *values[CG_NV_MAX];
+        # struct control_value **values;
         self.settings = dict()
 
     def __str__(self):
@@ -88,6 +90,204 @@ class Controller:
         return True
 
 
+cdef struct stat_buffer:
+    # Records "key[ subkey]\0value\0", one per value of the file
+    char *data
+    size_t size
+    size_t alloc
+    size_t *offsets
+    int count
+    int offsets_alloc
+
+
+cdef int stat_buffer_put(stat_buffer *buf, const char *data, size_t size) noexcept nogil:
+    cdef size_t alloc
+    cdef char *tmp
+
+    if buf.size + size > buf.alloc:
+        alloc = buf.alloc * 2 if buf.alloc else 4096
+        while alloc < buf.size + size:
+            alloc *= 2
+
+        tmp = <char *>realloc(buf.data, alloc)
+        if tmp == NULL:
+            return -1
+        buf.data = tmp
+        buf.alloc = alloc
+
+    memcpy(buf.data + buf.size, data, size)
+    buf.size += size
+
+    return 0
+
+
+cdef int stat_buffer_add(const char *key, const char *subkey, const char *value,
+                         void *userdata) noexcept nogil:
+    cdef stat_buffer *buf = <stat_buffer *>userdata
+    cdef size_t *offsets
+    cdef int alloc
+
+    if buf.count == buf.offsets_alloc:
+        alloc = buf.offsets_alloc * 2 if buf.offsets_alloc else 64
+        offsets = <size_t *>realloc(buf.offsets, alloc * sizeof(size_t))
+        if offsets == NULL:
+            return -1
+        buf.offsets = offsets
+        buf.offsets_alloc = alloc
+
+    buf.offsets[buf.count] = buf.size
+    if stat_buffer_put(buf, key, strlen(key)):
+        return -1
+    if subkey != NULL:
+        if stat_buffer_put(buf, b" ", 1) or stat_buffer_put(buf, subkey, strlen(subkey)):
+            return -1
+    if stat_buffer_put(buf, b"", 1) or stat_buffer_put(buf, value, strlen(value) + 1):
+        return -1
+    buf.count += 1
+
+    return 0
+
+
+cdef class StatView:
+    """Read-only mapping of the values of a stats file
+
+    Description:
+    The file is read in one pass into one buffer.  The keys and the values
+    are only converted to Python objects when they are looked up.  The keys
+    of nested keyed lines are the key and the subkey separated by a space,
+    e.g. '8:0 rbytes'.  The values are integers when they are unsigned
+    integers, strings otherwise
+    """
+    cdef stat_buffer buf
+    # Position of the first line of each key, built on the first lookup
+    cdef dict index
+
+    def __dealloc__(self):
+        free(self.buf.data)
+        free(self.buf.offsets)
+
+    cdef const char *_key(self, int i):
+        return self.buf.data + self.buf.offsets[i]
+
+    cdef object _value(self, int i):
+        cdef const char *key = self._key(i)
+        cdef const char *value = key + strlen(key) + 1
+        cdef char *end
+
+        if value[0] >= c'0' and value[0] <= c'9':
+            num = strtoull(value, &end, 10)
+            if end[0] == 0:
+                return num
+
+        return value.decode()
+
+    cdef int _find(self, key) except -2:
+        cdef int i
+
+        if self.index is None:
+            self.index = {}
+            for i in range(self.buf.count):
+                self.index.setdefault(self._key(i).decode(), i)
+
+        return self.index.get(key, -1)
+
+    def __len__(self):
+        return self.buf.count
+
+    def __getitem__(self, key):
+        i = self._find(key)
+        if i < 0:
+            raise KeyError(key)
+
+        return self._value(i)
+
+    def __contains__(self, key):
+        return self._find(key) >= 0
+
+    def __iter__(self):
+        return iter(self.keys())
+
+    def get(self, key, default=None):
+        i = self._find(key)
+        if i < 0:
+            return default
+
+        return self._value(i)
+
+    def keys(self):
+        return [self._key(i).decode() for i in range(self.buf.count)]
+
+    def values(self):
+        return [self._value(i) for i in range(self.buf.count)]
+
+    def items(self):
+        return [(self._key(i).decode(), self._value(i)) for i in range(self.buf.count)]
+
+
+Mapping.register(StatView)
+
+
+cdef class PidBuffer:
+    """Reusable buffer of the pids of a cgroup
+
+    Description:
+    Filled by Cgroup.read_pids().  The pids are exposed through the buffer
+    protocol, memoryview(buffer) or array('i', buffer) read them without
+    converting each of them to a Python integer.  The buffer cannot be
+    refilled while a memoryview of it exists
+    """
+    cdef pid_t *pids
+    cdef int alloc
+    cdef int size
+    cdef int exports
+    cdef Py_ssize_t shape[1]
+    cdef Py_ssize_t strides[1]
+
+    def __dealloc__(self):
+        free(self.pids)
+
+    def __len__(self):
+        return self.size
+
+    def __getitem__(self, int i):
+        if i < 0:
+            i += self.size
+        if i < 0 or i >= self.size:
+            raise IndexError("pid index out of range")
+
+        return self.pids[i]
+
+    def tolist(self):
+        return [self.pids[i] for i in range(self.size)]
+
+    def __getbuffer__(self, Py_buffer *view, int flags):
+        if flags & PyBUF_WRITABLE:
+            raise BufferError("The pid buffer is read-only")
+
+        self.shape[0] = self.size
+        self.strides[0] = sizeof(pid_t)
+
+        view.buf = self.pids
+        view.obj = self
+        view.len = self.size * sizeof(pid_t)
+        view.readonly = 1
+        view.itemsize = sizeof(pid_t)
+        if flags & PyBUF_FORMAT:
+            view.format = 'i'
+        else:
+            view.format = NULL
+        view.ndim = 1
+        view.shape = self.shape
+        view.strides = self.strides
+        view.suboffsets = NULL
+        view.internal = NULL
+
+        self.exports += 1
+
+    def __releasebuffer__(self, Py_buffer *view):
+        self.exports -= 1
+
+
 cdef class Cgroup:
     """ Python object representing a libcgroup cgroup """
     cdef cgroup.cgroup * _cgp
@@ -263,8 +463,24 @@ cdef class Cgroup:
 
                 name = setting_name.decode("ascii")
                 value = setting_value.decode("ascii").strip()
+                free(setting_value)
                 self.controllers[ctrlr_key].settings[name] = value
 
+    def _pythonize_controllers(self):
+        """
+        Given a self._cgp populated by cgroup_get_cgroup(), populate the
+        controllers and their settings
+        """
+        cdef cgroup.cgroup_controller *ctrl_ptr
+
+        ctrl_cnt = cgroup.cgroup_get_controller_count(self._cgp)
+        for i in range(0, ctrl_cnt):
+            ctrl_ptr = cgroup.cgroup_get_controller_by_index(self._cgp, i)
+            ctrl_name = cgroup.cgroup_get_controller_name(ctrl_ptr).decode('ascii')
+            self.controllers[ctrl_name] = Controller(ctrl_name)
+
+        self._pythonize_cgroup()
+
     def convert(self, out_version):
         """Convert this cgroup to another cgroup version
 
@@ -448,19 +664,158 @@ ifdef(`WITH_SYSTEMD',
         Description:
         Read the cgroup data from the cgroup sysfs filesystem
         """
-        cdef cgroup.cgroup_controller *ctrl_ptr
-
         ret = cgroup.cgroup_get_cgroup(self._cgp)
         if ret is not 0:
             raise RuntimeError("cgroup_get_cgroup failed: {}".`format'(ret))
 
-        ctrl_cnt = cgroup.cgroup_get_controller_count(self._cgp)
-        for i in range(0, ctrl_cnt):
-            ctrl_ptr = cgroup.cgroup_get_controller_by_index(self._cgp, i)
-            ctrl_name = cgroup.cgroup_get_controller_name(ctrl_ptr).decode('ascii')
-            self.controllers[ctrl_name] = Controller(ctrl_name)
+        self._pythonize_controllers()
 
-        self._pythonize_cgroup()
+    @staticmethod
+    def get_many(cgroups):
+        """Get the information of many cgroups from the cgroup sysfs
+
+        Arguments:
+        cgroups - list of Cgroup instances
+
+        Description:
+        Like get() on each cgroup, but the cgroup sysfs is read for all of
+        them in one call, without holding the GIL.  The Python fields are
+        populated afterwards
+
+        Note:
+        Reads from the cgroup sysfs
+        """
+        cdef cgroup.cgroup **cgps
+        cdef Cgroup cg
+        cdef int *rets
+        cdef int i, cnt
+
+        cnt = `len'(cgroups)
+        if cnt == 0:
+            return
+
+        cgps = <cgroup.cgroup **>malloc(cnt * sizeof(cgroup.cgroup *))
+        rets = <int *>malloc(cnt * sizeof(int))
+        if cgps == NULL or rets == NULL:
+            free(cgps)
+            free(rets)
+            raise MemoryError()
+
+        try:
+            for i in range(cnt):
+                cg = cgroups[i]
+                cgps[i] = cg._cgp
+
+            with nogil:
+                for i in range(cnt):
+                    rets[i] = cgroup.cgroup_get_cgroup(cgps[i])
+
+            for i in range(cnt):
+                cg = cgroups[i]
+                if rets[i] != 0:
+                    raise RuntimeError("cgroup_get_cgroup failed for {}: {}".`format'(
+                                       cg.name, rets[i]))
+
+                cg._pythonize_controllers()
+        finally:
+            free(cgps)
+            free(rets)
+
+    def read_stats(self, controller, name=None):
+        """Read a stats file of this cgroup
+
+        Arguments:
+        controller - name of the controller, e.g. 'memory'
+        name (optional) - name of the file, e.g. 'memory.events'.  The stats
+                          file of the controller by default
+
+        Return:
+        Returns a StatView of the values of the file
+
+        Description:
+        Invokes the libcgroup C function, cgroup_read_stats_foreach(),
+        without holding the GIL
+
+        Note:
+        Reads from the cgroup sysfs
+        """
+        return Cgroup.read_stats_many([self], controller, name)[0]
+
+    @staticmethod
+    def read_stats_many(cgroups, controller, name=None):
+        """Read the same stats file of many cgroups
+
+        Arguments:
+        cgroups - list of Cgroup instances
+        controller - name of the controller, e.g. 'memory'
+        name (optional) - name of the file, e.g. 'memory.events'.  The stats
+                          file of the controller by default
+
+        Return:
+        Returns a list with the StatView of each cgroup
+
+        Description:
+        The files of all the cgroups are read in one call, without holding
+        the GIL
+
+        Note:
+        Reads from the cgroup sysfs
+        """
+        cdef const char *c_controller
+        cdef const char *c_name = NULL
+        cdef const char **paths
+        cdef stat_buffer **bufs
+        cdef StatView view
+        cdef bytes b_path
+        cdef int *rets
+        cdef int i, cnt
+
+        b_controller = c_str(controller)
+        c_controller = b_controller
+        if name is not None:
+            b_name = c_str(name)
+            c_name = b_name
+
+        cnt = `len'(cgroups)
+        if cnt == 0:
+            return []
+
+        b_paths = [c_str(cg.name) for cg in cgroups]
+        views = [StatView() for i in range(cnt)]
+
+        paths = <const char **>malloc(cnt * sizeof(char *))
+        bufs = <stat_buffer **>malloc(cnt * sizeof(stat_buffer *))
+        rets = <int *>malloc(cnt * sizeof(int))
+        if paths == NULL or bufs == NULL or rets == NULL:
+            free(paths)
+            free(bufs)
+            free(rets)
+            raise MemoryError()
+
+        try:
+            for i in range(cnt):
+                b_path = b_paths[i]
+                paths[i] = b_path
+                view = views[i]
+                bufs[i] = &view.buf
+
+            with nogil:
+                for i in range(cnt):
+                    rets[i] = cgroup.cgroup_read_stats_foreach(c_controller, paths[i], c_name,
+                                                               stat_buffer_add, bufs[i])
+
+            for i in range(cnt):
+                if rets[i] == -1:
+                    raise MemoryError()
+                if rets[i] != 0:
+                    raise RuntimeError("cgroup_read_stats_foreach failed for {}: {}".`format'(
+                                       cgroups[i].name, rets[i]))
+        finally:
+            free(paths)
+            free(bufs)
+            free(rets)
+
+        return views
 
     def delete(self, ignore_migration=True):
         """Delete the cgroup from the cgroup sysfs
@@ -710,6 +1065,63 @@ ifdef(`WITH_SYSTEMD',
 
         return pid_list
 
+    def read_pids(self, controller=None, threads=False, sort=True, PidBuffer buffer=None):
+        """Read the processes or the threads of this cgroup into a PidBuffer
+
+        Arguments:
+        controller (optional) - name of the controller, needed on cgroup v1
+        threads (optional) - read the threads instead of the processes
+        sort (optional) - sort the pids
+        buffer (optional) - PidBuffer to fill, a new one by default.  A
+                            buffer reused from one call to the next only
+                            grows when needed
+
+        Return:
+        Returns the PidBuffer
+
+        Description:
+        Invokes the libcgroup C function, cgroup_get_pids(), without holding
+        the GIL.  Unlike get_processes(), the pids are not converted to a
+        Python list
+
+        Note:
+        Reads from the cgroup sysfs
+        """
+        cdef const char *c_controller = NULL
+        cdef const char *c_name
+        cdef pid_t **pids
+        cdef int flags = 0
+        cdef int *alloc
+        cdef int *size
+        cdef int ret
+
+        if buffer is None:
+            buffer = PidBuffer()
+        elif buffer.exports > 0:
+            raise BufferError("The pid buffer is in use by a memoryview")
+
+        b_name = c_str(self.name)
+        c_name = b_name
+        if controller is not None:
+            b_controller = c_str(controller)
+            c_controller = b_controller
+
+        if threads:
+            flags |= cgroup.CGFLAG_PIDS_THREADS
+        if not sort:
+            flags |= cgroup.CGFLAG_PIDS_UNSORTED
+
+        pids = &buffer.pids
+        alloc = &buffer.alloc
+        size = &buffer.size
+        with nogil:
+            ret = cgroup.cgroup_get_pids(c_name, c_controller, flags, pids, alloc, size)
+        if ret != 0:
+            buffer.size = 0
+            raise RuntimeError("cgroup_get_pids failed: {}".`format'(ret))
+
+        return buffer
+
     @staticmethod
     def is_cgroup_mode_legacy():
         """Check if the current setup mode is legacy (v1)
@@ -0,0 +1,522 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Reductions of the values of the groups over their subtrees
+ *
+ * Capacity reports need the totals of memory.current or usage_usec of each
+ * subtree, and the highest value of its leaves.  cgroup_rollup_read() walks
+ * the tree once with the parallel walk, where each group reads the files of
+ * the keys into its result.  The groups are then emitted in pre-order into
+ * one array of nodes and one array of values, count values per node, so
+ * that going through the array backwards reduces each group into its parent
+ * after all its subgroups.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/* Initial number of nodes of a result */
+#define CG_ROLLUP_NODES		64
+
+/*
+ * The counters the kernel totals over the subtree of a group, the memory of
+ * cgroup v1 is always hierarchical since Linux 5.11
+ */
+static const struct {
+	enum cg_version_t version;
+	const char *name;
+	/* NULL for all the keys of the file */
+	const char *key;
+} cg_rollup_hierarchical[] = {
+	{ CGROUP_V2, "memory.current", NULL },
+	{ CGROUP_V2, "memory.swap.current", NULL },
+	{ CGROUP_V2, "memory.stat", NULL },
+	{ CGROUP_V2, "pids.current", NULL },
+	{ CGROUP_V2, "io.stat", NULL },
+	{ CGROUP_V2, "cpu.stat", "usage_usec" },
+	{ CGROUP_V2, "cpu.stat", "user_usec" },
+	{ CGROUP_V2, "cpu.stat", "system_usec" },
+	{ CGROUP_V1, "memory.usage_in_bytes", NULL },
+	{ CGROUP_V1, "memory.memsw.usage_in_bytes", NULL },
+	{ CGROUP_V1, "pids.current", NULL },
+	{ CGROUP_V1, "cpuacct.usage", NULL },
+	{ CGROUP_V1, "cpuacct.stat", NULL },
+};
+
+struct cg_rollup_file {
+	const char *name;
+	/* The distinct keys of the file, NULL for a file holding a single value */
+	const char **keys;
+	int keys_cnt;
+	struct cgroup_stat_map *map;
+};
+
+struct cgroup_rollup {
+	struct cgroup_rollup_node *nodes;
+	int count;
+	int alloc;
+	/* The values of node i are at values[i * keys_cnt] */
+	u_int64_t *values;
+	int keys_cnt;
+	/* The paths of the nodes */
+	struct cgroup_arena *arena;
+};
+
+struct cg_rollup_walk {
+	const struct cgroup_rollup_key *keys;
+	int count;
+	/* File of key i, and slot of the key in the keys of the file */
+	int *file;
+	int *slot;
+	bool *hierarchical;
+
+	struct cg_rollup_file *files;
+	int files_cnt;
+	/* Most keys of a file */
+	int keys_max;
+
+	/* The base path without its trailing '/', and the length of its full path */
+	const char *base_path;
+	size_t prefix_len;
+	size_t full_len;
+
+	struct cgroup_rollup *rollup;
+	/* Whether node i read the file of key k, at found[i * count + k] */
+	bool *found;
+	/* The last node of each depth, the parents of the next nodes */
+	int *stack;
+	int stack_alloc;
+};
+
+/*
+ * Result of the visit of a group, allocated at once:
+ *	u_int64_t values[count], read for each key
+ *	u_int64_t scratch[keys_max], read from one file
+ *	bool found[count]
+ */
+static size_t cg_rollup_result_size(const struct cg_rollup_walk * const walk)
+{
+	return (walk->count + walk->keys_max) * sizeof(u_int64_t) + walk->count * sizeof(bool);
+}
+
+static bool cg_rollup_is_hierarchical(enum cg_version_t version, const char * const name,
+				      const char * const key)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(cg_rollup_hierarchical); i++) {
+		if (cg_rollup_hierarchical[i].version == version &&
+		    !strcmp(cg_rollup_hierarchical[i].name, name) &&
+		    (!cg_rollup_hierarchical[i].key ||
+		     (key && !strcmp(cg_rollup_hierarchical[i].key, key))))
+			return true;
+	}
+
+	return false;
+}
+
+static void cg_rollup_walk_free(struct cg_rollup_walk * const walk)
+{
+	int i;
+
+	for (i = 0; i < walk->files_cnt; i++) {
+		free(walk->files[i].keys);
+		cgroup_stat_map_free(&walk->files[i].map);
+	}
+	free(walk->files);
+	free(walk->file);
+	free(walk->slot);
+	free(walk->hierarchical);
+	free(walk->found);
+	free(walk->stack);
+}
+
+/**
+ * Group the keys by file, and build the stat map of each file.
+ * @return 0 on success, ECGINVAL if a file is read both as a single value
+ *	and as a stats file, ECGOTHER if an allocation failed
+ */
+static int cg_rollup_walk_init(struct cg_rollup_walk * const walk, const char * const controller)
+{
+	enum cg_version_t version = CGROUP_UNK;
+	struct cg_rollup_file *file;
+	int i, j;
+
+	cgroup_get_controller_version(controller, &version);
+
+	walk->file = calloc(walk->count, sizeof(int));
+	walk->slot = calloc(walk->count, sizeof(int));
+	walk->hierarchical = calloc(walk->count, sizeof(bool));
+	walk->files = calloc(walk->count, sizeof(struct cg_rollup_file));
+	if (!walk->file || !walk->slot || !walk->hierarchical || !walk->files)
+		goto nomem;
+
+	for (i = 0; i < walk->count; i++) {
+		if (!walk->keys[i].name || walk->keys[i].op < CGROUP_ROLLUP_SUM ||
+		    walk->keys[i].op > CGROUP_ROLLUP_COUNT)
+			return ECGINVAL;
+
+		walk->hierarchical[i] = cg_rollup_is_hierarchical(version, walk->keys[i].name,
+								  walk->keys[i].key);
+
+		for (j = 0; j < walk->files_cnt; j++) {
+			if (!strcmp(walk->files[j].name, walk->keys[i].name))
+				break;
+		}
+		file = &walk->files[j];
+		if (j == walk->files_cnt) {
+			file->name = walk->keys[i].name;
+			file->keys = calloc(walk->count, sizeof(char *));
+			if (!file->keys)
+				goto nomem;
+			walk->files_cnt++;
+		} else if (!file->keys_cnt != !walk->keys[i].key) {
+			return ECGINVAL;
+		}
+		walk->file[i] = j;
+
+		if (!walk->keys[i].key)
+			continue;
+
+		/* The same key may be reduced in several ways */
+		for (j = 0; j < file->keys_cnt; j++) {
+			if (!strcmp(file->keys[j], walk->keys[i].key))
+				break;
+		}
+		if (j == file->keys_cnt)
+			file->keys[file->keys_cnt++] = walk->keys[i].key;
+		walk->slot[i] = j;
+	}
+
+	walk->keys_max = 1;
+	for (i = 0; i < walk->files_cnt; i++) {
+		file = &walk->files[i];
+		if (!file->keys_cnt)
+			continue;
+
+		file->map = cgroup_stat_map_new(file->keys, file->keys_cnt);
+		if (!file->map)
+			goto nomem;
+		walk->keys_max = max(walk->keys_max, file->keys_cnt);
+	}
+
+	return 0;
+
+nomem:
+	last_errno = errno;
+	return ECGOTHER;
+}
+
+/* Store the value of a file holding a single value, on its first line */
+static int cg_rollup_store_single(const char *key, const char *subkey, const char *value,
+				  void *userdata)
+{
+	u_int64_t **slot = userdata;
+
+	if (!*slot)
+		return 0;
+
+	if (subkey || *value || cg_stat_parse_u64(key, *slot)) {
+		cgroup_warn("value %s is not an integer\n", key);
+		return ECGINVAL;
+	}
+	*slot = NULL;
+
+	return 0;
+}
+
+/**
+ * Read the files of the keys of a group, concurrently with the other
+ * groups.
+ */
+static int cg_rollup_visit(const struct cgroup_file_info *info, void *userdata, void **result)
+{
+	struct cg_rollup_walk *walk = userdata;
+	char path[FILENAME_MAX];
+	u_int64_t *values, *scratch, *slot;
+	bool *found;
+	int ret, i, k;
+
+	values = malloc(cg_rollup_result_size(walk));
+	if (!values) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+	scratch = values + walk->count;
+	found = (bool *)(scratch + walk->keys_max);
+	*result = values;
+
+	for (i = 0; i < walk->files_cnt; i++) {
+		if (snprintf(path, sizeof(path), "%s/%s", info->full_path, walk->files[i].name) >=
+		    (int)sizeof(path))
+			return ECGOTHER;
+
+		if (walk->files[i].map) {
+			ret = cg_stat_map_read(path, walk->files[i].map, scratch);
+		} else {
+			scratch[0] = 0;
+			slot = scratch;
+			ret = cg_read_keyed_file(path, cg_rollup_store_single, &slot);
+			if (!ret && slot)
+				ret = ECGROUPVALUENOTEXIST;
+		}
+
+		/* The file may be missing, or its group removed since it was read */
+		if (ret == ECGINVAL)
+			return ret;
+
+		for (k = 0; k < walk->count; k++) {
+			if (walk->file[k] != i)
+				continue;
+			found[k] = !ret;
+			values[k] = ret ? 0 : scratch[walk->slot[k]];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Append a group to the result, in pre-order.
+ */
+static int cg_rollup_emit(const struct cgroup_file_info *info, void *result, void *userdata)
+{
+	struct cg_rollup_walk *walk = userdata;
+	struct cgroup_rollup *rollup = walk->rollup;
+	const u_int64_t *values = result;
+	struct cgroup_rollup_node *nodes;
+	const char *suffix;
+	int alloc, index, k;
+	u_int64_t *dst;
+	bool *found;
+	size_t len;
+	char *path;
+	int *stack;
+
+	if (rollup->count == rollup->alloc) {
+		alloc = rollup->alloc ? rollup->alloc * 2 : CG_ROLLUP_NODES;
+
+		nodes = realloc(rollup->nodes, alloc * sizeof(struct cgroup_rollup_node));
+		if (!nodes)
+			goto nomem;
+		rollup->nodes = nodes;
+
+		dst = realloc(rollup->values, (size_t)alloc * walk->count * sizeof(u_int64_t));
+		if (!dst)
+			goto nomem;
+		rollup->values = dst;
+
+		found = realloc(walk->found, (size_t)alloc * walk->count * sizeof(bool));
+		if (!found)
+			goto nomem;
+		walk->found = found;
+
+		rollup->alloc = alloc;
+	}
+
+	if (info->depth >= walk->stack_alloc) {
+		alloc = walk->stack_alloc ? walk->stack_alloc * 2 : 16;
+		stack = realloc(walk->stack, alloc * sizeof(int));
+		if (!stack)
+			goto nomem;
+		walk->stack = stack;
+		walk->stack_alloc = alloc;
+	}
+
+	/* The path relative to the hierarchy, from the base path */
+	if (info->depth) {
+		suffix = info->full_path + walk->full_len;
+		len = strlen(suffix);
+		path = cg_arena_alloc(rollup->arena, walk->prefix_len + len + 1);
+		if (!path)
+			goto nomem;
+		memcpy(path, walk->base_path, walk->prefix_len);
+		memcpy(path + walk->prefix_len, suffix, len + 1);
+	} else {
+		path = cg_arena_strndup(rollup->arena, walk->base_path, FILENAME_MAX);
+		if (!path)
+			goto nomem;
+	}
+
+	index = rollup->count++;
+	walk->stack[info->depth] = index;
+
+	rollup->nodes[index].path = path;
+	rollup->nodes[index].parent = info->depth ? walk->stack[info->depth - 1] : -1;
+	rollup->nodes[index].depth = info->depth;
+	rollup->nodes[index].values = NULL;
+
+	dst = &rollup->values[(size_t)index * walk->count];
+	found = &walk->found[(size_t)index * walk->count];
+	if (values)
+		memcpy(found, values + walk->count + walk->keys_max, walk->count * sizeof(bool));
+	else
+		memset(found, 0, walk->count * sizeof(bool));
+
+	for (k = 0; k < walk->count; k++) {
+		if (walk->keys[k].op == CGROUP_ROLLUP_COUNT)
+			dst[k] = found[k];
+		else
+			dst[k] = found[k] ? values[k] : 0;
+	}
+
+	free(result);
+
+	return 0;
+
+nomem:
+	last_errno = errno;
+	free(result);
+
+	return ECGOTHER;
+}
+
+/**
+ * Reduce each group into its parent, the subgroups of a group come after it
+ * in the array.
+ */
+static int cg_rollup_reduce(const struct cg_rollup_walk * const walk)
+{
+	struct cgroup_rollup *rollup = walk->rollup;
+	u_int64_t *child, *parent;
+	bool *merged;
+	int i, k, p;
+
+	merged = calloc(rollup->count, sizeof(bool));
+	if (!merged) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	for (i = rollup->count - 1; i > 0; i--) {
+		p = rollup->nodes[i].parent;
+		child = &rollup->values[(size_t)i * walk->count];
+		parent = &rollup->values[(size_t)p * walk->count];
+
+		for (k = 0; k < walk->count; k++) {
+			switch (walk->keys[k].op) {
+			case CGROUP_ROLLUP_SUM:
+				/* The kernel already counted the subgroups */
+				if (walk->hierarchical[k] && walk->found[(size_t)p * walk->count + k])
+					break;
+				parent[k] = parent[k] > UINT64_MAX - child[k] ?
+					    UINT64_MAX : parent[k] + child[k];
+				break;
+			case CGROUP_ROLLUP_MAX:
+				/* The value of a group with subgroups is the one of its leaves */
+				if (!merged[p] || child[k] > parent[k])
+					parent[k] = child[k];
+				break;
+			case CGROUP_ROLLUP_COUNT:
+				parent[k] += child[k];
+				break;
+			}
+		}
+		merged[p] = true;
+	}
+	free(merged);
+
+	for (i = 0; i < rollup->count; i++)
+		rollup->nodes[i].values = &rollup->values[(size_t)i * walk->count];
+
+	return 0;
+}
+
+int cgroup_rollup_read(const char *controller, const char *base_path, int depth, int threads,
+		       const struct cgroup_rollup_key *keys, int count,
+		       struct cgroup_rollup **rollup)
+{
+	char full_path[FILENAME_MAX];
+	struct cg_rollup_walk walk;
+	int ret;
+
+	if (!rollup)
+		return ECGINVAL;
+	*rollup = NULL;
+
+	if (!cgroup_initialized)
+		return ECGROUPNOTINITIALIZED;
+
+	if (!controller || !base_path || !keys || count < 1 || threads < 1 || depth < 0)
+		return ECGINVAL;
+
+	if (!cg_build_path(base_path, full_path, controller))
+		return ECGOTHER;
+
+	memset(&walk, 0, sizeof(walk));
+	walk.keys = keys;
+	walk.count = count;
+	walk.base_path = base_path;
+	walk.prefix_len = strlen(base_path);
+	while (walk.prefix_len && base_path[walk.prefix_len - 1] == '/')
+		walk.prefix_len--;
+	/* The walk joins the paths of the subgroups to this one */
+	walk.full_len = strlen(full_path);
+	if (walk.full_len && full_path[walk.full_len - 1] == '/')
+		walk.full_len--;
+
+	ret = cg_rollup_walk_init(&walk, controller);
+	if (ret)
+		goto out;
+
+	walk.rollup = calloc(1, sizeof(struct cgroup_rollup));
+	if (!walk.rollup) {
+		last_errno = errno;
+		ret = ECGOTHER;
+		goto out;
+	}
+	walk.rollup->keys_cnt = count;
+	walk.rollup->arena = cgroup_arena_new();
+	if (!walk.rollup->arena) {
+		ret = ECGOTHER;
+		goto out;
+	}
+
+	ret = cgroup_walk_tree_parallel(controller, base_path, depth, threads,
+					CGROUP_WALK_PARALLEL_SORTED, cg_rollup_visit,
+					cg_rollup_emit, &walk);
+	if (!ret && !walk.rollup->count)
+		ret = ECGROUPNOTEXIST;
+	if (!ret)
+		ret = cg_rollup_reduce(&walk);
+
+out:
+	if (ret)
+		cgroup_rollup_free(&walk.rollup);
+	*rollup = walk.rollup;
+	cg_rollup_walk_free(&walk);
+
+	return ret;
+}
+
+const struct cgroup_rollup_node *cgroup_rollup_nodes(const struct cgroup_rollup *rollup,
+						     int *count)
+{
+	if (!rollup) {
+		if (count)
+			*count = 0;
+		return NULL;
+	}
+
+	if (count)
+		*count = rollup->count;
+
+	return rollup->nodes;
+}
+
+void cgroup_rollup_free(struct cgroup_rollup **rollup)
+{
+	if (!rollup || !*rollup)
+		return;
+
+	cgroup_arena_free(&(*rollup)->arena);
+	free((*rollup)->nodes);
+	free((*rollup)->values);
+
+	free(*rollup);
+	*rollup = NULL;
+}
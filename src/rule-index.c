@@ -0,0 +1,925 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Compiled index of the cached cgrules.conf rules
+ *
+ * The cached rules are kept in a singly linked list and the order of that
+ * list defines which rule wins when more than one rule matches a process.
+ * Walking the whole list for every classification gets expensive with a
+ * few thousand rules, so the list is compiled into hash buckets keyed by
+ * the user part and by the process name part of each rule.  Rules ending
+ * with an asterisk, and the glob and regular expression rules, are added to a
+ * trie of the literal prefixes their names start with: walking the name of a
+ * process down the trie gathers all the patterns it can match at once.
+ *
+ * A lookup only gathers the few buckets that can possibly match the given
+ * uid, gid and process name and merges them by the original position of
+ * the rules in the list, thus the first-match-wins semantics is retained.
+ * The caller still has to check each returned rule, the index only filters
+ * out the rules that can never match.
+ *
+ * The index also caches the members of the groups used by "@group" rules.
+ * Resolving them through NSS for every rule and every event is slow when
+ * the groups are served by a remote directory, so the members are resolved
+ * to uids once and refreshed only after the configured TTL expired.
+ *
+ * Finally the index caches the results of the lookups.  The same few hundred
+ * (uid, gid, process name) combinations account for almost all the events
+ * of a host, so the first matching rule, or the lack of one, is kept in a
+ * set-associative table evicting with the CLOCK algorithm.  A result which
+ * relied on the members of a group is only valid as long as the group cache
+ * it was computed with.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#include <time.h>
+#include <pwd.h>
+
+/* The user part of a bucket key */
+#define CG_RIDX_UID		'u'
+#define CG_RIDX_WILD		'w'
+#define CG_RIDX_GROUP		'@'
+
+/* The process name part of a bucket key */
+#define CG_RIDX_ALL		'a'	/* all rules, used when procname is unknown */
+#define CG_RIDX_NOPROC		'n'	/* rules without a process name */
+#define CG_RIDX_EXACT		'e'	/* rules matching the whole procname */
+#define CG_RIDX_PREFIX		'p'	/* rules ending with an asterisk */
+
+#define CG_RIDX_KEY_MAX		(FILENAME_MAX + 32)
+#define CG_RIDX_MIN_SIZE	16
+
+/* Geometry of the match result cache, CG_RMC_SETS must be a power of two */
+#define CG_RMC_SETS		128
+#define CG_RMC_WAYS		8
+
+struct cg_rule_ref {
+	unsigned int pos;
+	struct cgroup_rule *rule;
+};
+
+struct cgroup_rule_bucket {
+	char *key;
+	struct cg_rule_ref *refs;
+	int count;
+	int alloc;
+	struct cgroup_rule_bucket *next;
+};
+
+struct cg_trie_node {
+	struct cg_trie_node *child;
+	struct cg_trie_node *sibling;
+	unsigned char ch;
+	bool prefix_end;
+};
+
+struct cg_rule_group {
+	char *name;
+	/* Sorted uids of the group members */
+	uid_t *members;
+	int count;
+	struct cg_rule_group *next;
+};
+
+struct cg_rule_match {
+	/* NULL for a lookup without a process name */
+	char *procname;
+	/* The first matching rule, NULL if no rule matched */
+	struct cgroup_rule *rule;
+	/* Generation of the group cache the result was computed with */
+	unsigned long groups_gen;
+	unsigned int hash;
+	uid_t uid;
+	gid_t gid;
+	bool used;
+	bool groups;
+	bool referenced;
+};
+
+struct cg_rule_match_set {
+	pthread_mutex_t lock;
+	/* The CLOCK hand, next way to consider for eviction */
+	unsigned int hand;
+	struct cg_rule_match ways[CG_RMC_WAYS];
+};
+
+struct cgroup_rule_index {
+	struct cgroup_rule_bucket **table;
+	unsigned int table_size;
+	struct cg_trie_node trie;
+
+	/* The group cache is refreshed by lookups running in parallel */
+	pthread_mutex_t groups_lock;
+	struct cg_rule_group **groups;
+	unsigned int groups_size;
+	bool groups_resolved;
+	time_t groups_stamp;
+	/* Bumped whenever the group cache changes, read without the lock */
+	unsigned long groups_gen;
+
+	struct cg_rule_match_set *matches;
+};
+
+static unsigned int cg_ridx_hash(const char * const key)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, key);
+}
+
+static void cg_ridx_key(char * const key, char kind, unsigned long id, char prockind,
+			const char * const name, int name_len)
+{
+	snprintf(key, CG_RIDX_KEY_MAX, "%c%lu:%c%.*s", kind, id, prockind, name_len, name);
+}
+
+static struct cgroup_rule_bucket *cg_ridx_find(const struct cgroup_rule_index * const index,
+					       const char * const key)
+{
+	struct cgroup_rule_bucket *bucket;
+
+	bucket = index->table[cg_ridx_hash(key) & (index->table_size - 1)];
+	while (bucket) {
+		if (strcmp(bucket->key, key) == 0)
+			return bucket;
+		bucket = bucket->next;
+	}
+
+	return NULL;
+}
+
+static int cg_ridx_add(struct cgroup_rule_index * const index, const char * const key,
+		       struct cgroup_rule * const rule, unsigned int pos)
+{
+	struct cgroup_rule_bucket *bucket;
+	struct cg_rule_ref *refs;
+	unsigned int slot;
+
+	bucket = cg_ridx_find(index, key);
+	if (!bucket) {
+		bucket = calloc(1, sizeof(struct cgroup_rule_bucket));
+		if (!bucket)
+			goto err;
+
+		bucket->key = strdup(key);
+		if (!bucket->key) {
+			free(bucket);
+			goto err;
+		}
+
+		slot = cg_ridx_hash(key) & (index->table_size - 1);
+		bucket->next = index->table[slot];
+		index->table[slot] = bucket;
+	}
+
+	/* Rules are added in the list order, thus the bucket stays sorted */
+	if (bucket->count > 0 && bucket->refs[bucket->count - 1].pos == pos)
+		return 0;
+
+	if (bucket->count == bucket->alloc) {
+		refs = realloc(bucket->refs, sizeof(struct cg_rule_ref) *
+			       (bucket->alloc ? bucket->alloc * 2 : 4));
+		if (!refs)
+			goto err;
+
+		bucket->refs = refs;
+		bucket->alloc = bucket->alloc ? bucket->alloc * 2 : 4;
+	}
+
+	bucket->refs[bucket->count].pos = pos;
+	bucket->refs[bucket->count].rule = rule;
+	bucket->count++;
+
+	return 0;
+
+err:
+	last_errno = errno;
+	return ECGOTHER;
+}
+
+static int cg_ridx_trie_insert(struct cg_trie_node *node, const char *prefix, size_t len)
+{
+	struct cg_trie_node *child;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		for (child = node->child; child; child = child->sibling) {
+			if (child->ch == (unsigned char)prefix[i])
+				break;
+		}
+
+		if (!child) {
+			child = calloc(1, sizeof(struct cg_trie_node));
+			if (!child) {
+				last_errno = errno;
+				return ECGOTHER;
+			}
+
+			child->ch = (unsigned char)prefix[i];
+			child->sibling = node->child;
+			node->child = child;
+		}
+
+		node = child;
+	}
+
+	node->prefix_end = true;
+
+	return 0;
+}
+
+static void cg_ridx_trie_free(struct cg_trie_node *node)
+{
+	struct cg_trie_node *child, *next;
+
+	for (child = node->child; child; child = next) {
+		next = child->sibling;
+		cg_ridx_trie_free(child);
+		free(child);
+	}
+
+	node->child = NULL;
+}
+
+static struct cg_rule_group *cg_ridx_find_group(const struct cgroup_rule_index * const index,
+						 const char * const name)
+{
+	struct cg_rule_group *group;
+
+	group = index->groups[cg_ridx_hash(name) & (index->groups_size - 1)];
+	while (group) {
+		if (strcmp(group->name, name) == 0)
+			return group;
+		group = group->next;
+	}
+
+	return NULL;
+}
+
+static int cg_ridx_add_group(struct cgroup_rule_index * const index, const char * const name)
+{
+	struct cg_rule_group *group;
+	unsigned int slot;
+
+	if (cg_ridx_find_group(index, name))
+		return 0;
+
+	group = calloc(1, sizeof(struct cg_rule_group));
+	if (!group)
+		goto err;
+
+	group->name = strdup(name);
+	if (!group->name) {
+		free(group);
+		goto err;
+	}
+
+	slot = cg_ridx_hash(name) & (index->groups_size - 1);
+	group->next = index->groups[slot];
+	index->groups[slot] = group;
+
+	return 0;
+
+err:
+	last_errno = errno;
+	return ECGOTHER;
+}
+
+static int cg_ridx_uid_compare(const void *a, const void *b)
+{
+	uid_t ua = *(const uid_t *)a;
+	uid_t ub = *(const uid_t *)b;
+
+	return (ua > ub) - (ua < ub);
+}
+
+static int cg_ridx_resolve_group(struct cg_rule_group * const group)
+{
+	char pw_buffer[CGROUP_BUFFER_LEN];
+	struct passwd pw, *pwd;
+	char *gr_buffer = NULL;
+	struct group gr, *grp;
+	int i, cnt;
+	int ret = 0;
+
+	free(group->members);
+	group->members = NULL;
+	group->count = 0;
+
+	grp = cg_getgrnam(group->name, &gr, &gr_buffer);
+	if (!grp) {
+		cgroup_dbg("group %s not found, its rules match by gid only\n", group->name);
+		goto out;
+	}
+
+	for (cnt = 0; grp->gr_mem[cnt]; cnt++)
+		;
+
+	if (cnt == 0)
+		goto out;
+
+	group->members = malloc(sizeof(uid_t) * cnt);
+	if (!group->members) {
+		last_errno = errno;
+		ret = ECGOTHER;
+		goto out;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		if (getpwnam_r(grp->gr_mem[i], &pw, pw_buffer, sizeof(pw_buffer), &pwd) == 0 && pwd)
+			group->members[group->count++] = pwd->pw_uid;
+	}
+
+	qsort(group->members, group->count, sizeof(uid_t), cg_ridx_uid_compare);
+
+out:
+	free(gr_buffer);
+
+	return ret;
+}
+
+static time_t cg_ridx_now(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts))
+		return 0;
+
+	return ts.tv_sec;
+}
+
+static int cg_ridx_resolve_groups_locked(struct cgroup_rule_index * const index)
+{
+	struct cg_rule_group *group;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < index->groups_size; i++) {
+		for (group = index->groups[i]; group; group = group->next) {
+			ret = cg_ridx_resolve_group(group);
+			if (ret) {
+				index->groups_resolved = false;
+				__atomic_add_fetch(&index->groups_gen, 1, __ATOMIC_RELEASE);
+				return ret;
+			}
+		}
+	}
+
+	index->groups_resolved = true;
+	__atomic_store_n(&index->groups_stamp, cg_ridx_now(), __ATOMIC_RELAXED);
+	__atomic_add_fetch(&index->groups_gen, 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+int cgroup_rule_index_resolve_groups(struct cgroup_rule_index * const index)
+{
+	int ret;
+
+	pthread_mutex_lock(&index->groups_lock);
+	ret = cg_ridx_resolve_groups_locked(index);
+	pthread_mutex_unlock(&index->groups_lock);
+
+	return ret;
+}
+
+void cgroup_rule_index_invalidate_groups(struct cgroup_rule_index * const index)
+{
+	if (!index)
+		return;
+
+	pthread_mutex_lock(&index->groups_lock);
+	index->groups_resolved = false;
+	__atomic_add_fetch(&index->groups_gen, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&index->groups_lock);
+}
+
+int cgroup_rule_index_group_member(struct cgroup_rule_index * const index,
+				   const struct cgroup_rule * const rule, uid_t uid,
+				   unsigned int ttl)
+{
+	struct cg_rule_group *group;
+	int ret = -1;
+
+	if (!index || ttl == 0 || rule->username[0] != '@')
+		return -1;
+
+	pthread_mutex_lock(&index->groups_lock);
+
+	if (!index->groups_resolved || cg_ridx_now() - index->groups_stamp >= (time_t)ttl) {
+		if (cg_ridx_resolve_groups_locked(index))
+			goto out;
+	}
+
+	group = cg_ridx_find_group(index, &rule->username[1]);
+	if (!group)
+		goto out;
+
+	ret = 0;
+	if (group->members)
+		ret = bsearch(&uid, group->members, group->count, sizeof(uid_t),
+			      cg_ridx_uid_compare) != NULL;
+
+out:
+	pthread_mutex_unlock(&index->groups_lock);
+
+	return ret;
+}
+
+static unsigned int cg_ridx_match_hash(uid_t uid, gid_t gid, const char * const procname)
+{
+	unsigned int hash;
+
+	hash = procname ? cg_ridx_hash(procname) : 0;
+	hash ^= uid * 2654435761U;
+	hash ^= gid * 2246822519U;
+
+	/* The low bits pick the set, fold the high ones into them */
+	return hash ^ (hash >> 16);
+}
+
+static void cg_ridx_match_clear(struct cg_rule_match * const match)
+{
+	free(match->procname);
+	memset(match, 0, sizeof(*match));
+}
+
+static bool cg_ridx_match_equal(const struct cg_rule_match * const match, unsigned int hash,
+				uid_t uid, gid_t gid, const char * const procname)
+{
+	if (!match->used || match->hash != hash || match->uid != uid || match->gid != gid)
+		return false;
+
+	if (!match->procname || !procname)
+		return match->procname == procname;
+
+	return strcmp(match->procname, procname) == 0;
+}
+
+/**
+ * Check whether the group cache a result was computed with is still the
+ * current one and did not expire.
+ */
+static bool cg_ridx_match_groups_valid(struct cgroup_rule_index * const index,
+				       const struct cg_rule_match * const match,
+				       unsigned int ttl)
+{
+	time_t stamp;
+
+	if (ttl == 0)
+		return false;
+
+	if (match->groups_gen != __atomic_load_n(&index->groups_gen, __ATOMIC_ACQUIRE))
+		return false;
+
+	stamp = __atomic_load_n(&index->groups_stamp, __ATOMIC_RELAXED);
+
+	return cg_ridx_now() - stamp < (time_t)ttl;
+}
+
+bool cgroup_rule_index_match_get(struct cgroup_rule_index * const index, uid_t uid, gid_t gid,
+				 const char * const procname, unsigned int ttl,
+				 struct cgroup_rule ** const rule, unsigned long * const groups_gen)
+{
+	struct cg_rule_match_set *set;
+	struct cg_rule_match *match;
+	unsigned int hash, i;
+	bool hit = false;
+
+	/* Read before the caller matches the rules, a refresh meanwhile is noticed */
+	*groups_gen = __atomic_load_n(&index->groups_gen, __ATOMIC_ACQUIRE);
+
+	if (!index->matches)
+		return false;
+
+	hash = cg_ridx_match_hash(uid, gid, procname);
+	set = &index->matches[hash & (CG_RMC_SETS - 1)];
+
+	pthread_mutex_lock(&set->lock);
+
+	for (i = 0; i < CG_RMC_WAYS; i++) {
+		match = &set->ways[i];
+		if (!cg_ridx_match_equal(match, hash, uid, gid, procname))
+			continue;
+
+		if (match->groups && !cg_ridx_match_groups_valid(index, match, ttl)) {
+			cg_ridx_match_clear(match);
+			break;
+		}
+
+		match->referenced = true;
+		*rule = match->rule;
+		hit = true;
+		break;
+	}
+
+	pthread_mutex_unlock(&set->lock);
+
+	return hit;
+}
+
+void cgroup_rule_index_match_put(struct cgroup_rule_index * const index, uid_t uid, gid_t gid,
+				 const char * const procname, struct cgroup_rule * const rule,
+				 bool groups, unsigned long groups_gen)
+{
+	struct cg_rule_match *match = NULL;
+	struct cg_rule_match_set *set;
+	char *name = NULL;
+	unsigned int hash, i;
+
+	if (!index->matches)
+		return;
+
+	if (procname) {
+		name = strdup(procname);
+		if (!name)
+			return;
+	}
+
+	hash = cg_ridx_match_hash(uid, gid, procname);
+	set = &index->matches[hash & (CG_RMC_SETS - 1)];
+
+	pthread_mutex_lock(&set->lock);
+
+	/* Another thread may have stored the same lookup meanwhile */
+	for (i = 0; i < CG_RMC_WAYS; i++) {
+		if (cg_ridx_match_equal(&set->ways[i], hash, uid, gid, procname)) {
+			match = &set->ways[i];
+			break;
+		}
+	}
+
+	/* Otherwise evict the first way not referenced since the hand went by */
+	while (!match) {
+		match = &set->ways[set->hand];
+		set->hand = (set->hand + 1) % CG_RMC_WAYS;
+
+		if (match->used && match->referenced) {
+			match->referenced = false;
+			match = NULL;
+		}
+	}
+
+	cg_ridx_match_clear(match);
+	match->procname = name;
+	match->rule = rule;
+	match->groups_gen = groups_gen;
+	match->hash = hash;
+	match->uid = uid;
+	match->gid = gid;
+	match->groups = groups;
+	match->used = true;
+
+	pthread_mutex_unlock(&set->lock);
+}
+
+void cgroup_rule_index_match_flush(struct cgroup_rule_index * const index)
+{
+	struct cg_rule_match_set *set;
+	unsigned int i, j;
+
+	if (!index || !index->matches)
+		return;
+
+	for (i = 0; i < CG_RMC_SETS; i++) {
+		set = &index->matches[i];
+
+		pthread_mutex_lock(&set->lock);
+		for (j = 0; j < CG_RMC_WAYS; j++)
+			cg_ridx_match_clear(&set->ways[j]);
+		set->hand = 0;
+		pthread_mutex_unlock(&set->lock);
+	}
+}
+
+/**
+ * Add one rule into all the buckets it belongs to.
+ */
+static int cg_ridx_add_rule(struct cgroup_rule_index * const index,
+			    struct cgroup_rule * const rule, unsigned int pos)
+{
+	char key[CG_RIDX_KEY_MAX];
+	const char *prefix;
+	unsigned long id = 0;
+	size_t len;
+	char kind;
+	int ret;
+
+	if ((rule->uid == CGRULE_WILD) && (rule->gid == CGRULE_WILD)) {
+		kind = CG_RIDX_WILD;
+	} else if (rule->username[0] == '@') {
+		/*
+		 * Group membership is resolved by the caller, all group rules
+		 * share the same buckets.
+		 */
+		kind = CG_RIDX_GROUP;
+
+		ret = cg_ridx_add_group(index, &rule->username[1]);
+		if (ret)
+			return ret;
+	} else {
+		kind = CG_RIDX_UID;
+		id = rule->uid;
+	}
+
+	cg_ridx_key(key, kind, id, CG_RIDX_ALL, "", 0);
+	ret = cg_ridx_add(index, key, rule, pos);
+	if (ret)
+		return ret;
+
+	if (!rule->procname) {
+		cg_ridx_key(key, kind, id, CG_RIDX_NOPROC, "", 0);
+		return cg_ridx_add(index, key, rule, pos);
+	}
+
+	if (rule->pattern.type != CG_PROCNAME_LEGACY) {
+		/* A pattern is only found through its literal prefix */
+		prefix = rule->procname + rule->pattern.prefix_start;
+		len = rule->pattern.prefix_len;
+	} else {
+		len = strlen(rule->procname);
+		cg_ridx_key(key, kind, id, CG_RIDX_EXACT, rule->procname, len);
+		ret = cg_ridx_add(index, key, rule, pos);
+		if (ret)
+			return ret;
+
+		if (len == 0 || rule->procname[len - 1] != '*')
+			return 0;
+
+		prefix = rule->procname;
+		len--;
+	}
+
+	cg_ridx_key(key, kind, id, CG_RIDX_PREFIX, prefix, len);
+	ret = cg_ridx_add(index, key, rule, pos);
+	if (ret)
+		return ret;
+
+	return cg_ridx_trie_insert(&index->trie, prefix, len);
+}
+
+void cgroup_rule_index_free(struct cgroup_rule_index **index)
+{
+	struct cgroup_rule_bucket *bucket, *next;
+	struct cg_rule_group *group, *next_group;
+	unsigned int i;
+
+	if (!index || !*index)
+		return;
+
+	for (i = 0; (*index)->table && i < (*index)->table_size; i++) {
+		for (bucket = (*index)->table[i]; bucket; bucket = next) {
+			next = bucket->next;
+			free(bucket->key);
+			free(bucket->refs);
+			free(bucket);
+		}
+	}
+
+	for (i = 0; (*index)->groups && i < (*index)->groups_size; i++) {
+		for (group = (*index)->groups[i]; group; group = next_group) {
+			next_group = group->next;
+			free(group->name);
+			free(group->members);
+			free(group);
+		}
+	}
+
+	if ((*index)->matches) {
+		cgroup_rule_index_match_flush(*index);
+		for (i = 0; i < CG_RMC_SETS; i++)
+			pthread_mutex_destroy(&(*index)->matches[i].lock);
+		free((*index)->matches);
+	}
+
+	cg_ridx_trie_free(&(*index)->trie);
+	pthread_mutex_destroy(&(*index)->groups_lock);
+	free((*index)->groups);
+	free((*index)->table);
+	free(*index);
+	*index = NULL;
+}
+
+int cgroup_rule_index_build(struct cgroup_rule * const head, struct cgroup_rule_index **index)
+{
+	struct cgroup_rule_index *idx;
+	unsigned int group_count = 0;
+	struct cgroup_rule *rule;
+	unsigned int count = 0;
+	unsigned int pos = 0;
+	unsigned int i;
+	int ret = 0;
+
+	if (!index)
+		return ECGINVAL;
+
+	for (rule = head; rule; rule = rule->next) {
+		count++;
+		if (rule->username[0] == '@')
+			group_count++;
+	}
+
+	idx = calloc(1, sizeof(struct cgroup_rule_index));
+	if (!idx) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+	pthread_mutex_init(&idx->groups_lock, NULL);
+
+	/* Each rule lands in two to four buckets, most of them are shared */
+	idx->table_size = CG_RIDX_MIN_SIZE;
+	while (idx->table_size < count * 2)
+		idx->table_size <<= 1;
+
+	idx->groups_size = CG_RIDX_MIN_SIZE;
+	while (idx->groups_size < group_count)
+		idx->groups_size <<= 1;
+
+	idx->table = calloc(idx->table_size, sizeof(struct cgroup_rule_bucket *));
+	idx->groups = calloc(idx->groups_size, sizeof(struct cg_rule_group *));
+	if (!idx->table || !idx->groups) {
+		last_errno = errno;
+		cgroup_rule_index_free(&idx);
+		return ECGOTHER;
+	}
+
+	/* The lookups are still correct without their cache */
+	idx->matches = calloc(CG_RMC_SETS, sizeof(struct cg_rule_match_set));
+	if (idx->matches) {
+		for (i = 0; i < CG_RMC_SETS; i++)
+			pthread_mutex_init(&idx->matches[i].lock, NULL);
+	}
+
+	for (rule = head; rule; rule = rule->next, pos++) {
+		/* Continuation rules are never matched on their own */
+		if (rule->username[0] == '%')
+			continue;
+
+		ret = cg_ridx_add_rule(idx, rule, pos);
+		if (ret) {
+			cgroup_rule_index_free(&idx);
+			return ret;
+		}
+	}
+
+	cgroup_dbg("Compiled %u rules into the rules index\n", count);
+	*index = idx;
+
+	return 0;
+}
+
+static int cg_ridx_iter_add(struct cgroup_rule_iter * const iter,
+			    const struct cgroup_rule_index * const index, const char * const key)
+{
+	struct cgroup_rule_bucket *bucket;
+
+	bucket = cg_ridx_find(index, key);
+	if (!bucket)
+		return 0;
+
+	if (iter->count >= CG_RULE_ITER_MAX)
+		return ECGFAIL;
+
+	iter->buckets[iter->count] = bucket;
+	iter->next[iter->count] = 0;
+	iter->count++;
+
+	return 0;
+}
+
+/**
+ * Find the lengths of all the rule prefixes of name in the trie.
+ * @return The number of prefixes, -1 if there are too many
+ */
+static int cg_ridx_trie_prefixes(const struct cg_trie_node *node, const char * const name,
+				 int * const prefixes)
+{
+	int cnt = 0;
+	int i;
+
+	for (i = 0; node; i++) {
+		if (node->prefix_end) {
+			if (cnt >= CG_RULE_ITER_MAX)
+				return -1;
+			prefixes[cnt++] = i;
+		}
+
+		if (name[i] == '\0')
+			break;
+
+		for (node = node->child; node; node = node->sibling) {
+			if (node->ch == (unsigned char)name[i])
+				break;
+		}
+	}
+
+	return cnt;
+}
+
+int cgroup_rule_index_lookup(const struct cgroup_rule_index * const index, uid_t uid,
+			     const char * const procname, const char * const base,
+			     struct cgroup_rule_iter * const iter)
+{
+	const char kinds[] = { CG_RIDX_WILD, CG_RIDX_UID, CG_RIDX_GROUP };
+	int base_prefixes[CG_RULE_ITER_MAX];
+	int prefixes[CG_RULE_ITER_MAX];
+	char key[CG_RIDX_KEY_MAX];
+	int base_prefix_cnt = 0;
+	int prefix_cnt = 0;
+	unsigned long id;
+	int ret = 0;
+	int i, j;
+
+	if (!index || !iter)
+		return ECGINVAL;
+
+	memset(iter, 0, sizeof(struct cgroup_rule_iter));
+
+	if (procname) {
+		prefix_cnt = cg_ridx_trie_prefixes(&index->trie, procname, prefixes);
+		if (prefix_cnt < 0)
+			return ECGFAIL;
+	}
+
+	/* The glob rules also match the basename */
+	if (procname && base && strcmp(base, procname) != 0) {
+		base_prefix_cnt = cg_ridx_trie_prefixes(&index->trie, base, base_prefixes);
+		if (base_prefix_cnt < 0)
+			return ECGFAIL;
+	}
+
+	for (i = 0; i < (int)(sizeof(kinds) / sizeof(kinds[0])); i++) {
+		id = (kinds[i] == CG_RIDX_UID) ? uid : 0;
+
+		if (!procname) {
+			cg_ridx_key(key, kinds[i], id, CG_RIDX_ALL, "", 0);
+			ret |= cg_ridx_iter_add(iter, index, key);
+			continue;
+		}
+
+		cg_ridx_key(key, kinds[i], id, CG_RIDX_NOPROC, "", 0);
+		ret |= cg_ridx_iter_add(iter, index, key);
+
+		cg_ridx_key(key, kinds[i], id, CG_RIDX_EXACT, procname, strlen(procname));
+		ret |= cg_ridx_iter_add(iter, index, key);
+
+		if (base && strcmp(base, procname) != 0) {
+			cg_ridx_key(key, kinds[i], id, CG_RIDX_EXACT, base, strlen(base));
+			ret |= cg_ridx_iter_add(iter, index, key);
+		}
+
+		for (j = 0; j < prefix_cnt; j++) {
+			cg_ridx_key(key, kinds[i], id, CG_RIDX_PREFIX, procname, prefixes[j]);
+			ret |= cg_ridx_iter_add(iter, index, key);
+		}
+
+		/* The empty prefix was already added with procname */
+		for (j = 0; j < base_prefix_cnt; j++) {
+			if (base_prefixes[j] == 0)
+				continue;
+			cg_ridx_key(key, kinds[i], id, CG_RIDX_PREFIX, base, base_prefixes[j]);
+			ret |= cg_ridx_iter_add(iter, index, key);
+		}
+	}
+
+	return ret ? ECGFAIL : 0;
+}
+
+struct cgroup_rule *cgroup_rule_iter_next(struct cgroup_rule_iter * const iter)
+{
+	struct cg_rule_ref *ref, *min_ref;
+	int min, i;
+
+	while (1) {
+		min_ref = NULL;
+		min = -1;
+
+		for (i = 0; i < iter->count; i++) {
+			if (iter->next[i] >= iter->buckets[i]->count)
+				continue;
+
+			ref = &iter->buckets[i]->refs[iter->next[i]];
+			if (!min_ref || ref->pos < min_ref->pos) {
+				min_ref = ref;
+				min = i;
+			}
+		}
+
+		if (!min_ref)
+			return NULL;
+
+		iter->next[min]++;
+
+		/* The same rule can be present in more than one bucket */
+		if (iter->started && min_ref->pos == iter->last_pos)
+			continue;
+
+		iter->started = true;
+		iter->last_pos = min_ref->pos;
+
+		return min_ref->rule;
+	}
+}
@@ -0,0 +1,672 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Compiled cache of the cgrules configuration
+ *
+ * Every cgexec, cgclassify and PAM login used to parse cgrules.conf and all
+ * the files of cgrules.d, and to resolve each user and group they name.  The
+ * parsed rules are instead written to a binary file, which the later
+ * processes map read-only and turn back into a list of rules without
+ * parsing anything.
+ *
+ * The cache records the device, inode, size and mtime of each file it was
+ * compiled from: the configuration files, the cgrules.d directory itself so
+ * that an added or removed file is noticed, and the user and group
+ * databases the names were resolved with.  A cache whose files changed is
+ * ignored, and replaced by the next process that parses the rules.
+ *
+ * The file is made of a header, the sources, the rules, the offsets of the
+ * controller names and the strings, all in the native byte order.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CG_RULES_CACHE_MAGIC	"CGRULES"
+/* Bumped whenever the layout of the file changes */
+#define CG_RULES_CACHE_VERSION	1
+
+/* String offset of a rule without procname */
+#define CG_RULES_CACHE_NONE	UINT32_MAX
+
+/* The names of the rules are resolved with these databases */
+static const char * const cg_rules_cache_deps[] = {
+	"/etc/passwd",
+	"/etc/group",
+	"/etc/nsswitch.conf",
+};
+
+struct cg_rules_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t sources_cnt;
+	uint32_t rules_cnt;
+	uint32_t names_cnt;
+	uint32_t strings_len;
+	uint32_t pad;
+	/* Size of the whole file */
+	uint64_t size;
+};
+
+struct cg_rules_cache_source {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime_sec;
+	int64_t mtime_nsec;
+	uint32_t path;
+	/* 0 if the file did not exist */
+	uint32_t exists;
+};
+
+struct cg_rules_cache_rule {
+	uint32_t uid;
+	uint32_t gid;
+	uint32_t is_ignore;
+	uint32_t username;
+	uint32_t procname;
+	uint32_t destination;
+	/* Index of the first controller in the names */
+	uint32_t controllers;
+	uint32_t controllers_cnt;
+};
+
+/* The buffer a cache is serialized into */
+struct cg_rules_cache_buf {
+	char *data;
+	size_t len;
+	size_t alloc;
+};
+
+static int cg_rules_sources_add(struct cg_rules_sources * const sources, const char * const path)
+{
+	struct stat *st;
+	char **paths;
+	int alloc;
+
+	if (sources->count == sources->alloc) {
+		alloc = sources->alloc ? sources->alloc * 2 : 8;
+
+		paths = realloc(sources->paths, alloc * sizeof(char *));
+		if (!paths)
+			goto err;
+		sources->paths = paths;
+
+		st = realloc(sources->st, alloc * sizeof(struct stat));
+		if (!st)
+			goto err;
+		sources->st = st;
+
+		sources->alloc = alloc;
+	}
+
+	sources->paths[sources->count] = strdup(path);
+	if (!sources->paths[sources->count])
+		goto err;
+
+	/* A missing file is recorded as such, creating it invalidates the cache */
+	if (stat(path, &sources->st[sources->count]))
+		memset(&sources->st[sources->count], 0, sizeof(struct stat));
+
+	sources->count++;
+
+	return 0;
+
+err:
+	last_errno = errno;
+	return ECGOTHER;
+}
+
+int cg_rules_sources_collect(const char * const conf_file, const char * const conf_dir,
+			     struct cg_rules_sources * const sources)
+{
+	struct dirent *item;
+	char *path;
+	int ret, i;
+	DIR *d;
+
+	memset(sources, 0, sizeof(struct cg_rules_sources));
+
+	ret = cg_rules_sources_add(sources, conf_file);
+	if (ret)
+		goto err;
+
+	ret = cg_rules_sources_add(sources, conf_dir);
+	if (ret)
+		goto err;
+
+	/* The same files cgroup_parse_rules() reads */
+	d = opendir(conf_dir);
+	if (d) {
+		while ((item = readdir(d))) {
+			if (item->d_type != DT_REG && item->d_type != DT_LNK)
+				continue;
+
+			if (asprintf(&path, "%s/%s", conf_dir, item->d_name) < 0) {
+				last_errno = errno;
+				ret = ECGOTHER;
+				break;
+			}
+
+			ret = cg_rules_sources_add(sources, path);
+			free(path);
+			if (ret)
+				break;
+		}
+		closedir(d);
+		if (ret)
+			goto err;
+	}
+
+	sources->deps = sources->count;
+	for (i = 0; i < ARRAY_SIZE(cg_rules_cache_deps); i++) {
+		ret = cg_rules_sources_add(sources, cg_rules_cache_deps[i]);
+		if (ret)
+			goto err;
+	}
+
+	return 0;
+
+err:
+	cg_rules_sources_free(sources);
+
+	return ret;
+}
+
+void cg_rules_sources_free(struct cg_rules_sources * const sources)
+{
+	int i;
+
+	for (i = 0; i < sources->count; i++)
+		free(sources->paths[i]);
+	free(sources->paths);
+	free(sources->st);
+
+	memset(sources, 0, sizeof(struct cg_rules_sources));
+}
+
+bool cg_rules_name_in_files(const char * const name, bool group)
+{
+	size_t len = strlen(name);
+	size_t alloc = 0;
+	char *line = NULL;
+	bool found = false;
+	FILE *f;
+
+	/* cg_rules_cache_deps[] holds the databases in that order */
+	f = fopen(cg_rules_cache_deps[group ? 1 : 0], "re");
+	if (!f)
+		return false;
+
+	while (getline(&line, &alloc, f) > 0) {
+		if (!strncmp(line, name, len) && line[len] == ':') {
+			found = true;
+			break;
+		}
+	}
+
+	free(line);
+	fclose(f);
+
+	return found;
+}
+
+/**
+ * Append data to the buffer of a cache.
+ * @return The offset of the data, -1 if the allocation failed
+ */
+static ssize_t cg_rules_cache_append(struct cg_rules_cache_buf * const buf, const void * const data,
+				     size_t len)
+{
+	size_t alloc;
+	ssize_t off;
+	char *tmp;
+
+	if (buf->len + len > buf->alloc) {
+		alloc = buf->alloc ? buf->alloc : 4096;
+		while (buf->len + len > alloc)
+			alloc *= 2;
+
+		tmp = realloc(buf->data, alloc);
+		if (!tmp) {
+			last_errno = errno;
+			return -1;
+		}
+		buf->data = tmp;
+		buf->alloc = alloc;
+	}
+
+	off = buf->len;
+	memcpy(buf->data + off, data, len);
+	buf->len += len;
+
+	return off;
+}
+
+/**
+ * Append a string to the string table of a cache.
+ * @return The offset of the string in the table, CG_RULES_CACHE_NONE if the
+ *	allocation failed
+ */
+static uint32_t cg_rules_cache_string(struct cg_rules_cache_buf * const strings,
+				      const char * const str)
+{
+	ssize_t off;
+
+	off = cg_rules_cache_append(strings, str, strlen(str) + 1);
+	if (off < 0 || off >= CG_RULES_CACHE_NONE)
+		return CG_RULES_CACHE_NONE;
+
+	return off;
+}
+
+/**
+ * Serialize the rules and their sources.
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+static int cg_rules_cache_serialize(const struct cgroup_rule_list * const lst,
+				    const struct cg_rules_sources * const sources,
+				    struct cg_rules_cache_buf * const out)
+{
+	struct cg_rules_cache_buf strings = { 0 }, names = { 0 }, rules = { 0 };
+	struct cg_rules_cache_header header;
+	struct cg_rules_cache_source src;
+	struct cg_rules_cache_rule entry;
+	const struct cgroup_rule *rule;
+	int ret = ECGOTHER;
+	uint32_t name;
+	int i;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, CG_RULES_CACHE_MAGIC, sizeof(CG_RULES_CACHE_MAGIC));
+	header.version = CG_RULES_CACHE_VERSION;
+
+	/* The header is written once everything is counted */
+	if (cg_rules_cache_append(out, &header, sizeof(header)) < 0)
+		goto out;
+
+	for (i = 0; i < sources->count; i++) {
+		memset(&src, 0, sizeof(src));
+		src.dev = sources->st[i].st_dev;
+		src.ino = sources->st[i].st_ino;
+		src.size = sources->st[i].st_size;
+		src.mtime_sec = sources->st[i].st_mtim.tv_sec;
+		src.mtime_nsec = sources->st[i].st_mtim.tv_nsec;
+		src.exists = sources->st[i].st_ino != 0;
+		src.path = cg_rules_cache_string(&strings, sources->paths[i]);
+		if (src.path == CG_RULES_CACHE_NONE)
+			goto out;
+
+		if (cg_rules_cache_append(out, &src, sizeof(src)) < 0)
+			goto out;
+		header.sources_cnt++;
+	}
+
+	for (rule = lst->head; rule; rule = rule->next) {
+		memset(&entry, 0, sizeof(entry));
+		entry.uid = rule->uid;
+		entry.gid = rule->gid;
+		entry.is_ignore = rule->is_ignore;
+		entry.username = cg_rules_cache_string(&strings, rule->username);
+		entry.destination = cg_rules_cache_string(&strings, rule->destination);
+		entry.procname = CG_RULES_CACHE_NONE;
+		if (rule->procname) {
+			entry.procname = cg_rules_cache_string(&strings, rule->procname);
+			if (entry.procname == CG_RULES_CACHE_NONE)
+				goto out;
+		}
+		if (entry.username == CG_RULES_CACHE_NONE ||
+		    entry.destination == CG_RULES_CACHE_NONE)
+			goto out;
+
+		entry.controllers = header.names_cnt;
+		for (i = 0; i < MAX_MNT_ELEMENTS && rule->controllers[i]; i++) {
+			name = cg_rules_cache_string(&strings, rule->controllers[i]);
+			if (name == CG_RULES_CACHE_NONE)
+				goto out;
+
+			if (cg_rules_cache_append(&names, &name, sizeof(name)) < 0)
+				goto out;
+			entry.controllers_cnt++;
+			header.names_cnt++;
+		}
+
+		if (cg_rules_cache_append(&rules, &entry, sizeof(entry)) < 0)
+			goto out;
+		header.rules_cnt++;
+	}
+
+	if ((rules.len && cg_rules_cache_append(out, rules.data, rules.len) < 0) ||
+	    (names.len && cg_rules_cache_append(out, names.data, names.len) < 0) ||
+	    (strings.len && cg_rules_cache_append(out, strings.data, strings.len) < 0))
+		goto out;
+
+	header.strings_len = strings.len;
+	header.size = out->len;
+	memcpy(out->data, &header, sizeof(header));
+
+	ret = 0;
+
+out:
+	free(strings.data);
+	free(names.data);
+	free(rules.data);
+
+	return ret;
+}
+
+int cg_rules_cache_store(const char * const path, const struct cgroup_rule_list * const lst,
+			 const struct cg_rules_sources * const sources)
+{
+	struct cg_rules_cache_buf buf = { 0 };
+	char *tmp_path = NULL, *dir = NULL;
+	ssize_t written;
+	char *slash;
+	size_t done;
+	int fd = -1;
+	int ret;
+
+	ret = cg_rules_cache_serialize(lst, sources, &buf);
+	if (ret)
+		goto out;
+
+	ret = ECGOTHER;
+
+	dir = strdup(path);
+	if (!dir)
+		goto err;
+
+	slash = strrchr(dir, '/');
+	if (slash && slash != dir) {
+		*slash = '\0';
+		if (mkdir(dir, 0755) && errno != EEXIST)
+			goto err;
+	}
+
+	if (asprintf(&tmp_path, "%s.XXXXXX", path) < 0) {
+		tmp_path = NULL;
+		goto err;
+	}
+
+	/* Written aside and renamed, the readers see either cache whole */
+	fd = mkostemp(tmp_path, O_CLOEXEC);
+	if (fd < 0)
+		goto err;
+
+	if (fchmod(fd, 0644))
+		goto err;
+
+	for (done = 0; done < buf.len; done += written) {
+		written = write(fd, buf.data + done, buf.len - done);
+		if (written < 0 && errno == EINTR)
+			written = 0;
+		else if (written <= 0)
+			goto err;
+	}
+
+	ret = close(fd);
+	fd = -1;
+	if (ret || rename(tmp_path, path)) {
+		ret = ECGOTHER;
+		goto err;
+	}
+
+	goto out;
+
+err:
+	last_errno = errno;
+	cgroup_dbg("cannot write the rules cache %s: %s\n", path, strerror(errno));
+	if (fd >= 0)
+		close(fd);
+	if (tmp_path && (fd >= 0 || ret))
+		unlink(tmp_path);
+
+out:
+	free(tmp_path);
+	free(buf.data);
+	free(dir);
+
+	return ret;
+}
+
+/**
+ * Check that the files a cache was compiled from did not change.
+ * @return true if the cache is up to date
+ */
+static bool cg_rules_cache_fresh(const struct cg_rules_cache_source * const sources, uint32_t count,
+				 const char * const strings)
+{
+	const struct cg_rules_cache_source *src;
+	struct stat st;
+	uint32_t i;
+
+	for (i = 0; i < count; i++) {
+		src = &sources[i];
+
+		if (stat(strings + src->path, &st)) {
+			if (src->exists)
+				goto changed;
+			continue;
+		}
+
+		if (!src->exists || src->dev != st.st_dev || src->ino != st.st_ino ||
+		    src->size != (uint64_t)st.st_size || src->mtime_sec != st.st_mtim.tv_sec ||
+		    src->mtime_nsec != st.st_mtim.tv_nsec)
+			goto changed;
+	}
+
+	return true;
+
+changed:
+	cgroup_dbg("%s changed, the rules cache is stale\n", strings + src->path);
+	return false;
+}
+
+/**
+ * Turn a rule of a cache back into a struct cgroup_rule.
+ * @return The rule, NULL if an allocation failed
+ */
+static struct cgroup_rule *cg_rules_cache_rule(const struct cg_rules_cache_rule * const entry,
+					       const uint32_t * const names,
+					       const char * const strings)
+{
+	struct cgroup_rule *rule;
+	uint32_t i;
+
+	rule = calloc(1, sizeof(struct cgroup_rule));
+	if (!rule)
+		goto err;
+
+	rule->uid = entry->uid;
+	rule->gid = entry->gid;
+	rule->is_ignore = entry->is_ignore;
+	strcpy(rule->username, strings + entry->username);
+	strcpy(rule->destination, strings + entry->destination);
+
+	if (entry->procname != CG_RULES_CACHE_NONE) {
+		rule->procname = strdup(strings + entry->procname);
+		if (!rule->procname)
+			goto err;
+
+		/* The name was valid when the cache was written */
+		if (cg_procname_compile(&rule->pattern, rule->procname))
+			goto err;
+	}
+
+	for (i = 0; i < entry->controllers_cnt; i++) {
+		rule->controllers[i] = strdup(strings + names[entry->controllers + i]);
+		if (!rule->controllers[i])
+			goto err;
+	}
+
+	return rule;
+
+err:
+	last_errno = errno;
+	if (rule)
+		cgroup_free_rule(rule);
+
+	return NULL;
+}
+
+/**
+ * Check that all the offsets of a cache point inside of it.
+ * @return true if the cache is well formed
+ */
+static bool cg_rules_cache_valid(const struct cg_rules_cache_header * const header, size_t size)
+{
+	const struct cg_rules_cache_source *sources;
+	const struct cg_rules_cache_rule *rules;
+	const uint32_t *names;
+	const char *strings;
+	uint64_t expected;
+	uint32_t i, j;
+
+	if (size < sizeof(*header) || memcmp(header->magic, CG_RULES_CACHE_MAGIC,
+					     sizeof(CG_RULES_CACHE_MAGIC)) ||
+	    header->version != CG_RULES_CACHE_VERSION || header->size != size)
+		return false;
+
+	expected = sizeof(*header) +
+		   (uint64_t)header->sources_cnt * sizeof(struct cg_rules_cache_source) +
+		   (uint64_t)header->rules_cnt * sizeof(struct cg_rules_cache_rule) +
+		   (uint64_t)header->names_cnt * sizeof(uint32_t) + header->strings_len;
+	if (expected != size || !header->strings_len)
+		return false;
+
+	sources = (const struct cg_rules_cache_source *)(header + 1);
+	rules = (const struct cg_rules_cache_rule *)(sources + header->sources_cnt);
+	names = (const uint32_t *)(rules + header->rules_cnt);
+	strings = (const char *)(names + header->names_cnt);
+
+	/* Every string ends before the end of the table */
+	if (strings[header->strings_len - 1] != '\0')
+		return false;
+
+	for (i = 0; i < header->sources_cnt; i++) {
+		if (sources[i].path >= header->strings_len)
+			return false;
+	}
+
+	for (i = 0; i < header->names_cnt; i++) {
+		if (names[i] >= header->strings_len)
+			return false;
+	}
+
+	for (i = 0; i < header->rules_cnt; i++) {
+		if (rules[i].username >= header->strings_len ||
+		    rules[i].destination >= header->strings_len ||
+		    (rules[i].procname != CG_RULES_CACHE_NONE &&
+		     rules[i].procname >= header->strings_len) ||
+		    rules[i].controllers_cnt > MAX_MNT_ELEMENTS ||
+		    (uint64_t)rules[i].controllers + rules[i].controllers_cnt > header->names_cnt)
+			return false;
+
+		if (strlen(strings + rules[i].username) >= LOGIN_NAME_MAX ||
+		    strlen(strings + rules[i].destination) >= FILENAME_MAX)
+			return false;
+
+		for (j = 0; j < rules[i].controllers_cnt; j++) {
+			if (!strings[names[rules[i].controllers + j]])
+				return false;
+		}
+	}
+
+	return true;
+}
+
+int cg_rules_cache_load(const char * const path, struct cgroup_rule_list * const lst)
+{
+	const struct cg_rules_cache_header *header;
+	const struct cg_rules_cache_source *sources;
+	const struct cg_rules_cache_rule *rules;
+	struct cgroup_rule *rule;
+	const uint32_t *names;
+	const char *strings;
+	int ret = ECGOTHER;
+	void *map = NULL;
+	struct stat st;
+	uint32_t i;
+	int fd;
+
+	memset(lst, 0, sizeof(struct cgroup_rule_list));
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return ECGOTHER;
+
+	if (fstat(fd, &st))
+		goto out;
+
+	/* Only trust a cache nobody else could have written */
+	if (!S_ISREG(st.st_mode) || (st.st_uid != 0 && st.st_uid != geteuid()) ||
+	    (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		cgroup_warn("ignoring the rules cache %s, it is not owned by root\n", path);
+		goto out;
+	}
+
+	if (st.st_size < (off_t)sizeof(*header))
+		goto invalid;
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		goto out;
+	}
+
+	header = map;
+	if (!cg_rules_cache_valid(header, st.st_size))
+		goto invalid;
+
+	sources = (const struct cg_rules_cache_source *)(header + 1);
+	rules = (const struct cg_rules_cache_rule *)(sources + header->sources_cnt);
+	names = (const uint32_t *)(rules + header->rules_cnt);
+	strings = (const char *)(names + header->names_cnt);
+
+	if (!cg_rules_cache_fresh(sources, header->sources_cnt, strings))
+		goto out;
+
+	for (i = 0; i < header->rules_cnt; i++) {
+		rule = cg_rules_cache_rule(&rules[i], names, strings);
+		if (!rule) {
+			if (lst->head)
+				cgroup_free_rule_list(lst);
+			goto out;
+		}
+
+		if (!lst->head)
+			lst->head = rule;
+		else
+			lst->tail->next = rule;
+		lst->tail = rule;
+	}
+
+	cgroup_dbg("Loaded %u rules from the cache %s\n", header->rules_cnt, path);
+	ret = 0;
+	goto out;
+
+invalid:
+	cgroup_warn("ignoring the malformed rules cache %s\n", path);
+
+out:
+	if (map)
+		munmap(map, st.st_size);
+	close(fd);
+
+	return ret;
+}
@@ -0,0 +1,330 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Deltas and rates of the counters of stats files
+ *
+ * Monitoring tools sample counters like usage_usec of cpu.stat on many
+ * groups and turn them into rates.  A cgroup_sampler keeps the previous
+ * sample of each group it has read.  The groups are in one array, and their
+ * counters in another one, count values per group, found through a hash of
+ * the path of the group.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#include <sys/stat.h>
+
+/* Initial number of groups and of hash buckets, the buckets are a power of two */
+#define CG_SAMPLER_GROUPS	16
+
+struct cg_sample_group {
+	char *path;
+	unsigned int hash;
+	/* Next group of the hash bucket, -1 at the end */
+	int next;
+	/* A group created again under the same path has another inode */
+	ino_t ino;
+	struct timespec time;
+};
+
+struct cgroup_sampler {
+	char *controller;
+	char *name;
+	struct cgroup_stat_map *map;
+	int count;
+
+	/* The values being read */
+	u_int64_t *current;
+
+	struct cg_sample_group *groups;
+	/* The previous values of group i are at values[i * count] */
+	u_int64_t *values;
+	int groups_cnt;
+	int groups_alloc;
+
+	int *buckets;
+	unsigned int bucket_cnt;
+};
+
+static unsigned int cg_sampler_hash(const char * const path)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, path);
+}
+
+static int cg_sampler_lookup(const struct cgroup_sampler * const sampler,
+			     const char * const path, unsigned int hash)
+{
+	int i;
+
+	if (!sampler->bucket_cnt)
+		return -1;
+
+	for (i = sampler->buckets[hash & (sampler->bucket_cnt - 1)]; i >= 0;
+	     i = sampler->groups[i].next) {
+		if (sampler->groups[i].hash == hash && !strcmp(sampler->groups[i].path, path))
+			return i;
+	}
+
+	return -1;
+}
+
+static void cg_sampler_link(struct cgroup_sampler * const sampler, int index)
+{
+	int *bucket = &sampler->buckets[sampler->groups[index].hash & (sampler->bucket_cnt - 1)];
+
+	sampler->groups[index].next = *bucket;
+	*bucket = index;
+}
+
+static void cg_sampler_unlink(struct cgroup_sampler * const sampler, int index)
+{
+	int *i = &sampler->buckets[sampler->groups[index].hash & (sampler->bucket_cnt - 1)];
+
+	while (*i != index)
+		i = &sampler->groups[*i].next;
+	*i = sampler->groups[index].next;
+}
+
+/**
+ * Make room for one more group.
+ * @return 0 on success, ECGOTHER if an allocation failed
+ */
+static int cg_sampler_reserve(struct cgroup_sampler * const sampler)
+{
+	struct cg_sample_group *groups;
+	unsigned int bucket_cnt;
+	u_int64_t *values;
+	int *buckets;
+	int alloc, i;
+
+	if (sampler->groups_cnt == sampler->groups_alloc) {
+		alloc = sampler->groups_alloc ? sampler->groups_alloc * 2 : CG_SAMPLER_GROUPS;
+
+		groups = realloc(sampler->groups, alloc * sizeof(struct cg_sample_group));
+		if (!groups)
+			goto err;
+		sampler->groups = groups;
+
+		values = realloc(sampler->values, alloc * sampler->count * sizeof(u_int64_t));
+		if (!values)
+			goto err;
+		sampler->values = values;
+
+		sampler->groups_alloc = alloc;
+	}
+
+	/* Keep about one group per bucket */
+	if ((unsigned int)sampler->groups_cnt >= sampler->bucket_cnt) {
+		bucket_cnt = sampler->bucket_cnt ? sampler->bucket_cnt * 2 : CG_SAMPLER_GROUPS;
+
+		buckets = malloc(bucket_cnt * sizeof(int));
+		if (!buckets)
+			goto err;
+
+		free(sampler->buckets);
+		sampler->buckets = buckets;
+		sampler->bucket_cnt = bucket_cnt;
+
+		memset(buckets, -1, bucket_cnt * sizeof(int));
+		for (i = 0; i < sampler->groups_cnt; i++)
+			cg_sampler_link(sampler, i);
+	}
+
+	return 0;
+
+err:
+	last_errno = errno;
+	return ECGOTHER;
+}
+
+void cg_sampler_forget(struct cgroup_sampler * const sampler, const char * const path)
+{
+	int index, last;
+
+	index = cg_sampler_lookup(sampler, path, cg_sampler_hash(path));
+	if (index < 0)
+		return;
+
+	cg_sampler_unlink(sampler, index);
+	free(sampler->groups[index].path);
+
+	/* Move the last group into the hole */
+	last = --sampler->groups_cnt;
+	if (index == last)
+		return;
+
+	cg_sampler_unlink(sampler, last);
+	sampler->groups[index] = sampler->groups[last];
+	memcpy(&sampler->values[index * sampler->count], &sampler->values[last * sampler->count],
+	       sampler->count * sizeof(u_int64_t));
+	cg_sampler_link(sampler, index);
+}
+
+int cg_sampler_update(struct cgroup_sampler * const sampler, const char * const path, ino_t ino,
+		      const u_int64_t * const current, const struct timespec * const now,
+		      u_int64_t * const deltas, double * const rates, double * const interval)
+{
+	struct cg_sample_group *group;
+	unsigned int hash;
+	u_int64_t *values;
+	double elapsed;
+	u_int64_t delta;
+	int index, i;
+	int ret;
+
+	hash = cg_sampler_hash(path);
+	index = cg_sampler_lookup(sampler, path, hash);
+
+	if (index < 0 || sampler->groups[index].ino != ino) {
+		if (index < 0) {
+			ret = cg_sampler_reserve(sampler);
+			if (ret)
+				return ret;
+
+			index = sampler->groups_cnt;
+			group = &sampler->groups[index];
+
+			group->path = strdup(path);
+			if (!group->path) {
+				last_errno = errno;
+				return ECGOTHER;
+			}
+			group->hash = hash;
+			cg_sampler_link(sampler, index);
+			sampler->groups_cnt++;
+		}
+
+		/* A new group, or a group created again: there is no previous sample */
+		group = &sampler->groups[index];
+		group->ino = ino;
+		group->time = *now;
+		memcpy(&sampler->values[index * sampler->count], current,
+		       sampler->count * sizeof(u_int64_t));
+
+		if (deltas)
+			memset(deltas, 0, sampler->count * sizeof(u_int64_t));
+		if (rates)
+			memset(rates, 0, sampler->count * sizeof(double));
+		if (interval)
+			*interval = 0;
+
+		return 0;
+	}
+
+	group = &sampler->groups[index];
+	values = &sampler->values[index * sampler->count];
+
+	elapsed = (now->tv_sec - group->time.tv_sec) +
+		  (now->tv_nsec - group->time.tv_nsec) / 1000000000.0;
+
+	for (i = 0; i < sampler->count; i++) {
+		delta = current[i] >= values[i] ? current[i] - values[i] : current[i];
+
+		if (deltas)
+			deltas[i] = delta;
+		if (rates)
+			rates[i] = elapsed > 0 ? delta / elapsed : 0;
+
+		values[i] = current[i];
+	}
+
+	group->time = *now;
+	if (interval)
+		*interval = elapsed;
+
+	return 0;
+}
+
+struct cgroup_sampler *cgroup_sampler_new(const char *controller, const char *name,
+					  const char * const *keys, int count)
+{
+	struct cgroup_sampler *sampler;
+
+	if (!controller)
+		return NULL;
+
+	sampler = calloc(1, sizeof(struct cgroup_sampler));
+	if (!sampler) {
+		last_errno = errno;
+		return NULL;
+	}
+
+	sampler->map = cgroup_stat_map_new(keys, count);
+	if (!sampler->map)
+		goto err;
+	sampler->count = count;
+
+	sampler->controller = strdup(controller);
+	sampler->name = name ? strdup(name) : NULL;
+	sampler->current = calloc(count, sizeof(u_int64_t));
+	if (!sampler->controller || (name && !sampler->name) || !sampler->current) {
+		last_errno = errno;
+		goto err;
+	}
+
+	return sampler;
+
+err:
+	cgroup_sampler_free(&sampler);
+
+	return NULL;
+}
+
+void cgroup_sampler_free(struct cgroup_sampler **sampler)
+{
+	int i;
+
+	if (!sampler || !*sampler)
+		return;
+
+	for (i = 0; i < (*sampler)->groups_cnt; i++)
+		free((*sampler)->groups[i].path);
+
+	cgroup_stat_map_free(&(*sampler)->map);
+	free((*sampler)->controller);
+	free((*sampler)->name);
+	free((*sampler)->current);
+	free((*sampler)->groups);
+	free((*sampler)->values);
+	free((*sampler)->buckets);
+
+	free(*sampler);
+	*sampler = NULL;
+}
+
+int cgroup_sampler_read(struct cgroup_sampler *sampler, const char *path, u_int64_t *deltas,
+			double *rates, double *interval)
+{
+	char dir_path[FILENAME_MAX];
+	struct timespec now;
+	struct stat st;
+	int ret;
+
+	if (!sampler || !path)
+		return ECGINVAL;
+
+	ret = cgroup_read_stats_map(sampler->controller, path, sampler->name, sampler->map,
+				    sampler->current);
+	if (ret == 0) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		if (!cg_build_path(path, dir_path, sampler->controller))
+			ret = ECGOTHER;
+		else if (stat(dir_path, &st))
+			ret = ECGROUPNOTEXIST;
+	}
+
+	if (ret) {
+		/* The group may have been removed, it starts over if it comes back */
+		cg_sampler_forget(sampler, path);
+		return ret;
+	}
+
+	return cg_sampler_update(sampler, path, st.st_ino, sampler->current, &now, deltas, rates,
+				 interval);
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Lock-free snapshots of read-mostly data
+ *
+ * The cached rules are looked up on every event of cgrulesengd, possibly
+ * from many threads, and replaced only when the configuration is reloaded.
+ * A cg_snapshot publishes them behind a pointer that readers load without
+ * taking any lock.  Reclamation uses two reader counters indexed by the
+ * parity of an epoch: a writer swaps the pointer, moves to the next epoch
+ * and waits for the counter of the previous one to drain.  New readers
+ * count themselves in the other slot, so the wait is bounded by the longest
+ * read section that started before the swap.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <sched.h>
+
+void *cg_snapshot_get(struct cg_snapshot * const snapshot, int * const slot)
+{
+	unsigned long epoch;
+
+	for (;;) {
+		epoch = __atomic_load_n(&snapshot->epoch, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&snapshot->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+
+		if (__atomic_load_n(&snapshot->epoch, __ATOMIC_SEQ_CST) == epoch)
+			break;
+
+		/* A writer moved on meanwhile, it may not wait for this slot */
+		__atomic_sub_fetch(&snapshot->readers[epoch & 1], 1, __ATOMIC_SEQ_CST);
+	}
+
+	*slot = epoch & 1;
+
+	return __atomic_load_n(&snapshot->data, __ATOMIC_SEQ_CST);
+}
+
+void cg_snapshot_put(struct cg_snapshot * const snapshot, int slot)
+{
+	__atomic_sub_fetch(&snapshot->readers[slot], 1, __ATOMIC_RELEASE);
+}
+
+void cg_snapshot_publish(struct cg_snapshot * const snapshot, void *data)
+{
+	unsigned long epoch;
+	void *old;
+
+	pthread_mutex_lock(&snapshot->lock);
+
+	old = __atomic_exchange_n(&snapshot->data, data, __ATOMIC_SEQ_CST);
+	epoch = __atomic_fetch_add(&snapshot->epoch, 1, __ATOMIC_SEQ_CST);
+
+	/* The readers of the previous epoch may still see old */
+	while (__atomic_load_n(&snapshot->readers[epoch & 1], __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	pthread_mutex_unlock(&snapshot->lock);
+
+	if (old && snapshot->release)
+		snapshot->release(old);
+}
@@ -0,0 +1,221 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Integer values of stats files
+ *
+ * Samplers read the same few keys of cpu.stat or memory.stat over and over.
+ * The keys are hashed once into a cgroup_stat_map, then each read looks up
+ * the keys of the file as they are parsed in the read buffer and stores
+ * their values straight into the slots of the caller.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+struct cg_stat_key {
+	char *key;
+	unsigned int hash;
+	int slot;
+};
+
+struct cgroup_stat_map {
+	/* Open addressing, a NULL key is a free entry */
+	struct cg_stat_key *table;
+	unsigned int table_size;
+	int count;
+};
+
+struct cg_stat_read {
+	const struct cgroup_stat_map *map;
+	u_int64_t *values;
+};
+
+/* FNV-1a of key, and of " " subkey if subkey is set */
+static unsigned int cg_stat_hash(const char * const key, const char * const subkey)
+{
+	unsigned int hash;
+
+	hash = cg_fnv1a_str(CG_FNV1A_INIT, key);
+	if (!subkey)
+		return hash;
+
+	hash = cg_fnv1a(hash, " ", 1);
+
+	return cg_fnv1a_str(hash, subkey);
+}
+
+static bool cg_stat_match(const struct cg_stat_key * const entry, const char * const key,
+			  const char * const subkey)
+{
+	size_t len = strlen(key);
+
+	if (strncmp(entry->key, key, len))
+		return false;
+
+	if (!subkey)
+		return entry->key[len] == '\0';
+
+	return entry->key[len] == ' ' && !strcmp(entry->key + len + 1, subkey);
+}
+
+static const struct cg_stat_key *cg_stat_lookup(const struct cgroup_stat_map * const map,
+						const char * const key,
+						const char * const subkey)
+{
+	unsigned int hash, i;
+
+	hash = cg_stat_hash(key, subkey);
+
+	for (i = hash & (map->table_size - 1); map->table[i].key;
+	     i = (i + 1) & (map->table_size - 1)) {
+		if (map->table[i].hash == hash && cg_stat_match(&map->table[i], key, subkey))
+			return &map->table[i];
+	}
+
+	return NULL;
+}
+
+struct cgroup_stat_map *cgroup_stat_map_new(const char * const *keys, int count)
+{
+	struct cgroup_stat_map *map;
+	struct cg_stat_key *entry;
+	unsigned int hash, i;
+	int slot;
+
+	if (!keys || count < 1)
+		return NULL;
+
+	map = calloc(1, sizeof(struct cgroup_stat_map));
+	if (!map)
+		goto err;
+
+	/* Keep the table at most half full */
+	for (map->table_size = 4; map->table_size < (unsigned int)count * 2; map->table_size *= 2)
+		;
+
+	map->table = calloc(map->table_size, sizeof(struct cg_stat_key));
+	if (!map->table)
+		goto err;
+
+	for (slot = 0; slot < count; slot++) {
+		if (!keys[slot] || cg_stat_lookup(map, keys[slot], NULL)) {
+			cgroup_warn("invalid or duplicated stat key %s\n",
+				    keys[slot] ? keys[slot] : "(null)");
+			cgroup_stat_map_free(&map);
+			return NULL;
+		}
+
+		/* "key subkey" hashes like cg_stat_hash(key, subkey) */
+		hash = cg_stat_hash(keys[slot], NULL);
+		i = hash & (map->table_size - 1);
+		while (map->table[i].key)
+			i = (i + 1) & (map->table_size - 1);
+		entry = &map->table[i];
+
+		entry->key = strdup(keys[slot]);
+		if (!entry->key)
+			goto err;
+		entry->hash = hash;
+		entry->slot = slot;
+		map->count++;
+	}
+
+	return map;
+
+err:
+	last_errno = errno;
+	cgroup_stat_map_free(&map);
+
+	return NULL;
+}
+
+void cgroup_stat_map_free(struct cgroup_stat_map **map)
+{
+	unsigned int i;
+
+	if (!map || !*map)
+		return;
+
+	if ((*map)->table) {
+		for (i = 0; i < (*map)->table_size; i++)
+			free((*map)->table[i].key);
+		free((*map)->table);
+	}
+
+	free(*map);
+	*map = NULL;
+}
+
+int cg_stat_parse_u64(const char *str, u_int64_t * const value)
+{
+	u_int64_t val = 0;
+	unsigned int digit;
+
+	if (*str == '\0')
+		return ECGINVAL;
+
+	if (!strcmp(str, "max")) {
+		*value = UINT64_MAX;
+		return 0;
+	}
+
+	for (; *str; str++) {
+		digit = (unsigned char)*str - '0';
+		if (digit > 9)
+			return ECGINVAL;
+		if (val > (UINT64_MAX - digit) / 10)
+			return ECGINVAL;
+		val = val * 10 + digit;
+	}
+
+	*value = val;
+
+	return 0;
+}
+
+static int cg_stat_store(const char *key, const char *subkey, const char *value, void *userdata)
+{
+	struct cg_stat_read *stat_read = userdata;
+	const struct cg_stat_key *entry;
+
+	entry = cg_stat_lookup(stat_read->map, key, subkey);
+	if (!entry)
+		return 0;
+
+	if (cg_stat_parse_u64(value, &stat_read->values[entry->slot])) {
+		cgroup_warn("value %s of stat %s is not an integer\n", value, entry->key);
+		return ECGINVAL;
+	}
+
+	return 0;
+}
+
+int cg_stat_map_read(const char * const path, const struct cgroup_stat_map * const map,
+		     u_int64_t * const values)
+{
+	struct cg_stat_read stat_read;
+
+	memset(values, 0, map->count * sizeof(u_int64_t));
+
+	stat_read.map = map;
+	stat_read.values = values;
+
+	return cg_read_keyed_file(path, cg_stat_store, &stat_read);
+}
+
+int cg_stat_map_parse(char *buf, size_t len, const struct cgroup_stat_map * const map,
+		      u_int64_t * const values)
+{
+	struct cg_stat_read stat_read;
+
+	memset(values, 0, map->count * sizeof(u_int64_t));
+
+	stat_read.map = map;
+	stat_read.values = values;
+
+	return cg_parse_keyed_buf(buf, len, cg_stat_store, &stat_read);
+}
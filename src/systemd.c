@@ -12,8 +12,11 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <libgen.h>
+#include <fcntl.h>
 #include <errno.h>
 
+#include <sys/stat.h>
+
 #define USEC_PER_SEC 1000000
 
 static const char * const modes[] = {
@@ -53,6 +56,10 @@ static const char * const sender = "org.freedesktop.systemd1";
 static const char * const path = "/org/freedesktop/systemd1";
 static const char * const interface = "org.freedesktop.systemd1.Manager";
 
+/* One file per scope holding the pid of its idle process, named after the scope */
+static const char * const idle_pid_run_dir = "/var/run/libcgroup/";
+static const char * const idle_pid_dir = "/var/run/libcgroup/scopes";
+
 int cgroup_set_default_scope_opts(struct cgroup_systemd_scope_opts * const opts)
 {
 	if (!opts)
@@ -107,6 +114,119 @@ static int job_removed_callback(sd_bus_message *message, void *user_data, sd_bus
 	return 0;
 }
 
+/* Time given to systemd to reply to and run the job of an asynchronous scope */
+#define CG_SCOPE_ASYNC_TIMEOUT	(10 * USEC_PER_SEC)
+
+/*
+ * Scope queued by cgroup_create_scope_async(), until the JobRemoved signal of
+ * its job is received
+ */
+struct cg_scope_job {
+	char *scope_name;
+	/* Path of the job, NULL until systemd replied to StartTransientUnit */
+	char *job_path;
+	/* Pending StartTransientUnit call */
+	sd_bus_slot *slot;
+	cgroup_scope_callback callback;
+	void *userdata;
+	pid_t child_pid;
+	/* The idle process was started by libcgroup, kill it on failure */
+	bool kill_child;
+	struct timespec start;
+	bool done;
+	int result;
+	struct cg_scope_job *next;
+};
+
+struct cgroup_systemd_bus {
+	sd_bus *bus;
+	sd_bus_slot *match;
+	struct cg_scope_job *jobs;
+	struct cg_scope_job *tail;
+	int pending;
+};
+
+static void cg_scope_job_free(struct cg_scope_job * const job)
+{
+	sd_bus_slot_unref(job->slot);
+	free(job->scope_name);
+	free(job->job_path);
+	free(job);
+}
+
+static int cg_scope_reply(sd_bus_message *message, void *user_data, sd_bus_error *error)
+{
+	struct cg_scope_job *job = user_data;
+	const sd_bus_error *err;
+	const char *job_path;
+
+	if (sd_bus_message_is_method_error(message, NULL)) {
+		err = sd_bus_message_get_error(message);
+		cgroup_err("failed to create scope %s: %s\n", job->scope_name,
+			   err && err->message ? err->message : "unknown error");
+		goto fail;
+	}
+
+	if (sd_bus_message_read(message, "o", &job_path) < 0) {
+		cgroup_err("failed to read reply: %d\n", errno);
+		goto fail;
+	}
+
+	/* The job may already have been removed, see cg_scope_job_removed() */
+	if (!job->done) {
+		job->job_path = strdup(job_path);
+		if (!job->job_path) {
+			last_errno = errno;
+			goto fail;
+		}
+	}
+	cgroup_dbg("scope %s job_path = %s\n", job->scope_name, job_path);
+
+	return 0;
+
+fail:
+	job->done = true;
+	job->result = ECGFAIL;
+
+	return 0;
+}
+
+static int cg_scope_job_removed(sd_bus_message *message, void *user_data, sd_bus_error *error)
+{
+	const char *result, *msg_path, *scope_name;
+	struct cgroup_systemd_bus *bus = user_data;
+	struct cg_scope_job *job;
+
+	if (sd_bus_message_read(message, "uoss", NULL, &msg_path, &scope_name, &result) < 0) {
+		cgroup_err("callback message read failed: %d\n", errno);
+		return 0;
+	}
+
+	/*
+	 * The reply to StartTransientUnit normally comes first, fall back on
+	 * the name of the unit if it did not yet
+	 */
+	for (job = bus->jobs; job; job = job->next) {
+		if (job->done)
+			continue;
+		if (job->job_path ? strcmp(msg_path, job->job_path) == 0 :
+				    strcmp(scope_name, job->scope_name) == 0)
+			break;
+	}
+
+	if (!job) {
+		cgroup_dbg("Received a systemd signal, but it was not our message\n");
+		return 0;
+	}
+
+	cgroup_dbg("Received JobRemoved signal for scope %s.  Result: %s\n", scope_name, result);
+
+	job->done = true;
+	job->result = strcmp(result, "done") == 0 ? 0 : ECGFAIL;
+
+	return 0;
+}
+
 static int validate_scope_slice_name(const char * const scope_name, const char * const slice_name)
 {
 	char *_scope_name = NULL;
@@ -162,17 +282,99 @@ out:
 	return ret;
 }
 
-int cgroup_create_scope(const char * const scope_name, const char * const slice_name,
-			const struct cgroup_systemd_scope_opts * const opts)
+/**
+ * Record the idle process placed in a scope, for cgroup_get_scope_idle_pid().
+ * The record is a hint, failing to write it is not an error.
+ */
+static void cg_scope_record_idle_pid(const char * const scope_name, pid_t pid)
 {
-	sd_bus_message *msg = NULL, *reply = NULL;
-	int ret = 0, sdret = 0, cgret = ECGFAIL;
-	sd_bus_error error = SD_BUS_ERROR_NULL;
-	const char *job_path = NULL;
-	struct timespec start, now;
-	sd_bus *bus = NULL;
-	pid_t child_pid;
+	char path[FILENAME_MAX];
+	int fd;
+
+	if ((mkdir(idle_pid_run_dir, 0755) && errno != EEXIST) ||
+	    (mkdir(idle_pid_dir, 0755) && errno != EEXIST))
+		goto err;
+
+	snprintf(path, sizeof(path), "%s/%s", idle_pid_dir, scope_name);
+	fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto err;
+
+	dprintf(fd, "%d\n", pid);
+	close(fd);
 
+	return;
+
+err:
+	cgroup_dbg("failed to record the idle process of scope %s: %s\n", scope_name,
+		   strerror(errno));
+}
+
+int cgroup_get_scope_idle_pid(const char *scope_name, pid_t *pid)
+{
+	char path[FILENAME_MAX], buf[FILENAME_MAX], suffix[FILENAME_MAX];
+	bool found = false;
+	size_t len;
+	FILE *fp;
+
+	if (!scope_name || !pid || strchr(scope_name, '/'))
+		return ECGINVAL;
+
+	snprintf(path, sizeof(path), "%s/%s", idle_pid_dir, scope_name);
+	fp = fopen(path, "re");
+	if (!fp)
+		return ECGROUPNOTEXIST;
+
+	if (fscanf(fp, "%d", pid) != 1 || *pid <= 0) {
+		fclose(fp);
+		goto stale;
+	}
+	fclose(fp);
+
+	/* The process may have exited, and its pid been reused since */
+	snprintf(buf, sizeof(buf), "/proc/%d/cmdline", *pid);
+	fp = fopen(buf, "re");
+	if (!fp)
+		goto stale;
+	found = fgets(buf, sizeof(buf), fp) && strcmp(buf, "libcgroup_systemd_idle_thread") == 0;
+	fclose(fp);
+	if (!found)
+		goto stale;
+
+	/* and it must still be in the scope, it may have been moved */
+	snprintf(buf, sizeof(buf), "/proc/%d/cgroup", *pid);
+	fp = fopen(buf, "re");
+	if (!fp)
+		goto stale;
+
+	snprintf(suffix, sizeof(suffix), "/%s\n", scope_name);
+	found = false;
+	while (!found && fgets(buf, sizeof(buf), fp)) {
+		len = strlen(buf);
+		found = len >= strlen(suffix) && strcmp(&buf[len - strlen(suffix)], suffix) == 0;
+	}
+	fclose(fp);
+	if (found)
+		return 0;
+
+stale:
+	unlink(path);
+
+	return ECGROUPNOTEXIST;
+}
+
+/**
+ * Validate the arguments of a scope creation, and start the idle process to
+ * be placed in the scope if the caller did not give a pid.
+ * @param add_ref The scope is kept alive by a reference of the connection
+ * @param child_pid Set to the pid to be placed in the scope, 0 for an empty
+ *	scope kept alive by a reference of the connection
+ * @return 0 on success, or an error number
+ */
+static int cg_scope_prepare(const char * const scope_name, const char * const slice_name,
+			    const struct cgroup_systemd_scope_opts * const opts, bool add_ref,
+			    pid_t * const child_pid)
+{
 	if (!scope_name || !slice_name || !opts)
 		return ECGINVAL;
 
@@ -191,15 +393,22 @@ int cgroup_create_scope(const char * const scope_name, const char * const slice_
 		return ECGINVAL;
 	}
 
+	if (opts->pid < 0 && add_ref) {
+		/* The reference of the connection keeps the scope alive */
+		*child_pid = 0;
+		cgroup_dbg("no pid will be placed in scope %s\n", scope_name);
+		return 0;
+	}
+
 	if (opts->pid < 0) {
-		child_pid = fork();
-		if (child_pid < 0) {
+		*child_pid = fork();
+		if (*child_pid < 0) {
 			last_errno = errno;
 			cgroup_err("fork failed: %d\n", errno);
 			return ECGOTHER;
 		}
 
-		if (child_pid == 0) {
+		if (*child_pid == 0) {
 			static char * const args[] = {"libcgroup_systemd_idle_thread", NULL};
 
 			/*
@@ -214,83 +423,129 @@ int cgroup_create_scope(const char * const scope_name, const char * const slice_
 			return ECGOTHER;
 		}
 
-		cgroup_dbg("created libcgroup_system_idle thread pid %d\n", child_pid);
+		cgroup_dbg("created libcgroup_system_idle thread pid %d\n", *child_pid);
 	} else {
-		child_pid = opts->pid;
+		*child_pid = opts->pid;
 	}
-	cgroup_dbg("pid %d will be placed in scope %s\n", child_pid, scope_name);
+	cgroup_dbg("pid %d will be placed in scope %s\n", *child_pid, scope_name);
 
-	sdret = sd_bus_default_system(&bus);
-	if (sdret < 0) {
-		cgroup_err("failed to open the system bus: %d\n", errno);
-		goto out;
-	}
+	return 0;
+}
 
-	sdret = sd_bus_match_signal(bus, NULL, sender, path, interface,
-				    "JobRemoved", job_removed_callback, &job_path);
-	if (sdret < 0) {
-		cgroup_err("failed to install match callback: %d\n", errno);
-		goto out;
-	}
+/**
+ * Build the StartTransientUnit call of a scope.
+ * @return 0 on success, a negative errno from sd-bus on error
+ */
+static int cg_scope_message_new(sd_bus * const bus, const char * const scope_name,
+				const char * const slice_name,
+				const struct cgroup_systemd_scope_opts * const opts, bool add_ref,
+				pid_t child_pid, sd_bus_message ** const msg)
+{
+	int sdret;
 
-	sdret = sd_bus_message_new_method_call(bus, &msg, sender, path, interface,
+	sdret = sd_bus_message_new_method_call(bus, msg, sender, path, interface,
 					       "StartTransientUnit");
 	if (sdret < 0) {
 		cgroup_err("failed to create the systemd msg: %d\n", errno);
-		goto out;
+		return sdret;
 	}
 
-	sdret = sd_bus_message_append(msg, "ss", scope_name, modes[opts->mode]);
+	sdret = sd_bus_message_append(*msg, "ss", scope_name, modes[opts->mode]);
 	if (sdret < 0) {
 		cgroup_err("failed to append the scope name: %d\n", errno);
-		goto out;
+		return sdret;
 	}
 
-	sdret = sd_bus_message_open_container(msg, 'a', "(sv)");
+	sdret = sd_bus_message_open_container(*msg, 'a', "(sv)");
 	if (sdret < 0) {
 		cgroup_err("failed to open container: %d\n", errno);
-		goto out;
+		return sdret;
 	}
 
-	sdret = sd_bus_message_append(msg, "(sv)", "Description", "s",
+	sdret = sd_bus_message_append(*msg, "(sv)", "Description", "s",
 				      "scope created by libcgroup");
 	if (sdret < 0) {
 		cgroup_err("failed to append the description: %d\n", errno);
-		goto out;
+		return sdret;
 	}
 
-	sdret = sd_bus_message_append(msg, "(sv)", "PIDs", "au", 1, child_pid);
-	if (sdret < 0) {
-		cgroup_err("failed to append the PID: %d\n", errno);
-		goto out;
+	if (child_pid > 0) {
+		sdret = sd_bus_message_append(*msg, "(sv)", "PIDs", "au", 1, child_pid);
+		if (sdret < 0) {
+			cgroup_err("failed to append the PID: %d\n", errno);
+			return sdret;
+		}
+	}
+
+	if (add_ref) {
+		sdret = sd_bus_message_append(*msg, "(sv)", "AddRef", "b", 1);
+		if (sdret < 0) {
+			cgroup_err("failed to append the reference: %d\n", errno);
+			return sdret;
+		}
 	}
 
-	sdret = sd_bus_message_append(msg, "(sv)", "Slice", "s", slice_name);
+	sdret = sd_bus_message_append(*msg, "(sv)", "Slice", "s", slice_name);
 	if (sdret < 0) {
 		cgroup_err("failed to append the slice: %d\n", errno);
-		goto out;
+		return sdret;
 	}
 
 	if (opts->delegated == 1) {
-		sdret = sd_bus_message_append(msg, "(sv)", "Delegate", "b", 1);
+		sdret = sd_bus_message_append(*msg, "(sv)", "Delegate", "b", 1);
 		if (sdret < 0) {
 			cgroup_err("failed to append delegate: %d\n", errno);
-			goto out;
+			return sdret;
 		}
 	}
 
-	sdret = sd_bus_message_close_container(msg);
+	sdret = sd_bus_message_close_container(*msg);
 	if (sdret < 0) {
 		cgroup_err("failed to close the container: %d\n", errno);
-		goto out;
+		return sdret;
 	}
 
-	sdret = sd_bus_message_append(msg, "a(sa(sv))", 0);
+	sdret = sd_bus_message_append(*msg, "a(sa(sv))", 0);
 	if (sdret < 0) {
 		cgroup_err("failed to append aux structure: %d\n", errno);
+		return sdret;
+	}
+
+	return 0;
+}
+
+int cgroup_create_scope(const char * const scope_name, const char * const slice_name,
+			const struct cgroup_systemd_scope_opts * const opts)
+{
+	sd_bus_message *msg = NULL, *reply = NULL;
+	int ret = 0, sdret = 0, cgret = ECGFAIL;
+	sd_bus_error error = SD_BUS_ERROR_NULL;
+	const char *job_path = NULL;
+	struct timespec start, now;
+	sd_bus *bus = NULL;
+	pid_t child_pid;
+
+	ret = cg_scope_prepare(scope_name, slice_name, opts, false, &child_pid);
+	if (ret)
+		return ret;
+
+	sdret = sd_bus_default_system(&bus);
+	if (sdret < 0) {
+		cgroup_err("failed to open the system bus: %d\n", errno);
 		goto out;
 	}
 
+	sdret = sd_bus_match_signal(bus, NULL, sender, path, interface,
+				    "JobRemoved", job_removed_callback, &job_path);
+	if (sdret < 0) {
+		cgroup_err("failed to install match callback: %d\n", errno);
+		goto out;
+	}
+
+	sdret = cg_scope_message_new(bus, scope_name, slice_name, opts, false, child_pid, &msg);
+	if (sdret < 0)
+		goto out;
+
 	sdret = sd_bus_call(bus, msg, 0, &error, &reply);
 	if (sdret < 0) {
 		cgroup_err("sd_bus_call() failed: %d\n",
@@ -352,6 +607,9 @@ int cgroup_create_scope(const char * const scope_name, const char * const slice_
 
 	cgret = 0;
 
+	if (opts->pid < 0)
+		cg_scope_record_idle_pid(scope_name, child_pid);
+
 out:
 	if (cgret && opts->pid < 0)
 		kill(child_pid, SIGTERM);
@@ -364,6 +622,261 @@ out:
 	return cgret;
 }
 
+struct cgroup_systemd_bus *cgroup_systemd_bus_open(void)
+{
+	struct cgroup_systemd_bus *bus;
+	int sdret;
+
+	bus = calloc(1, sizeof(struct cgroup_systemd_bus));
+	if (!bus) {
+		last_errno = errno;
+		return NULL;
+	}
+
+	/* A connection of our own, the default one is shared by the thread */
+	sdret = sd_bus_open_system(&bus->bus);
+	if (sdret < 0) {
+		cgroup_err("failed to open the system bus: %d\n", -sdret);
+		goto err;
+	}
+
+	sdret = sd_bus_match_signal(bus->bus, &bus->match, sender, path, interface,
+				    "JobRemoved", cg_scope_job_removed, bus);
+	if (sdret < 0) {
+		cgroup_err("failed to install match callback: %d\n", -sdret);
+		goto err;
+	}
+
+	return bus;
+
+err:
+	last_errno = -sdret;
+	cgroup_systemd_bus_close(&bus);
+
+	return NULL;
+}
+
+void cgroup_systemd_bus_close(struct cgroup_systemd_bus **bus)
+{
+	struct cg_scope_job *job, *next;
+
+	if (!bus || !*bus)
+		return;
+
+	/* The pending scopes are abandoned, their callbacks are not called */
+	for (job = (*bus)->jobs; job; job = next) {
+		next = job->next;
+		cg_scope_job_free(job);
+	}
+
+	sd_bus_slot_unref((*bus)->match);
+	sd_bus_flush_close_unref((*bus)->bus);
+
+	free(*bus);
+	*bus = NULL;
+}
+
+int cgroup_systemd_bus_get_fd(const struct cgroup_systemd_bus *bus)
+{
+	if (!bus)
+		return -1;
+
+	return sd_bus_get_fd(bus->bus);
+}
+
+int cgroup_systemd_bus_pending(const struct cgroup_systemd_bus *bus)
+{
+	if (!bus)
+		return -1;
+
+	return bus->pending;
+}
+
+int cgroup_create_scope_async(struct cgroup_systemd_bus *bus, const char *scope_name,
+			      const char *slice_name,
+			      const struct cgroup_systemd_scope_opts *opts, int flags,
+			      cgroup_scope_callback callback, void *userdata)
+{
+	bool add_ref = flags & CGROUP_SCOPE_ADD_REF;
+	struct cg_scope_job *job = NULL;
+	sd_bus_message *msg = NULL;
+	pid_t child_pid;
+	int ret, sdret;
+
+	if (!bus || (flags & ~CGROUP_SCOPE_ADD_REF))
+		return ECGINVAL;
+
+	ret = cg_scope_prepare(scope_name, slice_name, opts, add_ref, &child_pid);
+	if (ret)
+		return ret;
+
+	job = calloc(1, sizeof(struct cg_scope_job));
+	if (!job) {
+		last_errno = errno;
+		ret = ECGOTHER;
+		goto err;
+	}
+
+	job->scope_name = strdup(scope_name);
+	if (!job->scope_name) {
+		last_errno = errno;
+		ret = ECGOTHER;
+		goto err;
+	}
+
+	job->callback = callback;
+	job->userdata = userdata;
+	job->child_pid = child_pid;
+	job->kill_child = opts->pid < 0 && !add_ref;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &job->start) < 0) {
+		last_errno = errno;
+		cgroup_err("Failed to get time: %d\n", errno);
+		ret = ECGOTHER;
+		goto err;
+	}
+
+	ret = ECGFAIL;
+	sdret = cg_scope_message_new(bus->bus, scope_name, slice_name, opts, add_ref, child_pid,
+				     &msg);
+	if (sdret < 0)
+		goto err;
+
+	/* The call is only queued, it is sent by cgroup_systemd_bus_dispatch() */
+	sdret = sd_bus_call_async(bus->bus, &job->slot, msg, cg_scope_reply, job,
+				  CG_SCOPE_ASYNC_TIMEOUT);
+	if (sdret < 0) {
+		cgroup_err("sd_bus_call_async() failed: %d\n", -sdret);
+		goto err;
+	}
+	sd_bus_message_unref(msg);
+
+	/* The jobs are kept in the order they were queued, the oldest first */
+	if (bus->tail)
+		bus->tail->next = job;
+	else
+		bus->jobs = job;
+	bus->tail = job;
+	bus->pending++;
+
+	return 0;
+
+err:
+	sd_bus_message_unref(msg);
+	if (opts->pid < 0 && !add_ref)
+		kill(child_pid, SIGTERM);
+	if (job)
+		cg_scope_job_free(job);
+
+	return ret;
+}
+
+/**
+ * Process all the pending messages of the bus.
+ * @return The number of messages processed, a negative errno on error
+ */
+static int cg_systemd_bus_process(struct cgroup_systemd_bus * const bus)
+{
+	int sdret, count = 0;
+
+	for (;;) {
+		sdret = sd_bus_process(bus->bus, NULL);
+		if (sdret <= 0)
+			return sdret < 0 ? sdret : count;
+		count++;
+	}
+}
+
+/**
+ * Report the scopes whose job completed, failed or timed out.  This is done
+ * outside of the sd-bus callbacks, so that the callbacks of the caller can
+ * queue more scopes.
+ */
+static int cg_scope_jobs_reap(struct cgroup_systemd_bus * const bus)
+{
+	struct cg_scope_job *job, *prev = NULL, *next;
+	struct timespec now;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &now) < 0) {
+		last_errno = errno;
+		cgroup_err("Failed to get time: %d\n", errno);
+		return ECGOTHER;
+	}
+
+	for (job = bus->jobs; job; job = next) {
+		next = job->next;
+
+		if (!job->done && elapsed_time(&job->start, &now) > CG_SCOPE_ASYNC_TIMEOUT) {
+			cgroup_err("The create scope command of %s timed out\n", job->scope_name);
+			job->done = true;
+			job->result = ECGFAIL;
+		}
+
+		if (!job->done) {
+			prev = job;
+			continue;
+		}
+
+		if (prev)
+			prev->next = next;
+		else
+			bus->jobs = next;
+		if (bus->tail == job)
+			bus->tail = prev;
+		bus->pending--;
+
+		if (job->kill_child) {
+			if (job->result)
+				kill(job->child_pid, SIGTERM);
+			else
+				cg_scope_record_idle_pid(job->scope_name, job->child_pid);
+		}
+
+		if (job->callback)
+			job->callback(bus, job->scope_name, job->result, job->userdata);
+		cg_scope_job_free(job);
+	}
+
+	return 0;
+}
+
+int cgroup_systemd_bus_dispatch(struct cgroup_systemd_bus *bus, int timeout)
+{
+	struct timespec now;
+	uint64_t usec;
+	int64_t left;
+	int sdret;
+
+	if (!bus)
+		return ECGINVAL;
+
+	sdret = cg_systemd_bus_process(bus);
+	if (sdret == 0 && timeout != 0) {
+		usec = timeout < 0 ? UINT64_MAX : (uint64_t)timeout * 1000;
+
+		/* Do not sleep past the timeout of the oldest job */
+		if (bus->jobs && clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+			left = CG_SCOPE_ASYNC_TIMEOUT - elapsed_time(&bus->jobs->start, &now);
+			if (left < 0)
+				left = 0;
+			if ((uint64_t)left < usec)
+				usec = left;
+		}
+
+		sdret = sd_bus_wait(bus->bus, usec);
+		if (sdret >= 0)
+			sdret = cg_systemd_bus_process(bus);
+	}
+
+	if (sdret < 0) {
+		last_errno = -sdret;
+		cgroup_err("failed to process the sd bus: %d\n", last_errno);
+		return ECGOTHER;
+	}
+
+	return cg_scope_jobs_reap(bus);
+}
+
 int cgroup_create_scope2(struct cgroup *cgroup, int ignore_ownership,
 			 const struct cgroup_systemd_scope_opts * const opts)
 {
@@ -56,6 +56,8 @@ static void usage(int status, const char *program_name)
 	info("  -h, --help			Display this help\n");
 	info("  -g <controllers>:<path>	Control group to be used as target\n");
 	info("  --cancel-sticky		cgred daemon change pidlist and children tasks\n");
+	info("  --stdin			Also read the pids from the standard input, ");
+	info("one or more per line\n");
 	info("  --sticky			cgred daemon does not change ");
 	info("pidlist and children tasks\n");
 #ifdef WITH_SYSTEMD
@@ -89,9 +91,11 @@ static int change_group_path(pid_t pid, struct cgroup_group_spec *cgroup_list[])
 }
 
 /*
- * Change process group as specified in cgrules.conf.
+ * Change process group as specified in cgrules.conf.  With CGFLAG_USECACHE,
+ * the rules cached by cgroup_init_rules_cache() are used instead of parsing
+ * cgrules.conf again.
  */
-static int change_group_based_on_rule(pid_t pid)
+static int change_group_based_on_rule(pid_t pid, int flags)
 {
 	char *procname = NULL;
 	int ret = -1;
@@ -99,19 +103,14 @@ static int change_group_based_on_rule(pid_t pid)
 	gid_t egid;
 
 	/* Put pid into right cgroup as per rules in /etc/cgrules.conf */
-	if (cgroup_get_uid_gid_from_procfs(pid, &euid, &egid)) {
-		err("Error in determining euid/egid of pid %d\n", pid);
-		goto out;
-	}
-
-	ret = cgroup_get_procname_from_procfs(pid, &procname);
+	ret = cgroup_get_proc_info_from_procfs(pid, &euid, &egid, &procname);
 	if (ret) {
-		err("Error in determining process name of pid %d\n", pid);
+		err("Error in determining euid/egid or process name of pid %d\n", pid);
 		goto out;
 	}
 
 	/* Change the cgroup by determining the rules */
-	ret = cgroup_change_cgroup_flags(euid, egid, procname, pid, 0);
+	ret = cgroup_change_cgroup_flags(euid, egid, procname, pid, flags);
 	if (ret) {
 		err("Error: change of cgroup failed for pid %d: %s\n", pid, cgroup_strerror(ret));
 		goto out;
@@ -125,9 +124,97 @@ out:
 	return ret;
 }
 
+/*
+ * Classify the pids read from the standard input, separated by spaces or
+ * newlines, e.g. the output of pgrep.  All the pids are read first, so the
+ * sticky ones are registered to the daemon at once.  Returns the exit code,
+ * like for the pids of the command line.
+ */
+static int classify_stdin(struct cgroup_group_spec *cgroup_list[], int cg_specified, int flag,
+			  int rule_flags)
+{
+	char *line = NULL, *saveptr, *tok, *endptr;
+	size_t len = 0, size = 0, cnt = 0, i;
+	int ret = 0, exit_code = 0;
+	pid_t *pids = NULL, *tmp;
+	pid_t pid;
+
+	while (getline(&line, &len, stdin) != -1) {
+		for (tok = strtok_r(line, " \t\n", &saveptr); tok;
+		     tok = strtok_r(NULL, " \t\n", &saveptr)) {
+			pid = (pid_t) strtol(tok, &endptr, 10);
+			if (endptr[0] != '\0') {
+				err("Error: %s is not valid pid.\n", tok);
+				exit_code = 2;
+				continue;
+			}
+
+			if (cnt == size) {
+				size = size ? size * 2 : 64;
+				tmp = realloc(pids, size * sizeof(pid_t));
+				if (!tmp) {
+					err("Error: out of memory\n");
+					exit_code = 1;
+					goto out;
+				}
+				pids = tmp;
+			}
+			pids[cnt++] = pid;
+		}
+	}
+
+	if (flag && cgroup_register_unchanged_processes(pids, cnt, flag))
+		exit_code = 1;
+
+	for (i = 0; i < cnt; i++) {
+		if (cg_specified)
+			ret = change_group_path(pids[i], cgroup_list);
+		else
+			ret = change_group_based_on_rule(pids[i], rule_flags);
+		if (ret)
+			exit_code = 1;
+	}
+
+out:
+	free(pids);
+	free(line);
+
+	return exit_code;
+}
+
+/*
+ * Register the pids of the command line to the daemon, skipping the invalid
+ * ones.  Returns 0 on success.
+ */
+static int register_sticky_pids(int argc, char *argv[], int flag)
+{
+	char *endptr;
+	pid_t *pids;
+	int cnt = 0;
+	int ret, i;
+
+	pids = malloc(sizeof(pid_t) * (argc ? argc : 1));
+	if (!pids) {
+		err("Error: out of memory\n");
+		return 1;
+	}
+
+	for (i = 0; i < argc; i++) {
+		pids[cnt] = (pid_t) strtol(argv[i], &endptr, 10);
+		if (endptr[0] == '\0')
+			cnt++;
+	}
+
+	ret = cgroup_register_unchanged_processes(pids, cnt, flag);
+	free(pids);
+
+	return ret;
+}
+
 static struct option longopts[] = {
 	{"sticky",		no_argument, NULL, 's'},
 	{"cancel-sticky",	no_argument, NULL, 'u'},
+	{"stdin",		no_argument, NULL, 'i'},
 	{"help",		no_argument, NULL, 'h'},
 	{0, 0, 0, 0}
 };
@@ -141,6 +228,8 @@ int main(int argc, char *argv[])
 	pid_t scope_pid = -1;
 	int replace_idle = 0;
 	int cg_specified = 0;
+	int read_stdin = 0;
+	int rule_flags = 0;
 	int flag = 0;
 	char *endptr;
 	pid_t pid;
@@ -183,6 +272,9 @@ int main(int argc, char *argv[])
 		case 'u':
 			flag |= CGROUP_DAEMON_CANCEL_UNCHANGE_PROCESS;
 			break;
+		case 'i':
+			read_stdin = 1;
+			break;
 		default:
 			usage(1, argv[0]);
 			exit(EXIT_BADARGS);
@@ -190,6 +282,11 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (read_stdin && replace_idle) {
+		err("%s: --stdin cannot be used with -r\n", argv[0]);
+		exit(EXIT_BADARGS);
+	}
+
 	/* Initialize libcg */
 	ret = cgroup_init();
 	if (ret) {
@@ -201,6 +298,20 @@ int main(int argc, char *argv[])
 	if (!ignore_default_systemd_delegate_slice)
 		cgroup_set_default_systemd_cgroup();
 
+	/* Parse the rules once for all the pids, instead of once per pid */
+	if (read_stdin && !cg_specified) {
+		ret = cgroup_init_rules_cache();
+		if (ret) {
+			err("%s: failed to parse the rules: %s\n", argv[0], cgroup_strerror(ret));
+			return ret;
+		}
+		rule_flags = CGFLAG_USECACHE;
+	}
+
+	/* Register the sticky pids to the daemon at once */
+	if (flag && register_sticky_pids(argc - optind, &argv[optind], flag))
+		exit_code = 1;
+
 	for (i = optind; i < argc; i++) {
 		pid = (pid_t) strtol(argv[i], &endptr, 10);
 		if (endptr[0] != '\0') {
@@ -210,11 +321,6 @@ int main(int argc, char *argv[])
 			continue;
 		}
 
-		if (flag)
-			ret = cgroup_register_unchanged_process(pid, flag);
-		if (ret)
-			exit_code = 1;
-
 		if (replace_idle && !skip_replace_idle) {
 			ret = find_scope_pid(pid, 1);
 			if (ret) {
@@ -226,7 +332,7 @@ int main(int argc, char *argv[])
 		if (cg_specified)
 			ret = change_group_path(pid, cgroup_list);
 		else
-			ret = change_group_based_on_rule(pid);
+			ret = change_group_based_on_rule(pid, rule_flags);
 
 		/* if any group change fails */
 		if (ret)
@@ -253,6 +359,12 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if (read_stdin) {
+		ret = classify_stdin(cgroup_list, cg_specified, flag, rule_flags);
+		if (ret)
+			exit_code = ret;
+	}
+
 	return exit_code;
 
 err:
@@ -300,6 +412,7 @@ static pid_t find_scope_pid(pid_t pid, int capture)
 	char buffer[FILENAME_MAX];
 	FILE *pid_proc_fp = NULL;
 	char *_ctrl_name = NULL;
+	const char *scope;
 	int idx, ret, size = 0;
 	pid_t *pids;
 	int i = 0;
@@ -384,6 +497,11 @@ static pid_t find_scope_pid(pid_t pid, int capture)
 			continue;
 
 
+		/* libcgroup records the idle_thread of the scopes it creates */
+		scope = strrchr(cgroup_name, '/');
+		if (!cgroup_get_scope_idle_pid(scope ? scope + 1 : cgroup_name, &_scope_pid))
+			goto found_idle_thread;
+
 		if (ret == 2)
 			ret = cgroup_get_procs(cgroup_name, NULL, &pids, &size);
 		else
@@ -401,6 +519,7 @@ static pid_t find_scope_pid(pid_t pid, int capture)
 		_scope_pid = search_systemd_idle_thread_task(pids, size);
 		free(pids);
 
+found_idle_thread:
 		if (_scope_pid == -1)
 			continue;
 
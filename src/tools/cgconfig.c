@@ -37,7 +37,7 @@ static void usage(int status, char *progname)
 	}
 
 	info("Usage: %s [-h] [-f mode] [-d mode] [-s mode] ", progname);
-	info("[-t <tuid>:<tgid>] [-a <agid>:<auid>] [-l FILE] [-L DIR] ...\n");
+	info("[-t <tuid>:<tgid>] [-a <agid>:<auid>] [-j N] [-r] [-l FILE] [-L DIR] ...\n");
 	info("Parse and load the specified cgroups configuration file\n");
 	info("  -a <tuid>:<tgid>		Default owner of groups ");
 	info("files and directories\n");
@@ -49,6 +49,11 @@ static void usage(int status, char *progname)
 	info("configuration files from a directory\n");
 	info("  -s, --tperm=mode		Default tasks file permissions\n");
 	info("  -t <tuid>:<tgid>		Default owner of the tasks file\n");
+	info("  -j, --jobs=N			Create the groups with N threads\n");
+	info("      --io-uring			Write the values of the groups ");
+	info("with io_uring\n");
+	info("  -r, --reload			Only apply the changes to the ");
+	info("existing groups\n");
 }
 
 int main(int argc, char *argv[])
@@ -62,6 +67,9 @@ int main(int argc, char *argv[])
 		{"dperm",		required_argument, NULL, 'd'},
 		{"fperm",		required_argument, NULL, 'f' },
 		{"tperm",		required_argument, NULL, 's' },
+		{"jobs",		required_argument, NULL, 'j' },
+		{"io-uring",		no_argument,	   NULL, 'u' },
+		{"reload",		no_argument,	   NULL, 'r' },
 		{0, 0, 0, 0}
 	};
 
@@ -74,6 +82,8 @@ int main(int argc, char *argv[])
 	struct cgroup *default_group = NULL;
 	int filem_change = 0;
 	int dirm_change = 0;
+	int reload = 0;
+	int jobs;
 	int ret, error = 0;
 	int c, i;
 
@@ -93,7 +103,7 @@ int main(int argc, char *argv[])
 	if (error)
 		goto err;
 
-	while ((c = getopt_long(argc, argv, "hl:L:t:a:d:f:s:", options, NULL)) > 0) {
+	while ((c = getopt_long(argc, argv, "hl:L:t:a:d:f:s:j:r", options, NULL)) > 0) {
 		switch (c) {
 		case 'h':
 			usage(0, argv[0]);
@@ -139,6 +149,25 @@ int main(int argc, char *argv[])
 			if (error)
 				goto err;
 			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (cgroup_config_set_jobs(jobs)) {
+				err("%s: Invalid number of jobs %s\n", argv[0], optarg);
+				error = EXIT_BADARGS;
+				goto err;
+			}
+			break;
+		case 'u':
+			error = cgroup_config_set_io_uring(1);
+			if (error) {
+				err("%s: %s\n", argv[0], cgroup_strerror(error));
+				error = EXIT_BADARGS;
+				goto err;
+			}
+			break;
+		case 'r':
+			reload = 1;
+			break;
 		default:
 			usage(1, argv[0]);
 			error = EXIT_BADARGS;
@@ -177,7 +206,10 @@ int main(int argc, char *argv[])
 	}
 
 	for (i = 0; i < cfg_files.count; i++) {
-		ret = cgroup_config_load_config(cfg_files.items[i]);
+		if (reload)
+			ret = cgroup_config_reload_config(cfg_files.items[i]);
+		else
+			ret = cgroup_config_load_config(cfg_files.items[i]);
 		if (ret) {
 			err("%s; error loading %s: %s\n", argv[0], cfg_files.items[i],
 			    cgroup_strerror(ret));
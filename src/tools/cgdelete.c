@@ -19,6 +19,7 @@
 
 static const struct option  long_options[] = {
 	{"recursive",	      no_argument, NULL, 'r'},
+	{"kill",	      no_argument, NULL, 'k'},
 	{"help",	      no_argument, NULL, 'h'},
 	{"group",	required_argument, NULL, 'g'},
 	{NULL, 0, NULL, 0}
@@ -39,10 +40,11 @@ static void usage(int status, const char *program_name)
 		return;
 	}
 
-	info("Usage: %s [-h] [-r] [[-g] <controllers>:<path>] ...\n", program_name);
+	info("Usage: %s [-h] [-r] [-k] [[-g] <controllers>:<path>] ...\n", program_name);
 	info("Remove control group(s)\n");
 	info("  -g <controllers>:<path>	Control group to be removed (-g is optional)\n");
 	info("  -h, --help			Display this help\n");
+	info("  -k, --kill			Kill the processes instead of moving them\n");
 	info("  -r, --recursive		Recursively remove all subgroups\n");
 #ifdef WITH_SYSTEMD
 	info("  -b				Ignore default systemd delegate hierarchy\n");
@@ -155,18 +157,21 @@ int main(int argc, char *argv[])
 
 	/* Parse arguments */
 #ifdef WITH_SYSTEMD
-	while ((c = getopt_long(argc, argv, "rhg:b", long_options, NULL)) > 0) {
+	while ((c = getopt_long(argc, argv, "rkhg:b", long_options, NULL)) > 0) {
 		switch (c) {
 		case 'b':
 			ignore_default_systemd_delegate_slice = 1;
 			break;
 #else
-	while ((c = getopt_long(argc, argv, "rhg:", long_options, NULL)) > 0) {
+	while ((c = getopt_long(argc, argv, "rkhg:", long_options, NULL)) > 0) {
 		switch (c) {
 #endif
 		case 'r':
 			flags |= CGFLAG_DELETE_RECURSIVE;
 			break;
+		case 'k':
+			flags |= CGFLAG_DELETE_KILL;
+			break;
 		case 'g':
 			ret = parse_cgroup_spec(cgroup_list, optarg, argc);
 			if (ret != 0) {
@@ -186,6 +191,12 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	if ((flags & CGFLAG_DELETE_KILL) && !(flags & CGFLAG_DELETE_RECURSIVE)) {
+		err("%s: -k requires -r, the subgroups are killed too\n", argv[0]);
+		ret = EXIT_BADARGS;
+		goto err;
+	}
+
 	/* this is false always for disable-systemd */
 	if (!ignore_default_systemd_delegate_slice)
 		cgroup_set_default_systemd_cgroup();
@@ -39,6 +39,7 @@
 static pid_t find_scope_pid(pid_t pid);
 static int write_systemd_unified(const char * const scope_name);
 static int is_scope_parsed(const char * const path);
+static int init_libcgroup(int ignore_default_systemd_delegate_slice);
 
 static struct option longopts[] = {
 	{"sticky",	no_argument, NULL, 's'},
@@ -76,6 +77,7 @@ int main(int argc, char *argv[])
 	int replace_idle = 0;
 	int cg_specified = 0;
 	int flag_child = 0;
+	int fast_path = 0;
 	int i, ret = 0;
 	uid_t uid;
 	gid_t gid;
@@ -122,17 +124,17 @@ int main(int argc, char *argv[])
 		exit(EXIT_BADARGS);
 	}
 
-	/* Initialize libcg */
-	ret = cgroup_init();
-	if (ret) {
-		err("libcgroup initialization failed: %s\n", cgroup_strerror(ret));
-		return ret;
+	/*
+	 * The groups given with -g are looked up by the fast path when the
+	 * system allows it, the library is initialized only if it does not.
+	 */
+	fast_path = cg_specified && !replace_idle;
+	if (!fast_path) {
+		ret = init_libcgroup(ignore_default_systemd_delegate_slice);
+		if (ret)
+			return ret;
 	}
 
-	/* this is false always for disable-systemd */
-	if (!ignore_default_systemd_delegate_slice)
-		cgroup_set_default_systemd_cgroup();
-
 	/* Just for debugging purposes. */
 	uid = geteuid();
 	gid = getegid();
@@ -173,8 +175,21 @@ int main(int argc, char *argv[])
 			if (!cgroup_list[i])
 				break;
 
-			ret = cgroup_change_cgroup_path(cgroup_list[i]->path, pid,
-				(const char *const*) cgroup_list[i]->controllers);
+			if (fast_path) {
+				ret = cgroup_change_cgroup_path_fast(cgroup_list[i]->path, pid,
+					(const char *const*) cgroup_list[i]->controllers);
+				if (ret == ECGROUPUNSUPP) {
+					/* Nothing was changed, take the slow path for all the groups */
+					fast_path = 0;
+					ret = init_libcgroup(ignore_default_systemd_delegate_slice);
+					if (ret)
+						return ret;
+				}
+			}
+
+			if (!fast_path)
+				ret = cgroup_change_cgroup_path(cgroup_list[i]->path, pid,
+					(const char *const*) cgroup_list[i]->controllers);
 			if (ret) {
 				err("cgroup change of group failed\n");
 				return ret;
@@ -229,6 +244,23 @@ int main(int argc, char *argv[])
 	return -1;
 }
 
+static int init_libcgroup(int ignore_default_systemd_delegate_slice)
+{
+	int ret;
+
+	ret = cgroup_init();
+	if (ret) {
+		err("libcgroup initialization failed: %s\n", cgroup_strerror(ret));
+		return ret;
+	}
+
+	/* this is false always for disable-systemd */
+	if (!ignore_default_systemd_delegate_slice)
+		cgroup_set_default_systemd_cgroup();
+
+	return 0;
+}
+
 static pid_t search_systemd_idle_thread_task(pid_t pids[], size_t size)
 {
 	char task_cmd[FILENAME_MAX];
@@ -269,6 +301,7 @@ static pid_t find_scope_pid(pid_t pid)
 	char buffer[FILENAME_MAX];
 	FILE *pid_proc_fp = NULL;
 	char *_ctrl_name = NULL;
+	const char *scope;
 	int idx, ret, size = 0;
 	pid_t *pids;
 
@@ -323,6 +356,11 @@ static pid_t find_scope_pid(pid_t pid)
 			ctrl_name[size] = '\0';
 		}
 
+		/* libcgroup records the idle_thread of the scopes it creates */
+		scope = strrchr(cgroup_name, '/');
+		if (!cgroup_get_scope_idle_pid(scope ? scope + 1 : cgroup_name, &_scope_pid))
+			goto found_idle_thread;
+
 		if (ret == 2)
 			ret = cgroup_get_procs(cgroup_name, NULL, &pids, &size);
 		else
@@ -339,6 +377,7 @@ static pid_t find_scope_pid(pid_t pid)
 		_scope_pid = search_systemd_idle_thread_task(pids, size);
 		free(pids);
 
+found_idle_thread:
 		if (_scope_pid == -1)
 			continue;
 
@@ -6,6 +6,9 @@
 
 #include <dirent.h>
 #include <getopt.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
 #include <pthread.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,6 +19,8 @@
 #define MODE_SHOW_HEADERS	1
 #define MODE_SHOW_NAMES		2
 #define MODE_SYSTEMD_DELEGATE	4
+/* Only print the values marked dirty, see watch_cgroups() */
+#define MODE_CHANGED_ONLY	8
 
 #define LL_MAX			100
 
@@ -27,6 +32,9 @@ static const struct option long_options[] = {
 	{"help",	      no_argument, NULL, 'h'},
 	{"all",		      no_argument, NULL, 'a'},
 	{"values-only",	      no_argument, NULL, 'v'},
+	{"format",	required_argument, NULL, 'F'},
+	{"interval",	required_argument, NULL, 'I'},
+	{"count",	required_argument, NULL, 'C'},
 	{NULL, 0, NULL, 0}
 };
 
@@ -36,7 +44,8 @@ static void usage(int status, const char *program_name)
 		err("Wrong input parameters, try %s -h' for more information.\n", program_name);
 		return;
 	}
-	info("Usage: %s [-nv] [-r <name>] [-g <controllers>] [-a] <path> ...\n", program_name);
+	info("Usage: %s [-nv] [-r <name>] [-g <controllers>] [-a] [--format=<format>] ", program_name);
+	info("[--interval=<ms> [--count=<n>]] <path> ...\n");
 	info("Print parameter(s) of given group(s).\n");
 	info("  -a, --all			Print info about all relevant controllers\n");
 	info("  -g <controllers>		Controller which info should be displayed\n");
@@ -51,6 +60,26 @@ static void usage(int status, const char *program_name)
 	info("  -b				Ignore default systemd delegate hierarchy\n");
 #endif
 	info("  -c				Display controller version\n");
+	info("      --format=<format>		Print the groups as text (default), json or ");
+	info("ndjson\n");
+	info("      --interval=<ms>		Read the values again every <ms> milliseconds ");
+	info("and print the changed ones\n");
+	info("      --count=<n>			Stop after <n> samples, see --interval\n");
+}
+
+static int parse_positive(const char * const string, long * const value,
+			  const char * const program_name)
+{
+	char *end;
+
+	errno = 0;
+	*value = strtol(string, &end, 10);
+	if (errno != 0 || end == string || *end != '\0' || *value <= 0) {
+		err("%s: invalid number %s\n", program_name, string);
+		return -1;
+	}
+
+	return 0;
 }
 
 static int get_controller_from_name(const char * const name, char **controller)
@@ -396,7 +425,8 @@ out:
 }
 
 static int parse_opts(int argc, char *argv[], struct cgroup **cg_list[], int * const cg_list_len,
-		      int * const mode)
+		      int * const mode, enum output_format * const format, long * const interval,
+		      long * const count)
 {
 	bool do_not_fill_controller = false;
 	bool first_cgroup_is_dummy = false;
@@ -460,6 +490,18 @@ static int parse_opts(int argc, char *argv[], struct cgroup **cg_list[], int * c
 		case 'c':
 			print_ctrl_ver = true;
 			break;
+		case 'F':
+			if (parse_format(optarg, format, argv[0]))
+				exit(EXIT_BADARGS);
+			break;
+		case 'I':
+			if (parse_positive(optarg, interval, argv[0]))
+				exit(EXIT_BADARGS);
+			break;
+		case 'C':
+			if (parse_positive(optarg, count, argv[0]))
+				exit(EXIT_BADARGS);
+			break;
 		default:
 			usage(1, argv[0]);
 			exit(EXIT_BADARGS);
@@ -472,6 +514,12 @@ static int parse_opts(int argc, char *argv[], struct cgroup **cg_list[], int * c
 		exit(EXIT_BADARGS);
 	}
 
+	/* '--count' only applies to '--interval' */
+	if (*count && !*interval) {
+		usage(1, argv[0]);
+		exit(EXIT_BADARGS);
+	}
+
 	/* '-m' and '-c' should not used with other options */
 	if ((cgroup_mount_type || print_ctrl_ver) &&
 	    (fill_controller || do_not_fill_controller)) {
@@ -505,6 +553,7 @@ static int get_cv_value(struct control_value * const cv, const char * const cg_n
 	bool is_multiline = false;
 	void *tmp, *handle = NULL;
 	char tmp_line[LL_MAX];
+	char *value;
 	int ret;
 
 	ret = cgroup_read_value_begin(controller_name, cg_name, cv->name, &handle, tmp_line,
@@ -535,7 +584,14 @@ static int get_cv_value(struct control_value * const cv, const char * const cg_n
 	/* remove the newline character */
 	tmp_line[strcspn(tmp_line, "\n")] = '\0';
 
-	strncpy(cv->value, tmp_line, CG_CONTROL_VALUE_MAX - 1);
+	value = strdup(tmp_line);
+	if (value == NULL) {
+		ret = ECGOTHER;
+		goto read_end;
+	}
+	free(cv->value);
+	cv->value = value;
+
 	cv->multiline_value = strdup(cv->value);
 	if (cv->multiline_value == NULL)
 		goto read_end;
@@ -560,7 +616,6 @@ static int get_cv_value(struct control_value * const cv, const char * const cg_n
 	}
 
 read_end:
-	cgroup_read_value_end(&handle);
 	if (ret == ECGEOF)
 		ret = 0;
 end:
@@ -569,8 +624,8 @@ end:
 		cv->multiline_value = NULL;
 	}
 
-	if ((FILE *)handle)
-		fclose((FILE *)handle);
+	if (handle)
+		cgroup_read_value_end(&handle);
 
 	return ret;
 }
@@ -707,6 +762,11 @@ static int get_controller_values(struct cgroup * const cg, struct cgroup_control
 	int ret = 0;
 	int i;
 
+	/* The values of a copied group are shared until they are read */
+	ret = cg_own_values(cgc);
+	if (ret)
+		goto out;
+
 	for (i = 0; i < cgc->index; i++) {
 		ret = get_cv_value(cgc->values[i], cg->name, cgc->name);
 		if (ret)
@@ -767,14 +827,34 @@ void print_controller(const struct cgroup_controller * const cgc, int mode)
 {
 	int i;
 
-	for (i = 0; i < cgc->index; i++)
+	for (i = 0; i < cgc->index; i++) {
+		if ((mode & MODE_CHANGED_ONLY) && !cgc->values[i]->dirty)
+			continue;
 		print_control_values(cgc->values[i], mode);
+	}
+}
+
+static bool cgroup_changed(const struct cgroup * const cg)
+{
+	int i, j;
+
+	for (i = 0; i < cg->index; i++) {
+		for (j = 0; j < cg->controller[i]->index; j++) {
+			if (cg->controller[i]->values[j]->dirty)
+				return true;
+		}
+	}
+
+	return false;
 }
 
 static void print_cgroup(const struct cgroup * const cg, int mode)
 {
 	int i;
 
+	if ((mode & MODE_CHANGED_ONLY) && !cgroup_changed(cg))
+		return;
+
 	if (mode & MODE_SHOW_HEADERS)
 		info("%s:\n", cg->name);
 
@@ -793,10 +873,319 @@ static void print_cgroups(struct cgroup *cg_list[], int cg_list_len, int mode)
 		print_cgroup(cg_list[i], mode);
 }
 
+static void print_json_control_value(FILE *out, const struct control_value * const cv)
+{
+	char *lines, *line, *saveptr = NULL;
+	bool first = true;
+
+	print_json_string(out, cv->name);
+	fputc(':', out);
+
+	if (!cv->multiline_value) {
+		print_json_value(out, cv->value);
+		return;
+	}
+
+	/* The lines of the value are an array, without the indentation of the text output */
+	fputc('[', out);
+	lines = strdup(cv->multiline_value);
+	if (lines) {
+		for (line = strtok_r(lines, "\n", &saveptr); line;
+		     line = strtok_r(NULL, "\n", &saveptr)) {
+			if (!first)
+				fputc(',', out);
+			print_json_value(out, line[0] == '\t' ? &line[1] : line);
+			first = false;
+		}
+		free(lines);
+	}
+	fputc(']', out);
+}
+
+static void print_json_cgroup(struct json_stream * const stream, const struct cgroup * const cg,
+			      int mode)
+{
+	const struct cgroup_controller *cgc;
+	FILE *out = stream->out;
+	bool first;
+	int i, j;
+
+	if ((mode & MODE_CHANGED_ONLY) && !cgroup_changed(cg))
+		return;
+
+	json_record_begin(stream);
+
+	fputs("{\"name\":", out);
+	print_json_string(out, cg->name);
+	fputs(",\"controllers\":{", out);
+
+	for (i = 0; i < cg->index; i++) {
+		cgc = cg->controller[i];
+
+		if (i > 0)
+			fputc(',', out);
+		print_json_string(out, cgc->name);
+		fputs(":{", out);
+
+		first = true;
+		for (j = 0; j < cgc->index; j++) {
+			if ((mode & MODE_CHANGED_ONLY) && !cgc->values[j]->dirty)
+				continue;
+			if (!first)
+				fputc(',', out);
+			print_json_control_value(out, cgc->values[j]);
+			first = false;
+		}
+		fputc('}', out);
+	}
+	fputs("}}", out);
+
+	json_record_end(stream);
+}
+
+/*
+ * Read and print the groups one by one, each group is freed once printed so
+ * that the output starts at once and the memory does not grow with the number
+ * of groups.
+ */
+static int print_json_cgroups(struct cgroup *cg_list[], int cg_list_len,
+			      enum output_format format)
+{
+	struct json_stream stream;
+	int ret = 0;
+	int i;
+
+	json_stream_begin(&stream, stdout, format);
+
+	for (i = 0; i < cg_list_len; i++) {
+		ret = get_cgroup_values(cg_list[i]);
+		if (ret)
+			break;
+
+		print_json_cgroup(&stream, cg_list[i], 0);
+		cgroup_free(&cg_list[i]);
+	}
+
+	json_stream_end(&stream);
+
+	return ret;
+}
+
+/* A file watched by --interval, it stays open between the samples */
+struct watch_file {
+	struct control_value *cv;
+	int fd;
+};
+
+static int watch_open(struct cgroup *cg_list[], int cg_list_len, struct watch_file **files,
+		      int * const files_len)
+{
+	char cg_path[FILENAME_MAX], path[FILENAME_MAX];
+	struct cgroup_controller *cgc;
+	struct watch_file *tmp;
+	int alloc = 0;
+	int i, j, k;
+	int fd;
+
+	*files = NULL;
+	*files_len = 0;
+
+	for (i = 0; i < cg_list_len; i++) {
+		for (j = 0; j < cg_list[i]->index; j++) {
+			cgc = cg_list[i]->controller[j];
+			if (!cg_build_path(cg_list[i]->name, cg_path, cgc->name))
+				continue;
+
+			for (k = 0; k < cgc->index; k++) {
+				snprintf(path, sizeof(path), "%s%s", cg_path, cgc->values[k]->name);
+				fd = open(path, O_RDONLY | O_CLOEXEC);
+				if (fd < 0) {
+					err("cannot watch %s: %s\n", path, strerror(errno));
+					continue;
+				}
+
+				if (*files_len == alloc) {
+					alloc = alloc ? alloc * 2 : 16;
+					tmp = realloc(*files, alloc * sizeof(struct watch_file));
+					if (!tmp) {
+						close(fd);
+						return ECGOTHER;
+					}
+					*files = tmp;
+				}
+
+				(*files)[*files_len].cv = cgc->values[k];
+				(*files)[*files_len].fd = fd;
+				(*files_len)++;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Read a watched file again, the value is marked dirty if it changed.  It is
+ * stored like get_cv_value() does, the lines of a multiline value indented.
+ * @return 0 on success, -1 if the file cannot be read anymore
+ */
+static int watch_read(struct watch_file * const file, char * const buf, char * const lines)
+{
+	struct control_value *cv = file->cv;
+	char *line, *saveptr = NULL;
+	bool multiline = false;
+	char *value;
+	ssize_t len;
+
+	len = pread(file->fd, buf, CG_CONTROL_VALUE_MAX - 1, 0);
+	if (len < 0)
+		return -1;
+	buf[len] = '\0';
+
+	lines[0] = '\0';
+	for (line = strtok_r(buf, "\n", &saveptr); line; line = strtok_r(NULL, "\n", &saveptr)) {
+		if (lines[0] != '\0') {
+			strncat(lines, "\n\t", CG_CONTROL_VALUE_MAX - strlen(lines) - 1);
+			multiline = true;
+		}
+		strncat(lines, line, CG_CONTROL_VALUE_MAX - strlen(lines) - 1);
+	}
+
+	if (multiline) {
+		if (cv->multiline_value && strcmp(cv->multiline_value, lines) == 0)
+			return 0;
+
+		value = strdup(lines);
+		if (!value)
+			return 0;
+		free(cv->multiline_value);
+		cv->multiline_value = value;
+		cv->value[0] = '\0';
+	} else {
+		if (!cv->multiline_value && strcmp(cv->value, lines) == 0)
+			return 0;
+
+		value = strdup(lines);
+		if (!value)
+			return 0;
+		free(cv->multiline_value);
+		cv->multiline_value = NULL;
+		free(cv->value);
+		cv->value = value;
+	}
+	cv->dirty = true;
+
+	return 0;
+}
+
+static void watch_print(struct json_stream * const stream, struct cgroup *cg_list[],
+			int cg_list_len, int mode)
+{
+	int i;
+
+	if (stream->format == FORMAT_TEXT) {
+		print_cgroups(cg_list, cg_list_len, mode);
+	} else {
+		for (i = 0; i < cg_list_len; i++)
+			print_json_cgroup(stream, cg_list[i], mode);
+	}
+	fflush(stdout);
+}
+
+static void clear_dirty(struct cgroup *cg_list[], int cg_list_len)
+{
+	int i, j, k;
+
+	for (i = 0; i < cg_list_len; i++) {
+		for (j = 0; j < cg_list[i]->index; j++) {
+			for (k = 0; k < cg_list[i]->controller[j]->index; k++)
+				cg_list[i]->controller[j]->values[k]->dirty = false;
+		}
+	}
+}
+
+/*
+ * Print the values, then sample them every interval ms and print those which
+ * changed.  The files are opened once and read again from their start, the
+ * mount table is not parsed again.
+ */
+static int watch_cgroups(struct cgroup *cg_list[], int cg_list_len, int mode,
+			 enum output_format format, long interval, long count)
+{
+	char buf[CG_CONTROL_VALUE_MAX], lines[CG_CONTROL_VALUE_MAX];
+	struct watch_file *files = NULL;
+	unsigned long long next_ns, now_ns;
+	struct json_stream stream;
+	int files_len, open_files;
+	struct timespec ts;
+	long sample;
+	int ret, i;
+
+	ret = watch_open(cg_list, cg_list_len, &files, &files_len);
+	if (ret)
+		goto out;
+
+	json_stream_begin(&stream, stdout, format);
+	watch_print(&stream, cg_list, cg_list_len, mode);
+	clear_dirty(cg_list, cg_list_len);
+
+	open_files = files_len;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	next_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+
+	for (sample = 1; (count == 0 || sample < count) && open_files > 0; sample++) {
+		/* The samples are taken at fixed times, whatever printing them takes */
+		next_ns += interval * 1000000ULL;
+		ts.tv_sec = next_ns / 1000000000ULL;
+		ts.tv_nsec = next_ns % 1000000000ULL;
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+			;
+
+		/* Skip the samples missed, e.g. when the output was blocked */
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		now_ns = ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+		if (now_ns > next_ns + interval * 1000000ULL)
+			next_ns = now_ns;
+
+		for (i = 0; i < files_len; i++) {
+			if (files[i].fd < 0)
+				continue;
+
+			if (watch_read(&files[i], buf, lines)) {
+				err("cannot read %s: %s\n", files[i].cv->name, strerror(errno));
+				close(files[i].fd);
+				files[i].fd = -1;
+				open_files--;
+			}
+		}
+
+		mode |= MODE_CHANGED_ONLY;
+		watch_print(&stream, cg_list, cg_list_len, mode);
+		clear_dirty(cg_list, cg_list_len);
+	}
+
+	json_stream_end(&stream);
+
+	/* All the groups were removed */
+	if (open_files == 0)
+		ret = ECGROUPNOTEXIST;
+
+out:
+	for (i = 0; i < files_len; i++) {
+		if (files[i].fd >= 0)
+			close(files[i].fd);
+	}
+	free(files);
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	int mode = MODE_SHOW_NAMES | MODE_SHOW_HEADERS | MODE_SYSTEMD_DELEGATE;
+	enum output_format format = FORMAT_TEXT;
 	struct cgroup **cg_list = NULL;
+	long interval = 0, count = 0;
 	int cg_list_len = 0;
 	int ret = 0, i;
 
@@ -812,7 +1201,7 @@ int main(int argc, char *argv[])
 		goto err;
 	}
 
-	ret = parse_opts(argc, argv, &cg_list, &cg_list_len, &mode);
+	ret = parse_opts(argc, argv, &cg_list, &cg_list_len, &mode, &format, &interval, &count);
 	if (ret)
 		goto err;
 
@@ -820,11 +1209,19 @@ int main(int argc, char *argv[])
 	if (mode & MODE_SYSTEMD_DELEGATE)
 		cgroup_set_default_systemd_cgroup();
 
+	if (format != FORMAT_TEXT && !interval) {
+		ret = print_json_cgroups(cg_list, cg_list_len, format);
+		goto err;
+	}
+
 	ret = get_values(cg_list, cg_list_len);
 	if (ret)
 		goto err;
 
-	print_cgroups(cg_list, cg_list_len, mode);
+	if (interval)
+		ret = watch_cgroups(cg_list, cg_list_len, mode, format, interval, count);
+	else
+		print_cgroups(cg_list, cg_list_len, mode);
 
 err:
 	for (i = 0; i < cg_list_len; i++)
@@ -17,6 +17,7 @@
 #include <errno.h>
 #include <pwd.h>
 #include <grp.h>
+#include <pthread.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -28,24 +29,63 @@ enum flag {
 	FL_OUTPUT =	8,  /* output should be redirect to the given file */
 	FL_DENY =	16, /* denylist set */
 	FL_ALLOW =	32, /* allowlist set */
+	FL_BASELINE =	64, /* only display the changes since a baseline */
 };
 
 #define DENYLIST_CONF	"/etc/cgsnapshot_denylist.conf"
 #define ALLOWLIST_CONF	"/etc/cgsnapshot_allowlist.conf"
 
+/* Size of the stdio buffer of the output */
+#define OUTPUT_BUF_SIZE	(256 * 1024)
+
+/* Initial number of buckets of a list, doubled as the list grows */
+#define LIST_TABLE_SIZE	64
+
 struct deny_list_type {
 	char *name;			/* variable name */
-	struct deny_list_type *next;	/* pointer to the next record */
+	unsigned int hash;		/* hash of the name */
+	struct deny_list_type *next;	/* next record of the bucket */
+	char *record;			/* record of the group, in the baseline */
+	bool seen;			/* the group still exists, in the baseline */
+};
+
+/*
+ * Set of the variable names of a deny or allow list, each variable of each
+ * group is looked up in both
+ */
+struct name_list {
+	struct deny_list_type **table;
+	unsigned int table_size;	/* power of two */
+	unsigned int count;
 };
 
-struct deny_list_type *deny_list;
-struct deny_list_type *allow_list;
+struct name_list deny_list;
+struct name_list allow_list;
+
+/*
+ * Set by --baseline, the group records of a previous snapshot by
+ * "controller:group", in the order of the file
+ */
+static const char *baseline_file;
+static struct name_list baseline;
+static struct deny_list_type **baseline_order;
+static int baseline_count;
+static char *baseline_mount;
 
 typedef char cont_name_t[FILENAME_MAX];
 
 int flags;
 FILE *output_f;
 
+/* Number of threads reading the groups, set by -j */
+static int jobs;
+
+/* Set by --format, the records of the json formats are written to json */
+static enum output_format format = FORMAT_TEXT;
+static struct json_stream json;
+
+static pthread_mutex_t pwd_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /*
  * Display the usage
  */
@@ -56,13 +96,18 @@ static void usage(int status, const char *program_name)
 		return;
 	}
 
-	info("Usage: %s [-h] [-s] [-b FILE] [-w FILE] [-f FILE] [controller] [...]\n",
+	info("Usage: %s [-h] [-s] [-b FILE] [-w FILE] [-f FILE] [-j N] [controller] [...]\n",
 	     program_name);
 	info("Generate the configuration file for given controllers\n");
+	info("      --baseline=FILE		Display only the changes since ");
+	info("the snapshot FILE\n");
 	info("  -b, --denylist=FILE		Set the denylist");
 	info(" configuration file (default %s)\n", DENYLIST_CONF);
 	info("  -f, --file=FILE		Redirect the output to output_file\n");
 	info("  -h, --help			Display this help\n");
+	info("  -j, --jobs=N			Read the groups with N threads\n");
+	info("      --format=FORMAT		Print the configuration as text (default), ");
+	info("json or ndjson\n");
 	info("  -s, --silent			Ignore all warnings\n");
 	info("  -t, --strict			Don't show variables ");
 	info("which are not on the allowlist\n");
@@ -70,13 +115,116 @@ static void usage(int status, const char *program_name)
 	info("configuration file (don't used by default)\n");
 }
 
-/* cache values from denylist file to the list structure */
-int load_list(char *filename, struct deny_list_type **p_list)
+static unsigned int list_hash(const char * const name)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, name);
+}
+
+static struct deny_list_type *list_find(const struct name_list * const list,
+					const char * const name, unsigned int hash)
+{
+	struct deny_list_type *record;
+
+	if (list->table == NULL)
+		return NULL;
+
+	record = list->table[hash & (list->table_size - 1)];
+	while (record != NULL) {
+		if (record->hash == hash && strcmp(record->name, name) == 0)
+			return record;
+		record = record->next;
+	}
+
+	return NULL;
+}
+
+/* Double the number of buckets of the list, or allocate the first ones */
+static int list_grow(struct name_list * const list)
+{
+	struct deny_list_type **table;
+	struct deny_list_type *record;
+	struct deny_list_type *next;
+	unsigned int size, i;
+
+	size = list->table_size ? list->table_size * 2 : LIST_TABLE_SIZE;
+	table = calloc(size, sizeof(struct deny_list_type *));
+	if (table == NULL)
+		return 1;
+
+	for (i = 0; i < list->table_size; i++) {
+		for (record = list->table[i]; record != NULL; record = next) {
+			next = record->next;
+			record->next = table[record->hash & (size - 1)];
+			table[record->hash & (size - 1)] = record;
+		}
+	}
+
+	free(list->table);
+	list->table = table;
+	list->table_size = size;
+
+	return 0;
+}
+
+/* @return The record of the name, added if it is not on the list yet */
+static struct deny_list_type *list_add(struct name_list * const list, const char * const name)
 {
-	struct deny_list_type *start = NULL;
-	struct deny_list_type *end = NULL;
 	struct deny_list_type *new;
+	unsigned int hash;
+
+	hash = list_hash(name);
+	new = list_find(list, name, hash);
+	if (new != NULL)
+		return new;
+
+	if (list->count >= list->table_size && list_grow(list))
+		return NULL;
+
+	new = calloc(1, sizeof(struct deny_list_type));
+	if (new == NULL)
+		return NULL;
+
+	new->name = strdup(name);
+	if (new->name == NULL) {
+		free(new);
+		return NULL;
+	}
 
+	new->hash = hash;
+	new->next = list->table[hash & (list->table_size - 1)];
+	list->table[hash & (list->table_size - 1)] = new;
+	list->count++;
+
+	return new;
+}
+
+/* free list structure */
+void free_list(struct name_list *list)
+{
+	struct deny_list_type *now;
+	struct deny_list_type *next;
+	unsigned int i;
+
+	for (i = 0; i < list->table_size; i++) {
+		now = list->table[i];
+		while (now != NULL) {
+			next = now->next;
+			free(now->name);
+			free(now->record);
+			free(now);
+			now = next;
+		}
+	}
+
+	free(list->table);
+	list->table = NULL;
+	list->table_size = 0;
+	list->count = 0;
+}
+
+/* cache values from denylist file to the list structure */
+int load_list(char *filename, struct name_list *list)
+{
 	char buf[FILENAME_MAX];
 	char name[FILENAME_MAX];
 	int i = 0;
@@ -86,7 +234,6 @@ int load_list(char *filename, struct deny_list_type **p_list)
 	fw = fopen(filename, "r");
 	if (fw == NULL) {
 		err("ERROR: Failed to open file %s: %s\n", filename, strerror(errno));
-		*p_list = NULL;
 		return 1;
 	}
 
@@ -106,101 +253,229 @@ int load_list(char *filename, struct deny_list_type **p_list)
 		if (ret == 0)
 			continue;
 
-		new = (struct deny_list_type *) malloc(sizeof(struct deny_list_type));
-		if (new == NULL) {
+		if (list_add(list, name) == NULL) {
 			err("ERROR: Memory allocation problem (%s)\n", strerror(errno));
-			ret = 1;
-			goto err;
+			fclose(fw);
+			free_list(list);
+			return 1;
 		}
+	}
+	fclose(fw);
 
-		new->name = strdup(name);
-		if (new->name == NULL) {
-			err("ERROR: Memory allocation problem (%s)\n", strerror(errno));
-			ret = 1;
-			free(new);
-			goto err;
+	return 0;
+}
+
+/*
+ * Test whether the variable is on the list return values are:
+ * 1 ... was found
+ * 0 ... no record was found
+ */
+int is_on_list(const char *name, const struct name_list *list)
+{
+	if (list->count == 0)
+		return 0;
+
+	return list_find(list, name, list_hash(name)) != NULL;
+}
+
+/* The start of the line following line */
+static const char *next_line(const char *line)
+{
+	const char *end = strchr(line, '\n');
+
+	return end ? end + 1 : line + strlen(line);
+}
+
+/*
+ * Find the first controller of a group record, the one of the hierarchy it
+ * was read from, see display_cgroup_data().  It is empty if the record has
+ * no controller.
+ */
+static void record_controller(const char *record, char *controller, size_t size)
+{
+	const char *line, *end;
+	size_t len;
+
+	controller[0] = '\0';
+
+	for (line = record; *line; line = end) {
+		end = next_line(line);
+
+		/* the headers of the controllers have one tab, like the perm block */
+		if (line[0] != '\t' || line[1] == '\t' || strncmp(line, "\tperm {", 7) == 0 ||
+		    end - line < 5 || strncmp(end - 3, " {\n", 3) != 0)
+			continue;
+
+		/* "\tcpu {\n" or "\t\"name=...\" {\n" */
+		line++;
+		len = end - line - 3;
+		if (line[0] == '"' && len >= 2) {
+			line++;
+			len -= 2;
 		}
-		new->next = NULL;
 
-		/* update the variables list */
-		if (start == NULL) {
-			start = new;
-			end = new;
-		} else {
-			end->next = new;
-			end = new;
+		if (len < size) {
+			memcpy(controller, line, len);
+			controller[len] = '\0';
 		}
+		return;
 	}
-	fclose(fw);
+}
 
-	*p_list = start;
+/* Index a record of the baseline, the record is then owned by the index */
+static int baseline_add(char *record)
+{
+	char controller[FILENAME_MAX], key[FILENAME_MAX * 2];
+	struct deny_list_type *entry, **order;
+	const char *name;
+	int name_len;
+
+	if (strncmp(record, "mount {", 7) == 0) {
+		free(baseline_mount);
+		baseline_mount = record;
+		return 0;
+	}
 
-	return 0;
+	/* "group NAME {\n" */
+	name = record + 6;
+	name_len = next_line(name) - name - 3;
+	if (name_len <= 0) {
+		free(record);
+		return 0;
+	}
 
-err:
-	fclose(fw);
-	new = start;
-	while (new != NULL) {
-		end = new->next;
-		free(new->name);
-		free(new);
-		new = end;
+	record_controller(record, controller, sizeof(controller));
+	snprintf(key, sizeof(key), "%s:%.*s", controller, name_len, name);
+
+	entry = list_add(&baseline, key);
+	if (entry == NULL) {
+		free(record);
+		return 1;
 	}
-	*p_list = NULL;
 
-	return ret;
+	if (entry->record == NULL) {
+		order = realloc(baseline_order, (baseline_count + 1) * sizeof(*order));
+		if (order == NULL) {
+			free(record);
+			return 1;
+		}
+		baseline_order = order;
+		baseline_order[baseline_count++] = entry;
+	}
+
+	free(entry->record);
+	entry->record = record;
+
+	return 0;
 }
 
-/* free list structure */
-void free_list(struct deny_list_type *list)
+/* Index the group records and the mount section of a previous snapshot */
+static int load_baseline(const char *filename)
 {
-	struct deny_list_type *now;
-	struct deny_list_type *next;
+	char *line = NULL, *record = NULL;
+	size_t line_size = 0, size;
+	FILE *f, *out = NULL;
+	int ret = 0;
+	int c;
+
+	f = fopen(filename, "r");
+	if (f == NULL) {
+		err("ERROR: Failed to open file %s: %s\n", filename, strerror(errno));
+		return 1;
+	}
+
+	while (getline(&line, &line_size, f) > 0) {
+		/* the records start with their header, the comments are skipped */
+		if (out == NULL) {
+			if (strcmp(line, "mount {\n") != 0 && strncmp(line, "group ", 6) != 0)
+				continue;
+
+			out = open_memstream(&record, &size);
+			if (out == NULL) {
+				ret = 1;
+				break;
+			}
+		}
+
+		fputs(line, out);
+		if (strcmp(line, "}\n") != 0)
+			continue;
+
+		/* like in display_cgroup_data(), the record ends with an empty line */
+		c = fgetc(f);
+		if (c == '\n')
+			fputc(c, out);
+		else if (c != EOF)
+			ungetc(c, f);
+
+		fclose(out);
+		out = NULL;
+		ret = baseline_add(record);
+		if (ret)
+			break;
+	}
 
-	now = list;
-	while (now != NULL) {
-		next = now->next;
-		free(now->name);
-		free(now);
-		now = next;
+	/* a record cut short */
+	if (out != NULL) {
+		fclose(out);
+		free(record);
 	}
+
+	if (ret)
+		err("ERROR: Memory allocation problem (%s)\n", strerror(errno));
+
+	free(line);
+	fclose(f);
+
+	return ret;
 }
 
-/*
- * Test whether the variable is on the list return values are:
- * 1 ... was found
- * 0 ... no record was found
- */
-int is_on_list(char *name, struct deny_list_type *list)
+/* Owners of a group, see read_permissions() */
+struct group_perm {
+	/* some uid or gid is nonroot, the names below are set */
+	bool nonroot;
+	char admin_uid[LOGIN_NAME_MAX];
+	char admin_gid[LOGIN_NAME_MAX];
+	char task_uid[LOGIN_NAME_MAX];
+	char task_gid[LOGIN_NAME_MAX];
+};
+
+static int read_owner_names(uid_t uid, gid_t gid, char *uid_name, char *gid_name)
 {
-	struct deny_list_type *record;
+	struct passwd *pw;
+	struct group *gr;
 
-	record = list;
-	/* go through the list of all values */
-	while (record != NULL) {
-		/* if the variable name is found */
-		if (strcmp(record->name, name) == 0)
-			return 1; /* return its value */
+	/* find out the user and group name */
+	pw = getpwuid(uid);
+	if (pw == NULL) {
+		err("ERROR: can't get %d user name\n", uid);
+		return -1;
+	}
+	snprintf(uid_name, LOGIN_NAME_MAX, "%s", pw->pw_name);
 
-		record = record->next;
+	gr = getgrgid(gid);
+	if (gr == NULL) {
+		err("ERROR: can't get %d group name\n", gid);
+		return -1;
 	}
+	snprintf(gid_name, LOGIN_NAME_MAX, "%s", gr->gr_name);
 
-	return 0; /* the variable was not found */
+	return 0;
 }
 
 /*
- * Display permissions record for the given group defined by path
+ * Read the owners of the group defined by path and of its tasks file
  */
-static int display_permissions(const char *path, const char * const cg_name,
-			       const char * const ctrl_name)
+static int read_permissions(struct group_perm *perm, const char *path, const char * const cg_name,
+			    const char * const ctrl_name)
 {
 	char tasks_path[FILENAME_MAX];
-	struct passwd *pw;
-	struct group *gr;
 	struct stat sba;
 	struct stat sbt;
 	int ret;
 
+	perm->nonroot = false;
+
 	/* admin permissions record */
 	/* get the directory statistic */
 	ret = stat(path, &sba);
@@ -223,63 +498,148 @@ static int display_permissions(const char *path, const char * const cg_name,
 		return -1;
 	}
 
-	if ((sba.st_uid) || (sba.st_gid) || (sbt.st_uid) || (sbt.st_gid)) {
-		/*
-		 * some uid or gid is nonroot, admin permission
-		 * tag is necessary
-		 */
+	if (!(sba.st_uid) && !(sba.st_gid) && !(sbt.st_uid) && !(sbt.st_gid))
+		return 0;
 
-		/* print the header */
-		fprintf(output_f, "\tperm {\n");
+	/*
+	 * some uid or gid is nonroot, admin permission
+	 * tag is necessary
+	 */
+	perm->nonroot = true;
 
-		/* find out the user and group name */
-		pw = getpwuid(sba.st_uid);
-		if (pw == NULL) {
-			err("ERROR: can't get %d user name\n", sba.st_uid);
-			fprintf(output_f, "}\n}\n");
-			return -1;
-		}
+	/* getpwuid() and getgrgid() are not reentrant, see -j */
+	pthread_mutex_lock(&pwd_lock);
+	ret = read_owner_names(sba.st_uid, sba.st_gid, perm->admin_uid, perm->admin_gid);
+	if (ret == 0)
+		ret = read_owner_names(sbt.st_uid, sbt.st_gid, perm->task_uid, perm->task_gid);
+	pthread_mutex_unlock(&pwd_lock);
 
-		gr = getgrgid(sba.st_gid);
-		if (gr == NULL) {
-			err("ERROR: can't get %d group name\n", sba.st_gid);
-			fprintf(output_f, "}\n}\n");
-			return -1;
-		}
+	return ret;
+}
 
-		/* print the admin record */
-		fprintf(output_f, "\t\tadmin {\n");
-		fprintf(output_f, "\t\t\tuid = %s;\n", pw->pw_name);
-		fprintf(output_f, "\t\t\tgid = %s;\n", gr->gr_name);
-		fprintf(output_f, "\t\t}\n");
-
-		/* find out the user and group name */
-		pw = getpwuid(sbt.st_uid);
-		if (pw == NULL) {
-			err("ERROR: can't get %d user name\n", sbt.st_uid);
-			fprintf(output_f, "}\n}\n");
-			return -1;
-		}
+/*
+ * Display permissions record for the given group defined by path
+ */
+static int display_permissions(FILE *out, const char *path, const char * const cg_name,
+			       const char * const ctrl_name)
+{
+	struct group_perm perm;
+	int ret;
 
-		gr = getgrgid(sbt.st_gid);
-		if (gr == NULL) {
-			err("ERROR: can't get %d group name\n", sbt.st_gid);
-			fprintf(output_f, "}\n}\n");
-			return -1;
-		}
+	ret = read_permissions(&perm, path, cg_name, ctrl_name);
+	if (!perm.nonroot)
+		return ret;
 
-		/* print the task record */
-		fprintf(output_f, "\t\ttask {\n");
-		fprintf(output_f, "\t\t\ttuid = %s;\n", pw->pw_name);
-		fprintf(output_f, "\t\t\ttgid = %s;\n", gr->gr_name);
-		fprintf(output_f, "\t\t}\n");
+	/* print the header */
+	fprintf(out, "\tperm {\n");
 
-		fprintf(output_f, "\t}\n");
+	if (ret) {
+		fprintf(out, "}\n}\n");
+		return ret;
 	}
 
+	/* print the admin record */
+	fprintf(out, "\t\tadmin {\n");
+	fprintf(out, "\t\t\tuid = %s;\n", perm.admin_uid);
+	fprintf(out, "\t\t\tgid = %s;\n", perm.admin_gid);
+	fprintf(out, "\t\t}\n");
+
+	/* print the task record */
+	fprintf(out, "\t\ttask {\n");
+	fprintf(out, "\t\t\ttuid = %s;\n", perm.task_uid);
+	fprintf(out, "\t\t\ttgid = %s;\n", perm.task_gid);
+	fprintf(out, "\t\t}\n");
+
+	fprintf(out, "\t}\n");
+
 	return 0;
 }
 
+/*
+ * Check whether the variable "name" of a group should be displayed
+ */
+static bool is_variable_shown(const char *name, const char *group_path, int root_path_len,
+			      int first)
+{
+	char var_path[FILENAME_MAX];
+	int bl, wl = 0; /* is on the denylist/allowlist flag */
+	struct stat sb;
+	int ret;
+
+	/*
+	 * For the non-root groups cgconfigparser set
+	 * permissions of variable files to 777. Thus it
+	 * is necessary to test the permissions of variable
+	 * files in the root group to find out whether the
+	 * variable is writable.
+	 */
+	if (root_path_len >= FILENAME_MAX)
+		root_path_len = FILENAME_MAX - 1;
+
+	strncpy(var_path, group_path, root_path_len);
+	var_path[root_path_len] = '\0';
+
+	strncat(var_path, "/", FILENAME_MAX - strlen(var_path) - 1);
+	var_path[FILENAME_MAX-1] = '\0';
+
+	strncat(var_path, name,	FILENAME_MAX - strlen(var_path) - 1);
+	var_path[FILENAME_MAX-1] = '\0';
+
+	/* test whether the  write permissions */
+	ret = stat(var_path, &sb);
+	/*
+	 * freezer.state is not in root group so ret != 0,
+	 * but it should be listed device.list should be
+	 * read to create device.allow input
+	 */
+	/* 0200 == S_IWUSR */
+	if ((ret == 0) && ((sb.st_mode & 0200) == 0) &&
+	    (strcmp("devices.list", name) != 0)) {
+		/* variable is not writable */
+		return false;
+	}
+
+	/*
+	 * find whether the variable is denylisted
+	 * or allowlisted
+	 */
+	bl = is_on_list(name, &deny_list);
+	wl = is_on_list(name, &allow_list);
+
+	/* if it is denylisted skip it and continue */
+	if (bl)
+		return false;
+
+	/*
+	 * if it is not allowlisted and strict tag is used
+	 * skip it and continue too
+	 */
+	if ((!wl) && (flags &  FL_STRICT))
+		return false;
+
+	/*
+	 * if it is not allowlisted and silent tag is not
+	 * used write an warning
+	 */
+	if ((!wl) && !(flags &  FL_SILENT) && (first)) {
+		err("WARNING: variable %s is neither ", name);
+		err("deny nor allow list\n");
+	}
+
+	/*
+	 * deal with devices variables:
+	 * - omit devices.deny and device.allow,
+	 * - generate devices.{deny,allow} from
+	 * device.list variable (deny all and then
+	 * all device.list devices
+	 */
+	if ((strcmp("devices.deny", name) == 0) ||
+	    (strcmp("devices.allow", name) == 0))
+		return false;
+
+	return true;
+}
+
 /*
  * Display the control group record:
  * header
@@ -287,29 +647,26 @@ static int display_permissions(const char *path, const char * const cg_name,
  *   controllers records
  * tail
  */
-static int display_cgroup_data(struct cgroup *group,
+static int display_cgroup_data(FILE *out, struct cgroup *group,
 			       char controller[CG_CONTROLLER_MAX][FILENAME_MAX],
 			       const char *group_path, int root_path_len, int first,
 			       const char *program_name)
 {
 	struct cgroup_controller *group_controller = NULL;
-	char var_path[FILENAME_MAX];
 	char *value = NULL;
 	char *output_name;
-	struct stat sb;
-	int bl, wl = 0; /* is on the denylist/allowlist flag */
 	int nr_var = 0;
 	int i = 0, j;
 	int ret = 0;
 	char *name;
 
 	/* print the  group definition header */
-	fprintf(output_f, "group %s {\n", group->name);
+	fprintf(out, "group %s {\n", group->name);
 
 	/* for all wanted controllers display controllers tag */
 	while (controller[i][0] != '\0') {
 		/* display the permission tags */
-		ret = display_permissions(group_path, group->name, controller[i]);
+		ret = display_permissions(out, group_path, group->name, controller[i]);
 		if (ret)
 			return ret;
 
@@ -324,91 +681,23 @@ static int display_cgroup_data(struct cgroup *group,
 
 		/* print the controller header */
 		if (strncmp(controller[i], "name=", 5) == 0)
-			fprintf(output_f, "\t\"%s\" {\n", controller[i]);
+			fprintf(out, "\t\"%s\" {\n", controller[i]);
 		else
-			fprintf(output_f, "\t%s {\n", controller[i]);
+			fprintf(out, "\t%s {\n", controller[i]);
 		i++;
 		nr_var = cgroup_get_value_name_count(group_controller);
 
 		for (j = 0; j < nr_var; j++) {
 			name = cgroup_get_value_name(group_controller, j);
 
-			/*
-			 * For the non-root groups cgconfigparser set
-			 * permissions of variable files to 777. Thus it
-			 * is necessary to test the permissions of variable
-			 * files in the root group to find out whether the
-			 * variable is writable.
-			 */
-			if (root_path_len >= FILENAME_MAX)
-				root_path_len = FILENAME_MAX - 1;
-
-			strncpy(var_path, group_path, root_path_len);
-			var_path[root_path_len] = '\0';
-
-			strncat(var_path, "/", FILENAME_MAX - strlen(var_path) - 1);
-			var_path[FILENAME_MAX-1] = '\0';
-
-			strncat(var_path, name,	FILENAME_MAX - strlen(var_path) - 1);
-			var_path[FILENAME_MAX-1] = '\0';
-
-			/* test whether the  write permissions */
-			ret = stat(var_path, &sb);
-			/*
-			 * freezer.state is not in root group so ret != 0,
-			 * but it should be listed device.list should be
-			 * read to create device.allow input
-			 */
-			/* 0200 == S_IWUSR */
-			if ((ret == 0) && ((sb.st_mode & 0200) == 0) &&
-			    (strcmp("devices.list", name) != 0)) {
-				/* variable is not writable */
+			if (!is_variable_shown(name, group_path, root_path_len, first))
 				continue;
-			}
-
-			/*
-			 * find whether the variable is denylisted
-			 * or allowlisted
-			 */
-			bl = is_on_list(name, deny_list);
-			wl = is_on_list(name, allow_list);
-
-			/* if it is denylisted skip it and continue */
-			if (bl)
-				continue;
-
-			/*
-			 * if it is not allowlisted and strict tag is used
-			 * skip it and continue too
-			 */
-			if ((!wl) && (flags &  FL_STRICT))
-				continue;
-
-			/*
-			 * if it is not allowlisted and silent tag is not
-			 * used write an warning
-			 */
-			if ((!wl) && !(flags &  FL_SILENT) && (first)) {
-				err("WARNING: variable %s is neither ", name);
-				err("deny nor allow list\n");
-			}
 
 			output_name = name;
 
-			/*
-			 * deal with devices variables:
-			 * - omit devices.deny and device.allow,
-			 * - generate devices.{deny,allow} from
-			 * device.list variable (deny all and then
-			 * all device.list devices
-			 */
-			if ((strcmp("devices.deny", name) == 0) ||
-			    (strcmp("devices.allow", name) == 0))
-				continue;
-
 			if (strcmp("devices.list", name) == 0) {
 				output_name = "devices.allow";
-				fprintf(output_f, "\t\tdevices.deny=\"a *:* rwm\";\n");
+				fputs("\t\tdevices.deny=\"a *:* rwm\";\n", out);
 			}
 
 			ret = cgroup_get_value_string(group_controller, name, &value);
@@ -419,19 +708,486 @@ static int display_cgroup_data(struct cgroup *group,
 				err("ERROR: Value of variable %s can be read\n", name);
 				goto err;
 			}
-			fprintf(output_f, "\t\t%s=\"%s\";\n", output_name, value);
+			/* the records are mostly values, skip the format parsing */
+			fputs("\t\t", out);
+			fputs(output_name, out);
+			fputs("=\"", out);
+			fputs(value, out);
+			fputs("\";\n", out);
 			free(value);
 		}
-		fprintf(output_f, "\t}\n");
+		fputs("\t}\n", out);
 	}
 
 	/* tail of the record */
-	fprintf(output_f, "}\n\n");
+	fputs("}\n\n", out);
 
 err:
 	return ret;
 }
 
+/*
+ * Display the control group record as a JSON object:
+ * {"group":{"name":..., "perm":{...}, "controllers":{"cpu":{...}, ...}}}
+ * Nothing of the record should be kept if an error is returned.
+ */
+static int display_cgroup_json(FILE *out, struct cgroup *group,
+			       char controller[CG_CONTROLLER_MAX][FILENAME_MAX],
+			       const char *group_path, int root_path_len, int first)
+{
+	struct cgroup_controller *group_controller = NULL;
+	struct group_perm perm;
+	bool first_ctrl = true;
+	bool first_var;
+	char *value = NULL;
+	int nr_var = 0;
+	int i, j;
+	int ret = 0;
+	char *name;
+
+	/* the record displays the owners of the first hierarchy */
+	ret = read_permissions(&perm, group_path, group->name, controller[0]);
+	if (ret)
+		return ret;
+
+	fputs("{\"group\":{\"name\":", out);
+	print_json_string(out, group->name);
+
+	if (perm.nonroot) {
+		fputs(",\"perm\":{\"admin\":{\"uid\":", out);
+		print_json_string(out, perm.admin_uid);
+		fputs(",\"gid\":", out);
+		print_json_string(out, perm.admin_gid);
+		fputs("},\"task\":{\"uid\":", out);
+		print_json_string(out, perm.task_uid);
+		fputs(",\"gid\":", out);
+		print_json_string(out, perm.task_gid);
+		fputs("}}", out);
+	}
+
+	fputs(",\"controllers\":{", out);
+
+	for (i = 0; controller[i][0] != '\0'; i++) {
+		group_controller = cgroup_get_controller(group, controller[i]);
+		if (group_controller == NULL) {
+			info("cannot find controller '%s' in group '%s'\n", controller[i],
+			     group->name);
+			continue;
+		}
+
+		if (!first_ctrl)
+			fputc(',', out);
+		first_ctrl = false;
+		print_json_string(out, controller[i]);
+		fputs(":{", out);
+
+		first_var = true;
+		nr_var = cgroup_get_value_name_count(group_controller);
+		for (j = 0; j < nr_var; j++) {
+			name = cgroup_get_value_name(group_controller, j);
+
+			if (!is_variable_shown(name, group_path, root_path_len, first))
+				continue;
+
+			ret = cgroup_get_value_string(group_controller, name, &value);
+			if (ret != 0) {
+				err("ERROR: Value of variable %s can be read\n", name);
+				return ret;
+			}
+
+			if (!first_var)
+				fputc(',', out);
+			first_var = false;
+
+			if (strcmp("devices.list", name) == 0) {
+				fputs("\"devices.deny\":\"a *:* rwm\",", out);
+				name = "devices.allow";
+			}
+
+			print_json_string(out, name);
+			fputc(':', out);
+			print_json_value(out, value);
+			free(value);
+		}
+		fputc('}', out);
+	}
+
+	fputs("}}}", out);
+
+	return 0;
+}
+
+/*
+ * Display the JSON record of a group into a string
+ * @return The record, NULL if it could not be displayed
+ */
+static char *render_cgroup_json(struct cgroup *group,
+				char controller[CG_CONTROLLER_MAX][FILENAME_MAX],
+				const char *group_path, int root_path_len, int first)
+{
+	char *record = NULL;
+	size_t size;
+	FILE *out;
+	int ret;
+
+	out = open_memstream(&record, &size);
+	if (out == NULL)
+		return NULL;
+
+	ret = display_cgroup_json(out, group, controller, group_path, root_path_len, first);
+	fclose(out);
+	if (ret) {
+		free(record);
+		return NULL;
+	}
+
+	return record;
+}
+
+static void emit_json_record(const char *record)
+{
+	json_record_begin(&json);
+	fputs(record, output_f);
+	json_record_end(&json);
+}
+
+/* An entry of a group record, the perm block or a variable of a controller */
+struct record_entry {
+	const char *section;	/* header line of the controller, NULL for perm */
+	int section_len;
+	const char *name;
+	int name_len;
+	const char *text;	/* the lines of the entry */
+	int len;
+};
+
+/*
+ * Split a record written by display_cgroup_data() into its entries
+ * @return The entries, count is set to -1 if they could not be allocated
+ */
+static struct record_entry *parse_record(const char *record, int *count)
+{
+	struct record_entry *entries = NULL, *tmp, *e;
+	const char *section = NULL, *line, *end;
+	int section_len = 0, alloc = 0;
+
+	*count = 0;
+
+	/* after the header of the group */
+	for (line = next_line(record); *line; line = end) {
+		end = next_line(line);
+
+		/* the closing brace of the group */
+		if (section == NULL && line[0] != '\t')
+			break;
+
+		if (section != NULL && strncmp(line, "\t}\n", 3) == 0) {
+			section = NULL;
+			continue;
+		}
+
+		if (section == NULL && strncmp(line, "\tperm {\n", 8) != 0) {
+			section = line;
+			section_len = end - line;
+			continue;
+		}
+
+		if (*count == alloc) {
+			alloc = alloc ? alloc * 2 : 32;
+			tmp = realloc(entries, alloc * sizeof(struct record_entry));
+			if (tmp == NULL) {
+				free(entries);
+				*count = -1;
+				return NULL;
+			}
+			entries = tmp;
+		}
+
+		e = &entries[(*count)++];
+		e->section = section;
+		e->section_len = section ? section_len : 0;
+		e->text = line;
+
+		if (section == NULL) {
+			/* the perm block, up to its closing brace */
+			e->name = "perm";
+			e->name_len = 4;
+			while (*end && strncmp(end, "\t}\n", 3) != 0)
+				end = next_line(end);
+			end = next_line(end);
+		} else {
+			/* a value may span several lines, up to its closing quote */
+			e->name = line + 2;
+			e->name_len = strcspn(e->name, "=\n");
+			while (*end && strncmp(end - 3, "\";\n", 3) != 0)
+				end = next_line(end);
+		}
+
+		e->len = end - line;
+	}
+
+	return entries;
+}
+
+static bool same_section(const struct record_entry * const a, const struct record_entry * const b)
+{
+	if (a->section_len != b->section_len)
+		return false;
+
+	return a->section_len == 0 || memcmp(a->section, b->section, a->section_len) == 0;
+}
+
+static const struct record_entry *find_entry(const struct record_entry * const entries, int count,
+					     const struct record_entry * const entry)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (same_section(&entries[i], entry) && entries[i].name_len == entry->name_len &&
+		    memcmp(entries[i].name, entry->name, entry->name_len) == 0)
+			return &entries[i];
+	}
+
+	return NULL;
+}
+
+static bool find_section(const struct record_entry * const entries, int count,
+			 const struct record_entry * const entry)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (same_section(&entries[i], entry))
+			return true;
+	}
+
+	return false;
+}
+
+/* Display the header of the controller of entry, once */
+static void open_section(FILE *out, const struct record_entry * const entry, bool *open)
+{
+	if (!*open && entry->section != NULL)
+		fwrite(entry->section, 1, entry->section_len, out);
+	*open = true;
+}
+
+/*
+ * Display what changed in the record of a group since the baseline: the
+ * entries which were added or changed, and a comment for the ones which
+ * were removed
+ */
+static void display_record_changes(FILE *out, const char *record, const char *prev)
+{
+	struct record_entry *entries, *prev_entries;
+	const struct record_entry *found;
+	int count, prev_count;
+	int i, j, k;
+	bool open;
+
+	entries = parse_record(record, &count);
+	prev_entries = parse_record(prev, &prev_count);
+	if (count < 0 || prev_count < 0) {
+		fputs(record, out);
+		goto out;
+	}
+
+	/* the header of the group */
+	fwrite(record, 1, next_line(record) - record, out);
+
+	/* the entries of a controller follow each other */
+	for (i = 0; i < count; i = j) {
+		open = false;
+
+		for (j = i; j < count && same_section(&entries[i], &entries[j]); j++) {
+			found = find_entry(prev_entries, prev_count, &entries[j]);
+			if (found != NULL && found->len == entries[j].len &&
+			    memcmp(found->text, entries[j].text, found->len) == 0)
+				continue;
+
+			open_section(out, &entries[i], &open);
+			fwrite(entries[j].text, 1, entries[j].len, out);
+		}
+
+		for (k = 0; k < prev_count; k++) {
+			if (!same_section(&prev_entries[k], &entries[i]) ||
+			    find_entry(&entries[i], j - i, &prev_entries[k]) != NULL)
+				continue;
+
+			open_section(out, &entries[i], &open);
+			fprintf(out, "%s# removed %.*s\n", entries[i].section ? "\t\t" : "\t",
+				prev_entries[k].name_len, prev_entries[k].name);
+		}
+
+		if (open && entries[i].section != NULL)
+			fputs("\t}\n", out);
+	}
+
+	/* the controllers which are gone, "\tcpu {\n" */
+	for (k = 0; k < prev_count; k = j) {
+		for (j = k + 1; j < prev_count && same_section(&prev_entries[k], &prev_entries[j]); j++)
+			;
+
+		if (find_section(entries, count, &prev_entries[k]) ||
+		    find_section(prev_entries, k, &prev_entries[k]))
+			continue;
+
+		if (prev_entries[k].section != NULL)
+			fprintf(out, "\t# removed %.*s\n", prev_entries[k].section_len - 4,
+				prev_entries[k].section + 1);
+		else
+			fputs("\t# removed perm\n", out);
+	}
+
+	fputs("}\n\n", out);
+
+out:
+	free(entries);
+	free(prev_entries);
+}
+
+/*
+ * Display the text record of a group, or with --baseline only what changed
+ * since the baseline
+ */
+static void emit_text_record(const char *name, const char *record)
+{
+	char controller[FILENAME_MAX], key[FILENAME_MAX * 2];
+	struct deny_list_type *prev;
+
+	if (!(flags & FL_BASELINE)) {
+		fputs(record, output_f);
+		return;
+	}
+
+	record_controller(record, controller, sizeof(controller));
+	snprintf(key, sizeof(key), "%s:%s", controller, name);
+
+	prev = list_find(&baseline, key, list_hash(key));
+	if (prev == NULL) {
+		fputs(record, output_f);
+		return;
+	}
+
+	prev->seen = true;
+	if (strcmp(record, prev->record) != 0)
+		display_record_changes(output_f, record, prev->record);
+}
+
+/* Display the groups of the baseline which were not found */
+static void display_removed_groups(void)
+{
+	const char *key, *name;
+	int i;
+
+	for (i = 0; i < baseline_count; i++) {
+		if (baseline_order[i]->seen)
+			continue;
+
+		/* "controller:group" */
+		key = baseline_order[i]->name;
+		name = strchr(key, ':') + 1;
+		fprintf(output_f, "# removed group %s (%.*s)\n", name, (int)(name - key - 1), key);
+	}
+}
+
+/*
+ * Display the text record of a group into a string
+ * @return The record, NULL if it could not be allocated
+ */
+static char *render_cgroup_data(struct cgroup *group,
+				char controller[CG_CONTROLLER_MAX][FILENAME_MAX],
+				const char *group_path, int root_path_len, int first,
+				const char *program_name)
+{
+	char *record = NULL;
+	size_t size;
+	FILE *out;
+
+	out = open_memstream(&record, &size);
+	if (out == NULL)
+		return NULL;
+
+	/* like the serial walk, what was displayed is kept on error */
+	display_cgroup_data(out, group, controller, group_path, root_path_len, first,
+			    program_name);
+	fclose(out);
+
+	return record;
+}
+
+struct snapshot_walk {
+	char (*controller)[FILENAME_MAX];
+	const char *program_name;
+	int prefix_len;
+};
+
+/*
+ * Read a group on one of the threads of the walk, its record is displayed
+ * into a buffer which is written by snapshot_emit()
+ */
+static int snapshot_visit(const struct cgroup_file_info *info, void *userdata, void **result)
+{
+	struct snapshot_walk *walk = userdata;
+	struct cgroup *group;
+	int ret;
+
+	group = cgroup_new_cgroup(&info->full_path[walk->prefix_len]);
+	if (group == NULL) {
+		info("cannot create group '%s'\n", &info->full_path[walk->prefix_len]);
+		return ECGFAIL;
+	}
+
+	ret = cgroup_get_cgroup(group);
+	if (ret != 0) {
+		/* See display_controller_data() */
+		if (ret != ECGROUPNOTEXIST)
+			info("cannot read group '%s': %s %d\n", group->name, cgroup_strerror(ret),
+			     ret);
+		else
+			ret = 0;
+		goto out;
+	}
+
+	if (format != FORMAT_TEXT) {
+		*result = render_cgroup_json(group, walk->controller, info->full_path,
+					     walk->prefix_len, info->depth == 0);
+		goto out;
+	}
+
+	*result = render_cgroup_data(group, walk->controller, info->full_path, walk->prefix_len,
+				     info->depth == 0, walk->program_name);
+	if (*result == NULL)
+		ret = ECGOTHER;
+
+out:
+	cgroup_free(&group);
+
+	return ret;
+}
+
+static int snapshot_emit(const struct cgroup_file_info *info, void *result, void *userdata)
+{
+	struct snapshot_walk *walk = userdata;
+
+	/*
+	 * The root group is only read for the warnings about the variables,
+	 * like in the serial walk it is not displayed
+	 */
+	if (info->depth == 0) {
+		free(result);
+		return 0;
+	}
+
+	if (result != NULL && format != FORMAT_TEXT)
+		emit_json_record(result);
+	else if (result != NULL)
+		emit_text_record(&info->full_path[walk->prefix_len], result);
+	free(result);
+
+	return 0;
+}
+
 /*
  * creates the record about the hierarchies which contains
  * "controller" subsystem
@@ -440,8 +1196,10 @@ static int display_controller_data(char controller[CG_CONTROLLER_MAX][FILENAME_M
 				   const char *program_name)
 {
 	char cgroup_name[FILENAME_MAX];
+	struct cgroup_arena *arena = NULL;
 	struct cgroup_file_info info;
 	struct cgroup *group = NULL;
+	char *record;
 	int prefix_len;
 	void *handle;
 	int first = 1;
@@ -458,6 +1216,31 @@ static int display_controller_data(char controller[CG_CONTROLLER_MAX][FILENAME_M
 
 	prefix_len = strlen(info.full_path);
 
+	if (jobs > 1) {
+		struct snapshot_walk walk = {
+			.controller = controller,
+			.program_name = program_name,
+			.prefix_len = prefix_len,
+		};
+
+		cgroup_walk_tree_end(&handle);
+
+		return cgroup_walk_tree_parallel(controller[0], "/", 0, jobs,
+						 CGROUP_WALK_PARALLEL_SORTED, snapshot_visit,
+						 snapshot_emit, &walk);
+	}
+
+	ret = cgroup_walk_tree_set_flags(&handle, CGROUP_WALK_TYPE_DIRS_ONLY);
+	if (ret)
+		goto err;
+
+	/* The groups are only read and displayed, they are all freed at once */
+	arena = cgroup_arena_new();
+	if (arena == NULL) {
+		ret = ECGOTHER;
+		goto err;
+	}
+
 	/* go through all files and directories */
 	while ((ret = cgroup_walk_tree_next(0, &handle, &info, lvl)) == 0) {
 		/* some group starts here */
@@ -467,7 +1250,7 @@ static int display_controller_data(char controller[CG_CONTROLLER_MAX][FILENAME_M
 			cgroup_name[FILENAME_MAX-1] = '\0';
 
 			/* start to grab data about the new group */
-			group = cgroup_new_cgroup(cgroup_name);
+			group = cgroup_new_cgroup_arena(cgroup_name, arena);
 			if (group == NULL) {
 				info("cannot create group '%s'\n", cgroup_name);
 				ret = ECGFAIL;
@@ -489,15 +1272,30 @@ static int display_controller_data(char controller[CG_CONTROLLER_MAX][FILENAME_M
 				}
 			}
 
-			if (ret == 0)
-				display_cgroup_data(group, controller, info.full_path, prefix_len,
-						    first, program_name);
+			if (ret == 0 && format != FORMAT_TEXT) {
+				record = render_cgroup_json(group, controller, info.full_path,
+							    prefix_len, first);
+				if (record != NULL)
+					emit_json_record(record);
+				free(record);
+			} else if (ret == 0 && (flags & FL_BASELINE)) {
+				record = render_cgroup_data(group, controller, info.full_path,
+							    prefix_len, first, program_name);
+				if (record != NULL)
+					emit_text_record(group->name, record);
+				free(record);
+			} else if (ret == 0) {
+				display_cgroup_data(output_f, group, controller, info.full_path,
+						    prefix_len, first, program_name);
+			}
 			first = 0;
 			cgroup_free(&group);
+			cgroup_arena_reset(arena);
 		}
 	}
 
 err:
+	cgroup_arena_free(&arena);
 	cgroup_walk_tree_end(&handle);
 	if (ret == ECGEOF)
 		ret = 0;
@@ -622,10 +1420,19 @@ static int show_mountpoints(const char *controller)
 		return ret;
 
 	while (ret == 0) {
-		if (quote)
+		if (format != FORMAT_TEXT) {
+			json_record_begin(&json);
+			fputs("{\"mount\":{\"controller\":", output_f);
+			print_json_string(output_f, controller);
+			fputs(",\"path\":", output_f);
+			print_json_string(output_f, path);
+			fputs("}}", output_f);
+			json_record_end(&json);
+		} else if (quote) {
 			fprintf(output_f, "\t\"%s\" = %s;\n", controller, path);
-		else
+		} else {
 			fprintf(output_f, "\t%s = %s;\n", controller, path);
+		}
 		ret = cgroup_get_subsys_mount_point_next(&handle, path);
 	}
 	cgroup_get_subsys_mount_point_end(&handle);
@@ -679,7 +1486,8 @@ static int parse_mountpoints(cont_name_t cont_names[CG_CONTROLLER_MAX], const ch
 	void *handle;
 
 	/* start mount section */
-	fprintf(output_f, "mount {\n");
+	if (format == FORMAT_TEXT)
+		fprintf(output_f, "mount {\n");
 
 	/* go through the controller list */
 	ret = cgroup_get_all_controller_begin(&handle, &info);
@@ -720,11 +1528,38 @@ static int parse_mountpoints(cont_name_t cont_names[CG_CONTROLLER_MAX], const ch
 	cgroup_get_controller_end(&handle);
 
 	/* finish mount section */
-	fprintf(output_f, "}\n\n");
+	if (format == FORMAT_TEXT)
+		fprintf(output_f, "}\n\n");
 
 	return final_ret;
 }
 
+/* Display the mount section only if it changed since the baseline */
+static int display_mount_changes(cont_name_t cont_names[CG_CONTROLLER_MAX],
+				 const char *program_name)
+{
+	FILE *out = output_f;
+	char *mount = NULL;
+	size_t size;
+	int ret;
+
+	output_f = open_memstream(&mount, &size);
+	if (output_f == NULL) {
+		output_f = out;
+		return parse_mountpoints(cont_names, program_name);
+	}
+
+	ret = parse_mountpoints(cont_names, program_name);
+	fclose(output_f);
+	output_f = out;
+
+	if (baseline_mount == NULL || strcmp(mount, baseline_mount) != 0)
+		fputs(mount, output_f);
+	free(mount);
+
+	return ret;
+}
+
 int main(int argc, char *argv[])
 {
 	static struct option long_opts[] = {
@@ -734,6 +1569,9 @@ int main(int argc, char *argv[])
 		{"allowlist",	required_argument, NULL, 'w'},
 		{"strict",	      no_argument, NULL, 't'},
 		{"file",	required_argument, NULL, 'f'},
+		{"jobs",	required_argument, NULL, 'j'},
+		{"format",	required_argument, NULL, 'F'},
+		{"baseline",	required_argument, NULL, 'B'},
 		{0, 0, 0, 0}
 	};
 
@@ -750,7 +1588,7 @@ int main(int argc, char *argv[])
 	flags = 0;
 
 	/* parse arguments */
-	while ((c = getopt_long(argc, argv, "hsb:w:tf:", long_opts, NULL)) > 0) {
+	while ((c = getopt_long(argc, argv, "hsb:w:tf:j:", long_opts, NULL)) > 0) {
 		switch (c) {
 		case 'h':
 			usage(0, argv[0]);
@@ -779,6 +1617,21 @@ int main(int argc, char *argv[])
 				return ECGOTHER;
 			}
 			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1) {
+				err("%s: Invalid number of jobs %s\n", argv[0], optarg);
+				return EXIT_BADARGS;
+			}
+			break;
+		case 'F':
+			if (parse_format(optarg, &format, argv[0]))
+				return EXIT_BADARGS;
+			break;
+		case 'B':
+			flags |= FL_BASELINE;
+			baseline_file = optarg;
+			break;
 		default:
 			usage(1, argv[0]);
 			exit(EXIT_BADARGS);
@@ -798,9 +1651,21 @@ int main(int argc, char *argv[])
 		}
 	}
 
+	/* the baseline is a snapshot in the text format, so are the changes */
+	if ((flags & FL_BASELINE) && format != FORMAT_TEXT) {
+		err("%s: --baseline is only supported with the text format\n", argv[0]);
+		return EXIT_BADARGS;
+	}
+
 	if ((flags & FL_OUTPUT) == 0)
 		output_f = stdout;
 
+	/*
+	 * The configuration is written in large blocks, even to a terminal,
+	 * rather than a write per line or per stdio buffer of a few pages
+	 */
+	setvbuf(output_f, NULL, _IOFBF, OUTPUT_BUF_SIZE);
+
 	/* denylist */
 	if (flags & FL_DENY) {
 		ret  = load_list(bl_file, &deny_list);
@@ -821,8 +1686,18 @@ int main(int argc, char *argv[])
 		goto finish;
 	}
 
+	if ((flags & FL_BASELINE) && load_baseline(baseline_file)) {
+		ret = EXIT_BADARGS;
+		goto finish;
+	}
+
 	/* print the header */
-	fprintf(output_f, "# Configuration file generated by cgsnapshot\n");
+	if (flags & FL_BASELINE)
+		fprintf(output_f, "# Changes since %s generated by cgsnapshot\n", baseline_file);
+	else if (format == FORMAT_TEXT)
+		fprintf(output_f, "# Configuration file generated by cgsnapshot\n");
+	else
+		json_stream_begin(&json, output_f, format);
 
 	/* initialize libcgroup */
 	ret = cgroup_init();
@@ -831,7 +1706,10 @@ int main(int argc, char *argv[])
 		goto finish;
 
 	/* print mount points section */
-	ret = parse_mountpoints(wanted_cont, argv[0]);
+	if (flags & FL_BASELINE)
+		ret = display_mount_changes(wanted_cont, argv[0]);
+	else
+		ret = parse_mountpoints(wanted_cont, argv[0]);
 	ret = ret ? EXIT_BADARGS : 0;
 	/* continue with processing on error*/
 
@@ -841,9 +1719,20 @@ int main(int argc, char *argv[])
 	if (err)
 		ret = err;
 
+	/* a group which could not be read is reported as removed */
+	if (flags & FL_BASELINE)
+		display_removed_groups();
+
 finish:
-	free_list(deny_list);
-	free_list(allow_list);
+	/* the records are streamed, terminate them even on error */
+	if (json.out != NULL)
+		json_stream_end(&json);
+
+	free_list(&deny_list);
+	free_list(&allow_list);
+	free_list(&baseline);
+	free(baseline_order);
+	free(baseline_mount);
 
 	if (output_f != stdout)
 		fclose(output_f);
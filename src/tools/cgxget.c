@@ -499,7 +499,8 @@ static int get_cv_value(struct control_value * const cv, const char * const cg_n
 {
 	bool is_multiline = false;
 	char tmp_line[LL_MAX];
-	void *handle, *tmp;
+	void *handle = NULL, *tmp;
+	char *value;
 	int ret;
 
 	ret = cgroup_read_value_begin(controller_name, cg_name, cv->name, &handle, tmp_line,
@@ -530,7 +531,14 @@ static int get_cv_value(struct control_value * const cv, const char * const cg_n
 	/* remove the newline character */
 	tmp_line[strcspn(tmp_line, "\n")] = '\0';
 
-	strncpy(cv->value, tmp_line, CG_CONTROL_VALUE_MAX - 1);
+	value = strdup(tmp_line);
+	if (value == NULL) {
+		ret = ECGOTHER;
+		goto read_end;
+	}
+	free(cv->value);
+	cv->value = value;
+
 	cv->multiline_value = strdup(cv->value);
 	if (cv->multiline_value == NULL)
 		goto read_end;
@@ -555,7 +563,6 @@ static int get_cv_value(struct control_value * const cv, const char * const cg_n
 	}
 
 read_end:
-	cgroup_read_value_end(&handle);
 	if (ret == ECGEOF)
 		ret = 0;
 end:
@@ -564,6 +571,9 @@ end:
 		cv->multiline_value = NULL;
 	}
 
+	if (handle)
+		cgroup_read_value_end(&handle);
+
 	return ret;
 }
 
@@ -701,6 +711,11 @@ static int get_controller_values(struct cgroup * const cg, struct cgroup_control
 	int ret = 0;
 	int i;
 
+	/* The values of a copied group are shared until they are read */
+	ret = cg_own_values(cgc);
+	if (ret)
+		goto out;
+
 	for (i = 0; i < cgc->index; i++) {
 		ret = get_cv_value(cgc->values[i], cg->name, cgc->name);
 		if (ret)
@@ -788,45 +803,25 @@ static void print_cgroups(struct cgroup *cg_list[], int cg_list_len, int mode)
 		print_cgroup(cg_list[i], mode);
 }
 
-static int convert_cgroups(struct cgroup **cg_list[], int cg_list_len,
+static int convert_cgroups(struct cgroup *cg_list[], int cg_list_len,
 			   enum cg_version_t in_version, enum cg_version_t out_version)
 {
-	struct cgroup **cg_converted_list;
-	int i = 0, j, ret = 0;
-
-	cg_converted_list = malloc(cg_list_len * sizeof(struct cgroup *));
-	if (cg_converted_list == NULL)
-		goto out;
+	bool unmappable = false;
+	int i, ret = 0;
 
 	for (i = 0; i < cg_list_len; i++) {
-		cg_converted_list[i] = cgroup_new_cgroup((*cg_list)[i]->name);
-		if (cg_converted_list[i] == NULL) {
-			ret = ECGCONTROLLERCREATEFAILED;
-			goto out;
+		ret = cgroup_convert_cgroup_inplace(cg_list[i], out_version, in_version);
+		if (ret == ECGNOVERSIONCONVERT) {
+			/* The unmappable settings were dropped, convert the other cgroups */
+			unmappable = true;
+			ret = 0;
+		} else if (ret) {
+			return ret;
 		}
-
-		ret = cgroup_convert_cgroup(cg_converted_list[i], out_version, (*cg_list)[i],
-					    in_version);
-		if (ret)
-			goto out;
 	}
 
-out:
-	if (ret != 0 && ret != ECGNOVERSIONCONVERT) {
-		/* The conversion failed */
-		for (j = 0; j < i; j++)
-			cgroup_free(&(cg_converted_list[j]));
-		free(cg_converted_list);
-	} else {
-		/*
-		 * The conversion succeeded or was unmappable.
-		 * Free the old list.
-		 */
-		for (i = 0; i < cg_list_len; i++)
-			cgroup_free(&(*cg_list)[i]);
-
-		*cg_list = cg_converted_list;
-	}
+	if (unmappable)
+		ret = ECGNOVERSIONCONVERT;
 
 	return ret;
 }
@@ -860,7 +855,7 @@ int main(int argc, char *argv[])
 	if (mode & MODE_SYSTEMD_DELEGATE)
 		cgroup_set_default_systemd_cgroup();
 
-	ret = convert_cgroups(&cg_list, cg_list_len, version, CGROUP_DISK);
+	ret = convert_cgroups(cg_list, cg_list_len, version, CGROUP_DISK);
 	if ((ret && ret != ECGNOVERSIONCONVERT) ||
 	    (ret == ECGNOVERSIONCONVERT && !ignore_unmappable))
 		/*
@@ -874,7 +869,7 @@ int main(int argc, char *argv[])
 	if (ret)
 		goto err;
 
-	ret = convert_cgroups(&cg_list, cg_list_len, CGROUP_DISK, version);
+	ret = convert_cgroups(cg_list, cg_list_len, CGROUP_DISK, version);
 	if (ret)
 		goto err;
 
@@ -891,7 +886,7 @@ err:
 #ifdef LIBCG_LIB
 int cgroup_cgxget(struct cgroup **cg, enum cg_version_t version, bool ignore_unmappable)
 {
-	struct cgroup *disk_cg, *out_cg;
+	struct cgroup *disk_cg = NULL;
 	int ret;
 
 	if (!cg || !(*cg)) {
@@ -915,20 +910,13 @@ int cgroup_cgxget(struct cgroup **cg, enum cg_version_t version, bool ignore_unm
 	if (ret)
 		goto out;
 
-	out_cg = cgroup_new_cgroup((*cg)->name);
-	if (!out_cg) {
-		ret = ECGCONTROLLERCREATEFAILED;
-		goto out;
-	}
-
-	ret = cgroup_convert_cgroup(out_cg, version, disk_cg, CGROUP_DISK);
-	if (ret) {
-		cgroup_free(&out_cg);
+	ret = cgroup_convert_cgroup_inplace(disk_cg, version, CGROUP_DISK);
+	if (ret)
 		goto out;
-	}
 
 	cgroup_free(cg);
-	*cg = out_cg;
+	*cg = disk_cg;
+	disk_cg = NULL;
 
 out:
 	if (disk_cg)
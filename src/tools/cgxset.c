@@ -95,6 +95,9 @@ STATIC int parse_r_flag(const char * const program_name, const char * const name
 	char *copy = NULL, *buf = NULL;
 	int ret = 0;
 
+	name_value->name = NULL;
+	name_value->value = NULL;
+
 	buf = strchr(name_value_str, '=');
 	if (buf == NULL) {
 		err("%s: wrong parameter of option -r: %s\n", program_name, optarg);
@@ -117,8 +120,12 @@ STATIC int parse_r_flag(const char * const program_name, const char * const name
 		goto err;
 	}
 
-	strncpy(name_value->name, buf, FILENAME_MAX);
-	name_value->name[FILENAME_MAX-1] = '\0';
+	name_value->name = strndup(buf, FILENAME_MAX - 1);
+	if (name_value->name == NULL) {
+		err("%s: not enough memory\n", program_name);
+		ret = -1;
+		goto err;
+	}
 
 	buf = strchr(name_value_str, '=');
 	/*
@@ -133,10 +140,18 @@ STATIC int parse_r_flag(const char * const program_name, const char * const name
 		goto err;
 	}
 
-	strncpy(name_value->value, buf, CG_CONTROL_VALUE_MAX);
-	name_value->value[CG_CONTROL_VALUE_MAX-1] = '\0';
+	name_value->value = strndup(buf, CG_CONTROL_VALUE_MAX - 1);
+	if (name_value->value == NULL) {
+		err("%s: not enough memory\n", program_name);
+		ret = -1;
+	}
 
 err:
+	if (ret) {
+		free((char *)name_value->name);
+		name_value->name = NULL;
+	}
+
 	if (copy)
 		free(copy);
 
@@ -159,7 +174,7 @@ int main(int argc, char *argv[])
 	enum cg_version_t src_version = CGROUP_UNK;
 	bool ignore_unmappable = false;
 	int ret = 0;
-	int c;
+	int c, i;
 
 	/* no parameter on input */
 	if (argc < 2) {
@@ -337,6 +352,10 @@ err:
 		cgroup_free(&cgroup);
 	if (src_cgroup)
 		cgroup_free(&src_cgroup);
+	for (i = 0; i < nv_number; i++) {
+		free((char *)name_value[i].name);
+		free(name_value[i].value);
+	}
 	free(name_value);
 
 	return ret;
@@ -42,11 +42,12 @@ static void usage(int status, const char *program_name)
 		return;
 	}
 
-	info("Usage: %s [-h] [[-g] <controllers>:<path>] [...]\n", program_name);
+	info("Usage: %s [-h] [-j N] [[-g] <controllers>:<path>] [...]\n", program_name);
 	info("List all cgroups\n");
 	info("  -g <controllers>:<path>	Control group to be ");
 	info("displayed (-g is optional)\n");
 	info("  -h, --help			Display this help\n");
+	info("  -j, --jobs=N			Walk the groups with N threads\n");
 #ifdef WITH_SYSTEMD
 	info("  -b				Ignore default systemd delegate hierarchy\n");
 #endif
@@ -68,7 +69,7 @@ static int is_ctlr_on_list(struct cgroup_group_spec *cgroup_list, const char *na
 	return 0;
 }
 
-static void print_info(struct cgroup_file_info *info, char *name, int pref)
+static void print_info(const struct cgroup_file_info *info, const char *name, int pref)
 {
 	if (info->type == CGROUP_FILE_TYPE_DIR) {
 		if (info->full_path[pref] ==  '/')
@@ -78,6 +79,23 @@ static void print_info(struct cgroup_file_info *info, char *name, int pref)
 	}
 }
 
+/* Number of threads walking the groups, set by -j */
+static int jobs;
+
+struct list_walk {
+	const char *name;
+	int len;
+};
+
+static int list_emit(const struct cgroup_file_info *info, void *result, void *userdata)
+{
+	struct list_walk *walk = userdata;
+
+	print_info(info, walk->name, walk->len);
+
+	return 0;
+}
+
 /* display controller:/input_path cgroups */
 static int display_controller_data(char *input_path, char *controller, char *name)
 {
@@ -102,6 +120,26 @@ static int display_controller_data(char *input_path, char *controller, char *nam
 	/* remove problematic  '/' characters from input directory path */
 	trim_filepath(input_dir_path);
 	len  = strlen(cgroup_dir_path) - strlen(input_dir_path);
+
+	if (jobs > 1) {
+		struct list_walk walk = {
+			.name = name,
+			.len = len,
+		};
+
+		cgroup_walk_tree_end(&handle);
+
+		return cgroup_walk_tree_parallel(controller, input_path, 0, jobs, 0, NULL,
+						 list_emit, &walk);
+	}
+
+	/* Only the groups are listed, the control files are not even stat'ed */
+	ret = cgroup_walk_tree_set_flags(&handle, CGROUP_WALK_TYPE_DIRS_ONLY);
+	if (ret) {
+		cgroup_walk_tree_end(&handle);
+		return ret;
+	}
+
 	print_info(&info, name, len);
 
 	while ((ret = cgroup_walk_tree_next(0, &handle, &info, lvl)) == 0)
@@ -242,6 +280,7 @@ int main(int argc, char *argv[])
 	static struct option options[] = {
 		{"help", 0, 0, 'h'},
 		{"group", required_argument, NULL, 'g'},
+		{"jobs", required_argument, NULL, 'j'},
 		{0, 0, 0, 0}
 	};
 
@@ -256,13 +295,13 @@ int main(int argc, char *argv[])
 
 	/* parse arguments */
 #ifdef WITH_SYSTEMD
-	while ((c = getopt_long(argc, argv, "hg:b", options, NULL)) > 0) {
+	while ((c = getopt_long(argc, argv, "hg:bj:", options, NULL)) > 0) {
 		switch (c) {
 		case 'b':
 			ignore_default_systemd_delegate_slice = 1;
 			break;
 #else
-	while ((c = getopt_long(argc, argv, "hg:", options, NULL)) > 0) {
+	while ((c = getopt_long(argc, argv, "hg:j:", options, NULL)) > 0) {
 		switch (c) {
 #endif
 		case 'h':
@@ -277,6 +316,14 @@ int main(int argc, char *argv[])
 				return ret;
 			}
 			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1) {
+				err("%s: Invalid number of jobs %s\n", argv[0], optarg);
+				ret = EXIT_BADARGS;
+				goto err;
+			}
+			break;
 		default:
 			usage(1, argv[0]);
 			ret = EXIT_BADARGS;
@@ -311,3 +311,125 @@ int parse_uid_gid(char *string, uid_t *uid, gid_t *gid, const char *program_name
 
 	return 0;
 }
+
+int parse_format(const char * const string, enum output_format * const format,
+		 const char * const program_name)
+{
+	if (strcmp(string, "text") == 0)
+		*format = FORMAT_TEXT;
+	else if (strcmp(string, "json") == 0)
+		*format = FORMAT_JSON;
+	else if (strcmp(string, "ndjson") == 0)
+		*format = FORMAT_NDJSON;
+	else {
+		fprintf(stderr, "%s: unknown format %s\n", program_name, string);
+		return -1;
+	}
+
+	return 0;
+}
+
+void print_json_string(FILE *out, const char * const string)
+{
+	const unsigned char *c;
+
+	fputc('"', out);
+	for (c = (const unsigned char *)string; *c != '\0'; c++) {
+		switch (*c) {
+		case '"':
+			fputs("\\\"", out);
+			break;
+		case '\\':
+			fputs("\\\\", out);
+			break;
+		case '\n':
+			fputs("\\n", out);
+			break;
+		case '\t':
+			fputs("\\t", out);
+			break;
+		default:
+			if (*c < 0x20)
+				fprintf(out, "\\u%04x", *c);
+			else
+				fputc(*c, out);
+		}
+	}
+	fputc('"', out);
+}
+
+/* Check if a string is a number of the JSON grammar, e.g. 1024 or -1.5e3 */
+static bool is_json_number(const char *str)
+{
+	if (*str == '-')
+		str++;
+
+	if (*str == '0')
+		str++;
+	else if (*str >= '1' && *str <= '9')
+		while (*str >= '0' && *str <= '9')
+			str++;
+	else
+		return false;
+
+	if (*str == '.') {
+		str++;
+		if (*str < '0' || *str > '9')
+			return false;
+		while (*str >= '0' && *str <= '9')
+			str++;
+	}
+
+	if (*str == 'e' || *str == 'E') {
+		str++;
+		if (*str == '+' || *str == '-')
+			str++;
+		if (*str < '0' || *str > '9')
+			return false;
+		while (*str >= '0' && *str <= '9')
+			str++;
+	}
+
+	return *str == '\0';
+}
+
+void print_json_value(FILE *out, const char * const value)
+{
+	if (is_json_number(value))
+		fputs(value, out);
+	else
+		print_json_string(out, value);
+}
+
+void json_stream_begin(struct json_stream * const stream, FILE *out, enum output_format format)
+{
+	stream->out = out;
+	stream->format = format;
+	stream->records = 0;
+
+	if (format == FORMAT_JSON)
+		fputc('[', out);
+}
+
+void json_record_begin(struct json_stream * const stream)
+{
+	if (stream->format == FORMAT_JSON)
+		fputs(stream->records ? ",\n" : "\n", stream->out);
+	stream->records++;
+}
+
+void json_record_end(struct json_stream * const stream)
+{
+	if (stream->format == FORMAT_NDJSON)
+		fputc('\n', stream->out);
+
+	/* A reader of a pipe gets each record as soon as it is printed */
+	fflush(stream->out);
+}
+
+void json_stream_end(struct json_stream * const stream)
+{
+	if (stream->format == FORMAT_JSON)
+		fputs(stream->records ? "\n]\n" : "]\n", stream->out);
+	fflush(stream->out);
+}
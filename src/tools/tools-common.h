@@ -19,12 +19,6 @@ extern "C" {
 
 #include <libcgroup.h>
 
-#define cgroup_err(x...)	cgroup_log(CGROUP_LOG_ERROR, "Error: " x)
-#define cgroup_warn(x...)	cgroup_log(CGROUP_LOG_WARNING, "Warning: " x)
-#define cgroup_info(x...)	cgroup_log(CGROUP_LOG_INFO, "Info: " x)
-#define cgroup_dbg(x...)	cgroup_log(CGROUP_LOG_DEBUG, x)
-#define cgroup_cont(x...)	cgroup_log(CGROUP_LOG_CONT, x)
-
 #define err(x...)	fprintf(stderr, x)
 #define info(x...)	fprintf(stdout, x)
 
@@ -47,6 +41,26 @@ struct cgroup_string_list {
 	int count;
 };
 
+/**
+ * Output formats of the tools which print groups, see parse_format().
+ */
+enum output_format {
+	FORMAT_TEXT,
+	/* One JSON array of all the records */
+	FORMAT_JSON,
+	/* One JSON record per line */
+	FORMAT_NDJSON,
+};
+
+/**
+ * Stream of JSON records, written as they are produced.
+ */
+struct json_stream {
+	FILE *out;
+	enum output_format format;
+	int records;
+};
+
 /**
  * Parse command line option with group specifier into provided data structure.
  * The option must have form of 'controller1,controller2,..:group_name'.
@@ -118,6 +132,48 @@ int parse_mode(char *string, mode_t *pmode, const char *program_name);
  */
 int parse_uid_gid(char *string, uid_t *uid, gid_t *gid, const char *program_name);
 
+/**
+ * Parse the argument of --format.
+ * @param string "text", "json" or "ndjson".
+ * @param format Parsed format.
+ * @param program_name argv[0] to show error messages.
+ * @return 0 on success, -1 if the format is unknown.
+ */
+int parse_format(const char * const string, enum output_format * const format,
+		 const char * const program_name);
+
+/**
+ * Print a string as a JSON string, with its quotes.
+ */
+void print_json_string(FILE *out, const char * const string);
+
+/**
+ * Print the value of a setting as a JSON value.  Numbers are printed
+ * unquoted, any other value as a string.
+ */
+void print_json_value(FILE *out, const char * const value);
+
+/**
+ * Start a stream of JSON records.
+ */
+void json_stream_begin(struct json_stream * const stream, FILE *out, enum output_format format);
+
+/**
+ * Print what separates a record from the previous one, before printing it.
+ */
+void json_record_begin(struct json_stream * const stream);
+
+/**
+ * Print what follows a record, after printing it, and flush the record.
+ */
+void json_record_end(struct json_stream * const stream);
+
+/**
+ * Terminate a stream of JSON records.  The output remains valid JSON if the
+ * stream is terminated early because of an error.
+ */
+void json_stream_end(struct json_stream * const stream);
+
 /**
  * Functions that are defined as STATIC can be placed within the
  * UNIT_TEST ifdef.  This will allow them to be included in the unit tests
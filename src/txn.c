@@ -0,0 +1,350 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Transactions on many groups
+ *
+ * The operations of a transaction are collected first and run together by
+ * cgroup_txn_commit(): the groups are created parents first, so that the
+ * ancestors of a group and the cgroup v2 subtree_control files are only
+ * handled once and then found in the caches, the modifications of a group
+ * follow each other on the same directory, and the tasks moved to a group
+ * are written by a single cgroup_attach_tasks().
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/* In the order the operations are run */
+enum cg_txn_op_type {
+	CG_TXN_CREATE,
+	CG_TXN_MODIFY,
+	CG_TXN_ATTACH,
+};
+
+struct cg_txn_op {
+	enum cg_txn_op_type type;
+	/* Owned by the caller, NULL for the root groups of an attach */
+	struct cgroup *cgroup;
+	int ignore_ownership;
+	pid_t tid;
+	int result;
+	/* The group did not exist before the creation, the rollback removes it */
+	bool created;
+	/* The values before the modification, the rollback writes them back */
+	struct cgroup *saved;
+};
+
+struct cgroup_txn {
+	struct cg_txn_op *ops;
+	int count;
+	int alloc;
+	bool committed;
+};
+
+struct cgroup_txn *cgroup_txn_begin(void)
+{
+	struct cgroup_txn *txn;
+
+	txn = calloc(1, sizeof(struct cgroup_txn));
+	if (!txn)
+		last_errno = errno;
+
+	return txn;
+}
+
+void cgroup_txn_free(struct cgroup_txn **txn)
+{
+	int i;
+
+	if (!txn || !*txn)
+		return;
+
+	for (i = 0; i < (*txn)->count; i++)
+		cgroup_free(&(*txn)->ops[i].saved);
+
+	free((*txn)->ops);
+	free(*txn);
+	*txn = NULL;
+}
+
+static int cg_txn_add(struct cgroup_txn * const txn, enum cg_txn_op_type type,
+		      struct cgroup * const cgroup, int ignore_ownership, pid_t tid)
+{
+	struct cg_txn_op *ops, *op;
+	int alloc;
+
+	if (!txn || txn->committed)
+		return ECGINVAL;
+
+	if (txn->count == txn->alloc) {
+		alloc = txn->alloc ? txn->alloc * 2 : 16;
+		ops = realloc(txn->ops, alloc * sizeof(struct cg_txn_op));
+		if (!ops) {
+			last_errno = ENOMEM;
+			return ECGOTHER;
+		}
+		txn->ops = ops;
+		txn->alloc = alloc;
+	}
+
+	op = &txn->ops[txn->count++];
+	memset(op, 0, sizeof(struct cg_txn_op));
+	op->type = type;
+	op->cgroup = cgroup;
+	op->ignore_ownership = ignore_ownership;
+	op->tid = tid;
+	op->result = ECGFAIL;
+
+	return 0;
+}
+
+int cgroup_txn_add_create(struct cgroup_txn *txn, struct cgroup *cgroup, int ignore_ownership)
+{
+	if (!cgroup)
+		return ECGINVAL;
+
+	return cg_txn_add(txn, CG_TXN_CREATE, cgroup, ignore_ownership, 0);
+}
+
+int cgroup_txn_add_modify(struct cgroup_txn *txn, struct cgroup *cgroup)
+{
+	if (!cgroup)
+		return ECGINVAL;
+
+	return cg_txn_add(txn, CG_TXN_MODIFY, cgroup, 0, 0);
+}
+
+int cgroup_txn_add_attach(struct cgroup_txn *txn, struct cgroup *cgroup, pid_t tid)
+{
+	return cg_txn_add(txn, CG_TXN_ATTACH, cgroup, 0, tid);
+}
+
+int cgroup_txn_result(const struct cgroup_txn *txn, int op)
+{
+	if (!txn || op < 0 || op >= txn->count)
+		return ECGINVAL;
+
+	return txn->ops[op].result;
+}
+
+/*
+ * By kind, then by group name so that a parent comes before its children
+ * and the operations on a group follow each other, then in the order of
+ * addition.
+ */
+static int cg_txn_compare_ops(const void *p1, const void *p2)
+{
+	const struct cg_txn_op *op1 = *(const struct cg_txn_op * const *)p1;
+	const struct cg_txn_op *op2 = *(const struct cg_txn_op * const *)p2;
+	int ret;
+
+	if (op1->type != op2->type)
+		return op1->type < op2->type ? -1 : 1;
+
+	ret = strcmp(op1->cgroup ? op1->cgroup->name : "", op2->cgroup ? op2->cgroup->name : "");
+	if (ret)
+		return ret;
+
+	return op1 < op2 ? -1 : op1 > op2;
+}
+
+static bool cg_txn_group_exists(const struct cgroup * const cgroup)
+{
+	char path[FILENAME_MAX];
+
+	if (!cg_build_path(cgroup->name, path,
+			   cgroup->index ? cgroup->controller[0]->name : NULL))
+		return false;
+
+	return access(path, F_OK) == 0;
+}
+
+static int cg_txn_create(struct cg_txn_op * const op, const struct cg_txn_op * const prev,
+			 bool rollback)
+{
+	bool existed = false;
+
+	/* The same group added twice is created once */
+	if (prev && prev->type == CG_TXN_CREATE && prev->cgroup == op->cgroup) {
+		op->result = prev->result;
+		return op->result;
+	}
+
+	if (rollback)
+		existed = cg_txn_group_exists(op->cgroup);
+
+	op->result = cgroup_create_cgroup(op->cgroup, op->ignore_ownership);
+
+	/* A failed creation removes the group, unless only a value failed */
+	if (rollback && !existed)
+		op->created = cg_txn_group_exists(op->cgroup);
+
+	return op->result;
+}
+
+static int cg_txn_modify(struct cg_txn_op * const op, bool rollback)
+{
+	int ret;
+
+	if (rollback) {
+		op->saved = cgroup_new_cgroup(op->cgroup->name);
+		if (!op->saved) {
+			op->result = ECGOTHER;
+			return op->result;
+		}
+
+		ret = cgroup_copy_cgroup(op->saved, op->cgroup);
+		if (!ret)
+			ret = cgroup_get_cgroup_selective(op->saved);
+		if (ret) {
+			cgroup_free(&op->saved);
+			op->result = ret;
+			return ret;
+		}
+	}
+
+	op->result = cgroup_modify_cgroup(op->cgroup);
+
+	return op->result;
+}
+
+/* Move the tasks of the count operations of ops, all on the same group */
+static int cg_txn_attach(struct cg_txn_op ** const ops, int count)
+{
+	bool task_error = false;
+	int *errors = NULL;
+	pid_t *pids;
+	int ret, i;
+
+	pids = malloc(count * sizeof(pid_t));
+	errors = malloc(count * sizeof(int));
+	if (!pids || !errors) {
+		last_errno = ENOMEM;
+		ret = ECGOTHER;
+		for (i = 0; i < count; i++)
+			ops[i]->result = ret;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++)
+		pids[i] = ops[i]->tid;
+
+	ret = cgroup_attach_tasks(ops[0]->cgroup, pids, count, 0, errors);
+
+	for (i = 0; i < count; i++) {
+		ops[i]->result = errors[i];
+		if (errors[i])
+			task_error = true;
+	}
+
+	/* An error of the group rather than of a task */
+	if (ret && !task_error) {
+		for (i = 0; i < count; i++)
+			ops[i]->result = ret;
+	}
+
+out:
+	free(pids);
+	free(errors);
+
+	return ret;
+}
+
+/* Undo the operations of sorted, in the reverse order */
+static void cg_txn_rollback(struct cg_txn_op ** const sorted, int count)
+{
+	struct cgroup_controller *cgc;
+	struct cg_txn_op *op;
+	int i, j, k, ret;
+
+	for (i = count - 1; i >= 0; i--) {
+		op = sorted[i];
+
+		/* A failed modification may have written part of its values */
+		if (op->type == CG_TXN_MODIFY && op->saved) {
+			/* The values read are not dirty, they must all be written */
+			for (j = 0; j < op->saved->index; j++) {
+				cgc = op->saved->controller[j];
+				for (k = 0; k < cgc->index; k++)
+					cgc->values[k]->dirty = true;
+			}
+
+			ret = cgroup_modify_cgroup(op->saved);
+			if (ret)
+				cgroup_warn("cannot restore the values of %s: %s\n",
+					    op->saved->name, cgroup_strerror(ret));
+		}
+
+		/* The children come after their parent, they are removed first */
+		if (op->type == CG_TXN_CREATE && op->created) {
+			ret = cgroup_delete_cgroup_ext(op->cgroup, CGFLAG_DELETE_IGNORE_MIGRATION);
+			if (ret)
+				cgroup_warn("cannot remove %s: %s\n", op->cgroup->name,
+					    cgroup_strerror(ret));
+			op->created = false;
+		}
+	}
+}
+
+int cgroup_txn_commit(struct cgroup_txn *txn, int flags)
+{
+	bool rollback = flags & CGFLAG_TXN_ROLLBACK;
+	struct cg_txn_op **sorted;
+	int error = 0, ret;
+	int i, j;
+
+	if (!txn || txn->committed)
+		return ECGINVAL;
+
+	txn->committed = true;
+	if (!txn->count)
+		return 0;
+
+	sorted = malloc(txn->count * sizeof(struct cg_txn_op *));
+	if (!sorted) {
+		last_errno = ENOMEM;
+		return ECGOTHER;
+	}
+
+	for (i = 0; i < txn->count; i++)
+		sorted[i] = &txn->ops[i];
+	qsort(sorted, txn->count, sizeof(struct cg_txn_op *), cg_txn_compare_ops);
+
+	for (i = 0; i < txn->count; i = j) {
+		j = i + 1;
+
+		switch (sorted[i]->type) {
+		case CG_TXN_CREATE:
+			ret = cg_txn_create(sorted[i], i ? sorted[i - 1] : NULL, rollback);
+			break;
+		case CG_TXN_MODIFY:
+			ret = cg_txn_modify(sorted[i], rollback);
+			break;
+		case CG_TXN_ATTACH:
+			while (j < txn->count && sorted[j]->cgroup == sorted[i]->cgroup)
+				j++;
+			ret = cg_txn_attach(&sorted[i], j - i);
+			break;
+		default:
+			ret = ECGINVAL;
+			break;
+		}
+
+		if (ret && !error)
+			error = ret;
+
+		if (ret && rollback) {
+			cgroup_dbg("transaction failed: %s, rolling back\n", cgroup_strerror(ret));
+			cg_txn_rollback(sorted, j);
+			break;
+		}
+	}
+
+	free(sorted);
+
+	return error;
+}
@@ -0,0 +1,365 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Values of the groups written through io_uring
+ *
+ * Creating a group from the configuration checks, opens, writes and closes
+ * the file of each of its values, four system calls per value, and as many
+ * transitions to the kernel.  With io_uring the files of up to
+ * CG_URING_VALUES values are checked in one batch of statx, then opened,
+ * written and closed in one chain of linked requests: two io_uring_enter()
+ * calls for the lot.  The chain keeps the order of the values, a request is
+ * only run once the previous one succeeded, and the files are opened into a
+ * single registered slot, the direct descriptor, which never shows up in
+ * the fd table of the process.
+ *
+ * The ring only writes what cannot fail in a surprising way: the values
+ * which are a single line and the files which exist.  At the first value it
+ * cannot write, it stops and cgroup_set_values_recursive() carries on
+ * synchronously from that value, with the usual errors and warnings.
+ *
+ * Each thread has its own ring, created on its first use.  The rings are
+ * not used at all when the kernel lacks the requests, direct descriptors
+ * came with Linux 5.15, or when io_uring is disabled.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <linux/io_uring.h>
+#include <linux/stat.h>
+
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#define CG_URING_ENTRIES	256
+/* Values per batch, three requests each */
+#define CG_URING_VALUES		64
+
+struct cg_uring {
+	int fd;
+	void *ring;
+	size_t ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+	unsigned int *sq_head;
+	unsigned int *sq_tail;
+	unsigned int *sq_mask;
+	unsigned int *sq_array;
+	unsigned int *cq_head;
+	unsigned int *cq_tail;
+	unsigned int *cq_mask;
+	struct io_uring_cqe *cqes;
+	/* Requests queued and not submitted yet */
+	unsigned int queued;
+	int res[3 * CG_URING_VALUES];
+	struct statx stx[CG_URING_VALUES];
+};
+
+__thread bool cg_uring_enabled;
+
+/* Set once the kernel refused a ring, for the whole process */
+static bool cg_uring_unsupported;
+
+static __thread struct cg_uring *cg_uring_ring;
+static pthread_key_t cg_uring_key;
+static pthread_once_t cg_uring_once = PTHREAD_ONCE_INIT;
+
+static void cg_uring_free(struct cg_uring *uring)
+{
+	if (uring->sqes)
+		munmap(uring->sqes, uring->sqes_size);
+	if (uring->ring)
+		munmap(uring->ring, uring->ring_size);
+	if (uring->fd >= 0)
+		close(uring->fd);
+	free(uring);
+}
+
+static void cg_uring_destroy(void *uring)
+{
+	cg_uring_free(uring);
+}
+
+static void cg_uring_key_create(void)
+{
+	if (pthread_key_create(&cg_uring_key, cg_uring_destroy))
+		cg_uring_unsupported = true;
+}
+
+/* Whether the kernel has the requests of the chains */
+static bool cg_uring_probe(int fd)
+{
+	static const int ops[] = {
+		IORING_OP_STATX, IORING_OP_OPENAT, IORING_OP_WRITE, IORING_OP_CLOSE,
+		/* Came with the direct descriptors */
+		IORING_OP_LINKAT,
+	};
+	struct io_uring_probe *probe;
+	bool supported = false;
+	size_t i;
+
+	probe = calloc(1, sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op));
+	if (!probe)
+		return false;
+
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) < 0)
+		goto out;
+
+	for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+		if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED))
+			goto out;
+	}
+	supported = true;
+
+out:
+	free(probe);
+
+	return supported;
+}
+
+static struct cg_uring *cg_uring_setup(void)
+{
+	struct io_uring_params params;
+	struct cg_uring *uring;
+	int slot = -1;
+
+	uring = calloc(1, sizeof(struct cg_uring));
+	if (!uring)
+		return NULL;
+
+	memset(&params, 0, sizeof(params));
+	uring->fd = syscall(__NR_io_uring_setup, CG_URING_ENTRIES, &params);
+	if (uring->fd < 0 || !(params.features & IORING_FEAT_SINGLE_MMAP) ||
+	    !cg_uring_probe(uring->fd))
+		goto err;
+
+	/* The submission and the completion rings share their mapping */
+	uring->ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	if (uring->ring_size < params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe))
+		uring->ring_size = params.cq_off.cqes +
+				   params.cq_entries * sizeof(struct io_uring_cqe);
+	uring->ring = mmap(NULL, uring->ring_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+	if (uring->ring == MAP_FAILED) {
+		uring->ring = NULL;
+		goto err;
+	}
+
+	uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+			   MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+	if (uring->sqes == MAP_FAILED) {
+		uring->sqes = NULL;
+		goto err;
+	}
+
+	uring->sq_head = uring->ring + params.sq_off.head;
+	uring->sq_tail = uring->ring + params.sq_off.tail;
+	uring->sq_mask = uring->ring + params.sq_off.ring_mask;
+	uring->sq_array = uring->ring + params.sq_off.array;
+	uring->cq_head = uring->ring + params.cq_off.head;
+	uring->cq_tail = uring->ring + params.cq_off.tail;
+	uring->cq_mask = uring->ring + params.cq_off.ring_mask;
+	uring->cqes = uring->ring + params.cq_off.cqes;
+
+	/* One empty slot, the files are opened one after the other */
+	if (syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_FILES, &slot, 1) < 0)
+		goto err;
+
+	return uring;
+
+err:
+	cgroup_dbg("io_uring is not available: %s\n", strerror(errno));
+	cg_uring_free(uring);
+
+	return NULL;
+}
+
+static struct cg_uring *cg_uring_get(void)
+{
+	struct cg_uring *uring;
+
+	if (cg_uring_unsupported)
+		return NULL;
+	if (cg_uring_ring)
+		return cg_uring_ring;
+
+	pthread_once(&cg_uring_once, cg_uring_key_create);
+
+	uring = cg_uring_setup();
+	if (!uring) {
+		cg_uring_unsupported = true;
+		return NULL;
+	}
+
+	if (pthread_setspecific(cg_uring_key, uring)) {
+		cg_uring_free(uring);
+		return NULL;
+	}
+	cg_uring_ring = uring;
+
+	return uring;
+}
+
+static struct io_uring_sqe *cg_uring_sqe(struct cg_uring *uring, __u8 opcode, __u64 user_data)
+{
+	unsigned int tail = *uring->sq_tail + uring->queued++;
+	struct io_uring_sqe *sqe;
+
+	sqe = &uring->sqes[tail & *uring->sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->user_data = user_data;
+	uring->sq_array[tail & *uring->sq_mask] = tail & *uring->sq_mask;
+
+	return sqe;
+}
+
+/*
+ * Submit the queued requests and wait for all of them, their results are
+ * stored in uring->res by user_data.
+ */
+static int cg_uring_run(struct cg_uring *uring)
+{
+	unsigned int count = uring->queued, done = 0;
+	unsigned int head, tail, submit;
+	struct io_uring_cqe *cqe;
+	int ret;
+
+	__atomic_store_n(uring->sq_tail, *uring->sq_tail + count, __ATOMIC_RELEASE);
+	uring->queued = 0;
+
+	while (done < count) {
+		submit = *uring->sq_tail - __atomic_load_n(uring->sq_head, __ATOMIC_ACQUIRE);
+		ret = syscall(__NR_io_uring_enter, uring->fd, submit, count - done,
+			      IORING_ENTER_GETEVENTS, NULL, 0);
+		if (ret < 0 && errno != EINTR) {
+			/* The state of the rings is unknown, stop using them */
+			cg_uring_unsupported = true;
+			return -1;
+		}
+
+		head = *uring->cq_head;
+		tail = __atomic_load_n(uring->cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++, done++) {
+			cqe = &uring->cqes[head & *uring->cq_mask];
+			uring->res[cqe->user_data] = cqe->res;
+		}
+		__atomic_store_n(uring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+/* Empty the slot of a file whose chain broke before it was closed */
+static void cg_uring_clear_slot(struct cg_uring *uring)
+{
+	struct io_uring_files_update update = { };
+	int slot = -1;
+
+	update.fds = (__u64)(uintptr_t)&slot;
+	syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_FILES_UPDATE, &update, 1);
+}
+
+int cg_uring_write_values(const char * const base, int dirfd,
+			  struct cgroup_controller * const controller, const int * const order,
+			  int count)
+{
+	struct io_uring_sqe *sqe = NULL;
+	struct control_value *cv;
+	struct cg_uring *uring;
+	int start, n, i, chained;
+	bool stop = false;
+	size_t len;
+
+	uring = cg_uring_get();
+	if (!uring)
+		return 0;
+
+	for (start = 0; start < count && !stop; start += n) {
+		n = count - start < CG_URING_VALUES ? count - start : CG_URING_VALUES;
+
+		/* Skip the read-only settings, as with fstatat() */
+		for (i = 0; i < n; i++) {
+			sqe = cg_uring_sqe(uring, IORING_OP_STATX, i);
+			sqe->fd = dirfd;
+			sqe->addr = (__u64)(uintptr_t)controller->values[order[start + i]]->name;
+			sqe->len = STATX_MODE;
+			sqe->off = (__u64)(uintptr_t)&uring->stx[i];
+		}
+		if (cg_uring_run(uring))
+			return start;
+
+		chained = 0;
+		for (i = 0; i < n; i++) {
+			cv = controller->values[order[start + i]];
+			len = strlen(cv->value);
+
+			if (uring->res[i] < 0 || !len || strchr(cv->value, '\n'))
+				break;
+			/* 0200 == S_IWUSR */
+			if (!(uring->stx[i].stx_mode & 0200))
+				continue;
+
+			cgroup_dbg("setting %s%s to \"%s\" with io_uring\n", base, cv->name,
+				   cv->value);
+
+			sqe = cg_uring_sqe(uring, IORING_OP_OPENAT, 3 * i);
+			sqe->fd = dirfd;
+			sqe->addr = (__u64)(uintptr_t)cv->name;
+			/* O_CLOEXEC does not apply to a direct descriptor */
+			sqe->open_flags = O_RDWR;
+			sqe->file_index = 1;
+			sqe->flags = IOSQE_IO_LINK;
+
+			sqe = cg_uring_sqe(uring, IORING_OP_WRITE, 3 * i + 1);
+			sqe->fd = 0;
+			sqe->addr = (__u64)(uintptr_t)cv->value;
+			sqe->len = len;
+			sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_LINK;
+
+			sqe = cg_uring_sqe(uring, IORING_OP_CLOSE, 3 * i + 2);
+			sqe->file_index = 1;
+			sqe->flags = IOSQE_IO_LINK;
+
+			chained++;
+		}
+		stop = i < n;
+		n = i;
+
+		if (chained) {
+			/* The chain ends with the last close */
+			sqe->flags = 0;
+			if (cg_uring_run(uring)) {
+				cg_uring_clear_slot(uring);
+				return start;
+			}
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!(uring->stx[i].stx_mode & 0200))
+				continue;
+
+			if (uring->res[3 * i] > 0) {
+				/* A kernel without direct descriptors opened a plain fd */
+				close(uring->res[3 * i]);
+				cg_uring_unsupported = true;
+			}
+			len = strlen(controller->values[order[start + i]]->value);
+			if (uring->res[3 * i] || uring->res[3 * i + 1] != (int)len ||
+			    uring->res[3 * i + 2]) {
+				cg_uring_clear_slot(uring);
+				return start + i;
+			}
+			cg_cv_set_dirty(controller, order[start + i], false);
+		}
+	}
+
+	return start;
+}
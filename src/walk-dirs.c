@@ -0,0 +1,280 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Walk of the directories of a cgroup tree with getdents64()
+ *
+ * fts stats every entry of a walk with FTS_LOGICAL, and a cgroup has tens
+ * of control files for one or two subdirectories.  With
+ * CGROUP_WALK_TYPE_DIRS_ONLY the walk reads the directories with
+ * getdents64() relative to the descriptor of their parent and tells them
+ * from the files by d_type, only an entry of an unknown type is stat'ed.
+ * The open directories are kept on a stack, one per level of the walk.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/syscall.h>
+#include <sys/stat.h>
+
+/* Size of the getdents64() buffer of a directory */
+#define CG_WALK_DIR_BUF	4096
+
+/* Initial number of levels of the stack */
+#define CG_WALK_DIRS_ALLOC	8
+
+struct cg_walk_dir {
+	int fd;
+	/* Length of the path of the directory in the handle */
+	size_t path_len;
+	/* Offset of the name of the directory in the path */
+	size_t name_off;
+	short depth;
+	/* The entries read and not returned yet are at buf[pos, len) */
+	long pos;
+	long len;
+	bool eof;
+	char *buf;
+	/* Terminated copy of the name, the parent of the subdirectories */
+	char name[FILENAME_MAX];
+};
+
+static int cg_walk_dirs_push(struct cgroup_tree_handle * const entry, int fd, size_t path_len,
+			     size_t name_off, short depth)
+{
+	struct cg_walk_dir *dirs, *dir;
+	int alloc;
+
+	if (entry->dirs_cnt == entry->dirs_alloc) {
+		alloc = entry->dirs_alloc ? entry->dirs_alloc * 2 : CG_WALK_DIRS_ALLOC;
+		dirs = realloc(entry->dirs, alloc * sizeof(struct cg_walk_dir));
+		if (!dirs)
+			goto err;
+
+		/* The buffers are kept when a level is popped */
+		memset(dirs + entry->dirs_alloc, 0,
+		       (alloc - entry->dirs_alloc) * sizeof(struct cg_walk_dir));
+		entry->dirs = dirs;
+		entry->dirs_alloc = alloc;
+	}
+
+	dir = &entry->dirs[entry->dirs_cnt];
+	if (!dir->buf) {
+		dir->buf = malloc(CG_WALK_DIR_BUF);
+		if (!dir->buf)
+			goto err;
+	}
+
+	dir->fd = fd;
+	memcpy(dir->name, entry->path + name_off, path_len - name_off + 1);
+	dir->path_len = path_len;
+	dir->name_off = name_off;
+	dir->depth = depth;
+	dir->pos = 0;
+	dir->len = 0;
+	dir->eof = false;
+	entry->dirs_cnt++;
+
+	return 0;
+
+err:
+	last_errno = errno;
+	close(fd);
+
+	return ECGOTHER;
+}
+
+static void cg_walk_dirs_pop(struct cgroup_tree_handle * const entry)
+{
+	struct cg_walk_dir *dir = &entry->dirs[--entry->dirs_cnt];
+
+	close(dir->fd);
+	if (entry->dirs_cnt)
+		entry->path[entry->dirs[entry->dirs_cnt - 1].path_len] = '\0';
+}
+
+static void cg_walk_dirs_info(struct cgroup_tree_handle * const entry,
+			      struct cgroup_file_info * const info)
+{
+	struct cg_walk_dir *dir = &entry->dirs[entry->dirs_cnt - 1];
+
+	info->type = CGROUP_FILE_TYPE_DIR;
+	info->full_path = entry->path;
+	info->path = entry->path + dir->name_off;
+	info->depth = dir->depth;
+
+	if (entry->dirs_cnt > 1)
+		info->parent = entry->dirs[entry->dirs_cnt - 2].name;
+	else
+		info->parent = "";
+}
+
+/**
+ * Read the next subdirectory of the directory on the top of the stack.
+ * @return The entry, NULL at the end of the directory or on error, then
+ *	*ret is set
+ */
+static struct cg_dirent64 *cg_walk_dirs_read(struct cg_walk_dir * const dir, int * const ret)
+{
+	struct cg_dirent64 *ent;
+	struct stat st;
+
+	*ret = 0;
+	for (;;) {
+		if (dir->pos >= dir->len) {
+			if (dir->eof)
+				return NULL;
+
+			dir->len = syscall(SYS_getdents64, dir->fd, dir->buf, CG_WALK_DIR_BUF);
+			dir->pos = 0;
+			if (dir->len < 0) {
+				last_errno = errno;
+				dir->len = 0;
+				*ret = ECGOTHER;
+				return NULL;
+			}
+			if (dir->len == 0) {
+				dir->eof = true;
+				return NULL;
+			}
+		}
+
+		ent = (struct cg_dirent64 *)(dir->buf + dir->pos);
+		dir->pos += ent->d_reclen;
+
+		if (ent->d_type == DT_UNKNOWN) {
+			if (fstatat(dir->fd, ent->d_name, &st, AT_SYMLINK_NOFOLLOW) ||
+			    !S_ISDIR(st.st_mode))
+				continue;
+		} else if (ent->d_type != DT_DIR) {
+			continue;
+		}
+
+		if (!strcmp(ent->d_name, ".") || !strcmp(ent->d_name, ".."))
+			continue;
+
+		return ent;
+	}
+}
+
+int cg_walk_dirs_start(struct cgroup_tree_handle * const entry, const char * const path)
+{
+	size_t len;
+	int fd;
+
+	len = strlen(path);
+	if (len >= sizeof(entry->path))
+		return ECGINVAL;
+
+	fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd < 0) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	memcpy(entry->path, path, len + 1);
+	entry->pop = false;
+
+	/* Like fts, the name of the root is its path */
+	return cg_walk_dirs_push(entry, fd, len, 0, 0);
+}
+
+int cg_walk_dirs_next(struct cgroup_tree_handle * const entry, int depth,
+		      struct cgroup_file_info * const info)
+{
+	struct cg_walk_dir *dir;
+	struct cg_dirent64 *ent;
+	size_t len, nlen;
+	bool slash;
+	int ret, fd;
+
+	if (entry->pop) {
+		entry->pop = false;
+		cg_walk_dirs_pop(entry);
+	}
+
+	while (entry->dirs_cnt) {
+		dir = &entry->dirs[entry->dirs_cnt - 1];
+
+		ent = NULL;
+		if (!depth || dir->depth < depth) {
+			ent = cg_walk_dirs_read(dir, &ret);
+			if (ret)
+				return ret;
+		}
+
+		if (!ent) {
+			/* All the subdirectories were returned */
+			if (entry->flags & CGROUP_WALK_TYPE_POST_DIR) {
+				cg_walk_dirs_info(entry, info);
+				entry->pop = true;
+				return 0;
+			}
+			cg_walk_dirs_pop(entry);
+			continue;
+		}
+
+		fd = openat(dir->fd, ent->d_name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (fd < 0) {
+			/* The group was removed since it was read */
+			if (errno == ENOENT)
+				continue;
+			last_errno = errno;
+			return ECGOTHER;
+		}
+
+		len = dir->path_len;
+		nlen = strlen(ent->d_name);
+		slash = len == 0 || entry->path[len - 1] != '/';
+		if (len + slash + nlen >= sizeof(entry->path)) {
+			cgroup_warn("path too long: %s/%s\n", entry->path, ent->d_name);
+			close(fd);
+			continue;
+		}
+
+		if (slash)
+			entry->path[len] = '/';
+		memcpy(entry->path + len + slash, ent->d_name, nlen + 1);
+
+		ret = cg_walk_dirs_push(entry, fd, len + slash + nlen, len + slash,
+					dir->depth + 1);
+		if (ret)
+			return ret;
+
+		if (entry->flags & CGROUP_WALK_TYPE_POST_DIR)
+			continue;
+
+		cg_walk_dirs_info(entry, info);
+		return 0;
+	}
+
+	return ECGEOF;
+}
+
+int cg_walk_dirs_fd(const struct cgroup_tree_handle * const entry)
+{
+	if (!entry->dirs_cnt)
+		return -1;
+
+	return entry->dirs[entry->dirs_cnt - 1].fd;
+}
+
+void cg_walk_dirs_end(struct cgroup_tree_handle * const entry)
+{
+	int i;
+
+	while (entry->dirs_cnt)
+		cg_walk_dirs_pop(entry);
+
+	for (i = 0; i < entry->dirs_alloc; i++)
+		free(entry->dirs[i].buf);
+	free(entry->dirs);
+
+	entry->dirs = NULL;
+	entry->dirs_alloc = 0;
+}
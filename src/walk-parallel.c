@@ -0,0 +1,469 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Parallel walk of a cgroup tree
+ *
+ * cgroup_walk_tree_begin() and cgroup_walk_tree_next() read the tree one
+ * directory at a time.  Here the directories are spread over a pool of
+ * threads.  Each thread keeps the directories it finds in its own deque and
+ * works on the newest one.  An idle thread steals the oldest directory of
+ * another thread, which is usually the root of a large subtree.
+ *
+ * The visit callback runs on the threads as soon as a directory is taken.
+ * The tree is kept, and once all the directories have been visited the emit
+ * callback runs on the calling thread, in pre-order.
+ */
+
+#include <libcgroup.h>
+#include <libcgroup-internal.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/stat.h>
+
+/* Initial number of entries of a deque */
+#define CG_WALK_DEQUE_SIZE	64
+
+struct cg_walk_node {
+	struct cg_walk_node *parent;
+	struct cg_walk_node *children;
+	struct cg_walk_node *next;
+	int children_cnt;
+	void *result;
+	short depth;
+	/* Offset of the name of the directory in path */
+	size_t name_off;
+	char path[];
+};
+
+struct cg_walk_deque {
+	pthread_mutex_t lock;
+	struct cg_walk_node **nodes;
+	/* The oldest node is at head, the newest at tail - 1 */
+	int head;
+	int tail;
+	int alloc;
+};
+
+struct cg_walk {
+	int depth;
+	int threads;
+	cgroup_walk_visit_callback visit;
+	void *userdata;
+
+	struct cg_walk_deque *deques;
+
+	/* Protects the fields below */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	/* Nodes pushed and not processed yet */
+	int pending;
+	/* Nodes in the deques */
+	int queued;
+	int error;
+	int error_errno;
+};
+
+struct cg_walk_thread {
+	struct cg_walk *walk;
+	int id;
+};
+
+static struct cg_walk_node *cg_walk_new_node(struct cg_walk_node * const parent,
+					     const char * const name)
+{
+	struct cg_walk_node *node;
+	size_t plen, nlen;
+	bool slash;
+
+	plen = strlen(parent->path);
+	nlen = strlen(name);
+	slash = plen == 0 || parent->path[plen - 1] != '/';
+
+	node = calloc(1, sizeof(struct cg_walk_node) + plen + slash + nlen + 1);
+	if (!node)
+		return NULL;
+
+	memcpy(node->path, parent->path, plen);
+	if (slash)
+		node->path[plen] = '/';
+	memcpy(node->path + plen + slash, name, nlen + 1);
+
+	node->parent = parent;
+	node->depth = parent->depth + 1;
+	node->name_off = plen + slash;
+
+	return node;
+}
+
+static void cg_walk_set_error(struct cg_walk * const walk, int error)
+{
+	pthread_mutex_lock(&walk->lock);
+	if (!walk->error) {
+		walk->error = error;
+		walk->error_errno = last_errno;
+	}
+	pthread_mutex_unlock(&walk->lock);
+}
+
+static int cg_walk_push(struct cg_walk * const walk, int id, struct cg_walk_node * const node)
+{
+	struct cg_walk_deque *deque = &walk->deques[id];
+	struct cg_walk_node **nodes;
+	int alloc;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail == deque->alloc) {
+		if (deque->head) {
+			memmove(deque->nodes, deque->nodes + deque->head,
+				(deque->tail - deque->head) * sizeof(struct cg_walk_node *));
+			deque->tail -= deque->head;
+			deque->head = 0;
+		} else {
+			alloc = deque->alloc ? deque->alloc * 2 : CG_WALK_DEQUE_SIZE;
+			nodes = realloc(deque->nodes, alloc * sizeof(struct cg_walk_node *));
+			if (!nodes) {
+				pthread_mutex_unlock(&deque->lock);
+				return -1;
+			}
+			deque->nodes = nodes;
+			deque->alloc = alloc;
+		}
+	}
+	deque->nodes[deque->tail++] = node;
+	pthread_mutex_unlock(&deque->lock);
+
+	pthread_mutex_lock(&walk->lock);
+	walk->pending++;
+	walk->queued++;
+	pthread_cond_broadcast(&walk->cond);
+	pthread_mutex_unlock(&walk->lock);
+
+	return 0;
+}
+
+/**
+ * Take the newest node of the own deque of the thread, or steal the oldest
+ * node of another deque.
+ */
+static struct cg_walk_node *cg_walk_pop(struct cg_walk * const walk, int id)
+{
+	struct cg_walk_node *node = NULL;
+	struct cg_walk_deque *deque;
+	int i;
+
+	deque = &walk->deques[id];
+	pthread_mutex_lock(&deque->lock);
+	if (deque->tail > deque->head)
+		node = deque->nodes[--deque->tail];
+	if (deque->tail == deque->head)
+		deque->head = deque->tail = 0;
+	pthread_mutex_unlock(&deque->lock);
+
+	for (i = 1; !node && i < walk->threads; i++) {
+		deque = &walk->deques[(id + i) % walk->threads];
+
+		pthread_mutex_lock(&deque->lock);
+		if (deque->tail > deque->head)
+			node = deque->nodes[deque->head++];
+		pthread_mutex_unlock(&deque->lock);
+	}
+
+	if (node) {
+		pthread_mutex_lock(&walk->lock);
+		walk->queued--;
+		pthread_mutex_unlock(&walk->lock);
+	}
+
+	return node;
+}
+
+static bool cg_walk_is_dir(DIR * const dir, const struct dirent * const entry)
+{
+	struct stat st;
+
+	if (entry->d_type != DT_UNKNOWN)
+		return entry->d_type == DT_DIR;
+
+	if (fstatat(dirfd(dir), entry->d_name, &st, AT_SYMLINK_NOFOLLOW))
+		return false;
+
+	return S_ISDIR(st.st_mode);
+}
+
+/**
+ * Read the subdirectories of a node, push them, then visit the node.
+ */
+static void cg_walk_process(struct cg_walk * const walk, int id, struct cg_walk_node * const node)
+{
+	struct cgroup_file_info info;
+	struct cg_walk_node *child;
+	struct dirent *entry;
+	DIR *dir;
+	int ret;
+
+	pthread_mutex_lock(&walk->lock);
+	ret = walk->error;
+	pthread_mutex_unlock(&walk->lock);
+	if (ret)
+		return;
+
+	if (!walk->depth || node->depth < walk->depth) {
+		dir = opendir(node->path);
+		if (!dir) {
+			/* The group may have been removed since it was read */
+			if (errno != ENOENT || !node->parent) {
+				last_errno = errno;
+				cg_walk_set_error(walk, ECGOTHER);
+				return;
+			}
+		} else {
+			while ((entry = readdir(dir)) != NULL) {
+				if (!strcmp(entry->d_name, ".") || !strcmp(entry->d_name, ".."))
+					continue;
+				if (!cg_walk_is_dir(dir, entry))
+					continue;
+
+				child = cg_walk_new_node(node, entry->d_name);
+				if (!child) {
+					last_errno = errno;
+					cg_walk_set_error(walk, ECGOTHER);
+					break;
+				}
+
+				/* Only this thread links the children of node */
+				child->next = node->children;
+				node->children = child;
+				node->children_cnt++;
+
+				if (cg_walk_push(walk, id, child)) {
+					last_errno = errno;
+					cg_walk_set_error(walk, ECGOTHER);
+					break;
+				}
+			}
+			closedir(dir);
+		}
+	}
+
+	if (!walk->visit)
+		return;
+
+	info.type = CGROUP_FILE_TYPE_DIR;
+	info.path = node->path + node->name_off;
+	info.parent = node->parent ? node->parent->path + node->parent->name_off : "";
+	info.full_path = node->path;
+	info.depth = node->depth;
+
+	ret = walk->visit(&info, walk->userdata, &node->result);
+	if (ret)
+		cg_walk_set_error(walk, ret);
+}
+
+static void *cg_walk_thread(void *arg)
+{
+	struct cg_walk_thread *thread = arg;
+	struct cg_walk *walk = thread->walk;
+	struct cg_walk_node *node;
+	bool done;
+
+	for (;;) {
+		node = cg_walk_pop(walk, thread->id);
+		if (node) {
+			cg_walk_process(walk, thread->id, node);
+
+			pthread_mutex_lock(&walk->lock);
+			if (--walk->pending == 0)
+				pthread_cond_broadcast(&walk->cond);
+			pthread_mutex_unlock(&walk->lock);
+			continue;
+		}
+
+		pthread_mutex_lock(&walk->lock);
+		while (walk->queued == 0 && walk->pending > 0)
+			pthread_cond_wait(&walk->cond, &walk->lock);
+		done = walk->pending == 0;
+		pthread_mutex_unlock(&walk->lock);
+
+		if (done)
+			break;
+	}
+
+	return NULL;
+}
+
+static int cg_walk_compare(const void *p1, const void *p2)
+{
+	const struct cg_walk_node *n1 = *(const struct cg_walk_node **)p1;
+	const struct cg_walk_node *n2 = *(const struct cg_walk_node **)p2;
+
+	return strcmp(n1->path + n1->name_off, n2->path + n2->name_off);
+}
+
+/**
+ * Sort the children of a node by name.
+ * @return 0 on success, -1 if the allocation failed
+ */
+static int cg_walk_sort_children(struct cg_walk_node * const node)
+{
+	struct cg_walk_node **children, *child;
+	int i;
+
+	if (node->children_cnt < 2)
+		return 0;
+
+	children = malloc(node->children_cnt * sizeof(struct cg_walk_node *));
+	if (!children)
+		return -1;
+
+	for (i = 0, child = node->children; child; child = child->next)
+		children[i++] = child;
+
+	qsort(children, node->children_cnt, sizeof(struct cg_walk_node *), cg_walk_compare);
+
+	for (i = node->children_cnt - 1, node->children = NULL; i >= 0; i--) {
+		children[i]->next = node->children;
+		node->children = children[i];
+	}
+	free(children);
+
+	return 0;
+}
+
+/**
+ * Reverse the children of a node into the order they were read.
+ */
+static void cg_walk_reverse_children(struct cg_walk_node * const node)
+{
+	struct cg_walk_node *child, *next, *children = NULL;
+
+	for (child = node->children; child; child = next) {
+		next = child->next;
+		child->next = children;
+		children = child;
+	}
+	node->children = children;
+}
+
+/**
+ * Emit a node and its subtree, and free them.
+ * @param ret The current return value of the walk, the nodes are only freed
+ *	once it is set
+ */
+static int cg_walk_emit(struct cg_walk_node * const node, int flags,
+			cgroup_walk_emit_callback emit, void *userdata, int ret)
+{
+	struct cgroup_file_info info;
+	struct cg_walk_node *child, *next;
+
+	if (!ret && emit) {
+		info.type = CGROUP_FILE_TYPE_DIR;
+		info.path = node->path + node->name_off;
+		info.parent = node->parent ? node->parent->path + node->parent->name_off : "";
+		info.full_path = node->path;
+		info.depth = node->depth;
+
+		ret = emit(&info, node->result, userdata);
+		node->result = NULL;
+
+		if (!ret && (flags & CGROUP_WALK_PARALLEL_SORTED) &&
+		    cg_walk_sort_children(node)) {
+			last_errno = errno;
+			ret = ECGOTHER;
+		}
+		if (!ret && !(flags & CGROUP_WALK_PARALLEL_SORTED))
+			cg_walk_reverse_children(node);
+	}
+
+	for (child = node->children; child; child = next) {
+		next = child->next;
+		ret = cg_walk_emit(child, flags, emit, userdata, ret);
+	}
+
+	free(node->result);
+	free(node);
+
+	return ret;
+}
+
+int cg_walk_tree_parallel(const char * const path, int depth, int threads, int flags,
+			  cgroup_walk_visit_callback visit, cgroup_walk_emit_callback emit,
+			  void *userdata)
+{
+	struct cg_walk_thread *thread_args = NULL;
+	struct cg_walk_node *root;
+	pthread_t *tids = NULL;
+	struct cg_walk walk;
+	int started = 0;
+	int ret, i;
+
+	memset(&walk, 0, sizeof(walk));
+	walk.depth = depth;
+	walk.threads = threads;
+	walk.visit = visit;
+	walk.userdata = userdata;
+	pthread_mutex_init(&walk.lock, NULL);
+	pthread_cond_init(&walk.cond, NULL);
+
+	root = calloc(1, sizeof(struct cg_walk_node) + strlen(path) + 1);
+	walk.deques = calloc(threads, sizeof(struct cg_walk_deque));
+	tids = calloc(threads, sizeof(pthread_t));
+	thread_args = calloc(threads, sizeof(struct cg_walk_thread));
+	if (!root || !walk.deques || !tids || !thread_args) {
+		last_errno = errno;
+		free(root);
+		ret = ECGOTHER;
+		goto out;
+	}
+
+	strcpy(root->path, path);
+
+	for (i = 0; i < threads; i++) {
+		pthread_mutex_init(&walk.deques[i].lock, NULL);
+		thread_args[i].walk = &walk;
+		thread_args[i].id = i;
+	}
+
+	if (cg_walk_push(&walk, 0, root)) {
+		last_errno = errno;
+		free(root);
+		ret = ECGOTHER;
+		goto out;
+	}
+
+	/* The calling thread is the first thread of the pool */
+	for (i = 1; i < threads; i++) {
+		if (pthread_create(&tids[i], NULL, cg_walk_thread, &thread_args[i]))
+			break;
+		started++;
+	}
+	cg_walk_thread(&thread_args[0]);
+
+	for (i = 1; i <= started; i++)
+		pthread_join(tids[i], NULL);
+
+	ret = walk.error;
+	if (ret)
+		last_errno = walk.error_errno;
+
+	ret = cg_walk_emit(root, flags, emit, userdata, ret);
+
+out:
+	if (walk.deques) {
+		for (i = 0; i < threads; i++) {
+			free(walk.deques[i].nodes);
+			pthread_mutex_destroy(&walk.deques[i].lock);
+		}
+		free(walk.deques);
+	}
+	free(thread_args);
+	free(tids);
+	pthread_cond_destroy(&walk.cond);
+	pthread_mutex_destroy(&walk.lock);
+
+	return ret;
+}
@@ -40,6 +40,194 @@ void init_cgroup_table(struct cgroup *cgroups, size_t count)
 		init_cgroup(&cgroups[i]);
 }
 
+/* Number of the hash buckets of the interned names, a power of two */
+#define CG_NAME_HASH_SIZE	256
+
+/* Initial sizes of the growable arrays */
+#define CG_CONTROLLER_ALLOC	4
+#define CG_NV_ALLOC		8
+
+struct cg_name {
+	struct cg_name *next;
+	char name[];
+};
+
+/*
+ * The same few control file names are used by all the cgroups, they are
+ * stored once and shared by all the control values.
+ */
+static struct cg_name *name_table[CG_NAME_HASH_SIZE];
+static pthread_mutex_t name_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static unsigned int cg_name_hash(const char * const name)
+{
+	return cg_fnv1a_str(CG_FNV1A_INIT, name) & (CG_NAME_HASH_SIZE - 1);
+}
+
+const char *cg_intern_name(const char * const name)
+{
+	struct cg_name *entry;
+	unsigned int hash;
+	size_t len;
+
+	hash = cg_name_hash(name);
+
+	pthread_mutex_lock(&name_table_lock);
+	for (entry = name_table[hash]; entry; entry = entry->next) {
+		if (strcmp(entry->name, name) == 0)
+			goto out;
+	}
+
+	len = strlen(name);
+	entry = malloc(sizeof(struct cg_name) + len + 1);
+	if (!entry) {
+		last_errno = errno;
+		pthread_mutex_unlock(&name_table_lock);
+		return NULL;
+	}
+
+	memcpy(entry->name, name, len + 1);
+	entry->next = name_table[hash];
+	name_table[hash] = entry;
+out:
+	pthread_mutex_unlock(&name_table_lock);
+
+	return entry->name;
+}
+
+static struct cgroup_arena *cg_controller_arena(const struct cgroup_controller * const controller)
+{
+	return controller->cgroup ? controller->cgroup->arena : NULL;
+}
+
+void *cg_cgroup_calloc(const struct cgroup * const cgroup, size_t size)
+{
+	void *ptr;
+
+	if (cgroup && cgroup->arena)
+		return cg_arena_alloc(cgroup->arena, size);
+
+	ptr = calloc(1, size);
+	if (!ptr)
+		last_errno = errno;
+
+	return ptr;
+}
+
+/**
+ * Grow an array of pointers of a cgroup.
+ * @param cgroup The cgroup, its arena is used if it has one
+ * @param array The array, NULL if it is not allocated yet
+ * @param count Number of entries used in array
+ * @param alloc Number of entries to allocate
+ * @return The new array, NULL if the allocation failed
+ */
+static void *cg_grow_array(const struct cgroup * const cgroup, void *array, int count, int alloc)
+{
+	void *new_array;
+
+	if (!cgroup || !cgroup->arena) {
+		new_array = realloc(array, alloc * sizeof(void *));
+		if (!new_array)
+			last_errno = errno;
+
+		return new_array;
+	}
+
+	/* The old array is released with the rest of the arena */
+	new_array = cg_arena_alloc(cgroup->arena, alloc * sizeof(void *));
+	if (new_array && count)
+		memcpy(new_array, array, count * sizeof(void *));
+
+	return new_array;
+}
+
+int cg_set_cv_value(const struct cgroup_controller * const controller,
+		    struct control_value * const cv, const char * const value)
+{
+	struct cgroup_arena *arena = cg_controller_arena(controller);
+	char *new_value;
+	size_t len;
+
+	if (arena) {
+		/* Overwrite the old value when it is long enough */
+		len = strnlen(value, CG_CONTROL_VALUE_MAX - 1);
+		if (cv->value && strlen(cv->value) >= len) {
+			memcpy(cv->value, value, len);
+			cv->value[len] = '\0';
+			return 0;
+		}
+
+		new_value = cg_arena_strndup(arena, value, CG_CONTROL_VALUE_MAX - 1);
+		if (!new_value)
+			return ECGOTHER;
+
+		cv->value = new_value;
+		return 0;
+	}
+
+	new_value = strndup(value, CG_CONTROL_VALUE_MAX - 1);
+	if (!new_value) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	free(cv->value);
+	cv->value = new_value;
+
+	return 0;
+}
+
+int cg_reserve_controller(struct cgroup * const cgroup)
+{
+	struct cgroup_controller **controller;
+	int alloc;
+
+	if (cgroup->index < cgroup->controller_alloc)
+		return 0;
+
+	if (cgroup->index >= CG_CONTROLLER_MAX)
+		return ECGMAXVALUESEXCEEDED;
+
+	alloc = cgroup->controller_alloc ? cgroup->controller_alloc * 2 : CG_CONTROLLER_ALLOC;
+	if (alloc > CG_CONTROLLER_MAX)
+		alloc = CG_CONTROLLER_MAX;
+
+	controller = cg_grow_array(cgroup, cgroup->controller, cgroup->index, alloc);
+	if (!controller)
+		return ECGOTHER;
+
+	cgroup->controller = controller;
+	cgroup->controller_alloc = alloc;
+
+	return 0;
+}
+
+int cg_reserve_value(struct cgroup_controller * const controller)
+{
+	struct control_value **values;
+	int alloc;
+
+	if (controller->index < controller->values_alloc)
+		return 0;
+
+	if (controller->index >= CG_NV_MAX)
+		return ECGMAXVALUESEXCEEDED;
+
+	alloc = controller->values_alloc ? controller->values_alloc * 2 : CG_NV_ALLOC;
+	if (alloc > CG_NV_MAX)
+		alloc = CG_NV_MAX;
+
+	values = cg_grow_array(controller->cgroup, controller->values, controller->index, alloc);
+	if (!values)
+		return ECGOTHER;
+
+	controller->values = values;
+	controller->values_alloc = alloc;
+
+	return 0;
+}
+
 struct cgroup *cgroup_new_cgroup(const char *name)
 {
 	struct cgroup *cgroup;
@@ -58,6 +246,25 @@ struct cgroup *cgroup_new_cgroup(const char *name)
 	return cgroup;
 }
 
+struct cgroup *cgroup_new_cgroup_arena(const char *name, struct cgroup_arena *arena)
+{
+	struct cgroup *cgroup;
+
+	if (!name || !arena)
+		return NULL;
+
+	cgroup = cg_arena_alloc(arena, sizeof(struct cgroup));
+	if (!cgroup)
+		return NULL;
+
+	init_cgroup(cgroup);
+	strncpy(cgroup->name, name, FILENAME_MAX - 1);
+	cgroup->name[FILENAME_MAX - 1] = '\0';
+	cgroup->arena = arena;
+
+	return cgroup;
+}
+
 struct cgroup_controller *cgroup_add_controller(struct cgroup *cgroup, const char *name)
 {
 	struct cgroup_controller *controller;
@@ -67,7 +274,7 @@ struct cgroup_controller *cgroup_add_controller(struct cgroup *cgroup, const cha
 		return NULL;
 
 	/* Still not sure how to handle the failure here. */
-	if (cgroup->index >= CG_CONTROLLER_MAX)
+	if (cg_reserve_controller(cgroup))
 		return NULL;
 
 	/* Still not sure how to handle the failure here. */
@@ -76,7 +283,7 @@ struct cgroup_controller *cgroup_add_controller(struct cgroup *cgroup, const cha
 			return NULL;
 	}
 
-	controller = calloc(1, sizeof(struct cgroup_controller));
+	controller = cg_cgroup_calloc(cgroup, sizeof(struct cgroup_controller));
 	if (!controller)
 		return NULL;
 
@@ -97,7 +304,8 @@ struct cgroup_controller *cgroup_add_controller(struct cgroup *cgroup, const cha
 		if (ret) {
 			cgroup_dbg("failed to get cgroup version for controller %s\n",
 				   controller->name);
-			free(controller);
+			if (!cgroup->arena)
+				free(controller);
 			return NULL;
 		}
 	}
@@ -221,22 +429,195 @@ out:
 
 static void cgroup_free_value(struct control_value *value)
 {
+	free(value->value);
 	if (value->multiline_value)
 		free(value->multiline_value);
-	if (value->prev_name)
-		free(value->prev_name);
 
 	free(value);
 }
 
-void cgroup_free_controller(struct cgroup_controller *ctrl)
+/* Serializes the first sharing of the values of a controller */
+static pthread_mutex_t share_lock = PTHREAD_MUTEX_INITIALIZER;
+
+bool cg_cv_is_dirty(const struct cgroup_controller * const controller, int i)
+{
+	if (controller->shared)
+		return controller->shared_dirty[i / 8] & (1 << (i % 8));
+
+	return controller->values[i]->dirty;
+}
+
+void cg_cv_set_dirty(struct cgroup_controller * const controller, int i, bool dirty)
+{
+	if (!controller->shared)
+		controller->values[i]->dirty = dirty;
+	else if (dirty)
+		controller->shared_dirty[i / 8] |= 1 << (i % 8);
+	else
+		controller->shared_dirty[i / 8] &= ~(1 << (i % 8));
+}
+
+int cg_share_values(struct cgroup_controller * const dst, struct cgroup_controller * const src)
+{
+	struct cg_value_set *set;
+	int i;
+
+	pthread_mutex_lock(&share_lock);
+	if (!src->shared) {
+		set = malloc(sizeof(struct cg_value_set));
+		if (!set) {
+			last_errno = errno;
+			pthread_mutex_unlock(&share_lock);
+			return ECGOTHER;
+		}
+		set->refcount = 1;
+
+		memset(src->shared_dirty, 0, sizeof(src->shared_dirty));
+		for (i = 0; i < src->index; i++) {
+			if (src->values[i]->dirty)
+				src->shared_dirty[i / 8] |= 1 << (i % 8);
+		}
+		src->shared = set;
+	}
+	__atomic_add_fetch(&src->shared->refcount, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&share_lock);
+
+	free(dst->values);
+	dst->values = src->values;
+	dst->values_alloc = src->index;
+	dst->index = src->index;
+	dst->shared = src->shared;
+
+	/* The values of a copy are all written */
+	memset(dst->shared_dirty, 0xff, sizeof(dst->shared_dirty));
+
+	return 0;
+}
+
+static struct control_value *cg_dup_value(const struct control_value * const value)
+{
+	struct control_value *copy;
+
+	copy = calloc(1, sizeof(struct control_value));
+	if (!copy)
+		goto err;
+
+	/* The names are interned, they can be shared */
+	copy->name = value->name;
+	copy->prev_name = value->prev_name;
+
+	copy->value = strdup(value->value);
+	if (!copy->value)
+		goto err;
+
+	if (value->multiline_value) {
+		copy->multiline_value = strdup(value->multiline_value);
+		if (!copy->multiline_value)
+			goto err;
+	}
+
+	return copy;
+
+err:
+	last_errno = errno;
+	if (copy)
+		free(copy->value);
+	free(copy);
+
+	return NULL;
+}
+
+/**
+ * Drop the reference of a controller to its shared values, the values are
+ * freed with the last one.
+ */
+static void cg_release_values(struct cgroup_controller * const controller)
+{
+	struct cg_value_set *set = controller->shared;
+	int i;
+
+	controller->shared = NULL;
+	if (__atomic_sub_fetch(&set->refcount, 1, __ATOMIC_ACQ_REL) == 0) {
+		for (i = 0; i < controller->index; i++)
+			cgroup_free_value(controller->values[i]);
+		free(controller->values);
+		free(set);
+	}
+}
+
+int cg_own_values(struct cgroup_controller * const controller)
 {
+	struct cg_value_set *set = controller->shared;
+	struct control_value **values;
 	int i;
 
-	for (i = 0; i < ctrl->index; i++)
-		cgroup_free_value(ctrl->values[i]);
+	if (!set)
+		return 0;
+
+	/* The last controller sharing the values takes them */
+	if (__atomic_load_n(&set->refcount, __ATOMIC_ACQUIRE) == 1) {
+		for (i = 0; i < controller->index; i++)
+			controller->values[i]->dirty = cg_cv_is_dirty(controller, i);
+		controller->shared = NULL;
+		free(set);
+		return 0;
+	}
+
+	values = calloc(controller->values_alloc ? controller->values_alloc : 1,
+			sizeof(struct control_value *));
+	if (!values) {
+		last_errno = errno;
+		return ECGOTHER;
+	}
+
+	for (i = 0; i < controller->index; i++) {
+		values[i] = cg_dup_value(controller->values[i]);
+		if (!values[i])
+			goto err;
+		values[i]->dirty = cg_cv_is_dirty(controller, i);
+	}
+
+	cg_release_values(controller);
+	controller->values = values;
+
+	return 0;
+
+err:
+	while (i-- > 0)
+		cgroup_free_value(values[i]);
+	free(values);
+
+	return ECGOTHER;
+}
+
+void cg_free_values(struct cgroup_controller * const ctrl)
+{
+	int i;
+
+	if (ctrl->shared) {
+		cg_release_values(ctrl);
+		ctrl->values = NULL;
+		ctrl->values_alloc = 0;
+		ctrl->index = 0;
+		return;
+	}
+
+	/* The values of an arena are released by cgroup_arena_reset() */
+	if (!cg_controller_arena(ctrl)) {
+		for (i = 0; i < ctrl->index; i++)
+			cgroup_free_value(ctrl->values[i]);
+	}
 	ctrl->index = 0;
+}
+
+void cgroup_free_controller(struct cgroup_controller *ctrl)
+{
+	cg_free_values(ctrl);
+
+	if (cg_controller_arena(ctrl))
+		return;
 
+	free(ctrl->values);
 	free(ctrl);
 }
 
@@ -250,6 +631,10 @@ void cgroup_free_controllers(struct cgroup *cgroup)
 	for (i = 0; i < cgroup->index; i++)
 		cgroup_free_controller(cgroup->controller[i]);
 
+	if (!cgroup->arena)
+		free(cgroup->controller);
+	cgroup->controller = NULL;
+	cgroup->controller_alloc = 0;
 	cgroup->index = 0;
 }
 
@@ -262,14 +647,15 @@ void cgroup_free(struct cgroup **cgroup)
 		return;
 
 	cgroup_free_controllers(cg);
-	free(cg);
+	if (!cg->arena)
+		free(cg);
 	*cgroup = NULL;
 }
 
 int cgroup_add_value_string(struct cgroup_controller *controller, const char *name,
 			    const char *value)
 {
-	int i;
+	int i, ret;
 	struct control_value *cntl_value;
 
 	if (!controller || !name)
@@ -283,25 +669,34 @@ int cgroup_add_value_string(struct cgroup_controller *controller, const char *na
 			return ECGVALUEEXISTS;
 	}
 
-	cntl_value = calloc(1, sizeof(struct control_value));
+	if (value && strlen(value) >= CG_CONTROL_VALUE_MAX) {
+		fprintf(stderr, "value exceeds the maximum of %d characters\n",
+			CG_CONTROL_VALUE_MAX - 1);
+		return ECGCONFIGPARSEFAIL;
+	}
+
+	ret = cg_own_values(controller);
+	if (ret)
+		return ret;
+
+	ret = cg_reserve_value(controller);
+	if (ret)
+		return ret;
+
+	cntl_value = cg_cgroup_calloc(controller->cgroup, sizeof(struct control_value));
 	if (!cntl_value)
 		return ECGCONTROLLERCREATEFAILED;
 
-	strncpy(cntl_value->name, name, sizeof(cntl_value->name));
-	cntl_value->name[sizeof(cntl_value->name)-1] = '\0';
-
-	if (value) {
-		if (strlen(value) >= sizeof(cntl_value->value)) {
-			fprintf(stderr, "value exceeds the maximum of %ld characters\n",
-				sizeof(cntl_value->value) - 1);
+	cntl_value->name = cg_intern_name(name);
+	if (!cntl_value->name ||
+	    cg_set_cv_value(controller, cntl_value, value ? value : "")) {
+		if (!cg_controller_arena(controller))
 			free(cntl_value);
-			return ECGCONFIGPARSEFAIL;
-		}
+		return ECGCONTROLLERCREATEFAILED;
+	}
 
-		strncpy(cntl_value->value, value, sizeof(cntl_value->value));
-		cntl_value->value[sizeof(cntl_value->value)-1] = '\0';
+	if (value)
 		cntl_value->dirty = true;
-	}
 
 	controller->values[controller->index] = cntl_value;
 	controller->index++;
@@ -370,7 +765,11 @@ int cgroup_remove_value(struct cgroup_controller * const controller, const char
 
 	for (i = 0; i < controller->index; i++) {
 		if (strcmp(controller->values[i]->name, name) == 0) {
-			cgroup_free_value(controller->values[i]);
+			if (cg_own_values(controller))
+				return ECGOTHER;
+
+			if (!cg_controller_arena(controller))
+				cgroup_free_value(controller->values[i]);
 
 			if (i == (controller->index - 1)) {
 				/* This is the last entry in the table. There's nothing to move */
@@ -545,8 +944,17 @@ int cgroup_set_value_string(struct cgroup_controller *controller, const char *na
 		struct control_value *val = controller->values[i];
 
 		if (!strcmp(val->name, name)) {
-			strncpy(val->value, value, CG_CONTROL_VALUE_MAX);
-			val->value[sizeof(val->value)-1] = '\0';
+			/* Unchanged since it was read or written, nothing to write */
+			if (!cg_cv_is_dirty(controller, i) && !strcmp(val->value, value))
+				return 0;
+
+			if (cg_own_values(controller))
+				return ECGOTHER;
+
+			val = controller->values[i];
+			if (cg_set_cv_value(controller, val, value))
+				return ECGOTHER;
+
 			val->dirty = true;
 			return 0;
 		}
@@ -578,6 +986,7 @@ int cgroup_get_value_int64(struct cgroup_controller *controller, const char *nam
 
 int cgroup_set_value_int64(struct cgroup_controller *controller, const char *name, int64_t value)
 {
+	char buf[32];
 	int ret;
 	int i;
 
@@ -588,10 +997,20 @@ int cgroup_set_value_int64(struct cgroup_controller *controller, const char *nam
 		struct control_value *val = controller->values[i];
 
 		if (!strcmp(val->name, name)) {
-			ret = snprintf(val->value, sizeof(val->value), "%" PRId64, value);
-			if (ret >= sizeof(val->value))
+			ret = snprintf(buf, sizeof(buf), "%" PRId64, value);
+			if (ret >= sizeof(buf))
 				return ECGINVAL;
 
+			if (!cg_cv_is_dirty(controller, i) && !strcmp(val->value, buf))
+				return 0;
+
+			if (cg_own_values(controller))
+				return ECGOTHER;
+
+			val = controller->values[i];
+			if (cg_set_cv_value(controller, val, buf))
+				return ECGOTHER;
+
 			val->dirty = true;
 			return 0;
 		}
@@ -625,6 +1044,7 @@ int cgroup_get_value_uint64(struct cgroup_controller *controller, const char *na
 int cgroup_set_value_uint64(struct cgroup_controller *controller, const char *name,
 			    u_int64_t value)
 {
+	char buf[32];
 	int ret;
 	int i;
 
@@ -635,10 +1055,20 @@ int cgroup_set_value_uint64(struct cgroup_controller *controller, const char *na
 		struct control_value *val = controller->values[i];
 
 		if (!strcmp(val->name, name)) {
-			ret = snprintf(val->value, sizeof(val->value), "%" PRIu64, value);
-			if (ret >= sizeof(val->value))
+			ret = snprintf(buf, sizeof(buf), "%" PRIu64, value);
+			if (ret >= sizeof(buf))
 				return ECGINVAL;
 
+			if (!cg_cv_is_dirty(controller, i) && !strcmp(val->value, buf))
+				return 0;
+
+			if (cg_own_values(controller))
+				return ECGOTHER;
+
+			val = controller->values[i];
+			if (cg_set_cv_value(controller, val, buf))
+				return ECGOTHER;
+
 			val->dirty = true;
 			return 0;
 		}
@@ -677,7 +1107,6 @@ int cgroup_get_value_bool(struct cgroup_controller *controller, const char *name
 
 int cgroup_set_value_bool(struct cgroup_controller *controller, const char *name, bool value)
 {
-	int ret;
 	int i;
 
 	if (!controller || !name)
@@ -687,13 +1116,15 @@ int cgroup_set_value_bool(struct cgroup_controller *controller, const char *name
 		struct control_value *val = controller->values[i];
 
 		if (!strcmp(val->name, name)) {
-			if (value)
-				ret = snprintf(val->value, sizeof(val->value), "1");
-			else
-				ret = snprintf(val->value, sizeof(val->value), "0");
+			if (!cg_cv_is_dirty(controller, i) && !strcmp(val->value, value ? "1" : "0"))
+				return 0;
 
-			if (ret >= sizeof(val->value))
-				return ECGINVAL;
+			if (cg_own_values(controller))
+				return ECGOTHER;
+
+			val = controller->values[i];
+			if (cg_set_cv_value(controller, val, value ? "1" : "0"))
+				return ECGOTHER;
 
 			val->dirty = true;
 			return 0;
@@ -782,11 +1213,43 @@ char *cgroup_get_value_name(struct cgroup_controller *controller, int index)
 		return NULL;
 
 	if (index < controller->index)
-		return (controller->values[index])->name;
+		return (char *)(controller->values[index])->name;
 	else
 		return NULL;
 }
 
+int cgroup_peek_value(struct cgroup_controller *controller, int index, const char **name,
+		      const char **value)
+{
+	if (!controller || index < 0 || index >= controller->index)
+		return ECGINVAL;
+
+	if (name)
+		*name = controller->values[index]->name;
+	if (value)
+		*value = controller->values[index]->value;
+
+	return 0;
+}
+
+int cgroup_peek_value_string(struct cgroup_controller *controller, const char *name,
+			     const char **value)
+{
+	int i;
+
+	if (!controller || !name || !value)
+		return ECGINVAL;
+
+	for (i = 0; i < controller->index; i++) {
+		if (!strcmp(controller->values[i]->name, name)) {
+			*value = controller->values[i]->value;
+			return 0;
+		}
+	}
+
+	return ECGROUPVALUENOTEXIST;
+}
+
 char *cgroup_get_cgroup_name(struct cgroup *cgroup)
 {
 	if (!cgroup)
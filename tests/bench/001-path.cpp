@@ -0,0 +1,42 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmarks of the path building
+ */
+
+#include "bench.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const CONTROLLERS[] = {
+	"blkio", "cpu", "cpuacct", "cpuset", "devices", "freezer", "hugetlb", "memory",
+	"net_cls", "net_prio", "perf_event", "pids", "rdma", "misc",
+};
+static const int CONTROLLERS_CNT = ARRAY_SIZE(CONTROLLERS);
+
+static void build_path(struct bench_state *state, enum cg_version_t version,
+		       const char * const controller)
+{
+	char path[FILENAME_MAX];
+
+	cgroup_fixture_mount_table("/sys/fs/cgroup", CONTROLLERS, CONTROLLERS_CNT, version);
+
+	while (bench_running(state))
+		bench_keep(cg_build_path("system.slice/bench.service", path, controller));
+}
+
+/* The last controller of the table is the worst case of a linear search */
+BENCH(cg_build_path_v1)
+{
+	build_path(state, CGROUP_V1, "misc");
+}
+
+BENCH(cg_build_path_v2)
+{
+	build_path(state, CGROUP_V2, "memory");
+}
+
+BENCH(cg_build_path_no_controller)
+{
+	build_path(state, CGROUP_V2, NULL);
+}
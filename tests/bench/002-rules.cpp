@@ -0,0 +1,129 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmarks of the rule matching
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "bench.h"
+
+#include "libcgroup-internal.h"
+
+#define RULE_COUNTS	10, 100, 1000, 10000, 100000
+
+/* Number of lookups of one iteration, spread over the rule set */
+#define LOOKUPS		64
+
+static struct cgroup_rule *new_rule(const char * const username, uid_t uid,
+				    const char * const procname, const char * const destination)
+{
+	struct cgroup_rule *rule;
+
+	rule = (struct cgroup_rule *)calloc(1, sizeof(struct cgroup_rule));
+	if (!rule)
+		return NULL;
+
+	rule->uid = uid;
+	rule->gid = CGRULE_INVALID;
+	snprintf(rule->username, sizeof(rule->username), "%s", username);
+	snprintf(rule->destination, sizeof(rule->destination), "%s", destination);
+	if (procname)
+		rule->procname = strdup(procname);
+	rule->controllers[0] = strdup("cpu");
+
+	return rule;
+}
+
+int bench_build_rules(struct cgroup_rule_list * const lst, long count, bool indexed)
+{
+	char name[32], procname[32], destination[64];
+	struct cgroup_rule *rule;
+	long i;
+
+	memset(lst, 0, sizeof(*lst));
+
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "user%ld", i);
+		snprintf(procname, sizeof(procname), "proc%ld", i);
+		snprintf(destination, sizeof(destination), "users/%s", name);
+
+		if (i == count - 1)
+			rule = new_rule("*", CGRULE_WILD, NULL, "other");
+		else
+			rule = new_rule(name, BENCH_FIRST_UID + i, i % 4 ? NULL : procname, destination);
+		if (!rule)
+			return -1;
+
+		if (!lst->head)
+			lst->head = rule;
+		else
+			lst->tail->next = rule;
+		lst->tail = rule;
+		lst->len++;
+	}
+
+	if (indexed)
+		return cgroup_rule_index_build(lst->head, &lst->index) ? -1 : 0;
+
+	return 0;
+}
+
+static void match_rules(struct bench_state *state, bool indexed)
+{
+	struct cgroup_rule_list lst;
+	uid_t uids[LOOKUPS];
+	int i;
+
+	if (bench_build_rules(&lst, state->arg, indexed)) {
+		bench_error(state, "cannot build the rules");
+		cgroup_free_rule_list(&lst);
+		return;
+	}
+
+	/* Users spread over the rules, the last ones match the wildcard */
+	for (i = 0; i < LOOKUPS; i++)
+		uids[i] = BENCH_FIRST_UID + (uid_t)((state->arg + 8) * i / LOOKUPS);
+
+	state->items = LOOKUPS;
+	while (bench_running(state)) {
+		for (i = 0; i < LOOKUPS; i++)
+			bench_keep(cgroup_find_matching_rule(&lst, uids[i], 100, 1, "/usr/bin/proc0"));
+	}
+
+	cgroup_free_rule_list(&lst);
+}
+
+BENCH(rule_match_indexed, RULE_COUNTS)
+{
+	match_rules(state, true);
+}
+
+BENCH(rule_match_list, RULE_COUNTS)
+{
+	match_rules(state, false);
+}
+
+BENCH(rule_index_build, RULE_COUNTS)
+{
+	struct cgroup_rule_index *index;
+	struct cgroup_rule_list lst;
+
+	if (bench_build_rules(&lst, state->arg, false)) {
+		bench_error(state, "cannot build the rules");
+		cgroup_free_rule_list(&lst);
+		return;
+	}
+
+	state->items = state->arg;
+	while (bench_running(state)) {
+		if (cgroup_rule_index_build(lst.head, &index)) {
+			bench_error(state, "cannot build the index");
+			break;
+		}
+		cgroup_rule_index_free(&index);
+	}
+
+	cgroup_free_rule_list(&lst);
+}
@@ -0,0 +1,98 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmarks of the dictionary of the configuration parser
+ */
+
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+#include "libcgroup-internal.h"
+
+#define ITEM_COUNTS	8, 64, 512, 4096
+
+static std::vector<std::string> item_names(long count)
+{
+	std::vector<std::string> names;
+	long i;
+
+	for (i = 0; i < count; i++)
+		names.push_back("controller.setting_" + std::to_string(i));
+
+	return names;
+}
+
+BENCH(dictionary_add, ITEM_COUNTS)
+{
+	std::vector<std::string> names = item_names(state->arg);
+	struct cgroup_dictionary *dict;
+	long i;
+
+	state->items = state->arg;
+	while (bench_running(state)) {
+		if (cgroup_dictionary_create(&dict, CG_DICT_DONT_FREE_ITEMS)) {
+			bench_error(state, "cannot create the dictionary");
+			return;
+		}
+
+		for (i = 0; i < state->arg; i++)
+			cgroup_dictionary_add(dict, names[i].c_str(), "100");
+
+		cgroup_dictionary_free(dict);
+	}
+}
+
+BENCH(dictionary_get, ITEM_COUNTS)
+{
+	std::vector<std::string> names = item_names(state->arg);
+	struct cgroup_dictionary *dict;
+	const char *value;
+	long i;
+
+	if (cgroup_dictionary_create(&dict, CG_DICT_DONT_FREE_ITEMS)) {
+		bench_error(state, "cannot create the dictionary");
+		return;
+	}
+	for (i = 0; i < state->arg; i++)
+		cgroup_dictionary_add(dict, names[i].c_str(), "100");
+
+	state->items = state->arg;
+	while (bench_running(state)) {
+		for (i = 0; i < state->arg; i++) {
+			cgroup_dictionary_get(dict, names[i].c_str(), &value);
+			bench_keep(value);
+		}
+	}
+
+	cgroup_dictionary_free(dict);
+}
+
+BENCH(dictionary_iterate, ITEM_COUNTS)
+{
+	std::vector<std::string> names = item_names(state->arg);
+	struct cgroup_dictionary *dict;
+	const char *name, *value;
+	void *handle;
+	long i;
+	int ret;
+
+	if (cgroup_dictionary_create(&dict, CG_DICT_DONT_FREE_ITEMS)) {
+		bench_error(state, "cannot create the dictionary");
+		return;
+	}
+	for (i = 0; i < state->arg; i++)
+		cgroup_dictionary_add(dict, names[i].c_str(), "100");
+
+	state->items = state->arg;
+	while (bench_running(state)) {
+		ret = cgroup_dictionary_iterator_begin(dict, &handle, &name, &value);
+		while (ret == 0) {
+			bench_keep(value);
+			ret = cgroup_dictionary_iterator_next(&handle, &name, &value);
+		}
+		cgroup_dictionary_iterator_end(&handle);
+	}
+
+	cgroup_dictionary_free(dict);
+}
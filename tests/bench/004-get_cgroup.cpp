@@ -0,0 +1,48 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmarks of cgroup_get_cgroup() on a synthetic cgroup
+ * filesystem
+ */
+
+#include "bench.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static void get_cgroup(struct bench_state *state, enum cg_version_t version)
+{
+	struct cgroup_fixture_opts opts = { 0 };
+	struct cgroup_fixture fixture;
+	struct cgroup *cg;
+
+	opts.version = version;
+	opts.depth = 1;
+	opts.fanout = 1;
+	if (cgroup_fixture_create(&opts, &fixture)) {
+		bench_error(state, "cannot create the synthetic cgroup filesystem");
+		return;
+	}
+	cgroup_fixture_mount(&fixture);
+
+	while (bench_running(state)) {
+		cg = cgroup_new_cgroup("cg0");
+		if (!cg || cgroup_get_cgroup(cg)) {
+			bench_error(state, "cgroup_get_cgroup failed");
+			cgroup_free(&cg);
+			break;
+		}
+		cgroup_free(&cg);
+	}
+
+	cgroup_fixture_destroy(&fixture);
+}
+
+BENCH(cgroup_get_cgroup_v1)
+{
+	get_cgroup(state, CGROUP_V1);
+}
+
+BENCH(cgroup_get_cgroup_v2)
+{
+	get_cgroup(state, CGROUP_V2);
+}
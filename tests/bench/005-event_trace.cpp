@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmark of the classification of the events of the
+ * rules daemon
+ *
+ * A trace holds one event per line, "<pid> <uid> <gid> <procname>", like
+ * the daemon sees them after reading /proc/<pid>/status for a netlink
+ * event.  The trace is read from the file named by BENCH_EVENT_TRACE, or
+ * synthesized.  Each event is matched against the rules and the path of
+ * its destination is built, the group is not changed.
+ */
+
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+/* Number of rules the events are classified with */
+#define EVENT_RULES	1000
+
+/* Number of events of the synthetic trace */
+#define EVENT_CNT	4096
+
+struct trace_event {
+	pid_t pid;
+	uid_t uid;
+	gid_t gid;
+	std::string procname;
+};
+
+static int read_trace(const char * const path, std::vector<struct trace_event> &events)
+{
+	char procname[FILENAME_MAX];
+	struct trace_event event;
+	unsigned int uid, gid;
+	char line[FILENAME_MAX + 64];
+	FILE *f;
+	int pid;
+
+	f = fopen(path, "re");
+	if (!f)
+		return -1;
+
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "%d %u %u %4095s", &pid, &uid, &gid, procname) != 4)
+			continue;
+
+		event.pid = pid;
+		event.uid = uid;
+		event.gid = gid;
+		event.procname = procname;
+		events.push_back(event);
+	}
+	fclose(f);
+
+	return events.empty() ? -1 : 0;
+}
+
+static void synthesize_trace(std::vector<struct trace_event> &events)
+{
+	struct trace_event event;
+	int i;
+
+	/* About one event out of six is of a user without a rule */
+	for (i = 0; i < EVENT_CNT; i++) {
+		event.pid = 1000 + i;
+		event.uid = BENCH_FIRST_UID + (i * 7919) % (EVENT_RULES * 6 / 5);
+		event.gid = 100;
+		event.procname = "/usr/bin/proc" + std::to_string(i % 50);
+		events.push_back(event);
+	}
+}
+
+BENCH(event_classification)
+{
+	static const char * const controllers[] = { "cpu" };
+	std::vector<struct trace_event> events;
+	const char *trace = getenv("BENCH_EVENT_TRACE");
+	char path[FILENAME_MAX];
+	struct cgroup_rule_list lst;
+	struct cgroup_rule *rule;
+
+	if (trace) {
+		if (read_trace(trace, events)) {
+			bench_error(state, "cannot read the trace");
+			return;
+		}
+	} else {
+		synthesize_trace(events);
+	}
+
+	cgroup_fixture_mount_table("/sys/fs/cgroup", controllers, 1, CGROUP_V1);
+
+	if (bench_build_rules(&lst, EVENT_RULES, true)) {
+		bench_error(state, "cannot build the rules");
+		cgroup_free_rule_list(&lst);
+		return;
+	}
+
+	state->items = events.size();
+	while (bench_running(state)) {
+		for (const struct trace_event &event : events) {
+			rule = cgroup_find_matching_rule(&lst, event.uid, event.gid, event.pid,
+							 event.procname.c_str());
+			if (rule)
+				bench_keep(cg_build_path(rule->destination, path,
+							 rule->controllers[0]));
+		}
+	}
+
+	cgroup_free_rule_list(&lst);
+}
@@ -0,0 +1,115 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmarks of the operations over whole hierarchies, on
+ * synthetic cgroup filesystems of two levels of groups
+ *
+ * The argument is the number of children of each group, 224 makes about
+ * 50000 groups.  A hierarchy is created once per size, the first time it
+ * is used, and removed when the benchmarks exit.  Reading all the settings
+ * of 50000 groups takes tens of seconds, the largest size is only walked.
+ */
+
+#include <stdlib.h>
+
+#include <map>
+
+#include "bench.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+#define FANOUTS		10, 32, 100
+
+static std::map<long, struct cgroup_fixture> fixtures;
+
+static void destroy_fixtures(void)
+{
+	for (auto &entry : fixtures)
+		cgroup_fixture_destroy(&entry.second);
+}
+
+static struct cgroup_fixture *get_fixture(long fanout)
+{
+	struct cgroup_fixture_opts opts = { 0 };
+	struct cgroup_fixture fixture;
+
+	if (fixtures.find(fanout) == fixtures.end()) {
+		if (fixtures.empty())
+			atexit(destroy_fixtures);
+
+		opts.version = CGROUP_V2;
+		opts.depth = 2;
+		opts.fanout = fanout;
+		if (cgroup_fixture_create(&opts, &fixture))
+			return NULL;
+
+		fixtures[fanout] = fixture;
+	}
+
+	cgroup_fixture_mount(&fixtures[fanout]);
+
+	return &fixtures[fanout];
+}
+
+BENCH(walk_tree, FANOUTS, 224)
+{
+	struct cgroup_file_info info;
+	struct cgroup_fixture *fixture;
+	int base_level, ret;
+	uint64_t dirs;
+	void *handle;
+
+	fixture = get_fixture(state->arg);
+	if (!fixture) {
+		bench_error(state, "cannot create the synthetic cgroup filesystem");
+		return;
+	}
+
+	state->items = fixture->groups;
+	while (bench_running(state)) {
+		dirs = 0;
+		ret = cgroup_walk_tree_begin("memory", "/", 0, &handle, &info, &base_level);
+		while (ret == 0) {
+			if (info.type == CGROUP_FILE_TYPE_DIR)
+				dirs++;
+			ret = cgroup_walk_tree_next(0, &handle, &info, base_level);
+		}
+		cgroup_walk_tree_end(&handle);
+		bench_keep(dirs);
+	}
+}
+
+/* What cgsnapshot does: read all the settings of all the groups */
+BENCH(get_all_cgroups, FANOUTS)
+{
+	struct cgroup_fixture *fixture;
+	char name[FILENAME_MAX];
+	struct cgroup *cg;
+	long i, j;
+
+	fixture = get_fixture(state->arg);
+	if (!fixture) {
+		bench_error(state, "cannot create the synthetic cgroup filesystem");
+		return;
+	}
+
+	state->items = fixture->groups;
+	while (bench_running(state)) {
+		for (i = 0; i < state->arg; i++) {
+			for (j = -1; j < state->arg; j++) {
+				if (j < 0)
+					snprintf(name, sizeof(name), "cg%ld", i);
+				else
+					snprintf(name, sizeof(name), "cg%ld/cg%ld", i, j);
+
+				cg = cgroup_new_cgroup(name);
+				if (!cg || cgroup_get_cgroup(cg)) {
+					bench_error(state, "cgroup_get_cgroup failed");
+					cgroup_free(&cg);
+					return;
+				}
+				cgroup_free(&cg);
+			}
+		}
+	}
+}
@@ -0,0 +1,296 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmarks harness
+ *
+ * Each benchmark is run with a growing number of iterations, until one run
+ * takes at least the minimum time.  The results of that run are printed,
+ * and with --json they are written in the format of Google Benchmark, so
+ * that the results of two commits can be compared with compare.py or with
+ * the tools of Google Benchmark.
+ */
+
+#include <getopt.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "bench.h"
+
+#include "libcgroup-internal.h"
+
+struct bench_entry {
+	std::string name;
+	bench_func func;
+	std::vector<long> args;
+};
+
+struct bench_result {
+	std::string name;
+	uint64_t iterations;
+	double real_ns;
+	double cpu_ns;
+	double items_per_second;
+};
+
+static std::vector<struct bench_entry> *benchmarks;
+
+static const double BENCH_MAX_ITERATIONS = 1e9;
+
+int bench_register(const char *name, bench_func func, const std::vector<long> &args)
+{
+	if (!benchmarks)
+		benchmarks = new std::vector<struct bench_entry>();
+
+	benchmarks->push_back({ name, func, args });
+
+	return 0;
+}
+
+uint64_t bench_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+uint64_t bench_cpu_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int run_one(const struct bench_entry &entry, long arg, double min_ns,
+		   struct bench_result &result)
+{
+	struct bench_state state;
+	double iterations;
+
+	result.name = entry.name;
+	if (!entry.args.empty())
+		result.name += "/" + std::to_string(arg);
+
+	for (iterations = 1; ; ) {
+		state.arg = arg;
+		state.iterations = (uint64_t)iterations;
+		state.done = 0;
+		state.items = 0;
+		state.error.clear();
+		state.start_ns = 0;
+		state.start_cpu_ns = 0;
+		state.elapsed_ns = 0;
+		state.elapsed_cpu_ns = 0;
+		state.running = false;
+
+		entry.func(&state);
+		if (!state.error.empty()) {
+			fprintf(stderr, "%s: %s\n", result.name.c_str(), state.error.c_str());
+			return -1;
+		}
+
+		if (state.done < state.iterations) {
+			fprintf(stderr, "%s: the benchmark stopped early\n", result.name.c_str());
+			return -1;
+		}
+
+		if (state.elapsed_ns >= min_ns || iterations >= BENCH_MAX_ITERATIONS)
+			break;
+
+		/* Aim a bit over the minimum time, but grow at most ten times */
+		if (state.elapsed_ns * 10 <= min_ns)
+			iterations *= 10;
+		else
+			iterations = iterations * min_ns * 1.4 / state.elapsed_ns + 1;
+	}
+
+	result.iterations = state.iterations;
+	result.real_ns = (double)state.elapsed_ns / state.iterations;
+	result.cpu_ns = (double)state.elapsed_cpu_ns / state.iterations;
+	result.items_per_second = 0;
+	if (state.items)
+		result.items_per_second = state.items * 1e9 / result.real_ns;
+
+	return 0;
+}
+
+static void print_json_string(FILE *f, const std::string &str)
+{
+	fputc('"', f);
+	for (char c : str) {
+		if (c == '"' || c == '\\')
+			fputc('\\', f);
+		fputc(c, f);
+	}
+	fputc('"', f);
+}
+
+static int write_json(const char * const path, const std::vector<struct bench_result> &results)
+{
+	const struct cgroup_library_version *version;
+	char host[256] = "";
+	char date[64] = "";
+	const char *commit;
+	struct tm tm;
+	time_t now;
+	size_t i;
+	FILE *f;
+
+	f = fopen(path, "we");
+	if (!f) {
+		fprintf(stderr, "cannot open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	now = time(NULL);
+	if (localtime_r(&now, &tm))
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S%z", &tm);
+	gethostname(host, sizeof(host) - 1);
+	version = cgroup_version();
+	commit = getenv("BENCH_COMMIT");
+
+	fprintf(f, "{\n  \"context\": {\n    \"date\": ");
+	print_json_string(f, date);
+	fprintf(f, ",\n    \"host_name\": ");
+	print_json_string(f, host);
+	fprintf(f, ",\n    \"num_cpus\": %ld,\n", sysconf(_SC_NPROCESSORS_ONLN));
+	fprintf(f, "    \"library_version\": \"%u.%u.%u\",\n    \"commit\": ", version->major,
+		version->minor, version->release);
+	print_json_string(f, commit ? commit : "");
+	fprintf(f, "\n  },\n  \"benchmarks\": [");
+
+	for (i = 0; i < results.size(); i++) {
+		fprintf(f, "%s\n    {\n      \"name\": ", i ? "," : "");
+		print_json_string(f, results[i].name);
+		fprintf(f, ",\n      \"run_name\": ");
+		print_json_string(f, results[i].name);
+		fprintf(f, ",\n      \"run_type\": \"iteration\",\n");
+		fprintf(f, "      \"iterations\": %lu,\n", (unsigned long)results[i].iterations);
+		fprintf(f, "      \"real_time\": %.3f,\n", results[i].real_ns);
+		fprintf(f, "      \"cpu_time\": %.3f,\n", results[i].cpu_ns);
+		fprintf(f, "      \"time_unit\": \"ns\"");
+		if (results[i].items_per_second)
+			fprintf(f, ",\n      \"items_per_second\": %.3f", results[i].items_per_second);
+		fprintf(f, "\n    }");
+	}
+	fprintf(f, "\n  ]\n}\n");
+
+	if (fclose(f)) {
+		fprintf(stderr, "cannot write %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void usage(const char * const program_name)
+{
+	printf("Usage: %s [--filter=<substring>] [--min-time=<seconds>] [--json=<file>] [--list]\n",
+	       program_name);
+	printf("Run the libcgroup microbenchmarks\n");
+	printf("  -f, --filter=<substring>	Only run the benchmarks whose name contains it\n");
+	printf("  -h, --help			Display this help\n");
+	printf("  -j, --json=<file>		Write the results to the file, as JSON\n");
+	printf("  -l, --list			List the benchmarks\n");
+	printf("  -t, --min-time=<seconds>	Minimum time of a measured run, 0.5 by default\n");
+}
+
+int main(int argc, char *argv[])
+{
+	static struct option longopts[] = {
+		{"filter",	required_argument, NULL, 'f'},
+		{"help",	no_argument, NULL, 'h'},
+		{"json",	required_argument, NULL, 'j'},
+		{"list",	no_argument, NULL, 'l'},
+		{"min-time",	required_argument, NULL, 't'},
+		{0, 0, 0, 0}
+	};
+	std::vector<struct bench_result> results;
+	struct bench_result result;
+	const char *filter = NULL;
+	const char *json = NULL;
+	std::vector<long> args;
+	double min_time = 0.5;
+	bool list = false;
+	int failed = 0;
+	char *end;
+	int c;
+
+	while ((c = getopt_long(argc, argv, "f:hj:lt:", longopts, NULL)) > 0) {
+		switch (c) {
+		case 'f':
+			filter = optarg;
+			break;
+		case 'h':
+			usage(argv[0]);
+			return 0;
+		case 'j':
+			json = optarg;
+			break;
+		case 'l':
+			list = true;
+			break;
+		case 't':
+			min_time = strtod(optarg, &end);
+			if (*end || min_time <= 0) {
+				fprintf(stderr, "invalid minimum time %s\n", optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!benchmarks)
+		return 0;
+
+	if (!list)
+		printf("%-40s %14s %14s %16s\n", "Benchmark", "Time (ns)", "Iterations",
+		       "Items/s");
+
+	for (const struct bench_entry &entry : *benchmarks) {
+		if (filter && entry.name.find(filter) == std::string::npos)
+			continue;
+
+		if (list) {
+			printf("%s\n", entry.name.c_str());
+			continue;
+		}
+
+		args = entry.args;
+		if (args.empty())
+			args.push_back(0);
+
+		for (long arg : args) {
+			if (run_one(entry, arg, min_time * 1e9, result)) {
+				failed++;
+				continue;
+			}
+
+			printf("%-40s %14.1f %14lu", result.name.c_str(), result.real_ns,
+			       (unsigned long)result.iterations);
+			if (result.items_per_second)
+				printf(" %16.0f", result.items_per_second);
+			printf("\n");
+			fflush(stdout);
+
+			results.push_back(result);
+		}
+	}
+
+	if (json && write_json(json, results))
+		return 1;
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,120 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup microbenchmarks
+ *
+ * A benchmark is a function which prepares its data, then runs the measured
+ * code in a "while (bench_running(state))" loop.  The harness calls it with
+ * a growing number of iterations until the loop runs long enough to be
+ * timed, see bench.cpp.
+ */
+
+#ifndef _LIBCGROUP_BENCH_H
+#define _LIBCGROUP_BENCH_H
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "libcgroup.h"
+
+struct bench_state {
+	/* Argument of the run, e.g. the number of rules, 0 if none */
+	long arg;
+	/* Number of iterations requested by the harness */
+	uint64_t iterations;
+	/* Number of iterations done so far */
+	uint64_t done;
+	/* Items processed by one iteration, for the throughput, 0 if unset */
+	uint64_t items;
+	/* Set by bench_error(), the benchmark is then skipped */
+	std::string error;
+
+	uint64_t start_ns;
+	uint64_t start_cpu_ns;
+	uint64_t elapsed_ns;
+	uint64_t elapsed_cpu_ns;
+	bool running;
+};
+
+typedef void (*bench_func)(struct bench_state *state);
+
+/**
+ * Register a benchmark, run once per argument, or once with 0 if args is
+ * empty.
+ */
+int bench_register(const char *name, bench_func func, const std::vector<long> &args);
+
+/* Monotonic time, and cpu time of the process, in nanoseconds */
+uint64_t bench_now_ns(void);
+uint64_t bench_cpu_ns(void);
+
+/* uid of the user of the first synthetic rule */
+#define BENCH_FIRST_UID	10000
+
+struct cgroup_rule_list;
+
+/**
+ * Build a synthetic rule set, with one rule per user starting at
+ * #BENCH_FIRST_UID, every fourth of them restricted to a process name, and
+ * a final wildcard rule.  The list must be freed with
+ * cgroup_free_rule_list(), even on error.
+ * @param indexed Also build the index of the rules
+ * @return 0 on success, -1 on error
+ */
+int bench_build_rules(struct cgroup_rule_list * const lst, long count, bool indexed);
+
+/**
+ * Start the timer before the first iteration, stop it after the last one.
+ */
+static inline bool bench_running(struct bench_state *state)
+{
+	if (state->done == 0 && !state->running) {
+		state->running = true;
+		state->start_cpu_ns = bench_cpu_ns();
+		state->start_ns = bench_now_ns();
+	}
+
+	if (state->done < state->iterations) {
+		state->done++;
+		return true;
+	}
+
+	state->elapsed_ns = bench_now_ns() - state->start_ns;
+	state->elapsed_cpu_ns = bench_cpu_ns() - state->start_cpu_ns;
+	state->running = false;
+
+	return false;
+}
+
+/**
+ * Mark the run as failed, e.g. when preparing its data failed.
+ */
+static inline void bench_error(struct bench_state *state, const char *msg)
+{
+	state->error = msg;
+}
+
+/**
+ * Keep the compiler from optimizing away a result.
+ */
+template <class T> static inline void bench_keep(T const &value)
+{
+	asm volatile("" : : "r,m"(value) : "memory");
+}
+
+#define BENCH_CONCAT2(a, b) a##b
+#define BENCH_CONCAT(a, b) BENCH_CONCAT2(a, b)
+
+/**
+ * Define a benchmark:
+ *	BENCH(rule_match, 10, 1000) { ... }
+ * The arguments are optional.
+ */
+#define BENCH(name, ...)							\
+	static void name(struct bench_state *state);				\
+	static int BENCH_CONCAT(name, _registered) =				\
+		bench_register(#name, name, std::vector<long>{ __VA_ARGS__ });	\
+	static void name(struct bench_state *state)
+
+#endif /* _LIBCGROUP_BENCH_H */
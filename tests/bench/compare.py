@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-only
+#
+# Compare two result files of the libcgroup microbenchmarks
+#
+# Usage: compare.py [--threshold=<percent>] <baseline.json> <contender.json>
+#
+# The exit status is 1 if a benchmark got slower by more than the threshold,
+# 5% by default.
+#
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as json_file:
+        data = json.load(json_file)
+
+    return data.get('context', dict()), \
+        {bench['name']: bench for bench in data['benchmarks']}
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare two benchmark result files')
+    parser.add_argument('--threshold', type=float, default=5.0,
+                        help='slowdown reported as a regression, in percent')
+    parser.add_argument('baseline')
+    parser.add_argument('contender')
+    args = parser.parse_args()
+
+    base_ctx, base = load(args.baseline)
+    cont_ctx, cont = load(args.contender)
+
+    print('Comparing {} to {}'.format(base_ctx.get('commit') or args.baseline,
+                                      cont_ctx.get('commit') or args.contender))
+    print('{:<40} {:>14} {:>14} {:>9}'.format('Benchmark', 'Old (ns)', 'New (ns)', 'Change'))
+
+    regressions = 0
+    for name, bench in base.items():
+        if name not in cont:
+            print('{:<40} {:>14.1f} {:>14} {:>9}'.format(name, bench['real_time'], '-', '-'))
+            continue
+
+        old = bench['real_time']
+        new = cont[name]['real_time']
+        change = (new - old) * 100.0 / old if old else 0.0
+        mark = ''
+        if change > args.threshold:
+            mark = ' *'
+            regressions += 1
+
+        print('{:<40} {:>14.1f} {:>14.1f} {:>+8.1f}%{}'.format(name, old, new, change, mark))
+
+    for name, bench in cont.items():
+        if name not in base:
+            print('{:<40} {:>14} {:>14.1f} {:>9}'.format(name, '-', bench['real_time'], '-'))
+
+    return 1 if regressions else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
+
+# vim: set et ts=4 sw=4:
@@ -0,0 +1,601 @@
+// SPDX-License-Identifier: LGPL-2.1-only
+/**
+ * Synthetic cgroup filesystem for the unit tests and the benchmarks
+ *
+ * The groups are created depth first, each directory and file relative to
+ * the fd of its parent directory, so that a hierarchy of tens of thousands
+ * of groups is created in a few seconds.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "cgroup-fixture.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <ftw.h>
+
+#include <sys/stat.h>
+
+/* Size of the buffer a control file is built in */
+#define FIXTURE_FILE_MAX	(64 * 1024)
+
+/* Format of the lines of a stat file */
+enum fixture_stat_format {
+	/* "key value" */
+	FIXTURE_STAT_FLAT,
+	/* "key rbytes=1 wbytes=2 ...", like io.stat */
+	FIXTURE_STAT_NESTED,
+};
+
+/* A control file, NULL terminated lists */
+struct fixture_file {
+	const char *name;
+	const char *value;
+};
+
+struct fixture_stat {
+	const char *name;
+	enum fixture_stat_format format;
+	const char * const *keys;
+};
+
+struct fixture_controller {
+	const char *name;
+	const struct fixture_file *files[2];
+	struct fixture_stat stat[2];
+};
+
+static const char * const default_controllers[] = { "cpu", "memory", "pids" };
+
+static const char * const pressure =
+	"some avg10=0.00 avg60=0.00 avg300=0.00 total=0\n"
+	"full avg10=0.00 avg60=0.00 avg300=0.00 total=0\n";
+
+static const struct fixture_file cpu_v1_files[] = {
+	{ "cpu.shares", "1024\n" },
+	{ "cpu.cfs_quota_us", "-1\n" },
+	{ "cpu.cfs_period_us", "100000\n" },
+	{ "cpu.rt_runtime_us", "0\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file cpu_v2_files[] = {
+	{ "cpu.weight", "100\n" },
+	{ "cpu.weight.nice", "0\n" },
+	{ "cpu.max", "max 100000\n" },
+	{ "cpu.idle", "0\n" },
+	{ "cpu.pressure", NULL },
+	{ NULL, NULL },
+};
+
+static const char * const cpu_v1_stat[] = {
+	"nr_periods", "nr_throttled", "throttled_time", NULL,
+};
+
+static const char * const cpu_v2_stat[] = {
+	"usage_usec", "user_usec", "system_usec", "nr_periods", "nr_throttled",
+	"throttled_usec", "nr_bursts", "burst_usec", NULL,
+};
+
+static const struct fixture_file cpuacct_v1_files[] = {
+	{ "cpuacct.usage", "0\n" },
+	{ NULL, NULL },
+};
+
+static const char * const cpuacct_v1_stat[] = {
+	"user", "system", NULL,
+};
+
+static const struct fixture_file memory_v1_files[] = {
+	{ "memory.limit_in_bytes", "9223372036854771712\n" },
+	{ "memory.soft_limit_in_bytes", "9223372036854771712\n" },
+	{ "memory.memsw.limit_in_bytes", "9223372036854771712\n" },
+	{ "memory.usage_in_bytes", "0\n" },
+	{ "memory.max_usage_in_bytes", "0\n" },
+	{ "memory.swappiness", "60\n" },
+	{ "memory.use_hierarchy", "1\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file memory_v2_files[] = {
+	{ "memory.current", "0\n" },
+	{ "memory.min", "0\n" },
+	{ "memory.low", "0\n" },
+	{ "memory.high", "max\n" },
+	{ "memory.max", "max\n" },
+	{ "memory.swap.current", "0\n" },
+	{ "memory.swap.max", "max\n" },
+	{ "memory.oom.group", "0\n" },
+	{ "memory.events", "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\noom_group_kill 0\n" },
+	{ "memory.pressure", NULL },
+	{ NULL, NULL },
+};
+
+static const char * const memory_v1_stat[] = {
+	"cache", "rss", "rss_huge", "shmem", "mapped_file", "dirty", "writeback",
+	"swap", "pgpgin", "pgpgout", "pgfault", "pgmajfault", "inactive_anon",
+	"active_anon", "inactive_file", "active_file", "unevictable",
+	"hierarchical_memory_limit", "hierarchical_memsw_limit", "total_cache",
+	"total_rss", "total_rss_huge", "total_shmem", "total_mapped_file",
+	"total_dirty", "total_writeback", "total_swap", "total_pgpgin",
+	"total_pgpgout", "total_pgfault", "total_pgmajfault", "total_inactive_anon",
+	"total_active_anon", "total_inactive_file", "total_active_file",
+	"total_unevictable", NULL,
+};
+
+static const char * const memory_v2_stat[] = {
+	"anon", "file", "kernel", "kernel_stack", "pagetables", "sec_pagetables",
+	"percpu", "sock", "vmalloc", "shmem", "zswap", "zswapped", "file_mapped",
+	"file_dirty", "file_writeback", "swapcached", "anon_thp", "file_thp",
+	"shmem_thp", "inactive_anon", "active_anon", "inactive_file", "active_file",
+	"unevictable", "slab_reclaimable", "slab_unreclaimable", "slab",
+	"workingset_refault_anon", "workingset_refault_file",
+	"workingset_activate_anon", "workingset_activate_file",
+	"workingset_restore_anon", "workingset_restore_file",
+	"workingset_nodereclaim", "pgscan", "pgsteal", "pgscan_kswapd",
+	"pgscan_direct", "pgsteal_kswapd", "pgsteal_direct", "pgfault", "pgmajfault",
+	"pgrefill", "pgactivate", "pgdeactivate", "pglazyfree", "pglazyfreed",
+	"thp_fault_alloc", "thp_collapse_alloc", NULL,
+};
+
+static const struct fixture_file pids_files[] = {
+	{ "pids.current", "0\n" },
+	{ "pids.max", "max\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file cpuset_v1_files[] = {
+	{ "cpuset.cpus", "0-3\n" },
+	{ "cpuset.mems", "0\n" },
+	{ "cpuset.cpu_exclusive", "0\n" },
+	{ "cpuset.mem_exclusive", "0\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file cpuset_v2_files[] = {
+	{ "cpuset.cpus", "0-3\n" },
+	{ "cpuset.mems", "0\n" },
+	{ "cpuset.cpus.effective", "0-3\n" },
+	{ "cpuset.mems.effective", "0\n" },
+	{ "cpuset.cpus.partition", "member\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file blkio_v1_files[] = {
+	{ "blkio.weight", "500\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file io_v2_files[] = {
+	{ "io.weight", "default 100\n" },
+	{ "io.max", "" },
+	{ "io.pressure", NULL },
+	{ NULL, NULL },
+};
+
+static const char * const io_v2_stat[] = {
+	"8:0", "8:16", "253:0", NULL,
+};
+
+static const struct fixture_file freezer_v1_files[] = {
+	{ "freezer.state", "THAWED\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file devices_v1_files[] = {
+	{ "devices.list", "a *:* rwm\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_controller controllers[] = {
+	{ "cpu", { cpu_v1_files, cpu_v2_files },
+	  { { "cpu.stat", FIXTURE_STAT_FLAT, cpu_v1_stat },
+	    { "cpu.stat", FIXTURE_STAT_FLAT, cpu_v2_stat } } },
+	{ "cpuacct", { cpuacct_v1_files, NULL },
+	  { { "cpuacct.stat", FIXTURE_STAT_FLAT, cpuacct_v1_stat }, { NULL } } },
+	{ "memory", { memory_v1_files, memory_v2_files },
+	  { { "memory.stat", FIXTURE_STAT_FLAT, memory_v1_stat },
+	    { "memory.stat", FIXTURE_STAT_FLAT, memory_v2_stat } } },
+	{ "pids", { pids_files, pids_files }, { { NULL }, { NULL } } },
+	{ "cpuset", { cpuset_v1_files, cpuset_v2_files }, { { NULL }, { NULL } } },
+	{ "blkio", { blkio_v1_files, NULL }, { { NULL }, { NULL } } },
+	{ "io", { NULL, io_v2_files },
+	  { { NULL }, { "io.stat", FIXTURE_STAT_NESTED, io_v2_stat } } },
+	{ "freezer", { freezer_v1_files, NULL }, { { NULL }, { NULL } } },
+	{ "devices", { devices_v1_files, NULL }, { { NULL }, { NULL } } },
+};
+
+static const struct fixture_file core_v1_files[] = {
+	{ "tasks", "" },
+	{ "cgroup.procs", "" },
+	{ "cgroup.clone_children", "0\n" },
+	{ "notify_on_release", "0\n" },
+	{ NULL, NULL },
+};
+
+static const struct fixture_file core_v2_files[] = {
+	{ "cgroup.procs", "" },
+	{ "cgroup.threads", "" },
+	{ "cgroup.type", "domain\n" },
+	{ "cgroup.events", "populated 0\nfrozen 0\n" },
+	{ "cgroup.freeze", "0\n" },
+	{ "cgroup.max.depth", "max\n" },
+	{ "cgroup.max.descendants", "max\n" },
+	{ NULL, NULL },
+};
+
+struct fixture_ctx {
+	const struct cgroup_fixture *fixture;
+	int stat_lines;
+	char *buf;
+	/* State of the generator of the values of the stat files */
+	unsigned long seed;
+	/* Space separated list of the controllers, for cgroup v2 */
+	char controllers[FILENAME_MAX];
+};
+
+static const struct fixture_controller *find_controller(const char * const name)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(controllers); i++) {
+		if (strcmp(controllers[i].name, name) == 0)
+			return &controllers[i];
+	}
+
+	return NULL;
+}
+
+static unsigned long next_value(struct fixture_ctx * const ctx)
+{
+	ctx->seed = ctx->seed * 6364136223846793005UL + 1442695040888963407UL;
+
+	return (ctx->seed >> 33) & ((1UL << 30) - 1);
+}
+
+static int write_file(int dir_fd, const char * const name, const char * const content,
+		      size_t len)
+{
+	ssize_t ret;
+	int fd;
+
+	fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		return -1;
+
+	ret = write(fd, content, len);
+	close(fd);
+
+	return ret == (ssize_t)len ? 0 : -1;
+}
+
+static int write_files(int dir_fd, const struct fixture_file *files)
+{
+	const char *value;
+
+	for (; files && files->name; files++) {
+		value = files->value ? files->value : pressure;
+		if (write_file(dir_fd, files->name, value, strlen(value)))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int write_stat(struct fixture_ctx * const ctx, int dir_fd,
+		      const struct fixture_stat * const stat)
+{
+	size_t len = 0, keys_cnt;
+	int lines, i, ret;
+
+	if (!stat->name)
+		return 0;
+
+	for (keys_cnt = 0; stat->keys[keys_cnt]; keys_cnt++)
+		;
+
+	lines = ctx->stat_lines ? ctx->stat_lines : (int)keys_cnt;
+	for (i = 0; i < lines; i++) {
+		/* The keys beyond the list of the kernel get a suffix */
+		if ((size_t)i < keys_cnt)
+			ret = snprintf(ctx->buf + len, FIXTURE_FILE_MAX - len, "%s",
+				       stat->keys[i]);
+		else
+			ret = snprintf(ctx->buf + len, FIXTURE_FILE_MAX - len, "%s_%zu",
+				       stat->keys[i % keys_cnt], i / keys_cnt);
+		if (ret < 0 || (size_t)ret >= FIXTURE_FILE_MAX - len)
+			goto too_long;
+		len += ret;
+
+		if (stat->format == FIXTURE_STAT_FLAT)
+			ret = snprintf(ctx->buf + len, FIXTURE_FILE_MAX - len, " %lu\n",
+				       next_value(ctx));
+		else
+			ret = snprintf(ctx->buf + len, FIXTURE_FILE_MAX - len,
+				       " rbytes=%lu wbytes=%lu rios=%lu wios=%lu dbytes=0 dios=0\n",
+				       next_value(ctx), next_value(ctx), next_value(ctx) >> 12,
+				       next_value(ctx) >> 12);
+		if (ret < 0 || (size_t)ret >= FIXTURE_FILE_MAX - len)
+			goto too_long;
+		len += ret;
+	}
+
+	return write_file(dir_fd, stat->name, ctx->buf, len);
+
+too_long:
+	errno = EFBIG;
+	return -1;
+}
+
+/**
+ * Fill the directory of a group with the files of the controllers of the
+ * index, or with the files of all the controllers on cgroup v2 (index -1).
+ */
+static int fill_group(struct fixture_ctx * const ctx, int dir_fd, int ctrl_index, bool leaf)
+{
+	const struct cgroup_fixture *fixture = ctx->fixture;
+	const struct fixture_controller *ctrl;
+	int version, i, first, last;
+
+	version = fixture->version == CGROUP_V1 ? 0 : 1;
+
+	if (write_files(dir_fd, version ? core_v2_files : core_v1_files))
+		return -1;
+
+	if (version) {
+		if (write_file(dir_fd, "cgroup.controllers", ctx->controllers,
+			       strlen(ctx->controllers)))
+			return -1;
+		if (write_file(dir_fd, "cgroup.subtree_control", ctx->controllers,
+			       leaf ? 0 : strlen(ctx->controllers)))
+			return -1;
+	}
+
+	first = ctrl_index < 0 ? 0 : ctrl_index;
+	last = ctrl_index < 0 ? fixture->controllers_cnt - 1 : ctrl_index;
+	for (i = first; i <= last; i++) {
+		ctrl = find_controller(fixture->controllers[i]);
+		if (!ctrl)
+			continue;
+
+		if (write_files(dir_fd, ctrl->files[version]))
+			return -1;
+		if (write_stat(ctx, dir_fd, &ctrl->stat[version]))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * Create the children of a group, and recursively their children.
+ */
+static int create_children(struct fixture_ctx * const ctx, int dir_fd, int ctrl_index,
+			   int level, long * const groups)
+{
+	const struct cgroup_fixture *fixture = ctx->fixture;
+	char name[32];
+	int child_fd;
+	int i, ret;
+
+	for (i = 0; i < fixture->fanout; i++) {
+		snprintf(name, sizeof(name), "cg%d", i);
+		if (mkdirat(dir_fd, name, 0755))
+			return -1;
+
+		child_fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+		if (child_fd < 0)
+			return -1;
+
+		ret = fill_group(ctx, child_fd, ctrl_index, level == fixture->depth);
+		if (!ret && level < fixture->depth)
+			ret = create_children(ctx, child_fd, ctrl_index, level + 1, groups);
+		close(child_fd);
+		if (ret)
+			return -1;
+
+		(*groups)++;
+	}
+
+	return 0;
+}
+
+static int create_hierarchy(struct fixture_ctx * const ctx, const char * const path,
+			    int ctrl_index, long * const groups)
+{
+	int dir_fd, ret;
+
+	if (mkdir(path, 0755) && errno != EEXIST)
+		return -1;
+
+	dir_fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd < 0)
+		return -1;
+
+	ret = fill_group(ctx, dir_fd, ctrl_index, ctx->fixture->depth == 0);
+	if (!ret && ctx->fixture->depth > 0)
+		ret = create_children(ctx, dir_fd, ctrl_index, 1, groups);
+	close(dir_fd);
+
+	return ret;
+}
+
+int cgroup_fixture_create(const struct cgroup_fixture_opts * const opts,
+			  struct cgroup_fixture * const fixture)
+{
+	char path[FILENAME_MAX];
+	struct fixture_ctx ctx;
+	const char *tmpdir;
+	long groups = 0;
+	int i, ret = -1;
+	size_t len = 0;
+
+	memset(fixture, 0, sizeof(*fixture));
+	memset(&ctx, 0, sizeof(ctx));
+
+	if (opts->depth < 0 || opts->fanout < 0 || opts->stat_lines < 0 ||
+	    (opts->version != CGROUP_V1 && opts->version != CGROUP_V2) ||
+	    opts->controllers_cnt > CG_CONTROLLER_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fixture->version = opts->version;
+	fixture->depth = opts->depth;
+	fixture->fanout = opts->fanout;
+	if (opts->controllers) {
+		for (i = 0; i < opts->controllers_cnt; i++)
+			fixture->controllers[i] = opts->controllers[i];
+		fixture->controllers_cnt = opts->controllers_cnt;
+	} else {
+		for (i = 0; i < (int)ARRAY_SIZE(default_controllers); i++)
+			fixture->controllers[i] = default_controllers[i];
+		fixture->controllers_cnt = ARRAY_SIZE(default_controllers);
+	}
+
+	if (opts->root) {
+		snprintf(fixture->root, sizeof(fixture->root), "%s", opts->root);
+		if (mkdir(fixture->root, 0755)) {
+			/* Do not let cgroup_fixture_destroy() remove a directory of the caller */
+			fixture->root[0] = '\0';
+			return -1;
+		}
+	} else {
+		tmpdir = getenv("TMPDIR");
+		snprintf(fixture->root, sizeof(fixture->root), "%s/cgfixture.XXXXXX",
+			 tmpdir ? tmpdir : "/tmp");
+		if (!mkdtemp(fixture->root))
+			return -1;
+	}
+
+	ctx.fixture = fixture;
+	ctx.stat_lines = opts->stat_lines;
+	ctx.seed = 1;
+	ctx.buf = malloc(FIXTURE_FILE_MAX);
+	if (!ctx.buf)
+		goto out;
+
+	for (i = 0; i < fixture->controllers_cnt; i++) {
+		ret = snprintf(ctx.controllers + len, sizeof(ctx.controllers) - len, "%s%s",
+			       i ? " " : "", fixture->controllers[i]);
+		if (ret < 0 || (size_t)ret >= sizeof(ctx.controllers) - len) {
+			errno = ENAMETOOLONG;
+			ret = -1;
+			goto out;
+		}
+		len += ret;
+	}
+	if (len)
+		ctx.controllers[len++] = '\n';
+
+	if (fixture->version == CGROUP_V2) {
+		ret = create_hierarchy(&ctx, fixture->root, -1, &groups);
+	} else {
+		for (i = 0, ret = 0; i < fixture->controllers_cnt && !ret; i++) {
+			ret = snprintf(path, sizeof(path), "%s/%s", fixture->root,
+				       fixture->controllers[i]);
+			if (ret < 0 || (size_t)ret >= sizeof(path)) {
+				errno = ENAMETOOLONG;
+				ret = -1;
+				break;
+			}
+			groups = 0;
+			ret = create_hierarchy(&ctx, path, i, &groups);
+		}
+	}
+	fixture->groups = groups;
+
+out:
+	free(ctx.buf);
+	if (ret)
+		cgroup_fixture_destroy(fixture);
+
+	return ret ? -1 : 0;
+}
+
+void cgroup_fixture_mount_table(const char * const root, const char * const controllers[],
+				int count, enum cg_version_t version)
+{
+	int i;
+
+	pthread_rwlock_wrlock(&cg_mount_table_lock);
+
+	memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+	memset(&cg_namespace_table, 0, sizeof(cg_namespace_table));
+	memset(&cg_cgroup_v2_mount_path, 0, sizeof(cg_cgroup_v2_mount_path));
+
+	for (i = 0; i < count && i < CG_CONTROLLER_MAX; i++) {
+		snprintf(cg_mount_table[i].name, CONTROL_NAMELEN_MAX, "%s", controllers[i]);
+		if (version == CGROUP_V1)
+			snprintf(cg_mount_table[i].mount.path, FILENAME_MAX, "%s/%s", root,
+				 controllers[i]);
+		else
+			snprintf(cg_mount_table[i].mount.path, FILENAME_MAX, "%s", root);
+		cg_mount_table[i].version = version;
+	}
+
+	if (version == CGROUP_V2)
+		snprintf(cg_cgroup_v2_mount_path, FILENAME_MAX, "%s", root);
+
+	cg_mount_index_build();
+	cgroup_initialized = 1;
+
+	pthread_rwlock_unlock(&cg_mount_table_lock);
+}
+
+void cgroup_fixture_mount(const struct cgroup_fixture * const fixture)
+{
+	cgroup_fixture_mount_table(fixture->root, fixture->controllers, fixture->controllers_cnt,
+				   fixture->version);
+}
+
+int cgroup_fixture_leaf_name(const struct cgroup_fixture * const fixture, long index,
+			     char * const name, size_t len)
+{
+	long leaves = 1, div;
+	size_t used = 0;
+	int i, ret;
+
+	for (i = 0; i < fixture->depth; i++)
+		leaves *= fixture->fanout;
+
+	if (fixture->depth == 0 || index < 0 || index >= leaves)
+		return -1;
+
+	name[0] = '\0';
+	for (div = leaves / fixture->fanout; div > 0; div /= fixture->fanout) {
+		ret = snprintf(name + used, len - used, "%scg%ld", used ? "/" : "",
+			       index / div);
+		if (ret < 0 || (size_t)ret >= len - used)
+			return -1;
+		used += ret;
+		index %= div;
+	}
+
+	return 0;
+}
+
+static int remove_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+int cgroup_fixture_destroy(struct cgroup_fixture * const fixture)
+{
+	if (fixture->root[0] == '\0')
+		return 0;
+
+	if (nftw(fixture->root, remove_cb, 64, FTW_DEPTH | FTW_PHYS))
+		return -1;
+
+	fixture->root[0] = '\0';
+
+	return 0;
+}
@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * Synthetic cgroup filesystem for the unit tests and the benchmarks
+ *
+ * A fixture is a tree of plain directories and files laid out like a
+ * cgroup v1 or v2 hierarchy, with the control files of the controllers
+ * filled with realistic values.  It is created in a local directory, so
+ * that no privilege is needed, and the mount table of the library is then
+ * pointed at it.
+ */
+
+#ifndef _CGROUP_FIXTURE_H
+#define _CGROUP_FIXTURE_H
+
+#include "libcgroup-internal.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct cgroup_fixture_opts {
+	/* Directory to create, NULL for a new directory in $TMPDIR or /tmp */
+	const char *root;
+	/* CGROUP_V1: one hierarchy per controller, CGROUP_V2: one for all */
+	enum cg_version_t version;
+	/* Controllers, NULL for cpu, memory and pids */
+	const char * const *controllers;
+	int controllers_cnt;
+	/* Levels of groups below the root, and number of children of a group */
+	int depth;
+	int fanout;
+	/* Lines of the stat files, 0 for the keys the kernel lists */
+	int stat_lines;
+};
+
+struct cgroup_fixture {
+	char root[FILENAME_MAX];
+	enum cg_version_t version;
+	const char *controllers[CG_CONTROLLER_MAX];
+	int controllers_cnt;
+	int depth;
+	int fanout;
+	/* Number of groups, the root excluded */
+	long groups;
+};
+
+/**
+ * Create a synthetic hierarchy.  Each group is named after its position,
+ * e.g. "cg3/cg1" for the second child of the fourth child of the root.
+ * @param opts The layout of the hierarchy
+ * @param fixture Filled with the description of the hierarchy
+ * @return 0 on success, -1 on error with errno set.  The directories
+ *	created before the error are removed.
+ */
+int cgroup_fixture_create(const struct cgroup_fixture_opts * const opts,
+			  struct cgroup_fixture * const fixture);
+
+/**
+ * Point the mount table of the library at a fixture.  The library does
+ * not need to be initialized before.
+ */
+void cgroup_fixture_mount(const struct cgroup_fixture * const fixture);
+
+/**
+ * Point the mount table of the library at controllers mounted below a
+ * local directory, <root>/<controller> on cgroup v1 and <root> on cgroup
+ * v2.  The directories are neither created nor checked.
+ */
+void cgroup_fixture_mount_table(const char * const root, const char * const controllers[],
+				int count, enum cg_version_t version);
+
+/**
+ * Get the name of a leaf group of a fixture.
+ * @param index Index of the leaf, from 0 to fanout^depth - 1
+ * @return 0 on success, -1 if the index is out of range or the name does
+ *	not fit
+ */
+int cgroup_fixture_leaf_name(const struct cgroup_fixture * const fixture, long index,
+			     char * const name, size_t len);
+
+/**
+ * Remove the directory of a fixture and all it contains.
+ */
+int cgroup_fixture_destroy(struct cgroup_fixture * const fixture);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _CGROUP_FIXTURE_H */
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+# SPDX-License-Identifier: LGPL-2.1-only
+#
+# Bulk reads of cgroups, stats and pids using the python bindings
+#
+
+from cgroup import Cgroup as CgroupCli, Mode
+from libcgroup import Cgroup, Version
+from process import Process
+import consts
+import ftests
+import sys
+import os
+
+
+CGNAME = '089bulkreads/cgwithpids'
+CGNAME2 = '089bulkreads/cgwithoutpids'
+CONTROLLERS = ['cpu', 'pids']
+PID_CNT = 10
+
+pid_list = list()
+
+
+def prereqs(config):
+    result = consts.TEST_PASSED
+    cause = None
+
+    if config.args.container:
+        result = consts.TEST_SKIPPED
+        cause = 'This test cannot be run within a container'
+        return result, cause
+
+    if Cgroup.cgroup_mode() != Mode.CGROUP_MODE_UNIFIED:
+        result = consts.TEST_SKIPPED
+        cause = 'This test requires the unified cgroup v2 hierarchy'
+
+    return result, cause
+
+
+def setup(config):
+    CgroupCli.create(config, CONTROLLERS, CGNAME)
+    CgroupCli.create(config, CONTROLLERS, CGNAME2)
+
+    for i in range(0, PID_CNT):
+        pid = config.process.create_process(config)
+        pid_list.append(pid)
+
+    CgroupCli.classify(config, CONTROLLERS, CGNAME, pid_list, ignore_systemd=True)
+
+
+def test(config):
+    result = consts.TEST_PASSED
+    cause = None
+
+    #
+    # Test 1 - get_many() reads the same settings as get()
+    #
+    cgs = [Cgroup(CGNAME, Version.CGROUP_V2), Cgroup(CGNAME2, Version.CGROUP_V2)]
+    Cgroup.get_many(cgs)
+
+    for cg in cgs:
+        cgone = Cgroup(cg.name, Version.CGROUP_V2)
+        cgone.get()
+
+        if cg.controllers.keys() != cgone.controllers.keys():
+            result = consts.TEST_FAILED
+            tmp_cause = 'get_many() read controllers {} for {}, get() read {}'.format(
+                        list(cg.controllers.keys()), cg.name, list(cgone.controllers.keys()))
+            cause = '\n'.join(filter(None, [cause, tmp_cause]))
+
+    #
+    # Test 2 - the stats are read as integers, nested keys included
+    #
+    stats = cgs[0].read_stats('cpu', 'cpu.stat')
+    if 'usage_usec' not in stats or not isinstance(stats['usage_usec'], int):
+        result = consts.TEST_FAILED
+        tmp_cause = 'Unexpected cpu.stat values {}'.format(stats.items())
+        cause = '\n'.join(filter(None, [cause, tmp_cause]))
+
+    # pids.current holds a single word, read as a key without a value
+    views = Cgroup.read_stats_many(cgs, 'pids', 'pids.current')
+    if len(views) != 2 or views[1].keys() != ['0']:
+        result = consts.TEST_FAILED
+        tmp_cause = 'Unexpected pids.current views {}'.format([v.items() for v in views])
+        cause = '\n'.join(filter(None, [cause, tmp_cause]))
+
+    #
+    # Test 3 - the pids are read into a buffer shared with a memoryview
+    #
+    buf = cgs[0].read_pids()
+    pids = memoryview(buf).tolist()
+
+    if sorted(pids) != sorted(pid_list):
+        result = consts.TEST_FAILED
+        tmp_cause = 'The pid lists do not match\n{}\n{}'.format(sorted(pid_list), pids)
+        cause = '\n'.join(filter(None, [cause, tmp_cause]))
+
+    cgs[1].read_pids(buffer=buf)
+    if len(buf) != 0:
+        result = consts.TEST_FAILED
+        tmp_cause = 'The reused pid buffer unexpectedly was populated\n{}'.format(buf.tolist())
+        cause = '\n'.join(filter(None, [cause, tmp_cause]))
+
+    return result, cause
+
+
+def teardown(config):
+    Process.kill(config, pid_list)
+    CgroupCli.delete(config, CONTROLLERS, os.path.dirname(CGNAME), recursive=True)
+
+
+def main(config):
+    [result, cause] = prereqs(config)
+    if result != consts.TEST_PASSED:
+        return [result, cause]
+
+    setup(config)
+    [result, cause] = test(config)
+    teardown(config)
+
+    return [result, cause]
+
+
+if __name__ == '__main__':
+    config = ftests.parse_args()
+    # this test was invoked directly.  run only it
+    config.args.num = int(os.path.basename(__file__).split('-')[0])
+    sys.exit(ftests.main(config))
+
+# vim: set et ts=4 sw=4:
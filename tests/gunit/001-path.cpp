@@ -55,6 +55,8 @@ class BuildPathV1Test : public ::testing::Test {
 			cg_mount_table[i].mount.next = NULL;
 		}
 
+		cg_mount_index_build();
+
 		// Give a couple of the entries a namespace as well
 		cg_namespace_table[1] =	NAMESPACE1;
 		cg_namespace_table[5] =	NAMESPACE5;
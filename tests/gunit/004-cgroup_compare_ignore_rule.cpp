@@ -1,6 +1,6 @@
 /* SPDX-License-Identifier: LGPL-2.1-only */
 /**
- * libcgroup googletest for cgroup_compare_ignore_rule()
+ * libcgroup googletest for cg_compare_ignore_rule()
  *
  * Copyright (c) 2019 Oracle and/or its affiliates.  All rights reserved.
  * Author: Tom Hromatka <tom.hromatka@oracle.com>
@@ -13,6 +13,19 @@
 class CgroupCompareIgnoreRuleTest : public ::testing::Test {
 };
 
+static bool cgroup_compare_ignore_rule(const struct cgroup_rule * const rule, pid_t pid,
+				       const char * const procname)
+{
+	struct cg_proc_cgroups pc;
+	bool ret;
+
+	cg_proc_cgroups_init(&pc, pid);
+	ret = cg_compare_ignore_rule(rule, &pc, procname);
+	cg_proc_cgroups_free(&pc);
+
+	return ret;
+}
+
 static void CreateCgroupProcFile(const char * const contents)
 {
 	FILE *f;
@@ -27,7 +40,7 @@ static void CreateCgroupProcFile(const char * const contents)
 TEST_F(CgroupCompareIgnoreRuleTest, NotAnIgnore)
 {
 	char procname[] = "myprocess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 1234;
 	bool ret;
 
@@ -43,7 +56,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, SimpleMatch)
 		"7:cpuacct:/SimpleMatchCgroup";
 	char rule_controller[] = "cpuacct";
 	char procname[] = "procfoo";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 2345;
 	bool ret;
 
@@ -64,7 +77,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, CgroupsDontMatch)
 		"2:cpuacct:CloseButNotQuite";
 	char rule_controller[] = "cpuacct";
 	char procname[] = "procfoo2";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 4567;
 	bool ret;
 
@@ -84,7 +97,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, ControllersDontMatch)
 		"5:memory:MyCgroup";
 	char rule_controller[] = "cpuacct";
 	char procname[] = "procfoo3";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 5678;
 	bool ret;
 
@@ -125,7 +138,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, MatchChildFolder)
 		"7:cpuset:/parentcg/childcg/grandchildcg";
 	char rule_controller[] = "cpuset";
 	char procname[] = "childprocess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 7890;
 	bool ret;
 
@@ -146,7 +159,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, MatchGrandchildFolder)
 		"1:hugetlb:/parentcg/childcg/grandchildcg";
 	char rule_controller[] = "hugetlb";
 	char procname[] = "granchildprocess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 8901;
 	bool ret;
 
@@ -182,7 +195,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, MatchSimilarChildFolder)
 		"1:hugetlb:/parentcg/childcg2";
 	char rule_controller[] = "hugetlb";
 	char procname[] = "granchildprocess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 8901;
 	bool ret;
 
@@ -215,7 +228,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, RealWorldMatch)
 		"0::/user.slice/user-1000.slice/session-1.scope\n";
 	char rule_controller[] = "cpu";
 	char procname[] = "granchildprocess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 8901;
 	bool ret;
 
@@ -248,7 +261,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, RealWorldNoMatch)
 		"0::/user.slice/user-1000.slice/session-1.scope\n";
 	char rule_controller[] = "net_cls";
 	char procname[] = "NotMatching";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 9012;
 	bool ret;
 
@@ -269,7 +282,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, SimilarFolderNoMatch)
 		"4:memory:/folder1";
 	char rule_controller[] = "memory";
 	char procname[] = "childprocess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 2345;
 	bool ret;
 
@@ -290,7 +303,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, RootDestinationMatch)
 		"2:freezer:/";
 	char rule_controller[] = "freezer";
 	char procname[] = "ANewProcess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 3456;
 	bool ret;
 
@@ -311,7 +324,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, RootDestinationNoMatch)
 		"2:freezer:/somerandomcg";
 	char rule_controller[] = "freezer";
 	char procname[] = "ANewProcess";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 3456;
 	bool ret;
 
@@ -333,7 +346,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, WildcardProcnameSimpleMatch)
 	char rule_controller[] = "cpuacct";
 	char rule_procname[] = "ssh*";
 	char procname[] = "sshd";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 1234;
 	bool ret;
 
@@ -355,7 +368,7 @@ TEST_F(CgroupCompareIgnoreRuleTest, WildcardProcnameNoMatch)
 	char rule_controller[] = "cpuacct";
 	char rule_procname[] = "httpd*";
 	char procname[] = "httpx";
-	struct cgroup_rule rule;
+	struct cgroup_rule rule = { };
 	pid_t pid = 1234;
 	bool ret;
 
@@ -369,3 +382,63 @@ TEST_F(CgroupCompareIgnoreRuleTest, WildcardProcnameNoMatch)
 	ret = cgroup_compare_ignore_rule(&rule, pid, procname);
 	ASSERT_EQ(ret, false);
 }
+
+TEST_F(CgroupCompareIgnoreRuleTest, ChildFolderAfterOtherCgroups)
+{
+	char proc_file_contents[] =
+		"3:cpu:/foo1\n"
+		"2:memory:/system.slice\n"
+		"1:cpuacct:/folder/child";
+	char rule_controller[] = "cpuacct";
+	char procname[] = "procfoo";
+	struct cgroup_rule rule = { };
+	pid_t pid = 1234;
+	bool ret;
+
+	CreateCgroupProcFile(proc_file_contents);
+
+	rule.is_ignore = true;
+	rule.controllers[0] = rule_controller;
+	sprintf(rule.destination, "folder/");
+
+	ret = cgroup_compare_ignore_rule(&rule, pid, procname);
+	ASSERT_EQ(ret, true);
+}
+
+TEST_F(CgroupCompareIgnoreRuleTest, SeveralIgnoreRules)
+{
+	char proc_file_contents[] =
+		"7:cpuacct:/second\n"
+		"6:memory:/other";
+	char rule_controller[] = "cpuacct";
+	struct cgroup_rule rules[3] = { };
+	struct cgroup_rule_list lst = { };
+	int i;
+
+	CreateCgroupProcFile(proc_file_contents);
+
+	/* The cgroups of the process are read once, for the first rule */
+	for (i = 0; i < 2; i++) {
+		strcpy(rules[i].username, "*");
+		rules[i].uid = CGRULE_WILD;
+		rules[i].gid = CGRULE_WILD;
+		rules[i].is_ignore = true;
+		rules[i].controllers[0] = rule_controller;
+		rules[i].next = &rules[i + 1];
+	}
+	sprintf(rules[0].destination, "first");
+	sprintf(rules[1].destination, "second");
+
+	strcpy(rules[2].username, "*");
+	rules[2].uid = CGRULE_WILD;
+	rules[2].gid = CGRULE_WILD;
+
+	lst.head = &rules[0];
+	lst.tail = &rules[2];
+	lst.len = 3;
+
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 1000, 1234, "procfoo"), &rules[1]);
+
+	sprintf(rules[1].destination, "third");
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 1000, 1234, "procfoo"), &rules[2]);
+}
@@ -137,6 +137,8 @@ class CgroupGetCgroupTest : public ::testing::Test {
 
 			CreateNames(NAMES[i], VALUES[i], CONTROLLERS[i]);
 		}
+
+		cg_mount_index_build();
 	}
 
 	/*
@@ -256,3 +258,83 @@ TEST_F(CgroupGetCgroupTest, CgroupGetCgroup_NoTasksFile)
 	if (cg)
 		free(cg);
 }
+
+TEST_F(CgroupGetCgroupTest, CgroupReadValuesBatch)
+{
+	char bufs[5][CG_CONTROL_VALUE_MAX];
+	struct cgroup_batch_value values[] = {
+		{ CG_NAME, "cpu", "cpu.shares", bufs[0], sizeof(bufs[0]), 0, -1 },
+		{ CG_NAME, "cpu", "cpu.foo", bufs[1], sizeof(bufs[1]), 0, -1 },
+		{ CG_NAME, "memory", "tasks", bufs[2], sizeof(bufs[2]), 0, -1 },
+		{ CG_NAME, "freezer", "tasks", bufs[3], sizeof(bufs[3]), 0, -1 },
+		{ CG_NAME, "cpu", "cpu.foo", bufs[4], 3, 0, -1 },
+	};
+	int ret;
+
+	ret = cgroup_read_values_batch(values, ARRAY_SIZE(values));
+	ASSERT_EQ(ret, ECGROUPVALUENOTEXIST);
+
+	ASSERT_EQ(values[0].err, 0);
+	ASSERT_STREQ(values[0].buf, VALUES[CTRL_CPU][1]);
+	ASSERT_EQ(values[0].len, strlen(VALUES[CTRL_CPU][1]));
+
+	ASSERT_EQ(values[1].err, 0);
+	ASSERT_STREQ(values[1].buf, VALUES[CTRL_CPU][3]);
+
+	ASSERT_EQ(values[2].err, 0);
+	ASSERT_STREQ(values[2].buf, VALUES[CTRL_MEMORY][0]);
+
+	/* The cgroup does not exist in the freezer hierarchy */
+	ASSERT_EQ(values[3].err, ECGROUPVALUENOTEXIST);
+
+	/* The value is truncated to the size of the buffer */
+	ASSERT_EQ(values[4].err, 0);
+	ASSERT_STREQ(values[4].buf, "ab");
+}
+
+TEST_F(CgroupGetCgroupTest, CgroupGetCgroupSelective)
+{
+	struct cgroup_controller *cpu, *mem;
+	struct cgroup *cg = NULL;
+	char *value;
+	int ret;
+
+	cg = cgroup_new_cgroup(CG_NAME);
+	ASSERT_NE(cg, nullptr);
+
+	cpu = cgroup_add_controller(cg, "cpu");
+	ASSERT_NE(cpu, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cpu, "cpu.shares", NULL), 0);
+	ASSERT_EQ(cgroup_add_value_string(cpu, "cpu.foo", NULL), 0);
+
+	mem = cgroup_add_controller(cg, "memory");
+	ASSERT_NE(mem, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(mem, "memory.limit_in_bytes", NULL), 0);
+
+	ret = cgroup_get_cgroup_selective(cg);
+	ASSERT_EQ(ret, 0);
+
+	/* Only the requested settings are read */
+	ASSERT_EQ(cgroup_get_controller_count(cg), 2);
+	ASSERT_EQ(cgroup_get_value_name_count(cpu), 2);
+	ASSERT_EQ(cgroup_get_value_name_count(mem), 1);
+
+	ASSERT_EQ(cgroup_get_value_string(cpu, "cpu.shares", &value), 0);
+	ASSERT_STREQ(value, VALUES[CTRL_CPU][1]);
+	free(value);
+
+	ASSERT_EQ(cgroup_get_value_string(cpu, "cpu.foo", &value), 0);
+	ASSERT_STREQ(value, VALUES[CTRL_CPU][3]);
+	free(value);
+
+	ASSERT_EQ(cgroup_get_value_string(mem, "memory.limit_in_bytes", &value), 0);
+	ASSERT_STREQ(value, VALUES[CTRL_MEMORY][1]);
+	free(value);
+	ASSERT_FALSE(mem->values[0]->dirty);
+
+	ASSERT_EQ(cgroup_add_value_string(cpu, "cpu.nosuchsetting", NULL), 0);
+	ret = cgroup_get_cgroup_selective(cg);
+	ASSERT_EQ(ret, ECGROUPVALUENOTEXIST);
+
+	cgroup_free(&cg);
+}
@@ -89,13 +89,14 @@ TEST_F(SetValuesRecursiveTest, SuccessfulSetValues)
 	ASSERT_GT(ret, 0);
 
 	for (i = 0; i < NAMES_CNT; i++) {
+		ASSERT_EQ(cg_reserve_value(&ctrlr), 0);
 		ctrlr.values[i] = (struct control_value *)calloc(1,
 					sizeof(struct control_value));
 		ASSERT_NE(ctrlr.values[i], nullptr);
 
-		strncpy(ctrlr.values[i]->name, NAMES[i], FILENAME_MAX);
-		strncpy(ctrlr.values[i]->value, VALUES[i],
-			CG_CONTROL_VALUE_MAX);
+		ctrlr.values[i]->name = cg_intern_name(NAMES[i]);
+		ASSERT_NE(ctrlr.values[i]->name, nullptr);
+		ASSERT_EQ(cg_set_cv_value(&ctrlr, ctrlr.values[i], VALUES[i]), 0);
 		if (i == 0)
 			ctrlr.values[i]->dirty = true;
 		else
@@ -121,3 +122,150 @@ TEST_F(SetValuesRecursiveTest, SuccessfulSetValues)
 		fclose(f);
 	}
 }
+
+TEST_F(SetValuesRecursiveTest, DirtyValuesOnly)
+{
+	char tmp_path[FILENAME_MAX], buf[4092];
+	struct cgroup_controller ctrlr = {0};
+	int ret, i;
+	char *val;
+	FILE *f;
+
+	for (i = 0; i < NAMES_CNT; i++) {
+		ASSERT_EQ(cg_reserve_value(&ctrlr), 0);
+		ctrlr.values[i] = (struct control_value *)calloc(1,
+					sizeof(struct control_value));
+		ASSERT_NE(ctrlr.values[i], nullptr);
+
+		ctrlr.values[i]->name = cg_intern_name(NAMES[i]);
+		ASSERT_EQ(cg_set_cv_value(&ctrlr, ctrlr.values[i], VALUES[i]), 0);
+		ctrlr.values[i]->dirty = (i == 1);
+		ctrlr.index++;
+	}
+
+	ret = cgroup_set_values_recursive(PARENT_DIR, &ctrlr, true);
+	ASSERT_EQ(ret, 0);
+	ASSERT_FALSE(ctrlr.values[1]->dirty);
+
+	for (i = 0; i < NAMES_CNT; i++) {
+		snprintf(tmp_path, FILENAME_MAX - 1, "%s%s", PARENT_DIR, NAMES[i]);
+
+		f = fopen(tmp_path, "r");
+		ASSERT_NE(f, nullptr);
+		val = fgets(buf, sizeof(buf), f);
+		fclose(f);
+
+		if (i == 1)
+			ASSERT_STREQ(val, VALUES[i]);
+		else
+			ASSERT_EQ(val, nullptr);
+	}
+}
+
+TEST_F(SetValuesRecursiveTest, UnchangedValueIsClean)
+{
+	struct cgroup_controller ctrlr = {0};
+	struct cgroup_controller *cgc = &ctrlr;
+
+	ASSERT_EQ(cgroup_add_value_string(cgc, NAMES[0], VALUES[0]), 0);
+	ASSERT_EQ(cgroup_add_value_int64(cgc, NAMES[1], 15), 0);
+	ASSERT_TRUE(cgc->values[0]->dirty);
+
+	/* As if the values were read from the kernel */
+	cgc->values[0]->dirty = false;
+	cgc->values[1]->dirty = false;
+
+	ASSERT_EQ(cgroup_set_value_string(cgc, NAMES[0], VALUES[0]), 0);
+	ASSERT_EQ(cgroup_set_value_int64(cgc, NAMES[1], 15), 0);
+	ASSERT_FALSE(cgc->values[0]->dirty);
+	ASSERT_FALSE(cgc->values[1]->dirty);
+
+	ASSERT_EQ(cgroup_set_value_int64(cgc, NAMES[1], 16), 0);
+	ASSERT_TRUE(cgc->values[1]->dirty);
+}
+
+TEST_F(SetValuesRecursiveTest, MissingGroup)
+{
+	struct cgroup_controller ctrlr = {0};
+
+	ASSERT_EQ(cg_reserve_value(&ctrlr), 0);
+	ctrlr.values[0] = (struct control_value *)calloc(1, sizeof(struct control_value));
+	ASSERT_NE(ctrlr.values[0], nullptr);
+	ctrlr.values[0]->name = cg_intern_name(NAMES[0]);
+	ASSERT_EQ(cg_set_cv_value(&ctrlr, ctrlr.values[0], VALUES[0]), 0);
+	ctrlr.values[0]->dirty = true;
+	ctrlr.index = 1;
+
+	ASSERT_EQ(cgroup_set_values_recursive("test009missing/", &ctrlr, true),
+		  ECGROUPVALUENOTEXIST);
+}
+
+#ifdef WITH_IO_URING
+TEST_F(SetValuesRecursiveTest, IoUring)
+{
+	char path[FILENAME_MAX], name[32], value[16], buf[16];
+	struct cgroup_controller ctrlr = {0};
+	const int count = 90;
+	char *val;
+	FILE *f;
+	int i;
+
+	/* More values than a batch of the ring, the file of one is missing */
+	for (i = 0; i < count; i++) {
+		snprintf(name, sizeof(name), "cpu.v%d", i);
+		snprintf(path, sizeof(path), "%s%s", PARENT_DIR, name);
+		if (i != 70) {
+			f = fopen(path, "w");
+			ASSERT_NE(f, nullptr);
+			fclose(f);
+		}
+
+		snprintf(value, sizeof(value), "%d", i);
+		ASSERT_EQ(cgroup_add_value_string(&ctrlr, name, value), 0);
+	}
+
+	/* The synchronous path takes over at the missing file and fails there */
+	cg_uring_enabled = true;
+	ASSERT_EQ(cgroup_set_values_recursive(PARENT_DIR, &ctrlr, true), ECGROUPVALUENOTEXIST);
+
+	for (i = 0; i < count; i++) {
+		if (i == 70)
+			continue;
+
+		snprintf(path, sizeof(path), "%scpu.v%d", PARENT_DIR, i);
+		f = fopen(path, "r");
+		ASSERT_NE(f, nullptr);
+		val = fgets(buf, sizeof(buf), f);
+		fclose(f);
+
+		if (i > 70) {
+			ASSERT_EQ(val, nullptr);
+			ASSERT_TRUE(ctrlr.values[i]->dirty);
+		} else {
+			snprintf(value, sizeof(value), "%d", i);
+			ASSERT_STREQ(val, value);
+			ASSERT_FALSE(ctrlr.values[i]->dirty);
+		}
+	}
+
+	/* Once the file exists, the values left dirty are written */
+	snprintf(path, sizeof(path), "%scpu.v70", PARENT_DIR);
+	f = fopen(path, "w");
+	ASSERT_NE(f, nullptr);
+	fclose(f);
+	ASSERT_EQ(cgroup_set_values_recursive(PARENT_DIR, &ctrlr, true), 0);
+	cg_uring_enabled = false;
+
+	for (i = 70; i < count; i++) {
+		snprintf(path, sizeof(path), "%scpu.v%d", PARENT_DIR, i);
+		f = fopen(path, "r");
+		ASSERT_NE(f, nullptr);
+		val = fgets(buf, sizeof(buf), f);
+		fclose(f);
+
+		snprintf(value, sizeof(value), "%d", i);
+		ASSERT_STREQ(val, value);
+		ASSERT_FALSE(ctrlr.values[i]->dirty);
+	}
+}
+#endif
@@ -88,6 +88,8 @@ class CgroupCreateCgroupTest : public ::testing::Test {
 				ASSERT_TRUE(false);
 			}
 		}
+
+		cg_mount_index_build();
 	}
 
 	/*
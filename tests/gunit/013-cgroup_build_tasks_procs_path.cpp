@@ -61,6 +61,8 @@ class BuildTasksProcPathTest : public ::testing::Test {
 					(cg_version_t)((i % 2) + 1);
 		}
 
+		cg_mount_index_build();
+
 		// Give a couple of the entries a namespace as well
 		cg_namespace_table[1] =	NAMESPACE1;
 		cg_namespace_table[4] =	NAMESPACE4;
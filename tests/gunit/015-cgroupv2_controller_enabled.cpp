@@ -91,6 +91,8 @@ class CgroupV2ControllerEnabled : public ::testing::Test {
 				 "%s", PARENT_DIR);
 			cg_mount_table[i].version = VERSIONS[i];
 		}
+
+		cg_mount_index_build();
 	}
 
 	void SetUp() override
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the compiled rules index
+ */
+
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+#define RULE_CNT 8
+
+class RuleIndexTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_rule rules[RULE_CNT];
+	struct cgroup_rule_index *index = NULL;
+
+	void SetRule(int i, const char * const username, uid_t uid, gid_t gid,
+		     const char * const procname)
+	{
+		memset(&rules[i], 0, sizeof(rules[i]));
+		strncpy(rules[i].username, username, sizeof(rules[i].username) - 1);
+		rules[i].uid = uid;
+		rules[i].gid = gid;
+		rules[i].procname = procname ? strdup(procname) : NULL;
+		if (i > 0)
+			rules[i - 1].next = &rules[i];
+	}
+
+	void SetUp() override
+	{
+		SetRule(0, "alice", 1000, CGRULE_INVALID, "bash");
+		SetRule(1, "%", 1000, CGRULE_INVALID, NULL);
+		SetRule(2, "*", CGRULE_WILD, CGRULE_WILD, "/usr/bin/python*");
+		SetRule(3, "@devs", CGRULE_INVALID, 500, NULL);
+		SetRule(4, "bob", 1001, CGRULE_INVALID, NULL);
+		SetRule(5, "*", CGRULE_WILD, CGRULE_WILD, "make");
+		SetRule(6, "alice", 1000, CGRULE_INVALID, NULL);
+		SetRule(7, "*", CGRULE_WILD, CGRULE_WILD, "*");
+
+		ASSERT_EQ(cgroup_rule_index_build(&rules[0], &index), 0);
+	}
+
+	void TearDown() override
+	{
+		int i;
+
+		cgroup_rule_index_free(&index);
+		ASSERT_EQ(index, nullptr);
+
+		for (i = 0; i < RULE_CNT; i++)
+			free(rules[i].procname);
+	}
+
+	void ExpectCandidates(uid_t uid, const char * const procname, const char * const base,
+			      const int * const expected, int expected_cnt)
+	{
+		struct cgroup_rule_iter iter;
+		struct cgroup_rule *rule;
+		int i = 0;
+
+		ASSERT_EQ(cgroup_rule_index_lookup(index, uid, procname, base, &iter), 0);
+
+		while ((rule = cgroup_rule_iter_next(&iter))) {
+			ASSERT_LT(i, expected_cnt);
+			ASSERT_EQ(rule, &rules[expected[i]]);
+			i++;
+		}
+		ASSERT_EQ(i, expected_cnt);
+	}
+};
+
+TEST_F(RuleIndexTest, ExactAndBasename)
+{
+	const int expected[] = { 0, 3, 6, 7 };
+
+	ExpectCandidates(1000, "/bin/bash", "bash", expected, 4);
+}
+
+TEST_F(RuleIndexTest, OtherUser)
+{
+	const int expected[] = { 3, 4, 5, 7 };
+
+	ExpectCandidates(1001, "make", "make", expected, 4);
+}
+
+TEST_F(RuleIndexTest, Prefix)
+{
+	const int expected[] = { 2, 3, 7 };
+
+	ExpectCandidates(2000, "/usr/bin/python3", "python3", expected, 3);
+}
+
+TEST_F(RuleIndexTest, NoProcname)
+{
+	const int expected[] = { 0, 2, 3, 5, 6, 7 };
+
+	ExpectCandidates(1000, NULL, NULL, expected, 6);
+}
+
+TEST_F(RuleIndexTest, LiteralAsteriskIsReturnedOnce)
+{
+	const int expected[] = { 2, 3, 7 };
+
+	ExpectCandidates(2000, "/usr/bin/python*", "python*", expected, 3);
+}
+
+TEST_F(RuleIndexTest, GroupCacheDisabled)
+{
+	ASSERT_EQ(cgroup_rule_index_group_member(index, &rules[3], 1000, 0), -1);
+}
+
+TEST_F(RuleIndexTest, GroupCacheNotAGroupRule)
+{
+	ASSERT_EQ(cgroup_rule_index_group_member(index, &rules[0], 1000, 60), -1);
+}
+
+TEST_F(RuleIndexTest, GroupCacheUnknownGroup)
+{
+	/* The group does not exist, thus it has no members */
+	strncpy(rules[3].username, "@cgrulestest_nosuchgroup", sizeof(rules[3].username) - 1);
+	cgroup_rule_index_free(&index);
+	ASSERT_EQ(cgroup_rule_index_build(&rules[0], &index), 0);
+
+	ASSERT_EQ(cgroup_rule_index_group_member(index, &rules[3], 1000, 60), 0);
+}
+
+TEST_F(RuleIndexTest, Patterns)
+{
+	const int expected_glob[] = { 2, 3, 6, 7 };
+	const int expected_base[] = { 0, 3, 6, 7 };
+	const int expected_regex[] = { 3, 5, 6, 7 };
+
+	/* Replace the python and the make rules with patterns */
+	free(rules[2].procname);
+	rules[2].procname = strdup("/usr/bin/python3.[0-9]*");
+	ASSERT_EQ(cg_procname_compile(&rules[2].pattern, rules[2].procname), 0);
+	free(rules[5].procname);
+	rules[5].procname = strdup("~^/srv/.*/bin/make$");
+	ASSERT_EQ(cg_procname_compile(&rules[5].pattern, rules[5].procname), 0);
+	free(rules[0].procname);
+	rules[0].procname = strdup("ba?h");
+	ASSERT_EQ(cg_procname_compile(&rules[0].pattern, rules[0].procname), 0);
+
+	cgroup_rule_index_free(&index);
+	ASSERT_EQ(cgroup_rule_index_build(&rules[0], &index), 0);
+
+	ExpectCandidates(1000, "/usr/bin/python3.11", "python3.11", expected_glob, 4);
+	/* The glob without a slash is found through the basename */
+	ExpectCandidates(1000, "/bin/bash", "bash", expected_base, 4);
+	ExpectCandidates(1000, "/srv/ci/bin/make", "make", expected_regex, 4);
+
+	cg_procname_free(&rules[0].pattern);
+	cg_procname_free(&rules[2].pattern);
+	cg_procname_free(&rules[5].pattern);
+}
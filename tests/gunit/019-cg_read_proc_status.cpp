@@ -0,0 +1,74 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for cg_read_proc_status()
+ */
+
+#include <unistd.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class ReadProcStatusTest : public ::testing::Test {
+};
+
+TEST_F(ReadProcStatusTest, AllFields)
+{
+	char comm[FILENAME_MAX] = { 0 };
+	char *procname = NULL;
+	uid_t euid;
+	gid_t egid;
+	FILE *f;
+	int len;
+
+	ASSERT_EQ(cg_read_proc_status(getpid(), &euid, &egid, &procname), 0);
+	ASSERT_EQ(euid, geteuid());
+	ASSERT_EQ(egid, getegid());
+	ASSERT_NE(procname, nullptr);
+
+	f = fopen("/proc/self/comm", "r");
+	ASSERT_NE(f, nullptr);
+	ASSERT_NE(fgets(comm, sizeof(comm), f), nullptr);
+	fclose(f);
+
+	len = strlen(comm);
+	if (len && comm[len - 1] == '\n')
+		comm[len - 1] = '\0';
+	ASSERT_STREQ(procname, comm);
+
+	free(procname);
+}
+
+TEST_F(ReadProcStatusTest, OnlyUid)
+{
+	uid_t euid;
+
+	ASSERT_EQ(cg_read_proc_status(getpid(), &euid, NULL, NULL), 0);
+	ASSERT_EQ(euid, geteuid());
+}
+
+TEST_F(ReadProcStatusTest, NoSuchProcess)
+{
+	uid_t euid;
+	gid_t egid;
+
+	ASSERT_EQ(cg_read_proc_status(-1, &euid, &egid, NULL), ECGROUPNOTEXIST);
+}
+
+TEST_F(ReadProcStatusTest, ProcInfo)
+{
+	char *procname = NULL;
+	uid_t euid;
+	gid_t egid;
+
+	ASSERT_EQ(cgroup_get_proc_info_from_procfs(getpid(), &euid, &egid, &procname), 0);
+	ASSERT_EQ(euid, geteuid());
+	ASSERT_EQ(egid, getegid());
+	ASSERT_NE(procname, nullptr);
+	/* The name is resolved through /proc/<pid>/exe */
+	ASSERT_EQ(procname[0], '/');
+
+	free(procname);
+}
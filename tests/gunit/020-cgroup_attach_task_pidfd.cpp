@@ -0,0 +1,55 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for cgroup_attach_task_pidfd()
+ */
+
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class AttachTaskPidfdTest : public ::testing::Test {
+};
+
+TEST_F(AttachTaskPidfdTest, NotAPidfd)
+{
+	int fd;
+
+	fd = open("/dev/null", O_RDONLY);
+	ASSERT_GE(fd, 0);
+
+	ASSERT_EQ(cgroup_attach_task_pidfd(NULL, fd), ECGOTHER);
+	ASSERT_EQ(cgroup_get_last_errno(), EINVAL);
+
+	close(fd);
+}
+
+TEST_F(AttachTaskPidfdTest, ExitedProcess)
+{
+#ifdef SYS_pidfd_open
+	pid_t pid;
+	int pidfd;
+
+	pid = fork();
+	ASSERT_GE(pid, 0);
+	if (pid == 0)
+		_exit(0);
+
+	pidfd = syscall(SYS_pidfd_open, pid, 0);
+	if (pidfd < 0)
+		GTEST_SKIP() << "pidfd_open() is not supported";
+
+	ASSERT_EQ(waitpid(pid, NULL, 0), pid);
+
+	/* ECGROUPNOTEXIST, or ECGOTHER if fdinfo has no Pid: field */
+	ASSERT_NE(cgroup_attach_task_pidfd(NULL, pidfd), 0);
+
+	close(pidfd);
+#else
+	GTEST_SKIP() << "pidfd_open() is not supported";
+#endif
+}
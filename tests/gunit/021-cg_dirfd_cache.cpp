@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the cache of open cgroup directories
+ */
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const DIRFD_DIR = "test021cgroup";
+static const char * const DIRFD_FILE = "test021cgroup/cpu.weight";
+
+class DirfdCacheTest : public ::testing::Test {
+	protected:
+
+	void CreateDir(const char * const value)
+	{
+		FILE *f;
+
+		ASSERT_EQ(mkdir(DIRFD_DIR, S_IRWXU), 0);
+
+		f = fopen(DIRFD_FILE, "w");
+		ASSERT_NE(f, nullptr);
+		fprintf(f, "%s", value);
+		fclose(f);
+	}
+
+	void RemoveDir(void)
+	{
+		unlink(DIRFD_FILE);
+		rmdir(DIRFD_DIR);
+	}
+
+	void ExpectValue(const char * const value)
+	{
+		char buf[16] = { 0 };
+		int fd;
+
+		fd = cg_dirfd_open(DIRFD_FILE, O_RDONLY);
+		ASSERT_GE(fd, 0);
+		ASSERT_EQ(read(fd, buf, sizeof(buf) - 1), (ssize_t)strlen(value));
+		ASSERT_STREQ(buf, value);
+		close(fd);
+	}
+
+	void SetUp() override
+	{
+		CreateDir("100");
+	}
+
+	void TearDown() override
+	{
+		RemoveDir();
+		cg_dirfd_flush();
+	}
+};
+
+TEST_F(DirfdCacheTest, OpenTwice)
+{
+	ExpectValue("100");
+	ExpectValue("100");
+}
+
+TEST_F(DirfdCacheTest, RecreatedDirectory)
+{
+	ExpectValue("100");
+
+	/* The cached directory fd now refers to the removed directory */
+	RemoveDir();
+	CreateDir("200");
+
+	ExpectValue("200");
+}
+
+TEST_F(DirfdCacheTest, Stat)
+{
+	struct stat st;
+
+	ASSERT_EQ(cg_dirfd_stat(DIRFD_FILE, &st), 0);
+	ASSERT_EQ(st.st_size, 3);
+
+	ASSERT_EQ(cg_dirfd_stat("test021cgroup/cpu.max", &st), -1);
+	ASSERT_EQ(errno, ENOENT);
+}
+
+TEST_F(DirfdCacheTest, Forget)
+{
+	ExpectValue("100");
+	cg_dirfd_forget("test021cgroup/");
+
+	RemoveDir();
+	ASSERT_EQ(cg_dirfd_open(DIRFD_FILE, O_RDONLY), -1);
+	ASSERT_EQ(errno, ENOENT);
+	CreateDir("300");
+
+	ExpectValue("300");
+}
+
+TEST_F(DirfdCacheTest, Mkdir)
+{
+	struct stat st;
+
+	/* The missing parents are created */
+	ASSERT_EQ(cg_dirfd_mkdir("test021cgroup/a/b/c/", 0775), 0);
+	ASSERT_EQ(stat("test021cgroup/a/b/c", &st), 0);
+	ASSERT_TRUE(S_ISDIR(st.st_mode));
+
+	/* A sibling below the cached parent, and an existing directory */
+	ASSERT_EQ(cg_dirfd_mkdir("test021cgroup/a/b/d", 0775), 0);
+	ASSERT_EQ(stat("test021cgroup/a/b/d", &st), 0);
+	ASSERT_EQ(cg_dirfd_mkdir("test021cgroup/a/b/d", 0775), 0);
+
+	rmdir("test021cgroup/a/b/c");
+	rmdir("test021cgroup/a/b/d");
+	rmdir("test021cgroup/a/b");
+	rmdir("test021cgroup/a");
+}
+
+TEST_F(DirfdCacheTest, MkdirRecreatedParent)
+{
+	struct stat st;
+
+	ASSERT_EQ(cg_dirfd_mkdir("test021cgroup/a/b", 0775), 0);
+
+	/* The cached parent now refers to the removed directory */
+	rmdir("test021cgroup/a/b");
+	rmdir("test021cgroup/a");
+	ASSERT_EQ(mkdir("test021cgroup/a", S_IRWXU), 0);
+
+	ASSERT_EQ(cg_dirfd_mkdir("test021cgroup/a/c", 0775), 0);
+	ASSERT_EQ(stat("test021cgroup/a/c", &st), 0);
+
+	rmdir("test021cgroup/a/c");
+	rmdir("test021cgroup/a");
+}
+
+TEST_F(DirfdCacheTest, MkdirNotDirectory)
+{
+	ASSERT_EQ(cg_dirfd_mkdir("test021cgroup/cpu.weight/a", 0775), -1);
+	ASSERT_EQ(errno, ENOTDIR);
+}
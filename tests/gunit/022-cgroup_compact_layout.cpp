@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the growable controller and value arrays
+ */
+
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class CompactLayoutTest : public ::testing::Test {
+	protected:
+
+	struct cgroup *cgroup = NULL;
+	struct cgroup_controller *cgc = NULL;
+
+	void SetUp() override
+	{
+		cgroup = cgroup_new_cgroup("compact");
+		ASSERT_NE(cgroup, nullptr);
+
+		/* The "cgroup" controller does not need a mounted hierarchy */
+		cgc = cgroup_add_controller(cgroup, CGROUP_FILE_PREFIX);
+		ASSERT_NE(cgc, nullptr);
+	}
+
+	void TearDown() override
+	{
+		cgroup_free(&cgroup);
+		ASSERT_EQ(cgroup, nullptr);
+	}
+
+	void AddValues(int count)
+	{
+		char name[FILENAME_MAX];
+		int i;
+
+		for (i = 0; i < count; i++) {
+			snprintf(name, sizeof(name), "cgroup.setting%d", i);
+			ASSERT_EQ(cgroup_add_value_int64(cgc, name, i), 0);
+		}
+	}
+};
+
+TEST_F(CompactLayoutTest, GrowToMaxValues)
+{
+	int64_t value;
+
+	AddValues(CG_NV_MAX);
+	ASSERT_EQ(cgroup_get_value_name_count(cgc), CG_NV_MAX);
+
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cgroup.toomany", "1"), ECGMAXVALUESEXCEEDED);
+
+	ASSERT_EQ(cgroup_get_value_int64(cgc, "cgroup.setting99", &value), 0);
+	ASSERT_EQ(value, 99);
+}
+
+TEST_F(CompactLayoutTest, NamesAreInterned)
+{
+	AddValues(2);
+
+	ASSERT_EQ(cg_intern_name("cgroup.setting1"), cgc->values[1]->name);
+	ASSERT_STREQ(cgroup_get_value_name(cgc, 1), "cgroup.setting1");
+}
+
+TEST_F(CompactLayoutTest, SetLongerValue)
+{
+	char *value;
+
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cgroup.max", "1"), 0);
+	ASSERT_EQ(cgroup_set_value_string(cgc, "cgroup.max", "18446744073709551615"), 0);
+
+	ASSERT_EQ(cgroup_get_value_string(cgc, "cgroup.max", &value), 0);
+	ASSERT_STREQ(value, "18446744073709551615");
+	free(value);
+}
+
+TEST_F(CompactLayoutTest, CopyCgroup)
+{
+	struct cgroup *copy;
+
+	AddValues(CG_NV_MAX / 2);
+
+	copy = cgroup_new_cgroup("compact");
+	ASSERT_NE(copy, nullptr);
+
+	ASSERT_EQ(cgroup_copy_cgroup(copy, cgroup), 0);
+	ASSERT_EQ(cgroup_compare_cgroup(copy, cgroup), 0);
+
+	cgroup_free(&copy);
+}
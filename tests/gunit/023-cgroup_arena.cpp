@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the cgroup arena allocator
+ */
+
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class CgroupArenaTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_arena *arena = NULL;
+
+	void SetUp() override
+	{
+		arena = cgroup_arena_new();
+		ASSERT_NE(arena, nullptr);
+	}
+
+	void TearDown() override
+	{
+		cgroup_arena_free(&arena);
+		ASSERT_EQ(arena, nullptr);
+	}
+
+	struct cgroup *NewGroup(const char * const name, int value_cnt)
+	{
+		struct cgroup_controller *cgc;
+		struct cgroup *cgroup;
+		char setting[FILENAME_MAX];
+		int i;
+
+		cgroup = cgroup_new_cgroup_arena(name, arena);
+		if (!cgroup)
+			return NULL;
+
+		/* The "cgroup" controller does not need a mounted hierarchy */
+		cgc = cgroup_add_controller(cgroup, CGROUP_FILE_PREFIX);
+		if (!cgc)
+			return NULL;
+
+		for (i = 0; i < value_cnt; i++) {
+			snprintf(setting, sizeof(setting), "cgroup.setting%d", i);
+			if (cgroup_add_value_int64(cgc, setting, i))
+				return NULL;
+		}
+
+		return cgroup;
+	}
+};
+
+TEST_F(CgroupArenaTest, BuildAndReset)
+{
+	struct cgroup *cgroup;
+	int64_t value;
+	int i;
+
+	/* Enough groups to need several chunks, then the reused chunk */
+	for (i = 0; i < 64; i++) {
+		cgroup = NewGroup("arena", CG_NV_MAX);
+		ASSERT_NE(cgroup, nullptr);
+
+		ASSERT_EQ(cgroup_get_value_int64(cgroup->controller[0], "cgroup.setting42",
+						 &value), 0);
+		ASSERT_EQ(value, 42);
+
+		cgroup_free(&cgroup);
+		ASSERT_EQ(cgroup, nullptr);
+
+		if (i % 8 == 7)
+			cgroup_arena_reset(arena);
+	}
+}
+
+TEST_F(CgroupArenaTest, SetValue)
+{
+	struct cgroup_controller *cgc;
+	struct cgroup *cgroup;
+	char *value;
+
+	cgroup = NewGroup("arena", 1);
+	ASSERT_NE(cgroup, nullptr);
+	cgc = cgroup_get_controller(cgroup, CGROUP_FILE_PREFIX);
+	ASSERT_NE(cgc, nullptr);
+
+	ASSERT_EQ(cgroup_set_value_string(cgc, "cgroup.setting0", "a longer value"), 0);
+	ASSERT_EQ(cgroup_set_value_string(cgc, "cgroup.setting0", "short"), 0);
+
+	ASSERT_EQ(cgroup_get_value_string(cgc, "cgroup.setting0", &value), 0);
+	ASSERT_STREQ(value, "short");
+	free(value);
+
+	ASSERT_EQ(cgroup_remove_value(cgc, "cgroup.setting0"), 0);
+	ASSERT_EQ(cgroup_get_value_name_count(cgc), 0);
+}
+
+TEST_F(CgroupArenaTest, CopyBetweenArenaAndHeap)
+{
+	struct cgroup *heap, *cgroup, *copy;
+
+	cgroup = NewGroup("arena", 10);
+	ASSERT_NE(cgroup, nullptr);
+
+	heap = cgroup_new_cgroup("arena");
+	ASSERT_NE(heap, nullptr);
+	ASSERT_EQ(cgroup_copy_cgroup(heap, cgroup), 0);
+	ASSERT_EQ(cgroup_compare_cgroup(heap, cgroup), 0);
+
+	copy = cgroup_new_cgroup_arena("arena", arena);
+	ASSERT_NE(copy, nullptr);
+	ASSERT_EQ(cgroup_copy_cgroup(copy, heap), 0);
+	ASSERT_EQ(cgroup_compare_cgroup(copy, heap), 0);
+
+	cgroup_free(&heap);
+	cgroup_arena_reset(arena);
+}
+
+TEST_F(CgroupArenaTest, InvalidArgs)
+{
+	ASSERT_EQ(cgroup_new_cgroup_arena(NULL, arena), nullptr);
+	ASSERT_EQ(cgroup_new_cgroup_arena("arena", NULL), nullptr);
+
+	cgroup_arena_reset(NULL);
+	cgroup_arena_free(NULL);
+}
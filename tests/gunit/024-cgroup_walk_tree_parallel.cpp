@@ -0,0 +1,176 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the parallel walk of a cgroup tree
+ */
+
+#include <algorithm>
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <sys/stat.h>
+#include <pthread.h>
+#include <ftw.h>
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const WALK_DIR = "test024cgroup";
+
+/* Each group has WALK_FANOUT subgroups, down to WALK_DEPTH */
+static const int WALK_FANOUT = 4;
+static const int WALK_DEPTH = 3;
+
+struct walk_data {
+	pthread_mutex_t lock;
+	int visited;
+	int stop_depth;
+	vector<string> emitted;
+};
+
+static int visit(const struct cgroup_file_info *info, void *userdata, void **result)
+{
+	struct walk_data *data = (struct walk_data *)userdata;
+
+	pthread_mutex_lock(&data->lock);
+	data->visited++;
+	pthread_mutex_unlock(&data->lock);
+
+	*result = strdup(info->full_path);
+	if (data->stop_depth && info->depth == data->stop_depth)
+		return ECGFAIL;
+
+	return 0;
+}
+
+static int emit(const struct cgroup_file_info *info, void *result, void *userdata)
+{
+	struct walk_data *data = (struct walk_data *)userdata;
+
+	if (result)
+		EXPECT_STREQ((char *)result, info->full_path);
+	data->emitted.push_back(info->full_path);
+	free(result);
+
+	return 0;
+}
+
+static int unlink_cb(const char *path, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	return remove(path);
+}
+
+class WalkTreeParallelTest : public ::testing::Test {
+	protected:
+
+	struct walk_data data;
+	vector<string> expected;
+
+	/* Build the tree in reverse order, to check the sorting */
+	void CreateTree(const string &path, int depth)
+	{
+		string file = path + "/cgroup.procs";
+		FILE *f;
+		int i;
+
+		ASSERT_EQ(mkdir(path.c_str(), S_IRWXU), 0);
+		f = fopen(file.c_str(), "w");
+		ASSERT_NE(f, nullptr);
+		fclose(f);
+
+		if (depth == WALK_DEPTH)
+			return;
+
+		for (i = WALK_FANOUT - 1; i >= 0; i--)
+			CreateTree(path + "/child" + to_string(i), depth + 1);
+	}
+
+	void ExpectTree(const string &path, int depth, int max_depth)
+	{
+		int i;
+
+		expected.push_back(path);
+		if (depth == WALK_DEPTH || (max_depth && depth == max_depth))
+			return;
+
+		for (i = 0; i < WALK_FANOUT; i++)
+			ExpectTree(path + "/child" + to_string(i), depth + 1, max_depth);
+	}
+
+	void SetUp() override
+	{
+		pthread_mutex_init(&data.lock, NULL);
+		data.visited = 0;
+		data.stop_depth = 0;
+
+		CreateTree(WALK_DIR, 0);
+	}
+
+	void TearDown() override
+	{
+		nftw(WALK_DIR, unlink_cb, 64, FTW_DEPTH | FTW_PHYS);
+		pthread_mutex_destroy(&data.lock);
+	}
+};
+
+TEST_F(WalkTreeParallelTest, SortedWalk)
+{
+	int threads;
+
+	ExpectTree(WALK_DIR, 0, 0);
+
+	for (threads = 1; threads <= 8; threads *= 2) {
+		data.visited = 0;
+		data.emitted.clear();
+
+		ASSERT_EQ(cg_walk_tree_parallel(WALK_DIR, 0, threads, CGROUP_WALK_PARALLEL_SORTED,
+						visit, emit, &data), 0);
+		ASSERT_EQ(data.visited, (int)expected.size());
+		ASSERT_EQ(data.emitted, expected);
+	}
+}
+
+TEST_F(WalkTreeParallelTest, DepthLimit)
+{
+	ExpectTree(WALK_DIR, 0, 1);
+
+	ASSERT_EQ(cg_walk_tree_parallel(WALK_DIR, 1, 4, CGROUP_WALK_PARALLEL_SORTED, visit, emit,
+					&data), 0);
+	ASSERT_EQ(data.visited, WALK_FANOUT + 1);
+	ASSERT_EQ(data.emitted, expected);
+}
+
+TEST_F(WalkTreeParallelTest, UnsortedWalkIsPreOrder)
+{
+	size_t i;
+
+	ASSERT_EQ(cg_walk_tree_parallel(WALK_DIR, 0, 4, 0, NULL, emit, &data), 0);
+
+	ExpectTree(WALK_DIR, 0, 0);
+	ASSERT_EQ(data.emitted.size(), expected.size());
+
+	/* Each group comes after its parent */
+	for (i = 1; i < data.emitted.size(); i++) {
+		string parent = data.emitted[i].substr(0, data.emitted[i].rfind('/'));
+
+		ASSERT_NE(find(data.emitted.begin(), data.emitted.begin() + i, parent),
+			  data.emitted.begin() + i);
+	}
+}
+
+TEST_F(WalkTreeParallelTest, VisitStopsTheWalk)
+{
+	data.stop_depth = 2;
+
+	/* The results which are not emitted are freed by the walk */
+	ASSERT_EQ(cg_walk_tree_parallel(WALK_DIR, 0, 4, 0, visit, emit, &data), ECGFAIL);
+	ASSERT_TRUE(data.emitted.empty());
+}
+
+TEST_F(WalkTreeParallelTest, MissingRoot)
+{
+	ASSERT_EQ(cg_walk_tree_parallel("test024missing", 0, 2, 0, visit, emit, &data), ECGOTHER);
+	ASSERT_EQ(data.visited, 0);
+}
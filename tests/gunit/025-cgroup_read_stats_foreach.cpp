@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the streaming reader of keyed files
+ */
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <unistd.h>
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const STAT_FILE = "test025.stat";
+
+struct stat_value {
+	string key;
+	string subkey;
+	string value;
+};
+
+static int collect(const char *key, const char *subkey, const char *value, void *userdata)
+{
+	vector<struct stat_value> *values = (vector<struct stat_value> *)userdata;
+
+	values->push_back({ key, subkey ? subkey : "(null)", value });
+
+	return 0;
+}
+
+static int stop(const char *key, const char *subkey, const char *value, void *userdata)
+{
+	int *calls = (int *)userdata;
+
+	if (++(*calls) == 3)
+		return ECGFAIL;
+
+	return 0;
+}
+
+class ReadStatsForeachTest : public ::testing::Test {
+	protected:
+
+	vector<struct stat_value> values;
+
+	void WriteFile(const string &content)
+	{
+		FILE *f;
+
+		f = fopen(STAT_FILE, "w");
+		ASSERT_NE(f, nullptr);
+		fwrite(content.data(), 1, content.size(), f);
+		fclose(f);
+	}
+
+	void TearDown() override
+	{
+		unlink(STAT_FILE);
+		cg_dirfd_flush();
+	}
+};
+
+TEST_F(ReadStatsForeachTest, FlatKeyed)
+{
+	WriteFile("anon 1024\nfile 2048\nunevictable 0");
+
+	ASSERT_EQ(cg_read_keyed_file(STAT_FILE, collect, &values), 0);
+	ASSERT_EQ(values.size(), 3);
+	ASSERT_EQ(values[0].key, "anon");
+	ASSERT_EQ(values[0].subkey, "(null)");
+	ASSERT_EQ(values[0].value, "1024");
+	ASSERT_EQ(values[2].key, "unevictable");
+	ASSERT_EQ(values[2].value, "0");
+}
+
+TEST_F(ReadStatsForeachTest, NestedKeyed)
+{
+	WriteFile("8:0 rbytes=90 wbytes=12 rios=3\n8:16 rbytes=1 wbytes=2 rios=0\n");
+
+	ASSERT_EQ(cg_read_keyed_file(STAT_FILE, collect, &values), 0);
+	ASSERT_EQ(values.size(), 6);
+	ASSERT_EQ(values[1].key, "8:0");
+	ASSERT_EQ(values[1].subkey, "wbytes");
+	ASSERT_EQ(values[1].value, "12");
+	ASSERT_EQ(values[3].key, "8:16");
+	ASSERT_EQ(values[3].subkey, "rbytes");
+	ASSERT_EQ(values[3].value, "1");
+}
+
+TEST_F(ReadStatsForeachTest, SingleWordLines)
+{
+	WriteFile("1\n22\n333\n");
+
+	ASSERT_EQ(cg_read_keyed_file(STAT_FILE, collect, &values), 0);
+	ASSERT_EQ(values.size(), 3);
+	ASSERT_EQ(values[2].key, "333");
+	ASSERT_EQ(values[2].value, "");
+}
+
+TEST_F(ReadStatsForeachTest, LongerThanBuffer)
+{
+	string content, line;
+	int i;
+
+	/* Many lines across the buffer boundaries, then one longer line */
+	for (i = 0; i < 1000; i++)
+		content += "key" + to_string(i) + " " + to_string(i) + "\n";
+
+	line = "dev";
+	for (i = 0; i < 1000; i++)
+		line += " k" + to_string(i) + "=" + to_string(i);
+	ASSERT_GT(line.size(), CG_KEYED_BUF_SIZE * 2);
+	content += line + "\n";
+
+	WriteFile(content);
+
+	ASSERT_EQ(cg_read_keyed_file(STAT_FILE, collect, &values), 0);
+	ASSERT_EQ(values.size(), 2000);
+	ASSERT_EQ(values[999].key, "key999");
+	ASSERT_EQ(values[999].value, "999");
+	ASSERT_EQ(values[1999].key, "dev");
+	ASSERT_EQ(values[1999].subkey, "k999");
+	ASSERT_EQ(values[1999].value, "999");
+}
+
+TEST_F(ReadStatsForeachTest, CallbackStops)
+{
+	int calls = 0;
+
+	WriteFile("a 1\nb 2\nc 3\nd 4\n");
+
+	ASSERT_EQ(cg_read_keyed_file(STAT_FILE, stop, &calls), ECGFAIL);
+	ASSERT_EQ(calls, 3);
+}
+
+TEST_F(ReadStatsForeachTest, MissingFile)
+{
+	ASSERT_EQ(cg_read_keyed_file("test025.missing", collect, &values),
+		  ECGROUPVALUENOTEXIST);
+}
@@ -0,0 +1,114 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the integer reader of stats files
+ */
+
+#include <string>
+using namespace std;
+
+#include <unistd.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const STAT_FILE = "test026.stat";
+
+class StatMapTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_stat_map *map = NULL;
+
+	void WriteFile(const string &content)
+	{
+		FILE *f;
+
+		f = fopen(STAT_FILE, "w");
+		ASSERT_NE(f, nullptr);
+		fwrite(content.data(), 1, content.size(), f);
+		fclose(f);
+	}
+
+	void TearDown() override
+	{
+		cgroup_stat_map_free(&map);
+		ASSERT_EQ(map, nullptr);
+		unlink(STAT_FILE);
+		cg_dirfd_flush();
+	}
+};
+
+TEST_F(StatMapTest, FlatKeyed)
+{
+	const char * const keys[] = { "system_usec", "usage_usec", "nr_throttled", "missing" };
+	u_int64_t values[4];
+
+	map = cgroup_stat_map_new(keys, 4);
+	ASSERT_NE(map, nullptr);
+
+	WriteFile("usage_usec 123456\nuser_usec 100000\nsystem_usec 23456\nnr_periods 0\n"
+		  "nr_throttled 18446744073709551615\n");
+
+	values[3] = 42;
+	ASSERT_EQ(cg_stat_map_read(STAT_FILE, map, values), 0);
+	ASSERT_EQ(values[0], 23456);
+	ASSERT_EQ(values[1], 123456);
+	ASSERT_EQ(values[2], UINT64_MAX);
+	ASSERT_EQ(values[3], 0);
+}
+
+TEST_F(StatMapTest, NestedKeyed)
+{
+	const char * const keys[] = { "8:16 wbytes", "8:0 rbytes", "8:0" };
+	u_int64_t values[3];
+
+	map = cgroup_stat_map_new(keys, 3);
+	ASSERT_NE(map, nullptr);
+
+	WriteFile("8:0 rbytes=90 wbytes=12\n8:16 rbytes=1 wbytes=2\n");
+
+	ASSERT_EQ(cg_stat_map_read(STAT_FILE, map, values), 0);
+	ASSERT_EQ(values[0], 2);
+	ASSERT_EQ(values[1], 90);
+	ASSERT_EQ(values[2], 0);
+}
+
+TEST_F(StatMapTest, InvalidValue)
+{
+	const char * const keys[] = { "avg10" };
+	u_int64_t values[1];
+
+	map = cgroup_stat_map_new(keys, 1);
+	ASSERT_NE(map, nullptr);
+
+	WriteFile("avg10 0.00\n");
+	ASSERT_EQ(cg_stat_map_read(STAT_FILE, map, values), ECGINVAL);
+}
+
+TEST_F(StatMapTest, InvalidKeys)
+{
+	const char * const keys[] = { "anon", "file", "anon" };
+
+	ASSERT_EQ(cgroup_stat_map_new(keys, 3), nullptr);
+	ASSERT_EQ(cgroup_stat_map_new(keys, 0), nullptr);
+	ASSERT_EQ(cgroup_stat_map_new(NULL, 1), nullptr);
+}
+
+TEST_F(StatMapTest, ParseU64)
+{
+	u_int64_t value;
+
+	ASSERT_EQ(cg_stat_parse_u64("0", &value), 0);
+	ASSERT_EQ(value, 0);
+	ASSERT_EQ(cg_stat_parse_u64("4096", &value), 0);
+	ASSERT_EQ(value, 4096);
+	ASSERT_EQ(cg_stat_parse_u64("max", &value), 0);
+	ASSERT_EQ(value, UINT64_MAX);
+
+	ASSERT_EQ(cg_stat_parse_u64("", &value), ECGINVAL);
+	ASSERT_EQ(cg_stat_parse_u64("-1", &value), ECGINVAL);
+	ASSERT_EQ(cg_stat_parse_u64("12k", &value), ECGINVAL);
+	ASSERT_EQ(cg_stat_parse_u64("18446744073709551616", &value), ECGINVAL);
+}
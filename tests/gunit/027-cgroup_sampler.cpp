@@ -0,0 +1,122 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the sampler of stats counters
+ */
+
+#include <string>
+using namespace std;
+
+#include <time.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const KEYS[] = { "usage_usec", "nr_throttled" };
+static const int KEYS_CNT = 2;
+
+class SamplerTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_sampler *sampler = NULL;
+	u_int64_t deltas[2];
+	double rates[2];
+	double interval;
+
+	void SetUp() override
+	{
+		sampler = cgroup_sampler_new("cpu", "cpu.stat", KEYS, KEYS_CNT);
+		ASSERT_NE(sampler, nullptr);
+	}
+
+	void TearDown() override
+	{
+		cgroup_sampler_free(&sampler);
+		ASSERT_EQ(sampler, nullptr);
+	}
+
+	int Update(const char * const path, ino_t ino, u_int64_t usage, u_int64_t throttled,
+		   time_t sec, long nsec)
+	{
+		u_int64_t current[2] = { usage, throttled };
+		struct timespec now = { sec, nsec };
+
+		return cg_sampler_update(sampler, path, ino, current, &now, deltas, rates,
+					 &interval);
+	}
+};
+
+TEST_F(SamplerTest, DeltasAndRates)
+{
+	ASSERT_EQ(Update("a", 1, 1000, 5, 10, 0), 0);
+	ASSERT_EQ(interval, 0);
+	ASSERT_EQ(deltas[0], 0);
+	ASSERT_EQ(rates[0], 0);
+
+	ASSERT_EQ(Update("a", 1, 3000, 6, 12, 0), 0);
+	ASSERT_EQ(interval, 2);
+	ASSERT_EQ(deltas[0], 2000);
+	ASSERT_EQ(deltas[1], 1);
+	ASSERT_DOUBLE_EQ(rates[0], 1000);
+	ASSERT_DOUBLE_EQ(rates[1], 0.5);
+
+	ASSERT_EQ(Update("a", 1, 3500, 6, 12, 500000000), 0);
+	ASSERT_DOUBLE_EQ(interval, 0.5);
+	ASSERT_EQ(deltas[0], 500);
+	ASSERT_DOUBLE_EQ(rates[0], 1000);
+}
+
+TEST_F(SamplerTest, CounterReset)
+{
+	ASSERT_EQ(Update("a", 1, 1000, 5, 10, 0), 0);
+	ASSERT_EQ(Update("a", 1, 200, 5, 11, 0), 0);
+	ASSERT_EQ(deltas[0], 200);
+	ASSERT_EQ(deltas[1], 0);
+}
+
+TEST_F(SamplerTest, GroupCreatedAgain)
+{
+	ASSERT_EQ(Update("a", 1, 1000, 5, 10, 0), 0);
+	ASSERT_EQ(Update("a", 2, 5000, 0, 11, 0), 0);
+	ASSERT_EQ(interval, 0);
+	ASSERT_EQ(deltas[0], 0);
+
+	ASSERT_EQ(Update("a", 2, 6000, 0, 12, 0), 0);
+	ASSERT_EQ(deltas[0], 1000);
+}
+
+TEST_F(SamplerTest, ManyGroups)
+{
+	string path;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		path = "group" + to_string(i);
+		ASSERT_EQ(Update(path.c_str(), i, i, 0, 10, 0), 0);
+	}
+
+	/* Forget every other group, the others keep their samples */
+	for (i = 0; i < 1000; i += 2)
+		cg_sampler_forget(sampler, ("group" + to_string(i)).c_str());
+
+	for (i = 0; i < 1000; i++) {
+		path = "group" + to_string(i);
+		ASSERT_EQ(Update(path.c_str(), i, i + 10, 0, 11, 0), 0);
+		if (i % 2) {
+			ASSERT_EQ(interval, 1);
+			ASSERT_EQ(deltas[0], 10);
+		} else {
+			ASSERT_EQ(interval, 0);
+		}
+	}
+}
+
+TEST_F(SamplerTest, InvalidArgs)
+{
+	const char * const keys[] = { "usage_usec", "usage_usec" };
+
+	ASSERT_EQ(cgroup_sampler_new(NULL, "cpu.stat", KEYS, KEYS_CNT), nullptr);
+	ASSERT_EQ(cgroup_sampler_new("cpu", "cpu.stat", keys, 2), nullptr);
+	ASSERT_EQ(cgroup_sampler_read(NULL, "a", deltas, rates, &interval), ECGINVAL);
+	ASSERT_EQ(cgroup_sampler_read(sampler, NULL, deltas, rates, &interval), ECGINVAL);
+}
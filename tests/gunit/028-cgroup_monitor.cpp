@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the monitoring of groups
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const EVENTS_FILE = "test028cgroup.events";
+static const char * const EVENTS_FILE2 = "test028memory.events";
+
+struct monitor_data {
+	int modified;
+	int removed;
+	int last_watch;
+	bool remove_self;
+};
+
+static void callback(struct cgroup_monitor *monitor, int watch, enum cgroup_monitor_event event,
+		     void *userdata)
+{
+	struct monitor_data *data = (struct monitor_data *)userdata;
+
+	if (event == CGROUP_MONITOR_MODIFIED)
+		data->modified++;
+	else if (event == CGROUP_MONITOR_REMOVED)
+		data->removed++;
+	data->last_watch = watch;
+
+	if (data->remove_self)
+		ASSERT_EQ(cgroup_monitor_remove(monitor, watch), 0);
+}
+
+static void write_file(const char * const path, const char * const content)
+{
+	FILE *f;
+
+	f = fopen(path, "w");
+	ASSERT_NE(f, nullptr);
+	fprintf(f, "%s", content);
+	fclose(f);
+}
+
+class MonitorTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_monitor *monitor = NULL;
+	struct monitor_data data = { 0, 0, -1, false };
+
+	void SetUp() override
+	{
+		write_file(EVENTS_FILE, "populated 0\nfrozen 0\n");
+		write_file(EVENTS_FILE2, "low 0\nhigh 0\n");
+
+		monitor = cgroup_monitor_new();
+		ASSERT_NE(monitor, nullptr);
+		ASSERT_GE(cgroup_monitor_get_fd(monitor), 0);
+	}
+
+	void TearDown() override
+	{
+		cgroup_monitor_free(&monitor);
+		ASSERT_EQ(monitor, nullptr);
+		unlink(EVENTS_FILE);
+		unlink(EVENTS_FILE2);
+	}
+};
+
+TEST_F(MonitorTest, Modified)
+{
+	int watch, watch2;
+
+	ASSERT_EQ(cg_monitor_add(monitor, EVENTS_FILE, NULL, callback, &data, &watch), 0);
+	ASSERT_EQ(cg_monitor_add(monitor, EVENTS_FILE2, NULL, callback, &data, &watch2), 0);
+	ASSERT_NE(watch, watch2);
+
+	ASSERT_EQ(cgroup_monitor_dispatch(monitor, 0), 0);
+	ASSERT_EQ(data.modified, 0);
+
+	write_file(EVENTS_FILE2, "low 0\nhigh 1\n");
+	ASSERT_EQ(cgroup_monitor_dispatch(monitor, 1000), 0);
+	ASSERT_EQ(data.modified, 1);
+	ASSERT_EQ(data.last_watch, watch2);
+
+	ASSERT_EQ(cgroup_monitor_remove(monitor, watch2), 0);
+	ASSERT_EQ(cgroup_monitor_remove(monitor, watch2), ECGINVAL);
+
+	write_file(EVENTS_FILE2, "low 0\nhigh 2\n");
+	write_file(EVENTS_FILE, "populated 1\nfrozen 0\n");
+	ASSERT_EQ(cgroup_monitor_dispatch(monitor, 1000), 0);
+	ASSERT_EQ(data.modified, 2);
+	ASSERT_EQ(data.last_watch, watch);
+}
+
+TEST_F(MonitorTest, SameFileTwice)
+{
+	int watch, watch2;
+
+	ASSERT_EQ(cg_monitor_add(monitor, EVENTS_FILE, NULL, callback, &data, &watch), 0);
+	ASSERT_EQ(cg_monitor_add(monitor, EVENTS_FILE, NULL, callback, &data, &watch2), 0);
+
+	write_file(EVENTS_FILE, "populated 1\nfrozen 0\n");
+	ASSERT_EQ(cgroup_monitor_dispatch(monitor, 1000), 0);
+	ASSERT_EQ(data.modified, 2);
+
+	/* The other watch of the file keeps firing */
+	ASSERT_EQ(cgroup_monitor_remove(monitor, watch), 0);
+	write_file(EVENTS_FILE, "populated 0\nfrozen 0\n");
+	ASSERT_EQ(cgroup_monitor_dispatch(monitor, 1000), 0);
+	ASSERT_EQ(data.modified, 3);
+	ASSERT_EQ(data.last_watch, watch2);
+}
+
+TEST_F(MonitorTest, RemovedFile)
+{
+	int watch;
+
+	ASSERT_EQ(cg_monitor_add(monitor, EVENTS_FILE, NULL, callback, &data, &watch), 0);
+
+	data.remove_self = true;
+	unlink(EVENTS_FILE);
+	ASSERT_EQ(cgroup_monitor_dispatch(monitor, 1000), 0);
+	ASSERT_EQ(data.removed, 1);
+	ASSERT_EQ(cgroup_monitor_remove(monitor, watch), ECGINVAL);
+}
+
+TEST_F(MonitorTest, InvalidWatches)
+{
+	int watch;
+
+	ASSERT_EQ(cg_monitor_add(monitor, "test028missing", NULL, callback, &data, &watch),
+		  ECGROUPVALUENOTEXIST);
+
+	/* A regular file cannot be polled for PSI events */
+	ASSERT_EQ(cg_monitor_add(monitor, EVENTS_FILE, "some 150000 1000000", callback, &data,
+				 &watch), ECGOTHER);
+
+	ASSERT_EQ(cgroup_monitor_remove(monitor, 0), ECGINVAL);
+	ASSERT_EQ(cgroup_monitor_remove(monitor, -1), ECGINVAL);
+	ASSERT_EQ(cgroup_monitor_dispatch(NULL, 0), ECGINVAL);
+	ASSERT_EQ(cgroup_monitor_get_fd(NULL), -1);
+}
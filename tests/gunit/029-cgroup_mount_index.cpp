@@ -0,0 +1,67 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the index of the mount table
+ */
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class MountIndexTest : public ::testing::Test {
+	protected:
+
+	void Fill(int count)
+	{
+		int i;
+
+		memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+		for (i = 0; i < count; i++) {
+			snprintf(cg_mount_table[i].name, CONTROL_NAMELEN_MAX, "controller%d", i);
+			cg_mount_table[i].version = CGROUP_V1;
+		}
+		cg_mount_index_build();
+	}
+
+	void TearDown() override
+	{
+		memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+		cg_mount_index_build();
+	}
+};
+
+TEST_F(MountIndexTest, Find)
+{
+	char name[CONTROL_NAMELEN_MAX];
+	int i;
+
+	Fill(CG_CONTROLLER_MAX - 1);
+
+	for (i = 0; i < CG_CONTROLLER_MAX - 1; i++) {
+		snprintf(name, sizeof(name), "controller%d", i);
+		ASSERT_EQ(cg_mount_table_find(name), i);
+	}
+
+	ASSERT_EQ(cg_mount_table_find("controller"), -1);
+	ASSERT_EQ(cg_mount_table_find(""), -1);
+	ASSERT_EQ(cg_mount_table_find_v2(), -1);
+}
+
+TEST_F(MountIndexTest, FindV2)
+{
+	Fill(3);
+	cg_mount_table[2].version = CGROUP_V2;
+	cg_mount_index_build();
+
+	ASSERT_EQ(cg_mount_table_find_v2(), 2);
+	ASSERT_EQ(cg_mount_table_find("controller2"), 2);
+}
+
+TEST_F(MountIndexTest, Rebuild)
+{
+	Fill(3);
+	ASSERT_EQ(cg_mount_table_find("controller2"), 2);
+
+	Fill(1);
+	ASSERT_EQ(cg_mount_table_find("controller0"), 0);
+	ASSERT_EQ(cg_mount_table_find("controller2"), -1);
+}
@@ -0,0 +1,155 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the lock-free snapshots
+ */
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const int READERS = 4;
+static const int VERSIONS = 2000;
+
+struct version {
+	int value;
+	bool released;
+};
+
+static int released;
+
+static void release(void *data)
+{
+	struct version *version = (struct version *)data;
+
+	/* A reader still holding the version would see it */
+	version->released = true;
+	released++;
+	delete version;
+}
+
+static void noop_release(void *data)
+{
+	((struct version *)data)->released = true;
+}
+
+struct reader_data {
+	struct cg_snapshot *snapshot;
+	bool *stop;
+	bool failed;
+};
+
+static void *reader(void *arg)
+{
+	struct reader_data *data = (struct reader_data *)arg;
+	struct version *version;
+	int slot;
+
+	while (!__atomic_load_n(data->stop, __ATOMIC_SEQ_CST)) {
+		version = (struct version *)cg_snapshot_get(data->snapshot, &slot);
+		if (!version || version->released)
+			data->failed = true;
+		cg_snapshot_put(data->snapshot, slot);
+	}
+
+	return NULL;
+}
+
+TEST(SnapshotTest, GetAndPublish)
+{
+	struct cg_snapshot snapshot = CG_SNAPSHOT_INITIALIZER(noop_release);
+	struct version v1 = { 1, false }, v2 = { 2, false };
+	int slot;
+
+	ASSERT_EQ(cg_snapshot_get(&snapshot, &slot), nullptr);
+	cg_snapshot_put(&snapshot, slot);
+
+	cg_snapshot_publish(&snapshot, &v1);
+	ASSERT_EQ(cg_snapshot_get(&snapshot, &slot), &v1);
+	cg_snapshot_put(&snapshot, slot);
+	ASSERT_FALSE(v1.released);
+
+	cg_snapshot_publish(&snapshot, &v2);
+	ASSERT_TRUE(v1.released);
+	ASSERT_FALSE(v2.released);
+
+	cg_snapshot_publish(&snapshot, NULL);
+	ASSERT_TRUE(v2.released);
+	ASSERT_EQ(cg_snapshot_get(&snapshot, &slot), nullptr);
+	cg_snapshot_put(&snapshot, slot);
+}
+
+struct publisher_data {
+	struct cg_snapshot *snapshot;
+	struct version *version;
+	bool done;
+};
+
+static void *publisher(void *arg)
+{
+	struct publisher_data *data = (struct publisher_data *)arg;
+
+	cg_snapshot_publish(data->snapshot, data->version);
+	__atomic_store_n(&data->done, true, __ATOMIC_SEQ_CST);
+
+	return NULL;
+}
+
+TEST(SnapshotTest, PublishWaitsForReaders)
+{
+	struct cg_snapshot snapshot = CG_SNAPSHOT_INITIALIZER(noop_release);
+	struct version v1 = { 1, false }, v2 = { 2, false };
+	struct publisher_data data = { &snapshot, &v2, false };
+	pthread_t thread;
+	int slot, slot2;
+
+	cg_snapshot_publish(&snapshot, &v1);
+	ASSERT_EQ(cg_snapshot_get(&snapshot, &slot), &v1);
+
+	ASSERT_EQ(pthread_create(&thread, NULL, publisher, &data), 0);
+
+	/* Readers arriving meanwhile see the new data without blocking */
+	while (cg_snapshot_get(&snapshot, &slot2) != &v2)
+		cg_snapshot_put(&snapshot, slot2);
+	cg_snapshot_put(&snapshot, slot2);
+
+	usleep(10000);
+	ASSERT_FALSE(__atomic_load_n(&data.done, __ATOMIC_SEQ_CST));
+	ASSERT_FALSE(v1.released);
+
+	cg_snapshot_put(&snapshot, slot);
+	ASSERT_EQ(pthread_join(thread, NULL), 0);
+	ASSERT_TRUE(data.done);
+	ASSERT_TRUE(v1.released);
+}
+
+TEST(SnapshotTest, ConcurrentReaders)
+{
+	struct cg_snapshot snapshot = CG_SNAPSHOT_INITIALIZER(release);
+	struct reader_data data[READERS];
+	pthread_t threads[READERS];
+	bool stop = false;
+	int i;
+
+	released = 0;
+	cg_snapshot_publish(&snapshot, new version { 0, false });
+
+	for (i = 0; i < READERS; i++) {
+		data[i] = { &snapshot, &stop, false };
+		ASSERT_EQ(pthread_create(&threads[i], NULL, reader, &data[i]), 0);
+	}
+
+	for (i = 1; i <= VERSIONS; i++)
+		cg_snapshot_publish(&snapshot, new version { i, false });
+
+	__atomic_store_n(&stop, true, __ATOMIC_SEQ_CST);
+	for (i = 0; i < READERS; i++) {
+		ASSERT_EQ(pthread_join(threads[i], NULL), 0);
+		ASSERT_FALSE(data[i].failed);
+	}
+
+	cg_snapshot_publish(&snapshot, NULL);
+	ASSERT_EQ(released, VERSIONS + 1);
+}
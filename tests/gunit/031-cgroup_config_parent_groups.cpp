@@ -0,0 +1,70 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the parents of the groups of a configuration
+ */
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static int ParentGroups(const char * const names[], int count, int * const parents)
+{
+	struct cgroup *cgroups, **table;
+	int i, ret;
+
+	cgroups = (struct cgroup *)calloc(count, sizeof(struct cgroup));
+	table = (struct cgroup **)calloc(count, sizeof(struct cgroup *));
+	for (i = 0; i < count; i++) {
+		snprintf(cgroups[i].name, sizeof(cgroups[i].name), "%s", names[i]);
+		table[i] = &cgroups[i];
+	}
+
+	ret = cg_config_parent_groups(table, count, parents);
+	free(table);
+	free(cgroups);
+
+	return ret;
+}
+
+TEST(ConfigParentGroupsTest, NearestDefinedAncestor)
+{
+	const char * const names[] = { "a/b/c", "a", "x/y", "a-b", "a/b/c/d/e", "x", "z/w" };
+	int parents[7];
+
+	ASSERT_EQ(ParentGroups(names, 7, parents), 0);
+
+	ASSERT_EQ(parents[0], 1);
+	ASSERT_EQ(parents[1], -1);
+	ASSERT_EQ(parents[2], 5);
+	ASSERT_EQ(parents[3], -1);
+	ASSERT_EQ(parents[4], 0);
+	ASSERT_EQ(parents[5], -1);
+	ASSERT_EQ(parents[6], -1);
+}
+
+TEST(ConfigParentGroupsTest, RootGroup)
+{
+	const char * const names[] = { "a", ".", "a/b", "+c" };
+	int parents[4];
+
+	ASSERT_EQ(ParentGroups(names, 4, parents), 0);
+
+	ASSERT_EQ(parents[0], 1);
+	ASSERT_EQ(parents[1], -1);
+	ASSERT_EQ(parents[2], 0);
+	ASSERT_EQ(parents[3], 1);
+}
+
+TEST(ConfigParentGroupsTest, DefinedTwice)
+{
+	const char * const names[] = { "a/b", "a", "a/b", "a/b/c" };
+	int parents[4];
+
+	ASSERT_EQ(ParentGroups(names, 4, parents), 0);
+
+	ASSERT_EQ(parents[0], 1);
+	ASSERT_EQ(parents[1], -1);
+	ASSERT_EQ(parents[2], 0);
+	ASSERT_NE(parents[3], -1);
+	ASSERT_NE(parents[3], 1);
+}
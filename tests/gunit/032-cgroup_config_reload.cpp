@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the incremental reload of a configuration
+ */
+
+#include <ftw.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const PARENT_DIR = "test032cgroup";
+static const char * const CG_NAME = "grp";
+static const mode_t MODE = S_IRWXU | S_IRWXG | S_IRWXO;
+
+static void write_file(const char * const dir, const char * const name,
+		       const char * const content)
+{
+	char path[FILENAME_MAX];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/%s/%s", PARENT_DIR, dir, name);
+	f = fopen(path, "w");
+	ASSERT_NE(f, nullptr);
+	fprintf(f, "%s", content);
+	fclose(f);
+}
+
+static int unlink_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+class ConfigReloadTest : public ::testing::Test {
+	protected:
+
+	struct cgroup *cgroup = NULL;
+	struct cgroup *diff = NULL;
+
+	void SetUp() override
+	{
+		char path[FILENAME_MAX];
+
+		ASSERT_EQ(cgroup_init(), 0);
+
+		ASSERT_EQ(mkdir(PARENT_DIR, MODE), 0);
+		snprintf(path, sizeof(path), "%s/cpu", PARENT_DIR);
+		ASSERT_EQ(mkdir(path, MODE), 0);
+		snprintf(path, sizeof(path), "%s/cpu/%s", PARENT_DIR, CG_NAME);
+		ASSERT_EQ(mkdir(path, MODE), 0);
+
+		write_file("cpu/grp", "tasks", "");
+		write_file("cpu/grp", "cpu.shares", "100\n");
+		write_file("cpu/grp", "cpu.cfs_quota_us", "-1\n");
+
+		memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+		memset(&cg_namespace_table, 0, sizeof(cg_namespace_table));
+		snprintf(cg_mount_table[0].name, CONTROL_NAMELEN_MAX, "cpu");
+		snprintf(cg_mount_table[0].mount.path, FILENAME_MAX, "%s/cpu", PARENT_DIR);
+		cg_mount_table[0].version = CGROUP_V1;
+		cg_mount_index_build();
+
+		cgroup = cgroup_new_cgroup(CG_NAME);
+		ASSERT_NE(cgroup, nullptr);
+		diff = cgroup_new_cgroup(CG_NAME);
+		ASSERT_NE(diff, nullptr);
+	}
+
+	void TearDown() override
+	{
+		cgroup_free(&cgroup);
+		cgroup_free(&diff);
+		ASSERT_EQ(nftw(PARENT_DIR, unlink_cb, 64, FTW_DEPTH | FTW_PHYS), 0);
+	}
+};
+
+TEST_F(ConfigReloadTest, ChangedSettings)
+{
+	struct cgroup_controller *cgc;
+
+	cgc = cgroup_add_controller(cgroup, "cpu");
+	ASSERT_NE(cgc, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpu.shares", "100"), 0);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpu.cfs_quota_us", "5000"), 0);
+
+	ASSERT_EQ(cg_config_diff_group(cgroup, diff), 0);
+	ASSERT_EQ(diff->index, 1);
+	ASSERT_STREQ(diff->controller[0]->name, "cpu");
+	ASSERT_EQ(diff->controller[0]->index, 1);
+	ASSERT_STREQ(diff->controller[0]->values[0]->name, "cpu.cfs_quota_us");
+	ASSERT_STREQ(diff->controller[0]->values[0]->value, "5000");
+}
+
+TEST_F(ConfigReloadTest, UnchangedSettings)
+{
+	struct cgroup_controller *cgc;
+
+	cgc = cgroup_add_controller(cgroup, "cpu");
+	ASSERT_NE(cgc, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpu.shares", "100"), 0);
+
+	ASSERT_EQ(cg_config_diff_group(cgroup, diff), 0);
+	ASSERT_EQ(diff->index, 0);
+}
+
+TEST_F(ConfigReloadTest, MissingSetting)
+{
+	struct cgroup_controller *cgc;
+
+	cgc = cgroup_add_controller(cgroup, "cpu");
+	ASSERT_NE(cgc, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpu.max", "5000 100000"), 0);
+
+	ASSERT_EQ(cg_config_diff_group(cgroup, diff), ECGROUPVALUENOTEXIST);
+}
+
+TEST_F(ConfigReloadTest, Owners)
+{
+	struct cgroup *missing;
+	bool changed;
+
+	ASSERT_NE(cgroup_add_controller(cgroup, "cpu"), nullptr);
+
+	/* The files belong to the current user, like NO_UID_GID */
+	ASSERT_EQ(cgroup_set_uid_gid(cgroup, NO_UID_GID, NO_UID_GID, NO_UID_GID, NO_UID_GID), 0);
+	ASSERT_EQ(cg_config_stat_group(cgroup, &changed), 0);
+	ASSERT_FALSE(changed);
+
+	ASSERT_EQ(cgroup_set_uid_gid(cgroup, getuid() + 1, NO_UID_GID, NO_UID_GID, NO_UID_GID),
+		  0);
+	ASSERT_EQ(cg_config_stat_group(cgroup, &changed), 0);
+	ASSERT_TRUE(changed);
+
+	missing = cgroup_new_cgroup("missing");
+	ASSERT_NE(missing, nullptr);
+	ASSERT_NE(cgroup_add_controller(missing, "cpu"), nullptr);
+	ASSERT_EQ(cg_config_stat_group(missing, &changed), ECGROUPNOTEXIST);
+	cgroup_free(&missing);
+}
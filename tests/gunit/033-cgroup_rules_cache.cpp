@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the compiled cache of the rules
+ */
+
+#include <ftw.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const CONF_FILE = "test033cgrules.conf";
+static const char * const CONF_DIR = "test033cgrules.d";
+static const char * const CACHE_FILE = "test033rules.bin";
+
+static void write_file(const char * const path, const char * const content)
+{
+	FILE *f;
+
+	f = fopen(path, "w");
+	ASSERT_NE(f, nullptr);
+	fprintf(f, "%s", content);
+	fclose(f);
+}
+
+static int unlink_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+static struct cgroup_rule *new_rule(const char * const username, uid_t uid, gid_t gid,
+				    const char * const procname, const char * const destination,
+				    const char * const controller1, const char * const controller2)
+{
+	struct cgroup_rule *rule;
+
+	rule = (struct cgroup_rule *)calloc(1, sizeof(struct cgroup_rule));
+	if (!rule)
+		return NULL;
+
+	rule->uid = uid;
+	rule->gid = gid;
+	snprintf(rule->username, sizeof(rule->username), "%s", username);
+	snprintf(rule->destination, sizeof(rule->destination), "%s", destination);
+	if (procname)
+		rule->procname = strdup(procname);
+	rule->controllers[0] = strdup(controller1);
+	if (controller2)
+		rule->controllers[1] = strdup(controller2);
+
+	return rule;
+}
+
+class RulesCacheTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_rule_list lst = { 0 };
+	struct cgroup_rule_list loaded = { 0 };
+	struct cg_rules_sources sources = { 0 };
+
+	void SetUp() override
+	{
+		struct cgroup_rule *rule;
+
+		write_file(CONF_FILE, "alice cpu alice\n");
+		ASSERT_EQ(mkdir(CONF_DIR, S_IRWXU), 0);
+		write_file("test033cgrules.d/50-users", "@staff:sshd cpu,memory staff/%u\n");
+
+		lst.head = new_rule("alice", 1000, CGRULE_INVALID, NULL, "alice", "cpu", NULL);
+		ASSERT_NE(lst.head, nullptr);
+
+		rule = new_rule("@staff", CGRULE_INVALID, 50, "sshd", "staff/%u", "cpu", "memory");
+		ASSERT_NE(rule, nullptr);
+		rule->is_ignore = true;
+		lst.head->next = rule;
+		lst.tail = rule;
+
+		ASSERT_EQ(cg_rules_sources_collect(CONF_FILE, CONF_DIR, &sources), 0);
+	}
+
+	void TearDown() override
+	{
+		cg_rules_sources_free(&sources);
+		if (lst.head)
+			cgroup_free_rule_list(&lst);
+		if (loaded.head)
+			cgroup_free_rule_list(&loaded);
+
+		unlink(CONF_FILE);
+		unlink(CACHE_FILE);
+		nftw(CONF_DIR, unlink_cb, 8, FTW_DEPTH | FTW_PHYS);
+	}
+};
+
+TEST_F(RulesCacheTest, StoreAndLoad)
+{
+	struct cgroup_rule *rule;
+
+	ASSERT_EQ(cg_rules_cache_store(CACHE_FILE, &lst, &sources), 0);
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), 0);
+
+	rule = loaded.head;
+	ASSERT_NE(rule, nullptr);
+	ASSERT_EQ(rule->uid, 1000);
+	ASSERT_EQ(rule->gid, CGRULE_INVALID);
+	ASSERT_FALSE(rule->is_ignore);
+	ASSERT_STREQ(rule->username, "alice");
+	ASSERT_STREQ(rule->destination, "alice");
+	ASSERT_EQ(rule->procname, nullptr);
+	ASSERT_STREQ(rule->controllers[0], "cpu");
+	ASSERT_EQ(rule->controllers[1], nullptr);
+
+	rule = rule->next;
+	ASSERT_NE(rule, nullptr);
+	ASSERT_EQ(rule->uid, CGRULE_INVALID);
+	ASSERT_EQ(rule->gid, 50);
+	ASSERT_TRUE(rule->is_ignore);
+	ASSERT_STREQ(rule->username, "@staff");
+	ASSERT_STREQ(rule->procname, "sshd");
+	ASSERT_STREQ(rule->destination, "staff/%u");
+	ASSERT_STREQ(rule->controllers[0], "cpu");
+	ASSERT_STREQ(rule->controllers[1], "memory");
+	ASSERT_EQ(rule->controllers[2], nullptr);
+
+	ASSERT_EQ(rule->next, nullptr);
+	ASSERT_EQ(loaded.tail, rule);
+}
+
+TEST_F(RulesCacheTest, EmptyList)
+{
+	struct cgroup_rule_list empty = { 0 };
+
+	ASSERT_EQ(cg_rules_cache_store(CACHE_FILE, &empty, &sources), 0);
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), 0);
+	ASSERT_EQ(loaded.head, nullptr);
+}
+
+TEST_F(RulesCacheTest, ModifiedFile)
+{
+	ASSERT_EQ(cg_rules_cache_store(CACHE_FILE, &lst, &sources), 0);
+
+	write_file("test033cgrules.d/50-users", "@staff:sshd cpu staff\n");
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), ECGOTHER);
+	ASSERT_EQ(loaded.head, nullptr);
+}
+
+TEST_F(RulesCacheTest, AddedFile)
+{
+	ASSERT_EQ(cg_rules_cache_store(CACHE_FILE, &lst, &sources), 0);
+
+	/* The main file did not exist when the cache was compiled */
+	unlink(CONF_FILE);
+	cg_rules_sources_free(&sources);
+	ASSERT_EQ(cg_rules_sources_collect(CONF_FILE, CONF_DIR, &sources), 0);
+	ASSERT_EQ(cg_rules_cache_store(CACHE_FILE, &lst, &sources), 0);
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), 0);
+	cgroup_free_rule_list(&loaded);
+
+	write_file(CONF_FILE, "alice cpu alice\n");
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), ECGOTHER);
+}
+
+TEST_F(RulesCacheTest, Malformed)
+{
+	struct stat st;
+
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), ECGOTHER);
+
+	ASSERT_EQ(cg_rules_cache_store(CACHE_FILE, &lst, &sources), 0);
+	ASSERT_EQ(stat(CACHE_FILE, &st), 0);
+	ASSERT_EQ(truncate(CACHE_FILE, st.st_size - 1), 0);
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), ECGOTHER);
+
+	write_file(CACHE_FILE, "not a cache of the rules, but long enough to hold a header");
+	ASSERT_EQ(cg_rules_cache_load(CACHE_FILE, &loaded), ECGOTHER);
+	ASSERT_EQ(loaded.head, nullptr);
+}
+
+TEST_F(RulesCacheTest, NameInFiles)
+{
+	ASSERT_TRUE(cg_rules_name_in_files("root", false));
+	ASSERT_TRUE(cg_rules_name_in_files("root", true));
+
+	/* A prefix of a name is not the name */
+	ASSERT_FALSE(cg_rules_name_in_files("roo", false));
+	ASSERT_FALSE(cg_rules_name_in_files("no-such-user-of-the-test", false));
+}
@@ -0,0 +1,96 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the cache of the groups created from templates
+ */
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class TemplateCacheTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_rule rule;
+
+	void SetUp() override
+	{
+		memset(&rule, 0, sizeof(rule));
+		rule.controllers[0] = strdup("cpu");
+		rule.controllers[1] = strdup("memory");
+
+		/* Start from an empty cache */
+		cg_template_cache_invalidate();
+		ASSERT_FALSE(cg_template_cache_find("", false));
+	}
+
+	void TearDown() override
+	{
+		free(rule.controllers[0]);
+		free(rule.controllers[1]);
+	}
+};
+
+TEST_F(TemplateCacheTest, Key)
+{
+	char *key;
+
+	key = cg_template_cache_key("users/alice", &rule);
+	ASSERT_STREQ(key, "users/alice:cpu,memory");
+	free(key);
+}
+
+TEST_F(TemplateCacheTest, AddAndFind)
+{
+	char *key, *key2;
+
+	key = cg_template_cache_key("users/alice", &rule);
+	ASSERT_NE(key, nullptr);
+	ASSERT_FALSE(cg_template_cache_find(key, false));
+	ASSERT_EQ(cg_template_cache_add(key), 0);
+
+	ASSERT_TRUE(cg_template_cache_find("users/alice:cpu,memory", false));
+	ASSERT_FALSE(cg_template_cache_find("users/bob:cpu,memory", false));
+
+	/* The same group for another rule is another entry */
+	free(rule.controllers[1]);
+	rule.controllers[1] = NULL;
+	key2 = cg_template_cache_key("users/alice", &rule);
+	ASSERT_FALSE(cg_template_cache_find(key2, false));
+	free(key2);
+
+	/* Removed, e.g. the group could not be used */
+	ASSERT_TRUE(cg_template_cache_find("users/alice:cpu,memory", true));
+	ASSERT_FALSE(cg_template_cache_find("users/alice:cpu,memory", false));
+}
+
+TEST_F(TemplateCacheTest, Invalidate)
+{
+	char *key;
+
+	key = cg_template_cache_key("users/alice", &rule);
+	ASSERT_NE(key, nullptr);
+	ASSERT_EQ(cg_template_cache_add(key), 0);
+	ASSERT_TRUE(cg_template_cache_find("users/alice:cpu,memory", false));
+
+	/* A group was removed or the templates were reloaded */
+	cg_template_cache_invalidate();
+	ASSERT_FALSE(cg_template_cache_find("users/alice:cpu,memory", false));
+}
+
+TEST_F(TemplateCacheTest, ManyGroups)
+{
+	char name[FILENAME_MAX];
+	char *key;
+	int i;
+
+	for (i = 0; i < 2000; i++) {
+		snprintf(name, sizeof(name), "users/%d", i);
+		key = cg_template_cache_key(name, &rule);
+		ASSERT_NE(key, nullptr);
+		ASSERT_EQ(cg_template_cache_add(key), 0);
+	}
+
+	/* The cache started over when it was full, the last groups are kept */
+	ASSERT_TRUE(cg_template_cache_find("users/1999:cpu,memory", false));
+	ASSERT_FALSE(cg_template_cache_find("users/0:cpu,memory", false));
+}
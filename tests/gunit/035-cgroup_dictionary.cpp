@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the dictionary of the configuration parser
+ */
+
+#include <fstream>
+#include <string>
+using namespace std;
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const NAMES[] = { "cpu.shares", "cpu.cfs_quota_us", "cpu.shares",
+				     "cpu.cfs_period_us" };
+static const char * const VALUES[] = { "100", "-1", "200", "100000" };
+static const int NAMES_CNT = 4;
+
+class DictionaryTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_dictionary *dict = NULL;
+
+	void SetUp() override
+	{
+		ASSERT_EQ(cgroup_dictionary_create(&dict, CG_DICT_DONT_FREE_ITEMS), 0);
+	}
+
+	void TearDown() override
+	{
+		ASSERT_EQ(cgroup_dictionary_free(dict), 0);
+	}
+};
+
+TEST_F(DictionaryTest, IterationOrder)
+{
+	const char *name, *value;
+	void *handle;
+	int ret, i;
+
+	for (i = 0; i < NAMES_CNT; i++)
+		ASSERT_EQ(cgroup_dictionary_add(dict, NAMES[i], VALUES[i]), 0);
+
+	i = 0;
+	ret = cgroup_dictionary_iterator_begin(dict, &handle, &name, &value);
+	while (ret == 0) {
+		ASSERT_LT(i, NAMES_CNT);
+		ASSERT_EQ(name, NAMES[i]);
+		ASSERT_EQ(value, VALUES[i]);
+		i++;
+		ret = cgroup_dictionary_iterator_next(&handle, &name, &value);
+	}
+	cgroup_dictionary_iterator_end(&handle);
+
+	ASSERT_EQ(ret, ECGEOF);
+	ASSERT_EQ(i, NAMES_CNT);
+}
+
+TEST_F(DictionaryTest, Get)
+{
+	const char *value;
+	int i;
+
+	ASSERT_EQ(cgroup_dictionary_get(dict, "cpu.shares", &value), ECGROUPVALUENOTEXIST);
+
+	for (i = 0; i < NAMES_CNT; i++)
+		ASSERT_EQ(cgroup_dictionary_add(dict, NAMES[i], VALUES[i]), 0);
+
+	/* The first value of a name added twice */
+	ASSERT_EQ(cgroup_dictionary_get(dict, "cpu.shares", &value), 0);
+	ASSERT_STREQ(value, "100");
+	ASSERT_EQ(cgroup_dictionary_get(dict, "cpu.cfs_period_us", &value), 0);
+	ASSERT_STREQ(value, "100000");
+	ASSERT_EQ(cgroup_dictionary_get(dict, "cpu.weight", &value), ECGROUPVALUENOTEXIST);
+	ASSERT_EQ(cgroup_dictionary_get(NULL, "cpu.shares", &value), ECGINVAL);
+}
+
+TEST_F(DictionaryTest, ManyItems)
+{
+	struct cgroup_dictionary *owned;
+	const char *name, *value;
+	void *handle;
+	string key;
+	int ret, i;
+
+	ASSERT_EQ(cgroup_dictionary_create(&owned, 0), 0);
+	for (i = 0; i < 1000; i++) {
+		key = "name" + to_string(i);
+		ASSERT_EQ(cgroup_dictionary_add(owned, strdup(key.c_str()),
+						strdup(to_string(i).c_str())), 0);
+	}
+
+	for (i = 0; i < 1000; i++) {
+		key = "name" + to_string(i);
+		ASSERT_EQ(cgroup_dictionary_get(owned, key.c_str(), &value), 0);
+		ASSERT_STREQ(value, to_string(i).c_str());
+	}
+
+	i = 0;
+	ret = cgroup_dictionary_iterator_begin(owned, &handle, &name, &value);
+	while (ret == 0) {
+		ASSERT_STREQ(name, ("name" + to_string(i)).c_str());
+		i++;
+		ret = cgroup_dictionary_iterator_next(&handle, &name, &value);
+	}
+	cgroup_dictionary_iterator_end(&handle);
+	ASSERT_EQ(i, 1000);
+
+	ASSERT_EQ(cgroup_dictionary_free(owned), 0);
+}
+
+TEST(DictionaryConfigTest, DuplicateOption)
+{
+	static const char * const CONF = "test035cgconfig.conf";
+	char path[] = "test035cgconfig.conf";
+
+	ofstream(CONF) << "template users/%u {\n\tcpu {\n\t\tcpu.shares = 100;\n"
+			  "\t\tcpu.cfs_quota_us = -1;\n\t\tcpu.shares = 200;\n\t}\n}\n";
+	ASSERT_NE(cgroup_init_templates_cache(path), 0);
+
+	ofstream(CONF) << "template users/%u {\n\tcpu {\n\t\tcpu.shares = 100;\n"
+			  "\t\tcpu.cfs_quota_us = -1;\n\t}\n}\n";
+	ASSERT_EQ(cgroup_init_templates_cache(path), 0);
+
+	ASSERT_EQ(unlink(CONF), 0);
+}
@@ -0,0 +1,71 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the migration of the tasks of a removed group
+ */
+
+#include <string>
+using namespace std;
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const INPUT_FILE = "test036tasks";
+static const char * const OUTPUT_FILE = "test036parent";
+
+class MoveTasksTest : public ::testing::Test {
+	protected:
+
+	void TearDown() override
+	{
+		unlink(INPUT_FILE);
+		unlink(OUTPUT_FILE);
+	}
+
+	/* The pids end up concatenated in a regular file, one write() each */
+	string Move(const string &tasks)
+	{
+		FILE *in, *out;
+		char buf[4096];
+		string result;
+		size_t len;
+
+		in = fopen(INPUT_FILE, "w");
+		fwrite(tasks.c_str(), 1, tasks.size(), in);
+		fclose(in);
+
+		in = fopen(INPUT_FILE, "re");
+		out = fopen(OUTPUT_FILE, "we");
+		EXPECT_EQ(cg_move_task_files(in, out), 0);
+		fclose(in);
+		fclose(out);
+
+		out = fopen(OUTPUT_FILE, "re");
+		while ((len = fread(buf, 1, sizeof(buf), out)) > 0)
+			result.append(buf, len);
+		fclose(out);
+
+		return result;
+	}
+};
+
+TEST_F(MoveTasksTest, FewTasks)
+{
+	ASSERT_EQ(Move("12\n345\n6\n"), "123456");
+	ASSERT_EQ(Move("12\n345"), "12345");
+	ASSERT_EQ(Move(""), "");
+}
+
+TEST_F(MoveTasksTest, ManyTasks)
+{
+	string tasks, expected;
+	int i;
+
+	/* Several chunks, with pids split across them */
+	for (i = 100000; i < 150000; i++) {
+		tasks += to_string(i) + "\n";
+		expected += to_string(i);
+	}
+
+	ASSERT_EQ(Move(tasks), expected);
+}
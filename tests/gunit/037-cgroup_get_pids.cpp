@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for cgroup_get_pids()
+ */
+
+#include <ftw.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static const char * const PARENT_DIR = "test037cgroup";
+static const char * const CG_NAME = "grp";
+static const mode_t MODE = S_IRWXU | S_IRWXG | S_IRWXO;
+
+static void write_file(const char * const name, const char * const content)
+{
+	char path[FILENAME_MAX];
+	FILE *f;
+
+	snprintf(path, sizeof(path), "%s/cpu/%s/%s", PARENT_DIR, CG_NAME, name);
+	f = fopen(path, "w");
+	ASSERT_NE(f, nullptr);
+	fprintf(f, "%s", content);
+	fclose(f);
+}
+
+static int unlink_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+class GetPidsTest : public ::testing::Test {
+	protected:
+
+	pid_t *pids = NULL;
+	int alloc = 0;
+	int size = 0;
+
+	void SetUp() override
+	{
+		char path[FILENAME_MAX];
+
+		ASSERT_EQ(cgroup_init(), 0);
+
+		ASSERT_EQ(mkdir(PARENT_DIR, MODE), 0);
+		snprintf(path, sizeof(path), "%s/cpu", PARENT_DIR);
+		ASSERT_EQ(mkdir(path, MODE), 0);
+		snprintf(path, sizeof(path), "%s/cpu/%s", PARENT_DIR, CG_NAME);
+		ASSERT_EQ(mkdir(path, MODE), 0);
+
+		write_file("cgroup.procs", "30\n10\n20\n");
+		write_file("tasks", "31\n30\n11\n10\n20\n");
+
+		memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+		memset(&cg_namespace_table, 0, sizeof(cg_namespace_table));
+		snprintf(cg_mount_table[0].name, CONTROL_NAMELEN_MAX, "cpu");
+		snprintf(cg_mount_table[0].mount.path, FILENAME_MAX, "%s/cpu", PARENT_DIR);
+		cg_mount_table[0].version = CGROUP_V1;
+		cg_mount_index_build();
+	}
+
+	void TearDown() override
+	{
+		free(pids);
+		ASSERT_EQ(nftw(PARENT_DIR, unlink_cb, 64, FTW_DEPTH | FTW_PHYS), 0);
+	}
+};
+
+TEST_F(GetPidsTest, SortedAndUnsorted)
+{
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", 0, &pids, &alloc, &size), 0);
+	ASSERT_EQ(size, 3);
+	ASSERT_EQ(pids[0], 10);
+	ASSERT_EQ(pids[1], 20);
+	ASSERT_EQ(pids[2], 30);
+
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", CGFLAG_PIDS_UNSORTED, &pids, &alloc, &size), 0);
+	ASSERT_EQ(size, 3);
+	ASSERT_EQ(pids[0], 30);
+	ASSERT_EQ(pids[1], 10);
+	ASSERT_EQ(pids[2], 20);
+}
+
+TEST_F(GetPidsTest, Threads)
+{
+	pid_t *threads;
+	int count;
+
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", CGFLAG_PIDS_THREADS | CGFLAG_PIDS_UNSORTED,
+				  &pids, &alloc, &size), 0);
+	ASSERT_EQ(size, 5);
+	ASSERT_EQ(pids[0], 31);
+	ASSERT_EQ(pids[4], 20);
+
+	ASSERT_EQ(cgroup_get_threads(CG_NAME, "cpu", &threads, &count), 0);
+	ASSERT_EQ(count, 5);
+	ASSERT_EQ(threads[0], 10);
+	ASSERT_EQ(threads[4], 31);
+	free(threads);
+}
+
+TEST_F(GetPidsTest, ReusedBuffer)
+{
+	pid_t *buffer;
+
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", 0, &pids, &alloc, &size), 0);
+	buffer = pids;
+	ASSERT_GE(alloc, size);
+
+	/* The last pid is not followed by a newline */
+	write_file("cgroup.procs", "7\n5");
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", 0, &pids, &alloc, &size), 0);
+	ASSERT_EQ(pids, buffer);
+	ASSERT_EQ(size, 2);
+	ASSERT_EQ(pids[0], 5);
+	ASSERT_EQ(pids[1], 7);
+
+	write_file("cgroup.procs", "");
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", 0, &pids, &alloc, &size), 0);
+	ASSERT_EQ(size, 0);
+}
+
+TEST_F(GetPidsTest, ChunkBoundaries)
+{
+	std::string content;
+	int i;
+
+	/* Enough pids to span several chunks, some of them cut in two */
+	for (i = 0; i < 30000; i++)
+		content += std::to_string(1000000 + i) + "\n";
+	write_file("cgroup.procs", content.c_str());
+
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", CGFLAG_PIDS_UNSORTED, &pids, &alloc, &size), 0);
+	ASSERT_EQ(size, 30000);
+	for (i = 0; i < size; i++)
+		ASSERT_EQ(pids[i], 1000000 + i);
+}
+
+TEST_F(GetPidsTest, Errors)
+{
+	pid_t *procs = NULL;
+	int count = 1;
+
+	ASSERT_EQ(cgroup_get_pids(NULL, "cpu", 0, &pids, &alloc, &size), ECGINVAL);
+	ASSERT_EQ(cgroup_get_pids(CG_NAME, "cpu", 0, &pids, NULL, &size), ECGINVAL);
+
+	ASSERT_EQ(cgroup_get_procs((char *)"missing", (char *)"cpu", &procs, &count),
+		  ECGROUPUNSUPP);
+	ASSERT_EQ(procs, nullptr);
+	ASSERT_EQ(count, 0);
+}
@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the rules left unchanged by a reload, see
+ * cgroup_change_all_cgroups_ext()
+ */
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+static void add_rule(struct cgroup_rule_list * const lst, const char * const username,
+		     const char * const destination, const char * const controller)
+{
+	struct cgroup_rule *rule;
+
+	rule = (struct cgroup_rule *)calloc(1, sizeof(struct cgroup_rule));
+	ASSERT_NE(rule, nullptr);
+
+	snprintf(rule->username, sizeof(rule->username), "%s", username);
+	snprintf(rule->destination, sizeof(rule->destination), "%s", destination);
+	rule->controllers[0] = strdup(controller);
+
+	if (lst->tail)
+		lst->tail->next = rule;
+	else
+		lst->head = rule;
+	lst->tail = rule;
+	lst->len++;
+}
+
+static struct cgroup_rule *nth_rule(const struct cgroup_rule_list * const lst, int n)
+{
+	struct cgroup_rule *rule = lst->head;
+
+	while (rule && n--)
+		rule = rule->next;
+
+	return rule;
+}
+
+class ChangeAllTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_rule_list old = { 0 };
+	struct cgroup_rule_list lst = { 0 };
+
+	void SetUp() override
+	{
+		add_rule(&old, "alice", "alice", "cpu");
+		add_rule(&old, "bob", "bob", "cpu");
+		add_rule(&old, "%", "bob", "memory");
+		add_rule(&old, "*", "others", "cpu");
+	}
+
+	void TearDown() override
+	{
+		if (old.head)
+			cgroup_free_rule_list(&old);
+		if (lst.head)
+			cgroup_free_rule_list(&lst);
+	}
+};
+
+TEST_F(ChangeAllTest, NoPreviousRules)
+{
+	add_rule(&lst, "alice", "alice", "cpu");
+
+	cgroup_mark_unchanged_rules(NULL, &lst);
+	ASSERT_FALSE(lst.head->unchanged);
+}
+
+TEST_F(ChangeAllTest, SameRules)
+{
+	add_rule(&lst, "alice", "alice", "cpu");
+	add_rule(&lst, "bob", "bob", "cpu");
+	add_rule(&lst, "%", "bob", "memory");
+	add_rule(&lst, "*", "others", "cpu");
+
+	cgroup_mark_unchanged_rules(&old, &lst);
+	for (int i = 0; i < 4; i++)
+		ASSERT_TRUE(nth_rule(&lst, i)->unchanged);
+	ASSERT_EQ(lst.replaced, nullptr);
+}
+
+TEST_F(ChangeAllTest, InsertedRule)
+{
+	add_rule(&lst, "alice", "alice", "cpu");
+	add_rule(&lst, "bob", "bob", "cpu");
+	add_rule(&lst, "%", "bob", "memory");
+	add_rule(&lst, "carol", "carol", "cpu");
+	add_rule(&lst, "*", "others", "cpu");
+
+	cgroup_mark_unchanged_rules(&old, &lst);
+	ASSERT_TRUE(nth_rule(&lst, 0)->unchanged);
+	ASSERT_TRUE(nth_rule(&lst, 1)->unchanged);
+	ASSERT_TRUE(nth_rule(&lst, 2)->unchanged);
+	ASSERT_FALSE(nth_rule(&lst, 3)->unchanged);
+	/* A pid it shadows now matches the new rule first */
+	ASSERT_TRUE(nth_rule(&lst, 4)->unchanged);
+	ASSERT_EQ(lst.replaced, nullptr);
+}
+
+TEST_F(ChangeAllTest, ChangedMultiLineRule)
+{
+	add_rule(&lst, "alice", "alice", "cpu");
+	add_rule(&lst, "bob", "bob", "cpu");
+	add_rule(&lst, "%", "bob", "memory");
+	add_rule(&lst, "%", "bob", "pids");
+	add_rule(&lst, "*", "others", "cpu");
+
+	cgroup_mark_unchanged_rules(&old, &lst);
+	ASSERT_TRUE(nth_rule(&lst, 0)->unchanged);
+	ASSERT_FALSE(nth_rule(&lst, 1)->unchanged);
+	ASSERT_FALSE(nth_rule(&lst, 2)->unchanged);
+	ASSERT_FALSE(nth_rule(&lst, 3)->unchanged);
+	ASSERT_TRUE(nth_rule(&lst, 4)->unchanged);
+
+	ASSERT_NE(lst.replaced, nullptr);
+	ASSERT_STREQ(nth_rule(lst.replaced, 0)->username, "bob");
+	ASSERT_STREQ(nth_rule(lst.replaced, 1)->controllers[0], "memory");
+	ASSERT_EQ(nth_rule(lst.replaced, 2), nullptr);
+}
+
+TEST_F(ChangeAllTest, RemovedContinuation)
+{
+	add_rule(&lst, "alice", "alice", "cpu");
+	add_rule(&lst, "bob", "bob", "cpu");
+	add_rule(&lst, "*", "others", "cpu");
+
+	cgroup_mark_unchanged_rules(&old, &lst);
+	ASSERT_TRUE(nth_rule(&lst, 0)->unchanged);
+	ASSERT_FALSE(nth_rule(&lst, 1)->unchanged);
+	ASSERT_TRUE(nth_rule(&lst, 2)->unchanged);
+	ASSERT_NE(lst.replaced, nullptr);
+	ASSERT_EQ(nth_rule(lst.replaced, 2), nullptr);
+}
+
+TEST_F(ChangeAllTest, ReplacedRuleShadows)
+{
+	struct cgroup_rule *rule;
+
+	/* Only the first rule of bob is removed */
+	nth_rule(&old, 1)->uid = 1001;
+	nth_rule(&old, 1)->gid = CGRULE_INVALID;
+	nth_rule(&old, 2)->uid = 1001;
+	nth_rule(&old, 2)->gid = CGRULE_INVALID;
+	nth_rule(&old, 3)->uid = CGRULE_WILD;
+	nth_rule(&old, 3)->gid = CGRULE_WILD;
+
+	add_rule(&lst, "alice", "alice", "cpu");
+	add_rule(&lst, "*", "others", "cpu");
+	nth_rule(&lst, 1)->uid = CGRULE_WILD;
+	nth_rule(&lst, 1)->gid = CGRULE_WILD;
+
+	cgroup_mark_unchanged_rules(&old, &lst);
+	ASSERT_TRUE(nth_rule(&lst, 0)->unchanged);
+	ASSERT_TRUE(nth_rule(&lst, 1)->unchanged);
+	ASSERT_NE(lst.replaced, nullptr);
+
+	/* bob matched his own rule, he must be classified again */
+	rule = cgroup_find_matching_rule(lst.replaced, 1001, 1001, getpid(), NULL);
+	ASSERT_NE(rule, nullptr);
+	ASSERT_STREQ(rule->destination, "bob");
+
+	/* The others still match the wildcard rule first */
+	ASSERT_EQ(cgroup_find_matching_rule(lst.replaced, 1002, 1002, getpid(), NULL), nullptr);
+}
+
+TEST_F(ChangeAllTest, InvalidJobs)
+{
+	ASSERT_EQ(cgroup_change_all_cgroups_ext(0, 0), ECGINVAL);
+}
+
+static bool skip_all(pid_t pid, void *userdata)
+{
+	(*(int *)userdata)++;
+
+	return true;
+}
+
+TEST_F(ChangeAllTest, SkipCallback)
+{
+	int skipped = 0;
+
+	/* No pid is read nor moved */
+	ASSERT_EQ(cgroup_change_all_cgroups_skip(1, CGFLAG_CHANGE_ALL_CHANGED_RULES, skip_all,
+						 &skipped), 0);
+	ASSERT_GT(skipped, 0);
+}
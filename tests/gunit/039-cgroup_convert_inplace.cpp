@@ -0,0 +1,142 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the lookup of the conversion tables and
+ * cgroup_convert_cgroup_inplace()
+ */
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "abstraction-map.h"
+
+static const char * const CG_NAME = "test039";
+
+class ConvertInplaceTest : public ::testing::Test {
+	protected:
+
+	void SetUp() override
+	{
+		ASSERT_EQ(cgroup_init(), 0);
+
+		/* cgroup_add_controller() needs the controllers to be mounted */
+		memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+		memset(&cg_namespace_table, 0, sizeof(cg_namespace_table));
+		snprintf(cg_mount_table[0].name, CONTROL_NAMELEN_MAX, "cpu");
+		snprintf(cg_mount_table[0].mount.path, FILENAME_MAX, "/sys/fs/cgroup/cpu");
+		cg_mount_table[0].version = CGROUP_V1;
+		snprintf(cg_mount_table[1].name, CONTROL_NAMELEN_MAX, "cpuset");
+		snprintf(cg_mount_table[1].mount.path, FILENAME_MAX, "/sys/fs/cgroup/cpuset");
+		cg_mount_table[1].version = CGROUP_V1;
+		cg_mount_index_build();
+	}
+};
+
+TEST(ConvertLookupTest, OrderOfSetting)
+{
+	const struct cgroup_abstraction_map **entries;
+
+	/* cpu.max maps to two settings, in the order of the table */
+	ASSERT_EQ(cg_convert_lookup(CGROUP_V1, "cpu.max", &entries), 2);
+	ASSERT_STREQ(entries[0]->out_setting, "cpu.cfs_quota_us");
+	ASSERT_STREQ(entries[1]->out_setting, "cpu.cfs_period_us");
+
+	ASSERT_EQ(cg_convert_lookup(CGROUP_V2, "cpuset.effective_cpus", &entries), 1);
+	ASSERT_STREQ(entries[0]->out_setting, "cpuset.cpus.effective");
+
+	ASSERT_EQ(cg_convert_lookup(CGROUP_V2, "cpuset.nonexistent", &entries), 0);
+	ASSERT_EQ(cg_convert_lookup(CGROUP_V2, "", &entries), 0);
+	ASSERT_EQ(cg_convert_lookup(CGROUP_V2, "zzz.last", &entries), 0);
+	ASSERT_EQ(cg_convert_lookup(CGROUP_DISK, "cpu.max", &entries), -1);
+}
+
+TEST_F(ConvertInplaceTest, Rename)
+{
+	struct cgroup_controller *cgc;
+	struct control_value *value;
+	struct cgroup *cgroup;
+
+	cgroup = cgroup_new_cgroup(CG_NAME);
+	ASSERT_NE(cgroup, nullptr);
+	cgc = cgroup_add_controller(cgroup, "cpuset");
+	ASSERT_NE(cgc, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpuset.effective_cpus", "0-3"), 0);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpuset.mems", "0"), 0);
+	value = cgc->values[0];
+
+	ASSERT_EQ(cgroup_convert_cgroup_inplace(cgroup, CGROUP_V2, CGROUP_V1), 0);
+
+	/* The values were renamed, not copied */
+	ASSERT_EQ(cgroup->index, 1);
+	ASSERT_EQ(cgroup->controller[0], cgc);
+	ASSERT_EQ(cgc->version, CGROUP_V2);
+	ASSERT_EQ(cgc->index, 2);
+	ASSERT_EQ(cgc->values[0], value);
+	ASSERT_STREQ(cgc->values[0]->name, "cpuset.cpus.effective");
+	ASSERT_STREQ(cgc->values[0]->value, "0-3");
+	ASSERT_STREQ(cgc->values[1]->name, "cpuset.mems");
+	ASSERT_STREQ(cgc->values[1]->value, "0");
+
+	/* And back */
+	ASSERT_EQ(cgroup_convert_cgroup_inplace(cgroup, CGROUP_V1, CGROUP_V2), 0);
+	ASSERT_EQ(cgc->version, CGROUP_V1);
+	ASSERT_STREQ(cgc->values[0]->name, "cpuset.effective_cpus");
+
+	cgroup_free(&cgroup);
+}
+
+TEST_F(ConvertInplaceTest, Computed)
+{
+	struct cgroup_controller *cgc;
+	struct cgroup *cgroup;
+
+	cgroup = cgroup_new_cgroup(CG_NAME);
+	ASSERT_NE(cgroup, nullptr);
+	cgc = cgroup_add_controller(cgroup, "cpu");
+	ASSERT_NE(cgc, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpu.shares", "2048"), 0);
+	cgc = cgroup_add_controller(cgroup, "cpuset");
+	ASSERT_NE(cgc, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpuset.cpus", "1"), 0);
+
+	ASSERT_EQ(cgroup_convert_cgroup_inplace(cgroup, CGROUP_V2, CGROUP_V1), 0);
+
+	ASSERT_EQ(cgroup->index, 2);
+	cgc = cgroup->controller[0];
+	ASSERT_STREQ(cgc->name, "cpu");
+	ASSERT_EQ(cgc->version, CGROUP_V2);
+	ASSERT_EQ(cgc->index, 1);
+	ASSERT_STREQ(cgc->values[0]->name, "cpu.weight");
+	ASSERT_STREQ(cgc->values[0]->value, "200");
+
+	cgc = cgroup->controller[1];
+	ASSERT_EQ(cgc->version, CGROUP_V2);
+	ASSERT_STREQ(cgc->values[0]->name, "cpuset.cpus");
+
+	cgroup_free(&cgroup);
+}
+
+TEST_F(ConvertInplaceTest, Unmappable)
+{
+	struct cgroup_controller *cgc;
+	struct cgroup *cgroup;
+
+	cgroup = cgroup_new_cgroup(CG_NAME);
+	ASSERT_NE(cgroup, nullptr);
+	cgc = cgroup_add_controller(cgroup, "cpuset");
+	ASSERT_NE(cgc, nullptr);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpuset.mem_hardwall", "1"), 0);
+	ASSERT_EQ(cgroup_add_value_string(cgc, "cpuset.cpus", "1"), 0);
+
+	/* The unmappable setting is dropped */
+	ASSERT_EQ(cgroup_convert_cgroup_inplace(cgroup, CGROUP_V2, CGROUP_V1),
+		  ECGNOVERSIONCONVERT);
+	ASSERT_EQ(cgroup->index, 1);
+	cgc = cgroup->controller[0];
+	ASSERT_EQ(cgc->version, CGROUP_V2);
+	ASSERT_EQ(cgc->index, 1);
+	ASSERT_STREQ(cgc->values[0]->name, "cpuset.cpus");
+
+	ASSERT_EQ(cgroup_convert_cgroup_inplace(NULL, CGROUP_V2, CGROUP_V1), ECGINVAL);
+
+	cgroup_free(&cgroup);
+}
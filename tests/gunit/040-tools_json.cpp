@@ -0,0 +1,118 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the JSON output of the tools
+ */
+
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "tools-common.h"
+
+class ToolsJsonTest : public ::testing::Test {
+	protected:
+
+	char *buf = NULL;
+	size_t size = 0;
+	FILE *out = NULL;
+
+	void SetUp() override
+	{
+		out = open_memstream(&buf, &size);
+		ASSERT_NE(out, nullptr);
+	}
+
+	void TearDown() override
+	{
+		if (out)
+			fclose(out);
+		free(buf);
+	}
+
+	void reset()
+	{
+		fclose(out);
+		free(buf);
+		buf = NULL;
+		out = open_memstream(&buf, &size);
+		ASSERT_NE(out, nullptr);
+	}
+
+	const char *output()
+	{
+		fflush(out);
+		return buf;
+	}
+};
+
+TEST_F(ToolsJsonTest, Values)
+{
+	print_json_value(out, "1024");
+	fputc(' ', out);
+	print_json_value(out, "-1");
+	fputc(' ', out);
+	print_json_value(out, "0.25");
+	fputc(' ', out);
+	print_json_value(out, "max");
+	fputc(' ', out);
+	print_json_value(out, "0123");
+	fputc(' ', out);
+	print_json_value(out, "100000 100000");
+	fputc(' ', out);
+	print_json_value(out, "");
+	fputc(' ', out);
+	print_json_value(out, "1.");
+
+	ASSERT_STREQ(output(), "1024 -1 0.25 \"max\" \"0123\" \"100000 100000\" \"\" \"1.\"");
+}
+
+TEST_F(ToolsJsonTest, Strings)
+{
+	print_json_string(out, "a \"b\"\\c\nd\te\x01");
+
+	ASSERT_STREQ(output(), "\"a \\\"b\\\"\\\\c\\nd\\te\\u0001\"");
+}
+
+TEST_F(ToolsJsonTest, Streams)
+{
+	struct json_stream stream;
+	int i;
+
+	json_stream_begin(&stream, out, FORMAT_JSON);
+	json_stream_end(&stream);
+	ASSERT_STREQ(output(), "[]\n");
+
+	reset();
+	json_stream_begin(&stream, out, FORMAT_JSON);
+	for (i = 0; i < 2; i++) {
+		json_record_begin(&stream);
+		fprintf(out, "{\"n\":%d}", i);
+		json_record_end(&stream);
+	}
+	json_stream_end(&stream);
+	ASSERT_STREQ(output(), "[\n{\"n\":0},\n{\"n\":1}\n]\n");
+
+	reset();
+	json_stream_begin(&stream, out, FORMAT_NDJSON);
+	for (i = 0; i < 2; i++) {
+		json_record_begin(&stream);
+		fprintf(out, "{\"n\":%d}", i);
+		json_record_end(&stream);
+	}
+	json_stream_end(&stream);
+	ASSERT_STREQ(output(), "{\"n\":0}\n{\"n\":1}\n");
+}
+
+TEST_F(ToolsJsonTest, ParseFormat)
+{
+	enum output_format format;
+
+	ASSERT_EQ(parse_format("json", &format, "test"), 0);
+	ASSERT_EQ(format, FORMAT_JSON);
+	ASSERT_EQ(parse_format("ndjson", &format, "test"), 0);
+	ASSERT_EQ(format, FORMAT_NDJSON);
+	ASSERT_EQ(parse_format("text", &format, "test"), 0);
+	ASSERT_EQ(format, FORMAT_TEXT);
+	ASSERT_EQ(parse_format("xml", &format, "test"), -1);
+}
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the synthetic cgroup filesystem of the tests
+ */
+
+#include <sys/stat.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test041cgroup";
+
+class FixtureTest : public ::testing::TestWithParam<enum cg_version_t> {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = GetParam();
+		opts.depth = 2;
+		opts.fanout = 3;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+	}
+
+	void TearDown() override
+	{
+		struct stat st;
+
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+		ASSERT_NE(stat(FIXTURE_DIR, &st), 0);
+	}
+};
+
+TEST_P(FixtureTest, Layout)
+{
+	char name[FILENAME_MAX];
+
+	ASSERT_EQ(fixture.groups, 12);
+	ASSERT_EQ(fixture.controllers_cnt, 3);
+
+	ASSERT_EQ(cgroup_fixture_leaf_name(&fixture, 0, name, sizeof(name)), 0);
+	ASSERT_STREQ(name, "cg0/cg0");
+	ASSERT_EQ(cgroup_fixture_leaf_name(&fixture, 5, name, sizeof(name)), 0);
+	ASSERT_STREQ(name, "cg1/cg2");
+	ASSERT_EQ(cgroup_fixture_leaf_name(&fixture, 9, name, sizeof(name)), -1);
+	ASSERT_EQ(cgroup_fixture_leaf_name(&fixture, 8, name, 4), -1);
+}
+
+TEST_P(FixtureTest, GetCgroup)
+{
+	struct cgroup_controller *ctrl;
+	char name[FILENAME_MAX];
+	struct cgroup *cg;
+	char *value;
+
+	ASSERT_EQ(cgroup_fixture_leaf_name(&fixture, 7, name, sizeof(name)), 0);
+	cg = cgroup_new_cgroup(name);
+	ASSERT_NE(cg, nullptr);
+	ASSERT_EQ(cgroup_get_cgroup(cg), 0);
+
+	ctrl = cgroup_get_controller(cg, "memory");
+	ASSERT_NE(ctrl, nullptr);
+	ASSERT_EQ(cgroup_get_value_string(ctrl, "memory.stat", &value), 0);
+	ASSERT_NE(strstr(value, "anon "), nullptr);
+	free(value);
+
+	ASSERT_NE(cgroup_get_controller(cg, "cpu"), nullptr);
+	ASSERT_NE(cgroup_get_controller(cg, "pids"), nullptr);
+
+	cgroup_free(&cg);
+}
+
+TEST_P(FixtureTest, WalkTree)
+{
+	struct cgroup_file_info info;
+	int base_level, ret;
+	void *handle;
+	long dirs = 0;
+
+	ret = cgroup_walk_tree_begin("memory", "/", 0, &handle, &info, &base_level);
+	while (ret == 0) {
+		if (info.type == CGROUP_FILE_TYPE_DIR)
+			dirs++;
+		ret = cgroup_walk_tree_next(0, &handle, &info, base_level);
+	}
+	ASSERT_EQ(ret, ECGEOF);
+	ASSERT_EQ(cgroup_walk_tree_end(&handle), 0);
+
+	/* The root is walked too */
+	ASSERT_EQ(dirs, fixture.groups + 1);
+}
+
+INSTANTIATE_TEST_SUITE_P(CgroupFixtureTest, FixtureTest,
+			 ::testing::Values(CGROUP_V1, CGROUP_V2));
@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the logging callbacks and the inline level check
+ */
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+struct log_capture {
+	int calls;
+	int level;
+	std::string file;
+	unsigned int line;
+	std::string function;
+	std::string format;
+	std::string message;
+};
+
+static void record_logger(void *userdata, const struct cgroup_log_record *record, va_list ap)
+{
+	struct log_capture *capture = (struct log_capture *)userdata;
+	char buf[256];
+
+	capture->calls++;
+	capture->level = record->level;
+	capture->file = record->file ? record->file : "";
+	capture->line = record->line;
+	capture->function = record->function ? record->function : "";
+	capture->format = record->format;
+
+	vsnprintf(buf, sizeof(buf), record->format, ap);
+	capture->message = buf;
+}
+
+static void plain_logger(void *userdata, int level, const char *fmt, va_list ap)
+{
+	struct log_capture *capture = (struct log_capture *)userdata;
+	char buf[256];
+
+	capture->calls++;
+	capture->level = level;
+
+	vsnprintf(buf, sizeof(buf), fmt, ap);
+	capture->message = buf;
+}
+
+class LogTest : public ::testing::Test {
+	protected:
+
+	struct log_capture capture = { };
+
+	void TearDown() override
+	{
+		cgroup_set_logger(NULL, CGROUP_LOG_ERROR, NULL);
+	}
+};
+
+TEST_F(LogTest, RecordFields)
+{
+	unsigned int line;
+
+	cgroup_set_log_record_callback(record_logger, CGROUP_LOG_WARNING, &capture);
+
+	line = __LINE__ + 1;
+	cgroup_warn("value %d\n", 42);
+
+	ASSERT_EQ(capture.calls, 1);
+	ASSERT_EQ(capture.level, CGROUP_LOG_WARNING);
+	ASSERT_EQ(capture.file, __FILE__);
+	ASSERT_EQ(capture.line, line);
+	ASSERT_EQ(capture.function, __func__);
+	ASSERT_EQ(capture.format, "value %d\n");
+	ASSERT_EQ(capture.message, "value 42\n");
+}
+
+TEST_F(LogTest, RecordFromCgroupLog)
+{
+	cgroup_set_log_record_callback(record_logger, CGROUP_LOG_INFO, &capture);
+
+	cgroup_log(CGROUP_LOG_INFO, "plain %s\n", "message");
+
+	ASSERT_EQ(capture.calls, 1);
+	ASSERT_EQ(capture.file, "");
+	ASSERT_EQ(capture.line, 0);
+	ASSERT_EQ(capture.message, "plain message\n");
+}
+
+TEST_F(LogTest, PrefixKeptForPlainLogger)
+{
+	cgroup_set_logger(plain_logger, CGROUP_LOG_ERROR, &capture);
+
+	cgroup_err("failed %d\n", 1);
+
+	ASSERT_EQ(capture.calls, 1);
+	ASSERT_EQ(capture.level, CGROUP_LOG_ERROR);
+	ASSERT_EQ(capture.message, "Error: failed 1\n");
+}
+
+static int evaluated;
+
+static int count_evaluation(void)
+{
+	return ++evaluated;
+}
+
+TEST_F(LogTest, LevelCheckedInline)
+{
+	cgroup_set_log_record_callback(record_logger, CGROUP_LOG_WARNING, &capture);
+	evaluated = 0;
+
+	/* The arguments of a disabled message are not evaluated */
+	cgroup_info("%d\n", count_evaluation());
+	ASSERT_EQ(capture.calls, 0);
+	ASSERT_EQ(evaluated, 0);
+
+	cgroup_warn("%d\n", count_evaluation());
+	ASSERT_EQ(capture.calls, 1);
+	ASSERT_EQ(evaluated, 1);
+
+	/* No logger, nothing is evaluated at any level */
+	cgroup_set_logger(NULL, CGROUP_LOG_DEBUG, NULL);
+	cgroup_err("%d\n", count_evaluation());
+	ASSERT_EQ(evaluated, 1);
+}
+
+TEST_F(LogTest, ReplaceCallbacks)
+{
+	struct log_capture plain = { };
+
+	cgroup_set_log_record_callback(record_logger, CGROUP_LOG_ERROR, &capture);
+	cgroup_set_logger(plain_logger, CGROUP_LOG_ERROR, &plain);
+
+	cgroup_err("once\n");
+	ASSERT_EQ(capture.calls, 0);
+	ASSERT_EQ(plain.calls, 1);
+
+	/* The default logger does not replace a record callback */
+	cgroup_set_log_record_callback(record_logger, CGROUP_LOG_ERROR, &capture);
+	cgroup_set_default_logger(CGROUP_LOG_ERROR);
+	cgroup_err("twice\n");
+	ASSERT_EQ(capture.calls, 1);
+	ASSERT_EQ(plain.calls, 1);
+}
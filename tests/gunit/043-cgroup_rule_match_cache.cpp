@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the cache of the rule match results
+ */
+
+#include <string.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+#define RULE_CNT 5
+
+class RuleMatchCacheTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_rule rules[RULE_CNT];
+	struct cgroup_rule_list lst = { };
+
+	void SetRule(int i, const char * const username, uid_t uid, gid_t gid,
+		     const char * const procname)
+	{
+		memset(&rules[i], 0, sizeof(rules[i]));
+		strncpy(rules[i].username, username, sizeof(rules[i].username) - 1);
+		rules[i].uid = uid;
+		rules[i].gid = gid;
+		rules[i].procname = procname ? strdup(procname) : NULL;
+		if (i > 0)
+			rules[i - 1].next = &rules[i];
+	}
+
+	void SetUp() override
+	{
+		SetRule(0, "alice", 1000, CGRULE_INVALID, "bash");
+		SetRule(1, "%", 1000, CGRULE_INVALID, NULL);
+		SetRule(2, "@cgrulestest_nosuchgroup", CGRULE_INVALID, 500, "make");
+		SetRule(3, "bob", 1001, CGRULE_INVALID, "/usr/bin/python*");
+		SetRule(4, "carol", 1002, CGRULE_INVALID, NULL);
+
+		lst.head = &rules[0];
+		lst.tail = &rules[RULE_CNT - 1];
+		lst.len = RULE_CNT;
+		ASSERT_EQ(cgroup_rule_index_build(lst.head, &lst.index), 0);
+	}
+
+	void TearDown() override
+	{
+		int i;
+
+		cgroup_set_group_cache_ttl(0);
+		cgroup_rule_index_free(&lst.index);
+
+		for (i = 0; i < RULE_CNT; i++)
+			free(rules[i].procname);
+	}
+
+	bool Cached(uid_t uid, gid_t gid, const char * const procname,
+		    struct cgroup_rule ** const rule)
+	{
+		unsigned long gen;
+
+		return cgroup_rule_index_match_get(lst.index, uid, gid, procname, 60, rule, &gen);
+	}
+};
+
+TEST_F(RuleMatchCacheTest, HitReturnsTheSameRule)
+{
+	struct cgroup_rule *rule = NULL;
+
+	ASSERT_FALSE(Cached(1000, 100, "/bin/bash", &rule));
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 100, 0, "/bin/bash"), &rules[0]);
+
+	ASSERT_TRUE(Cached(1000, 100, "/bin/bash", &rule));
+	ASSERT_EQ(rule, &rules[0]);
+	/* The continuation rules follow the cached one */
+	ASSERT_EQ(rule->next, &rules[1]);
+
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 100, 0, "/bin/bash"), &rules[0]);
+}
+
+TEST_F(RuleMatchCacheTest, KeyedByUidGidAndProcname)
+{
+	struct cgroup_rule *rule = NULL;
+
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1001, 100, 0, "/usr/bin/python3"), &rules[3]);
+
+	ASSERT_FALSE(Cached(1001, 101, "/usr/bin/python3", &rule));
+	ASSERT_FALSE(Cached(1002, 100, "/usr/bin/python3", &rule));
+	ASSERT_FALSE(Cached(1001, 100, "/usr/bin/python2", &rule));
+	ASSERT_FALSE(Cached(1001, 100, NULL, &rule));
+	ASSERT_TRUE(Cached(1001, 100, "/usr/bin/python3", &rule));
+}
+
+TEST_F(RuleMatchCacheTest, NoProcname)
+{
+	struct cgroup_rule *rule = NULL;
+
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 100, 0, NULL), &rules[0]);
+	ASSERT_TRUE(Cached(1000, 100, NULL, &rule));
+	ASSERT_EQ(rule, &rules[0]);
+
+	/* The group rule is checked before the rule of carol */
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1002, 100, 0, NULL), &rules[4]);
+	ASSERT_FALSE(Cached(1002, 100, NULL, &rule));
+}
+
+TEST_F(RuleMatchCacheTest, NegativeResult)
+{
+	struct cgroup_rule *rule = &rules[0];
+
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 2000, 2000, 0, "/bin/true"), nullptr);
+	ASSERT_TRUE(Cached(2000, 2000, "/bin/true", &rule));
+	ASSERT_EQ(rule, nullptr);
+}
+
+TEST_F(RuleMatchCacheTest, IgnoreRuleIsNotCached)
+{
+	struct cgroup_rule *rule = NULL;
+
+	/* Whether it matches depends on the cgroups of the process */
+	rules[0].is_ignore = true;
+	strncpy(rules[0].destination, "/", sizeof(rules[0].destination) - 1);
+
+	cgroup_find_matching_rule(&lst, 1000, 100, getpid(), "/bin/bash");
+	ASSERT_FALSE(Cached(1000, 100, "/bin/bash", &rule));
+
+	/* An ignore rule of another user does not matter */
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1001, 100, getpid(), "/usr/bin/python3"),
+		  &rules[3]);
+	ASSERT_TRUE(Cached(1001, 100, "/usr/bin/python3", &rule));
+}
+
+TEST_F(RuleMatchCacheTest, GroupResultNeedsTheGroupCache)
+{
+	struct cgroup_rule *rule = &rules[0];
+
+	/* Without the group cache the members are looked up every time */
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 100, 0, "make"), nullptr);
+	ASSERT_FALSE(Cached(1000, 100, "make", &rule));
+
+	cgroup_set_group_cache_ttl(60);
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 100, 0, "make"), nullptr);
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 1000, 100, 0, "make"), nullptr);
+	ASSERT_TRUE(Cached(1000, 100, "make", &rule));
+	ASSERT_EQ(rule, nullptr);
+
+	/* The result goes with the group members it was computed from */
+	cgroup_rule_index_invalidate_groups(lst.index);
+	ASSERT_FALSE(Cached(1000, 100, "make", &rule));
+}
+
+TEST_F(RuleMatchCacheTest, GroupIdIsNotAGroupLookup)
+{
+	struct cgroup_rule *rule = NULL;
+
+	/* The GID of the rule matches directly, no member is looked up */
+	ASSERT_EQ(cgroup_find_matching_rule(&lst, 2000, 500, 0, "make"), &rules[2]);
+	ASSERT_TRUE(Cached(2000, 500, "make", &rule));
+	ASSERT_EQ(rule, &rules[2]);
+}
+
+TEST_F(RuleMatchCacheTest, Bounded)
+{
+	struct cgroup_rule *rule;
+	char name[32];
+	int i, hits = 0;
+
+	for (i = 0; i < 4096; i++) {
+		snprintf(name, sizeof(name), "/bin/tool%d", i);
+		ASSERT_EQ(cgroup_find_matching_rule(&lst, 1002, 100, 0, name), &rules[4]);
+	}
+
+	for (i = 0; i < 4096; i++) {
+		snprintf(name, sizeof(name), "/bin/tool%d", i);
+		if (Cached(1002, 100, name, &rule)) {
+			ASSERT_EQ(rule, &rules[4]);
+			hits++;
+		}
+	}
+	ASSERT_GT(hits, 0);
+	ASSERT_LT(hits, 4096);
+
+	cgroup_rule_index_match_flush(lst.index);
+	ASSERT_FALSE(Cached(1002, 100, "/bin/tool4095", &rule));
+}
@@ -0,0 +1,107 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the glob and regular expression process names
+ */
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class ProcnamePatternTest : public ::testing::Test {
+	protected:
+
+	struct cg_procname_pattern pattern = { };
+
+	void TearDown() override
+	{
+		cg_procname_free(&pattern);
+	}
+
+	bool Match(const char * const rule_procname, const char * const procname,
+		   const char * const base)
+	{
+		cg_procname_free(&pattern);
+		EXPECT_EQ(cg_procname_compile(&pattern, rule_procname), 0);
+
+		return cg_procname_match(&pattern, rule_procname, procname, base);
+	}
+};
+
+TEST_F(ProcnamePatternTest, LegacyNames)
+{
+	ASSERT_TRUE(Match("bash", "/bin/bash", "bash"));
+	ASSERT_EQ(pattern.type, CG_PROCNAME_LEGACY);
+	ASSERT_TRUE(Match("/bin/bash", "/bin/bash", "bash"));
+	ASSERT_FALSE(Match("bash", "/bin/bash", NULL));
+
+	/* A trailing asterisk is still a prefix of the whole name */
+	ASSERT_TRUE(Match("/usr/bin/python*", "/usr/bin/python3", "python3"));
+	ASSERT_EQ(pattern.type, CG_PROCNAME_LEGACY);
+	ASSERT_FALSE(Match("python*", "/usr/bin/python3", "python3"));
+}
+
+TEST_F(ProcnamePatternTest, Glob)
+{
+	ASSERT_TRUE(Match("/opt/*/bin/worker", "/opt/app/bin/worker", "worker"));
+	ASSERT_EQ(pattern.type, CG_PROCNAME_GLOB);
+	ASSERT_EQ(pattern.prefix_start, 0);
+	ASSERT_EQ(pattern.prefix_len, 5);
+
+	/* An asterisk does not cross a slash */
+	ASSERT_FALSE(Match("/opt/*/bin/worker", "/opt/app/v2/bin/worker", "worker"));
+	ASSERT_FALSE(Match("/opt/*/bin/worker", "/opt/app/bin/worker2", "worker2"));
+}
+
+TEST_F(ProcnamePatternTest, GlobBasename)
+{
+	ASSERT_TRUE(Match("python3.[0-9]*", "/usr/bin/python3.11", "python3.11"));
+	ASSERT_EQ(pattern.prefix_len, 8);
+	ASSERT_FALSE(Match("python3.[0-9]*", "/usr/bin/python3-config", "python3-config"));
+	ASSERT_TRUE(Match("*sh", "/bin/bash", "bash"));
+	ASSERT_EQ(pattern.prefix_len, 0);
+	ASSERT_TRUE(Match("ba?h", "/bin/bash", "bash"));
+}
+
+TEST_F(ProcnamePatternTest, GlobEscape)
+{
+	ASSERT_TRUE(Match("/opt/a\\*b", "/opt/a*b", "a*b"));
+	ASSERT_EQ(pattern.type, CG_PROCNAME_GLOB);
+	ASSERT_EQ(pattern.prefix_len, 6);
+	ASSERT_FALSE(Match("/opt/a\\*b", "/opt/axb", "axb"));
+
+	/* An escaped trailing asterisk is not a prefix */
+	ASSERT_TRUE(Match("/opt/run\\?\\*", "/opt/run?*", "run?*"));
+	ASSERT_EQ(pattern.prefix_len, 8);
+	ASSERT_FALSE(Match("/opt/run\\?\\*", "/opt/run?x", "run?x"));
+	ASSERT_FALSE(Match("/opt/a\\*", "/opt/a*b", "a*b"));
+}
+
+TEST_F(ProcnamePatternTest, Regex)
+{
+	ASSERT_TRUE(Match("~^/usr/bin/python3\\.[0-9]+$", "/usr/bin/python3.11", "python3.11"));
+	ASSERT_EQ(pattern.type, CG_PROCNAME_REGEX);
+	ASSERT_EQ(pattern.prefix_start, 2);
+	ASSERT_EQ(pattern.prefix_len, 16);
+	ASSERT_FALSE(Match("~^/usr/bin/python3\\.[0-9]+$", "/usr/bin/python3.x", "python3.x"));
+
+	/* Not anchored, the expression is searched in the whole name */
+	ASSERT_TRUE(Match("~(^|/)java$", "/usr/lib/jvm/bin/java", "java"));
+	ASSERT_EQ(pattern.prefix_len, 0);
+	ASSERT_FALSE(Match("~(^|/)java$", "/usr/bin/javac", "javac"));
+}
+
+TEST_F(ProcnamePatternTest, RegexPrefix)
+{
+	ASSERT_TRUE(Match("~^/opt/ab*c", "/opt/ac", "ac"));
+	/* The quantified b is not part of the prefix */
+	ASSERT_EQ(pattern.prefix_len, 6);
+
+	ASSERT_TRUE(Match("~^/opt|^/srv", "/srv/x", "x"));
+	ASSERT_EQ(pattern.prefix_len, 0);
+}
+
+TEST_F(ProcnamePatternTest, InvalidRegex)
+{
+	ASSERT_EQ(cg_procname_compile(&pattern, "~^/opt/(worker"), ECGINVAL);
+	ASSERT_EQ(pattern.regex, nullptr);
+}
@@ -0,0 +1,113 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for cgroup_attach_tasks()
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test045attach";
+
+class AttachTasksTest : public ::testing::TestWithParam<enum cg_version_t> {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+	struct cgroup *cg = NULL;
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = GetParam();
+		opts.depth = 1;
+		opts.fanout = 2;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+
+		cg = cgroup_new_cgroup("cg1");
+		ASSERT_NE(cg, nullptr);
+		ASSERT_NE(cgroup_add_controller(cg, "cpu"), nullptr);
+		ASSERT_NE(cgroup_add_controller(cg, "memory"), nullptr);
+	}
+
+	void TearDown() override
+	{
+		cgroup_free(&cg);
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	std::string ReadProcs(const char * const controller)
+	{
+		std::stringstream content;
+		std::string path;
+
+		path = std::string(fixture.root) + "/";
+		if (fixture.version == CGROUP_V1)
+			path += std::string(controller) + "/cg1/tasks";
+		else
+			path += "cg1/cgroup.procs";
+
+		std::ifstream file(path);
+		content << file.rdbuf();
+
+		return content.str();
+	}
+};
+
+TEST_P(AttachTasksTest, OneWritePerTask)
+{
+	const pid_t pids[] = { 101, 202, 303 };
+	int errors[3] = { -1, -1, -1 };
+
+	ASSERT_EQ(cgroup_attach_tasks(cg, pids, 3, 0, errors), 0);
+	ASSERT_EQ(errors[0], 0);
+	ASSERT_EQ(errors[1], 0);
+	ASSERT_EQ(errors[2], 0);
+
+	/* A cgroup v2 group has a single cgroup.procs, written once */
+	ASSERT_EQ(ReadProcs("cpu"), "101202303");
+	ASSERT_EQ(ReadProcs("memory"), "101202303");
+}
+
+TEST_P(AttachTasksTest, NoTasks)
+{
+	ASSERT_EQ(cgroup_attach_tasks(cg, NULL, 0, 0, NULL), 0);
+	ASSERT_EQ(ReadProcs("cpu"), "");
+}
+
+TEST_P(AttachTasksTest, InvalidArguments)
+{
+	int errors[2] = { -1, -1 };
+
+	ASSERT_EQ(cgroup_attach_tasks(cg, NULL, 2, 0, NULL), ECGINVAL);
+	ASSERT_EQ(cgroup_attach_tasks(cg, NULL, 2, 0, errors), ECGINVAL);
+	ASSERT_EQ(errors[0], ECGINVAL);
+	ASSERT_EQ(errors[1], ECGINVAL);
+}
+
+TEST_P(AttachTasksTest, MissingGroup)
+{
+	const pid_t pids[] = { 101, 202 };
+	int errors[2] = { };
+	struct cgroup *missing;
+
+	missing = cgroup_new_cgroup("cg9");
+	ASSERT_NE(missing, nullptr);
+	ASSERT_NE(cgroup_add_controller(missing, "cpu"), nullptr);
+
+	ASSERT_NE(cgroup_attach_tasks(missing, pids, 2, 0, errors), 0);
+	ASSERT_NE(errors[0], 0);
+	ASSERT_NE(errors[1], 0);
+
+	cgroup_free(&missing);
+}
+
+INSTANTIATE_TEST_SUITE_P(CgroupAttachTasksTest, AttachTasksTest,
+			 ::testing::Values(CGROUP_V1, CGROUP_V2));
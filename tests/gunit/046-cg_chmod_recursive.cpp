@@ -0,0 +1,124 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the recursive permission changes of the groups
+ */
+
+#include <string>
+
+#include <sys/stat.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test046chmod";
+
+class ChmodRecursiveTest : public ::testing::TestWithParam<enum cg_version_t> {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+	struct cgroup *cg = NULL;
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = GetParam();
+		opts.depth = 2;
+		opts.fanout = 2;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+
+		cg = cgroup_new_cgroup("cg1");
+		ASSERT_NE(cg, nullptr);
+		ASSERT_NE(cgroup_add_controller(cg, "cpu"), nullptr);
+		ASSERT_NE(cgroup_add_controller(cg, "memory"), nullptr);
+	}
+
+	void TearDown() override
+	{
+		cgroup_free(&cg);
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	std::string Path(const char * const controller, const char * const file)
+	{
+		std::string path = std::string(fixture.root) + "/";
+
+		if (fixture.version == CGROUP_V1)
+			path += std::string(controller) + "/";
+
+		return path + "cg1" + file;
+	}
+
+	struct stat Stat(const std::string &path)
+	{
+		struct stat st = { };
+
+		EXPECT_EQ(stat(path.c_str(), &st), 0) << path;
+
+		return st;
+	}
+};
+
+TEST_P(ChmodRecursiveTest, Modes)
+{
+	const char *file = GetParam() == CGROUP_V1 ? "/cpu.shares" : "/cpu.weight";
+
+	ASSERT_EQ(cg_chmod_recursive(cg, 0750, 1, 0640, 1), 0);
+
+	ASSERT_EQ(Stat(Path("cpu", "")).st_mode & 07777, 0750);
+	ASSERT_EQ(Stat(Path("cpu", file)).st_mode & 07777, 0640);
+	/* The children of the group */
+	ASSERT_EQ(Stat(Path("cpu", "/cg0")).st_mode & 07777, 0750);
+	ASSERT_EQ(Stat(Path("cpu", (std::string("/cg1") + file).c_str())).st_mode & 07777, 0640);
+	ASSERT_EQ(Stat(Path("memory", GetParam() == CGROUP_V1 ? "/memory.usage_in_bytes" :
+							      "/memory.current")).st_mode & 07777,
+		  0640);
+}
+
+TEST_P(ChmodRecursiveTest, DirectoriesOnly)
+{
+	const char *file = GetParam() == CGROUP_V1 ? "/cpu.shares" : "/cpu.weight";
+	mode_t mode = Stat(Path("cpu", file)).st_mode & 07777;
+
+	ASSERT_EQ(cg_chmod_recursive(cg, 0700, 1, 0600, 0), 0);
+
+	ASSERT_EQ(Stat(Path("cpu", "/cg0")).st_mode & 07777, 0700);
+	ASSERT_EQ(Stat(Path("cpu", file)).st_mode & 07777, mode);
+}
+
+TEST_P(ChmodRecursiveTest, UnchangedSkipped)
+{
+	const char *file = GetParam() == CGROUP_V1 ? "/cpu.shares" : "/cpu.weight";
+	struct stat before, after;
+
+	ASSERT_EQ(cg_chmod_recursive(cg, 0750, 1, 0640, 1), 0);
+	before = Stat(Path("cpu", file));
+
+	/* A file already right is not changed again, its ctime is kept */
+	ASSERT_EQ(cg_chmod_recursive(cg, 0750, 1, 0640, 1), 0);
+	after = Stat(Path("cpu", file));
+
+	ASSERT_EQ(after.st_ctim.tv_sec, before.st_ctim.tv_sec);
+	ASSERT_EQ(after.st_ctim.tv_nsec, before.st_ctim.tv_nsec);
+}
+
+TEST_P(ChmodRecursiveTest, MissingGroup)
+{
+	struct cgroup *missing;
+
+	missing = cgroup_new_cgroup("missing");
+	ASSERT_NE(missing, nullptr);
+	ASSERT_NE(cgroup_add_controller(missing, "cpu"), nullptr);
+
+	ASSERT_EQ(cg_chmod_recursive(missing, 0750, 1, 0640, 1), ECGOTHER);
+	ASSERT_EQ(cgroup_get_last_errno(), ENOENT);
+
+	cgroup_free(&missing);
+}
+
+INSTANTIATE_TEST_SUITE_P(CgChmodRecursiveTest, ChmodRecursiveTest,
+			 ::testing::Values(CGROUP_V1, CGROUP_V2));
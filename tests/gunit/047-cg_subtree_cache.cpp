@@ -0,0 +1,90 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the cache of the cgroup v2 subtree_control files
+ */
+
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test047subtree";
+
+class SubtreeCacheTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = CGROUP_V2;
+		opts.depth = 1;
+		opts.fanout = 1;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+		cg_subtree_cache_invalidate();
+	}
+
+	void TearDown() override
+	{
+		cg_subtree_cache_invalidate();
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	int Create(const char * const name)
+	{
+		struct cgroup *cg;
+		int ret;
+
+		cg = cgroup_new_cgroup(name);
+		if (!cg)
+			return ECGFAIL;
+
+		if (!cgroup_add_controller(cg, "cpu")) {
+			cgroup_free(&cg);
+			return ECGFAIL;
+		}
+
+		ret = cgroup_create_cgroup(cg, 1);
+		cgroup_free(&cg);
+
+		return ret;
+	}
+
+	std::string SubtreeFile(const char * const dir)
+	{
+		return std::string(fixture.root) + "/" + dir + "/cgroup.subtree_control";
+	}
+};
+
+TEST_F(SubtreeCacheTest, AncestorsEnabledOnce)
+{
+	ASSERT_EQ(Create("cg0/a"), 0);
+
+	/* The parent is known to be enabled, its file is not written again */
+	ASSERT_EQ(unlink(SubtreeFile("cg0").c_str()), 0);
+	ASSERT_EQ(Create("cg0/b"), 0);
+
+	cg_subtree_cache_invalidate();
+	ASSERT_NE(Create("cg0/c"), 0);
+}
+
+TEST_F(SubtreeCacheTest, ControllerEnabledCached)
+{
+	/* A group of the fixture, its parent enables the controllers */
+	ASSERT_EQ(cgroupv2_controller_enabled("cg0", "cpu"), 0);
+
+	ASSERT_EQ(unlink(SubtreeFile(".").c_str()), 0);
+	ASSERT_EQ(cgroupv2_controller_enabled("cg0", "cpu"), 0);
+
+	cg_subtree_cache_invalidate();
+	ASSERT_NE(cgroupv2_controller_enabled("cg0", "cpu"), 0);
+}
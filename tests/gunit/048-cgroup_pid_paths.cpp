@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for cgroup_get_current_controller_paths()
+ */
+
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test048pidpaths";
+
+class PidPathsTest : public ::testing::TestWithParam<enum cg_version_t> {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+	struct cgroup_pid_paths *paths = NULL;
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = GetParam();
+		opts.depth = 2;
+		opts.fanout = 2;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+	}
+
+	void TearDown() override
+	{
+		cgroup_pid_paths_free(&paths);
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	void WriteProcs(const char * const controller, const char * const group,
+			const char * const procs)
+	{
+		std::string path = std::string(fixture.root) + "/";
+
+		if (fixture.version == CGROUP_V1)
+			path += std::string(controller) + "/";
+
+		std::ofstream file(path + group + "/cgroup.procs");
+		file << procs;
+	}
+
+	std::string Name(size_t pid_index, int controller_index)
+	{
+		const char *name;
+
+		name = cgroup_pid_paths_name(paths,
+					     cgroup_pid_paths_id(paths, pid_index, controller_index));
+
+		return name ? name : "(none)";
+	}
+};
+
+TEST_P(PidPathsTest, FromProcs)
+{
+	const char * const controllers[] = { "cpu", "memory", NULL };
+	const pid_t pids[] = { 101, 303, 404, 101, 202 };
+
+	WriteProcs("cpu", "cg0", "101\n202\n");
+	WriteProcs("cpu", "cg1/cg0", "303\n");
+	if (GetParam() == CGROUP_V1)
+		WriteProcs("memory", "cg1", "101\n202\n303\n");
+
+	ASSERT_EQ(cgroup_get_current_controller_paths(pids, 5, controllers,
+						      CGFLAG_PID_PATHS_FROM_PROCS, &paths), 0);
+
+	ASSERT_EQ(Name(0, 0), "/cg0");
+	ASSERT_EQ(Name(1, 0), "/cg1/cg0");
+	ASSERT_EQ(Name(2, 0), "(none)");
+	ASSERT_EQ(Name(3, 0), "/cg0");
+
+	/* The tasks of the same group share its id */
+	ASSERT_EQ(cgroup_pid_paths_id(paths, 0, 0), cgroup_pid_paths_id(paths, 4, 0));
+	ASSERT_EQ(cgroup_pid_paths_id(paths, 3, 0), cgroup_pid_paths_id(paths, 0, 0));
+
+	if (GetParam() == CGROUP_V1) {
+		ASSERT_EQ(Name(0, 1), "/cg1");
+		ASSERT_EQ(Name(1, 1), "/cg1");
+		ASSERT_EQ(cgroup_pid_paths_count(paths), 3);
+	} else {
+		/* A single hierarchy for both controllers */
+		ASSERT_EQ(cgroup_pid_paths_id(paths, 1, 1), cgroup_pid_paths_id(paths, 1, 0));
+		ASSERT_EQ(cgroup_pid_paths_count(paths), 2);
+	}
+}
+
+TEST_P(PidPathsTest, ExitedTasks)
+{
+	const char * const controllers[] = { "cpu", NULL };
+	const pid_t pids[] = { 0x7ffffff0, 0x7ffffff1 };
+
+	ASSERT_EQ(cgroup_get_current_controller_paths(pids, 2, controllers, 0, &paths), 0);
+
+	ASSERT_EQ(cgroup_pid_paths_id(paths, 0, 0), CGROUP_PATH_ID_NONE);
+	ASSERT_EQ(cgroup_pid_paths_id(paths, 1, 0), CGROUP_PATH_ID_NONE);
+	ASSERT_EQ(cgroup_pid_paths_count(paths), 0);
+
+	/* Out of range */
+	ASSERT_EQ(cgroup_pid_paths_id(paths, 2, 0), CGROUP_PATH_ID_NONE);
+	ASSERT_EQ(cgroup_pid_paths_id(paths, 0, 1), CGROUP_PATH_ID_NONE);
+	ASSERT_EQ(cgroup_pid_paths_name(paths, 0), nullptr);
+}
+
+TEST_P(PidPathsTest, NotMounted)
+{
+	const char * const controllers[] = { "cpu", "blkio", NULL };
+	const pid_t pids[] = { 101 };
+
+	ASSERT_EQ(cgroup_get_current_controller_paths(pids, 1, controllers, 0, &paths),
+		  ECGROUPSUBSYSNOTMOUNTED);
+	ASSERT_EQ(paths, nullptr);
+
+	ASSERT_EQ(cgroup_get_current_controller_paths(NULL, 1, controllers, 0, &paths),
+		  ECGINVAL);
+}
+
+INSTANTIATE_TEST_SUITE_P(CgroupPidPathsTest, PidPathsTest,
+			 ::testing::Values(CGROUP_V1, CGROUP_V2));
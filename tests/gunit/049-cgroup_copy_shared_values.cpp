@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the values shared by the copies of a cgroup
+ */
+
+#include <stdio.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+#define COPIES	4
+
+class SharedValuesTest : public ::testing::Test {
+	protected:
+
+	struct cgroup *cgroup = NULL;
+	struct cgroup_controller *cgc = NULL;
+	struct cgroup *copies[COPIES] = { };
+
+	void SetUp() override
+	{
+		char name[FILENAME_MAX];
+		int i;
+
+		cgroup = cgroup_new_cgroup("shared");
+		ASSERT_NE(cgroup, nullptr);
+
+		/* The "cgroup" controller does not need a mounted hierarchy */
+		cgc = cgroup_add_controller(cgroup, CGROUP_FILE_PREFIX);
+		ASSERT_NE(cgc, nullptr);
+
+		for (i = 0; i < 3; i++) {
+			snprintf(name, sizeof(name), "cgroup.setting%d", i);
+			ASSERT_EQ(cgroup_add_value_int64(cgc, name, i), 0);
+		}
+
+		for (i = 0; i < COPIES; i++) {
+			copies[i] = cgroup_new_cgroup("shared");
+			ASSERT_NE(copies[i], nullptr);
+			ASSERT_EQ(cgroup_copy_cgroup(copies[i], cgroup), 0);
+		}
+	}
+
+	void TearDown() override
+	{
+		int i;
+
+		for (i = 0; i < COPIES; i++)
+			cgroup_free(&copies[i]);
+		cgroup_free(&cgroup);
+	}
+
+	struct cgroup_controller *Copy(int i)
+	{
+		return copies[i]->controller[0];
+	}
+};
+
+TEST_F(SharedValuesTest, CopiesShareValues)
+{
+	int i;
+
+	for (i = 0; i < COPIES; i++) {
+		ASSERT_EQ(Copy(i)->values, cgc->values);
+		ASSERT_EQ(cgroup_compare_cgroup(copies[i], cgroup), 0);
+	}
+}
+
+TEST_F(SharedValuesTest, WriteTakesCopy)
+{
+	int64_t value;
+
+	ASSERT_EQ(cgroup_set_value_int64(Copy(1), "cgroup.setting1", 42), 0);
+	ASSERT_NE(Copy(1)->values, cgc->values);
+	ASSERT_EQ(Copy(1)->shared, nullptr);
+
+	ASSERT_EQ(cgroup_get_value_int64(Copy(1), "cgroup.setting1", &value), 0);
+	ASSERT_EQ(value, 42);
+	ASSERT_EQ(cgroup_get_value_int64(Copy(1), "cgroup.setting2", &value), 0);
+	ASSERT_EQ(value, 2);
+
+	ASSERT_EQ(cgroup_get_value_int64(cgc, "cgroup.setting1", &value), 0);
+	ASSERT_EQ(value, 1);
+	ASSERT_EQ(cgroup_get_value_int64(Copy(2), "cgroup.setting1", &value), 0);
+	ASSERT_EQ(value, 1);
+	ASSERT_EQ(Copy(2)->values, cgc->values);
+}
+
+TEST_F(SharedValuesTest, AddAndRemoveTakeCopy)
+{
+	ASSERT_EQ(cgroup_add_value_int64(Copy(0), "cgroup.setting3", 3), 0);
+	ASSERT_EQ(cgroup_get_value_name_count(Copy(0)), 4);
+
+	ASSERT_EQ(cgroup_remove_value(Copy(3), "cgroup.setting0"), 0);
+	ASSERT_EQ(cgroup_get_value_name_count(Copy(3)), 2);
+
+	ASSERT_EQ(cgroup_get_value_name_count(cgc), 3);
+	ASSERT_EQ(cgroup_get_value_name_count(Copy(1)), 3);
+	ASSERT_STREQ(cgroup_get_value_name(Copy(1), 0), "cgroup.setting0");
+}
+
+TEST_F(SharedValuesTest, DirtyFlagsPerCopy)
+{
+	int i;
+
+	/* The values of a copy are all written, those of the source are unchanged */
+	cg_cv_set_dirty(cgc, 0, false);
+	for (i = 0; i < 3; i++)
+		ASSERT_TRUE(cg_cv_is_dirty(Copy(0), i));
+	ASSERT_FALSE(cg_cv_is_dirty(cgc, 0));
+	ASSERT_TRUE(cg_cv_is_dirty(cgc, 1));
+
+	cg_cv_set_dirty(Copy(0), 2, false);
+	ASSERT_FALSE(cg_cv_is_dirty(Copy(0), 2));
+	ASSERT_TRUE(cg_cv_is_dirty(Copy(1), 2));
+
+	/* The flags are kept by the private copy */
+	ASSERT_EQ(cg_own_values(Copy(0)), 0);
+	ASSERT_FALSE(Copy(0)->values[2]->dirty);
+	ASSERT_TRUE(Copy(0)->values[1]->dirty);
+	ASSERT_EQ(cg_own_values(cgc), 0);
+	ASSERT_FALSE(cgc->values[0]->dirty);
+}
+
+TEST_F(SharedValuesTest, LastReferenceTakesValues)
+{
+	struct control_value **values = cgc->values;
+	int i;
+
+	cgroup_free(&cgroup);
+	for (i = 0; i < COPIES - 1; i++)
+		cgroup_free(&copies[i]);
+
+	ASSERT_EQ(Copy(COPIES - 1)->values, values);
+	ASSERT_EQ(cgroup_set_value_string(Copy(COPIES - 1), "cgroup.setting0", "7"), 0);
+	ASSERT_EQ(Copy(COPIES - 1)->values, values);
+	ASSERT_EQ(Copy(COPIES - 1)->shared, nullptr);
+}
+
+TEST_F(SharedValuesTest, ArenaCopyNotShared)
+{
+	struct cgroup_arena *arena;
+	struct cgroup *copy;
+
+	arena = cgroup_arena_new();
+	ASSERT_NE(arena, nullptr);
+
+	copy = cgroup_new_cgroup_arena("shared", arena);
+	ASSERT_NE(copy, nullptr);
+	ASSERT_EQ(cgroup_copy_cgroup(copy, cgroup), 0);
+	ASSERT_NE(copy->controller[0]->values, cgc->values);
+	ASSERT_EQ(cgroup_compare_cgroup(copy, cgroup), 0);
+
+	cgroup_free(&copy);
+	cgroup_arena_free(&arena);
+}
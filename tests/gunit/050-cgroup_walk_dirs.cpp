@@ -0,0 +1,127 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the getdents64() walk of cgroup_walk_tree_next()
+ */
+
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test050cgroup";
+
+class WalkDirsTest : public ::testing::TestWithParam<enum cg_version_t> {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = GetParam();
+		opts.depth = 3;
+		opts.fanout = 2;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+	}
+
+	void TearDown() override
+	{
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	/* The directories returned by a walk with flags, 0 for the default */
+	std::vector<std::string> Walk(int flags, int depth)
+	{
+		std::vector<std::string> dirs;
+		struct cgroup_file_info info;
+		int base_level, ret;
+		void *handle;
+
+		ret = cgroup_walk_tree_begin("memory", "/", depth, &handle, &info, &base_level);
+		EXPECT_EQ(ret, 0);
+		if (flags)
+			EXPECT_EQ(cgroup_walk_tree_set_flags(&handle, flags), 0);
+
+		/* In post-order the root is returned again at the end */
+		if (!(flags & CGROUP_WALK_TYPE_POST_DIR))
+			dirs.push_back(std::string(info.full_path) + ":" + std::to_string(info.depth));
+
+		while ((ret = cgroup_walk_tree_next(depth, &handle, &info, base_level)) == 0) {
+			if (info.type == CGROUP_FILE_TYPE_DIR)
+				dirs.push_back(std::string(info.full_path) + ":" +
+					       std::to_string(info.depth));
+		}
+		EXPECT_EQ(ret, ECGEOF);
+		EXPECT_EQ(cgroup_walk_tree_end(&handle), 0);
+
+		return dirs;
+	}
+};
+
+TEST_P(WalkDirsTest, SameAsFts)
+{
+	std::vector<std::string> fts, dirs;
+
+	fts = Walk(CGROUP_WALK_TYPE_PRE_DIR, 0);
+	dirs = Walk(CGROUP_WALK_TYPE_PRE_DIR | CGROUP_WALK_TYPE_DIRS_ONLY, 0);
+	ASSERT_EQ(fts.size(), fixture.groups + 1);
+
+	/* The order of the siblings is the order of the directory in both */
+	ASSERT_EQ(dirs, fts);
+
+	fts = Walk(CGROUP_WALK_TYPE_POST_DIR, 0);
+	dirs = Walk(CGROUP_WALK_TYPE_POST_DIR | CGROUP_WALK_TYPE_DIRS_ONLY, 0);
+	ASSERT_EQ(fts.size(), fixture.groups + 1);
+	ASSERT_EQ(dirs, fts);
+}
+
+TEST_P(WalkDirsTest, Depth)
+{
+	std::vector<std::string> dirs;
+
+	dirs = Walk(CGROUP_WALK_TYPE_DIRS_ONLY, 2);
+	/* The root, its 2 children and their 4 children */
+	ASSERT_EQ(dirs.size(), 7);
+	ASSERT_EQ(dirs, Walk(CGROUP_WALK_TYPE_PRE_DIR, 2));
+}
+
+TEST_P(WalkDirsTest, DirFd)
+{
+	struct cgroup_file_info info;
+	int base_level, dirfd, fd;
+	void *handle;
+
+	ASSERT_EQ(cgroup_walk_tree_begin("memory", "/", 0, &handle, &info, &base_level), 0);
+	ASSERT_EQ(cgroup_walk_tree_get_dirfd(&handle, &dirfd), ECGINVAL);
+	ASSERT_EQ(cgroup_walk_tree_set_flags(&handle, CGROUP_WALK_TYPE_DIRS_ONLY), 0);
+
+	ASSERT_EQ(cgroup_walk_tree_next(0, &handle, &info, base_level), 0);
+	ASSERT_EQ(info.depth, 1);
+	ASSERT_STREQ(info.path, "cg0");
+	ASSERT_EQ(cgroup_walk_tree_get_dirfd(&handle, &dirfd), 0);
+
+	fd = openat(dirfd, "cgroup.procs", O_RDONLY);
+	ASSERT_GE(fd, 0);
+	close(fd);
+
+	ASSERT_EQ(cgroup_walk_tree_next(0, &handle, &info, base_level), 0);
+	ASSERT_STREQ(info.path, "cg0");
+	ASSERT_STREQ(info.parent, "cg0");
+	ASSERT_EQ(info.depth, 2);
+
+	/* The backend cannot change once the walk started */
+	ASSERT_EQ(cgroup_walk_tree_set_flags(&handle, CGROUP_WALK_TYPE_PRE_DIR), ECGINVAL);
+	ASSERT_EQ(cgroup_walk_tree_end(&handle), 0);
+}
+
+INSTANTIATE_TEST_SUITE_P(CgroupWalkDirsTest, WalkDirsTest,
+			 ::testing::Values(CGROUP_V1, CGROUP_V2));
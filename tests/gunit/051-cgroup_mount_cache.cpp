@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the mount table published by cgrulesengd
+ */
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdlib.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+/* A process publishes a single file, all the tests share it */
+static const char * const CACHE_FILE = "test051mounts/mounts.bin";
+static const char * const COPY_FILE = "test051mounts/copy.bin";
+
+class MountCacheTest : public ::testing::Test {
+	protected:
+
+	void Clear(void)
+	{
+		struct cg_mount_point *mount, *next;
+		int i;
+
+		for (i = 0; cg_mount_table[i].name[0] != '\0'; i++) {
+			for (mount = cg_mount_table[i].mount.next; mount; mount = next) {
+				next = mount->next;
+				free(mount);
+			}
+		}
+		for (mount = cg_cgroup_v2_empty_mount_paths; mount; mount = next) {
+			next = mount->next;
+			free(mount);
+		}
+
+		memset(&cg_mount_table, 0, sizeof(cg_mount_table));
+		memset(&cg_cgroup_v2_mount_path, 0, sizeof(cg_cgroup_v2_mount_path));
+		cg_cgroup_v2_empty_mount_paths = NULL;
+	}
+
+	void Append(const char * const name, const char * const path, enum cg_version_t version)
+	{
+		int i;
+
+		for (i = 0; cg_mount_table[i].name[0] != '\0'; i++)
+			;
+
+		strcpy(cg_mount_table[i].name, name);
+		strcpy(cg_mount_table[i].mount.path, path);
+		cg_mount_table[i].version = version;
+	}
+
+	void SetUp() override
+	{
+		struct cg_mount_point *empty;
+
+		Clear();
+
+		Append("cpu", "/sys/fs/cgroup/cpu,cpuacct", CGROUP_V1);
+		cg_mount_table[0].shared_mnt = 1;
+		Append("cpuacct", "/sys/fs/cgroup/cpu,cpuacct", CGROUP_V1);
+		cg_mount_table[1].shared_mnt = 1;
+		ASSERT_EQ(cg_add_duplicate_mount(&cg_mount_table[1], "/mnt/cpuacct"), 0);
+		Append("memory", "/sys/fs/cgroup/unified", CGROUP_V2);
+		Append("cgroup", "/sys/fs/cgroup/unified", CGROUP_V2);
+		strcpy(cg_cgroup_v2_mount_path, "/sys/fs/cgroup/unified");
+
+		empty = (struct cg_mount_point *)calloc(1, sizeof(*empty));
+		ASSERT_NE(empty, nullptr);
+		strcpy(empty->path, "/mnt/empty");
+		cg_cgroup_v2_empty_mount_paths = empty;
+	}
+
+	void TearDown() override
+	{
+		Clear();
+		cg_mount_index_build();
+	}
+};
+
+TEST_F(MountCacheTest, PublishAndLoad)
+{
+	ASSERT_EQ(cg_mount_cache_publish(CACHE_FILE, true), 0);
+	Clear();
+
+	ASSERT_EQ(cg_mount_cache_load(CACHE_FILE), 0);
+
+	ASSERT_STREQ(cg_mount_table[0].name, "cpu");
+	ASSERT_EQ(cg_mount_table[0].shared_mnt, 1);
+	ASSERT_EQ(cg_mount_table[0].mount.next, nullptr);
+
+	ASSERT_STREQ(cg_mount_table[1].name, "cpuacct");
+	ASSERT_STREQ(cg_mount_table[1].mount.path, "/sys/fs/cgroup/cpu,cpuacct");
+	ASSERT_NE(cg_mount_table[1].mount.next, nullptr);
+	ASSERT_STREQ(cg_mount_table[1].mount.next->path, "/mnt/cpuacct");
+	ASSERT_EQ(cg_mount_table[1].mount.next->next, nullptr);
+
+	ASSERT_STREQ(cg_mount_table[3].name, "cgroup");
+	ASSERT_EQ(cg_mount_table[3].version, CGROUP_V2);
+	ASSERT_EQ(cg_mount_table[4].name[0], '\0');
+
+	ASSERT_STREQ(cg_cgroup_v2_mount_path, "/sys/fs/cgroup/unified");
+	ASSERT_NE(cg_cgroup_v2_empty_mount_paths, nullptr);
+	ASSERT_STREQ(cg_cgroup_v2_empty_mount_paths->path, "/mnt/empty");
+	ASSERT_EQ(cg_cgroup_v2_empty_mount_paths->next, nullptr);
+}
+
+TEST_F(MountCacheTest, Republish)
+{
+	ASSERT_EQ(cg_mount_cache_publish(CACHE_FILE, true), 0);
+
+	/* The table is rewritten in place */
+	cg_mount_table[2].name[0] = '\0';
+	cg_mount_table[3].name[0] = '\0';
+	ASSERT_EQ(cg_mount_cache_publish(CACHE_FILE, true), 0);
+	Clear();
+
+	ASSERT_EQ(cg_mount_cache_load(CACHE_FILE), 0);
+	ASSERT_STREQ(cg_mount_table[1].name, "cpuacct");
+	ASSERT_EQ(cg_mount_table[2].name[0], '\0');
+}
+
+TEST_F(MountCacheTest, Withdrawn)
+{
+	ASSERT_EQ(cg_mount_cache_publish(CACHE_FILE, false), 0);
+	Clear();
+
+	ASSERT_EQ(cg_mount_cache_load(CACHE_FILE), ECGOTHER);
+	ASSERT_EQ(cg_mount_table[0].name[0], '\0');
+}
+
+TEST_F(MountCacheTest, OtherProcess)
+{
+	int status;
+	pid_t pid;
+
+	ASSERT_EQ(cg_mount_cache_publish(CACHE_FILE, true), 0);
+
+	/* The lock of the publisher is seen by the other processes */
+	pid = fork();
+	ASSERT_GE(pid, 0);
+	if (pid == 0) {
+		Clear();
+		_exit(cg_mount_cache_load(CACHE_FILE) == 0 &&
+		      strcmp(cg_mount_table[1].name, "cpuacct") == 0 ? 0 : 1);
+	}
+
+	ASSERT_EQ(waitpid(pid, &status, 0), pid);
+	ASSERT_TRUE(WIFEXITED(status));
+	ASSERT_EQ(WEXITSTATUS(status), 0);
+}
+
+TEST_F(MountCacheTest, NoPublisher)
+{
+	char cmd[FILENAME_MAX];
+
+	ASSERT_EQ(cg_mount_cache_publish(CACHE_FILE, true), 0);
+
+	/* A copy of the file is not locked by anyone, it may be stale */
+	snprintf(cmd, sizeof(cmd), "cp %s %s", CACHE_FILE, COPY_FILE);
+	ASSERT_EQ(system(cmd), 0);
+	ASSERT_EQ(cg_mount_cache_load(COPY_FILE), ECGOTHER);
+
+	/* Nor is a file the other users could write */
+	ASSERT_EQ(chmod(CACHE_FILE, 0664), 0);
+	ASSERT_EQ(cg_mount_cache_load(CACHE_FILE), ECGOTHER);
+	ASSERT_EQ(chmod(CACHE_FILE, 0644), 0);
+
+	unlink(COPY_FILE);
+}
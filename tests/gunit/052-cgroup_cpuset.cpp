@@ -0,0 +1,123 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the sets of CPUs and memory nodes
+ */
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+
+class CpusetTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_cpuset *a = NULL;
+	struct cgroup_cpuset *b = NULL;
+	char buf[256];
+
+	void SetUp() override
+	{
+		a = cgroup_cpuset_new();
+		ASSERT_NE(a, nullptr);
+		b = cgroup_cpuset_new();
+		ASSERT_NE(b, nullptr);
+	}
+
+	void TearDown() override
+	{
+		cgroup_cpuset_free(&a);
+		cgroup_cpuset_free(&b);
+		ASSERT_EQ(a, nullptr);
+	}
+};
+
+TEST_F(CpusetTest, ParseFormat)
+{
+	ASSERT_EQ(cgroup_cpuset_parse(a, "0-63,128-191,200\n"), 0);
+	ASSERT_EQ(cgroup_cpuset_count(a), 129);
+	ASSERT_TRUE(cgroup_cpuset_isset(a, 63));
+	ASSERT_FALSE(cgroup_cpuset_isset(a, 64));
+	ASSERT_TRUE(cgroup_cpuset_isset(a, 200));
+	ASSERT_FALSE(cgroup_cpuset_isset(a, 100000));
+
+	ASSERT_EQ(cgroup_cpuset_format(a, buf, sizeof(buf)), 0);
+	ASSERT_STREQ(buf, "0-63,128-191,200");
+
+	/* Overlapping and adjacent ranges are merged */
+	ASSERT_EQ(cgroup_cpuset_parse(a, "5,1-3,4,2-2"), 0);
+	ASSERT_EQ(cgroup_cpuset_format(a, buf, sizeof(buf)), 0);
+	ASSERT_STREQ(buf, "1-5");
+
+	ASSERT_EQ(cgroup_cpuset_parse(a, "\n"), 0);
+	ASSERT_EQ(cgroup_cpuset_count(a), 0);
+	ASSERT_EQ(cgroup_cpuset_format(a, buf, sizeof(buf)), 0);
+	ASSERT_STREQ(buf, "");
+
+	ASSERT_EQ(cgroup_cpuset_parse(a, "0-3"), 0);
+	ASSERT_EQ(cgroup_cpuset_format(a, buf, 3), ECGINVAL);
+}
+
+TEST_F(CpusetTest, ParseInvalid)
+{
+	ASSERT_EQ(cgroup_cpuset_parse(a, "3-1"), ECGINVAL);
+	ASSERT_EQ(cgroup_cpuset_parse(a, "1,,2"), ECGINVAL);
+	ASSERT_EQ(cgroup_cpuset_parse(a, "1-"), ECGINVAL);
+	ASSERT_EQ(cgroup_cpuset_parse(a, "a"), ECGINVAL);
+	ASSERT_EQ(cgroup_cpuset_parse(a, "0-99999999999"), ECGINVAL);
+}
+
+TEST_F(CpusetTest, Operations)
+{
+	struct cgroup_cpuset *c = cgroup_cpuset_new();
+
+	ASSERT_EQ(cgroup_cpuset_parse(a, "0-7,300"), 0);
+	ASSERT_EQ(cgroup_cpuset_parse(b, "4-11"), 0);
+	ASSERT_TRUE(cgroup_cpuset_intersects(a, b));
+
+	ASSERT_EQ(cgroup_cpuset_and(c, a, b), 0);
+	ASSERT_EQ(cgroup_cpuset_format(c, buf, sizeof(buf)), 0);
+	ASSERT_STREQ(buf, "4-7");
+
+	ASSERT_EQ(cgroup_cpuset_or(c, b, a), 0);
+	ASSERT_EQ(cgroup_cpuset_format(c, buf, sizeof(buf)), 0);
+	ASSERT_STREQ(buf, "0-11,300");
+
+	/* In place, on a set shorter than the result */
+	ASSERT_EQ(cgroup_cpuset_or(b, b, a), 0);
+	ASSERT_TRUE(cgroup_cpuset_equal(b, c));
+	ASSERT_EQ(cgroup_cpuset_and(b, b, a), 0);
+	ASSERT_TRUE(cgroup_cpuset_equal(b, a));
+
+	ASSERT_EQ(cgroup_cpuset_parse(b, "8-299"), 0);
+	ASSERT_FALSE(cgroup_cpuset_intersects(a, b));
+	ASSERT_FALSE(cgroup_cpuset_equal(a, b));
+
+	/* Equal sets of different capacities */
+	ASSERT_EQ(cgroup_cpuset_parse(b, "0-1000"), 0);
+	ASSERT_EQ(cgroup_cpuset_parse(b, "3"), 0);
+	cgroup_cpuset_zero(c);
+	ASSERT_EQ(cgroup_cpuset_set(c, 3), 0);
+	ASSERT_TRUE(cgroup_cpuset_equal(b, c));
+
+	cgroup_cpuset_free(&c);
+}
+
+TEST_F(CpusetTest, ControllerValue)
+{
+	struct cgroup_controller *cgc;
+	struct cgroup *cgroup;
+
+	cgroup = cgroup_new_cgroup("test052");
+	ASSERT_NE(cgroup, nullptr);
+	/* The "cgroup" controller does not need a mounted hierarchy */
+	cgc = cgroup_add_controller(cgroup, CGROUP_FILE_PREFIX);
+	ASSERT_NE(cgc, nullptr);
+
+	ASSERT_EQ(cgroup_get_value_cpuset(cgc, "cgroup.cpus", a), ECGROUPVALUENOTEXIST);
+
+	ASSERT_EQ(cgroup_cpuset_parse(a, "0-3,8"), 0);
+	ASSERT_EQ(cgroup_set_value_cpuset(cgc, "cgroup.cpus", a), 0);
+	ASSERT_EQ(cgroup_get_value_cpuset(cgc, "cgroup.cpus", b), 0);
+	ASSERT_TRUE(cgroup_cpuset_equal(a, b));
+
+	cgroup_free(&cgroup);
+}
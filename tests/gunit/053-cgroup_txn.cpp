@@ -0,0 +1,157 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the transactions on many groups
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include <sys/stat.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test053txn";
+
+class TxnTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+	struct cgroup *groups[8] = { };
+	int groups_cnt = 0;
+	struct cgroup_txn *txn = NULL;
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = CGROUP_V2;
+		opts.depth = 1;
+		opts.fanout = 2;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+		cg_subtree_cache_invalidate();
+
+		txn = cgroup_txn_begin();
+		ASSERT_NE(txn, nullptr);
+	}
+
+	void TearDown() override
+	{
+		int i;
+
+		cgroup_txn_free(&txn);
+		ASSERT_EQ(txn, nullptr);
+		for (i = 0; i < groups_cnt; i++)
+			cgroup_free(&groups[i]);
+		cg_subtree_cache_invalidate();
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	struct cgroup *Group(const char * const name)
+	{
+		struct cgroup *cg;
+
+		cg = cgroup_new_cgroup(name);
+		if (cg && !cgroup_add_controller(cg, "cpu"))
+			cgroup_free(&cg);
+		if (cg)
+			groups[groups_cnt++] = cg;
+
+		return cg;
+	}
+
+	std::string ReadFile(const std::string &name)
+	{
+		std::stringstream content;
+		std::ifstream file(std::string(fixture.root) + "/" + name);
+
+		content << file.rdbuf();
+
+		return content.str();
+	}
+
+	bool Exists(const std::string &name)
+	{
+		struct stat st;
+
+		return stat((std::string(fixture.root) + "/" + name).c_str(), &st) == 0;
+	}
+};
+
+TEST_F(TxnTest, CreateModifyAttach)
+{
+	struct cgroup *created, *cg1;
+
+	cg1 = Group("cg1");
+	ASSERT_NE(cg1, nullptr);
+	ASSERT_EQ(cgroup_set_value_string(cg1->controller[0], "cpu.weight", "200"), 0);
+	created = Group("cg0/a");
+	ASSERT_NE(created, nullptr);
+
+	/* Run as creations, modifications then moves, whatever the order */
+	ASSERT_EQ(cgroup_txn_add_attach(txn, cg1, 101), 0);
+	ASSERT_EQ(cgroup_txn_add_modify(txn, cg1), 0);
+	ASSERT_EQ(cgroup_txn_add_create(txn, created, 1), 0);
+	ASSERT_EQ(cgroup_txn_add_create(txn, created, 1), 0);
+	ASSERT_EQ(cgroup_txn_add_attach(txn, cg1, 202), 0);
+
+	ASSERT_EQ(cgroup_txn_commit(txn, CGFLAG_TXN_ROLLBACK), 0);
+	ASSERT_EQ(cgroup_txn_commit(txn, 0), ECGINVAL);
+
+	ASSERT_EQ(cgroup_txn_result(txn, 0), 0);
+	ASSERT_EQ(cgroup_txn_result(txn, 4), 0);
+	ASSERT_EQ(cgroup_txn_result(txn, 5), ECGINVAL);
+
+	ASSERT_EQ(cgroup_txn_result(txn, 3), 0);
+	ASSERT_TRUE(Exists("cg0/a"));
+	ASSERT_EQ(ReadFile("cg1/cpu.weight").substr(0, 3), "200");
+	ASSERT_EQ(ReadFile("cg1/cgroup.procs"), "101202");
+}
+
+TEST_F(TxnTest, Rollback)
+{
+	struct cgroup *created, *cg1;
+
+	cg1 = Group("cg1");
+	ASSERT_NE(cg1, nullptr);
+	ASSERT_EQ(cgroup_set_value_string(cg1->controller[0], "cpu.weight", "200"), 0);
+	created = Group("cg0/x");
+	ASSERT_NE(created, nullptr);
+
+	ASSERT_EQ(cgroup_txn_add_create(txn, created, 1), 0);
+	ASSERT_EQ(cgroup_txn_add_modify(txn, cg1), 0);
+	/* The new directory has no cgroup.procs, the move fails */
+	ASSERT_EQ(cgroup_txn_add_attach(txn, created, 101), 0);
+
+	ASSERT_NE(cgroup_txn_commit(txn, CGFLAG_TXN_ROLLBACK), 0);
+	ASSERT_EQ(cgroup_txn_result(txn, 0), 0);
+	ASSERT_EQ(cgroup_txn_result(txn, 1), 0);
+	ASSERT_NE(cgroup_txn_result(txn, 2), 0);
+
+	ASSERT_FALSE(Exists("cg0/x"));
+	ASSERT_EQ(ReadFile("cg1/cpu.weight").substr(0, 3), "100");
+}
+
+TEST_F(TxnTest, NoRollback)
+{
+	struct cgroup *missing, *created;
+
+	missing = Group("cg9/y");
+	ASSERT_NE(missing, nullptr);
+	created = Group("cg0/y");
+	ASSERT_NE(created, nullptr);
+
+	/* Every operation is tried */
+	ASSERT_EQ(cgroup_txn_add_attach(txn, missing, 101), 0);
+	ASSERT_EQ(cgroup_txn_add_create(txn, created, 1), 0);
+
+	ASSERT_NE(cgroup_txn_commit(txn, 0), 0);
+	ASSERT_NE(cgroup_txn_result(txn, 0), 0);
+	ASSERT_EQ(cgroup_txn_result(txn, 1), 0);
+	ASSERT_TRUE(Exists("cg0/y"));
+}
@@ -0,0 +1,106 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the snapshot of the controllers walked by the
+ * controller iterators
+ */
+
+#include <fstream>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test054controllers";
+
+class ControllersTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = CGROUP_V2;
+		opts.depth = 1;
+		opts.fanout = 1;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+	}
+
+	void TearDown() override
+	{
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	std::string MountedAll()
+	{
+		struct cgroup_mount_point info;
+		void *handle = NULL;
+		std::string names;
+		int ret;
+
+		ret = cgroup_get_controller_begin(&handle, &info);
+		while (ret == 0) {
+			names += std::string(info.name) + " ";
+			ret = cgroup_get_controller_next(&handle, &info);
+		}
+		EXPECT_EQ(ret, ECGEOF);
+		cgroup_get_controller_end(&handle);
+
+		return names;
+	}
+};
+
+TEST_F(ControllersTest, MountedControllers)
+{
+	static const char * const v1[] = { "cgroup", "cpu", "memory" };
+	struct cgroup_mount_point info;
+	void *handle = NULL;
+
+	ASSERT_EQ(MountedAll(), "cpu memory pids ");
+
+	/* The "cgroup" pseudo-controller is hidden */
+	cgroup_fixture_mount_table(fixture.root, v1, 3, CGROUP_V1);
+	ASSERT_EQ(cgroup_get_controller_begin(&handle, &info), 0);
+	ASSERT_STREQ(info.name, "cpu");
+	ASSERT_EQ(std::string(info.path), std::string(fixture.root) + "/cpu");
+
+	/* A new mount table does not change a walk in progress */
+	cgroup_fixture_mount(&fixture);
+	ASSERT_EQ(cgroup_get_controller_next(&handle, &info), 0);
+	ASSERT_STREQ(info.name, "memory");
+	ASSERT_EQ(cgroup_get_controller_next(&handle, &info), ECGEOF);
+	ASSERT_EQ(cgroup_get_controller_end(&handle), 0);
+	ASSERT_EQ(handle, nullptr);
+
+	ASSERT_EQ(MountedAll(), "cpu memory pids ");
+}
+
+TEST_F(ControllersTest, V2OnlyControllers)
+{
+	struct controller_data info;
+	void *handle = NULL;
+	bool found = false;
+	int ret;
+
+	/* A controller of the cgroup v2 root which /proc/cgroups does not list */
+	std::ofstream(std::string(fixture.root) + "/cgroup.controllers") << "cpu zzctl\n";
+	cgroup_fixture_mount(&fixture);
+
+	ret = cgroup_get_all_controller_begin(&handle, &info);
+	while (ret == 0) {
+		if (std::string(info.name) == "zzctl") {
+			ASSERT_EQ(info.hierarchy, 0);
+			ASSERT_EQ(info.enabled, 1);
+			found = true;
+		}
+		ret = cgroup_get_all_controller_next(&handle, &info);
+	}
+	ASSERT_EQ(ret, ECGEOF);
+	ASSERT_EQ(cgroup_get_all_controller_end(&handle), 0);
+	ASSERT_TRUE(found);
+}
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the rewind of the read handles of values and stats
+ */
+
+#include <fstream>
+#include <string>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test055readhandle";
+
+class ReadHandleTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+	void *handle = NULL;
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = CGROUP_V2;
+		opts.depth = 1;
+		opts.fanout = 1;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+	}
+
+	void TearDown() override
+	{
+		if (handle)
+			cgroup_read_value_end(&handle);
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	/* Rewritten in place, the open handle sees the new content */
+	void WriteFile(const std::string &name, const std::string &content)
+	{
+		std::ofstream(std::string(fixture.root) + "/cg0/" + name) << content;
+	}
+};
+
+TEST_F(ReadHandleTest, StatsRewind)
+{
+	struct cgroup_stat stat;
+
+	WriteFile("cpu.stat", "usage_usec 100\nuser_usec 60\n");
+
+	ASSERT_EQ(cgroup_read_stats_begin("cpu", "cg0", &handle, &stat), 0);
+	ASSERT_STREQ(stat.name, "usage_usec");
+	ASSERT_STREQ(stat.value, "100\n");
+	ASSERT_EQ(cgroup_read_stats_next(&handle, &stat), 0);
+	ASSERT_STREQ(stat.name, "user_usec");
+	ASSERT_EQ(cgroup_read_stats_next(&handle, &stat), ECGEOF);
+
+	WriteFile("cpu.stat", "usage_usec 250\n");
+	ASSERT_EQ(cgroup_read_stats_rewind(&handle, &stat), 0);
+	ASSERT_STREQ(stat.name, "usage_usec");
+	ASSERT_STREQ(stat.value, "250\n");
+	ASSERT_EQ(cgroup_read_stats_next(&handle, &stat), ECGEOF);
+
+	ASSERT_EQ(cgroup_read_stats_end(&handle), 0);
+	ASSERT_EQ(handle, nullptr);
+}
+
+TEST_F(ReadHandleTest, ValueRewind)
+{
+	char buffer[8];
+
+	WriteFile("cpu.max", "max 100000\n");
+
+	/* Like fgets(), a long line is returned in pieces */
+	ASSERT_EQ(cgroup_read_value_begin("cpu", "cg0", "cpu.max", &handle, buffer,
+					  sizeof(buffer)), 0);
+	ASSERT_STREQ(buffer, "max 100");
+	ASSERT_EQ(cgroup_read_value_next(&handle, buffer, sizeof(buffer)), 0);
+	ASSERT_STREQ(buffer, "000\n");
+	ASSERT_EQ(cgroup_read_value_next(&handle, buffer, sizeof(buffer)), ECGEOF);
+
+	WriteFile("cpu.max", "5000");
+	ASSERT_EQ(cgroup_read_value_rewind(&handle, buffer, sizeof(buffer)), 0);
+	ASSERT_STREQ(buffer, "5000");
+
+	WriteFile("cpu.max", "");
+	ASSERT_EQ(cgroup_read_value_rewind(&handle, buffer, sizeof(buffer)), ECGEOF);
+}
+
+TEST_F(ReadHandleTest, ReadError)
+{
+	std::string dir = std::string(fixture.root) + "/cg0/cpu.dir";
+	char buffer[8];
+
+	/* A directory opens but cannot be read, no handle is left behind */
+	ASSERT_EQ(mkdir(dir.c_str(), 0755), 0);
+	handle = buffer;
+	ASSERT_EQ(cgroup_read_value_begin("cpu", "cg0", "cpu.dir", &handle, buffer,
+					  sizeof(buffer)), ECGEOF);
+	ASSERT_EQ(handle, nullptr);
+	ASSERT_EQ(rmdir(dir.c_str()), 0);
+}
+
+TEST_F(ReadHandleTest, MapRewind)
+{
+	const char * const keys[] = { "user_usec", "usage_usec" };
+	struct cgroup_stat_map *map;
+	struct cgroup_stat stat;
+	u_int64_t values[2];
+	std::string content;
+	int i;
+
+	map = cgroup_stat_map_new(keys, 2);
+	ASSERT_NE(map, nullptr);
+
+	/* Larger than the first buffer of the handle, the last line without \n */
+	for (i = 0; i < 500; i++)
+		content += "nr_periods_" + std::to_string(i) + " 1\n";
+	WriteFile("cpu.stat", "usage_usec 100\n" + content + "user_usec 60");
+
+	ASSERT_EQ(cgroup_read_stats_begin("cpu", "cg0", &handle, &stat), 0);
+	ASSERT_EQ(cgroup_read_stats_map_rewind(&handle, map, values), 0);
+	ASSERT_EQ(values[0], 60);
+	ASSERT_EQ(values[1], 100);
+	ASSERT_EQ(cgroup_read_stats_next(&handle, &stat), ECGEOF);
+
+	WriteFile("cpu.stat", "usage_usec 300\n");
+	ASSERT_EQ(cgroup_read_stats_map_rewind(&handle, map, values), 0);
+	ASSERT_EQ(values[0], 0);
+	ASSERT_EQ(values[1], 300);
+
+	cgroup_stat_map_free(&map);
+}
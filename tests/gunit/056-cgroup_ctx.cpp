@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the contexts of the library
+ */
+
+#include <string>
+#include <thread>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const CPU_ONLY[] = { "cpu" };
+static const char * const MEMORY_ONLY[] = { "memory" };
+
+class CtxTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_ctx *ctx = NULL;
+
+	void SetUp() override
+	{
+		ctx = cgroup_ctx_new();
+		ASSERT_NE(ctx, nullptr);
+		cgroup_fixture_mount_table("/ctx-default", CPU_ONLY, 1, CGROUP_V2);
+	}
+
+	void TearDown() override
+	{
+		cgroup_ctx_free(&ctx);
+		ASSERT_EQ(ctx, nullptr);
+		ASSERT_EQ(cgroup_ctx_use(NULL), nullptr);
+	}
+};
+
+TEST_F(CtxTest, OwnMountTable)
+{
+	char path[FILENAME_MAX];
+
+	ASSERT_EQ(cgroup_ctx_use(ctx), nullptr);
+
+	/* A new context is not initialized */
+	ASSERT_EQ(cgroup_initialized, 0);
+	ASSERT_EQ(cg_mount_table_find("cpu"), -1);
+
+	cgroup_fixture_mount_table("/ctx-own", MEMORY_ONLY, 1, CGROUP_V2);
+	systemd_default_cgroup[0] = '\0';
+	ASSERT_EQ(cg_mount_table_find("cpu"), -1);
+	ASSERT_EQ(cg_mount_table_find("memory"), 0);
+	ASSERT_NE(cg_build_path("grp", path, "memory"), nullptr);
+	ASSERT_STREQ(path, "/ctx-own/grp/");
+
+	/* The default context is left alone */
+	ASSERT_EQ(cgroup_ctx_use(NULL), ctx);
+	ASSERT_EQ(cg_mount_table_find("cpu"), 0);
+	ASSERT_EQ(cg_mount_table_find("memory"), -1);
+	ASSERT_STREQ(cg_cgroup_v2_mount_path, "/ctx-default");
+}
+
+TEST_F(CtxTest, PerThread)
+{
+	int found = -2;
+
+	/* Another thread starts in the default context */
+	cgroup_ctx_use(ctx);
+	cgroup_fixture_mount_table("/ctx-own", MEMORY_ONLY, 1, CGROUP_V2);
+
+	std::thread([&found]() {
+		found = cg_mount_table_find("cpu");
+	}).join();
+	ASSERT_EQ(found, 0);
+
+	std::thread([this, &found]() {
+		cgroup_ctx_use(ctx);
+		found = cg_mount_table_find("memory");
+	}).join();
+	ASSERT_EQ(found, 0);
+
+	/* The thread goes back to the default context when freeing its own */
+	cgroup_ctx_free(&ctx);
+	ASSERT_EQ(cg_mount_table_find("cpu"), 0);
+}
@@ -0,0 +1,169 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the C++ interface
+ */
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup.hpp"
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test057hpp";
+
+class HppTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = CGROUP_V2;
+		opts.depth = 2;
+		opts.fanout = 2;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+		cg_subtree_cache_invalidate();
+	}
+
+	void TearDown() override
+	{
+		cg_subtree_cache_invalidate();
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	std::string ReadFile(const std::string &name)
+	{
+		std::stringstream content;
+		std::ifstream file(std::string(fixture.root) + "/" + name);
+
+		content << file.rdbuf();
+
+		return content.str();
+	}
+
+	void WriteFile(const std::string &name, const std::string &content)
+	{
+		std::ofstream(std::string(fixture.root) + "/" + name) << content;
+	}
+};
+
+TEST_F(HppTest, Cgroup)
+{
+	libcgroup::Cgroup cg("cg1");
+	libcgroup::Controller cpu;
+	int count = 0;
+
+	static_assert(libcgroup::controllers::cpu.name() == "cpu", "constexpr name");
+
+	cpu = cg.add_controller(libcgroup::controllers::cpu);
+	cpu.set("cpu.weight", "200").set("cpu.weight", "300");
+	ASSERT_EQ(cpu.value("cpu.weight"), "300");
+	ASSERT_FALSE(cg.controller("memory"));
+	ASSERT_EQ(cg.controller("cpu").name(), "cpu");
+
+	for (const auto &value : cpu.values()) {
+		ASSERT_EQ(value.name, "cpu.weight");
+		ASSERT_EQ(value.value, "300");
+		count++;
+	}
+	ASSERT_EQ(count, 1);
+
+	for (const auto &controller : cg.controllers())
+		ASSERT_EQ(controller.name(), "cpu");
+
+	cg.modify();
+	ASSERT_EQ(ReadFile("cg1/cpu.weight").substr(0, 3), "300");
+
+	/* The group moves, the controller stays with it */
+	libcgroup::Cgroup moved(std::move(cg));
+	ASSERT_EQ(cg.get(), nullptr);
+	ASSERT_EQ(moved.name(), "cg1");
+	ASSERT_EQ(moved.controller("cpu").get(), cpu.get());
+
+	try {
+		cpu.value("cpu.max");
+		FAIL();
+	} catch (const libcgroup::Error &e) {
+		ASSERT_EQ(e.code(), ECGROUPVALUENOTEXIST);
+	}
+}
+
+TEST_F(HppTest, Walk)
+{
+	std::vector<std::string> pre, post;
+
+	for (const auto &info : libcgroup::Walk("cpu", "/", 0, CGROUP_WALK_TYPE_DIRS_ONLY))
+		pre.push_back(std::string(info.full_path));
+	ASSERT_EQ(pre.size(), fixture.groups + 1);
+
+	for (const auto &info : libcgroup::Walk("cpu", "/", 0, CGROUP_WALK_TYPE_POST_DIR |
+						 CGROUP_WALK_TYPE_DIRS_ONLY))
+		post.push_back(std::string(info.full_path));
+	ASSERT_EQ(post.size(), pre.size());
+	ASSERT_EQ(post.back(), pre.front());
+
+	libcgroup::Walk walk("cpu", "/cg0", 1, CGROUP_WALK_TYPE_DIRS_ONLY);
+	auto it = walk.begin();
+	ASSERT_EQ((*it).depth, 0);
+	++it;
+	ASSERT_EQ((*it).depth, 1);
+	ASSERT_EQ((*it).path, "cg0");
+	ASSERT_GE(walk.dirfd(), 0);
+}
+
+TEST_F(HppTest, Stats)
+{
+	std::vector<std::string> names;
+
+	WriteFile("cg0/cpu.stat", "usage_usec 100\nuser_usec 60\n");
+
+	libcgroup::Stats stats("cpu", "cg0");
+	for (const auto &stat : stats) {
+		names.push_back(std::string(stat.name));
+		if (stat.name == "usage_usec")
+			ASSERT_EQ(stat.value, "100");
+	}
+	ASSERT_EQ(names, std::vector<std::string>({ "usage_usec", "user_usec" }));
+
+	/* The open file is read again */
+	WriteFile("cg0/cpu.stat", "usage_usec 250\n");
+	stats.rewind();
+	auto it = stats.begin();
+	ASSERT_EQ((*it).value, "250");
+	ASSERT_EQ(++it, stats.end());
+
+	try {
+		libcgroup::Stats missing("cpu", "cg9");
+		FAIL();
+	} catch (const libcgroup::Error &e) {
+		ASSERT_NE(e.code(), 0);
+	}
+}
+
+TEST_F(HppTest, Pids)
+{
+	libcgroup::Pids pids;
+	std::vector<pid_t> read;
+
+	WriteFile("cg0/cgroup.procs", "34\n12\n");
+	WriteFile("cg1/cgroup.procs", "56\n");
+
+	for (pid_t pid : pids.read("cg0"))
+		read.push_back(pid);
+	ASSERT_EQ(read, std::vector<pid_t>({ 12, 34 }));
+
+	/* The buffer of the first read is reused */
+	const pid_t *data = pids.data();
+	ASSERT_EQ(pids.read("cg1").size(), 1);
+	ASSERT_EQ(pids.data(), data);
+	ASSERT_EQ(pids[0], 56);
+}
@@ -0,0 +1,158 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the reductions of values over subtrees
+ */
+
+#include <fstream>
+#include <string>
+using namespace std;
+
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "libcgroup-internal.h"
+#include "cgroup-fixture.h"
+
+static const char * const FIXTURE_DIR = "test058rollup";
+
+class RollupTest : public ::testing::Test {
+	protected:
+
+	struct cgroup_fixture fixture = { };
+	struct cgroup_rollup *rollup = NULL;
+
+	void SetUp() override
+	{
+		struct cgroup_fixture_opts opts = { };
+
+		opts.root = FIXTURE_DIR;
+		opts.version = CGROUP_V2;
+		opts.depth = 2;
+		opts.fanout = 2;
+		ASSERT_EQ(cgroup_fixture_create(&opts, &fixture), 0);
+		cgroup_fixture_mount(&fixture);
+
+		/* Like the kernel, the root group has no memory.current */
+		ASSERT_EQ(unlink((string(fixture.root) + "/memory.current").c_str()), 0);
+		ofstream(string(fixture.root) + "/cpu.stat") << "usage_usec 500\nnr_throttled 1\n";
+
+		/* The kernel totals memory.current and usage_usec over the subtree */
+		WriteFile("cg0", "100", 50, 3);
+		WriteFile("cg0/cg0", "10", 20, 1);
+		WriteFile("cg0/cg1", "40", 30, 2);
+		WriteFile("cg1", "7", 5, 0);
+		WriteFile("cg1/cg0", "3", 2, 4);
+		WriteFile("cg1/cg1", "4", 3, 0);
+	}
+
+	void TearDown() override
+	{
+		cgroup_rollup_free(&rollup);
+		ASSERT_EQ(rollup, nullptr);
+		ASSERT_EQ(cgroup_fixture_destroy(&fixture), 0);
+	}
+
+	void WriteFile(const string &group, const string &current, int usage, int throttled)
+	{
+		string dir = string(fixture.root) + "/" + group;
+
+		ofstream(dir + "/memory.current") << current << "\n";
+		ofstream(dir + "/cpu.stat") << "usage_usec " << usage << "\nnr_throttled " <<
+					       throttled << "\n";
+	}
+};
+
+TEST_F(RollupTest, Reductions)
+{
+	static const struct cgroup_rollup_key keys[] = {
+		{ "memory.current", NULL, CGROUP_ROLLUP_SUM },
+		{ "memory.current", NULL, CGROUP_ROLLUP_MAX },
+		{ "memory.current", NULL, CGROUP_ROLLUP_COUNT },
+		{ "cpu.stat", "usage_usec", CGROUP_ROLLUP_SUM },
+		{ "cpu.stat", "nr_throttled", CGROUP_ROLLUP_SUM },
+		{ "cpu.stat", "nr_throttled", CGROUP_ROLLUP_MAX },
+	};
+	const struct cgroup_rollup_node *nodes;
+	int count;
+
+	ASSERT_EQ(cgroup_rollup_read("memory", "/", 0, 4, keys, ARRAY_SIZE(keys), &rollup), 0);
+	nodes = cgroup_rollup_nodes(rollup, &count);
+	ASSERT_EQ(count, fixture.groups + 1);
+
+	/* Pre-order, sorted by name */
+	ASSERT_STREQ(nodes[0].path, "/");
+	ASSERT_EQ(nodes[0].parent, -1);
+	ASSERT_STREQ(nodes[1].path, "/cg0");
+	ASSERT_STREQ(nodes[2].path, "/cg0/cg0");
+	ASSERT_EQ(nodes[2].parent, 1);
+	ASSERT_EQ(nodes[2].depth, 2);
+	ASSERT_STREQ(nodes[4].path, "/cg1");
+	ASSERT_EQ(nodes[4].parent, 0);
+
+	/* The root has no memory.current, its children are summed */
+	ASSERT_EQ(nodes[0].values[0], 107);
+	ASSERT_EQ(nodes[1].values[0], 100);
+	ASSERT_EQ(nodes[2].values[0], 10);
+
+	/* The maximum of the leaves */
+	ASSERT_EQ(nodes[0].values[1], 40);
+	ASSERT_EQ(nodes[4].values[1], 4);
+	ASSERT_EQ(nodes[5].values[1], 3);
+
+	ASSERT_EQ(nodes[0].values[2], fixture.groups);
+	ASSERT_EQ(nodes[1].values[2], 3);
+
+	ASSERT_EQ(nodes[0].values[3], 500);
+	ASSERT_EQ(nodes[1].values[3], 50);
+
+	/* nr_throttled is not hierarchical */
+	ASSERT_EQ(nodes[0].values[4], 11);
+	ASSERT_EQ(nodes[1].values[4], 6);
+	ASSERT_EQ(nodes[0].values[5], 4);
+	ASSERT_EQ(nodes[1].values[5], 2);
+}
+
+TEST_F(RollupTest, Subtree)
+{
+	static const struct cgroup_rollup_key keys[] = {
+		{ "cpu.stat", "nr_throttled", CGROUP_ROLLUP_SUM },
+		{ "cpu.stat", "nr_throttled", CGROUP_ROLLUP_MAX },
+	};
+	const struct cgroup_rollup_node *nodes;
+	int count;
+
+	ASSERT_EQ(cgroup_rollup_read("cpu", "cg1/", 0, 1, keys, ARRAY_SIZE(keys), &rollup), 0);
+	nodes = cgroup_rollup_nodes(rollup, &count);
+	ASSERT_EQ(count, 3);
+	ASSERT_STREQ(nodes[0].path, "cg1/");
+	ASSERT_STREQ(nodes[1].path, "cg1/cg0");
+	ASSERT_EQ(nodes[0].values[0], 4);
+	cgroup_rollup_free(&rollup);
+
+	/* The groups below the depth are not read, cg0 is a leaf */
+	ASSERT_EQ(cgroup_rollup_read("cpu", "/", 1, 2, keys, ARRAY_SIZE(keys), &rollup), 0);
+	nodes = cgroup_rollup_nodes(rollup, &count);
+	ASSERT_EQ(count, 3);
+	ASSERT_EQ(nodes[0].values[0], 4);
+	ASSERT_EQ(nodes[0].values[1], 3);
+}
+
+TEST_F(RollupTest, Errors)
+{
+	static const struct cgroup_rollup_key mixed[] = {
+		{ "cpu.stat", "usage_usec", CGROUP_ROLLUP_SUM },
+		{ "cpu.stat", NULL, CGROUP_ROLLUP_SUM },
+	};
+	static const struct cgroup_rollup_key current[] = {
+		{ "memory.current", NULL, CGROUP_ROLLUP_SUM },
+	};
+
+	ASSERT_EQ(cgroup_rollup_read("cpu", "/", 0, 2, mixed, ARRAY_SIZE(mixed), &rollup),
+		  ECGINVAL);
+	ASSERT_EQ(rollup, nullptr);
+
+	ofstream(string(fixture.root) + "/cg1/cg0/memory.current") << "many\n";
+	ASSERT_EQ(cgroup_rollup_read("memory", "/", 0, 2, current, 1, &rollup), ECGINVAL);
+	ASSERT_EQ(rollup, nullptr);
+}
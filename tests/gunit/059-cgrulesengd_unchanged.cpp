@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the unchanged processes and the changed parents
+ * of cgrulesengd
+ */
+
+#include <string.h>
+
+#include "gtest/gtest.h"
+
+#include "daemon/cgrulesengd.h"
+
+/* Beyond pid_max, nothing in /proc is looked at anyway */
+static const pid_t FIRST_PID = 5000000;
+
+static struct proc_event ForkEvent(pid_t parent, pid_t child, u_int64_t timestamp)
+{
+	struct proc_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.what = proc_event::PROC_EVENT_FORK;
+	ev.timestamp_ns = timestamp;
+	ev.event_data.fork.parent_pid = parent;
+	ev.event_data.fork.child_pid = child;
+
+	return ev;
+}
+
+static struct proc_event ExitEvent(pid_t pid)
+{
+	struct proc_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.what = proc_event::PROC_EVENT_EXIT;
+	ev.event_data.exit.process_pid = pid;
+
+	return ev;
+}
+
+TEST(CgrulesengdUnchangedTest, StoreAndRemove)
+{
+	ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID), 0);
+
+	ASSERT_EQ(cgre_store_unchanged_process(FIRST_PID, 0), 0);
+	ASSERT_EQ(cgre_store_unchanged_process(FIRST_PID + 1, CGROUP_DAEMON_UNCHANGE_CHILDREN), 0);
+	/* Stored twice, the first flags stay */
+	ASSERT_EQ(cgre_store_unchanged_process(FIRST_PID, CGROUP_DAEMON_UNCHANGE_CHILDREN), 0);
+
+	ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID), 1);
+	ASSERT_EQ(cgre_is_unchanged_child(FIRST_PID), 0);
+	ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID + 1), 1);
+	ASSERT_EQ(cgre_is_unchanged_child(FIRST_PID + 1), 1);
+
+	cgre_remove_unchanged_process(FIRST_PID);
+	ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID), 0);
+	ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID + 1), 1);
+
+	/* Removing an unknown process changes nothing */
+	cgre_remove_unchanged_process(FIRST_PID);
+	cgre_remove_unchanged_process(FIRST_PID + 1);
+	ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID + 1), 0);
+}
+
+TEST(CgrulesengdUnchangedTest, ManyProcesses)
+{
+	const int cnt = 5000;
+	int i;
+
+	/* Grows the table past its initial size, several times */
+	for (i = 0; i < cnt; i++)
+		ASSERT_EQ(cgre_store_unchanged_process(FIRST_PID + i, i % 2), 0);
+	for (i = 0; i < cnt; i++)
+		ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID + i), 1);
+
+	/* The tombstones of the removed processes do not hide the others */
+	for (i = 0; i < cnt; i += 2)
+		cgre_remove_unchanged_process(FIRST_PID + i);
+	for (i = 0; i < cnt; i++)
+		ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID + i), i % 2);
+
+	/* Nor do they fill the table as processes come and go */
+	for (i = 0; i < 10 * cnt; i++) {
+		ASSERT_EQ(cgre_store_unchanged_process(FIRST_PID + cnt + i, 0), 0);
+		cgre_remove_unchanged_process(FIRST_PID + cnt + i);
+	}
+	for (i = 1; i < cnt; i += 2)
+		ASSERT_EQ(cgre_is_unchanged_child(FIRST_PID + i), 1);
+
+	for (i = 1; i < cnt; i += 2)
+		cgre_remove_unchanged_process(FIRST_PID + i);
+	for (i = 0; i < cnt; i++)
+		ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID + i), 0);
+}
+
+TEST(CgrulesengdUnchangedTest, ForkAndExit)
+{
+	struct proc_event ev;
+
+	ASSERT_EQ(cgre_store_unchanged_process(FIRST_PID, CGROUP_DAEMON_UNCHANGE_CHILDREN), 0);
+	ASSERT_EQ(cgre_store_unchanged_process(FIRST_PID + 1, 0), 0);
+
+	/* The children of a sticky parent are sticky */
+	ev = ForkEvent(FIRST_PID, FIRST_PID + 2, 0);
+	ASSERT_EQ(cgre_process_event(&ev, proc_event::PROC_EVENT_FORK), 0);
+	ASSERT_EQ(cgre_is_unchanged_child(FIRST_PID + 2), 1);
+
+	/* Unless the parent only keeps its own group */
+	ev = ForkEvent(FIRST_PID + 1, FIRST_PID + 3, 0);
+	ASSERT_EQ(cgre_process_event(&ev, proc_event::PROC_EVENT_FORK), 0);
+	ASSERT_EQ(cgre_is_unchanged_process(FIRST_PID + 3), 0);
+
+	/* The exits forget them */
+	for (pid_t pid = FIRST_PID; pid < FIRST_PID + 3; pid++) {
+		ev = ExitEvent(pid);
+		ASSERT_EQ(cgre_process_event(&ev, proc_event::PROC_EVENT_EXIT), 0);
+		ASSERT_EQ(cgre_is_unchanged_process(pid), 0);
+	}
+}
+
+TEST(CgrulesengdUnchangedTest, ParentChangedWhenForking)
+{
+	struct proc_event ev;
+	u_int64_t before;
+
+	before = cgre_now_ns();
+	ASSERT_EQ(cgre_store_parent_info(FIRST_PID), 0);
+	ASSERT_EQ(cgre_store_parent_info(FIRST_PID), 0);
+
+	/* Forked before the change, the child has to be moved too */
+	ev = ForkEvent(FIRST_PID, FIRST_PID + 1, before);
+	ASSERT_EQ(cgre_was_parent_changed_when_forking(&ev), 1);
+	ev = ForkEvent(FIRST_PID + 2, FIRST_PID + 3, before);
+	ASSERT_EQ(cgre_was_parent_changed_when_forking(&ev), 0);
+
+	/* A later fork expires both changes */
+	ev = ForkEvent(FIRST_PID, FIRST_PID + 1, cgre_now_ns());
+	ASSERT_EQ(cgre_was_parent_changed_when_forking(&ev), 0);
+	ev = ForkEvent(FIRST_PID, FIRST_PID + 1, before);
+	ASSERT_EQ(cgre_was_parent_changed_when_forking(&ev), 0);
+}
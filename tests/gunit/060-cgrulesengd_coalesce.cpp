@@ -0,0 +1,190 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the coalescing of the events of cgrulesengd
+ */
+
+#include <string.h>
+
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "gtest/gtest.h"
+
+#include "daemon/cgrulesengd.h"
+
+/* Beyond pid_max, the events of the same process */
+static const pid_t PID = 5000000;
+
+class CoalesceTest : public ::testing::Test {
+	protected:
+
+	/* Knows no process, a delivered event reads it and is done */
+	struct cgre_trace trace = { };
+
+	void SetUp() override
+	{
+		replay_trace = &trace;
+		coalesce_ms = 1000;
+	}
+
+	void TearDown() override
+	{
+		ASSERT_EQ(cgre_flush_pending(1), 0);
+		replay_trace = NULL;
+		coalesce_ms = CGRE_COALESCE_MS;
+		event_filter_sk = -1;
+	}
+
+	/* The events classified so far */
+	u_int64_t Delivered(void)
+	{
+		return cgre_stats.proc_read.count;
+	}
+};
+
+static struct proc_event IdEvent(enum proc_event::what what, pid_t pid)
+{
+	struct proc_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.what = what;
+	switch (what) {
+	case proc_event::PROC_EVENT_EXEC:
+		ev.event_data.exec.process_pid = pid;
+		ev.event_data.exec.process_tgid = pid;
+		break;
+	case proc_event::PROC_EVENT_UID:
+	case proc_event::PROC_EVENT_GID:
+		ev.event_data.id.process_pid = pid;
+		ev.event_data.id.process_tgid = pid;
+		break;
+	case proc_event::PROC_EVENT_EXIT:
+		ev.event_data.exit.process_pid = pid;
+		ev.event_data.exit.process_tgid = pid;
+		break;
+	default:
+		break;
+	}
+
+	return ev;
+}
+
+TEST_F(CoalesceTest, Merged)
+{
+	u_int64_t delivered = Delivered(), coalesced = cgre_stats.coalesced;
+	struct proc_event ev;
+
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ev = IdEvent(proc_event::PROC_EVENT_UID, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ev = IdEvent(proc_event::PROC_EVENT_GID, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, PID + 1);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ASSERT_EQ(cgre_stats.coalesced, coalesced + 2);
+
+	/* Their window is not over yet */
+	ASSERT_EQ(cgre_flush_pending(0), 0);
+	ASSERT_EQ(Delivered(), delivered);
+
+	/* One classification per process */
+	ASSERT_EQ(cgre_flush_pending(1), 0);
+	ASSERT_EQ(Delivered(), delivered + 2);
+}
+
+TEST_F(CoalesceTest, Disabled)
+{
+	u_int64_t delivered = Delivered();
+	struct proc_event ev;
+
+	coalesce_ms = 0;
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ev = IdEvent(proc_event::PROC_EVENT_UID, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ASSERT_EQ(Delivered(), delivered + 2);
+}
+
+TEST_F(CoalesceTest, ExitCancels)
+{
+	u_int64_t delivered = Delivered(), coalesced = cgre_stats.coalesced;
+	struct proc_event ev;
+
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ev = IdEvent(proc_event::PROC_EVENT_EXIT, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ASSERT_EQ(cgre_stats.coalesced, coalesced + 1);
+
+	ASSERT_EQ(cgre_flush_pending(1), 0);
+	ASSERT_EQ(Delivered(), delivered);
+
+	/* A new process with the same pid starts a new window */
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ASSERT_EQ(cgre_flush_pending(1), 0);
+	ASSERT_EQ(Delivered(), delivered + 1);
+}
+
+TEST_F(CoalesceTest, ForkDeliversParent)
+{
+	u_int64_t delivered = Delivered();
+	struct proc_event ev;
+
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, PID);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ASSERT_EQ(Delivered(), delivered);
+
+	/* The parent is classified before its child may follow it */
+	memset(&ev, 0, sizeof(ev));
+	ev.what = proc_event::PROC_EVENT_FORK;
+	ev.event_data.fork.parent_pid = PID;
+	ev.event_data.fork.parent_tgid = PID;
+	ev.event_data.fork.child_pid = PID + 1;
+	ev.event_data.fork.child_tgid = PID + 1;
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ASSERT_EQ(Delivered(), delivered + 1);
+
+	ASSERT_EQ(cgre_flush_pending(1), 0);
+	ASSERT_EQ(Delivered(), delivered + 1);
+}
+
+TEST_F(CoalesceTest, ExitedBeforeDelivery)
+{
+	u_int64_t delivered, coalesced;
+	struct proc_event ev;
+	pid_t pid;
+
+	/* With the exits filtered out, the process is checked on delivery */
+	event_filter_sk = STDIN_FILENO;
+
+	pid = fork();
+	ASSERT_GE(pid, 0);
+	if (pid == 0) {
+		pause();
+		_exit(0);
+	}
+
+	delivered = Delivered();
+	coalesced = cgre_stats.coalesced;
+
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, pid);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, getpid());
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+
+	ASSERT_EQ(kill(pid, SIGKILL), 0);
+	ASSERT_EQ(waitpid(pid, NULL, 0), pid);
+
+	/* The exited process is dropped, the live one classified */
+	ASSERT_EQ(cgre_flush_pending(1), 0);
+	ASSERT_EQ(cgre_stats.coalesced, coalesced + 1);
+	ASSERT_EQ(Delivered(), delivered + 1);
+
+	/* An event of a process gone already is not kept */
+	ev = IdEvent(proc_event::PROC_EVENT_EXEC, pid);
+	ASSERT_EQ(cgre_coalesce_event(&ev), 0);
+	ASSERT_EQ(Delivered(), delivered + 2);
+}
@@ -0,0 +1,109 @@
+/* SPDX-License-Identifier: LGPL-2.1-only */
+/**
+ * libcgroup googletest for the groups created by the replay of cgrulesengd
+ */
+
+#include <string>
+using namespace std;
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <ftw.h>
+
+#include "gtest/gtest.h"
+
+#include "daemon/cgrulesengd.h"
+
+static const char * const PARENT_DIR = "test061stub";
+static const string ROOT = string(PARENT_DIR) + "/root";
+static const string OUTSIDE = string(PARENT_DIR) + "/outside";
+static const mode_t MODE = S_IRWXU | S_IRWXG | S_IRWXO;
+
+static int unlink_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+static bool exists(const string &path)
+{
+	struct stat st;
+
+	return lstat(path.c_str(), &st) == 0;
+}
+
+class TraceStubTest : public ::testing::Test {
+	protected:
+
+	void SetUp() override
+	{
+		ASSERT_EQ(mkdir(PARENT_DIR, MODE), 0);
+		ASSERT_EQ(mkdir(ROOT.c_str(), MODE), 0);
+		ASSERT_EQ(mkdir(OUTSIDE.c_str(), MODE), 0);
+		/* Planted by a recording to reach out of the hierarchy */
+		ASSERT_EQ(symlink("../outside", (ROOT + "/link").c_str()), 0);
+
+		ASSERT_EQ(cgre_trace_stub_add_root(ROOT.c_str()), 0);
+
+		if (cgre_trace_stub_group(ROOT.c_str()) && errno == ENOSYS)
+			GTEST_SKIP() << "openat2() is not supported";
+	}
+
+	void TearDown() override
+	{
+		cgre_trace_stub_free_roots();
+		ASSERT_EQ(nftw(PARENT_DIR, unlink_cb, 64, FTW_DEPTH | FTW_PHYS), 0);
+	}
+};
+
+TEST_F(TraceStubTest, Groups)
+{
+	ASSERT_TRUE(exists(ROOT + "/cgroup.procs"));
+	ASSERT_TRUE(exists(ROOT + "/tasks"));
+
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/a").c_str()), 0);
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "//a/b").c_str()), 0);
+	/* Recorded again, the group is left alone */
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/a/b").c_str()), 0);
+
+	ASSERT_TRUE(exists(ROOT + "/a/cgroup.procs"));
+	ASSERT_TRUE(exists(ROOT + "/a/tasks"));
+	ASSERT_TRUE(exists(ROOT + "/a/b/cgroup.procs"));
+	ASSERT_TRUE(exists(ROOT + "/a/b/tasks"));
+
+	/* The parents are recorded first */
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/c/d").c_str()), 1);
+	ASSERT_FALSE(exists(ROOT + "/c"));
+}
+
+TEST_F(TraceStubTest, NotBeneathRoot)
+{
+	ASSERT_EQ(cgre_trace_stub_group((OUTSIDE + "/a").c_str()), -1);
+	/* The root is a prefix of the path, but not one of its directories */
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "x/a").c_str()), -1);
+	ASSERT_FALSE(exists(ROOT + "x"));
+}
+
+TEST_F(TraceStubTest, DotDot)
+{
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/a").c_str()), 0);
+
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/../escape").c_str()), 1);
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/a/../../escape").c_str()), 1);
+	ASSERT_FALSE(exists(string(PARENT_DIR) + "/escape"));
+
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/..").c_str()), 1);
+	ASSERT_FALSE(exists(string(PARENT_DIR) + "/cgroup.procs"));
+}
+
+TEST_F(TraceStubTest, Symlink)
+{
+	/* Neither through a symbolic link */
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/link/x").c_str()), 1);
+	ASSERT_FALSE(exists(OUTSIDE + "/x"));
+
+	/* Nor into it */
+	ASSERT_EQ(cgre_trace_stub_group((ROOT + "/link").c_str()), 1);
+	ASSERT_FALSE(exists(OUTSIDE + "/cgroup.procs"));
+	ASSERT_FALSE(exists(OUTSIDE + "/tasks"));
+}